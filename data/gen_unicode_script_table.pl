@@ -0,0 +1,127 @@
+#!/usr/bin/perl
+
+# Copyright 2016 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Generate unicode_script_table.h from Unicode Scripts.txt and the
+# ScriptType enum of unicode_script.h, as a two-stage table: the code points
+# are cut into blocks of 2^$bits, the distinct blocks are stored once, and
+# every block of code points points to its distinct block.
+#
+# usage: ./gen_unicode_script_table.pl ../src/unicode_script.h < Scripts.txt \
+#          > ../src/unicode_script_table.h
+
+use strict;
+
+my $bits = 7;
+my $block_size = 1 << $bits;
+my $max_codepoint = 0x110000;
+
+# The values of ScriptType, in the order of the enum.
+my %value;
+my @names;
+open(my $header, '<', $ARGV[0]) or die "usage: $0 unicode_script.h";
+my $in_enum = 0;
+while (<$header>) {
+  $in_enum = 1 if /^enum ScriptType/;
+  next unless $in_enum;
+  last if /^};/;
+  if (/^\s+U_(\w+)/) {
+    $value{$1} = scalar(@names);
+    push(@names, $1);
+  }
+}
+close($header);
+die "no ScriptType in $ARGV[0]" unless @names;
+die "ScriptType does not fit in uint8" if @names > 256;
+
+my $version = "";
+my @table = ($value{"Common"}) x $max_codepoint;
+while (<STDIN>) {
+  chomp;
+  $version = $1 if /^# (Scripts-\S+)\.txt/;
+  my ($first, $last, $script);
+  if (/^([0-9A-F]+)\s+;\s+(\S+)\s+\#/) {
+    ($first, $last, $script) = (hex($1), hex($1), $2);
+  } elsif (/^([0-9A-F]+)\.\.([0-9A-F]+)\s+;\s+(\S+)\s+\#/) {
+    ($first, $last, $script) = (hex($1), hex($2), $3);
+  } else {
+    next;
+  }
+  die "unknown script $script" unless exists $value{$script};
+  @table[$first .. $last] = ($value{$script}) x ($last - $first + 1);
+}
+
+my (@index, @blocks, %block_ids);
+for (my $c = 0; $c < $max_codepoint; $c += $block_size) {
+  my $key = join(",", @table[$c .. $c + $block_size - 1]);
+  if (!exists $block_ids{$key}) {
+    $block_ids{$key} = scalar(@blocks);
+    push(@blocks, $key);
+  }
+  push(@index, $block_ids{$key});
+}
+die "too many blocks" if @blocks > 65536;
+
+# Prints the comma separated `values`, 16 per line.
+sub print_values {
+  my @values = @_;
+  for (my $i = 0; $i < @values; $i += 16) {
+    my $end = $i + 15 < $#values ? $i + 15 : $#values;
+    print "    ", join(", ", @values[$i .. $end]), ",\n";
+  }
+}
+
+print <<'END';
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+END
+print "// Generated by data/gen_unicode_script_table.pl from $version.txt.\n";
+print "// Do not edit.\n\n";
+print "#ifndef UNICODE_SCRIPT_TABLE_H_\n";
+print "#define UNICODE_SCRIPT_TABLE_H_\n\n";
+print "#include \"common.h\"\n\n";
+print "namespace sentencepiece {\n";
+print "namespace unicode_script {\n";
+print "namespace {\n\n";
+print "constexpr char32 kMaxCodepoint = 0x", sprintf("%X", $max_codepoint),
+      ";\n";
+print "constexpr int kBlockBits = $bits;\n";
+print "constexpr int kNumScripts = ", scalar(@names), ";\n\n";
+print "// Index into kBlocks of each of the ", $max_codepoint / $block_size,
+      " blocks of code points.\n";
+print "constexpr uint16 kBlockIndex[] = {\n";
+print_values(@index);
+print "};\n\n";
+print "// The ScriptType of every code point of the ", scalar(@blocks),
+      " distinct blocks.\n";
+print "constexpr uint8 kBlocks[] = {\n";
+print_values(map { split(/,/) } @blocks);
+print "};\n\n";
+print "}  // namespace\n";
+print "}  // namespace unicode_script\n";
+print "}  // namespace sentencepiece\n";
+print "#endif  // UNICODE_SCRIPT_TABLE_H_\n";
@@ -0,0 +1,119 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+
+# Copyright 2018 Google Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.!
+
+"""Measures how the batch encoders of the Python module scale with threads.
+
+Runs encode() of a list, i.e., _EncodeAsIdsBatch, and EncodeBatch() with
+every --num_threads on the same inputs, and reports the throughput and the
+parallel efficiency as `spm_benchmark --mode=scaling` does, so that the
+overhead of the Python wrapper can be told apart from the C++ encoder.
+
+  python scaling_benchmark.py --model=m.model --input=test/botchan.txt
+"""
+
+import argparse
+import os
+import time
+
+import sentencepiece as spm
+
+
+def default_num_threads():
+  num_cores = os.cpu_count() or 1
+  values = []
+  n = 1
+  while n < num_cores:
+    values.append(n)
+    n *= 2
+  values.append(num_cores)
+  return values
+
+
+def run(encode, min_time):
+  """Runs `encode` once to warm up and then for at least `min_time` seconds.
+
+  Returns the number of passes per second.
+  """
+  encode()
+  passes = 0
+  start = time.perf_counter()
+  while True:
+    encode()
+    passes += 1
+    seconds = time.perf_counter() - start
+    if seconds >= min_time:
+      return passes / seconds
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+  parser.add_argument('--model', required=True, help='model file')
+  parser.add_argument(
+      '--input', required=True, help='corpus file, one input per line')
+  parser.add_argument(
+      '--num_threads',
+      default='',
+      help='comma separated numbers of threads. The powers of two up to the '
+      'number of cores by default')
+  parser.add_argument(
+      '--min_time', type=float, default=0.5, help='minimum seconds of a run')
+  parser.add_argument(
+      '--output_format', default='text', choices=['text', 'tsv'])
+  args = parser.parse_args()
+
+  sp = spm.SentencePieceProcessor(model_file=args.model)
+  with open(args.input, encoding='utf-8') as f:
+    inputs = [line.rstrip('\n') for line in f if line.strip()]
+  num_bytes = sum(len(line.encode('utf-8')) for line in inputs)
+  num_tokens = sum(len(ids) for ids in sp.encode(inputs))
+  if args.num_threads:
+    num_threads = [int(n) for n in args.num_threads.split(',')]
+  else:
+    num_threads = default_num_threads()
+
+  benchmarks = [
+      ('encode', lambda n: sp.encode(inputs, num_threads=n)),
+      ('EncodeBatch', lambda n: sp.EncodeBatch(inputs, num_threads=n)),
+  ]
+
+  tsv = args.output_format == 'tsv'
+  if tsv:
+    print('benchmark\tthreads\tbytes_per_second\ttokens_per_second\t'
+          'efficiency')
+  else:
+    print('{:<12} {:>7} {:>10} {:>12} {:>10}'.format('benchmark', 'threads',
+                                                    'MB/s', 'Mtokens/s',
+                                                    'efficiency'))
+  for name, encode in benchmarks:
+    base = None
+    for n in num_threads:
+      passes_per_second = run(lambda: encode(n), args.min_time)
+      if base is None:
+        base = (n, passes_per_second)
+      efficiency = passes_per_second / base[1] * base[0] / n
+      if tsv:
+        print('{}\t{}\t{:.0f}\t{:.0f}\t{:.3f}'.format(
+            name, n, passes_per_second * num_bytes,
+            passes_per_second * num_tokens, efficiency))
+      else:
+        print('{:<12} {:>7} {:>10.2f} {:>12.3f} {:>10.2f}'.format(
+            name, n, passes_per_second * num_bytes / 1e6,
+            passes_per_second * num_tokens / 1e6, efficiency))
+
+
+if __name__ == '__main__':
+  main()
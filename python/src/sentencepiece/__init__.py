@@ -255,12 +255,18 @@ class SentencePieceProcessor(object):
     def LoadFromSerializedProto(self, serialized):
         return _sentencepiece.SentencePieceProcessor_LoadFromSerializedProto(self, serialized)
 
+    def SaveCompiledModel(self, filename):
+        return _sentencepiece.SentencePieceProcessor_SaveCompiledModel(self, filename)
+
     def SetEncodeExtraOptions(self, extra_option):
         return _sentencepiece.SentencePieceProcessor_SetEncodeExtraOptions(self, extra_option)
 
     def SetDecodeExtraOptions(self, extra_option):
         return _sentencepiece.SentencePieceProcessor_SetDecodeExtraOptions(self, extra_option)
 
+    def SetEncodeLimits(self, max_tokens, max_input_bytes):
+        return _sentencepiece.SentencePieceProcessor_SetEncodeLimits(self, max_tokens, max_input_bytes)
+
     def SetVocabulary(self, valid_vocab):
         return _sentencepiece.SentencePieceProcessor_SetVocabulary(self, valid_vocab)
 
@@ -339,6 +345,21 @@ class SentencePieceProcessor(object):
     def _EncodeAsImmutableProtoBatch(self, ins, num_threads, enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse, emit_unk_piece):
         return _sentencepiece.SentencePieceProcessor__EncodeAsImmutableProtoBatch(self, ins, num_threads, enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse, emit_unk_piece)
 
+    def _GetVocabularyTable(self):
+        return _sentencepiece.SentencePieceProcessor__GetVocabularyTable(self)
+
+    def _EncodeBatch(self, ins, num_threads, with_pieces, with_alignment, unicode_offsets):
+        return _sentencepiece.SentencePieceProcessor__EncodeBatch(self, ins, num_threads, with_pieces, with_alignment, unicode_offsets)
+
+    def _EncodeAsIdsArrays(self, ins, num_threads, enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse, emit_unk_piece, padded, pad_id, max_length):
+        return _sentencepiece.SentencePieceProcessor__EncodeAsIdsArrays(self, ins, num_threads, enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse, emit_unk_piece, padded, pad_id, max_length)
+
+    def _EncodeBufferAsIdsArrays(self, data, offsets, num_threads, enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse, emit_unk_piece, padded, pad_id, max_length):
+        return _sentencepiece.SentencePieceProcessor__EncodeBufferAsIdsArrays(self, data, offsets, num_threads, enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse, emit_unk_piece, padded, pad_id, max_length)
+
+    def _EncodeArrow(self, schema, array, num_threads):
+        return _sentencepiece.SentencePieceProcessor__EncodeArrow(self, schema, array, num_threads)
+
     def _DecodeIds(self, ids):
         return _sentencepiece.SentencePieceProcessor__DecodeIds(self, ids)
 
@@ -464,6 +485,7 @@ class SentencePieceProcessor(object):
       self._nbest_size = nbest_size
       self._alpha = alpha
       self._num_threads = num_threads
+      self._compiled_model_file = None
       if model_file or model_proto:
         self.Load(model_file=model_file, model_proto=model_proto)
 
@@ -478,12 +500,18 @@ class SentencePieceProcessor(object):
                enable_sampling=None,
                nbest_size=None,
                alpha=None,
-               num_threads=None):
+               num_threads=None,
+               max_length=None):
       """Encode text input to segmented ids or tokens.
 
         Args:
         input: input string. accepsts list of string.
-        out_type: output type. int or str.
+        out_type: output type. int, str, 'serialized_proto', 'immutable_proto',
+                  'numpy' or 'numpy_padded'. 'numpy' returns the ids of a list
+                  as a flat int32 numpy array and the offsets of the sentences
+                  in it, and 'numpy_padded' returns them as a 2D int32 array
+                  padded with pad_id() and the lengths of the sentences. The
+                  arrays are filled in C++ without Python objects of the ids.
         add_bos: Add <s> to the result (Default = false)
         add_eos: Add </s> to the result (Default = false) <s>/</s> is added after
                  reversing (if enabled).
@@ -498,6 +526,10 @@ class SentencePieceProcessor(object):
         alpha: Soothing parameter for unigram sampling, and merge probability for
                BPE-dropout (probablity 'p' in BPE-dropout paper).
         num_threads: the number of threads used in the batch processing (Default = -1).
+        max_length: Truncates the ids of 'numpy' and 'numpy_padded' to this length
+                    with <s> and </s>, dropping the end of the sentence before
+                    reversing (Default = None, no truncation). <s>, </s>,
+                    truncation, reversal, and padding are done in one pass in C++.
       """
 
       if out_type is None:
@@ -531,6 +563,24 @@ class SentencePieceProcessor(object):
       if num_threads is None or type(num_threads) is not int:
         raise RuntimeError('num_threads must be int')
 
+      if max_length is not None:
+        if out_type != 'numpy' and out_type != 'numpy_padded':
+          raise RuntimeError(
+              'max_length is supported only in numpy and numpy_padded out_type')
+        if type(max_length) is not int or max_length < add_bos + add_eos:
+          raise ValueError('max_length must be an int of <s> and </s> at least')
+
+      if out_type == 'numpy' or out_type == 'numpy_padded':
+        import numpy
+        padded = out_type == 'numpy_padded'
+        ids, sizes = self._EncodeAsIdsArrays(
+            input if type(input) is list else [input], num_threads,
+            enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse,
+            emit_unk_piece, padded, self.pad_id(), max_length or 0)
+        if type(input) is not list:
+          return numpy.asarray(ids)[0] if padded else numpy.asarray(ids)
+        return numpy.asarray(ids), numpy.asarray(sizes)
+
       if type(input) is list:
         if out_type is int:
           return self._EncodeAsIdsBatch(input, num_threads, enable_sampling, nbest_size,
@@ -868,6 +918,24 @@ class SentencePieceProcessor(object):
       return None
 
 
+    async def EncodeAsync(self, input, **kwargs):
+      """Encode() on a worker thread, awaited without blocking the event loop.
+
+      The GIL is released while the input is encoded, so that the event loop
+      serves the other requests meanwhile. The arguments are as in Encode().
+      """
+      import asyncio
+      return await asyncio.get_running_loop().run_in_executor(
+          _get_async_executor(), lambda: self.Encode(input, **kwargs))
+
+
+    async def DecodeAsync(self, input, **kwargs):
+      """Decode() on a worker thread, as EncodeAsync() does."""
+      import asyncio
+      return await asyncio.get_running_loop().run_in_executor(
+          _get_async_executor(), lambda: self.Decode(input, **kwargs))
+
+
     def DecodePieces(self, input, out_type=str, **kwargs):
       return self.Decode(input=input, out_type=out_type, **kwargs)
 
@@ -892,6 +960,138 @@ class SentencePieceProcessor(object):
       return self.Decode(input=input, out_type=out_type, **kwargs)
 
 
+    def EncodeBuffer(self,
+                     data,
+                     offsets,
+                     out_type='numpy',
+                     add_bos=None,
+                     add_eos=None,
+                     reverse=None,
+                     emit_unk_piece=None,
+                     enable_sampling=None,
+                     nbest_size=None,
+                     alpha=None,
+                     num_threads=None,
+                     max_length=None):
+      """Encodes the sentences in one buffer without converting them one by one.
+
+      The i-th sentence is the UTF-8 data[offsets[i]:offsets[i + 1]], as in the
+      value and offset buffers of an Arrow string array. The sentences are
+      encoded in place, without the Python string of every sentence and its
+      UTF-8 copy that encoding a list makes.
+
+      Args:
+        data: bytes, or any object of the buffer protocol, e.g., memoryview.
+        offsets: 1D buffer of the len(sentences) + 1 offsets, of 32 or 64 bit
+          integers.
+        out_type: 'numpy', 'numpy_padded' or int, as in Encode() for a list
+          (Default = 'numpy').
+        The other arguments are as in Encode().
+      """
+      if add_bos is None:
+        add_bos = self._add_bos
+      if add_eos is None:
+        add_eos = self._add_eos
+      if reverse is None:
+        reverse = self._reverse
+      if emit_unk_piece is None:
+        emit_unk_piece = self._emit_unk_piece
+      if enable_sampling is None:
+        enable_sampling = self._enable_sampling
+      if nbest_size is None:
+        nbest_size = self._nbest_size
+      if alpha is None:
+        alpha = self._alpha
+      if num_threads is None:
+        num_threads = self._num_threads
+      if num_threads is None or type(num_threads) is not int:
+        raise RuntimeError('num_threads must be int')
+      if out_type not in ['numpy', 'numpy_padded', int]:
+        raise RuntimeError('unknown out_type={}'.format(out_type))
+      if max_length is not None and (type(max_length) is not int or
+                                     max_length < add_bos + add_eos):
+        raise ValueError('max_length must be an int of <s> and </s> at least')
+
+      padded = out_type == 'numpy_padded'
+      ids, sizes = self._EncodeBufferAsIdsArrays(
+          data, offsets, num_threads, enable_sampling, nbest_size, alpha,
+          add_bos, add_eos, reverse, emit_unk_piece, padded, self.pad_id(),
+          max_length or 0)
+      if out_type is int:
+        ids, sizes = memoryview(ids), memoryview(sizes)
+        return [ids[sizes[i]:sizes[i + 1]].tolist()
+                for i in range(len(sizes) - 1)]
+      import numpy
+      return numpy.asarray(ids), numpy.asarray(sizes)
+
+    def EncodeArrow(self, array, num_threads=None):
+      """Encodes an Arrow string array to a list<int32> array of the ids.
+
+      The strings are encoded in place and the ids are not copied, so that
+      the sentences do not go through Python objects. Null strings are null
+      lists, and a large string array is encoded to a large_list<int32>
+      array.
+
+      Args:
+        array: a string or large string array of the Arrow PyCapsule interface,
+          e.g., pyarrow.Array.
+        num_threads: the number of threads (Default = num_threads of Init())
+
+      Returns:
+        ArrowIds, an array of the Arrow PyCapsule interface, e.g., to import
+        with pyarrow.array(ids).
+      """
+      if num_threads is None:
+        num_threads = self._num_threads
+      if num_threads is None or type(num_threads) is not int:
+        raise RuntimeError('num_threads must be int')
+      if not hasattr(array, '__arrow_c_array__'):
+        raise TypeError('array must implement __arrow_c_array__')
+      schema, data = array.__arrow_c_array__()
+      return ArrowIds(self._EncodeArrow(schema, data, num_threads))
+
+    def EncodeBatch(self,
+                    input,
+                    num_threads=None,
+                    with_pieces=False,
+                    with_alignment=False,
+                    unicode_offsets=False):
+      """Encodes a list of sentences into one BatchEncodeResult.
+
+      Unlike Encode(), the ids of all the sentences are kept in a few flat
+      arrays, which numpy.asarray() reads without a copy. The encode extra
+      options of SetEncodeExtraOptions() apply, while add_bos, add_eos,
+      reverse and emit_unk_piece of Init() do not.
+
+      Args:
+        input: a list of sentences.
+        num_threads: the number of threads (Default = num_threads of Init())
+        with_pieces: Stores the pieces (Default = false)
+        with_alignment: Stores the byte offsets of the pieces in the sentences
+          (Default = false)
+        unicode_offsets: Stores the offsets in Unicode characters instead of
+          bytes (Default = false). Without with_pieces, the pieces and their
+          surfaces are never built.
+      """
+      if type(input) is not list:
+        raise TypeError('input must be a list')
+      if num_threads is None:
+        num_threads = self._num_threads
+      if num_threads is None or type(num_threads) is not int:
+        raise RuntimeError('num_threads must be int')
+      return BatchEncodeResult(
+          self._EncodeBatch(input, num_threads, with_pieces, with_alignment,
+                          unicode_offsets))
+
+
+    def GetVocabularyTable(self):
+      """Returns all the pieces with their scores and types at once.
+
+      Much faster than calling IdToPiece(), GetScore() and the Is*() methods
+      for every id. See VocabularyTable.
+      """
+      return VocabularyTable(self._GetVocabularyTable())
+
     def CalculateEntropy(self, input, alpha, num_threads=None):
       """Calculate sentence entropy"""
       if type(input) is list:
@@ -930,12 +1130,24 @@ class SentencePieceProcessor(object):
 
 
     def __getstate__(self):
+      # A processor of a compiled model is pickled as the path of the model,
+      # e.g., for the DataLoader workers, which then map the pages of the same
+      # file instead of each parsing and building its own copy of the model.
+      if self._compiled_model_file is not None:
+        return self._compiled_model_file
       return self.serialized_model_proto()
 
 
-    def __setstate__(self, serialized_model_proto):
+    def __setstate__(self, state):
       self.__init__()
-      self.LoadFromSerializedProto(serialized_model_proto)
+      if type(state) is not dict:
+        self.LoadFromSerializedProto(state)
+        return
+      path = state['compiled_model_file']
+      stat = os.stat(path)
+      if (stat.st_size, stat.st_mtime_ns) != (state['size'], state['mtime_ns']):
+        raise RuntimeError('{} was modified after it was pickled'.format(path))
+      self.Load(model_file=path)
 
 
     def __len__(self):
@@ -956,19 +1168,73 @@ class SentencePieceProcessor(object):
       """
       if model_file and model_proto:
         raise RuntimeError('model_file and model_proto must be exclusive.')
+      self._compiled_model_file = None
       if model_proto:
         return self.LoadFromSerializedProto(model_proto)
-      return self.LoadFromFile(model_file)
+      status = self.LoadFromFile(model_file)
+      with open(model_file, 'rb') as f:
+        is_compiled = f.read(8) == b'SPMCMODL'
+      if is_compiled:
+        path = os.path.abspath(model_file)
+        stat = os.stat(path)
+        self._compiled_model_file = {'compiled_model_file': path,
+                                     'size': stat.st_size,
+                                     'mtime_ns': stat.st_mtime_ns}
+      return status
 
 
 # Register SentencePieceProcessor in _sentencepiece:
 _sentencepiece.SentencePieceProcessor_swigregister(SentencePieceProcessor)
 
+class StreamingDecoder(object):
+    thisown = property(lambda x: x.this.own(), lambda x, v: x.this.own(v), doc="The membership flag")
+    __repr__ = _swig_repr
+
+    def __init__(self, sp):
+        _sentencepiece.StreamingDecoder_swiginit(self, _sentencepiece.new_StreamingDecoder(sp))
+    __swig_destroy__ = _sentencepiece.delete_StreamingDecoder
+
+    def buffered_size(self):
+        return _sentencepiece.StreamingDecoder_buffered_size(self)
+
+    def Put(self, id):
+        return _sentencepiece.StreamingDecoder_Put(self, id)
+
+    def Flush(self):
+        return _sentencepiece.StreamingDecoder_Flush(self)
+
+    def Init(self, sp):
+      """Initializes a decoder of the ids generated one by one.
+
+      put(id) returns the text which became final with `id`, and flush()
+      returns the rest of the sequence. The concatenated text is the same as
+      sp.decode() of all the ids, at a constant cost per id. The bytes of an
+      incomplete UTF-8 character are held back until the character is
+      complete. After flush(), the decoder can decode a new sequence.
+
+      Args:
+        sp: The SentencePieceProcessor. It must not be reloaded while the
+          decoder is in use.
+      """
+
+      _streaming_decoder_init_native(self, sp)
+      self._sp = sp
+
+
+# Register StreamingDecoder in _sentencepiece:
+_sentencepiece.StreamingDecoder_swigregister(StreamingDecoder)
+
 def SetRandomGeneratorSeed(seed):
     return _sentencepiece.SetRandomGeneratorSeed(seed)
 
 def SetMinLogLevel(v):
     return _sentencepiece.SetMinLogLevel(v)
+
+def SetThreadOptions(*args):
+    return _sentencepiece.SetThreadOptions(*args)
+
+def GetNumThreads():
+    return _sentencepiece.GetNumThreads()
 class SentencePieceTrainer(object):
     thisown = property(lambda x: x.this.own(), lambda x, v: x.this.own(v), doc="The membership flag")
 
@@ -1151,6 +1417,116 @@ from io import StringIO
 from io import BytesIO
 
 
+_async_executor = None
+
+
+def _get_async_executor():
+  """Returns the threads of the async methods, created on first use.
+
+  The processor methods release the GIL in the native code, so these
+  threads do not hold it while they encode and decode.
+  """
+  global _async_executor
+  if _async_executor is None:
+    import concurrent.futures
+    _async_executor = concurrent.futures.ThreadPoolExecutor(
+        thread_name_prefix='sentencepiece')
+  return _async_executor
+
+
+def _reset_async_executor():
+  global _async_executor
+  _async_executor = None
+
+
+# The child of fork() has none of the threads of the parent.
+if hasattr(os, 'register_at_fork'):
+  os.register_at_fork(after_in_child=_reset_async_executor)
+
+
+class BatchEncodeResult(object):
+  """Flat result of SentencePieceProcessor.EncodeBatch().
+
+  The ids of the i-th sentence are ids[offsets[i]:offsets[i + 1]]. With
+  with_pieces, the j-th piece is pieces[piece_offsets[j]:piece_offsets[j + 1]],
+  and with with_alignment, begins[j] and ends[j] are the byte offsets (or the
+  character offsets with unicode_offsets) of the j-th piece in its sentence.
+  All of them are read-only memoryviews of the arrays of the C++ result.
+  """
+
+  def __init__(self, arrays):
+    (self.ids, self.offsets, self.pieces, self.piece_offsets, self.begins,
+     self.ends) = [memoryview(array) for array in arrays]
+
+  def __len__(self):
+    return len(self.offsets) - 1
+
+  def __getitem__(self, index):
+    if index < 0:
+      index += len(self)
+    if index < 0 or index >= len(self):
+      raise IndexError('batch index is out of range.')
+    return self.ids[self.offsets[index]:self.offsets[index + 1]].tolist()
+
+  def piece(self, index):
+    """Returns the index-th piece of ids."""
+    begin, end = self.piece_offsets[index], self.piece_offsets[index + 1]
+    return self.pieces[begin:end].tobytes().decode('utf-8')
+
+
+class VocabularyTable(object):
+  """Flat vocabulary of SentencePieceProcessor.GetVocabularyTable().
+
+  The piece of id i is pieces[piece_offsets[i]:piece_offsets[i + 1]], and
+  scores[i] and types[i] are its score and ModelProto.SentencePiece.Type,
+  e.g., 1 for NORMAL and 3 for CONTROL. All of them are read-only
+  memoryviews of the arrays of the C++ table.
+  """
+
+  NORMAL = 1
+  UNKNOWN = 2
+  CONTROL = 3
+  USER_DEFINED = 4
+  UNUSED = 5
+  BYTE = 6
+
+  def __init__(self, arrays):
+    (self.pieces, self.piece_offsets, self.scores,
+     self.types) = [memoryview(array) for array in arrays]
+
+  def __len__(self):
+    return len(self.scores)
+
+  def piece(self, id):
+    """Returns the piece of id."""
+    begin, end = self.piece_offsets[id], self.piece_offsets[id + 1]
+    return self.pieces[begin:end].tobytes().decode('utf-8')
+
+  def piece_list(self):
+    """Returns the list of all the pieces."""
+    blob = self.pieces.tobytes()
+    offsets = self.piece_offsets.tolist()
+    return [blob[offsets[i]:offsets[i + 1]].decode('utf-8')
+            for i in range(len(self))]
+
+
+class ArrowIds(object):
+  """list<int32> array of SentencePieceProcessor.EncodeArrow().
+
+  It implements the Arrow PyCapsule interface, and is moved to the first
+  consumer, e.g., of pyarrow.array(ids).
+  """
+
+  def __init__(self, capsules):
+    self._capsules = capsules
+
+  def __arrow_c_array__(self, requested_schema=None):
+    if self._capsules is None:
+      raise RuntimeError('the array is already exported.')
+    capsules, self._capsules = self._capsules, None
+    return capsules
+
+
 def _add_snake_case(classname):
   """Added snake_cased method from CammelCased method."""
 
@@ -1183,8 +1559,10 @@ def _batchnize(classname, name):
 
 _sentencepiece_processor_init_native = SentencePieceProcessor.__init__
 _sentencepiece_normalizer_init_native = SentencePieceNormalizer.__init__
+_streaming_decoder_init_native = StreamingDecoder.__init__
 setattr(SentencePieceProcessor, '__init__', SentencePieceProcessor.Init)
 setattr(SentencePieceNormalizer, '__init__', SentencePieceNormalizer.Init)
+setattr(StreamingDecoder, '__init__', StreamingDecoder.Init)
 
 SentencePieceProcessor.Tokenize = SentencePieceProcessor.Encode
 SentencePieceProcessor.Detokenize = SentencePieceProcessor.Decode
@@ -1198,8 +1576,11 @@ for m in [
 _add_snake_case(SentencePieceProcessor)
 _add_snake_case(SentencePieceTrainer)
 _add_snake_case(SentencePieceNormalizer)
+_add_snake_case(StreamingDecoder)
 set_random_generator_seed = SetRandomGeneratorSeed
 set_min_log_level = SetMinLogLevel
+set_thread_options = SetThreadOptions
+get_num_threads = GetNumThreads
 
 from ._version import __version__
 
@@ -9,8 +9,14 @@
 #include <functional>
 #include <limits>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <thread>
 #include <vector>
+#include <sentencepiece_arrow.h>
 #include <sentencepiece_processor.h>
 #include <sentencepiece_trainer.h>
 
@@ -67,6 +73,338 @@ PyObject* MakePyOutputBytes(const sentencepiece::util::bytes& output) {
   return PyBytes_FromStringAndSize(output.data(), output.size());
 }
 
+// Read-only buffer over an array of a BatchEncodeResult or IdsArrays, with
+// which memoryview() and numpy.asarray() read the array without a copy.
+// `owner` is the capsule deleting the result with its last array.
+struct FlatArrayObject {
+  PyObject_HEAD
+  PyObject *owner;
+  void *data;
+  Py_ssize_t size;
+  Py_ssize_t itemsize;
+  const char *format;
+  int ndim;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+void FlatArrayDealloc(PyObject *self) {
+  Py_XDECREF(reinterpret_cast<FlatArrayObject *>(self)->owner);
+  Py_TYPE(self)->tp_free(self);
+}
+
+int FlatArrayGetBuffer(PyObject *self, Py_buffer *view, int flags) {
+  auto *array = reinterpret_cast<FlatArrayObject *>(self);
+  if (PyBuffer_FillInfo(view, self, array->data,
+                        array->size * array->itemsize, 1, flags) < 0) {
+    return -1;
+  }
+  // PyBuffer_FillInfo() describes unsigned bytes.
+  if ((flags & PyBUF_ND) == PyBUF_ND) {
+    view->itemsize = array->itemsize;
+    view->ndim = array->ndim;
+    view->shape = array->shape;
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) {
+      view->strides = array->strides;
+    }
+  }
+  if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) {
+    view->format = const_cast<char *>(array->format);
+  }
+  return 0;
+}
+
+PyTypeObject *GetFlatArrayType() {
+  static PyTypeObject *type = []() -> PyTypeObject * {
+    static PyBufferProcs buffer_procs = {FlatArrayGetBuffer, nullptr};
+    static PyTypeObject flat_array_type = {PyVarObject_HEAD_INIT(nullptr, 0)};
+    flat_array_type.tp_name = "sentencepiece._FlatArray";
+    flat_array_type.tp_basicsize = sizeof(FlatArrayObject);
+    flat_array_type.tp_dealloc = FlatArrayDealloc;
+    flat_array_type.tp_as_buffer = &buffer_procs;
+    flat_array_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    flat_array_type.tp_doc = "Read-only array of BatchEncodeResult.";
+    return PyType_Ready(&flat_array_type) < 0 ? nullptr : &flat_array_type;
+  }();
+  return type;
+}
+
+// Returns the capsule owning `data`, which deletes it with the last array.
+template <typename T>
+PyObject *MakeArrayOwner(T *data) {
+  PyObject *owner = PyCapsule_New(data, nullptr, [](PyObject *capsule) {
+    delete static_cast<T *>(PyCapsule_GetPointer(capsule, nullptr));
+  });
+  if (owner == nullptr) delete data;
+  return owner;
+}
+
+// With `rows`, the array is 2D of `rows` rows of `size` / `rows` items.
+template <typename T>
+PyObject *MakeFlatArray(PyObject *owner, const T *data, size_t size,
+                        const char *format, Py_ssize_t rows = -1) {
+  static const T kEmpty = T();
+  PyTypeObject *type = GetFlatArrayType();
+  if (type == nullptr) return nullptr;
+  auto *array = PyObject_New(FlatArrayObject, type);
+  if (array == nullptr) return nullptr;
+  Py_INCREF(owner);
+  array->owner = owner;
+  array->data = const_cast<T *>(size == 0 ? &kEmpty : data);
+  array->size = size;
+  array->itemsize = sizeof(T);
+  array->format = format;
+  array->ndim = rows >= 0 ? 2 : 1;
+  array->shape[0] = rows >= 0 ? rows : size;
+  array->shape[1] = rows > 0 ? size / rows : 0;
+  array->strides[0] = array->ndim == 2 ? array->shape[1] * sizeof(T)
+                                       : sizeof(T);
+  array->strides[1] = sizeof(T);
+  return reinterpret_cast<PyObject *>(array);
+}
+
+// Moves `result` to Python as the tuple of its (ids, offsets, pieces,
+// piece_offsets, begins, ends) arrays, which share the ownership of it.
+PyObject *MakeBatchEncodeArrays(sentencepiece::BatchEncodeResult *result) {
+  PyObject *owner = MakeArrayOwner(result);
+  if (owner == nullptr) return nullptr;
+  const char *size_format =
+      sizeof(size_t) == sizeof(unsigned long long) ? "Q" : "I";
+  PyObject *tuple = PyTuple_New(6);
+  if (tuple == nullptr) {
+    Py_DECREF(owner);
+    return nullptr;
+  }
+  PyTuple_SET_ITEM(tuple, 0, MakeFlatArray(owner, result->ids().data(),
+                                           result->ids().size(), "i"));
+  PyTuple_SET_ITEM(tuple, 1, MakeFlatArray(owner, result->offsets().data(),
+                                           result->offsets().size(),
+                                           size_format));
+  PyTuple_SET_ITEM(tuple, 2, MakeFlatArray(owner, result->pieces().data(),
+                                           result->pieces().size(), "B"));
+  PyTuple_SET_ITEM(tuple, 3,
+                   MakeFlatArray(owner, result->piece_offsets().data(),
+                                 result->piece_offsets().size(), size_format));
+  PyTuple_SET_ITEM(tuple, 4, MakeFlatArray(owner, result->begins().data(),
+                                           result->begins().size(), "I"));
+  PyTuple_SET_ITEM(tuple, 5, MakeFlatArray(owner, result->ends().data(),
+                                           result->ends().size(), "I"));
+  Py_DECREF(owner);
+  for (int i = 0; i < 6; ++i) {
+    if (PyTuple_GET_ITEM(tuple, i) == nullptr) {
+      Py_DECREF(tuple);
+      return nullptr;
+    }
+  }
+  return tuple;
+}
+
+// Moves `table` to Python as the tuple of its (pieces, piece_offsets,
+// scores, types) arrays, which share the ownership of it.
+PyObject *MakeVocabularyArrays(sentencepiece::VocabularyTable *table) {
+  PyObject *owner = MakeArrayOwner(table);
+  if (owner == nullptr) return nullptr;
+  const char *size_format =
+      sizeof(size_t) == sizeof(unsigned long long) ? "Q" : "I";
+  PyObject *tuple = PyTuple_New(4);
+  if (tuple == nullptr) {
+    Py_DECREF(owner);
+    return nullptr;
+  }
+  PyTuple_SET_ITEM(tuple, 0, MakeFlatArray(owner, table->pieces().data(),
+                                           table->pieces().size(), "B"));
+  PyTuple_SET_ITEM(tuple, 1,
+                   MakeFlatArray(owner, table->piece_offsets().data(),
+                                 table->piece_offsets().size(), size_format));
+  PyTuple_SET_ITEM(tuple, 2, MakeFlatArray(owner, table->scores().data(),
+                                           table->scores().size(), "f"));
+  PyTuple_SET_ITEM(tuple, 3, MakeFlatArray(owner, table->types().data(),
+                                           table->types().size(), "B"));
+  Py_DECREF(owner);
+  for (int i = 0; i < 4; ++i) {
+    if (PyTuple_GET_ITEM(tuple, i) == nullptr) {
+      Py_DECREF(tuple);
+      return nullptr;
+    }
+  }
+  return tuple;
+}
+
+// Layout of the ids of a batch in IdsArrays.
+struct IdsLayout {
+  bool add_bos = false;
+  bool add_eos = false;
+  bool reverse = false;
+  bool padded = false;
+  int max_length = 0;  // Of a sentence with <s> and </s>. No limit if <= 0.
+  int bos_id = -1;
+  int eos_id = -1;
+  int pad_id = -1;
+};
+
+// Ids of a batch in one array, either flat or padded to the longest one.
+struct IdsArrays {
+  std::vector<int> ids;
+  std::vector<size_t> offsets;  // Of the sentences in the flat ids.
+  std::vector<int> lengths;     // Of the sentences in the padded rows.
+
+  // Lays out the ids [row(i).first, row(i).second) of the `size` sentences
+  // of the encoder in one pass, writing <s> and </s> to their slots and the
+  // truncated and reversed ids between them, so that the ids are neither
+  // shifted nor copied per sentence. Truncation to `max_length` drops the
+  // end of a sentence, before it is reversed.
+  template <typename Row>
+  IdsArrays(size_t size, const Row &row, const IdsLayout &layout) {
+    const size_t num_extra = layout.add_bos + layout.add_eos;
+    const size_t max_length =
+        layout.max_length > 0
+            ? std::max<size_t>(layout.max_length, num_extra)
+            : std::numeric_limits<size_t>::max();
+    const auto length = [&](size_t i) {
+      const auto range = row(i);
+      return std::min<size_t>(range.second - range.first + num_extra,
+                              max_length);
+    };
+    const auto write = [&](size_t i, size_t length, int *out) {
+      const int *begin = row(i).first;
+      const int *end = begin + (length - num_extra);
+      if (layout.add_bos) *out++ = layout.bos_id;
+      out = layout.reverse ? std::reverse_copy(begin, end, out)
+                           : std::copy(begin, end, out);
+      if (layout.add_eos) *out = layout.eos_id;
+    };
+
+    if (layout.padded) {
+      size_t width = 0;
+      lengths.resize(size);
+      for (size_t i = 0; i < size; ++i) {
+        lengths[i] = static_cast<int>(length(i));
+        width = std::max<size_t>(width, lengths[i]);
+      }
+      ids.assign(size * width, layout.pad_id);
+      for (size_t i = 0; i < size; ++i) {
+        write(i, lengths[i], ids.data() + i * width);
+      }
+    } else {
+      offsets.resize(size + 1);
+      offsets[0] = 0;
+      for (size_t i = 0; i < size; ++i) {
+        offsets[i + 1] = offsets[i] + length(i);
+      }
+      ids.resize(offsets.back());
+      for (size_t i = 0; i < size; ++i) {
+        write(i, offsets[i + 1] - offsets[i], ids.data() + offsets[i]);
+      }
+    }
+  }
+};
+
+// Moves `arrays` to Python as the tuple of (ids, offsets) or, if the rows
+// are padded, of the 2D (ids, lengths).
+PyObject *MakeIdsArrays(IdsArrays *arrays, bool padded) {
+  PyObject *owner = MakeArrayOwner(arrays);
+  if (owner == nullptr) return nullptr;
+  const char *size_format =
+      sizeof(size_t) == sizeof(unsigned long long) ? "Q" : "I";
+  PyObject *ids = MakeFlatArray(owner, arrays->ids.data(), arrays->ids.size(),
+                                "i", padded ? arrays->lengths.size() : -1);
+  PyObject *sizes = padded ? MakeFlatArray(owner, arrays->lengths.data(),
+                                           arrays->lengths.size(), "i")
+                           : MakeFlatArray(owner, arrays->offsets.data(),
+                                           arrays->offsets.size(),
+                                           size_format);
+  Py_DECREF(owner);
+  PyObject *tuple =
+      ids != nullptr && sizes != nullptr ? PyTuple_Pack(2, ids, sizes)
+                                         : nullptr;
+  Py_XDECREF(ids);
+  Py_XDECREF(sizes);
+  return tuple;
+}
+
+// View of the buffer of a Python object, released with the GIL held.
+class ScopedBuffer {
+ public:
+  ScopedBuffer(PyObject *obj, int flags)
+      : ok_(PyObject_GetBuffer(obj, &view_, flags) == 0) {}
+  ~ScopedBuffer() {
+    if (ok_) PyBuffer_Release(&view_);
+  }
+
+  ScopedBuffer(const ScopedBuffer &) = delete;
+  ScopedBuffer &operator=(const ScopedBuffer &) = delete;
+
+  bool ok() const { return ok_; }
+  const Py_buffer &view() const { return view_; }
+
+ private:
+  Py_buffer view_;
+  bool ok_ = false;
+};
+
+// Splits `data` into the sentences between the `offsets` of an integer
+// buffer, e.g., of the value and offset buffers of an Arrow string array.
+// Sets the Python error and returns false if they do not match.
+bool SplitBuffer(const Py_buffer &data, const Py_buffer &offsets,
+                 std::vector<absl::string_view> *ins) {
+  absl::string_view format = offsets.format ? offsets.format : "B";
+  if (!format.empty() && (format[0] == '@' || format[0] == '=' ||
+                          format[0] == '<')) {
+    format.remove_prefix(1);
+  }
+  if (offsets.ndim != 1 || format.size() != 1 ||
+      absl::string_view("iIlLqQnN").find(format[0]) ==
+          absl::string_view::npos ||
+      (offsets.itemsize != 4 && offsets.itemsize != 8)) {
+    PyErr_SetString(PyExc_TypeError,
+                    "offsets must be a 1D array of 32 or 64 bit integers");
+    return false;
+  }
+  const Py_ssize_t size = offsets.shape[0];
+  auto offset = [&offsets](Py_ssize_t i) -> int64_t {
+    const char *p = static_cast<const char *>(offsets.buf) +
+                    i * offsets.strides[0];
+    if (offsets.itemsize == 4) {
+      int32_t value;
+      memcpy(&value, p, sizeof(value));
+      return value;
+    }
+    int64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  };
+  ins->clear();
+  if (size == 0) return true;
+  ins->reserve(size - 1);
+  const char *base = static_cast<const char *>(data.buf);
+  for (Py_ssize_t i = 0; i + 1 < size; ++i) {
+    const int64_t begin = offset(i);
+    const int64_t end = offset(i + 1);
+    if (begin < 0 || begin > end || end > data.len) {
+      PyErr_SetString(PyExc_IndexError, "offsets are out of the data");
+      return false;
+    }
+    ins->emplace_back(base + begin, end - begin);
+  }
+  return true;
+}
+
+// Destructors of the capsules of the Arrow PyCapsule interface, which
+// release the array unless the consumer has moved it.
+void DeleteArrowSchemaCapsule(PyObject *capsule) {
+  auto *schema = static_cast<ArrowSchema *>(
+      PyCapsule_GetPointer(capsule, "arrow_schema"));
+  if (schema->release != nullptr) schema->release(schema);
+  delete schema;
+}
+
+void DeleteArrowArrayCapsule(PyObject *capsule) {
+  auto *array =
+      static_cast<ArrowArray *>(PyCapsule_GetPointer(capsule, "arrow_array"));
+  if (array->release != nullptr) array->release(array);
+  delete array;
+}
+
 int ToSwigError(sentencepiece::util::StatusCode code) {
   switch (code) {
     case sentencepiece::util::StatusCode::kNotFound:
@@ -81,67 +419,184 @@ int ToSwigError(sentencepiece::util::StatusCode code) {
   return SWIG_RuntimeError;
 }
 
+// Sentence iterator over a Python iterator. A producer thread pulls the
+// sentences in batches of kBatchSize into a queue of at most kMaxBatches,
+// holding the GIL only while it calls the iterator, so that the trainer
+// consumes and counts them without the GIL. The first batch is read in the
+// constructor, where the caller holds the GIL.
 class PySentenceIterator : public sentencepiece::SentenceIterator {
-  public:
-  PySentenceIterator(PyObject *iter) : iter_(iter) {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+ public:
+  static constexpr size_t kBatchSize = 1024;
+  static constexpr size_t kMaxBatches = 8;
+
+  explicit PySentenceIterator(PyObject *iter) : iter_(iter) {
+    Py_INCREF(iter_);
+    eof_ = !FetchBatch(&batch_);
+    if (!eof_) producer_ = std::thread([this]() { Produce(); });
   }
 
   ~PySentenceIterator() {
-   // Py_XDECREF(iter_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    not_full_.notify_all();
+    if (producer_.joinable()) {
+      // The producer may be waiting for the GIL held by the caller.
+      Py_BEGIN_ALLOW_THREADS
+      producer_.join();
+      Py_END_ALLOW_THREADS
+    }
+    Py_XDECREF(iter_);
   }
 
   bool done() const override {
-    return item_ == nullptr;
+    return pos_ >= batch_.size();
   }
 
   void Next() override {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+    if (++pos_ < batch_.size()) return;
+    batch_.clear();
+    pos_ = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return !queue_.empty() || eof_; });
+    if (queue_.empty()) return;
+    batch_ = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
   }
 
   const std::string &value() const override {
-    return value_;
+    return batch_[pos_];
   }
 
   sentencepiece::util::Status status() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
     return status_;
   }
 
   private:
-   void CopyValue() {
-     if (item_ == nullptr) return;
-     const PyInputString ustring(item_);
-     if (ustring.IsAvalable()) {
-       const char *data = ustring.data();
-       size_t size = ustring.size();
-       while (size > 0) {
-         if (data[size - 1] == '\r' || data[size - 1] == '\n')
-           --size;
-         else
-           break;
+   void Produce() {
+     bool more = true;
+     while (more) {
+       {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (stop_) return;
+       }
+       std::vector<std::string> batch;
+       const PyGILState_STATE state = PyGILState_Ensure();
+       more = FetchBatch(&batch);
+       PyGILState_Release(state);
+       std::unique_lock<std::mutex> lock(mutex_);
+       not_full_.wait(lock, [this]() {
+         return queue_.size() < kMaxBatches || stop_;
+       });
+       if (stop_) return;
+       if (!batch.empty()) queue_.push_back(std::move(batch));
+       eof_ = !more;
+       lock.unlock();
+       not_empty_.notify_one();
+     }
+   }
+
+   // Appends up to kBatchSize sentences to `batch`, without the trailing
+   // newlines. Returns false at the end of the iterator or on an error.
+   // Must be called with the GIL held.
+   bool FetchBatch(std::vector<std::string> *batch) {
+     batch->reserve(kBatchSize);
+     while (batch->size() < kBatchSize) {
+       PyObject *item = PyIter_Next(iter_);
+       if (item == nullptr) {
+         if (PyErr_Occurred()) SetError(FetchErrorMessage());
+         return false;
+       }
+       bool ok = false;
+       {
+         const PyInputString ustring(item);
+         if (ustring.IsAvalable()) {
+           const char *data = ustring.data();
+           size_t size = ustring.size();
+           while (size > 0) {
+             if (data[size - 1] == '\r' || data[size - 1] == '\n')
+               --size;
+             else
+               break;
+           }
+           batch->emplace_back(data, size);
+           ok = true;
+         }
+       }
+       Py_DECREF(item);
+       if (!ok) {
+         SetError("Not a string.");
+         return false;
        }
-       value_.assign(data, size);
-     } else {
-       status_ = sentencepiece::util::Status(sentencepiece::util::StatusCode::kInternal,
-                                             "Not a string.");
      }
-     Py_XDECREF(item_);
+     return true;
+   }
+
+   // Takes the pending Python error as the message of the status.
+   static std::string FetchErrorMessage() {
+     std::string message = "Failed to read the sentence iterator.";
+     PyObject *type = nullptr, *value = nullptr, *traceback = nullptr;
+     PyErr_Fetch(&type, &value, &traceback);
+     if (value != nullptr) {
+       PyObject *str = PyObject_Str(value);
+       const char *data = str != nullptr ? PyUnicode_AsUTF8(str) : nullptr;
+       if (data != nullptr) message = data;
+       Py_XDECREF(str);
+     }
+     Py_XDECREF(type);
+     Py_XDECREF(value);
+     Py_XDECREF(traceback);
+     PyErr_Clear();
+     return message;
    }
+
+   void SetError(const std::string &message) {
+     std::lock_guard<std::mutex> lock(mutex_);
+     if (status_.ok()) {
+       status_ = sentencepiece::util::Status(
+           sentencepiece::util::StatusCode::kInternal, message);
+     }
+   }
+
    PyObject *iter_ = nullptr;
-   PyObject *item_ = nullptr;
-   std::string value_;
+   // Consumed by the trainer only.
+   std::vector<std::string> batch_;
+   size_t pos_ = 0;
+   // Shared with the producer.
+   mutable std::mutex mutex_;
+   std::condition_variable not_empty_;
+   std::condition_variable not_full_;
+   std::deque<std::vector<std::string>> queue_;
+   bool eof_ = false;
+   bool stop_ = false;
    sentencepiece::util::Status status_;
+   std::thread producer_;
 };
 
 inline void RewriteIds(const sentencepiece::SentencePieceProcessor &sp,
                        std::vector<int> *ids,
                        bool add_bos, bool add_eos, bool reverse, bool emit_unk_piece) {
   if (!add_bos && !add_eos && !reverse) return;
-  if (reverse) std::reverse(ids->begin(), ids->end());
-  if (add_bos) ids->insert(ids->begin(), sp.bos_id());
-  if (add_eos) ids->push_back(sp.eos_id());
+  if (!add_bos) {
+    if (reverse) std::reverse(ids->begin(), ids->end());
+    if (add_eos) ids->push_back(sp.eos_id());
+    return;
+  }
+  // Writes <s> and the ids in one pass, instead of shifting the ids.
+  std::vector<int> out;
+  out.reserve(ids->size() + 1 + add_eos);
+  out.push_back(sp.bos_id());
+  if (reverse) {
+    out.insert(out.end(), ids->rbegin(), ids->rend());
+  } else {
+    out.insert(out.end(), ids->begin(), ids->end());
+  }
+  if (add_eos) out.push_back(sp.eos_id());
+  ids->swap(out);
 }
 
 inline void RewriteIds(const sentencepiece::SentencePieceProcessor &sp,
@@ -207,51 +662,145 @@ inline void ConvertToUnicodeSpans(sentencepiece::ImmutableNBestSentencePieceText
   proto->ConvertToUnicodeSpans();
 }
 
+// Releases the GIL while the native code runs, so that the other Python
+// threads run during the encoding and decoding. The arguments are marshalled
+// before and the result objects are built after, with the GIL held. The
+// input lists must not be modified by the other threads during the call.
+class ScopedReleaseGIL {
+ public:
+  ScopedReleaseGIL() : state_(PyEval_SaveThread()) {}
+  ~ScopedReleaseGIL() { PyEval_RestoreThread(state_); }
+
+  ScopedReleaseGIL(const ScopedReleaseGIL &) = delete;
+  ScopedReleaseGIL &operator=(const ScopedReleaseGIL &) = delete;
+
+ private:
+  PyThreadState *state_ = nullptr;
+};
+
+// Scoped group of tasks running on the shared pool of the batch calls of
+// the C++ library, so that the process has a single pool of the size and
+// the CPUs of SetThreadOptions(). The destructor blocks until all the tasks
+// of this group are finished.
+// The tasks of a group of one thread run inline.
 class ThreadPool {
  public:
-  explicit ThreadPool(size_t request_size) :
-    request_size_(request_size) {}
+  explicit ThreadPool(int num_threads) :
+    num_threads_(num_threads) {}
 
   virtual ~ThreadPool() {
-    for (auto &task : tasks_) {
-      task.join();
-    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return pending_ == 0; });
   }
 
   void Schedule(std::function<void()> closure) {
-    static constexpr size_t kMinThreadSize = 2;
-    if (request_size_ < kMinThreadSize) {
+    if (num_threads_ < 2) {
       closure();
-    } else {
-      tasks_.emplace_back(closure);
+      return;
     }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++pending_;
+    }
+    sentencepiece::ScheduleOnSharedThreadPool([this, closure]() {
+        closure();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) cv_.notify_all();
+      });
   }
 
  private:
-  size_t request_size_ = 0;
-  std::vector<std::thread> tasks_;
+  int num_threads_ = 0;
+  size_t pending_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
 };
 
+// Approximate bytes of text of an input of a batch.
+inline size_t InputBytes(absl::string_view in) { return in.size(); }
+
+// An id or a piece is a few bytes of text.
+template <typename T>
+inline size_t InputBytes(const std::vector<T> &in) { return 4 * in.size(); }
+
+// Minimum bytes of the inputs per thread. A smaller batch runs inline, as
+// handing it to the workers costs more than it saves.
+constexpr size_t kMinBytesPerThread = 4096;
+
+// Caps `num_threads` by the total bytes of `ins` rather than by its size,
+// so that a few long inputs still run in parallel and many short ones run
+// inline.
 template <typename T>
 inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   if (*num_threads < 0) {
-    *num_threads = std::thread::hardware_concurrency();
+    *num_threads = sentencepiece::GetNumThreads();
+  }
+  size_t bytes = 0;
+  for (const auto &in : ins) bytes += InputBytes(in);
+  const size_t max_threads = std::min<size_t>(
+      {bytes / kMinBytesPerThread, ins.size(), 256});
+  *num_threads = std::max<int>(
+      1, std::min<int>(*num_threads, static_cast<int>(max_threads)));
+}
+
+// Returns the indices of `ins` longest first, so that the workers claiming
+// the inputs one by one do not start a long one last. Empty when the inputs
+// run inline in their order.
+template <typename T>
+inline std::vector<size_t> LongestFirstOrder(const std::vector<T> &ins,
+                                             int num_threads) {
+  std::vector<size_t> order;
+  if (num_threads < 2) return order;
+  order.resize(ins.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&ins](size_t a, size_t b) {
+    return InputBytes(ins[a]) > InputBytes(ins[b]);
+  });
+  return order;
+}
+
+// Encodes `ins` with SentencePieceProcessor::EncodeBatch() and applies the
+// options of the Python API to every output.
+template <typename T>
+std::vector<T> EncodeBatchWithOptions(
+    const sentencepiece::SentencePieceProcessor &sp,
+    const std::vector<absl::string_view> &ins, int num_threads,
+    bool add_bos, bool add_eos, bool reverse, bool emit_unk_piece) {
+  InitNumThreads(ins, &num_threads);
+  std::vector<T> outs;
+  const auto status = sp.EncodeBatch(ins, num_threads, &outs);
+  if (!status.ok()) throw status;
+  for (auto &out : outs) {
+    RewriteIds(sp, &out, add_bos, add_eos, reverse, emit_unk_piece);
   }
-  *num_threads = std::max<int>(1,
-                               std::min<int>({*num_threads,
-                                     static_cast<int>(ins.size()), 256}));
+  return outs;
+}
+
+// Decodes `ins` with SentencePieceProcessor::DecodeBatch().
+template <typename T>
+std::vector<std::string> DecodeBatch(
+    const sentencepiece::SentencePieceProcessor &sp,
+    const std::vector<std::vector<T>> &ins, int num_threads) {
+  for (const auto &in : ins) CheckIds(in, sp.GetPieceSize());
+  InitNumThreads(ins, &num_threads);
+  std::vector<std::string> outs;
+  const auto status = sp.DecodeBatch(ins, num_threads, &outs);
+  if (!status.ok()) throw status;
+  return outs;
 }
 
 #define DEFINE_ENCODE_BATCH_FUNC_IMPL(FuncName, InType, OutType)        \
   std::vector<OutType> outs(ins.size());                                \
   InitNumThreads(ins, &num_threads);                                    \
   {                                                                     \
-    ThreadPool pool(ins.size());                                        \
+    const auto order = LongestFirstOrder(ins, num_threads);             \
+    ThreadPool pool(num_threads);                                        \
     std::atomic<size_t> index = 0;                                      \
     for (int n = 0;  n < num_threads; ++n) {                            \
       pool.Schedule([&]() {                                             \
-          size_t i = 0;                                                 \
-          while ((i = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+          size_t k = 0;                                                 \
+          while ((k = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+            const size_t i = order.empty() ? k : order[k];              \
             auto out = enable_sampling ?                                \
                        self->Sample##FuncName(ins[i],                   \
                                               nbest_size, alpha) :      \
@@ -270,12 +819,14 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   std::vector<OutType> outs(ins.size());                                \
   InitNumThreads(ins, &num_threads);                                    \
   {                                                                     \
+    const auto order = LongestFirstOrder(ins, num_threads);             \
     std::atomic<size_t> index = 0;                                      \
-    ThreadPool pool(ins.size());                                        \
+    ThreadPool pool(num_threads);                                        \
     for (int n = 0;  n < num_threads; ++n) {                            \
       pool.Schedule([&]() {                                             \
-          size_t i = 0;                                                 \
-          while ((i = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+          size_t k = 0;                                                 \
+          while ((k = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+            const size_t i = order.empty() ? k : order[k];              \
             CheckIds(ins[i], self->GetPieceSize());                     \
             auto out = self->FuncName(ins[i]);                          \
             ConvertToUnicodeSpans(&out);                                \
@@ -286,6 +837,70 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   }                                                                     \
   return outs;
 
+// Encodes `ins` to ids with the options of the Python API.
+std::vector<std::vector<int>> EncodeIdsBatch(
+    const sentencepiece::SentencePieceProcessor *self,
+    const std::vector<absl::string_view> &ins, int num_threads,
+    bool enable_sampling, int nbest_size, float alpha,
+    bool add_bos, bool add_eos, bool reverse, bool emit_unk_piece) {
+  if (enable_sampling) {
+    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsIds,
+                                  absl::string_view, std::vector<int>);
+  }
+  return EncodeBatchWithOptions<std::vector<int>>(
+      *self, ins, num_threads, add_bos, add_eos, reverse, emit_unk_piece);
+}
+
+// Encodes `ins` to the ids arrays of `layout`. The flat result of
+// SentencePieceProcessor::EncodeBatch() or the sampled ids are laid out
+// as they are, without rewriting every sentence first.
+IdsArrays *EncodeIdsArrays(
+    const sentencepiece::SentencePieceProcessor *self,
+    const std::vector<absl::string_view> &ins, int num_threads,
+    bool enable_sampling, int nbest_size, float alpha,
+    const IdsLayout &layout) {
+  if (enable_sampling) {
+    const auto outs = EncodeIdsBatch(self, ins, num_threads, enable_sampling,
+                                     nbest_size, alpha, false, false, false,
+                                     false);
+    return new IdsArrays(
+        outs.size(),
+        [&](size_t i) {
+          return std::make_pair(outs[i].data(),
+                                outs[i].data() + outs[i].size());
+        },
+        layout);
+  }
+  InitNumThreads(ins, &num_threads);
+  sentencepiece::BatchEncodeResult result;
+  const auto status = self->EncodeBatch(ins, num_threads, false, false,
+                                        &result);
+  if (!status.ok()) throw status;
+  const int *ids = result.ids().data();
+  const auto &offsets = result.offsets();
+  return new IdsArrays(
+      ins.size(),
+      [&](size_t i) {
+        return std::make_pair(ids + offsets[i], ids + offsets[i + 1]);
+      },
+      layout);
+}
+
+IdsLayout MakeIdsLayout(const sentencepiece::SentencePieceProcessor *self,
+                        bool add_bos, bool add_eos, bool reverse,
+                        bool padded, int pad_id, int max_length) {
+  IdsLayout layout;
+  layout.add_bos = add_bos;
+  layout.add_eos = add_eos;
+  layout.reverse = reverse;
+  layout.padded = padded;
+  layout.max_length = max_length;
+  layout.bos_id = self->bos_id();
+  layout.eos_id = self->eos_id();
+  layout.pad_id = pad_id;
+  return layout;
+}
+
 }  // namespace
 %}
 
@@ -299,6 +914,53 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   }
 }
 
+// Runs the native part of the encode and decode methods without the GIL.
+%define RELEASE_GIL(method)
+%exception sentencepiece::SentencePieceProcessor::method {
+  try {
+    {
+      ScopedReleaseGIL release_gil;
+      $action
+    }
+    ReleaseResultObject(resultobj);
+  }
+  catch (const sentencepiece::util::Status &status) {
+    SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+  }
+}
+%enddef
+
+RELEASE_GIL(_EncodeAsIds)
+RELEASE_GIL(_EncodeAsPieces)
+RELEASE_GIL(_EncodeAsSerializedProto)
+RELEASE_GIL(_EncodeAsImmutableProto)
+RELEASE_GIL(_EncodeAsIdsBatch)
+RELEASE_GIL(_EncodeAsPiecesBatch)
+RELEASE_GIL(_EncodeAsSerializedProtoBatch)
+RELEASE_GIL(_EncodeAsImmutableProtoBatch)
+RELEASE_GIL(_DecodeIds)
+RELEASE_GIL(_DecodeIdsAsBytes)
+RELEASE_GIL(_DecodePieces)
+RELEASE_GIL(_DecodeIdsAsSerializedProto)
+RELEASE_GIL(_DecodePiecesAsSerializedProto)
+RELEASE_GIL(_DecodeIdsAsImmutableProto)
+RELEASE_GIL(_DecodePiecesAsImmutableProto)
+RELEASE_GIL(_DecodeIdsBatch)
+RELEASE_GIL(_DecodeIdsAsBytesBatch)
+RELEASE_GIL(_DecodeIdsAsSerializedProtoBatch)
+RELEASE_GIL(_DecodeIdsAsImmutableProtoBatch)
+RELEASE_GIL(_DecodePiecesBatch)
+RELEASE_GIL(_DecodePiecesAsSerializedProtoBatch)
+RELEASE_GIL(_DecodePiecesAsImmutableProtoBatch)
+RELEASE_GIL(_NBestEncodeAsIds)
+RELEASE_GIL(_NBestEncodeAsPieces)
+RELEASE_GIL(_NBestEncodeAsSerializedProto)
+RELEASE_GIL(_NBestEncodeAsImmutableProto)
+RELEASE_GIL(_SampleEncodeAndScoreAsIds)
+RELEASE_GIL(_SampleEncodeAndScoreAsPieces)
+RELEASE_GIL(_SampleEncodeAndScoreAsSerializedProto)
+RELEASE_GIL(_SampleEncodeAndScoreAsImmutableProto)
+
 %apply unsigned int { uint32_t }
 
 %ignore sentencepiece::util::Status;
@@ -309,17 +971,29 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 %ignore sentencepiece::NormalizerSpec;
 %ignore sentencepiece::TrainerSpec;
 %ignore sentencepiece::SentencePieceProcessor::status;
+%ignore sentencepiece::ScheduleOnSharedThreadPool;
 %ignore sentencepiece::ImmutableSentencePieceText::mutable_proto;
 %ignore sentencepiece::ImmutableSentencePieceText::pieces() const;
 %ignore sentencepiece::ImmutableSentencePieceText::ConvertToUnicodeSpans;
 %ignore sentencepiece::ImmutableNBestSentencePieceText::mutable_proto;
 %ignore sentencepiece::ImmutableNBestSentencePieceText::nbests() const;
 %ignore sentencepiece::ImmutableNBestSentencePieceText::ConvertToUnicodeSpans;
+%ignore sentencepiece::ImmutableSentencePieceText::ImmutableSentencePieceText(std::shared_ptr<google::protobuf::Arena>);
+%ignore sentencepiece::ImmutableNBestSentencePieceText::ImmutableNBestSentencePieceText(std::shared_ptr<google::protobuf::Arena>);
 
 %ignore sentencepiece::SentencePieceProcessor::Encode;
 %ignore sentencepiece::SentencePieceProcessor::SampleEncode;
 %ignore sentencepiece::SentencePieceProcessor::NBestEncode;
 %ignore sentencepiece::SentencePieceProcessor::SampleEncodeAndScore;
+%ignore sentencepiece::SentencePieceProcessor::SampleEncodeBatch;
+%ignore sentencepiece::SentencePieceProcessor::SampleEncodeAndScoreBatch;
+%ignore sentencepiece::SentencePieceProcessor::CalculateEntropyBatch;
+%ignore sentencepiece::SentencePieceProcessor::EncodeBatch;
+%ignore sentencepiece::SentencePieceProcessor::DecodeBatch;
+%ignore sentencepiece::SentencePieceProcessor::NBestEncodeBatch;
+%ignore sentencepiece::SentencePieceProcessor::CountTokens;
+%ignore sentencepiece::SentencePieceProcessor::CountTokensBatch;
+%ignore sentencepiece::SentencePieceProcessor::EncodeWithOffsets;
 %ignore sentencepiece::SentencePieceProcessor::Decode;
 
 %ignore sentencepiece::SentencePieceProcessor::EncodeAsPieces;
@@ -354,10 +1028,42 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 %ignore sentencepiece::SentencePieceProcessor::mutable_normalizer_spec;
 %ignore sentencepiece::SentencePieceProcessor::Load;
 %ignore sentencepiece::SentencePieceProcessor::LoadOrDie;
+%ignore sentencepiece::SentencePieceProcessor::ShareModel;
+%ignore sentencepiece::SentencePieceProcessor::ExportCompactModel;
+%ignore sentencepiece::SentencePieceProcessor::LoadFromCompiledArray;
+%ignore sentencepiece::SentencePieceProcessor::LoadAsync;
+%ignore sentencepiece::SentencePieceProcessor::SetSelfTestMode;
+%ignore sentencepiece::SentencePieceProcessor::SetUseHugePages;
+%ignore sentencepiece::SentencePieceProcessor::SelfTestStatus;
 %ignore sentencepiece::SentencePieceProcessor::SetModel;
 %ignore sentencepiece::SentencePieceProcessor::SetNormalizer;
+%ignore sentencepiece::SentencePieceProcessor::EncodeStatsEnabled;
+%ignore sentencepiece::SentencePieceProcessor::GetEncodeStats;
+%ignore sentencepiece::SentencePieceProcessor::ResetEncodeStats;
+%ignore sentencepiece::EncodeStats;
+%ignore sentencepiece::SentencePieceProcessor::GetMemoryUsage;
+%ignore sentencepiece::MemoryUsage;
+%ignore sentencepiece::SentencePieceProcessor::SetEncodeTracer;
+%ignore sentencepiece::EncodeTracer;
+%ignore sentencepiece::SentencePieceProcessor::EncodeUTF16;
+%ignore sentencepiece::SentencePieceProcessor::EncodeUTF16Batch;
+%ignore sentencepiece::SentencePieceProcessor::DecodeUTF16;
+%ignore sentencepiece::CancellationToken;
+%ignore sentencepiece::ScopedCancellation;
 %ignore sentencepiece::pretokenizer::PretokenizerForTrainingInterface;
 %ignore sentencepiece::SentenceIterator;
+%ignore sentencepiece::StreamingEncoder;
+%ignore sentencepiece::PrefixEncoder;
+%ignore sentencepiece::IncrementalEncoder;
+%ignore sentencepiece::StreamingDecoder::Feed;
+%ignore sentencepiece::StreamingDecoder::Finish;
+%ignore sentencepiece::ReloadableSentencePieceProcessor;
+%ignore sentencepiece::BatchEncodeResult;
+%ignore sentencepiece::BatchSampleResult;
+%ignore sentencepiece::NBestResult;
+%ignore sentencepiece::VocabularyTable;
+%ignore sentencepiece::SampleGenerator;
+%ignore sentencepiece::SentencePieceProcessor::GetVocabularyTable;
 %ignore sentencepiece::ConvertToUnicodeSpans;
 %ignore sentencepiece::SentencePieceTrainer::Train;
 %ignore sentencepiece::SentencePieceTrainer::GetNormalizerSpec;
@@ -368,10 +1074,15 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 %ignore sentencepiece::SentencePieceTrainer::PieceProcecssor;
 %ignore sentencepiece::SentencePieceTrainer::SetPretokenizerForTraining;
 %ignore sentencepiece::SentencePieceTrainer::GetPretokenizerForTraining;
+%ignore sentencepiece::SentencePieceTrainer::SetTrainerObserver;
+%ignore sentencepiece::SentencePieceTrainer::GetTrainerObserver;
+%ignore sentencepiece::TrainerEvent;
+%ignore sentencepiece::TrainerObserver;
 %ignore sentencepiece::ConvertToUnicodeAlignment;
 
 %ignore sentencepiece::SentencePieceNormalizer::Load;
 %ignore sentencepiece::SentencePieceNormalizer::Normalize;
+%ignore sentencepiece::SentencePieceNormalizer::NormalizeBatch;
 %ignore sentencepiece::SentencePieceNormalizer::mutable_normalizer_spec;
 
 %ignore sentencepiece::io::LoadModelProto;
@@ -441,8 +1152,8 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
       bool enable_sampling, int nbest_size, float alpha,
       bool add_bos, bool add_eos, bool reverse,
       bool emit_unk_piece) const {
-    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsIds,
-                                  absl::string_view, std::vector<int>);
+    return EncodeIdsBatch($self, ins, num_threads, enable_sampling, nbest_size,
+                          alpha, add_bos, add_eos, reverse, emit_unk_piece);
   }
 
   std::vector<std::vector<std::string>> _EncodeAsPiecesBatch(
@@ -450,8 +1161,12 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
       bool enable_sampling, int nbest_size, float alpha,
       bool add_bos, bool add_eos, bool reverse,
       bool emit_unk_piece) const {
-    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsPieces,
-                                  absl::string_view, std::vector<std::string>);
+    if (enable_sampling) {
+      DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsPieces, absl::string_view,
+                                    std::vector<std::string>);
+    }
+    return EncodeBatchWithOptions<std::vector<std::string>>(
+        *$self, ins, num_threads, add_bos, add_eos, reverse, emit_unk_piece);
   }
 
   BytesArray _EncodeAsSerializedProtoBatch(
@@ -470,9 +1185,122 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
       bool enable_sampling, int nbest_size, float alpha,
       bool add_bos, bool add_eos, bool reverse,
       bool emit_unk_piece) const {
-    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsImmutableProto,
-                                  absl::string_view,
-                                  sentencepiece::ImmutableSentencePieceText);
+    if (enable_sampling) {
+      DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsImmutableProto,
+                                    absl::string_view,
+                                    sentencepiece::ImmutableSentencePieceText);
+    }
+    RewriteIds(*$self, static_cast<sentencepiece::ImmutableSentencePieceText *>(nullptr),
+               add_bos, add_eos, reverse, emit_unk_piece);
+    InitNumThreads(ins, &num_threads);
+    // The protos of the batch are allocated on one arena.
+    std::vector<sentencepiece::ImmutableSentencePieceText> outs;
+    const auto _status = $self->EncodeBatch(ins, num_threads, &outs);
+    if (!_status.ok()) throw _status;
+    for (auto &out : outs) out.ConvertToUnicodeSpans();
+    return outs;
+  }
+
+  PyObject *_GetVocabularyTable() const {
+    auto *table = new sentencepiece::VocabularyTable;
+    const auto _status = $self->GetVocabularyTable(table);
+    if (!_status.ok()) {
+      delete table;
+      throw _status;
+    }
+    return MakeVocabularyArrays(table);
+  }
+
+  PyObject *_EncodeBatch(const std::vector<absl::string_view> &ins,
+                         int num_threads, bool with_pieces,
+                         bool with_alignment, bool unicode_offsets) const {
+    InitNumThreads(ins, &num_threads);
+    auto *result = new sentencepiece::BatchEncodeResult;
+    sentencepiece::util::Status _status;
+    {
+      // The arrays are Python objects made after the GIL is taken back.
+      ScopedReleaseGIL release_gil;
+      _status = $self->EncodeBatch(ins, num_threads, with_pieces,
+                                   with_alignment, unicode_offsets, result);
+    }
+    if (!_status.ok()) {
+      delete result;
+      throw _status;
+    }
+    return MakeBatchEncodeArrays(result);
+  }
+
+  PyObject *_EncodeAsIdsArrays(
+      const std::vector<absl::string_view> &ins, int num_threads,
+      bool enable_sampling, int nbest_size, float alpha,
+      bool add_bos, bool add_eos, bool reverse,
+      bool emit_unk_piece, bool padded, int pad_id,
+      int max_length) const {
+    const IdsLayout layout = MakeIdsLayout($self, add_bos, add_eos, reverse,
+                                           padded, pad_id, max_length);
+    auto *arrays = [&]() {
+      ScopedReleaseGIL release_gil;
+      return EncodeIdsArrays($self, ins, num_threads, enable_sampling,
+                             nbest_size, alpha, layout);
+    }();
+    return MakeIdsArrays(arrays, padded);
+  }
+
+  PyObject *_EncodeBufferAsIdsArrays(
+      PyObject *data, PyObject *offsets, int num_threads,
+      bool enable_sampling, int nbest_size, float alpha,
+      bool add_bos, bool add_eos, bool reverse,
+      bool emit_unk_piece, bool padded, int pad_id,
+      int max_length) const {
+    const ScopedBuffer data_buffer(data, PyBUF_SIMPLE);
+    if (!data_buffer.ok()) return nullptr;
+    const ScopedBuffer offsets_buffer(offsets, PyBUF_FORMAT | PyBUF_STRIDES);
+    if (!offsets_buffer.ok()) return nullptr;
+    std::vector<absl::string_view> ins;
+    if (!SplitBuffer(data_buffer.view(), offsets_buffer.view(), &ins)) {
+      return nullptr;
+    }
+    const IdsLayout layout = MakeIdsLayout($self, add_bos, add_eos, reverse,
+                                           padded, pad_id, max_length);
+    auto *arrays = [&]() {
+      ScopedReleaseGIL release_gil;
+      return EncodeIdsArrays($self, ins, num_threads, enable_sampling,
+                             nbest_size, alpha, layout);
+    }();
+    return MakeIdsArrays(arrays, padded);
+  }
+
+  PyObject *_EncodeArrow(PyObject *schema, PyObject *array,
+                         int num_threads) const {
+    const auto *input_schema = static_cast<const ArrowSchema *>(
+        PyCapsule_GetPointer(schema, "arrow_schema"));
+    if (input_schema == nullptr) return nullptr;
+    const auto *input = static_cast<const ArrowArray *>(
+        PyCapsule_GetPointer(array, "arrow_array"));
+    if (input == nullptr) return nullptr;
+    if (num_threads < 0) num_threads = sentencepiece::GetNumThreads();
+    num_threads = std::max<int>(1, std::min<int>(num_threads, 256));
+
+    auto output_schema = std::make_unique<ArrowSchema>();
+    auto output = std::make_unique<ArrowArray>();
+    sentencepiece::util::Status _status;
+    {
+      ScopedReleaseGIL release_gil;
+      _status = sentencepiece::EncodeArrowArray(
+          *$self, *input_schema, *input, num_threads, output_schema.get(),
+          output.get());
+    }
+    if (!_status.ok()) throw _status;
+    PyObject *schema_capsule = PyCapsule_New(
+        output_schema.release(), "arrow_schema", DeleteArrowSchemaCapsule);
+    PyObject *array_capsule = PyCapsule_New(
+        output.release(), "arrow_array", DeleteArrowArrayCapsule);
+    PyObject *tuple = schema_capsule != nullptr && array_capsule != nullptr
+                          ? PyTuple_Pack(2, schema_capsule, array_capsule)
+                          : nullptr;
+    Py_XDECREF(schema_capsule);
+    Py_XDECREF(array_capsule);
+    return tuple;
   }
 
   /////////////////////////////////////////////////////////////////////////////
@@ -523,12 +1351,12 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   // DecodeAs* (Batch request)
   std::vector<std::string> _DecodeIdsBatch(
       const std::vector<std::vector<int>> &ins, int num_threads) const {
-    DEFINE_DECODE_BATCH_FUNC_IMPL(DecodeIds, int, std::string);
+    return DecodeBatch(*$self, ins, num_threads);
   }
 
   BytesArray _DecodeIdsAsBytesBatch(
       const std::vector<std::vector<int>> &ins, int num_threads) const {
-    DEFINE_DECODE_BATCH_FUNC_IMPL(DecodeIds, int, std::string);
+    return DecodeBatch(*$self, ins, num_threads);
   }
 
   BytesArray _DecodeIdsAsSerializedProtoBatch(
@@ -546,7 +1374,7 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 
   std::vector<std::string> _DecodePiecesBatch(
       const std::vector<std::vector<absl::string_view>> &ins, int num_threads) const {
-    DEFINE_DECODE_BATCH_FUNC_IMPL(DecodePieces, std::string, std::string);
+    return DecodeBatch(*$self, ins, num_threads);
   }
 
   BytesArray _DecodePiecesAsSerializedProtoBatch(
@@ -688,12 +1516,14 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
     std::vector<float> outs(ins.size());
     InitNumThreads(ins, &num_threads);
     {
-      ThreadPool pool(ins.size());
+      const auto order = LongestFirstOrder(ins, num_threads);
+      ThreadPool pool(num_threads);
       std::atomic<size_t> index = 0;
       for (int n = 0;  n < num_threads; ++n) {
         pool.Schedule([&]() {
-           size_t i = 0;
-           while ((i = std::atomic_fetch_add(&index, 1)) < outs.size()) {
+           size_t k = 0;
+           while ((k = std::atomic_fetch_add(&index, 1)) < outs.size()) {
+             const size_t i = order.empty() ? k : order[k];
              outs[i] = self->CalculateEntropy(ins[i], alpha);
            }
          });
@@ -760,6 +1590,7 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
     self._nbest_size = nbest_size
     self._alpha = alpha
     self._num_threads = num_threads
+    self._compiled_model_file = None
     if model_file or model_proto:
       self.Load(model_file=model_file, model_proto=model_proto)
 
@@ -774,12 +1605,18 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
              enable_sampling=None,
              nbest_size=None,
              alpha=None,
-             num_threads=None):
+             num_threads=None,
+             max_length=None):
     """Encode text input to segmented ids or tokens.
 
       Args:
       input: input string. accepsts list of string.
-      out_type: output type. int or str.
+      out_type: output type. int, str, 'serialized_proto', 'immutable_proto',
+                'numpy' or 'numpy_padded'. 'numpy' returns the ids of a list
+                as a flat int32 numpy array and the offsets of the sentences
+                in it, and 'numpy_padded' returns them as a 2D int32 array
+                padded with pad_id() and the lengths of the sentences. The
+                arrays are filled in C++ without Python objects of the ids.
       add_bos: Add <s> to the result (Default = false)
       add_eos: Add </s> to the result (Default = false) <s>/</s> is added after
                reversing (if enabled).
@@ -794,6 +1631,10 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
       alpha: Soothing parameter for unigram sampling, and merge probability for
              BPE-dropout (probablity 'p' in BPE-dropout paper).
       num_threads: the number of threads used in the batch processing (Default = -1).
+      max_length: Truncates the ids of 'numpy' and 'numpy_padded' to this length
+                  with <s> and </s>, dropping the end of the sentence before
+                  reversing (Default = None, no truncation). <s>, </s>,
+                  truncation, reversal, and padding are done in one pass in C++.
     """
 
     if out_type is None:
@@ -827,6 +1668,24 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
     if num_threads is None or type(num_threads) is not int:
       raise RuntimeError('num_threads must be int')
 
+    if max_length is not None:
+      if out_type != 'numpy' and out_type != 'numpy_padded':
+        raise RuntimeError(
+            'max_length is supported only in numpy and numpy_padded out_type')
+      if type(max_length) is not int or max_length < add_bos + add_eos:
+        raise ValueError('max_length must be an int of <s> and </s> at least')
+
+    if out_type == 'numpy' or out_type == 'numpy_padded':
+      import numpy
+      padded = out_type == 'numpy_padded'
+      ids, sizes = self._EncodeAsIdsArrays(
+          input if type(input) is list else [input], num_threads,
+          enable_sampling, nbest_size, alpha, add_bos, add_eos, reverse,
+          emit_unk_piece, padded, self.pad_id(), max_length or 0)
+      if type(input) is not list:
+        return numpy.asarray(ids)[0] if padded else numpy.asarray(ids)
+      return numpy.asarray(ids), numpy.asarray(sizes)
+
     if type(input) is list:
       if out_type is int:
         return self._EncodeAsIdsBatch(input, num_threads, enable_sampling, nbest_size,
@@ -1164,6 +2023,24 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
     return None
 
 
+  async def EncodeAsync(self, input, **kwargs):
+    """Encode() on a worker thread, awaited without blocking the event loop.
+
+    The GIL is released while the input is encoded, so that the event loop
+    serves the other requests meanwhile. The arguments are as in Encode().
+    """
+    import asyncio
+    return await asyncio.get_running_loop().run_in_executor(
+        _get_async_executor(), lambda: self.Encode(input, **kwargs))
+
+
+  async def DecodeAsync(self, input, **kwargs):
+    """Decode() on a worker thread, as EncodeAsync() does."""
+    import asyncio
+    return await asyncio.get_running_loop().run_in_executor(
+        _get_async_executor(), lambda: self.Decode(input, **kwargs))
+
+
   def DecodePieces(self, input, out_type=str, **kwargs):
     return self.Decode(input=input, out_type=out_type, **kwargs)
 
@@ -1188,6 +2065,137 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
     return self.Decode(input=input, out_type=out_type, **kwargs)
 
 
+  def EncodeBuffer(self,
+                   data,
+                   offsets,
+                   out_type='numpy',
+                   add_bos=None,
+                   add_eos=None,
+                   reverse=None,
+                   emit_unk_piece=None,
+                   enable_sampling=None,
+                   nbest_size=None,
+                   alpha=None,
+                   num_threads=None,
+                   max_length=None):
+    """Encodes the sentences in one buffer without converting them one by one.
+
+    The i-th sentence is the UTF-8 data[offsets[i]:offsets[i + 1]], as in the
+    value and offset buffers of an Arrow string array. The sentences are
+    encoded in place, without the Python string of every sentence and its
+    UTF-8 copy that encoding a list makes.
+
+    Args:
+      data: bytes, or any object of the buffer protocol, e.g., memoryview.
+      offsets: 1D buffer of the len(sentences) + 1 offsets, of 32 or 64 bit
+        integers.
+      out_type: 'numpy', 'numpy_padded' or int, as in Encode() for a list
+        (Default = 'numpy').
+      The other arguments are as in Encode().
+    """
+    if add_bos is None:
+      add_bos = self._add_bos
+    if add_eos is None:
+      add_eos = self._add_eos
+    if reverse is None:
+      reverse = self._reverse
+    if emit_unk_piece is None:
+      emit_unk_piece = self._emit_unk_piece
+    if enable_sampling is None:
+      enable_sampling = self._enable_sampling
+    if nbest_size is None:
+      nbest_size = self._nbest_size
+    if alpha is None:
+      alpha = self._alpha
+    if num_threads is None:
+      num_threads = self._num_threads
+    if num_threads is None or type(num_threads) is not int:
+      raise RuntimeError('num_threads must be int')
+    if out_type not in ['numpy', 'numpy_padded', int]:
+      raise RuntimeError('unknown out_type={}'.format(out_type))
+    if max_length is not None and (type(max_length) is not int or
+                                   max_length < add_bos + add_eos):
+      raise ValueError('max_length must be an int of <s> and </s> at least')
+
+    padded = out_type == 'numpy_padded'
+    ids, sizes = self._EncodeBufferAsIdsArrays(
+        data, offsets, num_threads, enable_sampling, nbest_size, alpha,
+        add_bos, add_eos, reverse, emit_unk_piece, padded, self.pad_id(),
+        max_length or 0)
+    if out_type is int:
+      ids, sizes = memoryview(ids), memoryview(sizes)
+      return [ids[sizes[i]:sizes[i + 1]].tolist()
+              for i in range(len(sizes) - 1)]
+    import numpy
+    return numpy.asarray(ids), numpy.asarray(sizes)
+
+  def EncodeArrow(self, array, num_threads=None):
+    """Encodes an Arrow string array to a list<int32> array of the ids.
+
+    The strings are encoded in place and the ids are not copied, so that
+    the sentences do not go through Python objects. Null strings are null
+    lists, and a large string array is encoded to a large_list<int32>
+    array.
+
+    Args:
+      array: a string or large string array of the Arrow PyCapsule interface,
+        e.g., pyarrow.Array.
+      num_threads: the number of threads (Default = num_threads of Init())
+
+    Returns:
+      ArrowIds, an array of the Arrow PyCapsule interface, e.g., to import
+      with pyarrow.array(ids).
+    """
+    if num_threads is None:
+      num_threads = self._num_threads
+    if num_threads is None or type(num_threads) is not int:
+      raise RuntimeError('num_threads must be int')
+    if not hasattr(array, '__arrow_c_array__'):
+      raise TypeError('array must implement __arrow_c_array__')
+    schema, data = array.__arrow_c_array__()
+    return ArrowIds(self._EncodeArrow(schema, data, num_threads))
+
+  def EncodeBatch(self,
+                  input,
+                  num_threads=None,
+                  with_pieces=False,
+                  with_alignment=False,
+                  unicode_offsets=False):
+    """Encodes a list of sentences into one BatchEncodeResult.
+
+    Unlike Encode(), the ids of all the sentences are kept in a few flat
+    arrays, which numpy.asarray() reads without a copy. The encode extra
+    options of SetEncodeExtraOptions() apply, while add_bos, add_eos,
+    reverse and emit_unk_piece of Init() do not.
+
+    Args:
+      input: a list of sentences.
+      num_threads: the number of threads (Default = num_threads of Init())
+      with_pieces: Stores the pieces (Default = false)
+      with_alignment: Stores the byte offsets of the pieces in the sentences
+        (Default = false)
+      unicode_offsets: Stores the offsets in Unicode characters instead of
+        bytes (Default = false). Without with_pieces, the pieces and their
+        surfaces are never built.
+    """
+    if type(input) is not list:
+      raise TypeError('input must be a list')
+    if num_threads is None:
+      num_threads = self._num_threads
+    if num_threads is None or type(num_threads) is not int:
+      raise RuntimeError('num_threads must be int')
+    return BatchEncodeResult(
+        self._EncodeBatch(input, num_threads, with_pieces, with_alignment,
+                        unicode_offsets))
+
+  def GetVocabularyTable(self):
+    """Returns all the pieces with their scores and types at once.
+
+    Much faster than calling IdToPiece(), GetScore() and the Is*() methods
+    for every id. See VocabularyTable.
+    """
+    return VocabularyTable(self._GetVocabularyTable())
+
   def CalculateEntropy(self, input, alpha, num_threads=None):
     """Calculate sentence entropy"""
     if type(input) is list:
@@ -1226,12 +2234,24 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 
 
   def __getstate__(self):
+    # A processor of a compiled model is pickled as the path of the model,
+    # e.g., for the DataLoader workers, which then map the pages of the same
+    # file instead of each parsing and building its own copy of the model.
+    if self._compiled_model_file is not None:
+      return self._compiled_model_file
     return self.serialized_model_proto()
 
 
-  def __setstate__(self, serialized_model_proto):
+  def __setstate__(self, state):
     self.__init__()
-    self.LoadFromSerializedProto(serialized_model_proto)
+    if type(state) is not dict:
+      self.LoadFromSerializedProto(state)
+      return
+    path = state['compiled_model_file']
+    stat = os.stat(path)
+    if (stat.st_size, stat.st_mtime_ns) != (state['size'], state['mtime_ns']):
+      raise RuntimeError('{} was modified after it was pickled'.format(path))
+    self.Load(model_file=path)
 
 
   def __len__(self):
@@ -1252,9 +2272,19 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
     """
     if model_file and model_proto:
       raise RuntimeError('model_file and model_proto must be exclusive.')
+    self._compiled_model_file = None
     if model_proto:
       return self.LoadFromSerializedProto(model_proto)
-    return self.LoadFromFile(model_file)
+    status = self.LoadFromFile(model_file)
+    with open(model_file, 'rb') as f:
+      is_compiled = f.read(8) == b'SPMCMODL'
+    if is_compiled:
+      path = os.path.abspath(model_file)
+      stat = os.stat(path)
+      self._compiled_model_file = {'compiled_model_file': path,
+                                   'size': stat.st_size,
+                                   'mtime_ns': stat.st_mtime_ns}
+    return status
 }
 }
 
@@ -1273,7 +2303,12 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 
   static void _TrainFromMap2(const std::unordered_map<std::string, std::string> &args,
                             SentenceIterator *iter) {
-    const auto _status = sentencepiece::SentencePieceTrainer::Train(args, iter);
+    sentencepiece::util::Status _status;
+    {
+      // The iterator takes the GIL only while it reads the Python iterator.
+      ScopedReleaseGIL release_gil;
+      _status = sentencepiece::SentencePieceTrainer::Train(args, iter);
+    }
     if (!_status.ok()) throw _status;
     return;
   }
@@ -1288,7 +2323,11 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   static sentencepiece::util::bytes _TrainFromMap4(const std::unordered_map<std::string, std::string> &args,
                                                   SentenceIterator *iter) {
     sentencepiece::util::bytes model_proto;
-    const auto _status = sentencepiece::SentencePieceTrainer::Train(args, iter, &model_proto);
+    sentencepiece::util::Status _status;
+    {
+      ScopedReleaseGIL release_gil;
+      _status = sentencepiece::SentencePieceTrainer::Train(args, iter, &model_proto);
+    }
     if (!_status.ok()) throw _status;
     return model_proto;
   }
@@ -1432,6 +2471,41 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
 %}
 }
 
+%extend sentencepiece::StreamingDecoder {
+  std::string Put(int id) {
+    std::string text;
+    const auto _status = $self->Feed(id, &text);
+    if (!_status.ok()) throw _status;
+    return text;
+  }
+
+  std::string Flush() {
+    std::string text;
+    const auto _status = $self->Finish(&text);
+    if (!_status.ok()) throw _status;
+    return text;
+  }
+
+%pythoncode %{
+  def Init(self, sp):
+    """Initializes a decoder of the ids generated one by one.
+
+    put(id) returns the text which became final with `id`, and flush()
+    returns the rest of the sequence. The concatenated text is the same as
+    sp.decode() of all the ids, at a constant cost per id. The bytes of an
+    incomplete UTF-8 character are held back until the character is
+    complete. After flush(), the decoder can decode a new sequence.
+
+    Args:
+      sp: The SentencePieceProcessor. It must not be reloaded while the
+        decoder is in use.
+    """
+
+    _streaming_decoder_init_native(self, sp)
+    self._sp = sp
+%}
+}
+
 %extend sentencepiece::ImmutableSentencePieceText_ImmutableSentencePiece {
   const sentencepiece::util::bytes& _surface_as_bytes() const {
     return $self->surface();
@@ -1924,6 +2998,116 @@ from io import StringIO
 from io import BytesIO
 
 
+_async_executor = None
+
+
+def _get_async_executor():
+  """Returns the threads of the async methods, created on first use.
+
+  The processor methods release the GIL in the native code, so these
+  threads do not hold it while they encode and decode.
+  """
+  global _async_executor
+  if _async_executor is None:
+    import concurrent.futures
+    _async_executor = concurrent.futures.ThreadPoolExecutor(
+        thread_name_prefix='sentencepiece')
+  return _async_executor
+
+
+def _reset_async_executor():
+  global _async_executor
+  _async_executor = None
+
+
+# The child of fork() has none of the threads of the parent.
+if hasattr(os, 'register_at_fork'):
+  os.register_at_fork(after_in_child=_reset_async_executor)
+
+
+class BatchEncodeResult(object):
+  """Flat result of SentencePieceProcessor.EncodeBatch().
+
+  The ids of the i-th sentence are ids[offsets[i]:offsets[i + 1]]. With
+  with_pieces, the j-th piece is pieces[piece_offsets[j]:piece_offsets[j + 1]],
+  and with with_alignment, begins[j] and ends[j] are the byte offsets (or the
+  character offsets with unicode_offsets) of the j-th piece in its sentence.
+  All of them are read-only memoryviews of the arrays of the C++ result.
+  """
+
+  def __init__(self, arrays):
+    (self.ids, self.offsets, self.pieces, self.piece_offsets, self.begins,
+     self.ends) = [memoryview(array) for array in arrays]
+
+  def __len__(self):
+    return len(self.offsets) - 1
+
+  def __getitem__(self, index):
+    if index < 0:
+      index += len(self)
+    if index < 0 or index >= len(self):
+      raise IndexError('batch index is out of range.')
+    return self.ids[self.offsets[index]:self.offsets[index + 1]].tolist()
+
+  def piece(self, index):
+    """Returns the index-th piece of ids."""
+    begin, end = self.piece_offsets[index], self.piece_offsets[index + 1]
+    return self.pieces[begin:end].tobytes().decode('utf-8')
+
+
+class VocabularyTable(object):
+  """Flat vocabulary of SentencePieceProcessor.GetVocabularyTable().
+
+  The piece of id i is pieces[piece_offsets[i]:piece_offsets[i + 1]], and
+  scores[i] and types[i] are its score and ModelProto.SentencePiece.Type,
+  e.g., 1 for NORMAL and 3 for CONTROL. All of them are read-only
+  memoryviews of the arrays of the C++ table.
+  """
+
+  NORMAL = 1
+  UNKNOWN = 2
+  CONTROL = 3
+  USER_DEFINED = 4
+  UNUSED = 5
+  BYTE = 6
+
+  def __init__(self, arrays):
+    (self.pieces, self.piece_offsets, self.scores,
+     self.types) = [memoryview(array) for array in arrays]
+
+  def __len__(self):
+    return len(self.scores)
+
+  def piece(self, id):
+    """Returns the piece of id."""
+    begin, end = self.piece_offsets[id], self.piece_offsets[id + 1]
+    return self.pieces[begin:end].tobytes().decode('utf-8')
+
+  def piece_list(self):
+    """Returns the list of all the pieces."""
+    blob = self.pieces.tobytes()
+    offsets = self.piece_offsets.tolist()
+    return [blob[offsets[i]:offsets[i + 1]].decode('utf-8')
+            for i in range(len(self))]
+
+
+class ArrowIds(object):
+  """list<int32> array of SentencePieceProcessor.EncodeArrow().
+
+  It implements the Arrow PyCapsule interface, and is moved to the first
+  consumer, e.g., of pyarrow.array(ids).
+  """
+
+  def __init__(self, capsules):
+    self._capsules = capsules
+
+  def __arrow_c_array__(self, requested_schema=None):
+    if self._capsules is None:
+      raise RuntimeError('the array is already exported.')
+    capsules, self._capsules = self._capsules, None
+    return capsules
+
+
 def _add_snake_case(classname):
   """Added snake_cased method from CammelCased method."""
 
@@ -1956,8 +3140,10 @@ def _batchnize(classname, name):
 
 _sentencepiece_processor_init_native = SentencePieceProcessor.__init__
 _sentencepiece_normalizer_init_native = SentencePieceNormalizer.__init__
+_streaming_decoder_init_native = StreamingDecoder.__init__
 setattr(SentencePieceProcessor, '__init__', SentencePieceProcessor.Init)
 setattr(SentencePieceNormalizer, '__init__', SentencePieceNormalizer.Init)
+setattr(StreamingDecoder, '__init__', StreamingDecoder.Init)
 
 SentencePieceProcessor.Tokenize = SentencePieceProcessor.Encode
 SentencePieceProcessor.Detokenize = SentencePieceProcessor.Decode
@@ -1971,8 +3157,11 @@ for m in [
 _add_snake_case(SentencePieceProcessor)
 _add_snake_case(SentencePieceTrainer)
 _add_snake_case(SentencePieceNormalizer)
+_add_snake_case(StreamingDecoder)
 set_random_generator_seed = SetRandomGeneratorSeed
 set_min_log_level = SetMinLogLevel
+set_thread_options = SetThreadOptions
+get_num_threads = GetNumThreads
 
 from ._version import __version__
 
@@ -2990,14 +2990,15 @@ SWIG_Python_NonDynamicSetAttr(PyObject *obj, PyObject *name, PyObject *value) {
 #define SWIGTYPE_p_sentencepiece__SentencePieceNormalizer swig_types[6]
 #define SWIGTYPE_p_sentencepiece__SentencePieceProcessor swig_types[7]
 #define SWIGTYPE_p_sentencepiece__SentencePieceTrainer swig_types[8]
-#define SWIGTYPE_p_std__string swig_types[9]
-#define SWIGTYPE_p_std__unordered_mapT_std__string_std__string_t swig_types[10]
-#define SWIGTYPE_p_std__vectorT_absl__string_view_t swig_types[11]
-#define SWIGTYPE_p_std__vectorT_int_t swig_types[12]
-#define SWIGTYPE_p_std__vectorT_std__vectorT_absl__string_view_t_t swig_types[13]
-#define SWIGTYPE_p_std__vectorT_std__vectorT_int_t_t swig_types[14]
-static swig_type_info *swig_types[16];
-static swig_module_info swig_module = {swig_types, 15, 0, 0, 0, 0};
+#define SWIGTYPE_p_sentencepiece__StreamingDecoder swig_types[9]
+#define SWIGTYPE_p_std__string swig_types[10]
+#define SWIGTYPE_p_std__unordered_mapT_std__string_std__string_t swig_types[11]
+#define SWIGTYPE_p_std__vectorT_absl__string_view_t swig_types[12]
+#define SWIGTYPE_p_std__vectorT_int_t swig_types[13]
+#define SWIGTYPE_p_std__vectorT_std__vectorT_absl__string_view_t_t swig_types[14]
+#define SWIGTYPE_p_std__vectorT_std__vectorT_int_t_t swig_types[15]
+static swig_type_info *swig_types[17];
+static swig_module_info swig_module = {swig_types, 16, 0, 0, 0, 0};
 #define SWIG_TypeQuery(name) SWIG_TypeQueryModule(&swig_module, &swig_module, name)
 #define SWIG_MangledTypeQuery(name) SWIG_MangledTypeQueryModule(&swig_module, &swig_module, name)
 
@@ -3152,8 +3153,14 @@ namespace swig {
 #include <functional>
 #include <limits>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <thread>
 #include <vector>
+#include <sentencepiece_arrow.h>
 #include <sentencepiece_processor.h>
 #include <sentencepiece_trainer.h>
 
@@ -3210,6 +3217,338 @@ PyObject* MakePyOutputBytes(const sentencepiece::util::bytes& output) {
   return PyBytes_FromStringAndSize(output.data(), output.size());
 }
 
+// Read-only buffer over an array of a BatchEncodeResult or IdsArrays, with
+// which memoryview() and numpy.asarray() read the array without a copy.
+// `owner` is the capsule deleting the result with its last array.
+struct FlatArrayObject {
+  PyObject_HEAD
+  PyObject *owner;
+  void *data;
+  Py_ssize_t size;
+  Py_ssize_t itemsize;
+  const char *format;
+  int ndim;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+void FlatArrayDealloc(PyObject *self) {
+  Py_XDECREF(reinterpret_cast<FlatArrayObject *>(self)->owner);
+  Py_TYPE(self)->tp_free(self);
+}
+
+int FlatArrayGetBuffer(PyObject *self, Py_buffer *view, int flags) {
+  auto *array = reinterpret_cast<FlatArrayObject *>(self);
+  if (PyBuffer_FillInfo(view, self, array->data,
+                        array->size * array->itemsize, 1, flags) < 0) {
+    return -1;
+  }
+  // PyBuffer_FillInfo() describes unsigned bytes.
+  if ((flags & PyBUF_ND) == PyBUF_ND) {
+    view->itemsize = array->itemsize;
+    view->ndim = array->ndim;
+    view->shape = array->shape;
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) {
+      view->strides = array->strides;
+    }
+  }
+  if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) {
+    view->format = const_cast<char *>(array->format);
+  }
+  return 0;
+}
+
+PyTypeObject *GetFlatArrayType() {
+  static PyTypeObject *type = []() -> PyTypeObject * {
+    static PyBufferProcs buffer_procs = {FlatArrayGetBuffer, nullptr};
+    static PyTypeObject flat_array_type = {PyVarObject_HEAD_INIT(nullptr, 0)};
+    flat_array_type.tp_name = "sentencepiece._FlatArray";
+    flat_array_type.tp_basicsize = sizeof(FlatArrayObject);
+    flat_array_type.tp_dealloc = FlatArrayDealloc;
+    flat_array_type.tp_as_buffer = &buffer_procs;
+    flat_array_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    flat_array_type.tp_doc = "Read-only array of BatchEncodeResult.";
+    return PyType_Ready(&flat_array_type) < 0 ? nullptr : &flat_array_type;
+  }();
+  return type;
+}
+
+// Returns the capsule owning `data`, which deletes it with the last array.
+template <typename T>
+PyObject *MakeArrayOwner(T *data) {
+  PyObject *owner = PyCapsule_New(data, nullptr, [](PyObject *capsule) {
+    delete static_cast<T *>(PyCapsule_GetPointer(capsule, nullptr));
+  });
+  if (owner == nullptr) delete data;
+  return owner;
+}
+
+// With `rows`, the array is 2D of `rows` rows of `size` / `rows` items.
+template <typename T>
+PyObject *MakeFlatArray(PyObject *owner, const T *data, size_t size,
+                        const char *format, Py_ssize_t rows = -1) {
+  static const T kEmpty = T();
+  PyTypeObject *type = GetFlatArrayType();
+  if (type == nullptr) return nullptr;
+  auto *array = PyObject_New(FlatArrayObject, type);
+  if (array == nullptr) return nullptr;
+  Py_INCREF(owner);
+  array->owner = owner;
+  array->data = const_cast<T *>(size == 0 ? &kEmpty : data);
+  array->size = size;
+  array->itemsize = sizeof(T);
+  array->format = format;
+  array->ndim = rows >= 0 ? 2 : 1;
+  array->shape[0] = rows >= 0 ? rows : size;
+  array->shape[1] = rows > 0 ? size / rows : 0;
+  array->strides[0] = array->ndim == 2 ? array->shape[1] * sizeof(T)
+                                       : sizeof(T);
+  array->strides[1] = sizeof(T);
+  return reinterpret_cast<PyObject *>(array);
+}
+
+// Moves `result` to Python as the tuple of its (ids, offsets, pieces,
+// piece_offsets, begins, ends) arrays, which share the ownership of it.
+PyObject *MakeBatchEncodeArrays(sentencepiece::BatchEncodeResult *result) {
+  PyObject *owner = MakeArrayOwner(result);
+  if (owner == nullptr) return nullptr;
+  const char *size_format =
+      sizeof(size_t) == sizeof(unsigned long long) ? "Q" : "I";
+  PyObject *tuple = PyTuple_New(6);
+  if (tuple == nullptr) {
+    Py_DECREF(owner);
+    return nullptr;
+  }
+  PyTuple_SET_ITEM(tuple, 0, MakeFlatArray(owner, result->ids().data(),
+                                           result->ids().size(), "i"));
+  PyTuple_SET_ITEM(tuple, 1, MakeFlatArray(owner, result->offsets().data(),
+                                           result->offsets().size(),
+                                           size_format));
+  PyTuple_SET_ITEM(tuple, 2, MakeFlatArray(owner, result->pieces().data(),
+                                           result->pieces().size(), "B"));
+  PyTuple_SET_ITEM(tuple, 3,
+                   MakeFlatArray(owner, result->piece_offsets().data(),
+                                 result->piece_offsets().size(), size_format));
+  PyTuple_SET_ITEM(tuple, 4, MakeFlatArray(owner, result->begins().data(),
+                                           result->begins().size(), "I"));
+  PyTuple_SET_ITEM(tuple, 5, MakeFlatArray(owner, result->ends().data(),
+                                           result->ends().size(), "I"));
+  Py_DECREF(owner);
+  for (int i = 0; i < 6; ++i) {
+    if (PyTuple_GET_ITEM(tuple, i) == nullptr) {
+      Py_DECREF(tuple);
+      return nullptr;
+    }
+  }
+  return tuple;
+}
+
+// Moves `table` to Python as the tuple of its (pieces, piece_offsets,
+// scores, types) arrays, which share the ownership of it.
+PyObject *MakeVocabularyArrays(sentencepiece::VocabularyTable *table) {
+  PyObject *owner = MakeArrayOwner(table);
+  if (owner == nullptr) return nullptr;
+  const char *size_format =
+      sizeof(size_t) == sizeof(unsigned long long) ? "Q" : "I";
+  PyObject *tuple = PyTuple_New(4);
+  if (tuple == nullptr) {
+    Py_DECREF(owner);
+    return nullptr;
+  }
+  PyTuple_SET_ITEM(tuple, 0, MakeFlatArray(owner, table->pieces().data(),
+                                           table->pieces().size(), "B"));
+  PyTuple_SET_ITEM(tuple, 1,
+                   MakeFlatArray(owner, table->piece_offsets().data(),
+                                 table->piece_offsets().size(), size_format));
+  PyTuple_SET_ITEM(tuple, 2, MakeFlatArray(owner, table->scores().data(),
+                                           table->scores().size(), "f"));
+  PyTuple_SET_ITEM(tuple, 3, MakeFlatArray(owner, table->types().data(),
+                                           table->types().size(), "B"));
+  Py_DECREF(owner);
+  for (int i = 0; i < 4; ++i) {
+    if (PyTuple_GET_ITEM(tuple, i) == nullptr) {
+      Py_DECREF(tuple);
+      return nullptr;
+    }
+  }
+  return tuple;
+}
+
+// Layout of the ids of a batch in IdsArrays.
+struct IdsLayout {
+  bool add_bos = false;
+  bool add_eos = false;
+  bool reverse = false;
+  bool padded = false;
+  int max_length = 0;  // Of a sentence with <s> and </s>. No limit if <= 0.
+  int bos_id = -1;
+  int eos_id = -1;
+  int pad_id = -1;
+};
+
+// Ids of a batch in one array, either flat or padded to the longest one.
+struct IdsArrays {
+  std::vector<int> ids;
+  std::vector<size_t> offsets;  // Of the sentences in the flat ids.
+  std::vector<int> lengths;     // Of the sentences in the padded rows.
+
+  // Lays out the ids [row(i).first, row(i).second) of the `size` sentences
+  // of the encoder in one pass, writing <s> and </s> to their slots and the
+  // truncated and reversed ids between them, so that the ids are neither
+  // shifted nor copied per sentence. Truncation to `max_length` drops the
+  // end of a sentence, before it is reversed.
+  template <typename Row>
+  IdsArrays(size_t size, const Row &row, const IdsLayout &layout) {
+    const size_t num_extra = layout.add_bos + layout.add_eos;
+    const size_t max_length =
+        layout.max_length > 0
+            ? std::max<size_t>(layout.max_length, num_extra)
+            : std::numeric_limits<size_t>::max();
+    const auto length = [&](size_t i) {
+      const auto range = row(i);
+      return std::min<size_t>(range.second - range.first + num_extra,
+                              max_length);
+    };
+    const auto write = [&](size_t i, size_t length, int *out) {
+      const int *begin = row(i).first;
+      const int *end = begin + (length - num_extra);
+      if (layout.add_bos) *out++ = layout.bos_id;
+      out = layout.reverse ? std::reverse_copy(begin, end, out)
+                           : std::copy(begin, end, out);
+      if (layout.add_eos) *out = layout.eos_id;
+    };
+
+    if (layout.padded) {
+      size_t width = 0;
+      lengths.resize(size);
+      for (size_t i = 0; i < size; ++i) {
+        lengths[i] = static_cast<int>(length(i));
+        width = std::max<size_t>(width, lengths[i]);
+      }
+      ids.assign(size * width, layout.pad_id);
+      for (size_t i = 0; i < size; ++i) {
+        write(i, lengths[i], ids.data() + i * width);
+      }
+    } else {
+      offsets.resize(size + 1);
+      offsets[0] = 0;
+      for (size_t i = 0; i < size; ++i) {
+        offsets[i + 1] = offsets[i] + length(i);
+      }
+      ids.resize(offsets.back());
+      for (size_t i = 0; i < size; ++i) {
+        write(i, offsets[i + 1] - offsets[i], ids.data() + offsets[i]);
+      }
+    }
+  }
+};
+
+// Moves `arrays` to Python as the tuple of (ids, offsets) or, if the rows
+// are padded, of the 2D (ids, lengths).
+PyObject *MakeIdsArrays(IdsArrays *arrays, bool padded) {
+  PyObject *owner = MakeArrayOwner(arrays);
+  if (owner == nullptr) return nullptr;
+  const char *size_format =
+      sizeof(size_t) == sizeof(unsigned long long) ? "Q" : "I";
+  PyObject *ids = MakeFlatArray(owner, arrays->ids.data(), arrays->ids.size(),
+                                "i", padded ? arrays->lengths.size() : -1);
+  PyObject *sizes = padded ? MakeFlatArray(owner, arrays->lengths.data(),
+                                           arrays->lengths.size(), "i")
+                           : MakeFlatArray(owner, arrays->offsets.data(),
+                                           arrays->offsets.size(),
+                                           size_format);
+  Py_DECREF(owner);
+  PyObject *tuple =
+      ids != nullptr && sizes != nullptr ? PyTuple_Pack(2, ids, sizes)
+                                         : nullptr;
+  Py_XDECREF(ids);
+  Py_XDECREF(sizes);
+  return tuple;
+}
+
+// View of the buffer of a Python object, released with the GIL held.
+class ScopedBuffer {
+ public:
+  ScopedBuffer(PyObject *obj, int flags)
+      : ok_(PyObject_GetBuffer(obj, &view_, flags) == 0) {}
+  ~ScopedBuffer() {
+    if (ok_) PyBuffer_Release(&view_);
+  }
+
+  ScopedBuffer(const ScopedBuffer &) = delete;
+  ScopedBuffer &operator=(const ScopedBuffer &) = delete;
+
+  bool ok() const { return ok_; }
+  const Py_buffer &view() const { return view_; }
+
+ private:
+  Py_buffer view_;
+  bool ok_ = false;
+};
+
+// Splits `data` into the sentences between the `offsets` of an integer
+// buffer, e.g., of the value and offset buffers of an Arrow string array.
+// Sets the Python error and returns false if they do not match.
+bool SplitBuffer(const Py_buffer &data, const Py_buffer &offsets,
+                 std::vector<absl::string_view> *ins) {
+  absl::string_view format = offsets.format ? offsets.format : "B";
+  if (!format.empty() && (format[0] == '@' || format[0] == '=' ||
+                          format[0] == '<')) {
+    format.remove_prefix(1);
+  }
+  if (offsets.ndim != 1 || format.size() != 1 ||
+      absl::string_view("iIlLqQnN").find(format[0]) ==
+          absl::string_view::npos ||
+      (offsets.itemsize != 4 && offsets.itemsize != 8)) {
+    PyErr_SetString(PyExc_TypeError,
+                    "offsets must be a 1D array of 32 or 64 bit integers");
+    return false;
+  }
+  const Py_ssize_t size = offsets.shape[0];
+  auto offset = [&offsets](Py_ssize_t i) -> int64_t {
+    const char *p = static_cast<const char *>(offsets.buf) +
+                    i * offsets.strides[0];
+    if (offsets.itemsize == 4) {
+      int32_t value;
+      memcpy(&value, p, sizeof(value));
+      return value;
+    }
+    int64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  };
+  ins->clear();
+  if (size == 0) return true;
+  ins->reserve(size - 1);
+  const char *base = static_cast<const char *>(data.buf);
+  for (Py_ssize_t i = 0; i + 1 < size; ++i) {
+    const int64_t begin = offset(i);
+    const int64_t end = offset(i + 1);
+    if (begin < 0 || begin > end || end > data.len) {
+      PyErr_SetString(PyExc_IndexError, "offsets are out of the data");
+      return false;
+    }
+    ins->emplace_back(base + begin, end - begin);
+  }
+  return true;
+}
+
+// Destructors of the capsules of the Arrow PyCapsule interface, which
+// release the array unless the consumer has moved it.
+void DeleteArrowSchemaCapsule(PyObject *capsule) {
+  auto *schema = static_cast<ArrowSchema *>(
+      PyCapsule_GetPointer(capsule, "arrow_schema"));
+  if (schema->release != nullptr) schema->release(schema);
+  delete schema;
+}
+
+void DeleteArrowArrayCapsule(PyObject *capsule) {
+  auto *array =
+      static_cast<ArrowArray *>(PyCapsule_GetPointer(capsule, "arrow_array"));
+  if (array->release != nullptr) array->release(array);
+  delete array;
+}
+
 int ToSwigError(sentencepiece::util::StatusCode code) {
   switch (code) {
     case sentencepiece::util::StatusCode::kNotFound:
@@ -3224,67 +3563,184 @@ int ToSwigError(sentencepiece::util::StatusCode code) {
   return SWIG_RuntimeError;
 }
 
+// Sentence iterator over a Python iterator. A producer thread pulls the
+// sentences in batches of kBatchSize into a queue of at most kMaxBatches,
+// holding the GIL only while it calls the iterator, so that the trainer
+// consumes and counts them without the GIL. The first batch is read in the
+// constructor, where the caller holds the GIL.
 class PySentenceIterator : public sentencepiece::SentenceIterator {
-  public:
-  PySentenceIterator(PyObject *iter) : iter_(iter) {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+ public:
+  static constexpr size_t kBatchSize = 1024;
+  static constexpr size_t kMaxBatches = 8;
+
+  explicit PySentenceIterator(PyObject *iter) : iter_(iter) {
+    Py_INCREF(iter_);
+    eof_ = !FetchBatch(&batch_);
+    if (!eof_) producer_ = std::thread([this]() { Produce(); });
   }
 
   ~PySentenceIterator() {
-   // Py_XDECREF(iter_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    not_full_.notify_all();
+    if (producer_.joinable()) {
+      // The producer may be waiting for the GIL held by the caller.
+      Py_BEGIN_ALLOW_THREADS
+      producer_.join();
+      Py_END_ALLOW_THREADS
+    }
+    Py_XDECREF(iter_);
   }
 
   bool done() const override {
-    return item_ == nullptr;
+    return pos_ >= batch_.size();
   }
 
   void Next() override {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+    if (++pos_ < batch_.size()) return;
+    batch_.clear();
+    pos_ = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return !queue_.empty() || eof_; });
+    if (queue_.empty()) return;
+    batch_ = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
   }
 
   const std::string &value() const override {
-    return value_;
+    return batch_[pos_];
   }
 
   sentencepiece::util::Status status() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
     return status_;
   }
 
   private:
-   void CopyValue() {
-     if (item_ == nullptr) return;
-     const PyInputString ustring(item_);
-     if (ustring.IsAvalable()) {
-       const char *data = ustring.data();
-       size_t size = ustring.size();
-       while (size > 0) {
-         if (data[size - 1] == '\r' || data[size - 1] == '\n')
-           --size;
-         else
-           break;
+   void Produce() {
+     bool more = true;
+     while (more) {
+       {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (stop_) return;
        }
-       value_.assign(data, size);
-     } else {
-       status_ = sentencepiece::util::Status(sentencepiece::util::StatusCode::kInternal,
-                                             "Not a string.");
+       std::vector<std::string> batch;
+       const PyGILState_STATE state = PyGILState_Ensure();
+       more = FetchBatch(&batch);
+       PyGILState_Release(state);
+       std::unique_lock<std::mutex> lock(mutex_);
+       not_full_.wait(lock, [this]() {
+         return queue_.size() < kMaxBatches || stop_;
+       });
+       if (stop_) return;
+       if (!batch.empty()) queue_.push_back(std::move(batch));
+       eof_ = !more;
+       lock.unlock();
+       not_empty_.notify_one();
+     }
+   }
+
+   // Appends up to kBatchSize sentences to `batch`, without the trailing
+   // newlines. Returns false at the end of the iterator or on an error.
+   // Must be called with the GIL held.
+   bool FetchBatch(std::vector<std::string> *batch) {
+     batch->reserve(kBatchSize);
+     while (batch->size() < kBatchSize) {
+       PyObject *item = PyIter_Next(iter_);
+       if (item == nullptr) {
+         if (PyErr_Occurred()) SetError(FetchErrorMessage());
+         return false;
+       }
+       bool ok = false;
+       {
+         const PyInputString ustring(item);
+         if (ustring.IsAvalable()) {
+           const char *data = ustring.data();
+           size_t size = ustring.size();
+           while (size > 0) {
+             if (data[size - 1] == '\r' || data[size - 1] == '\n')
+               --size;
+             else
+               break;
+           }
+           batch->emplace_back(data, size);
+           ok = true;
+         }
+       }
+       Py_DECREF(item);
+       if (!ok) {
+         SetError("Not a string.");
+         return false;
+       }
+     }
+     return true;
+   }
+
+   // Takes the pending Python error as the message of the status.
+   static std::string FetchErrorMessage() {
+     std::string message = "Failed to read the sentence iterator.";
+     PyObject *type = nullptr, *value = nullptr, *traceback = nullptr;
+     PyErr_Fetch(&type, &value, &traceback);
+     if (value != nullptr) {
+       PyObject *str = PyObject_Str(value);
+       const char *data = str != nullptr ? PyUnicode_AsUTF8(str) : nullptr;
+       if (data != nullptr) message = data;
+       Py_XDECREF(str);
      }
-     Py_XDECREF(item_);
+     Py_XDECREF(type);
+     Py_XDECREF(value);
+     Py_XDECREF(traceback);
+     PyErr_Clear();
+     return message;
    }
+
+   void SetError(const std::string &message) {
+     std::lock_guard<std::mutex> lock(mutex_);
+     if (status_.ok()) {
+       status_ = sentencepiece::util::Status(
+           sentencepiece::util::StatusCode::kInternal, message);
+     }
+   }
+
    PyObject *iter_ = nullptr;
-   PyObject *item_ = nullptr;
-   std::string value_;
+   // Consumed by the trainer only.
+   std::vector<std::string> batch_;
+   size_t pos_ = 0;
+   // Shared with the producer.
+   mutable std::mutex mutex_;
+   std::condition_variable not_empty_;
+   std::condition_variable not_full_;
+   std::deque<std::vector<std::string>> queue_;
+   bool eof_ = false;
+   bool stop_ = false;
    sentencepiece::util::Status status_;
+   std::thread producer_;
 };
 
 inline void RewriteIds(const sentencepiece::SentencePieceProcessor &sp,
                        std::vector<int> *ids,
                        bool add_bos, bool add_eos, bool reverse, bool emit_unk_piece) {
   if (!add_bos && !add_eos && !reverse) return;
-  if (reverse) std::reverse(ids->begin(), ids->end());
-  if (add_bos) ids->insert(ids->begin(), sp.bos_id());
-  if (add_eos) ids->push_back(sp.eos_id());
+  if (!add_bos) {
+    if (reverse) std::reverse(ids->begin(), ids->end());
+    if (add_eos) ids->push_back(sp.eos_id());
+    return;
+  }
+  // Writes <s> and the ids in one pass, instead of shifting the ids.
+  std::vector<int> out;
+  out.reserve(ids->size() + 1 + add_eos);
+  out.push_back(sp.bos_id());
+  if (reverse) {
+    out.insert(out.end(), ids->rbegin(), ids->rend());
+  } else {
+    out.insert(out.end(), ids->begin(), ids->end());
+  }
+  if (add_eos) out.push_back(sp.eos_id());
+  ids->swap(out);
 }
 
 inline void RewriteIds(const sentencepiece::SentencePieceProcessor &sp,
@@ -3350,51 +3806,145 @@ inline void ConvertToUnicodeSpans(sentencepiece::ImmutableNBestSentencePieceText
   proto->ConvertToUnicodeSpans();
 }
 
+// Releases the GIL while the native code runs, so that the other Python
+// threads run during the encoding and decoding. The arguments are marshalled
+// before and the result objects are built after, with the GIL held. The
+// input lists must not be modified by the other threads during the call.
+class ScopedReleaseGIL {
+ public:
+  ScopedReleaseGIL() : state_(PyEval_SaveThread()) {}
+  ~ScopedReleaseGIL() { PyEval_RestoreThread(state_); }
+
+  ScopedReleaseGIL(const ScopedReleaseGIL &) = delete;
+  ScopedReleaseGIL &operator=(const ScopedReleaseGIL &) = delete;
+
+ private:
+  PyThreadState *state_ = nullptr;
+};
+
+// Scoped group of tasks running on the shared pool of the batch calls of
+// the C++ library, so that the process has a single pool of the size and
+// the CPUs of SetThreadOptions(). The destructor blocks until all the tasks
+// of this group are finished.
+// The tasks of a group of one thread run inline.
 class ThreadPool {
  public:
-  explicit ThreadPool(size_t request_size) :
-    request_size_(request_size) {}
+  explicit ThreadPool(int num_threads) :
+    num_threads_(num_threads) {}
 
   virtual ~ThreadPool() {
-    for (auto &task : tasks_) {
-      task.join();
-    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return pending_ == 0; });
   }
 
   void Schedule(std::function<void()> closure) {
-    static constexpr size_t kMinThreadSize = 2;
-    if (request_size_ < kMinThreadSize) {
+    if (num_threads_ < 2) {
       closure();
-    } else {
-      tasks_.emplace_back(closure);
+      return;
     }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++pending_;
+    }
+    sentencepiece::ScheduleOnSharedThreadPool([this, closure]() {
+        closure();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) cv_.notify_all();
+      });
   }
 
  private:
-  size_t request_size_ = 0;
-  std::vector<std::thread> tasks_;
+  int num_threads_ = 0;
+  size_t pending_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
 };
 
+// Approximate bytes of text of an input of a batch.
+inline size_t InputBytes(absl::string_view in) { return in.size(); }
+
+// An id or a piece is a few bytes of text.
+template <typename T>
+inline size_t InputBytes(const std::vector<T> &in) { return 4 * in.size(); }
+
+// Minimum bytes of the inputs per thread. A smaller batch runs inline, as
+// handing it to the workers costs more than it saves.
+constexpr size_t kMinBytesPerThread = 4096;
+
+// Caps `num_threads` by the total bytes of `ins` rather than by its size,
+// so that a few long inputs still run in parallel and many short ones run
+// inline.
 template <typename T>
 inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   if (*num_threads < 0) {
-    *num_threads = std::thread::hardware_concurrency();
+    *num_threads = sentencepiece::GetNumThreads();
+  }
+  size_t bytes = 0;
+  for (const auto &in : ins) bytes += InputBytes(in);
+  const size_t max_threads = std::min<size_t>(
+      {bytes / kMinBytesPerThread, ins.size(), 256});
+  *num_threads = std::max<int>(
+      1, std::min<int>(*num_threads, static_cast<int>(max_threads)));
+}
+
+// Returns the indices of `ins` longest first, so that the workers claiming
+// the inputs one by one do not start a long one last. Empty when the inputs
+// run inline in their order.
+template <typename T>
+inline std::vector<size_t> LongestFirstOrder(const std::vector<T> &ins,
+                                             int num_threads) {
+  std::vector<size_t> order;
+  if (num_threads < 2) return order;
+  order.resize(ins.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&ins](size_t a, size_t b) {
+    return InputBytes(ins[a]) > InputBytes(ins[b]);
+  });
+  return order;
+}
+
+// Encodes `ins` with SentencePieceProcessor::EncodeBatch() and applies the
+// options of the Python API to every output.
+template <typename T>
+std::vector<T> EncodeBatchWithOptions(
+    const sentencepiece::SentencePieceProcessor &sp,
+    const std::vector<absl::string_view> &ins, int num_threads,
+    bool add_bos, bool add_eos, bool reverse, bool emit_unk_piece) {
+  InitNumThreads(ins, &num_threads);
+  std::vector<T> outs;
+  const auto status = sp.EncodeBatch(ins, num_threads, &outs);
+  if (!status.ok()) throw status;
+  for (auto &out : outs) {
+    RewriteIds(sp, &out, add_bos, add_eos, reverse, emit_unk_piece);
   }
-  *num_threads = std::max<int>(1,
-                               std::min<int>({*num_threads,
-                                     static_cast<int>(ins.size()), 256}));
+  return outs;
+}
+
+// Decodes `ins` with SentencePieceProcessor::DecodeBatch().
+template <typename T>
+std::vector<std::string> DecodeBatch(
+    const sentencepiece::SentencePieceProcessor &sp,
+    const std::vector<std::vector<T>> &ins, int num_threads) {
+  for (const auto &in : ins) CheckIds(in, sp.GetPieceSize());
+  InitNumThreads(ins, &num_threads);
+  std::vector<std::string> outs;
+  const auto status = sp.DecodeBatch(ins, num_threads, &outs);
+  if (!status.ok()) throw status;
+  return outs;
 }
 
 #define DEFINE_ENCODE_BATCH_FUNC_IMPL(FuncName, InType, OutType)        \
   std::vector<OutType> outs(ins.size());                                \
   InitNumThreads(ins, &num_threads);                                    \
   {                                                                     \
-    ThreadPool pool(ins.size());                                        \
+    const auto order = LongestFirstOrder(ins, num_threads);             \
+    ThreadPool pool(num_threads);                                        \
     std::atomic<size_t> index = 0;                                      \
     for (int n = 0;  n < num_threads; ++n) {                            \
       pool.Schedule([&]() {                                             \
-          size_t i = 0;                                                 \
-          while ((i = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+          size_t k = 0;                                                 \
+          while ((k = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+            const size_t i = order.empty() ? k : order[k];              \
             auto out = enable_sampling ?                                \
                        self->Sample##FuncName(ins[i],                   \
                                               nbest_size, alpha) :      \
@@ -3413,12 +3963,14 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   std::vector<OutType> outs(ins.size());                                \
   InitNumThreads(ins, &num_threads);                                    \
   {                                                                     \
+    const auto order = LongestFirstOrder(ins, num_threads);             \
     std::atomic<size_t> index = 0;                                      \
-    ThreadPool pool(ins.size());                                        \
+    ThreadPool pool(num_threads);                                        \
     for (int n = 0;  n < num_threads; ++n) {                            \
       pool.Schedule([&]() {                                             \
-          size_t i = 0;                                                 \
-          while ((i = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+          size_t k = 0;                                                 \
+          while ((k = std::atomic_fetch_add(&index, 1)) < outs.size()) { \
+            const size_t i = order.empty() ? k : order[k];              \
             CheckIds(ins[i], self->GetPieceSize());                     \
             auto out = self->FuncName(ins[i]);                          \
             ConvertToUnicodeSpans(&out);                                \
@@ -3429,6 +3981,70 @@ inline void InitNumThreads(const std::vector<T> &ins, int *num_threads) {
   }                                                                     \
   return outs;
 
+// Encodes `ins` to ids with the options of the Python API.
+std::vector<std::vector<int>> EncodeIdsBatch(
+    const sentencepiece::SentencePieceProcessor *self,
+    const std::vector<absl::string_view> &ins, int num_threads,
+    bool enable_sampling, int nbest_size, float alpha,
+    bool add_bos, bool add_eos, bool reverse, bool emit_unk_piece) {
+  if (enable_sampling) {
+    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsIds,
+                                  absl::string_view, std::vector<int>);
+  }
+  return EncodeBatchWithOptions<std::vector<int>>(
+      *self, ins, num_threads, add_bos, add_eos, reverse, emit_unk_piece);
+}
+
+// Encodes `ins` to the ids arrays of `layout`. The flat result of
+// SentencePieceProcessor::EncodeBatch() or the sampled ids are laid out
+// as they are, without rewriting every sentence first.
+IdsArrays *EncodeIdsArrays(
+    const sentencepiece::SentencePieceProcessor *self,
+    const std::vector<absl::string_view> &ins, int num_threads,
+    bool enable_sampling, int nbest_size, float alpha,
+    const IdsLayout &layout) {
+  if (enable_sampling) {
+    const auto outs = EncodeIdsBatch(self, ins, num_threads, enable_sampling,
+                                     nbest_size, alpha, false, false, false,
+                                     false);
+    return new IdsArrays(
+        outs.size(),
+        [&](size_t i) {
+          return std::make_pair(outs[i].data(),
+                                outs[i].data() + outs[i].size());
+        },
+        layout);
+  }
+  InitNumThreads(ins, &num_threads);
+  sentencepiece::BatchEncodeResult result;
+  const auto status = self->EncodeBatch(ins, num_threads, false, false,
+                                        &result);
+  if (!status.ok()) throw status;
+  const int *ids = result.ids().data();
+  const auto &offsets = result.offsets();
+  return new IdsArrays(
+      ins.size(),
+      [&](size_t i) {
+        return std::make_pair(ids + offsets[i], ids + offsets[i + 1]);
+      },
+      layout);
+}
+
+IdsLayout MakeIdsLayout(const sentencepiece::SentencePieceProcessor *self,
+                        bool add_bos, bool add_eos, bool reverse,
+                        bool padded, int pad_id, int max_length) {
+  IdsLayout layout;
+  layout.add_bos = add_bos;
+  layout.add_eos = add_eos;
+  layout.reverse = reverse;
+  layout.padded = padded;
+  layout.max_length = max_length;
+  layout.bos_id = self->bos_id();
+  layout.eos_id = self->eos_id();
+  layout.pad_id = pad_id;
+  return layout;
+}
+
 }  // namespace
 
 
@@ -3892,12 +4508,16 @@ SWIGINTERN sentencepiece::ImmutableSentencePieceText sentencepiece_SentencePiece
     return proto;
   }
 SWIGINTERN std::vector< std::vector< int > > sentencepiece_SentencePieceProcessor__EncodeAsIdsBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< absl::string_view > const &ins,int num_threads,bool enable_sampling,int nbest_size,float alpha,bool add_bos,bool add_eos,bool reverse,bool emit_unk_piece){
-    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsIds,
-                                  absl::string_view, std::vector<int>);
+    return EncodeIdsBatch(self, ins, num_threads, enable_sampling, nbest_size,
+                          alpha, add_bos, add_eos, reverse, emit_unk_piece);
   }
 SWIGINTERN std::vector< std::vector< std::string > > sentencepiece_SentencePieceProcessor__EncodeAsPiecesBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< absl::string_view > const &ins,int num_threads,bool enable_sampling,int nbest_size,float alpha,bool add_bos,bool add_eos,bool reverse,bool emit_unk_piece){
-    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsPieces,
-                                  absl::string_view, std::vector<std::string>);
+    if (enable_sampling) {
+      DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsPieces, absl::string_view,
+                                    std::vector<std::string>);
+    }
+    return EncodeBatchWithOptions<std::vector<std::string>>(
+        *self, ins, num_threads, add_bos, add_eos, reverse, emit_unk_piece);
   }
 SWIGINTERN BytesArray sentencepiece_SentencePieceProcessor__EncodeAsSerializedProtoBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< absl::string_view > const &ins,int num_threads,bool enable_sampling,int nbest_size,float alpha,bool add_bos,bool add_eos,bool reverse,bool emit_unk_piece){
     DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsSerializedProto,
@@ -3905,9 +4525,104 @@ SWIGINTERN BytesArray sentencepiece_SentencePieceProcessor__EncodeAsSerializedPr
                                   sentencepiece::util::bytes);
   }
 SWIGINTERN std::vector< sentencepiece::ImmutableSentencePieceText > sentencepiece_SentencePieceProcessor__EncodeAsImmutableProtoBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< absl::string_view > const &ins,int num_threads,bool enable_sampling,int nbest_size,float alpha,bool add_bos,bool add_eos,bool reverse,bool emit_unk_piece){
-    DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsImmutableProto,
-                                  absl::string_view,
-                                  sentencepiece::ImmutableSentencePieceText);
+    if (enable_sampling) {
+      DEFINE_ENCODE_BATCH_FUNC_IMPL(EncodeAsImmutableProto,
+                                    absl::string_view,
+                                    sentencepiece::ImmutableSentencePieceText);
+    }
+    RewriteIds(*self, static_cast<sentencepiece::ImmutableSentencePieceText *>(nullptr),
+               add_bos, add_eos, reverse, emit_unk_piece);
+    InitNumThreads(ins, &num_threads);
+    // The protos of the batch are allocated on one arena.
+    std::vector<sentencepiece::ImmutableSentencePieceText> outs;
+    const auto _status = self->EncodeBatch(ins, num_threads, &outs);
+    if (!_status.ok()) throw _status;
+    for (auto &out : outs) out.ConvertToUnicodeSpans();
+    return outs;
+  }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__GetVocabularyTable(sentencepiece::SentencePieceProcessor const *self){
+    auto *table = new sentencepiece::VocabularyTable;
+    const auto _status = self->GetVocabularyTable(table);
+    if (!_status.ok()) {
+      delete table;
+      throw _status;
+    }
+    return MakeVocabularyArrays(table);
+  }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__EncodeBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< absl::string_view > const &ins,int num_threads,bool with_pieces,bool with_alignment,bool unicode_offsets){
+    InitNumThreads(ins, &num_threads);
+    auto *result = new sentencepiece::BatchEncodeResult;
+    sentencepiece::util::Status _status;
+    {
+      // The arrays are Python objects made after the GIL is taken back.
+      ScopedReleaseGIL release_gil;
+      _status = self->EncodeBatch(ins, num_threads, with_pieces,
+                                   with_alignment, unicode_offsets, result);
+    }
+    if (!_status.ok()) {
+      delete result;
+      throw _status;
+    }
+    return MakeBatchEncodeArrays(result);
+  }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__EncodeAsIdsArrays(sentencepiece::SentencePieceProcessor const *self,std::vector< absl::string_view > const &ins,int num_threads,bool enable_sampling,int nbest_size,float alpha,bool add_bos,bool add_eos,bool reverse,bool emit_unk_piece,bool padded,int pad_id,int max_length){
+    const IdsLayout layout = MakeIdsLayout(self, add_bos, add_eos, reverse,
+                                           padded, pad_id, max_length);
+    auto *arrays = [&]() {
+      ScopedReleaseGIL release_gil;
+      return EncodeIdsArrays(self, ins, num_threads, enable_sampling,
+                             nbest_size, alpha, layout);
+    }();
+    return MakeIdsArrays(arrays, padded);
+  }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__EncodeBufferAsIdsArrays(sentencepiece::SentencePieceProcessor const *self,PyObject *data,PyObject *offsets,int num_threads,bool enable_sampling,int nbest_size,float alpha,bool add_bos,bool add_eos,bool reverse,bool emit_unk_piece,bool padded,int pad_id,int max_length){
+    const ScopedBuffer data_buffer(data, PyBUF_SIMPLE);
+    if (!data_buffer.ok()) return nullptr;
+    const ScopedBuffer offsets_buffer(offsets, PyBUF_FORMAT | PyBUF_STRIDES);
+    if (!offsets_buffer.ok()) return nullptr;
+    std::vector<absl::string_view> ins;
+    if (!SplitBuffer(data_buffer.view(), offsets_buffer.view(), &ins)) {
+      return nullptr;
+    }
+    const IdsLayout layout = MakeIdsLayout(self, add_bos, add_eos, reverse,
+                                           padded, pad_id, max_length);
+    auto *arrays = [&]() {
+      ScopedReleaseGIL release_gil;
+      return EncodeIdsArrays(self, ins, num_threads, enable_sampling,
+                             nbest_size, alpha, layout);
+    }();
+    return MakeIdsArrays(arrays, padded);
+  }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__EncodeArrow(sentencepiece::SentencePieceProcessor const *self,PyObject *schema,PyObject *array,int num_threads){
+    const auto *input_schema = static_cast<const ArrowSchema *>(
+        PyCapsule_GetPointer(schema, "arrow_schema"));
+    if (input_schema == nullptr) return nullptr;
+    const auto *input = static_cast<const ArrowArray *>(
+        PyCapsule_GetPointer(array, "arrow_array"));
+    if (input == nullptr) return nullptr;
+    if (num_threads < 0) num_threads = sentencepiece::GetNumThreads();
+    num_threads = std::max<int>(1, std::min<int>(num_threads, 256));
+
+    auto output_schema = std::make_unique<ArrowSchema>();
+    auto output = std::make_unique<ArrowArray>();
+    sentencepiece::util::Status _status;
+    {
+      ScopedReleaseGIL release_gil;
+      _status = sentencepiece::EncodeArrowArray(
+          *self, *input_schema, *input, num_threads, output_schema.get(),
+          output.get());
+    }
+    if (!_status.ok()) throw _status;
+    PyObject *schema_capsule = PyCapsule_New(
+        output_schema.release(), "arrow_schema", DeleteArrowSchemaCapsule);
+    PyObject *array_capsule = PyCapsule_New(
+        output.release(), "arrow_array", DeleteArrowArrayCapsule);
+    PyObject *tuple = schema_capsule != nullptr && array_capsule != nullptr
+                          ? PyTuple_Pack(2, schema_capsule, array_capsule)
+                          : nullptr;
+    Py_XDECREF(schema_capsule);
+    Py_XDECREF(array_capsule);
+    return tuple;
   }
 SWIGINTERN std::string sentencepiece_SentencePieceProcessor__DecodeIds(sentencepiece::SentencePieceProcessor const *self,std::vector< int > const &ids){
     CheckIds(ids, self->GetPieceSize());
@@ -3941,10 +4656,10 @@ SWIGINTERN sentencepiece::ImmutableSentencePieceText sentencepiece_SentencePiece
     return proto;
   }
 SWIGINTERN std::vector< std::string > sentencepiece_SentencePieceProcessor__DecodeIdsBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< std::vector< int > > const &ins,int num_threads){
-    DEFINE_DECODE_BATCH_FUNC_IMPL(DecodeIds, int, std::string);
+    return DecodeBatch(*self, ins, num_threads);
   }
 SWIGINTERN BytesArray sentencepiece_SentencePieceProcessor__DecodeIdsAsBytesBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< std::vector< int > > const &ins,int num_threads){
-    DEFINE_DECODE_BATCH_FUNC_IMPL(DecodeIds, int, std::string);
+    return DecodeBatch(*self, ins, num_threads);
   }
 SWIGINTERN BytesArray sentencepiece_SentencePieceProcessor__DecodeIdsAsSerializedProtoBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< std::vector< int > > const &ins,int num_threads){
     DEFINE_DECODE_BATCH_FUNC_IMPL(DecodeIdsAsSerializedProto, int,
@@ -3955,7 +4670,7 @@ SWIGINTERN std::vector< sentencepiece::ImmutableSentencePieceText > sentencepiec
                                   sentencepiece::ImmutableSentencePieceText);
   }
 SWIGINTERN std::vector< std::string > sentencepiece_SentencePieceProcessor__DecodePiecesBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< std::vector< absl::string_view > > const &ins,int num_threads){
-    DEFINE_DECODE_BATCH_FUNC_IMPL(DecodePieces, std::string, std::string);
+    return DecodeBatch(*self, ins, num_threads);
   }
 SWIGINTERN BytesArray sentencepiece_SentencePieceProcessor__DecodePiecesAsSerializedProtoBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< std::vector< absl::string_view > > const &ins,int num_threads){
     DEFINE_DECODE_BATCH_FUNC_IMPL(DecodePiecesAsSerializedProto, std::string,
@@ -4036,12 +4751,14 @@ SWIGINTERN std::vector< float > sentencepiece_SentencePieceProcessor__CalculateE
     std::vector<float> outs(ins.size());
     InitNumThreads(ins, &num_threads);
     {
-      ThreadPool pool(ins.size());
+      const auto order = LongestFirstOrder(ins, num_threads);
+      ThreadPool pool(num_threads);
       std::atomic<size_t> index = 0;
       for (int n = 0;  n < num_threads; ++n) {
         pool.Schedule([&]() {
-           size_t i = 0;
-           while ((i = std::atomic_fetch_add(&index, 1)) < outs.size()) {
+           size_t k = 0;
+           while ((k = std::atomic_fetch_add(&index, 1)) < outs.size()) {
+             const size_t i = order.empty() ? k : order[k];
              outs[i] = self->CalculateEntropy(ins[i], alpha);
            }
          });
@@ -4123,6 +4840,53 @@ SWIG_AsVal_unsigned_SS_int (PyObject * obj, unsigned int *val)
   return res;
 }
 
+#ifdef SWIG_LONG_LONG_AVAILABLE
+SWIGINTERN int
+SWIG_AsVal_unsigned_SS_long_SS_long (PyObject *obj, unsigned long long *val)
+{
+  int res = SWIG_TypeError;
+  if (PyLong_Check(obj)) {
+    unsigned long long v = PyLong_AsUnsignedLongLong(obj);
+    if (!PyErr_Occurred()) {
+      if (val) *val = v;
+      return SWIG_OK;
+    } else {
+      PyErr_Clear();
+      res = SWIG_OverflowError;
+    }
+  } else {
+    unsigned long v;
+    res = SWIG_AsVal_unsigned_SS_long (obj,&v);
+    if (SWIG_IsOK(res)) {
+      if (val) *val = v;
+      return res;
+    }
+  }
+  return res;
+}
+#endif
+
+
+SWIGINTERNINLINE int
+SWIG_AsVal_size_t (PyObject * obj, size_t *val)
+{
+  int res = SWIG_TypeError;
+#ifdef SWIG_LONG_LONG_AVAILABLE
+  if (sizeof(size_t) <= sizeof(unsigned long)) {
+#endif
+    unsigned long v;
+    res = SWIG_AsVal_unsigned_SS_long (obj, val ? &v : 0);
+    if (SWIG_IsOK(res) && val) *val = static_cast< size_t >(v);
+#ifdef SWIG_LONG_LONG_AVAILABLE
+  } else if (sizeof(size_t) <= sizeof(unsigned long long)) {
+    unsigned long long v;
+    res = SWIG_AsVal_unsigned_SS_long_SS_long (obj, val ? &v : 0);
+    if (SWIG_IsOK(res) && val) *val = static_cast< size_t >(v);
+  }
+#endif
+  return res;
+}
+
 SWIGINTERN void sentencepiece_SentencePieceTrainer__TrainFromString(absl::string_view arg){
     const auto _status = sentencepiece::SentencePieceTrainer::Train(arg);
     if (!_status.ok()) throw _status;
@@ -4134,7 +4898,12 @@ SWIGINTERN void sentencepiece_SentencePieceTrainer__TrainFromMap(std::unordered_
     return;
   }
 SWIGINTERN void sentencepiece_SentencePieceTrainer__TrainFromMap2(std::unordered_map< std::string,std::string > const &args,sentencepiece::SentenceIterator *iter){
-    const auto _status = sentencepiece::SentencePieceTrainer::Train(args, iter);
+    sentencepiece::util::Status _status;
+    {
+      // The iterator takes the GIL only while it reads the Python iterator.
+      ScopedReleaseGIL release_gil;
+      _status = sentencepiece::SentencePieceTrainer::Train(args, iter);
+    }
     if (!_status.ok()) throw _status;
     return;
   }
@@ -4146,7 +4915,11 @@ SWIGINTERN sentencepiece::util::bytes sentencepiece_SentencePieceTrainer__TrainF
   }
 SWIGINTERN sentencepiece::util::bytes sentencepiece_SentencePieceTrainer__TrainFromMap4(std::unordered_map< std::string,std::string > const &args,sentencepiece::SentenceIterator *iter){
     sentencepiece::util::bytes model_proto;
-    const auto _status = sentencepiece::SentencePieceTrainer::Train(args, iter, &model_proto);
+    sentencepiece::util::Status _status;
+    {
+      ScopedReleaseGIL release_gil;
+      _status = sentencepiece::SentencePieceTrainer::Train(args, iter, &model_proto);
+    }
     if (!_status.ok()) throw _status;
     return model_proto;
   }
@@ -4171,6 +4944,18 @@ SWIGINTERN void sentencepiece_SentencePieceNormalizer__SetProtoField(sentencepie
         value ? "1" : "0",
         self->mutable_normalizer_spec()).IgnoreError();
   }
+SWIGINTERN std::string sentencepiece_StreamingDecoder_Put(sentencepiece::StreamingDecoder *self,int id){
+    std::string text;
+    const auto _status = self->Feed(id, &text);
+    if (!_status.ok()) throw _status;
+    return text;
+  }
+SWIGINTERN std::string sentencepiece_StreamingDecoder_Flush(sentencepiece::StreamingDecoder *self){
+    std::string text;
+    const auto _status = self->Finish(&text);
+    if (!_status.ok()) throw _status;
+    return text;
+  }
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -4985,6 +5770,51 @@ fail:
 }
 
 
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SaveCompiledModel(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  absl::string_view arg2 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  PyObject *swig_obj[2] ;
+  sentencepiece::util::Status result;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor_SaveCompiledModel", 2, 2, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor_SaveCompiledModel" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    const PyInputString ustring(swig_obj[1]);
+    if (!ustring.IsAvalable()) {
+      PyErr_SetString(PyExc_TypeError, "not a string");
+      SWIG_fail;
+    }
+    resultobj = ustring.input_type();
+    arg2 = ustring.str();
+  }
+  {
+    try {
+      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SaveCompiledModel(arg2);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  {
+    if (!(&result)->ok()) {
+      SWIG_exception(ToSwigError((&result)->code()), (&result)->ToString().c_str());
+    }
+    resultobj = SWIG_From_bool((&result)->ok());
+  }
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
 SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SetEncodeExtraOptions(PyObject *self, PyObject *args) {
   PyObject *resultobj = 0;
   sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
@@ -5075,6 +5905,57 @@ fail:
 }
 
 
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SetEncodeLimits(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  size_t arg2 ;
+  size_t arg3 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  size_t val2 ;
+  int ecode2 = 0 ;
+  size_t val3 ;
+  int ecode3 = 0 ;
+  PyObject *swig_obj[3] ;
+  sentencepiece::util::Status result;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor_SetEncodeLimits", 3, 3, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor_SetEncodeLimits" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  ecode2 = SWIG_AsVal_size_t(swig_obj[1], &val2);
+  if (!SWIG_IsOK(ecode2)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode2), "in method '" "SentencePieceProcessor_SetEncodeLimits" "', argument " "2"" of type '" "size_t""'");
+  } 
+  arg2 = static_cast< size_t >(val2);
+  ecode3 = SWIG_AsVal_size_t(swig_obj[2], &val3);
+  if (!SWIG_IsOK(ecode3)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "SentencePieceProcessor_SetEncodeLimits" "', argument " "3"" of type '" "size_t""'");
+  } 
+  arg3 = static_cast< size_t >(val3);
+  {
+    try {
+      result = (arg1)->SetEncodeLimits(arg2,arg3);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  {
+    if (!(&result)->ok()) {
+      SWIG_exception(ToSwigError((&result)->code()), (&result)->ToString().c_str());
+    }
+    resultobj = SWIG_From_bool((&result)->ok());
+  }
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
 SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SetVocabulary(PyObject *self, PyObject *args) {
   PyObject *resultobj = 0;
   sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
@@ -5981,7 +6862,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsIds(PyObject *self, P
   arg9 = static_cast< bool >(val9);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsIds((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsIds((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6082,7 +6966,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsPieces(PyObject *self
   arg9 = static_cast< bool >(val9);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsPieces((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsPieces((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6184,7 +7071,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsSerializedProto(PyObj
   arg9 = static_cast< bool >(val9);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6282,7 +7172,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsImmutableProto(PyObje
   arg9 = static_cast< bool >(val9);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6398,7 +7291,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsIdsBatch(PyObject *se
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsIdsBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsIdsBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6529,7 +7425,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsPiecesBatch(PyObject
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsPiecesBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsPiecesBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6661,7 +7560,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsSerializedProtoBatch(
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsSerializedProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsSerializedProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6788,7 +7690,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsImmutableProtoBatch(P
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__EncodeAsImmutableProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__EncodeAsImmutableProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6814,7 +7719,435 @@ fail:
 }
 
 
-SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIds(PyObject *self, PyObject *args) {
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__GetVocabularyTable(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  PyObject *swig_obj[1] ;
+  PyObject *result = 0 ;
+  
+  if (!args) SWIG_fail;
+  swig_obj[0] = args;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__GetVocabularyTable" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__GetVocabularyTable((sentencepiece::SentencePieceProcessor const *)arg1);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeBatch(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  std::vector< absl::string_view > *arg2 = 0 ;
+  int arg3 ;
+  bool arg4 ;
+  bool arg5 ;
+  bool arg6 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val3 ;
+  int ecode3 = 0 ;
+  bool val4 ;
+  int ecode4 = 0 ;
+  bool val5 ;
+  int ecode5 = 0 ;
+  bool val6 ;
+  int ecode6 = 0 ;
+  PyObject *swig_obj[6] ;
+  PyObject *result = 0 ;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor__EncodeBatch", 6, 6, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__EncodeBatch" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    std::vector<absl::string_view> *out = nullptr;
+    if (PyList_Check(swig_obj[1])) {
+      const size_t size = PyList_Size(swig_obj[1]);
+      out = new std::vector<absl::string_view>(size);
+      for (size_t i = 0; i < size; ++i) {
+        const PyInputString ustring(PyList_GetItem(swig_obj[1], i));
+        if (ustring.IsAvalable()) {
+          (*out)[i] = ustring.str();
+        } else {
+          PyErr_SetString(PyExc_TypeError, "list must contain strings");
+          SWIG_fail;
+        }
+        resultobj = ustring.input_type();
+      }
+    } else {
+      PyErr_SetString(PyExc_TypeError, "not a list");
+      SWIG_fail;
+    }
+    arg2 = out;
+  }
+  ecode3 = SWIG_AsVal_int(swig_obj[2], &val3);
+  if (!SWIG_IsOK(ecode3)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "SentencePieceProcessor__EncodeBatch" "', argument " "3"" of type '" "int""'");
+  } 
+  arg3 = static_cast< int >(val3);
+  ecode4 = SWIG_AsVal_bool(swig_obj[3], &val4);
+  if (!SWIG_IsOK(ecode4)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode4), "in method '" "SentencePieceProcessor__EncodeBatch" "', argument " "4"" of type '" "bool""'");
+  } 
+  arg4 = static_cast< bool >(val4);
+  ecode5 = SWIG_AsVal_bool(swig_obj[4], &val5);
+  if (!SWIG_IsOK(ecode5)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode5), "in method '" "SentencePieceProcessor__EncodeBatch" "', argument " "5"" of type '" "bool""'");
+  } 
+  arg5 = static_cast< bool >(val5);
+  ecode6 = SWIG_AsVal_bool(swig_obj[5], &val6);
+  if (!SWIG_IsOK(ecode6)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode6), "in method '" "SentencePieceProcessor__EncodeBatch" "', argument " "6"" of type '" "bool""'");
+  } 
+  arg6 = static_cast< bool >(val6);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__EncodeBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  {
+    delete arg2;
+  }
+  return resultobj;
+fail:
+  {
+    delete arg2;
+  }
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsIdsArrays(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  std::vector< absl::string_view > *arg2 = 0 ;
+  int arg3 ;
+  bool arg4 ;
+  int arg5 ;
+  float arg6 ;
+  bool arg7 ;
+  bool arg8 ;
+  bool arg9 ;
+  bool arg10 ;
+  bool arg11 ;
+  int arg12 ;
+  int arg13 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val3 ;
+  int ecode3 = 0 ;
+  bool val4 ;
+  int ecode4 = 0 ;
+  int val5 ;
+  int ecode5 = 0 ;
+  float val6 ;
+  int ecode6 = 0 ;
+  bool val7 ;
+  int ecode7 = 0 ;
+  bool val8 ;
+  int ecode8 = 0 ;
+  bool val9 ;
+  int ecode9 = 0 ;
+  bool val10 ;
+  int ecode10 = 0 ;
+  bool val11 ;
+  int ecode11 = 0 ;
+  int val12 ;
+  int ecode12 = 0 ;
+  int val13 ;
+  int ecode13 = 0 ;
+  PyObject *swig_obj[13] ;
+  PyObject *result = 0 ;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor__EncodeAsIdsArrays", 13, 13, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    std::vector<absl::string_view> *out = nullptr;
+    if (PyList_Check(swig_obj[1])) {
+      const size_t size = PyList_Size(swig_obj[1]);
+      out = new std::vector<absl::string_view>(size);
+      for (size_t i = 0; i < size; ++i) {
+        const PyInputString ustring(PyList_GetItem(swig_obj[1], i));
+        if (ustring.IsAvalable()) {
+          (*out)[i] = ustring.str();
+        } else {
+          PyErr_SetString(PyExc_TypeError, "list must contain strings");
+          SWIG_fail;
+        }
+        resultobj = ustring.input_type();
+      }
+    } else {
+      PyErr_SetString(PyExc_TypeError, "not a list");
+      SWIG_fail;
+    }
+    arg2 = out;
+  }
+  ecode3 = SWIG_AsVal_int(swig_obj[2], &val3);
+  if (!SWIG_IsOK(ecode3)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "3"" of type '" "int""'");
+  } 
+  arg3 = static_cast< int >(val3);
+  ecode4 = SWIG_AsVal_bool(swig_obj[3], &val4);
+  if (!SWIG_IsOK(ecode4)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode4), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "4"" of type '" "bool""'");
+  } 
+  arg4 = static_cast< bool >(val4);
+  ecode5 = SWIG_AsVal_int(swig_obj[4], &val5);
+  if (!SWIG_IsOK(ecode5)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode5), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "5"" of type '" "int""'");
+  } 
+  arg5 = static_cast< int >(val5);
+  ecode6 = SWIG_AsVal_float(swig_obj[5], &val6);
+  if (!SWIG_IsOK(ecode6)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode6), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "6"" of type '" "float""'");
+  } 
+  arg6 = static_cast< float >(val6);
+  ecode7 = SWIG_AsVal_bool(swig_obj[6], &val7);
+  if (!SWIG_IsOK(ecode7)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode7), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "7"" of type '" "bool""'");
+  } 
+  arg7 = static_cast< bool >(val7);
+  ecode8 = SWIG_AsVal_bool(swig_obj[7], &val8);
+  if (!SWIG_IsOK(ecode8)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode8), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "8"" of type '" "bool""'");
+  } 
+  arg8 = static_cast< bool >(val8);
+  ecode9 = SWIG_AsVal_bool(swig_obj[8], &val9);
+  if (!SWIG_IsOK(ecode9)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode9), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "9"" of type '" "bool""'");
+  } 
+  arg9 = static_cast< bool >(val9);
+  ecode10 = SWIG_AsVal_bool(swig_obj[9], &val10);
+  if (!SWIG_IsOK(ecode10)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode10), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "10"" of type '" "bool""'");
+  } 
+  arg10 = static_cast< bool >(val10);
+  ecode11 = SWIG_AsVal_bool(swig_obj[10], &val11);
+  if (!SWIG_IsOK(ecode11)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode11), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "11"" of type '" "bool""'");
+  } 
+  arg11 = static_cast< bool >(val11);
+  ecode12 = SWIG_AsVal_int(swig_obj[11], &val12);
+  if (!SWIG_IsOK(ecode12)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode12), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "12"" of type '" "int""'");
+  } 
+  arg12 = static_cast< int >(val12);
+  ecode13 = SWIG_AsVal_int(swig_obj[12], &val13);
+  if (!SWIG_IsOK(ecode13)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode13), "in method '" "SentencePieceProcessor__EncodeAsIdsArrays" "', argument " "13"" of type '" "int""'");
+  } 
+  arg13 = static_cast< int >(val13);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__EncodeAsIdsArrays((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10,arg11,arg12,arg13);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  {
+    delete arg2;
+  }
+  return resultobj;
+fail:
+  {
+    delete arg2;
+  }
+  return NULL;
+}
+
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeBufferAsIdsArrays(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  PyObject *arg2 = (PyObject *) 0 ;
+  PyObject *arg3 = (PyObject *) 0 ;
+  int arg4 ;
+  bool arg5 ;
+  int arg6 ;
+  float arg7 ;
+  bool arg8 ;
+  bool arg9 ;
+  bool arg10 ;
+  bool arg11 ;
+  bool arg12 ;
+  int arg13 ;
+  int arg14 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val4 ;
+  int ecode4 = 0 ;
+  bool val5 ;
+  int ecode5 = 0 ;
+  int val6 ;
+  int ecode6 = 0 ;
+  float val7 ;
+  int ecode7 = 0 ;
+  bool val8 ;
+  int ecode8 = 0 ;
+  bool val9 ;
+  int ecode9 = 0 ;
+  bool val10 ;
+  int ecode10 = 0 ;
+  bool val11 ;
+  int ecode11 = 0 ;
+  bool val12 ;
+  int ecode12 = 0 ;
+  int val13 ;
+  int ecode13 = 0 ;
+  int val14 ;
+  int ecode14 = 0 ;
+  PyObject *swig_obj[14] ;
+  PyObject *result = 0 ;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor__EncodeBufferAsIdsArrays", 14, 14, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  arg2 = swig_obj[1];
+  arg3 = swig_obj[2];
+  ecode4 = SWIG_AsVal_int(swig_obj[3], &val4);
+  if (!SWIG_IsOK(ecode4)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode4), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "4"" of type '" "int""'");
+  } 
+  arg4 = static_cast< int >(val4);
+  ecode5 = SWIG_AsVal_bool(swig_obj[4], &val5);
+  if (!SWIG_IsOK(ecode5)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode5), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "5"" of type '" "bool""'");
+  } 
+  arg5 = static_cast< bool >(val5);
+  ecode6 = SWIG_AsVal_int(swig_obj[5], &val6);
+  if (!SWIG_IsOK(ecode6)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode6), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "6"" of type '" "int""'");
+  } 
+  arg6 = static_cast< int >(val6);
+  ecode7 = SWIG_AsVal_float(swig_obj[6], &val7);
+  if (!SWIG_IsOK(ecode7)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode7), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "7"" of type '" "float""'");
+  } 
+  arg7 = static_cast< float >(val7);
+  ecode8 = SWIG_AsVal_bool(swig_obj[7], &val8);
+  if (!SWIG_IsOK(ecode8)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode8), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "8"" of type '" "bool""'");
+  } 
+  arg8 = static_cast< bool >(val8);
+  ecode9 = SWIG_AsVal_bool(swig_obj[8], &val9);
+  if (!SWIG_IsOK(ecode9)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode9), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "9"" of type '" "bool""'");
+  } 
+  arg9 = static_cast< bool >(val9);
+  ecode10 = SWIG_AsVal_bool(swig_obj[9], &val10);
+  if (!SWIG_IsOK(ecode10)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode10), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "10"" of type '" "bool""'");
+  } 
+  arg10 = static_cast< bool >(val10);
+  ecode11 = SWIG_AsVal_bool(swig_obj[10], &val11);
+  if (!SWIG_IsOK(ecode11)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode11), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "11"" of type '" "bool""'");
+  } 
+  arg11 = static_cast< bool >(val11);
+  ecode12 = SWIG_AsVal_bool(swig_obj[11], &val12);
+  if (!SWIG_IsOK(ecode12)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode12), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "12"" of type '" "bool""'");
+  } 
+  arg12 = static_cast< bool >(val12);
+  ecode13 = SWIG_AsVal_int(swig_obj[12], &val13);
+  if (!SWIG_IsOK(ecode13)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode13), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "13"" of type '" "int""'");
+  } 
+  arg13 = static_cast< int >(val13);
+  ecode14 = SWIG_AsVal_int(swig_obj[13], &val14);
+  if (!SWIG_IsOK(ecode14)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode14), "in method '" "SentencePieceProcessor__EncodeBufferAsIdsArrays" "', argument " "14"" of type '" "int""'");
+  } 
+  arg14 = static_cast< int >(val14);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__EncodeBufferAsIdsArrays((sentencepiece::SentencePieceProcessor const *)arg1,arg2,arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10,arg11,arg12,arg13,arg14);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  return resultobj;
+fail:
+  return NULL;
+}
+
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeArrow(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  PyObject *arg2 = (PyObject *) 0 ;
+  PyObject *arg3 = (PyObject *) 0 ;
+  int arg4 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val4 ;
+  int ecode4 = 0 ;
+  PyObject *swig_obj[4] ;
+  PyObject *result = 0 ;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor__EncodeArrow", 4, 4, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__EncodeArrow" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  arg2 = swig_obj[1];
+  arg3 = swig_obj[2];
+  ecode4 = SWIG_AsVal_int(swig_obj[3], &val4);
+  if (!SWIG_IsOK(ecode4)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode4), "in method '" "SentencePieceProcessor__EncodeArrow" "', argument " "4"" of type '" "int""'");
+  } 
+  arg4 = static_cast< int >(val4);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__EncodeArrow((sentencepiece::SentencePieceProcessor const *)arg1,arg2,arg3,arg4);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  return resultobj;
+fail:
+  return NULL;
+}
+
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIds(PyObject *self, PyObject *args) {
   PyObject *resultobj = 0;
   sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
   std::vector< int > *arg2 = 0 ;
@@ -6851,7 +8184,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIds(PyObject *self, PyO
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIds((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIds((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6911,7 +8247,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsAsBytes(PyObject *se
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsAsBytes((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsAsBytes((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -6971,7 +8310,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodePieces(PyObject *self,
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodePieces((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodePieces((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7031,7 +8373,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsAsSerializedProto(Py
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7091,7 +8436,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodePiecesAsSerializedProto
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodePiecesAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodePiecesAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7150,7 +8498,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsAsImmutableProto(PyO
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7208,7 +8559,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodePiecesAsImmutableProto(
   }
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodePiecesAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodePiecesAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< absl::string_view > const &)*arg2);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7283,7 +8637,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsBatch(PyObject *self
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7364,7 +8721,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsAsBytesBatch(PyObjec
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsAsBytesBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsAsBytesBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7444,7 +8804,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsAsSerializedProtoBat
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsAsSerializedProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsAsSerializedProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7524,7 +8887,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodeIdsAsImmutableProtoBatc
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodeIdsAsImmutableProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodeIdsAsImmutableProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< int > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7606,7 +8972,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodePiecesBatch(PyObject *s
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodePiecesBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< absl::string_view > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodePiecesBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< absl::string_view > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7682,7 +9051,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodePiecesAsSerializedProto
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodePiecesAsSerializedProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< absl::string_view > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodePiecesAsSerializedProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< absl::string_view > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7757,7 +9129,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__DecodePiecesAsImmutableProtoB
   arg3 = static_cast< int >(val3);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__DecodePiecesAsImmutableProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< absl::string_view > > const &)*arg2,arg3);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__DecodePiecesAsImmutableProtoBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::vector< absl::string_view > > const &)*arg2,arg3);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7843,7 +9218,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__NBestEncodeAsIds(PyObject *se
   arg7 = static_cast< bool >(val7);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__NBestEncodeAsIds((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__NBestEncodeAsIds((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -7932,7 +9310,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__NBestEncodeAsPieces(PyObject
   arg7 = static_cast< bool >(val7);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__NBestEncodeAsPieces((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__NBestEncodeAsPieces((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8022,7 +9403,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__NBestEncodeAsSerializedProto(
   arg7 = static_cast< bool >(val7);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__NBestEncodeAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__NBestEncodeAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8104,7 +9488,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__NBestEncodeAsImmutableProto(P
   arg7 = static_cast< bool >(val7);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__NBestEncodeAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__NBestEncodeAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8208,7 +9595,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__SampleEncodeAndScoreAsIds(PyO
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsIds((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsIds((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8321,7 +9711,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__SampleEncodeAndScoreAsPieces(
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsPieces((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsPieces((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8435,7 +9828,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__SampleEncodeAndScoreAsSeriali
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsSerializedProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8541,7 +9937,10 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor__SampleEncodeAndScoreAsImmutab
   arg10 = static_cast< bool >(val10);
   {
     try {
-      result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      {
+        ScopedReleaseGIL release_gil;
+        result = sentencepiece_SentencePieceProcessor__SampleEncodeAndScoreAsImmutableProto((sentencepiece::SentencePieceProcessor const *)arg1,SWIG_STD_MOVE(arg2),arg3,arg4,arg5,arg6,arg7,arg8,arg9,arg10);
+      }
       ReleaseResultObject(resultobj);
     }
     catch (const sentencepiece::util::Status &status) {
@@ -8852,6 +10251,187 @@ SWIGINTERN PyObject *SentencePieceProcessor_swiginit(PyObject *SWIGUNUSEDPARM(se
   return SWIG_Python_InitShadowInstance(args);
 }
 
+SWIGINTERN PyObject *_wrap_new_StreamingDecoder(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = 0 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  PyObject *swig_obj[1] ;
+  sentencepiece::StreamingDecoder *result = 0 ;
+  
+  if (!args) SWIG_fail;
+  swig_obj[0] = args;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1, SWIGTYPE_p_sentencepiece__SentencePieceProcessor,  0  | 0);
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "new_StreamingDecoder" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const &""'"); 
+  }
+  if (!argp1) {
+    SWIG_exception_fail(SWIG_NullReferenceError, "invalid null reference " "in method '" "new_StreamingDecoder" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const &""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    try {
+      result = (sentencepiece::StreamingDecoder *)new sentencepiece::StreamingDecoder((sentencepiece::SentencePieceProcessor const &)*arg1);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = SWIG_NewPointerObj(SWIG_as_voidptr(result), SWIGTYPE_p_sentencepiece__StreamingDecoder, SWIG_POINTER_NEW |  0 );
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_delete_StreamingDecoder(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::StreamingDecoder *arg1 = (sentencepiece::StreamingDecoder *) 0 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  PyObject *swig_obj[1] ;
+  
+  if (!args) SWIG_fail;
+  swig_obj[0] = args;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__StreamingDecoder, SWIG_POINTER_DISOWN |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "delete_StreamingDecoder" "', argument " "1"" of type '" "sentencepiece::StreamingDecoder *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::StreamingDecoder * >(argp1);
+  {
+    try {
+      delete arg1;
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = SWIG_Py_Void();
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_StreamingDecoder_buffered_size(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::StreamingDecoder *arg1 = (sentencepiece::StreamingDecoder *) 0 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  PyObject *swig_obj[1] ;
+  size_t result;
+  
+  if (!args) SWIG_fail;
+  swig_obj[0] = args;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__StreamingDecoder, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "StreamingDecoder_buffered_size" "', argument " "1"" of type '" "sentencepiece::StreamingDecoder const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::StreamingDecoder * >(argp1);
+  {
+    try {
+      result = ((sentencepiece::StreamingDecoder const *)arg1)->buffered_size();
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = SWIG_From_size_t(static_cast< size_t >(result));
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_StreamingDecoder_Put(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::StreamingDecoder *arg1 = (sentencepiece::StreamingDecoder *) 0 ;
+  int arg2 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val2 ;
+  int ecode2 = 0 ;
+  PyObject *swig_obj[2] ;
+  std::string result;
+  
+  if (!SWIG_Python_UnpackTuple(args, "StreamingDecoder_Put", 2, 2, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__StreamingDecoder, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "StreamingDecoder_Put" "', argument " "1"" of type '" "sentencepiece::StreamingDecoder *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::StreamingDecoder * >(argp1);
+  ecode2 = SWIG_AsVal_int(swig_obj[1], &val2);
+  if (!SWIG_IsOK(ecode2)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode2), "in method '" "StreamingDecoder_Put" "', argument " "2"" of type '" "int""'");
+  } 
+  arg2 = static_cast< int >(val2);
+  {
+    try {
+      result = sentencepiece_StreamingDecoder_Put(arg1,arg2);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  {
+    PyObject *input_type = resultobj;
+    resultobj = MakePyOutputString(result, input_type);
+  }
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_StreamingDecoder_Flush(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::StreamingDecoder *arg1 = (sentencepiece::StreamingDecoder *) 0 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  PyObject *swig_obj[1] ;
+  std::string result;
+  
+  if (!args) SWIG_fail;
+  swig_obj[0] = args;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__StreamingDecoder, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "StreamingDecoder_Flush" "', argument " "1"" of type '" "sentencepiece::StreamingDecoder *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::StreamingDecoder * >(argp1);
+  {
+    try {
+      result = sentencepiece_StreamingDecoder_Flush(arg1);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  {
+    PyObject *input_type = resultobj;
+    resultobj = MakePyOutputString(result, input_type);
+  }
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *StreamingDecoder_swigregister(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+  PyObject *obj;
+  if (!SWIG_Python_UnpackTuple(args, "swigregister", 1, 1, &obj)) return NULL;
+  SWIG_TypeNewClientData(SWIGTYPE_p_sentencepiece__StreamingDecoder, SWIG_NewClientData(obj));
+  return SWIG_Py_Void();
+}
+
+SWIGINTERN PyObject *StreamingDecoder_swiginit(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+  return SWIG_Python_InitShadowInstance(args);
+}
+
 SWIGINTERN PyObject *_wrap_SetRandomGeneratorSeed(PyObject *self, PyObject *args) {
   PyObject *resultobj = 0;
   unsigned int arg1 ;
@@ -8912,6 +10492,73 @@ fail:
 }
 
 
+SWIGINTERN PyObject *_wrap_SetThreadOptions(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  int arg1 ;
+  absl::string_view arg2 = "" ;
+  int val1 ;
+  int ecode1 = 0 ;
+  Py_ssize_t argc;
+  PyObject *swig_obj[2] = {0, 0} ;
+  sentencepiece::util::Status result;
+  
+  if (!(argc = SWIG_Python_UnpackTuple(args, "SetThreadOptions", 1, 2, swig_obj))) SWIG_fail;
+  ecode1 = SWIG_AsVal_int(swig_obj[0], &val1);
+  if (!SWIG_IsOK(ecode1)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode1), "in method '" "SetThreadOptions" "', argument " "1"" of type '" "int""'");
+  } 
+  arg1 = static_cast< int >(val1);
+  if (swig_obj[1]) {
+    const PyInputString ustring(swig_obj[1]);
+    if (!ustring.IsAvalable()) {
+      PyErr_SetString(PyExc_TypeError, "not a string");
+      SWIG_fail;
+    }
+    resultobj = ustring.input_type();
+    arg2 = ustring.str();
+  }
+  {
+    try {
+      result = sentencepiece::SetThreadOptions(arg1,SWIG_STD_MOVE(arg2));
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  {
+    if (!(&result)->ok()) {
+      SWIG_exception(ToSwigError((&result)->code()), (&result)->ToString().c_str());
+    }
+    resultobj = SWIG_From_bool((&result)->ok());
+  }
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_GetNumThreads(PyObject *self, PyObject *args) {
+  PyObject *resultobj = 0;
+  int result;
+  
+  if (!SWIG_Python_UnpackTuple(args, "GetNumThreads", 0, 0, 0)) SWIG_fail;
+  {
+    try {
+      result = (int)sentencepiece::GetNumThreads();
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = SWIG_From_int(static_cast< int >(result));
+  return resultobj;
+fail:
+  return NULL;
+}
+
+
 SWIGINTERN PyObject *_wrap_SentencePieceTrainer__TrainFromString(PyObject *self, PyObject *args) {
   PyObject *resultobj = 0;
   absl::string_view arg1 ;
@@ -9649,8 +11296,10 @@ static PyMethodDef SwigMethods[] = {
 	 { "new_SentencePieceProcessor", _wrap_new_SentencePieceProcessor, METH_NOARGS, NULL},
 	 { "delete_SentencePieceProcessor", _wrap_delete_SentencePieceProcessor, METH_O, NULL},
 	 { "SentencePieceProcessor_LoadFromSerializedProto", _wrap_SentencePieceProcessor_LoadFromSerializedProto, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor_SaveCompiledModel", _wrap_SentencePieceProcessor_SaveCompiledModel, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_SetEncodeExtraOptions", _wrap_SentencePieceProcessor_SetEncodeExtraOptions, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_SetDecodeExtraOptions", _wrap_SentencePieceProcessor_SetDecodeExtraOptions, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor_SetEncodeLimits", _wrap_SentencePieceProcessor_SetEncodeLimits, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_SetVocabulary", _wrap_SentencePieceProcessor_SetVocabulary, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_ResetVocabulary", _wrap_SentencePieceProcessor_ResetVocabulary, METH_O, NULL},
 	 { "SentencePieceProcessor_LoadVocabulary", _wrap_SentencePieceProcessor_LoadVocabulary, METH_VARARGS, NULL},
@@ -9677,6 +11326,11 @@ static PyMethodDef SwigMethods[] = {
 	 { "SentencePieceProcessor__EncodeAsPiecesBatch", _wrap_SentencePieceProcessor__EncodeAsPiecesBatch, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor__EncodeAsSerializedProtoBatch", _wrap_SentencePieceProcessor__EncodeAsSerializedProtoBatch, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor__EncodeAsImmutableProtoBatch", _wrap_SentencePieceProcessor__EncodeAsImmutableProtoBatch, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor__GetVocabularyTable", _wrap_SentencePieceProcessor__GetVocabularyTable, METH_O, NULL},
+	 { "SentencePieceProcessor__EncodeBatch", _wrap_SentencePieceProcessor__EncodeBatch, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor__EncodeAsIdsArrays", _wrap_SentencePieceProcessor__EncodeAsIdsArrays, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor__EncodeBufferAsIdsArrays", _wrap_SentencePieceProcessor__EncodeBufferAsIdsArrays, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor__EncodeArrow", _wrap_SentencePieceProcessor__EncodeArrow, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor__DecodeIds", _wrap_SentencePieceProcessor__DecodeIds, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor__DecodeIdsAsBytes", _wrap_SentencePieceProcessor__DecodeIdsAsBytes, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor__DecodePieces", _wrap_SentencePieceProcessor__DecodePieces, METH_VARARGS, NULL},
@@ -9706,8 +11360,17 @@ static PyMethodDef SwigMethods[] = {
 	 { "SentencePieceProcessor__OverrideNormalizerSpec", _wrap_SentencePieceProcessor__OverrideNormalizerSpec, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_swigregister", SentencePieceProcessor_swigregister, METH_O, NULL},
 	 { "SentencePieceProcessor_swiginit", SentencePieceProcessor_swiginit, METH_VARARGS, NULL},
+	 { "new_StreamingDecoder", _wrap_new_StreamingDecoder, METH_O, NULL},
+	 { "delete_StreamingDecoder", _wrap_delete_StreamingDecoder, METH_O, NULL},
+	 { "StreamingDecoder_buffered_size", _wrap_StreamingDecoder_buffered_size, METH_O, NULL},
+	 { "StreamingDecoder_Put", _wrap_StreamingDecoder_Put, METH_VARARGS, NULL},
+	 { "StreamingDecoder_Flush", _wrap_StreamingDecoder_Flush, METH_O, NULL},
+	 { "StreamingDecoder_swigregister", StreamingDecoder_swigregister, METH_O, NULL},
+	 { "StreamingDecoder_swiginit", StreamingDecoder_swiginit, METH_VARARGS, NULL},
 	 { "SetRandomGeneratorSeed", _wrap_SetRandomGeneratorSeed, METH_O, NULL},
 	 { "SetMinLogLevel", _wrap_SetMinLogLevel, METH_O, NULL},
+	 { "SetThreadOptions", _wrap_SetThreadOptions, METH_VARARGS, NULL},
+	 { "GetNumThreads", _wrap_GetNumThreads, METH_NOARGS, NULL},
 	 { "SentencePieceTrainer__TrainFromString", _wrap_SentencePieceTrainer__TrainFromString, METH_O, NULL},
 	 { "SentencePieceTrainer__TrainFromMap", _wrap_SentencePieceTrainer__TrainFromMap, METH_O, NULL},
 	 { "SentencePieceTrainer__TrainFromMap2", _wrap_SentencePieceTrainer__TrainFromMap2, METH_VARARGS, NULL},
@@ -9741,6 +11404,7 @@ static swig_type_info _swigt__p_sentencepiece__SentenceIterator = {"_p_sentencep
 static swig_type_info _swigt__p_sentencepiece__SentencePieceNormalizer = {"_p_sentencepiece__SentencePieceNormalizer", "sentencepiece::SentencePieceNormalizer *", 0, 0, (void*)0, 0};
 static swig_type_info _swigt__p_sentencepiece__SentencePieceProcessor = {"_p_sentencepiece__SentencePieceProcessor", "sentencepiece::SentencePieceProcessor *", 0, 0, (void*)0, 0};
 static swig_type_info _swigt__p_sentencepiece__SentencePieceTrainer = {"_p_sentencepiece__SentencePieceTrainer", "sentencepiece::SentencePieceTrainer *", 0, 0, (void*)0, 0};
+static swig_type_info _swigt__p_sentencepiece__StreamingDecoder = {"_p_sentencepiece__StreamingDecoder", "sentencepiece::StreamingDecoder *", 0, 0, (void*)0, 0};
 static swig_type_info _swigt__p_std__string = {"_p_std__string", "sentencepiece::util::bytes *|std::string *", 0, 0, (void*)0, 0};
 static swig_type_info _swigt__p_std__unordered_mapT_std__string_std__string_t = {"_p_std__unordered_mapT_std__string_std__string_t", "std::unordered_map< std::string,std::string > *", 0, 0, (void*)0, 0};
 static swig_type_info _swigt__p_std__vectorT_absl__string_view_t = {"_p_std__vectorT_absl__string_view_t", "std::vector< absl::string_view > *", 0, 0, (void*)0, 0};
@@ -9758,6 +11422,7 @@ static swig_type_info *swig_type_initial[] = {
   &_swigt__p_sentencepiece__SentencePieceNormalizer,
   &_swigt__p_sentencepiece__SentencePieceProcessor,
   &_swigt__p_sentencepiece__SentencePieceTrainer,
+  &_swigt__p_sentencepiece__StreamingDecoder,
   &_swigt__p_std__string,
   &_swigt__p_std__unordered_mapT_std__string_std__string_t,
   &_swigt__p_std__vectorT_absl__string_view_t,
@@ -9775,6 +11440,7 @@ static swig_cast_info _swigc__p_sentencepiece__SentenceIterator[] = {  {&_swigt_
 static swig_cast_info _swigc__p_sentencepiece__SentencePieceNormalizer[] = {  {&_swigt__p_sentencepiece__SentencePieceNormalizer, 0, 0, 0},{0, 0, 0, 0}};
 static swig_cast_info _swigc__p_sentencepiece__SentencePieceProcessor[] = {  {&_swigt__p_sentencepiece__SentencePieceProcessor, 0, 0, 0},{0, 0, 0, 0}};
 static swig_cast_info _swigc__p_sentencepiece__SentencePieceTrainer[] = {  {&_swigt__p_sentencepiece__SentencePieceTrainer, 0, 0, 0},{0, 0, 0, 0}};
+static swig_cast_info _swigc__p_sentencepiece__StreamingDecoder[] = {  {&_swigt__p_sentencepiece__StreamingDecoder, 0, 0, 0},{0, 0, 0, 0}};
 static swig_cast_info _swigc__p_std__string[] = {  {&_swigt__p_std__string, 0, 0, 0},{0, 0, 0, 0}};
 static swig_cast_info _swigc__p_std__unordered_mapT_std__string_std__string_t[] = {  {&_swigt__p_std__unordered_mapT_std__string_std__string_t, 0, 0, 0},{0, 0, 0, 0}};
 static swig_cast_info _swigc__p_std__vectorT_absl__string_view_t[] = {  {&_swigt__p_std__vectorT_absl__string_view_t, 0, 0, 0},{0, 0, 0, 0}};
@@ -9792,6 +11458,7 @@ static swig_cast_info *swig_cast_initial[] = {
   _swigc__p_sentencepiece__SentencePieceNormalizer,
   _swigc__p_sentencepiece__SentencePieceProcessor,
   _swigc__p_sentencepiece__SentencePieceTrainer,
+  _swigc__p_sentencepiece__StreamingDecoder,
   _swigc__p_std__string,
   _swigc__p_std__unordered_mapT_std__string_std__string_t,
   _swigc__p_std__vectorT_absl__string_view_t,
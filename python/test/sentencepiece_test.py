@@ -16,10 +16,12 @@
 # limitations under the License.!
 
 from collections import defaultdict
+import array
 import io
 import os
 import pickle
 import sys
+import threading
 import unittest
 import sentencepiece as spm
 
@@ -264,6 +266,27 @@ class TestSentencepieceProcessor(unittest.TestCase):
         [sp2.id_to_piece(i) for i in range(sp2.get_piece_size())],
     )
 
+  def test_train_iterator_error(self):
+    def sentences():
+      yield 'foo'
+      raise ValueError('broken iterator')
+
+    with self.assertRaises(RuntimeError):
+      spm.SentencePieceTrainer.train(
+          sentence_iterator=sentences(),
+          model_writer=io.BytesIO(),
+          vocab_size=10,
+          logstream=open(os.devnull, 'w'),
+      )
+
+    with self.assertRaises(RuntimeError):
+      spm.SentencePieceTrainer.train(
+          sentence_iterator=iter(['foo', 1]),
+          model_writer=io.BytesIO(),
+          vocab_size=10,
+          logstream=open(os.devnull, 'w'),
+      )
+
   def test_train_kwargs(self):
     # suppress logging (redirect to /dev/null)
     spm.SentencePieceTrainer.train(
@@ -775,6 +798,325 @@ class TestSentencepieceProcessor(unittest.TestCase):
     self.assertEqual(e1, e2)
     self.assertEqual(e1, e3)
 
+  def test_encode_batch(self):
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = file.readlines()
+
+    ids = sp.encode(texts, out_type=int)
+    for num_threads in [1, 8]:
+      r = sp.encode_batch(texts, num_threads=num_threads)
+      self.assertEqual(len(texts), len(r))
+      self.assertEqual(ids, [r[i] for i in range(len(r))])
+      self.assertEqual(len(texts) + 1, len(r.offsets))
+      self.assertEqual(0, len(r.pieces))
+      self.assertEqual(0, len(r.begins))
+
+    r = sp.EncodeBatch(
+        texts[:100], num_threads=2, with_pieces=True, with_alignment=True
+    )
+    for i, text in enumerate(texts[:100]):
+      spt = sp.encode(text, out_type='immutable_proto')
+      offset = r.offsets[i]
+      for j, piece in enumerate(spt.pieces):
+        self.assertEqual(piece.id, r.ids[offset + j])
+        self.assertEqual(piece.piece, r.piece(offset + j))
+        # The alignment is in bytes.
+        begin, end = r.begins[offset + j], r.ends[offset + j]
+        surface = text.encode('utf-8')[begin:end].decode('utf-8')
+        self.assertEqual(piece.surface, surface)
+
+    # The offsets in characters, without building the pieces.
+    r = sp.EncodeBatch(
+        texts[:100], num_threads=2, with_alignment=True, unicode_offsets=True
+    )
+    self.assertEqual(0, len(r.pieces))
+    for i, text in enumerate(texts[:100]):
+      spt = sp.encode(text, out_type='immutable_proto')
+      offset = r.offsets[i]
+      for j, piece in enumerate(spt.pieces):
+        begin, end = r.begins[offset + j], r.ends[offset + j]
+        self.assertEqual(piece.surface, text[begin:end])
+
+    # The arrays keep the result alive.
+    flat_ids = r.ids
+    del r
+    self.assertEqual(sum(ids[:100], []), flat_ids.tolist())
+    with self.assertRaises(TypeError):
+      flat_ids[0] = 0
+
+    with self.assertRaises(TypeError):
+      sp.encode_batch('hello')
+
+  def test_vocabulary_table(self):
+    for sp in [self.sp_, self.jasp_]:
+      table = sp.get_vocabulary_table()
+      self.assertEqual(sp.get_piece_size(), len(table))
+      self.assertEqual(len(table) + 1, len(table.piece_offsets))
+      pieces = table.piece_list()
+      for i in range(len(table)):
+        self.assertEqual(sp.id_to_piece(i), pieces[i])
+        self.assertEqual(sp.id_to_piece(i), table.piece(i))
+        self.assertAlmostEqual(sp.get_score(i), table.scores[i])
+        self.assertEqual(sp.is_unknown(i),
+                         table.types[i] == spm.VocabularyTable.UNKNOWN)
+        self.assertEqual(sp.is_control(i),
+                         table.types[i] == spm.VocabularyTable.CONTROL)
+        self.assertEqual(sp.is_unused(i),
+                         table.types[i] == spm.VocabularyTable.UNUSED)
+
+    # The arrays keep the table alive.
+    scores = self.sp_.get_vocabulary_table().scores
+    self.assertEqual(self.sp_.get_piece_size(), len(scores))
+    with self.assertRaises(TypeError):
+      scores[0] = 0.0
+
+  def test_encode_arrays(self):
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = file.readlines()[:100] + ['']
+    ids = sp.encode(texts, out_type=int, add_bos=True)
+
+    flat, offsets = sp._EncodeAsIdsArrays(
+        texts, 2, False, 0, 0.0, True, False, False, False, False, -1, 0)
+    flat, offsets = memoryview(flat), memoryview(offsets)
+    self.assertEqual(len(texts) + 1, len(offsets))
+    self.assertEqual(sum(ids, []), flat.tolist())
+    for i in range(len(texts)):
+      self.assertEqual(ids[i], flat[offsets[i]:offsets[i + 1]].tolist())
+
+    padded, lengths = sp._EncodeAsIdsArrays(
+        texts, 2, False, 0, 0.0, True, False, False, False, True, 0, 0)
+    padded = memoryview(padded)
+    width = max(len(x) for x in ids)
+    self.assertEqual((len(texts), width), padded.shape)
+    self.assertEqual([len(x) for x in ids], memoryview(lengths).tolist())
+    self.assertEqual([x + [0] * (width - len(x)) for x in ids],
+                     padded.tolist())
+
+    # <s>, </s>, truncation and reversal are laid out in one pass.
+    plain = sp.encode(texts, out_type=int)
+    expected = [[sp.bos_id()] + x[:6][::-1] + [sp.eos_id()] for x in plain]
+    flat, offsets = sp._EncodeAsIdsArrays(
+        texts, 2, False, 0, 0.0, True, True, True, False, False, -1, 8)
+    flat, offsets = memoryview(flat), memoryview(offsets)
+    self.assertEqual(expected, [flat[offsets[i]:offsets[i + 1]].tolist()
+                                for i in range(len(texts))])
+    padded, lengths = sp._EncodeAsIdsArrays(
+        texts, 2, False, 0, 0.0, True, True, True, False, True, -1, 8)
+    self.assertEqual([len(x) for x in expected], memoryview(lengths).tolist())
+    self.assertEqual([x + [-1] * (8 - len(x)) for x in expected],
+                     memoryview(padded).tolist())
+    sampled, offsets = sp._EncodeAsIdsArrays(
+        texts, 2, True, -1, 0.1, True, True, False, False, False, -1, 8)
+    sampled, offsets = memoryview(sampled), memoryview(offsets)
+    for i in range(len(texts)):
+      row = sampled[offsets[i]:offsets[i + 1]].tolist()
+      self.assertLessEqual(len(row), 8)
+      self.assertEqual([sp.bos_id(), sp.eos_id()], [row[0], row[-1]])
+
+    with self.assertRaises(RuntimeError):
+      sp.encode(texts, out_type=int, max_length=8)
+    with self.assertRaises(ValueError):
+      sp.encode(texts, out_type='numpy', add_bos=True, add_eos=True,
+                max_length=1)
+
+    try:
+      import numpy
+    except ImportError:
+      return
+    flat, offsets = sp.encode(texts, out_type='numpy', add_bos=True)
+    self.assertEqual(numpy.int32, flat.dtype)
+    self.assertEqual(ids[3], flat[offsets[3]:offsets[4]].tolist())
+    padded, lengths = sp.encode(texts, out_type='numpy_padded', add_bos=True)
+    self.assertEqual((len(texts), width), padded.shape)
+    self.assertEqual(ids[3], padded[3, :lengths[3]].tolist())
+    self.assertEqual(ids[3], sp.encode(texts[3], out_type='numpy',
+                                       add_bos=True).tolist())
+
+  def test_encode_buffer(self):
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = [''] + file.readlines()[:100] + ['ü']
+    data = ''.join(texts).encode('utf-8')
+    offsets = [0]
+    for text in texts:
+      offsets.append(offsets[-1] + len(text.encode('utf-8')))
+
+    ids = sp.encode(texts, out_type=int, add_eos=True)
+    for typecode in ['i', 'q']:
+      self.assertEqual(
+          ids,
+          sp.encode_buffer(data, array.array(typecode, offsets),
+                           out_type=int, add_eos=True, num_threads=2))
+    self.assertEqual(
+        ids[1:3],
+        sp.encode_buffer(memoryview(data), array.array('i', offsets[1:4]),
+                         out_type=int, add_eos=True))
+    self.assertEqual([], sp.encode_buffer(data, array.array('i', [0]),
+                                          out_type=int))
+
+    with self.assertRaises(IndexError):
+      sp.encode_buffer(data, array.array('i', [0, len(data) + 1]),
+                       out_type=int)
+    with self.assertRaises(IndexError):
+      sp.encode_buffer(data, array.array('i', [2, 1]), out_type=int)
+    with self.assertRaises(TypeError):
+      sp.encode_buffer(data, array.array('d', [0, 1]), out_type=int)
+    with self.assertRaises(TypeError):
+      sp.encode_buffer('hello', array.array('i', [0, 1]), out_type=int)
+
+  def test_encode_arrow(self):
+    try:
+      import pyarrow
+    except ImportError:
+      return
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = file.readlines()[:100]
+    texts[3] = None
+    ids = [None if text is None else sp.encode(text) for text in texts]
+
+    for string_type in [pyarrow.string(), pyarrow.large_string()]:
+      array = pyarrow.array(texts, type=string_type)
+      result = pyarrow.array(sp.encode_arrow(array, num_threads=2))
+      self.assertEqual(ids, result.to_pylist())
+      result = pyarrow.array(sp.encode_arrow(array.slice(3)))
+      self.assertEqual(ids[3:], result.to_pylist())
+
+    with self.assertRaises(TypeError):
+      sp.encode_arrow(texts)
+
+  def test_encode_in_threads(self):
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = file.readlines()
+    ids = sp.encode(texts, out_type=int)
+    decoded = sp.decode(ids)
+
+    # The encode and decode calls release the GIL, and do not interfere.
+    results = [None] * 8
+
+    def run(n):
+      if n % 2 == 0:
+        results[n] = sp.encode(texts, out_type=int, num_threads=2)
+      else:
+        results[n] = [sp.decode(sp.encode(s)) for s in texts[:200]]
+
+    threads = [threading.Thread(target=run, args=(n,)) for n in range(8)]
+    for thread in threads:
+      thread.start()
+    for thread in threads:
+      thread.join()
+    for n, result in enumerate(results):
+      self.assertEqual(ids if n % 2 == 0 else decoded[:200], result)
+
+    with self.assertRaises(IndexError):
+      sp.decode([sp.piece_size()])
+
+  def test_encode_limits(self):
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      text = ' '.join(line.strip() for line in file.readlines()[:200])
+    ids = sp.encode(text)
+    pieces = sp.encode(text, out_type=str)
+
+    sp.set_encode_limits(10, 0)
+    self.assertEqual(ids[:10], sp.encode(text))
+    self.assertEqual(pieces[:10], sp.encode(text, out_type=str))
+    self.assertEqual([ids[:10]] * 3, sp.encode([text] * 3, num_threads=2))
+    self.assertEqual([sp.bos_id()] + ids[:10], sp.encode(text, add_bos=True))
+
+    sp.set_encode_limits(0, 20)
+    self.assertEqual(sp.encode(text[:20]), sp.encode(text))
+    sp.set_encode_limits(0, 0)
+    self.assertEqual(ids, sp.encode(text))
+
+  def test_encode_async(self):
+    import asyncio
+
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = file.readlines()[:100]
+    ids = sp.encode(texts)
+
+    async def run():
+      encoded = await asyncio.gather(
+          *[sp.encode_async(text) for text in texts])
+      self.assertEqual(ids, list(encoded))
+      self.assertEqual(ids, await sp.encode_async(texts, num_threads=2))
+      self.assertEqual(
+          sp.encode(texts[0], out_type=str),
+          await sp.encode_async(texts[0], out_type=str))
+      self.assertEqual(sp.decode(ids), await sp.decode_async(ids))
+      with self.assertRaises(IndexError):
+        await sp.decode_async([sp.piece_size()])
+
+    asyncio.run(run())
+
+  def test_streaming_decoder(self):
+    for model, texts in [
+        ('test_model.model', ['I saw a girl with a telescope.', '']),
+        ('test_ja_model.model', ['吾輩は猫である。名前はまだ無い。']),
+    ]:
+      sp = spm.SentencePieceProcessor(model_file=os.path.join('test', model))
+      decoder = spm.StreamingDecoder(sp)
+      for text in texts:
+        ids = sp.encode(text)
+        pieces = [decoder.put(id) for id in ids]
+        pieces.append(decoder.flush())
+        self.assertEqual(sp.decode(ids), ''.join(pieces))
+        self.assertEqual(0, decoder.buffered_size())
+
+    with self.assertRaises(IndexError):
+      decoder.put(sp.piece_size())
+
+  def test_encode_after_fork(self):
+    if not hasattr(os, 'fork'):
+      return
+    sp = spm.SentencePieceProcessor(
+        model_file=os.path.join('test', 'test_model.model')
+    )
+    with open(os.path.join(data_dir, 'botchan.txt'), 'r') as file:
+      texts = file.readlines()
+    # Starts the workers of the parent before the fork.
+    pieces = sp.encode(texts, out_type=str, num_threads=4)
+    ids = sp.encode(texts, out_type=int, num_threads=4)
+    sampled = sp.encode(texts, enable_sampling=True, alpha=0.1, num_threads=4)
+    self.assertEqual(len(texts), len(sampled))
+
+    # The child, e.g. a DataLoader worker, runs the batches on its own
+    # workers.
+    pid = os.fork()
+    if pid == 0:
+      ok = (
+          sp.encode(texts, out_type=int, num_threads=4) == ids
+          and sp.encode(texts, out_type=str, num_threads=4) == pieces
+          and len(
+              sp.encode(
+                  texts, enable_sampling=True, alpha=0.1, num_threads=4
+              )
+          )
+          == len(texts)
+      )
+      os._exit(0 if ok else 1)
+    _, status = os.waitpid(pid, 0)
+    self.assertEqual(0, status)
+
   def test_pickle(self):
     with open('sp.pickle', 'wb') as f:
       pickle.dump(self.sp_, f)
@@ -788,6 +1130,24 @@ class TestSentencepieceProcessor(unittest.TestCase):
 
     self.assertEqual(id1, id2)
 
+  def test_pickle_compiled_model(self):
+    self.sp_.save_compiled_model('compiled.model')
+    sp = spm.SentencePieceProcessor(model_file='compiled.model')
+    ids = self.sp_.encode('hello world.')
+    self.assertEqual(ids, sp.encode('hello world.'))
+
+    # Only the path of the compiled model is pickled.
+    data = pickle.dumps(sp)
+    self.assertLess(len(data), 1000)
+    self.assertGreater(len(pickle.dumps(self.sp_)), 1000)
+    self.assertEqual(ids, pickle.loads(data).encode('hello world.'))
+
+    stat = os.stat('compiled.model')
+    os.utime('compiled.model', ns=(stat.st_atime_ns, stat.st_mtime_ns + 1000))
+    with self.assertRaises(RuntimeError):
+      pickle.loads(data)
+    os.remove('compiled.model')
+
   def test_global_params(self):
     spm.SetRandomGeneratorSeed(0)
     spm.SetMinLogLevel(2)
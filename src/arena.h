@@ -0,0 +1,173 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace sentencepiece {
+namespace model {
+
+// Monotonic allocator of the short-lived buffers of an encode. Allocate()
+// bumps a pointer in the current block, and the memory is only given back
+// all at once by Reset() or by an ArenaScope, keeping the blocks for the
+// next use. Only for trivially destructible objects, whose destructors are
+// never run. Not thread-safe; an arena is usually thread-local.
+class Arena {
+ public:
+  explicit Arena(size_t block_size = kDefaultBlockSize)
+      : block_size_(std::max<size_t>(block_size, 64)) {}
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Returns `size` bytes aligned to `align`, a power of two.
+  void *Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    uintptr_t ptr = (position_ + align - 1) & ~(align - 1);
+    if (limit_ == 0 || ptr + size > limit_) {
+      NextBlock(size + align);
+      ptr = (position_ + align - 1) & ~(align - 1);
+    }
+    position_ = ptr + size;
+    return reinterpret_cast<void *>(ptr);
+  }
+
+  // Returns an uninitialized array of `size` T.
+  template <typename T>
+  T *AllocateArray(size_t size) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "the destructors of an arena are never run");
+    return static_cast<T *>(Allocate(sizeof(T) * size, alignof(T)));
+  }
+
+  // Gives all the memory back, keeping the blocks.
+  void Reset() {
+    block_index_ = 0;
+    position_ = limit_ = 0;
+  }
+
+  // Returns the bytes of the blocks.
+  size_t capacity() const {
+    size_t bytes = 0;
+    for (const auto &block : blocks_) bytes += block.size;
+    return bytes;
+  }
+
+ private:
+  friend class ArenaScope;
+
+  static constexpr size_t kDefaultBlockSize = 4096;
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+
+  void StartBlock(size_t index) {
+    block_index_ = index;
+    position_ = reinterpret_cast<uintptr_t>(blocks_[index].data.get());
+    limit_ = position_ + blocks_[index].size;
+  }
+
+  // Moves to the next block with `size` bytes or more. The blocks after the
+  // current one are reused when they are large enough, and the new ones
+  // double in size, so a steady workload stops allocating.
+  void NextBlock(size_t size) {
+    // No block is started after a reset.
+    const size_t next = limit_ == 0 ? 0 : block_index_ + 1;
+    if (next < blocks_.size() && blocks_[next].size < size) {
+      // Too small for this allocation: replaces it with a larger one.
+      blocks_.erase(blocks_.begin() + next, blocks_.end());
+    }
+    if (next == blocks_.size()) {
+      Block block;
+      block.size = std::max(size, blocks_.empty() ? block_size_
+                                                  : 2 * blocks_.back().size);
+      block.data.reset(new char[block.size]);
+      blocks_.push_back(std::move(block));
+    }
+    StartBlock(next);
+  }
+
+  std::vector<Block> blocks_;
+  size_t block_index_ = 0;
+  uintptr_t position_ = 0;
+  uintptr_t limit_ = 0;
+  const size_t block_size_;
+};
+
+// Gives the memory allocated from `arena` in its lifetime back on
+// destruction, so that the scopes of nested calls may share an arena.
+class ArenaScope {
+ public:
+  explicit ArenaScope(Arena *arena)
+      : arena_(arena),
+        block_index_(arena->block_index_),
+        position_(arena->position_),
+        limit_(arena->limit_) {}
+
+  ~ArenaScope() {
+    arena_->block_index_ = block_index_;
+    arena_->position_ = position_;
+    arena_->limit_ = limit_;
+  }
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+ private:
+  Arena *arena_;
+  const size_t block_index_;
+  const uintptr_t position_;
+  const uintptr_t limit_;
+};
+
+// STL allocator on an Arena, e.g., for the std::vector of an encode. The
+// memory of a grown vector is only given back with its arena scope.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena *arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {}
+
+  T *allocate(size_t size) { return arena_->AllocateArray<T>(size); }
+  void deallocate(T *, size_t) {}
+
+  Arena *arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &other) const {
+    return arena_ == other.arena();
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena_ != other.arena();
+  }
+
+ private:
+  Arena *arena_;
+};
+
+}  // namespace model
+}  // namespace sentencepiece
+#endif  // ARENA_H_
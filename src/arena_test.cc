@@ -0,0 +1,85 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "arena.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "testharness.h"
+
+namespace sentencepiece {
+namespace model {
+
+TEST(ArenaTest, AllocateTest) {
+  Arena arena(128);
+  EXPECT_EQ(0, arena.capacity());
+
+  char *c = arena.AllocateArray<char>(3);
+  int64_t *n = arena.AllocateArray<int64_t>(4);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(n) % alignof(int64_t));
+  EXPECT_GE(reinterpret_cast<char *>(n), c + 3);
+  for (int i = 0; i < 4; ++i) n[i] = i;
+  EXPECT_EQ(128, arena.capacity());
+
+  // A larger allocation than a block gets a block of its own, and the
+  // memory allocated before is left as it is.
+  int *large = arena.AllocateArray<int>(1000);
+  for (int i = 0; i < 1000; ++i) large[i] = i;
+  EXPECT_GE(arena.capacity(), 128 + 4000);
+  for (int i = 0; i < 4; ++i) EXPECT_EQ(i, n[i]);
+
+  // The blocks are reused after a reset.
+  const size_t capacity = arena.capacity();
+  arena.Reset();
+  EXPECT_EQ(c, arena.AllocateArray<char>(3));
+  arena.AllocateArray<int>(1000);
+  EXPECT_EQ(capacity, arena.capacity());
+}
+
+TEST(ArenaTest, ScopeTest) {
+  Arena arena(128);
+  int *outer = arena.AllocateArray<int>(4);
+  int *first = nullptr;
+  {
+    const ArenaScope scope(&arena);
+    first = arena.AllocateArray<int>(4);
+    {
+      const ArenaScope nested(&arena);
+      arena.AllocateArray<int>(100);
+    }
+    EXPECT_EQ(first + 4, arena.AllocateArray<int>(4));
+  }
+  // The memory of the scope is given back, and the one before is kept.
+  EXPECT_EQ(first, arena.AllocateArray<int>(4));
+  EXPECT_NE(outer, first);
+
+  {
+    const ArenaScope scope(&arena);
+    std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>(&arena)};
+    for (int i = 0; i < 1000; ++i) v.push_back(i);
+    for (int i = 0; i < 1000; ++i) EXPECT_EQ(i, v[i]);
+  }
+  const size_t capacity = arena.capacity();
+  {
+    const ArenaScope scope(&arena);
+    std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>(&arena)};
+    for (int i = 0; i < 1000; ++i) v.push_back(i);
+  }
+  // A steady workload stops allocating blocks.
+  EXPECT_EQ(capacity, arena.capacity());
+}
+
+}  // namespace model
+}  // namespace sentencepiece
@@ -0,0 +1,107 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "third_party/absl/strings/str_format.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace benchmark {
+
+double WallTime() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+double Result::ns_per_call() const {
+  return stats.calls == 0 ? 0.0 : 1e9 * seconds / stats.calls;
+}
+
+double Result::bytes_per_second() const {
+  return seconds == 0.0 ? 0.0 : stats.bytes / seconds;
+}
+
+double Result::tokens_per_second() const {
+  return seconds == 0.0 ? 0.0 : stats.tokens / seconds;
+}
+
+Result Run(const std::function<PassStats()> &pass, double min_seconds) {
+  pass();
+  Result result;
+  const double start = WallTime();
+  do {
+    const PassStats stats = pass();
+    result.stats.calls += stats.calls;
+    result.stats.bytes += stats.bytes;
+    result.stats.tokens += stats.tokens;
+    ++result.passes;
+    result.seconds = WallTime() - start;
+  } while (result.seconds < min_seconds);
+  return result;
+}
+
+Reporter::Reporter(absl::string_view format) : tsv_(format == "tsv") {
+  CHECK(format == "text" || format == "tsv")
+      << "unknown output format: " << format;
+}
+
+void Reporter::Report(const Result &result) {
+  if (tsv_) {
+    if (!header_written_) {
+      std::cout << "benchmark\tmodel\tinputs\tpasses\tcalls\tseconds\t"
+                   "ns_per_call\tbytes_per_second\ttokens_per_second\n";
+    }
+    std::cout << absl::StrFormat(
+        "%s\t%s\t%s\t%lld\t%lld\t%.6f\t%.1f\t%.0f\t%.0f\n",
+        result.name.c_str(), result.model.c_str(), result.inputs.c_str(),
+        static_cast<long long>(result.passes),
+        static_cast<long long>(result.stats.calls), result.seconds,
+        result.ns_per_call(), result.bytes_per_second(),
+        result.tokens_per_second());
+  } else {
+    if (!header_written_) {
+      std::cout << absl::StrFormat("%-20s %-12s %-8s %12s %10s %12s\n",
+                                   "benchmark", "model", "inputs",
+                                   "ns/call", "MB/s", "Mtokens/s");
+    }
+    std::cout << absl::StrFormat(
+        "%-20s %-12s %-8s %12.1f %10.2f %12.3f\n", result.name.c_str(),
+        result.model.c_str(), result.inputs.c_str(), result.ns_per_call(),
+        result.bytes_per_second() / 1e6, result.tokens_per_second() / 1e6);
+  }
+  header_written_ = true;
+  std::cout.flush();
+}
+
+int64 Percentile(const std::vector<int64> &values, double q) {
+  if (values.empty()) return 0;
+  const size_t rank = static_cast<size_t>(std::ceil(q * values.size()));
+  return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+}
+
+absl::string_view TruncateUTF8(absl::string_view text, size_t size) {
+  if (text.size() <= size) return text;
+  while (size > 0 && string_util::IsTrailByte(text[size])) --size;
+  return text.substr(0, size);
+}
+
+}  // namespace benchmark
+}  // namespace sentencepiece
@@ -0,0 +1,79 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace benchmark {
+
+// Seconds of the monotonic wall clock since an arbitrary origin.
+double WallTime();
+
+// Work done by one pass of a benchmark over its inputs.
+struct PassStats {
+  int64 calls = 0;   // Calls to the benchmarked method.
+  int64 bytes = 0;   // Bytes of the processed text.
+  int64 tokens = 0;  // Tokens produced or consumed.
+};
+
+// Throughput of one benchmark.
+struct Result {
+  std::string name;    // e.g., "encode".
+  std::string model;   // Name of the model.
+  std::string inputs;  // Name of the input set.
+  int64 passes = 0;
+  double seconds = 0.0;
+  PassStats stats;  // Sum of all the passes.
+
+  double ns_per_call() const;
+  double bytes_per_second() const;
+  double tokens_per_second() const;
+};
+
+// Runs `pass` once to warm up, then repeatedly until `min_seconds` have
+// elapsed, and at least once.
+Result Run(const std::function<PassStats()> &pass, double min_seconds);
+
+// Writes results to stdout as an aligned table ("text") or as
+// tab-separated values with a header line ("tsv").
+class Reporter {
+ public:
+  explicit Reporter(absl::string_view format);
+
+  void Report(const Result &result);
+
+ private:
+  const bool tsv_;
+  bool header_written_ = false;
+};
+
+// Returns the `q`-quantile, 0 <= q <= 1, of the sorted `values` by the
+// nearest rank. 0 if `values` is empty.
+int64 Percentile(const std::vector<int64> &values, double q);
+
+// Returns the prefix of `text` of at most `size` bytes which does not cut a
+// UTF-8 character.
+absl::string_view TruncateUTF8(absl::string_view text, size_t size);
+
+}  // namespace benchmark
+}  // namespace sentencepiece
+#endif  // BENCHMARK_H_
@@ -21,38 +21,329 @@
 #include <utility>
 #include <vector>
 
-#include "freelist.h"
+#include "arena.h"
+#include "memory_usage.h"
 #include "third_party/absl/container/flat_hash_map.h"
 #include "util.h"
 
 namespace sentencepiece {
 namespace bpe {
 
-Model::Model(const ModelProto &model_proto) {
+Model::Model(const ModelProto &model_proto,
+             std::shared_ptr<const CompiledModel> compiled_model) {
   model_proto_ = &model_proto;
+  compiled_model_ = std::move(compiled_model);
   InitializePieces();
+  if (status().ok()) {
+    BuildMerges();
+    pieces_within_words_ = PiecesAreWithinWords(nullptr);
+  }
 }
 
 Model::~Model() {}
 
-std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
-    absl::string_view normalized, float alpha) const {
+namespace {
+inline uint64 MergeKey(int left, int right) {
+  return (static_cast<uint64>(static_cast<uint32>(left)) << 32) |
+         static_cast<uint32>(right);
+}
+
+inline uint64 MergeHash(uint64 key) {
+  key *= 0x9E3779B97F4A7C15ULL;
+  return key ^ (key >> 32);
+}
+
+// Returns the arena of the symbols and the agenda of MergeWithAgenda() in
+// the calling thread.
+model::Arena &GetThreadLocalArena() {
+  thread_local model::Arena arena;
+  return arena;
+}
+}  // namespace
+
+void Model::BuildMerges() {
+  single_byte_piece_ids_.fill(-1);
+  for (int c = 0; c < 256; ++c) {
+    const char ch = static_cast<char>(c);
+    const auto it = pieces_.find(absl::string_view(&ch, 1));
+    if (it != pieces_.end()) single_byte_piece_ids_[c] = it->second;
+  }
+
+  std::vector<Merge> merges;
+  for (const auto &it : pieces_) {
+    const absl::string_view piece = it.first;
+    for (size_t n = 1; n < piece.size(); ++n) {
+      const auto left = pieces_.find(piece.substr(0, n));
+      if (left == pieces_.end()) continue;
+      const auto right = pieces_.find(piece.substr(n));
+      if (right == pieces_.end()) continue;
+      Merge merge;
+      merge.key = MergeKey(left->second, right->second);
+      merge.id = it.second;
+      merge.score = GetScoreInlined(it.second);
+      merges.push_back(merge);
+    }
+  }
+
+  // Keeps the load factor at most 1/2.
+  size_t size = 16;
+  while (size < 2 * merges.size()) size *= 2;
+  merges_.assign(size, Merge());
+  merges_mask_ = size - 1;
+  for (const auto &merge : merges) {
+    uint64 slot = MergeHash(merge.key) & merges_mask_;
+    while (merges_[slot].key != kEmptyMergeKey) {
+      slot = (slot + 1) & merges_mask_;
+    }
+    merges_[slot] = merge;
+  }
+}
+
+const Model::Merge *Model::FindMerge(int left, int right) const {
+  const uint64 key = MergeKey(left, right);
+  for (uint64 slot = MergeHash(key) & merges_mask_;;
+       slot = (slot + 1) & merges_mask_) {
+    const Merge &merge = merges_[slot];
+    if (merge.key == key) return &merge;
+    if (merge.key == kEmptyMergeKey) return nullptr;
+  }
+}
+
+int Model::FindSymbolPiece(absl::string_view symbol) const {
+  if (symbol.size() == 1) {
+    return single_byte_piece_ids_[static_cast<uint8>(symbol[0])];
+  }
+  const auto it = pieces_.find(symbol);
+  return it == pieces_.end() ? -1 : it->second;
+}
+
+int Model::FindMergedPiece(absl::string_view merged, int left_id, int right_id,
+                           float *score) const {
+  if (left_id >= 0 && right_id >= 0) {
+    const Merge *merge = FindMerge(left_id, right_id);
+    if (merge == nullptr) return -1;
+    *score = merge->score;
+    return merge->id;
+  }
+  // A character which is not a piece may still be a part of a piece.
+  const auto it = pieces_.find(merged);
+  if (it == pieces_.end()) return -1;
+  *score = GetScoreInlined(it->second);
+  return it->second;
+}
+
+int Model::SplitIntoSymbols(absl::string_view normalized,
+                            LinearSymbol *symbols) const {
+  int size = 0;
+  while (!normalized.empty()) {
+    LinearSymbol &s = symbols[size];
+    const int mblen = matcher_->PrefixMatch(normalized, &s.freeze);
+    s.piece = absl::string_view(normalized.data(), mblen);
+    s.id = FindSymbolPiece(s.piece);
+    s.prev = size - 1;
+    normalized.remove_prefix(mblen);
+    s.next = normalized.empty() ? -1 : size + 1;
+    ++size;
+  }
+  return size;
+}
+
+void Model::MergeByLinearScan(
+    LinearSymbol *symbols, int size,
+    std::pair<absl::string_view, absl::string_view> *last_merge) const {
+  // Finds the merge of `left` and the next symbol.
+  auto update_pair = [this, symbols](int left) {
+    if (left == -1) return;
+    LinearSymbol &s = symbols[left];
+    s.pair_id = -1;
+    if (s.next == -1 || s.freeze || symbols[s.next].freeze) return;
+    const LinearSymbol &r = symbols[s.next];
+    s.pair_id = FindMergedPiece(
+        absl::string_view(s.piece.data(), s.piece.size() + r.piece.size()),
+        s.id, r.id, &s.pair_score);
+  };
+
+  for (int i = 0; i < size; ++i) update_pair(i);
+
+  // Merges the best pair until none is left. The leftmost pair wins a tie, as
+  // in the agenda.
+  while (true) {
+    int best = -1;
+    for (int i = 0; i != -1; i = symbols[i].next) {
+      if (symbols[i].pair_id != -1 &&
+          (best == -1 || symbols[i].pair_score > symbols[best].pair_score)) {
+        best = i;
+      }
+    }
+    if (best == -1) break;
+
+    LinearSymbol &left = symbols[best];
+    const LinearSymbol &right = symbols[left.next];
+    if (last_merge != nullptr) *last_merge = {left.piece, right.piece};
+    left.piece = absl::string_view(left.piece.data(),
+                                   left.piece.size() + right.piece.size());
+    left.id = left.pair_id;
+    left.next = right.next;
+    if (left.next != -1) symbols[left.next].prev = best;
+    update_pair(left.prev);
+    update_pair(best);
+  }
+}
+
+void Model::EncodeShort(absl::string_view normalized,
+                        EncodeResult *output) const {
+  LinearSymbol symbols[kMaxShortInputSize];
+  MergeByLinearScan(symbols, SplitIntoSymbols(normalized, symbols), nullptr);
+  const auto *mask = ScopedVocabularyMask::current();
+  for (int i = 0; i != -1; i = symbols[i].next) {
+    const LinearSymbol &s = symbols[i];
+    if (s.id >= 0 && !IsUnusedInlined(s.id, mask)) {
+      output->emplace_back(s.piece, s.id);
+    } else {
+      Resegment(s.piece, output);
+    }
+  }
+}
+
+void Model::BuildRevMerge() const {
+  std::vector<LinearSymbol> symbols;
+  for (const auto &it : pieces_) {
+    // The symbols inside a piece are merged in the same order wherever the
+    // piece appears, so its last merge does not depend on the context.
+    symbols.resize(it.first.size());
+    const int size = SplitIntoSymbols(it.first, symbols.data());
+    std::pair<absl::string_view, absl::string_view> last_merge;
+    MergeByLinearScan(symbols.data(), size, &last_merge);
+    if (size > 1 && symbols[0].next == -1 && symbols[0].id == it.second) {
+      rev_merge_[it.second] = last_merge;
+    }
+  }
+  rev_merge_built_.store(true, std::memory_order_release);
+}
+
+void Model::AddMemoryUsage(MemoryUsage *usage) const {
+  ModelInterface::AddMemoryUsage(usage);
+  size_t bytes = memory_usage::Vector(merges_);
+  if (rev_merge_built_.load(std::memory_order_acquire)) {
+    bytes += memory_usage::HashMap(rev_merge_);
+  }
+  usage->Add("bpe_merges", bytes);
+}
+
+void Model::Resegment(absl::string_view w, EncodeResult *output) const {
+  const int id = PieceToId(w);
+  if (id == -1 || !IsUnusedInlined(id)) {
+    output->emplace_back(w, id);
+    return;
+  }
+  // Any piece may be unused in some vocabulary restriction.
+  std::call_once(rev_merge_once_, [this]() { BuildRevMerge(); });
+  const auto p = rev_merge_.find(id);
+  if (p == rev_merge_.end()) {
+    // The piece is never made by merges, e.g., an unused character.
+    output->emplace_back(w, id);
+    return;
+  }
+  // Recursively resegment left and right symbols.
+  Resegment(p->second.first, output);
+  Resegment(p->second.second, output);
+}
+
+EncodeResult Model::SampleEncode(absl::string_view normalized,
+                                 float alpha) const {
+  // The segmentation is only deterministic without the dropout.
+  if (alpha <= 0.0 && IsEncodeCacheAvailable()) {
+    return EncodeWithCache(normalized, [this](absl::string_view word) {
+      return SampleEncodeUncached(word, 0.0);
+    });
+  }
+  return SampleEncodeUncached(normalized, alpha);
+}
+
+EncodeResult Model::SampleEncodeUncached(absl::string_view normalized,
+                                         float alpha) const {
+  if (!status().ok() || normalized.empty()) {
+    return {};
+  }
+
+  if (alpha <= 0.0) {
+    if (normalized.size() <= kMaxShortInputSize) {
+      EncodeResult output;
+      EncodeShort(normalized, &output);
+      return output;
+    }
+    if (pieces_within_words_) return EncodeByWords(normalized);
+  }
+  return SampleEncodeWithAgenda(normalized, alpha);
+}
+
+EncodeResult Model::EncodeByWords(absl::string_view normalized) const {
+  std::vector<absl::string_view> words;
+  SplitIntoWords(normalized,
+                 model_proto_->trainer_spec().treat_whitespace_as_suffix(),
+                 false, &words);
+  EncodeResult output;
+  for (const auto word : words) {
+    if (word.size() <= kMaxShortInputSize) {
+      EncodeShort(word, &output);
+    } else {
+      const auto word_output = SampleEncodeWithAgenda(word, 0.0);
+      output.insert(output.end(), word_output.begin(), word_output.end());
+    }
+  }
+  return output;
+}
+
+EncodeResult Model::SampleEncodeWithSeed(absl::string_view normalized,
+                                         float alpha, uint64 seed) const {
+  if (alpha <= 0.0 || alpha >= 1.0) return SampleEncode(normalized, alpha);
   if (!status().ok() || normalized.empty()) {
     return {};
   }
 
+  // Draws the numbers in blocks instead of one per merge.
+  constexpr int kBlockSize = 64;
+  random::CounterGenerator gen(seed);
+  float values[kBlockSize];
+  int pos = kBlockSize;
+  return MergeWithAgenda(normalized, [&]() {
+    if (pos == kBlockSize) {
+      gen.Fill(values, kBlockSize);
+      pos = 0;
+    }
+    return values[pos++] < alpha;
+  });
+}
+
+EncodeResult Model::SampleEncodeWithAgenda(absl::string_view normalized,
+                                           float alpha) const {
+  // BPE-dropout: https://arxiv.org/pdf/1910.13267.pdf
+  std::mt19937 *rand_gen = nullptr;
+  return MergeWithAgenda(normalized, [&]() {
+    if (alpha <= 0.0) return false;
+    if (alpha >= 1.0) return true;
+    if (rand_gen == nullptr) rand_gen = random::GetRandomGenerator();
+    std::uniform_real_distribution<> gen(0.0, 1.0);
+    return gen(*rand_gen) < alpha;
+  });
+}
+
+template <typename SkipMerge>
+EncodeResult Model::MergeWithAgenda(absl::string_view normalized,
+                                    SkipMerge skip_merge) const {
   struct SymbolPair {
     int left;     // left index of this pair
     int right;    // right index of this pair
     float score;  // score of this pair. large is better.
     size_t size;  // length of this piece
+    int id;       // id of this piece
   };
 
   class SymbolPairComparator {
    public:
-    const bool operator()(SymbolPair *h1, SymbolPair *h2) {
-      return (h1->score < h2->score ||
-              (h1->score == h2->score && h1->left > h2->left));
+    const bool operator()(const SymbolPair &h1, const SymbolPair &h2) {
+      return (h1.score < h2.score ||
+              (h1.score == h2.score && h1.left > h2.left));
     }
   };
 
@@ -60,50 +351,38 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     int prev;     // prev index of this symbol. -1 for BOS.
     int next;     // next index of tihs symbol. -1 for EOS.
     bool freeze;  // this symbol is never be merged.
+    int id;       // id in `pieces_`, or -1 if the symbol is not a piece.
     absl::string_view piece;
   };
 
-  using Agenda = std::priority_queue<SymbolPair *, std::vector<SymbolPair *>,
-                                     SymbolPairComparator>;
-  Agenda agenda;
-  std::vector<Symbol> symbols;
+  // The buffers are given back to the arena of the thread on return.
+  model::Arena &arena = GetThreadLocalArena();
+  const model::ArenaScope arena_scope(&arena);
+  using AgendaBuffer =
+      std::vector<SymbolPair, model::ArenaAllocator<SymbolPair>>;
+  using Agenda =
+      std::priority_queue<SymbolPair, AgendaBuffer, SymbolPairComparator>;
+  AgendaBuffer agenda_buffer{model::ArenaAllocator<SymbolPair>(&arena)};
+  agenda_buffer.reserve(normalized.size());
+  Agenda agenda(SymbolPairComparator(), std::move(agenda_buffer));
+  std::vector<Symbol, model::ArenaAllocator<Symbol>> symbols{
+      model::ArenaAllocator<Symbol>(&arena)};
   symbols.reserve(normalized.size());
 
-  // Reverse merge rules.
-  // key: merged symbol, value: pair of original symbols.
-  absl::flat_hash_map<absl::string_view,
-                      std::pair<absl::string_view, absl::string_view>>
-      rev_merge;
-
-  // Pre-allocates SymbolPair for efficiency.
-  constexpr size_t kPreallocateSymbolPairSize = 256;
-  model::FreeList<SymbolPair> symbol_pair_allocator(kPreallocateSymbolPairSize);
-
   // Lookup new symbol pair at [left, right] and inserts it to agenda.
-  auto MaybeAddNewSymbolPair = [this, &symbol_pair_allocator, &symbols, &agenda,
-                                &rev_merge](int left, int right) {
+  auto MaybeAddNewSymbolPair = [this, &symbols, &agenda](int left,
+                                                         int right) {
     if (left == -1 || right == -1 || symbols[left].freeze ||
         symbols[right].freeze)
       return;
     const absl::string_view piece(
         symbols[left].piece.data(),
         symbols[left].piece.size() + symbols[right].piece.size());
-    const auto it = pieces_.find(piece);
-    if (it == pieces_.end()) {
-      return;
-    }
-    auto *h = symbol_pair_allocator.Allocate();
-    h->left = left;
-    h->right = right;
-    h->score = GetScore(it->second);
-    h->size = piece.size();
-    agenda.push(h);
-
-    // Makes `rev_merge` for resegmentation.
-    if (IsUnusedInlined(it->second)) {
-      rev_merge[piece] =
-          std::make_pair(symbols[left].piece, symbols[right].piece);
-    }
+    float score = 0.0;
+    const int id =
+        FindMergedPiece(piece, symbols[left].id, symbols[right].id, &score);
+    if (id == -1) return;
+    agenda.push({left, right, score, piece.size(), id});
   };
 
   // Splits the input into character sequence
@@ -112,6 +391,7 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     Symbol s;
     const int mblen = matcher_->PrefixMatch(normalized, &s.freeze);
     s.piece = absl::string_view(normalized.data(), mblen);
+    s.id = FindSymbolPiece(s.piece);
     s.prev = index == 0 ? -1 : index - 1;
     normalized.remove_prefix(mblen);
     s.next = normalized.empty() ? -1 : index + 1;
@@ -128,25 +408,17 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     MaybeAddNewSymbolPair(i - 1, i);
   }
 
-  // BPE-dropout: https://arxiv.org/pdf/1910.13267.pdf
-  std::mt19937 *rand_gen = nullptr;
-  auto skip_merge = [&]() {
-    if (alpha <= 0.0) return false;
-    if (alpha >= 1.0) return true;
-    if (rand_gen == nullptr) rand_gen = random::GetRandomGenerator();
-    std::uniform_real_distribution<> gen(0.0, 1.0);
-    return gen(*rand_gen) < alpha;
-  };
-
   // Main loop.
+  CancellationCheck cancellation;
   while (!agenda.empty()) {
-    SymbolPair *top = agenda.top();
+    if (cancellation.Cancelled()) return {};
+    const SymbolPair top = agenda.top();
     agenda.pop();
 
     // `top` is no longer available.
-    if (symbols[top->left].piece.empty() || symbols[top->right].piece.empty() ||
-        symbols[top->left].piece.size() + symbols[top->right].piece.size() !=
-            top->size) {
+    if (symbols[top.left].piece.empty() || symbols[top.right].piece.empty() ||
+        symbols[top.left].piece.size() + symbols[top.right].piece.size() !=
+            top.size) {
       continue;
     }
 
@@ -156,46 +428,32 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     if (skip_merge()) continue;
 
     // Replaces symbols with `top` rule.
-    symbols[top->left].piece = absl::string_view(
-        symbols[top->left].piece.data(),
-        symbols[top->left].piece.size() + symbols[top->right].piece.size());
+    symbols[top.left].piece = absl::string_view(
+        symbols[top.left].piece.data(),
+        symbols[top.left].piece.size() + symbols[top.right].piece.size());
+    symbols[top.left].id = top.id;
 
     // Updates prev/next pointers.
-    symbols[top->left].next = symbols[top->right].next;
-    if (symbols[top->right].next >= 0) {
-      symbols[symbols[top->right].next].prev = top->left;
+    symbols[top.left].next = symbols[top.right].next;
+    if (symbols[top.right].next >= 0) {
+      symbols[symbols[top.right].next].prev = top.left;
     }
-    symbols[top->right].piece = absl::string_view("");
+    symbols[top.right].piece = absl::string_view("");
 
     // Adds new symbol pairs which are newly added after symbol replacement.
-    MaybeAddNewSymbolPair(symbols[top->left].prev, top->left);
-    MaybeAddNewSymbolPair(top->left, symbols[top->left].next);
+    MaybeAddNewSymbolPair(symbols[top.left].prev, top.left);
+    MaybeAddNewSymbolPair(top.left, symbols[top.left].next);
   }
 
-  std::function<void(absl::string_view, EncodeResult *)> resegment;
-  resegment = [this, &resegment, &rev_merge](absl::string_view w,
-                                             EncodeResult *output) -> void {
-    const int id = PieceToId(w);
-    if (id == -1 || !IsUnusedInlined(id)) {
-      output->emplace_back(w, id);
-      return;
-    }
-    const auto p = rev_merge.find(w);
-    if (p == rev_merge.end()) {
-      // This block will never be called, as `rev_merge` stores all the
-      // resegmentation info for unused id.
-      output->emplace_back(w, id);
-      return;
-    }
-    // Recursively resegment left and right symbols.
-    resegment(p->second.first, output);
-    resegment(p->second.second, output);
-  };
-
   EncodeResult output;
+  const auto *mask = ScopedVocabularyMask::current();
   for (int index = 0; index != -1; index = symbols[index].next) {
-    if (index >= 0 && index < static_cast<int>(symbols.size())) {
-      resegment(symbols[index].piece, &output);
+    const Symbol &symbol = symbols[index];
+    if (symbol.id >= 0 && !IsUnusedInlined(symbol.id, mask)) {
+      // The id of a piece is known without a lookup.
+      output.emplace_back(symbol.piece, symbol.id);
+    } else {
+      Resegment(symbol.piece, &output);
     }
   }
 
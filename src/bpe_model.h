@@ -15,6 +15,12 @@
 #ifndef BPE_MODEL_H_
 #define BPE_MODEL_H_
 
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include "model_interface.h"
 #include "sentencepiece_model.pb.h"
 
@@ -29,7 +35,9 @@ namespace bpe {
 // https://en.wikipedia.org/wiki/Byte_pair_encoding
 class Model : public ModelInterface {
  public:
-  explicit Model(const ModelProto &model_proto);
+  // Maps the piece ids from `compiled_model` if it is given.
+  explicit Model(const ModelProto &model_proto,
+                 std::shared_ptr<const CompiledModel> compiled_model = nullptr);
   ~Model() override;
 
   EncodeResult Encode(absl::string_view normalized) const override {
@@ -43,9 +51,124 @@ class Model : public ModelInterface {
   EncodeResult SampleEncode(absl::string_view normalized,
                             float alpha) const override;
 
+  // The same as above, but the dropout is decided by numbers drawn in blocks
+  // from a counter-based generator keyed by `seed`.
+  EncodeResult SampleEncodeWithSeed(absl::string_view normalized, float alpha,
+                                    uint64 seed) const override;
+
   bool IsSampleEncodeAvailable() const override { return true; }
 
+  bool IsSeededSampleEncodeAvailable() const override { return true; }
+
   bool IsNBestEncodeAvailable() const override { return false; }
+
+  void AddMemoryUsage(MemoryUsage *usage) const override;
+
+ private:
+  FRIEND_TEST(BPEModelTest, EncodeShortTest);
+  FRIEND_TEST(BPEModelTest, EncodeByWordsTest);
+
+  // A merge rule, i.e., a piece made of two other pieces.
+  struct Merge {
+    uint64 key = kEmptyMergeKey;  // (left id << 32) | right id.
+    int id = -1;                  // Id of the merged piece.
+    float score = 0.0;            // Score of the merged piece.
+  };
+
+  static constexpr uint64 kEmptyMergeKey = ~static_cast<uint64>(0);
+
+  // SampleEncode() without the word cache.
+  EncodeResult SampleEncodeUncached(absl::string_view normalized,
+                                    float alpha) const;
+
+  // SampleEncodeUncached() of any input, merging the best pairs from a
+  // priority queue.
+  EncodeResult SampleEncodeWithAgenda(absl::string_view normalized,
+                                      float alpha) const;
+
+  // Merges the best pairs from a priority queue, skipping a merge when
+  // `skip_merge()` returns true.
+  template <typename SkipMerge>
+  EncodeResult MergeWithAgenda(absl::string_view normalized,
+                               SkipMerge skip_merge) const;
+
+  // Symbol of EncodeShort() and BuildRevMerge().
+  struct LinearSymbol {
+    int prev;     // prev index of this symbol. -1 for BOS.
+    int next;     // next index of this symbol. -1 for EOS.
+    bool freeze;  // this symbol is never be merged.
+    int id;       // id in `pieces_`, or -1 if the symbol is not a piece.
+    absl::string_view piece;
+    int pair_id;       // The piece merging this symbol and the next, or -1.
+    float pair_score;  // Score of `pair_id`.
+  };
+
+  // Inputs up to this size in bytes are encoded by EncodeShort().
+  static constexpr size_t kMaxShortInputSize = 32;
+
+  // Encodes a short input without the dropout in a fixed-size array,
+  // finding the best pair by a linear scan instead of the agenda. The result
+  // is the same as SampleEncodeWithAgenda().
+  void EncodeShort(absl::string_view normalized, EncodeResult *output) const;
+
+  // Encodes `normalized` without the dropout word by word, the short words
+  // by EncodeShort(). The result is the same as SampleEncodeWithAgenda() if
+  // `pieces_within_words_`, as the merges never cross the words and the
+  // merges inside a word are made in the same order.
+  EncodeResult EncodeByWords(absl::string_view normalized) const;
+
+  // Splits `normalized` into the initial symbols. `symbols` must have room
+  // for normalized.size() symbols. Returns the number of symbols.
+  int SplitIntoSymbols(absl::string_view normalized,
+                       LinearSymbol *symbols) const;
+
+  // Merges the best pairs of `symbols[0, size)` until none is left. Stores
+  // the pieces of the last merge to `last_merge` if it is not null.
+  void MergeByLinearScan(
+      LinearSymbol *symbols, int size,
+      std::pair<absl::string_view, absl::string_view> *last_merge) const;
+
+  // Appends `w` to `output`, splitting the unused pieces by `rev_merge_`.
+  void Resegment(absl::string_view w, EncodeResult *output) const;
+
+  // Computes `rev_merge_` of all the pieces.
+  void BuildRevMerge() const;
+
+  // Returns the id of the initial symbol `symbol` in `pieces_`, or -1.
+  int FindSymbolPiece(absl::string_view symbol) const;
+
+  // Returns the id of `merged`, the concatenation of two symbols with the
+  // ids `left_id` and `right_id`, and stores its score to `score`. Returns -1
+  // if it is not a piece.
+  int FindMergedPiece(absl::string_view merged, int left_id, int right_id,
+                      float *score) const;
+
+  // Compiles `merges_` from every split of the pieces into two pieces.
+  void BuildMerges();
+
+  // Returns the merge of the pieces `left` and `right`, or nullptr.
+  const Merge *FindMerge(int left, int right) const;
+
+  // Open-addressing hash table of the merge rules with linear probing.
+  // Encoding compares the ids of the symbols instead of looking up their
+  // concatenations by string.
+  std::vector<Merge> merges_;
+  uint64 merges_mask_ = 0;
+
+  // Reverse merge rules, built the first time a piece is unused.
+  // key: id of the merged piece, value: the two symbols merged last.
+  mutable absl::flat_hash_map<int,
+                              std::pair<absl::string_view, absl::string_view>>
+      rev_merge_;
+  mutable std::once_flag rev_merge_once_;
+  // Set once `rev_merge_` is built, so that it can be measured.
+  mutable std::atomic<bool> rev_merge_built_{false};
+
+  // Whether no piece has an inner whitespace. See PiecesAreWithinWords().
+  bool pieces_within_words_ = false;
+
+  // Ids of the single-byte pieces, or -1.
+  std::array<int, 256> single_byte_piece_ids_{};
 };
 }  // namespace bpe
 }  // namespace sentencepiece
@@ -13,6 +13,7 @@
 // limitations under the License.!
 
 #include <cstdio>
+#include <set>
 #include <string>
 
 #include "bpe_model.h"
@@ -249,6 +250,21 @@ TEST(BPEModelTest, EncodeWithUnusedTest) {
   }
 }
 
+TEST(BPEModelTest, EncodeWithPartsOutOfVocabularyTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+
+  AddPiece(&model_proto, "xyz", 0.0);  // 3
+  AddPiece(&model_proto, "xy", -0.1);  // 4
+  AddPiece(&model_proto, "y", -0.2);   // 5
+  AddPiece(&model_proto, "z", -0.3);   // 6
+
+  // "x" is not a piece, so "xy" is not a merge rule of two pieces.
+  const Model model(model_proto);
+  EXPECT_EQ(EncodeResult({{"xyz", 3}}), model.Encode("xyz"));
+  EXPECT_EQ(EncodeResult({{"xy", 4}, {"y", 5}}), model.Encode("xyy"));
+  EXPECT_EQ(EncodeResult({{"x", 0}, {"z", 6}}), model.Encode("xz"));
+}
+
 TEST(SampleModelTest, EncodeTest) {
   ModelProto model_proto = MakeBaseModelProto();
 
@@ -295,5 +311,125 @@ TEST(SampleModelTest, EncodeTest) {
 }
 
 }  // namespace
+
+TEST(BPEModelTest, SampleEncodeWithSeedTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+
+  AddPiece(&model_proto, "ab", 0.0);     // 3
+  AddPiece(&model_proto, "cd", -0.1);    // 4
+  AddPiece(&model_proto, "abc", -0.2);   // 5
+  AddPiece(&model_proto, "abcd", -0.3);  // 6
+  AddPiece(&model_proto, "a", 0.0);      // 7
+  AddPiece(&model_proto, "b", 0.0);      // 8
+  AddPiece(&model_proto, "c", 0.0);      // 9
+  AddPiece(&model_proto, "d", 0.0);      // 10
+
+  const Model model(model_proto);
+  EXPECT_TRUE(model.IsSeededSampleEncodeAvailable());
+
+  const std::string input = "abcdabcdabcd";
+  EXPECT_EQ(model.Encode(input), model.SampleEncodeWithSeed(input, 0.0, 1));
+  EXPECT_EQ(model.SampleEncode(input, 1.0),
+            model.SampleEncodeWithSeed(input, 1.0, 1));
+
+  std::set<EncodeResult> results;
+  int num_merged = 0;
+  constexpr int kTrial = 10000;
+  for (int seed = 0; seed < kTrial; ++seed) {
+    const auto result = model.SampleEncodeWithSeed(input, 0.5, seed);
+    EXPECT_EQ(result, model.SampleEncodeWithSeed(input, 0.5, seed));
+    results.insert(result);
+    // "ab" is the first merge, and drops out with the probability 0.5.
+    if (model.SampleEncodeWithSeed("ab", 0.5, seed).size() == 1) ++num_merged;
+  }
+  EXPECT_GT(results.size(), 1);
+  EXPECT_NEAR(0.5, static_cast<double>(num_merged) / kTrial, 0.05);
+}
+
+TEST(BPEModelTest, EncodeShortTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+  const std::vector<std::string> kPieces = {
+      "a", "b", "c", "ab", "bc", "abc", "ca", "あ", "あい", "い", "cab", "bb",
+      "bab", "cc", "ccc", "abab", "ab" "あ", "UD"};
+  for (size_t i = 0; i < kPieces.size(); ++i) {
+    // Repeated scores make ties.
+    AddPiece(&model_proto, kPieces[i], -0.5 * (i % 4));
+  }
+  model_proto.mutable_pieces(model_proto.pieces_size() - 1)
+      ->set_type(ModelProto::SentencePiece::USER_DEFINED);
+
+  const std::vector<std::string> kChars = {"a", "b", "c", "x", "あ", "い",
+                                           "UD"};
+  Model model(model_proto);
+  for (const bool with_unused : {false, true}) {
+    if (with_unused) {
+      // "bc" and "abc" are unused.
+      model_proto.mutable_pieces(7)->set_type(
+          ModelProto::SentencePiece::UNUSED);
+      model_proto.mutable_pieces(8)->set_type(
+          ModelProto::SentencePiece::UNUSED);
+      model.OnPieceTypesChanged();
+      const EncodeResult expected = {{"a", 3}, {"b", 4}, {"c", 5}};
+      EXPECT_EQ(expected, model.Encode("abc"));
+    }
+    for (int trial = 0; trial < 3000; ++trial) {
+      std::string input;
+      while (true) {
+        const std::string &c = kChars[rand() % kChars.size()];
+        if (input.size() + c.size() > Model::kMaxShortInputSize) break;
+        input += c;
+        if (rand() % 16 == 0) break;
+      }
+      EncodeResult result;
+      model.EncodeShort(input, &result);
+      EXPECT_EQ(model.SampleEncodeWithAgenda(input, 0.0), result);
+      EXPECT_EQ(result, model.Encode(input));
+    }
+  }
+}
+
+TEST(BPEModelTest, EncodeByWordsTest) {
+  for (const bool treat_ws_as_suffix : {false, true}) {
+    ModelProto model_proto = MakeBaseModelProto();
+    model_proto.mutable_trainer_spec()->set_treat_whitespace_as_suffix(
+        treat_ws_as_suffix);
+    const std::vector<std::string> kPieces = {
+        "a", "b", "c", "ab", "bc", "abc", "ca", "bab", "cc", "\xe2\x96\x81"};
+    for (size_t i = 0; i < kPieces.size(); ++i) {
+      AddPiece(&model_proto, kPieces[i], -0.5 * (i % 4));
+    }
+    for (const std::string piece : {"ab", "abc", "c", "cab"}) {
+      AddPiece(&model_proto,
+               treat_ws_as_suffix ? piece + "\xe2\x96\x81"
+                                  : "\xe2\x96\x81" + piece,
+               -0.5);
+    }
+    Model model(model_proto);
+    EXPECT_TRUE(model.pieces_within_words_);
+
+    // Long inputs of short and long words.
+    const std::vector<std::string> kChars = {"a", "b", "c", "x",
+                                             "\xe2\x96\x81"};
+    for (int trial = 0; trial < 1000; ++trial) {
+      std::string input;
+      const size_t size = Model::kMaxShortInputSize + rand() % 200;
+      while (input.size() < size) input += kChars[rand() % kChars.size()];
+      EXPECT_EQ(model.SampleEncodeWithAgenda(input, 0.0),
+                model.EncodeByWords(input));
+      EXPECT_EQ(model.SampleEncodeWithAgenda(input, 0.0), model.Encode(input));
+    }
+  }
+
+  // A piece with an inner whitespace crosses the words.
+  ModelProto model_proto = MakeBaseModelProto();
+  AddPiece(&model_proto, "a");
+  AddPiece(&model_proto, "\xe2\x96\x81");
+  AddPiece(&model_proto, "a\xe2\x96\x81" "a");
+  Model model(model_proto);
+  EXPECT_FALSE(model.pieces_within_words_);
+  const std::string input = std::string(40, 'a') + "\xe2\x96\x81" "a";
+  EXPECT_EQ(model.SampleEncodeWithAgenda(input, 0.0), model.Encode(input));
+}
+
 }  // namespace bpe
 }  // namespace sentencepiece
@@ -15,23 +15,210 @@
 #include "bpe_model_trainer.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
+#include "memory_usage.h"
 #include "pretokenizer_for_training.h"
 #include "third_party/absl/container/flat_hash_set.h"
+#include "third_party/absl/strings/str_cat.h"
 #include "third_party/absl/strings/str_join.h"
 #include "third_party/absl/strings/str_replace.h"
 #include "util.h"
 
 namespace sentencepiece {
 namespace bpe {
+namespace {
+
+// Maximum number of the positions merged at once, which bounds the memory
+// of the deltas.
+constexpr size_t kMergeChunkSize = 1 << 16;
+
+// Minimum number of the positions merged in parallel.
+constexpr size_t kMinParallelMergeSize = 4096;
+
+// A position list is compacted when it has more stale entries than valid
+// ones, or a quarter of stale entries over max_memory_mb, and at least this
+// many entries.
+constexpr size_t kMinCompactSize = 64;
+
+// Number of the pieces added between two measures of the memory against
+// max_memory_mb.
+constexpr size_t kMemoryCheckPieces = 100;
+
+// Number of the characters of the sentences sampled for the approximate
+// merges.
+constexpr size_t kApproximateSampleSize = 1 << 24;
+
+// Maximum number of the pairs merged in bulk at once by the approximate
+// merges.
+constexpr size_t kMaxApproximateBulkSize = 64;
+
+// Number of the standard deviations of the sampling error in the margin of
+// an approximate merge.
+constexpr double kApproximateConfidence = 3.0;
+
+// Count-min sketch of weighted frequencies. Estimate() never underestimates
+// a frequency, and overestimates it by at most e / kWidth of the total
+// weight with a probability of 1 - exp(-kDepth).
+class CountMinSketch {
+ public:
+  static constexpr int kDepth = 4;
+  static constexpr int kWidthBits = 16;
+  static constexpr size_t kWidth = size_t{1} << kWidthBits;
+
+  CountMinSketch() : counts_(kDepth * kWidth, 0) {}
+
+  void Clear() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+  }
+
+  void Add(uint64_t key, uint64_t weight) {
+    for (int row = 0; row < kDepth; ++row) {
+      counts_[row * kWidth + Column(key, row)] += weight;
+    }
+    total_ += weight;
+  }
+
+  uint64_t Estimate(uint64_t key) const {
+    uint64_t result = counts_[Column(key, 0)];
+    for (int row = 1; row < kDepth; ++row) {
+      result = std::min(result, counts_[row * kWidth + Column(key, row)]);
+    }
+    return result;
+  }
+
+  // Adds the frequencies of |other|.
+  void Merge(const CountMinSketch &other) {
+    for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+    total_ += other.total_;
+  }
+
+  // Returns the bound of the overestimates.
+  uint64_t error() const {
+    return static_cast<uint64_t>(std::ceil(std::exp(1.0) * total_ / kWidth));
+  }
+
+ private:
+  // Multiplicative hash of |key|, which is already a fingerprint, for |row|.
+  static size_t Column(uint64_t key, int row) {
+    static constexpr uint64_t kMultipliers[kDepth] = {
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL,
+        0xd6e8feb86659fd93ULL};
+    return (key * kMultipliers[row]) >> (64 - kWidthBits);
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+};
+
+// Returns the first index at or after |index| which begins a sentence in
+// |positions|, or positions.size().
+size_t GetSentenceBoundary(const std::vector<uint64_t> &positions,
+                           size_t index) {
+  while (index > 0 && index < positions.size() &&
+         (positions[index] >> 32) == (positions[index - 1] >> 32)) {
+    ++index;
+  }
+  return index;
+}
+
+}  // namespace
+
+void Trainer::PositionList::Add(uint64_t pos) {
+  // Each entry is a pair of varints: the delta of sid and the left index
+  // from the previous entry if sid changes, or 0 and the delta of the left
+  // index otherwise. (0, 0) begins a new run with the absolute sid and the
+  // left index.
+  const uint64_t sid = pos >> 32, left = pos & 0xffffffff;
+  const uint64_t last_sid = last_ >> 32, last_left = last_ & 0xffffffff;
+  if (pos > last_) {
+    sentence_record::AppendVarint(sid - last_sid, &data_);
+    sentence_record::AppendVarint(sid > last_sid ? left : left - last_left,
+                                  &data_);
+  } else {
+    sentence_record::AppendVarint(0, &data_);
+    sentence_record::AppendVarint(0, &data_);
+    sentence_record::AppendVarint(sid, &data_);
+    sentence_record::AppendVarint(left, &data_);
+  }
+  last_ = pos;
+  ++size_;
+}
+
+std::vector<uint64_t> Trainer::PositionList::ToVector() const {
+  std::vector<uint64_t> result;
+  result.reserve(size_);
+  absl::string_view input(data_);
+  uint64_t sid = 0, left = 0;
+  while (!input.empty()) {
+    uint64_t v1 = 0, v2 = 0;
+    CHECK(sentence_record::ConsumeVarint(&input, &v1) &&
+          sentence_record::ConsumeVarint(&input, &v2));
+    if (v1 == 0 && v2 == 0) {
+      CHECK(sentence_record::ConsumeVarint(&input, &sid) &&
+            sentence_record::ConsumeVarint(&input, &left));
+    } else if (v1 > 0) {
+      sid += v1;
+      left = v2;
+    } else {
+      left += v2;
+    }
+    result.push_back((sid << 32) | left);
+  }
+  return result;
+}
+
+void Trainer::PositionList::Clear() {
+  std::string().swap(data_);
+  last_ = 0;
+  size_ = 0;
+}
+
+size_t Trainer::PositionList::GetMemoryUsage() const {
+  return memory_usage::String(data_);
+}
+
+char32 Trainer::Symbol::CharAt(uint32_t index) const {
+  const Symbol *symbol = this;
+  while (symbol->IsBigram()) {
+    if (index < symbol->left->size) {
+      symbol = symbol->left;
+    } else {
+      index -= symbol->left->size;
+      symbol = symbol->right;
+    }
+  }
+  return symbol->c;
+}
+
+void Trainer::Symbol::AppendChars(string_util::UnicodeText *chars) const {
+  if (IsBigram()) {
+    left->AppendChars(chars);
+    right->AppendChars(chars);
+  } else {
+    chars->push_back(c);
+  }
+}
 
 std::string Trainer::Symbol::ToString() const {
+  string_util::UnicodeText chars;
+  chars.reserve(size);
+  AppendChars(&chars);
   return string_util::UnicodeTextToUTF8(chars);
 }
 
+Trainer::Symbol *Trainer::NewSymbol() {
+  Symbol *s = allocated_.Allocate();
+  s->id = positions_.size();
+  positions_.emplace_back();
+  return s;
+}
+
 Trainer::Symbol *Trainer::GetCharSymbol(char32 c) {
   const uint64 freq = port::FindWithDefault(required_chars_, c, 1);
   CHECK_GT(freq, 0);
@@ -39,12 +226,13 @@ Trainer::Symbol *Trainer::GetCharSymbol(char32 c) {
   if (it != symbols_cache_.end()) {
     return it->second;
   }
-  Symbol *s = new Symbol;
-  allocated_.push_back(s);
+  Symbol *s = NewSymbol();
   s->is_unk = (kUNKChar == c);
   s->fp = c;
-  s->chars.push_back(c);
+  s->c = c;
+  s->size = 1;
   s->freq = freq;
+  s->summary = GetCharSummary(c);
   port::InsertOrDie(&symbols_cache_, s->fp, s);
   return s;
 }
@@ -61,106 +249,375 @@ Trainer::Symbol *Trainer::GetPairSymbol(const Symbol *left,
     return it->second;
   }
 
-  CHECK(!left->chars.empty());
-  CHECK(!right->chars.empty());
-  string_util::UnicodeText ut;
-  for (const char32 c : left->chars) ut.push_back(c);
-  for (const char32 c : right->chars) ut.push_back(c);
-
   // Do not make an invalid piece.
-  if (!IsValidSentencePiece(ut)) {
+  const PieceSummary summary =
+      MergePieceSummaries(left->summary, right->summary);
+  if (!IsValidPieceSummary(summary)) {
     return nullptr;
   }
 
-  Symbol *s = new Symbol;
-  allocated_.push_back(s);
+  Symbol *s = NewSymbol();
   s->fp = fp;
   s->left = left;
   s->right = right;
-  s->chars = ut;
+  s->size = summary.size;
+  s->summary = summary;
   port::InsertOrDie(&symbols_cache_, s->fp, s);
   return s;
 }
 
-void Trainer::ComputeFreq(Symbol *symbol) const {
-  if (symbol->freq > 0) {  // if freq == 0, re-computation is required.
-    return;
+Trainer::Symbol *Trainer::FindPairSymbol(const Symbol *left,
+                                         const Symbol *right) const {
+  if (left == nullptr || right == nullptr || left->is_unk || right->is_unk) {
+    return nullptr;
   }
-  CHECK_EQ(0, symbol->freq);
-  for (auto it = symbol->positions.begin(); it != symbol->positions.end();) {
-    const Position pos = DecodePos(*it);
-    // symbols_[sid][left] and symbols_[sid]right] must store
-    // the same symbols in symbol->left and symbols->right.
-    if (symbol->left != symbols_[pos.sid][pos.left] ||
-        symbol->right != symbols_[pos.sid][pos.right]) {
-      it = symbol->positions.erase(it);
-    } else {
-      symbol->freq += sentences_[pos.sid].second;
-      ++it;
+  const auto it =
+      symbols_cache_.find(port::FingerprintCat(left->fp, right->fp));
+  return it == symbols_cache_.end() ? nullptr : it->second;
+}
+
+void Trainer::AddPairDelta(int sid, int left, int right, bool add,
+                           std::vector<PairDelta> *deltas) const {
+  if (left == -1 || right == -1) return;
+  const Symbol *l = symbol_at(sid, left);
+  const Symbol *r = symbol_at(sid, right);
+  deltas->push_back(
+      PairDelta{FindPairSymbol(l, r), l, r, EncodePos(sid, left), add});
+}
+
+void Trainer::MergePositions(Symbol *best, const uint64_t *begin,
+                             const uint64_t *end,
+                             std::vector<PairDelta> *deltas) {
+  // Only the sentences of these positions are modified, so that the
+  // threads merge disjoint ranges of sentences in parallel.
+  for (const uint64_t *it = begin; it != end; ++it) {
+    if (!IsValidPosition(best, *it)) {
+      // The left or right symbol might be merged in this iteration
+      // when left_symbol == right_symbol.
+      continue;
     }
+    const Position pos = DecodePos(*it);
+
+    // We have three bigrams [prev, left], [left, right], [right, next],
+    // which are affected with this symbol replacement.
+    const int right = link_at(pos.sid, pos.left).next;
+    const int prev = link_at(pos.sid, pos.left).prev;
+    const int next = link_at(pos.sid, right).next;
+
+    // Uncounts bigrams [prev, left] and [right, next].
+    AddPairDelta(pos.sid, prev, pos.left, false, deltas);
+    AddPairDelta(pos.sid, right, next, false, deltas);
+
+    // Merges two symbols.
+    symbol_at(pos.sid, pos.left) = best;
+    symbol_at(pos.sid, right) = nullptr;
+    link_at(pos.sid, pos.left).next = next;
+    if (next != -1) link_at(pos.sid, next).prev = pos.left;
+
+    // Makes new symbol bigrams [prev, left] and [left, next].
+    AddPairDelta(pos.sid, prev, pos.left, true, deltas);
+    AddPairDelta(pos.sid, pos.left, next, true, deltas);
   }
 }
 
-int Trainer::GetNextIndex(int sid, int index) const {
-  for (size_t i = index + 1; i < symbols_[sid].size(); ++i) {
-    if (symbols_[sid][i] == nullptr) continue;
-    return i;
-  }
-  return -1;
+bool Trainer::IsValidPosition(const Symbol *symbol, uint64_t pos) const {
+  // Once a bigram is broken by a merge, its left symbol is replaced, so the
+  // same position never holds the bigram again.
+  const Position p = DecodePos(pos);
+  if (symbol_at(p.sid, p.left) != symbol->left) return false;
+  const int right = link_at(p.sid, p.left).next;
+  return right != -1 && symbol_at(p.sid, right) == symbol->right;
 }
 
-int Trainer::GetPrevIndex(int sid, int index) const {
-  for (int i = index - 1; i >= 0; --i) {
-    if (symbols_[sid][i] == nullptr) continue;
-    return i;
-  }
-  return -1;
+std::vector<uint64_t> Trainer::GetValidPositions(const Symbol *symbol) const {
+  std::vector<uint64_t> positions = positions_[symbol->id].ToVector();
+  positions.erase(std::remove_if(positions.begin(), positions.end(),
+                                 [&](uint64_t pos) {
+                                   return !IsValidPosition(symbol, pos);
+                                 }),
+                  positions.end());
+  std::sort(positions.begin(), positions.end());
+  return positions;
 }
 
-void Trainer::AddNewPair(int sid, int left, int right) {
-  if (left == -1 || right == -1) return;
-  auto *symbol = GetPairSymbol(symbols_[sid][left], symbols_[sid][right]);
-  if (symbol != nullptr) {
-    active_symbols_.insert(symbol);
-    symbol->positions.insert(EncodePos(sid, left, right));
+void Trainer::CompactPositions(Symbol *symbol) {
+  const std::vector<uint64_t> positions = GetValidPositions(symbol);
+  positions_[symbol->id].Clear();
+  for (const uint64_t pos : positions) positions_[symbol->id].Add(pos);
+}
+
+void Trainer::CompactAllPositions() {
+  std::vector<Symbol *> bigrams;
+  for (const auto &it : symbols_cache_) {
+    if (it.second->IsBigram() &&
+        positions_[it.second->id].size() > it.second->num_positions) {
+      bigrams.push_back(it.second);
+    }
   }
+  // Every list is compacted by one thread.
+  GetThreadPool()->ParallelFor(bigrams.size(), 1,
+                               [&](int, size_t begin, size_t end) {
+                                 for (size_t i = begin; i < end; ++i) {
+                                   CompactPositions(bigrams[i]);
+                                 }
+                               });
 }
 
-void Trainer::ResetFreq(int sid, int left, int right, const Symbol *best) {
-  if (left == -1 || right == -1) return;
-  auto *symbol = GetPairSymbol(symbols_[sid][left], symbols_[sid][right]);
-  if (symbol != nullptr && symbol != best) {
-    symbol->freq = 0;
+void Trainer::ApplyPairDeltas(int shard, int num_shards, const Symbol *best,
+                              std::vector<Symbol *> *changed) {
+  // The deltas of a bigram are counted by one shard in the order of the
+  // positions, as the serial merges would.
+  for (const auto &deltas : deltas_) {
+    for (const auto &delta : deltas) {
+      Symbol *symbol = delta.symbol;
+      if (symbol == nullptr || symbol == best ||
+          symbol->fp % num_shards != static_cast<uint64_t>(shard)) {
+        continue;
+      }
+      const int64 freq = freqs_[DecodePos(delta.pos).sid];
+      if (delta.add) {
+        positions_[symbol->id].Add(delta.pos);
+        ++symbol->num_positions;
+        symbol->freq += freq;
+      } else {
+        // The entry is left stale.
+        CHECK_GT(symbol->num_positions, 0);
+        CHECK_GE(symbol->freq, freq);
+        --symbol->num_positions;
+        symbol->freq -= freq;
+        const size_t max_size =
+            eager_compaction_
+                ? symbol->num_positions + symbol->num_positions / 4
+                : 2 * symbol->num_positions;
+        if (positions_[symbol->id].size() >=
+            std::max(kMinCompactSize, max_size)) {
+          CompactPositions(symbol);
+        }
+      }
+      if (changed != nullptr) changed->push_back(symbol);
+    }
   }
 }
 
-void Trainer::UpdateActiveSymbols() {
-  std::vector<Symbol *> symbols;
-  for (auto &it : symbols_cache_) {
-    Symbol *symbol = it.second;
-    if (symbol->IsBigram()) {
-      ComputeFreq(symbol);
-      symbols.push_back(symbol);
+void Trainer::CountPairDeltas(int num_shards, const Symbol *best,
+                              std::vector<Symbol *> *changed) {
+  // Makes the new bigrams, which are not cached yet.
+  for (auto &deltas : deltas_) {
+    for (auto &delta : deltas) {
+      if (delta.symbol == nullptr) {
+        delta.symbol = GetPairSymbol(delta.left, delta.right);
+      }
     }
   }
 
-  // At least kMinActiveSymbolsSize symbols must be in |active_symbols_|.
-  constexpr int kMinActiveSymbolsSize = 1000;
+  if (num_shards == 1) {
+    ApplyPairDeltas(0, 1, best, changed);
+    return;
+  }
+  std::vector<std::vector<Symbol *>> changed_shards(num_shards);
+  GetThreadPool()->ParallelForShards(
+      num_shards, [&](int shard, size_t, size_t) {
+        ApplyPairDeltas(shard, num_shards, best,
+                        changed ? &changed_shards[shard] : nullptr);
+      });
+  if (changed == nullptr) return;
+  for (const auto &c : changed_shards) {
+    changed->insert(changed->end(), c.begin(), c.end());
+  }
+}
 
-  // Keeps top 5% frequent symbols.
-  constexpr float kTopFrequentRatio = 0.05;
-  const int size =
-      std::min<int>(std::max<int>(kMinActiveSymbolsSize,
-                                  symbols_cache_.size() * kTopFrequentRatio),
-                    symbols.size());
+void Trainer::PushSymbol(Symbol *symbol) {
+  // The bigrams which do not occur anymore are still pushed, so that they
+  // are selected after all the others.
+  if (!symbol->removed) {
+    queue_.push(QueueEntry{symbol->freq, symbol});
+  }
+}
 
-  std::partial_sort(symbols.begin(), symbols.begin() + size, symbols.end(),
-                    [](Symbol *s1, Symbol *s2) { return s1->freq > s2->freq; });
-  LOG(INFO) << "Updating active symbols. max_freq=" << symbols[0]->freq
-            << " min_freq=" << symbols[size - 1]->freq;
+util::Status Trainer::ApproximateMerges(
+    size_t max_pieces, absl::flat_hash_set<std::string> *dup) {
+  auto *pool = GetThreadPool();
+  const size_t num_sentences = offsets_.size() - 1;
+
+  // Samples every |stride|-th sentence. The sampling variance of an
+  // estimated frequency f is about f * |variance_scale|, taking the
+  // occurrences of a pair as clustered in the sentences as the characters.
+  const size_t stride = std::max<size_t>(
+      1, offsets_[num_sentences] / kApproximateSampleSize);
+  std::vector<int> sample;
+  double sum_weight = 0.0, sum_weight2 = 0.0;
+  for (size_t sid = 0; sid < num_sentences; sid += stride) {
+    sample.push_back(sid);
+    const double weight = static_cast<double>(freqs_[sid]) *
+                          (offsets_[sid + 1] - offsets_[sid]);
+    sum_weight += weight;
+    sum_weight2 += weight * weight;
+  }
+  const double variance_scale =
+      sum_weight > 0.0 ? (1.0 - 1.0 / stride) * sum_weight2 / sum_weight
+                       : 0.0;
+
+  // Calls fn(left, right) for the pairs of the symbols of sentence |sid|.
+  auto for_each_pair = [&](int sid, const auto &fn) {
+    if (offsets_[sid + 1] == offsets_[sid]) return;
+    for (int i = 0; link_at(sid, i).next != -1; i = link_at(sid, i).next) {
+      fn(symbol_at(sid, i), symbol_at(sid, link_at(sid, i).next));
+    }
+  };
+
+  // Returns true if the pair may be chosen.
+  auto is_candidate = [&](const Symbol *left, const Symbol *right) {
+    if (left->is_unk || right->is_unk ||
+        !IsValidPieceSummary(
+            MergePieceSummaries(left->summary, right->summary))) {
+      return false;
+    }
+    const Symbol *symbol = FindPairSymbol(left, right);
+    return symbol == nullptr || !symbol->removed;
+  };
+
+  struct Candidate {
+    uint64_t freq;  // estimated frequency in the sample.
+    uint64_t fp;
+    const Symbol *left;
+    const Symbol *right;
+  };
+  auto greater = [](const Candidate &c1, const Candidate &c2) {
+    if (c1.freq != c2.freq) return c1.freq > c2.freq;
+    return c1.fp < c2.fp;
+  };
+
+  // The best pairs of all the shards include the 2 * kMaxApproximateBulkSize
+  // best ones of the sample, so that the pair after a bulk is known.
+  const size_t max_candidates = 2 * kMaxApproximateBulkSize;
+  const int num_shards = pool->num_threads();
+  std::vector<CountMinSketch> sketches(num_shards);
+  std::vector<std::vector<Candidate>> shard_candidates(num_shards);
+  std::vector<Candidate> candidates;
+  absl::flat_hash_map<const Symbol *, Symbol *> bulk;
+  absl::flat_hash_set<const Symbol *> used;
+  while (final_pieces_.size() < max_pieces) {
+    // Counts the pairs of the sample in a sketch per shard, and sums them up.
+    pool->ParallelForShards(
+        sample.size(), [&](int shard, size_t begin, size_t end) {
+          CountMinSketch *sketch = &sketches[shard];
+          sketch->Clear();
+          for (size_t n = begin; n < end; ++n) {
+            const int sid = sample[n];
+            for_each_pair(sid, [&](const Symbol *left, const Symbol *right) {
+              sketch->Add(port::FingerprintCat(left->fp, right->fp),
+                          freqs_[sid]);
+            });
+          }
+        });
+    for (int shard = 1; shard < num_shards; ++shard) {
+      sketches[0].Merge(sketches[shard]);
+    }
+    const CountMinSketch &sketch = sketches[0];
+
+    // Keeps the best pairs of each shard in a min-heap.
+    pool->ParallelForShards(
+        sample.size(), [&](int shard, size_t begin, size_t end) {
+          auto *heap = &shard_candidates[shard];
+          heap->clear();
+          for (size_t n = begin; n < end; ++n) {
+            for_each_pair(sample[n], [&](const Symbol *left,
+                                         const Symbol *right) {
+              const uint64_t fp = port::FingerprintCat(left->fp, right->fp);
+              const uint64_t freq = sketch.Estimate(fp);
+              const Candidate candidate{freq, fp, left, right};
+              if (heap->size() == max_candidates &&
+                  !greater(candidate, heap->front())) {
+                return;
+              }
+              for (const auto &c : *heap) {
+                if (c.fp == fp) return;
+              }
+              if (!is_candidate(left, right)) return;
+              if (heap->size() == max_candidates) {
+                std::pop_heap(heap->begin(), heap->end(), greater);
+                heap->pop_back();
+              }
+              heap->push_back(candidate);
+              std::push_heap(heap->begin(), heap->end(), greater);
+            });
+          }
+        });
+    candidates.clear();
+    for (const auto &heap : shard_candidates) {
+      candidates.insert(candidates.end(), heap.begin(), heap.end());
+    }
+    std::sort(candidates.begin(), candidates.end(), greater);
+    candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                 [](const Candidate &c1, const Candidate &c2) {
+                                   return c1.fp == c2.fp;
+                                 }),
+                     candidates.end());
+
+    // Takes the best pairs while they are ahead of the next one beyond the
+    // error bound. A merge only changes the frequencies of the pairs
+    // sharing its symbols, and makes pairs less frequent than the ones of
+    // its symbols, so the pairs of a bulk must not share symbols.
+    bulk.clear();
+    used.clear();
+    bool decided = false;
+    for (size_t i = 0; i < candidates.size() && i < kMaxApproximateBulkSize &&
+                       final_pieces_.size() < max_pieces;
+         ++i) {
+      const Candidate &c = candidates[i];
+      if (used.count(c.left) || used.count(c.right)) break;
+      const uint64_t next =
+          i + 1 < candidates.size() ? candidates[i + 1].freq : 0;
+      const double bound =
+          sketch.error() +
+          kApproximateConfidence *
+              std::sqrt(static_cast<double>(c.freq + next) * variance_scale);
+      if (c.freq - next <= bound) break;
+      decided = true;
+
+      Symbol *symbol = GetPairSymbol(c.left, c.right);
+      CHECK_OR_RETURN(symbol != nullptr);
+      symbol->removed = true;
+      if (!dup->insert(symbol->ToString()).second) continue;
+      final_pieces_.emplace_back(symbol->ToString(),
+                                 -static_cast<float>(final_pieces_.size()));
+      bulk.emplace(c.left, symbol);
+      used.insert(c.left);
+      used.insert(c.right);
+    }
+    if (!decided) break;
+
+    // Merges the pairs of the bulk in all the sentences.
+    pool->ParallelFor(
+        num_sentences, kSentenceGrainSize, [&](int, size_t begin, size_t end) {
+          for (size_t sid = begin; sid < end; ++sid) {
+            if (offsets_[sid + 1] == offsets_[sid]) continue;
+            for (int i = 0; link_at(sid, i).next != -1;) {
+              const int right = link_at(sid, i).next;
+              const auto it = bulk.find(symbol_at(sid, i));
+              if (it == bulk.end() ||
+                  it->second->right != symbol_at(sid, right)) {
+                i = right;
+                continue;
+              }
+              const int next = link_at(sid, right).next;
+              symbol_at(sid, i) = it->second;
+              symbol_at(sid, right) = nullptr;
+              link_at(sid, i).next = next;
+              if (next == -1) break;
+              link_at(sid, next).prev = i;
+              i = next;
+            }
+          }
+        });
+    LOG(INFO) << "Approximately added: bulk=" << bulk.size()
+              << " size=" << final_pieces_.size()
+              << " piece=" << final_pieces_.back().first;
+  }
 
-  active_symbols_.clear();
-  active_symbols_.insert(symbols.begin(), symbols.begin() + size);
+  LOG(INFO) << "Counting the pairs exactly after " << final_pieces_.size()
+            << " pieces";
+  return util::OkStatus();
 }
 
 util::Status Trainer::Train() {
@@ -170,15 +627,19 @@ util::Status Trainer::Train() {
   CHECK_EQ_OR_RETURN(TrainerSpec::BPE, trainer_spec_.model_type());
 
   symbols_.clear();
-  allocated_.clear();
+  links_.clear();
+  offsets_.clear();
+  freqs_.clear();
+  allocated_.Free();
+  positions_.clear();
   symbols_cache_.clear();
-  active_symbols_.clear();
+  queue_ = decltype(queue_)();
 
   // Load all sentences
   RETURN_IF_ERROR(LoadSentences());
 
   if (trainer_spec_.split_by_whitespace()) {
-    SplitSentencesByWhitespace();
+    RETURN_IF_ERROR(SplitSentencesByWhitespace());
   }
 
   // Pretokenizer applied only in training time.
@@ -188,30 +649,106 @@ util::Status Trainer::Train() {
   if (pretokenizer || !trainer_spec_.pretokenization_delimiter().empty()) {
     absl::string_view delimiter = trainer_spec_.pretokenization_delimiter();
     LOG(INFO) << "Preprocessing with pretokenizer...";
-    for (auto &w : sentences_) {
+    ScopedPhase phase(this, "pretokenize");
+    // The pretokenizer runs over windows of the sentences in parallel.
+    std::vector<size_t> indices;
+    std::vector<Sentence> window;
+    std::vector<std::vector<std::string>> tokens;
+    auto flush = [&]() -> util::Status {
       if (pretokenizer) {
-        w.first = absl::StrJoin(pretokenizer->PreTokenize(w.first),
-                                TrainerInterface::kUPPBoundaryStr);
-      } else if (!delimiter.empty()) {
-        w.first = absl::StrReplaceAll(
-            w.first, {{delimiter, TrainerInterface::kUPPBoundaryStr}});
+        std::vector<absl::string_view> texts;
+        for (const auto &w : window) texts.push_back(w.first);
+        PreTokenizeSentences(*pretokenizer, texts, &tokens);
+      }
+      for (size_t i = 0; i < window.size(); ++i) {
+        auto &w = window[i];
+        if (pretokenizer) {
+          w.first =
+              absl::StrJoin(tokens[i], TrainerInterface::kUPPBoundaryStr);
+        } else if (!delimiter.empty()) {
+          w.first = absl::StrReplaceAll(
+              w.first, {{delimiter, TrainerInterface::kUPPBoundaryStr}});
+        }
+        RETURN_IF_ERROR(sentences_->Set(indices[i], std::move(w)));
       }
+      indices.clear();
+      window.clear();
+      return util::OkStatus();
+    };
+    auto cursor = sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      indices.push_back(cursor->index());
+      window.push_back(cursor->value());
+      if (window.size() >= kPreTokenizeWindowSize) RETURN_IF_ERROR(flush());
     }
+    RETURN_IF_ERROR(cursor->status());
+    RETURN_IF_ERROR(flush());
   }
 
-  // Initializes symbols_. symbols_[sid][i] stores an unary symbol.
-  symbols_.resize(sentences_.size());
-  for (size_t i = 0; i < sentences_.size(); ++i) {
-    for (const char32 c : string_util::UTF8ToUnicodeText(sentences_[i].first)) {
-      symbols_[i].push_back(GetCharSymbol(c));
+  // Makes the unary (character) symbols in advance, so that the threads
+  // only look them up.
+  ScopedPhase init_phase(this, "init_symbols");
+  auto *pool = GetThreadPool();
+  for (const auto &w : required_chars_) GetCharSymbol(w.first);
+  GetCharSymbol(kUNKChar);
+  GetCharSymbol(kUPPBoundaryChar);
+
+  // Initializes symbols_. symbol_at(sid, i) stores an unary symbol.
+  // The first pass counts the characters of the sentences, and the second
+  // one fills their symbols.
+  const size_t num_sentences = sentences_->size();
+  offsets_.assign(num_sentences + 1, 0);
+  freqs_.resize(num_sentences);
+  std::vector<util::Status> status(pool->num_threads());
+  auto for_each_sentence = [&](const std::function<void(
+                                   size_t sid, const Sentence &w)> &fn) {
+    pool->ParallelFor(num_sentences, kSentenceGrainSize,
+                      [&](int n, size_t begin, size_t end) {
+                        if (!status[n].ok()) return;
+                        auto cursor = sentences_->NewCursor(begin, end);
+                        for (; !cursor->done(); cursor->Next()) {
+                          fn(cursor->index(), cursor->value());
+                        }
+                        status[n] = cursor->status();
+                      });
+  };
+  for_each_sentence([&](size_t sid, const Sentence &w) {
+    const absl::string_view sentence = w.first;
+    freqs_[sid] = w.second;
+    size_t size = 0;
+    for (size_t i = 0; i < sentence.size();) {
+      size_t mblen = 0;
+      string_util::DecodeUTF8(sentence.data() + i,
+                              sentence.data() + sentence.size(), &mblen);
+      i += mblen;
+      ++size;
     }
+    offsets_[sid + 1] = size;
+  });
+  for (const auto &s : status) RETURN_IF_ERROR(s);
+  for (size_t sid = 0; sid < num_sentences; ++sid) {
+    offsets_[sid + 1] += offsets_[sid];
   }
 
-  // Makes all bigram symbols.
-  for (size_t sid = 0; sid < symbols_.size(); ++sid) {
-    for (size_t i = 1; i < symbols_[sid].size(); ++i) {
-      AddNewPair(sid, i - 1, i);
+  symbols_.resize(offsets_[num_sentences]);
+  links_.resize(offsets_[num_sentences]);
+  for_each_sentence([&](size_t sid, const Sentence &w) {
+    const int size = offsets_[sid + 1] - offsets_[sid];
+    const char *begin = w.first.data();
+    const char *end = w.first.data() + w.first.size();
+    for (int i = 0; i < size; ++i) {
+      size_t mblen = 0;
+      const char32 c = string_util::DecodeUTF8(begin, end, &mblen);
+      begin += mblen;
+      const auto it = symbols_cache_.find(c);
+      symbol_at(sid, i) = it == symbols_cache_.end() ? nullptr : it->second;
+      link_at(sid, i).prev = i - 1;
+      link_at(sid, i).next = i + 1 < size ? i + 1 : -1;
     }
+  });
+  for (const auto &s : status) RETURN_IF_ERROR(s);
+  for (size_t i = 0; i < symbols_.size(); ++i) {
+    CHECK_OR_RETURN(symbols_[i] != nullptr) << "Unknown character.";
   }
 
   const int vocab_size =
@@ -222,29 +759,80 @@ util::Status Trainer::Train() {
   // In real segmentation phase, we can consider them as one symbol.
   // e.g., "aaa" => "aa" + "a" or "a" + "aa".
   absl::flat_hash_set<std::string> dup;
+  CHECK_OR_RETURN(final_pieces_.empty());
+
+  init_phase.End();
+
+  // The first merges, which take the longest with the position lists, are
+  // chosen from the estimated frequencies.
+  if (trainer_spec_.approximate_bpe_merges() > 0) {
+    ScopedPhase approximate_phase(this, "approximate_merge");
+    RETURN_IF_ERROR(ApproximateMerges(
+        std::min(trainer_spec_.approximate_bpe_merges(), vocab_size), &dup));
+  }
+
+  // Makes all bigram symbols, in chunks of whole sentences.
+  ScopedPhase bigram_phase(this, "init_bigrams");
+  for (size_t begin = 0; begin < num_sentences;) {
+    const size_t end = std::max<size_t>(
+        begin + 1, std::upper_bound(offsets_.begin() + begin + 1,
+                                    offsets_.end(),
+                                    offsets_[begin] + kMergeChunkSize) -
+                       offsets_.begin() - 1);
+    const size_t chunk_size = offsets_[end] - offsets_[begin];
+    const int num_shards =
+        chunk_size >= kMinParallelMergeSize ? pool->num_threads() : 1;
+    deltas_.resize(num_shards);
+    for (auto &deltas : deltas_) deltas.clear();
+    auto add_pairs = [&](int shard, size_t b, size_t e) {
+      for (size_t sid = begin + b; sid < begin + e; ++sid) {
+        if (offsets_[sid + 1] == offsets_[sid]) continue;
+        for (int i = 0; i != -1; i = link_at(sid, i).next) {
+          AddPairDelta(sid, i, link_at(sid, i).next, true, &deltas_[shard]);
+        }
+      }
+    };
+    if (num_shards == 1) {
+      add_pairs(0, 0, end - begin);
+    } else {
+      pool->ParallelForShards(end - begin, add_pairs);
+    }
+    CountPairDeltas(num_shards, nullptr, nullptr);
+    begin = end;
+  }
+  for (auto &it : symbols_cache_) {
+    if (it.second->IsBigram()) PushSymbol(it.second);
+  }
 
   // Main loop.
-  CHECK_OR_RETURN(final_pieces_.empty());
+  bigram_phase.End();
+  ScopedPhase merge_phase(this, "merge");
+  const auto merge_start = std::chrono::steady_clock::now();
+  std::vector<Symbol *> changed;
   while (final_pieces_.size() < static_cast<size_t>(vocab_size)) {
-    constexpr int kUpdateActiveSymbolsInteval = 100;
-    if (final_pieces_.size() % kUpdateActiveSymbolsInteval == 0) {
-      UpdateActiveSymbols();
+    // Over max_memory_mb, the stale positions are dropped and the lists are
+    // compacted eagerly from then on.
+    if (memory_budget() > 0 && !eager_compaction_ &&
+        final_pieces_.size() % kMemoryCheckPieces == 0 &&
+        static_cast<int64>(GetMemoryUsage().total()) > memory_budget()) {
+      eager_compaction_ = true;
+      CompactAllPositions();
+      NotifyMemoryDecision(
+          "compact_positions",
+          absl::StrCat("compacting the position lists eagerly after ",
+                       final_pieces_.size(), " pieces"));
     }
 
-    // Scanning active symbols, finds the best_symbol with highest freq.
+    // Pops the best_symbol with highest freq, skipping the stale entries.
+    // If the frequency is the same, takes shorter symbol.
+    // If the length is the same, uses lexicographical comparison.
     Symbol *best_symbol = nullptr;
-    for (auto &it : active_symbols_) {
-      Symbol *symbol = it;
-      ComputeFreq(symbol);
-      // If the frequency is the same, take shorter symbol.
-      // if the length is the same, use lexicographical comparison
-      if (best_symbol == nullptr ||
-          (symbol->freq > best_symbol->freq ||
-           (symbol->freq == best_symbol->freq &&
-            (symbol->chars.size() < best_symbol->chars.size() ||
-             (symbol->chars.size() == best_symbol->chars.size() &&
-              symbol->ToString() < best_symbol->ToString()))))) {
-        best_symbol = symbol;
+    while (!queue_.empty()) {
+      const QueueEntry entry = queue_.top();
+      queue_.pop();
+      if (!entry.symbol->removed && entry.freq == entry.symbol->freq) {
+        best_symbol = entry.symbol;
+        break;
       }
     }
 
@@ -253,10 +841,10 @@ util::Status Trainer::Train() {
       break;
     }
 
+    // Removes best_symbol so it is not selected again.
+    best_symbol->removed = true;
+
     if (!dup.insert(best_symbol->ToString()).second) {
-      // Removes best_symbol so it is not selected again.
-      symbols_cache_.erase(best_symbol->fp);
-      active_symbols_.erase(best_symbol);
       continue;
     }
 
@@ -268,44 +856,61 @@ util::Status Trainer::Train() {
       LOG(INFO) << "Added: freq=" << best_symbol->freq
                 << " size=" << final_pieces_.size()
                 << " all=" << symbols_cache_.size()
-                << " active=" << active_symbols_.size()
+                << " queue=" << queue_.size()
                 << " piece=" << best_symbol->ToString();
+      TrainerEvent event;
+      event.type = TrainerEvent::MERGE_PROGRESS;
+      event.num_pieces = final_pieces_.size();
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - merge_start)
+                                 .count();
+      event.merges_per_second =
+          seconds > 0.0 ? final_pieces_.size() / seconds : 0.0;
+      Notify(&event);
     }
 
-    // Add new bigrams which are created after symbol replacement.
+    // Updates the bigrams affected by the symbol replacement.
     // We do not need to scan all characters, but scan the neighbors in
-    // best_symbol.
-    for (const uint64 &encoded_pos : best_symbol->positions) {
-      const Position pos = DecodePos(encoded_pos);
-
-      if (symbols_[pos.sid][pos.left] == nullptr) {
-        // left index might be NULL (set in the previous iteration)
-        // when left_symbol == right_symbol.
-        continue;
+    // best_symbol. The positions are merged in chunks of whole sentences,
+    // and the frequent ones in parallel.
+    const std::vector<uint64_t> positions = GetValidPositions(best_symbol);
+    CHECK_EQ_OR_RETURN(positions.size(), best_symbol->num_positions);
+    positions_[best_symbol->id].Clear();
+    best_symbol->num_positions = 0;
+    best_symbol->freq = 0;
+    changed.clear();
+    for (size_t chunk_begin = 0; chunk_begin < positions.size();) {
+      size_t chunk_end =
+          std::min(positions.size(), chunk_begin + kMergeChunkSize);
+      chunk_end = GetSentenceBoundary(positions, chunk_end);
+
+      const size_t chunk_size = chunk_end - chunk_begin;
+      const int num_shards =
+          chunk_size >= kMinParallelMergeSize ? pool->num_threads() : 1;
+      deltas_.resize(num_shards);
+      for (auto &deltas : deltas_) deltas.clear();
+
+      const uint64_t *data = positions.data() + chunk_begin;
+      auto merge = [&](int shard, size_t begin, size_t end) {
+        begin = GetSentenceBoundary(positions, chunk_begin + begin);
+        end = GetSentenceBoundary(positions, chunk_begin + end);
+        MergePositions(best_symbol, positions.data() + begin,
+                       positions.data() + end, &deltas_[shard]);
+      };
+      if (num_shards == 1) {
+        MergePositions(best_symbol, data, data + chunk_size, &deltas_[0]);
+      } else {
+        pool->ParallelForShards(chunk_size, merge);
       }
-      CHECK_OR_RETURN(symbols_[pos.sid][pos.right]);
-
-      // We have three bigrams [prev, left], [left, right], [right, next],
-      // which are affected with this symbol replacement.
-      const int next = GetNextIndex(pos.sid, pos.right);
-      const int prev = GetPrevIndex(pos.sid, pos.left);
 
-      // Resets the frequencies of bigrams [prev, left] and [right, next].
-      ResetFreq(pos.sid, prev, pos.left, best_symbol);
-      ResetFreq(pos.sid, pos.right, next, best_symbol);
-
-      // Merges two symbols.
-      symbols_[pos.sid][pos.left] = best_symbol;
-      symbols_[pos.sid][pos.right] = nullptr;
-
-      // Makes new symbol bigrams [prev, left] and [left, next].
-      AddNewPair(pos.sid, prev, pos.left);
-      AddNewPair(pos.sid, pos.left, next);
+      CountPairDeltas(num_shards, best_symbol, &changed);
+      chunk_begin = chunk_end;
     }
 
-    // Removes best_symbol so it is not selected again.
-    symbols_cache_.erase(best_symbol->fp);
-    active_symbols_.erase(best_symbol);
+    // Pushes the new frequencies of the changed bigrams once.
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (Symbol *symbol : changed) PushSymbol(symbol);
   }  // end of main loop
 
   // Adds required_chars_
@@ -315,9 +920,32 @@ util::Status Trainer::Train() {
                                -static_cast<float>(final_pieces_.size()));
   }
 
-  port::STLDeleteElements(&allocated_);
+  // Releases the symbols, measured at their largest.
+  RecordMemoryUsage();
+  absl::flat_hash_map<uint64_t, Symbol *>().swap(symbols_cache_);
+  decltype(queue_)().swap(queue_);
+  std::vector<PositionList>().swap(positions_);
+  model::FreeList<Symbol>(kSymbolChunkSize).swap(allocated_);
+  merge_phase.End();
 
+  ScopedPhase save_phase(this, "save");
   return Save();
 }
+
+void Trainer::AddMemoryUsage(MemoryUsage *usage) const {
+  TrainerInterface::AddMemoryUsage(usage);
+  usage->Add("bpe_symbols", allocated_.capacity() * sizeof(Symbol) +
+                                memory_usage::HashMap(symbols_cache_) +
+                                queue_.size() * sizeof(QueueEntry));
+  size_t bytes = memory_usage::Vector(positions_);
+  for (const auto &positions : positions_) {
+    bytes += positions.GetMemoryUsage();
+  }
+  usage->Add("bpe_positions", bytes);
+  bytes = memory_usage::Vector(symbols_) + memory_usage::Vector(links_) +
+          memory_usage::Vector(offsets_) + memory_usage::Vector(freqs_);
+  for (const auto &deltas : deltas_) bytes += memory_usage::Vector(deltas);
+  usage->Add("bpe_sentences", bytes);
+}
 }  // namespace bpe
 }  // namespace sentencepiece
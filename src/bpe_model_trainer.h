@@ -16,13 +16,14 @@
 #define BPE_MODEL_TRAINER_H_
 
 #include <cstdint>
-#include <limits>
+#include <queue>
 #include <string>
 #include <vector>
 
+#include "freelist.h"
 #include "sentencepiece_model.pb.h"
-#include "third_party/absl/container/btree_set.h"
 #include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/container/flat_hash_set.h"
 #include "trainer_interface.h"
 
 namespace sentencepiece {
@@ -39,52 +40,121 @@ class Trainer : public TrainerInterface {
 
   util::Status Train() override;
 
+ protected:
+  void AddMemoryUsage(MemoryUsage *usage) const override;
+
  private:
-  // Symbol represents a character or symbol bigram.
+  // Number of the symbols allocated at once.
+  static constexpr size_t kSymbolChunkSize = 4096;
+
+  // Append-only list of the positions of a bigram, which are encoded as
+  // varint deltas of their increasing runs and take a few bytes each.
+  // A removed position is not erased but left as a stale entry, which does
+  // not hold the bigram anymore and is dropped by CompactPositions().
+  class PositionList {
+   public:
+    // Appends the position |pos|. See EncodePos().
+    void Add(uint64_t pos);
+
+    // Returns all the entries, including the stale ones, in the order added.
+    std::vector<uint64_t> ToVector() const;
+
+    void Clear();
+
+    // Returns the number of the entries, including the stale ones.
+    size_t size() const { return size_; }
+
+    // Returns the bytes of the encoded entries.
+    size_t GetMemoryUsage() const;
+
+   private:
+    std::string data_;
+    uint64_t last_ = 0;
+    size_t size_ = 0;
+  };
+
+  // Symbol represents a character or symbol bigram. The characters of a
+  // bigram are the ones of |left| followed by the ones of |right|.
+  // Symbols are allocated from |allocated_|, which zero-fills them.
   struct Symbol {
-    const Symbol *left;              // left symbol in bigram
-    const Symbol *right;             // right symbol in bigram
-    string_util::UnicodeText chars;  // all flattend chracter sequence
-    bool is_unk;                     // true if this symbol is unknown.
-    uint64_t fp;                     // fingerprint of this symbol.
-    uint64_t freq;                   // frequency of this symbol.
+    const Symbol *left;  // left symbol in bigram
+    const Symbol *right;  // right symbol in bigram
+    char32 c;             // the character of a unary symbol.
+    uint32_t size;        // number of the characters.
+    uint32_t id;          // index of the positions in positions_.
+    bool is_unk;          // true if this symbol is unknown.
+    bool removed;         // true if this symbol is not selected.
+    uint64_t fp;          // fingerprint of this symbol.
+    uint64_t freq;        // frequency of this symbol.
 
-    // Position list. Use set so that we can keep the order of occurrence.
-    // See EncodePos/DecodePos.
-    absl::btree_set<uint64_t> positions;
+    // Number of the occurrences of a bigram. |num_positions| and |freq| are
+    // kept exact while merging, while positions_[id] may have stale entries.
+    uint64_t num_positions;
+
+    // Decides whether the bigrams of this symbol are valid pieces.
+    PieceSummary summary;
 
     bool IsBigram() const { return left != nullptr && right != nullptr; }
+
+    // Returns the |index|-th character.
+    char32 CharAt(uint32_t index) const;
+
+    // Appends the characters to |chars|.
+    void AppendChars(string_util::UnicodeText *chars) const;
+
     std::string ToString() const;
-    Symbol() : left(nullptr), right(nullptr), is_unk(false), fp(0), freq(0) {}
+  };
+
+  // An entry of |queue_|, which is stale if |freq| is not the frequency of
+  // |symbol| anymore.
+  struct QueueEntry {
+    uint64_t freq;
+    Symbol *symbol;
+  };
+
+  // Orders the entries of |queue_| so that the top is the best symbol: the
+  // most frequent one, and then the shorter one, the one with the smaller
+  // characters and the one with the smaller fingerprint.
+  struct QueueEntryLess {
+    bool operator()(const QueueEntry &e1, const QueueEntry &e2) const {
+      if (e1.freq != e2.freq) return e1.freq < e2.freq;
+      const Symbol *s1 = e1.symbol;
+      const Symbol *s2 = e2.symbol;
+      if (s1->size != s2->size) return s1->size > s2->size;
+      for (uint32_t i = 0; i < s1->size; ++i) {
+        const char32 c1 = s1->CharAt(i);
+        const char32 c2 = s2->CharAt(i);
+        if (c1 != c2) return c1 > c2;
+      }
+      return s1->fp > s2->fp;
+    }
   };
 
   struct Position {
-    int sid;    // sentence id
-    int left;   // left symbol index
-    int right;  // right symbol index
+    int sid;   // sentence id
+    int left;  // left symbol index
   };
 
-  // Encodes sid, left and right bigram index into uint64_t.
-  // Encoded value keeps the order of sid, left and right.
-  static uint64_t EncodePos(int sid, int l, int r) {
+  // Encodes sid and left bigram index into uint64_t. The right index is
+  // the next valid one of left in links_. Encoded value keeps the order of
+  // sid and left.
+  static uint64_t EncodePos(int sid, int l) {
+    CHECK_GE(sid, 0);
     CHECK_GE(l, 0);
-    CHECK_GE(r, 0);
-    CHECK_LE(l, std::numeric_limits<uint16_t>::max());
-    CHECK_LE(r, std::numeric_limits<uint16_t>::max());
-    const uint64_t n = (static_cast<uint64_t>(sid) << 32) |
-                       (static_cast<uint64_t>(l) << 16) | r;
-    return n;
+    return (static_cast<uint64_t>(sid) << 32) | static_cast<uint32_t>(l);
   }
 
-  // Decodes sid, left and right bigram index from uint64_t.
+  // Decodes sid and left bigram index from uint64_t.
   static Position DecodePos(uint64_t n) {
     Position p;
     p.sid = n >> 32;
-    p.left = (n >> 16) & 0xffff;
-    p.right = n & 0xffff;
+    p.left = n & 0xffffffff;
     return p;
   }
 
+  // Allocates a zero-filled symbol with its position list.
+  Symbol *NewSymbol();
+
   // Gets unary (character) symbol from the char code |c|.
   // The return value is cached.
   Symbol *GetCharSymbol(char32 c);
@@ -92,38 +162,118 @@ class Trainer : public TrainerInterface {
   // Gets symbol pair from left/right symbols. The return value is cached.
   Symbol *GetPairSymbol(const Symbol *left, const Symbol *right);
 
-  // Computes the frequency of |symbol| and update symbol->freq field.
-  void ComputeFreq(Symbol *symbol) const;
+  // Returns the cached symbol pair of left/right symbols, or nullptr.
+  // Unlike GetPairSymbol(), does not modify symbols_cache_.
+  Symbol *FindPairSymbol(const Symbol *left, const Symbol *right) const;
 
-  // Returns the valid index before symbols_[sid][index].
-  int GetNextIndex(int sid, int index) const;
+  // An occurrence of a bigram added or removed by merging, which is counted
+  // after the merges of all the threads.
+  struct PairDelta {
+    Symbol *symbol;       // the bigram, or nullptr if it is not cached yet.
+    const Symbol *left;   // left symbol in bigram
+    const Symbol *right;  // right symbol in bigram
+    uint64_t pos;         // encoded position of the occurrence.
+    bool add;             // true if the occurrence is added.
+  };
+
+  // Records the occurrence of bigram
+  // [symbol_at(sid, left), symbol_at(sid, right)] in |deltas|.
+  void AddPairDelta(int sid, int left, int right, bool add,
+                    std::vector<PairDelta> *deltas) const;
+
+  // Merges |best| at the positions [begin, end), which cover whole
+  // sentences, and records the changes of the neighbor bigrams in |deltas|.
+  void MergePositions(Symbol *best, const uint64_t *begin,
+                      const uint64_t *end, std::vector<PairDelta> *deltas);
+
+  // Returns true if |pos| holds the bigram |symbol|.
+  bool IsValidPosition(const Symbol *symbol, uint64_t pos) const;
+
+  // Returns the sorted positions which hold |symbol|.
+  std::vector<uint64_t> GetValidPositions(const Symbol *symbol) const;
 
-  // Returns the valid index after symbols_[sid][index].
-  int GetPrevIndex(int sid, int index) const;
+  // Drops the stale entries of positions_[symbol->id].
+  void CompactPositions(Symbol *symbol);
 
-  // Makes a new bigram from [symbols_[sid][left], symbols_[sid][right]] and
-  // Adds it to symbols_cache_ and active_symbols_.
-  void AddNewPair(int sid, int left, int right);
+  // Drops the stale entries of the position lists of all the bigrams.
+  void CompactAllPositions();
 
-  // Resets the fequency of bigram [symbols_[sid][left] symbols_[sid][right]],
-  // if this bigram is not |best|.
-  void ResetFreq(int sid, int left, int right, const Symbol *best);
+  // Counts the deltas of the bigrams of |shard| out of |num_shards|,
+  // except |best|, and adds the changed bigrams to |changed| if not null.
+  void ApplyPairDeltas(int shard, int num_shards, const Symbol *best,
+                       std::vector<Symbol *> *changed);
 
-  // Updates |active_symbols_| by copying the top 5% frequent symbols in
-  // symbols_cache_.
-  void UpdateActiveSymbols();
+  // Makes the uncached bigrams of |deltas_| and counts all the deltas,
+  // except |best|, with |num_shards| threads. Appends the changed bigrams
+  // to |changed| if not null.
+  void CountPairDeltas(int num_shards, const Symbol *best,
+                       std::vector<Symbol *> *changed);
+
+  // Pushes the current frequency of |symbol| to |queue_|.
+  void PushSymbol(Symbol *symbol);
+
+  // Chooses the first merges, up to |max_pieces| pieces in final_pieces_,
+  // from the pair frequencies of a sample of the sentences estimated in
+  // count-min sketches, and merges them in bulk without the position lists.
+  // The pieces are added to |dup|. Stops once the margin of the best pair
+  // is within the error bound of the estimates.
+  util::Status ApproximateMerges(size_t max_pieces,
+                                 absl::flat_hash_set<std::string> *dup);
 
   // All unique symbols. Key is a fingerprint of Symbol.
   absl::flat_hash_map<uint64_t, Symbol *> symbols_cache_;
 
-  // Set of symbols from which we find the best symbol in each iteration.
-  absl::btree_set<Symbol *> active_symbols_;
+  // Max-heap of the bigrams, from which we pop the best symbol in each
+  // iteration. The frequency of a symbol is pushed again when it changes,
+  // and the stale entries are skipped when popped.
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>, QueueEntryLess>
+      queue_;
+
+  // Stores symbols allocated in chunks so that we can delete them at once.
+  model::FreeList<Symbol> allocated_{kSymbolChunkSize};
+
+  // Positions of the bigrams. positions_[symbol->id] stores the positions
+  // of |symbol|, which are kept out of Symbol so that it is trivial.
+  std::vector<PositionList> positions_;
+
+  // True if the position lists are compacted at fewer stale entries to stay
+  // within max_memory_mb.
+  bool eager_compaction_ = false;
+
+  // Doubly-linked indices of the valid symbols, skipping the merged ones.
+  struct Link {
+    int prev;
+    int next;
+  };
+
+  // Returns the symbol at |index| of sentence |sid|.
+  Symbol *&symbol_at(int sid, int index) {
+    return symbols_[offsets_[sid] + index];
+  }
+  const Symbol *symbol_at(int sid, int index) const {
+    return symbols_[offsets_[sid] + index];
+  }
+
+  // Returns the links of symbol_at(sid, index) to its neighbors, or -1.
+  Link &link_at(int sid, int index) { return links_[offsets_[sid] + index]; }
+  const Link &link_at(int sid, int index) const {
+    return links_[offsets_[sid] + index];
+  }
+
+  // Sentences, flattened into one array. The symbols of sentence |sid| are
+  // symbols_[offsets_[sid], offsets_[sid + 1]), and links_ follows the
+  // same layout.
+  std::vector<Symbol *> symbols_;
+  std::vector<Link> links_;
+  std::vector<size_t> offsets_;
 
-  // Stores symbols allocated in heap so that we can delete them at onece.
-  std::vector<Symbol *> allocated_;
+  // Per-thread deltas of MergePositions(), kept to reuse the buffers.
+  std::vector<std::vector<PairDelta>> deltas_;
 
-  // Sentences. symbols_[sid][index] stores a symbol in sentence_[sid][index].
-  std::vector<std::vector<Symbol *>> symbols_;
+  // Frequencies of the sentences. freqs_[sid] is the frequency of
+  // sentence |sid|, kept here so that the merges do not read the sentence
+  // store.
+  std::vector<int64> freqs_;
 };
 }  // namespace bpe
 }  // namespace sentencepiece
@@ -12,16 +12,20 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
 #include "bpe_model_trainer.h"
 #include "filesystem.h"
+#include "pretokenizer_for_training.h"
 #include "sentencepiece_processor.h"
 #include "sentencepiece_trainer.h"
 #include "testharness.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/absl/strings/str_join.h"
+#include "third_party/absl/strings/str_split.h"
 #include "util.h"
 
 namespace sentencepiece {
@@ -89,6 +93,114 @@ TEST(BPETrainerTest, BasicTest) {
             RunTrainer({"pen", "pineapple", "apple"}, 20, {"app"}));
 }
 
+// Splits the text into the pieces of two bytes, counting the batches.
+class PairPretokenizer
+    : public pretokenizer::PretokenizerForTrainingInterface {
+ public:
+  util::Status status() const override { return util::OkStatus(); }
+
+  SentencePieceText Tokenize(absl::string_view text) const override {
+    SentencePieceText spt;
+    for (size_t begin = 0; begin < text.size(); begin += 2) {
+      const size_t end = std::min(begin + 2, text.size());
+      auto *piece = spt.add_pieces();
+      piece->set_surface(std::string(text.substr(begin, end - begin)));
+      piece->set_begin(begin);
+      piece->set_end(end);
+    }
+    return spt;
+  }
+
+  std::vector<SentencePieceText> TokenizeBatch(
+      const std::vector<absl::string_view> &texts) const override {
+    ++num_batches_;
+    return PretokenizerForTrainingInterface::TokenizeBatch(texts);
+  }
+
+  int num_batches() const { return num_batches_; }
+
+ private:
+  mutable std::atomic<int> num_batches_{0};
+};
+
+TEST(BPETrainerTest, PretokenizerTest) {
+  PairPretokenizer pretokenizer;
+  ASSERT_TRUE(
+      SentencePieceTrainer::SetPretokenizerForTraining(&pretokenizer).ok());
+  const std::string pieces =
+      RunTrainer({"abracadabra", "cadabra", "abrac"}, 12);
+  ASSERT_TRUE(SentencePieceTrainer::SetPretokenizerForTraining(nullptr).ok());
+
+  EXPECT_GT(pretokenizer.num_batches(), 0);
+  for (const auto &piece : absl::StrSplit(pieces, " ")) {
+    EXPECT_LE(piece.size(), 2);
+  }
+}
+
+TEST(BPETrainerTest, LongSentenceTest) {
+  // More symbols than a 16-bit index.
+  std::string sentence;
+  for (int i = 0; i < 20000; ++i) sentence += "abcd";
+  const std::string input_file =
+      util::JoinPath(::testing::TempDir(), "long_input");
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    output->WriteLine(sentence);
+  }
+
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::BPE);
+  trainer_spec.add_input(input_file);
+  trainer_spec.set_vocab_size(10);
+  trainer_spec.set_max_sentence_length(100000);
+  trainer_spec.set_split_by_whitespace(false);
+  trainer_spec.set_model_prefix(
+      util::JoinPath(::testing::TempDir(), "long_model"));
+
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("identity");
+  normalizer_spec.set_add_dummy_prefix(false);
+  NormalizerSpec denormalizer_spec;
+
+  Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+  ASSERT_TRUE(trainer.Train().ok());
+
+  SentencePieceProcessor processor;
+  ASSERT_TRUE(processor.Load(trainer_spec.model_prefix() + ".model").ok());
+  std::vector<std::string> pieces;
+  for (int i = 3; i < processor.GetPieceSize(); ++i) {
+    pieces.emplace_back(processor.IdToPiece(i));
+  }
+  EXPECT_EQ("ab cd abcd a b c d", absl::StrJoin(pieces, " "));
+}
+
+TEST(BPETrainerTest, MemoryUsageTest) {
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::BPE);
+  trainer_spec.add_input(util::JoinPath(::testing::SrcDir(), "botchan.txt"));
+  trainer_spec.set_vocab_size(1000);
+  trainer_spec.set_model_prefix(
+      util::JoinPath(::testing::TempDir(), "memory_model"));
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("nmt_nfkc");
+  NormalizerSpec denormalizer_spec;
+
+  Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+  ASSERT_TRUE(trainer.Train().ok());
+
+  // The symbols are released after the merges, but their peak is kept.
+  const auto usage = trainer.GetMemoryUsage();
+  EXPECT_EQ(0, usage.bytes("bpe_symbols"));
+  EXPECT_GT(usage.bytes("sentences"), 0);
+  const auto &peak = trainer.peak_memory_usage();
+  EXPECT_GT(peak.bytes("bpe_symbols"), 0);
+  EXPECT_GT(peak.bytes("bpe_positions"), 0);
+  EXPECT_GE(peak.bytes("sentences"), usage.bytes("sentences"));
+  for (const auto &phase : trainer.phases()) {
+    EXPECT_GT(phase.memory_bytes, 0);
+  }
+}
+
 static constexpr char kTestInputData[] = "wagahaiwa_nekodearu.txt";
 
 TEST(BPETrainerTest, EndToEndTest) {
@@ -134,6 +246,59 @@ TEST(BPETrainerTest, EndToEndTest) {
             absl::StrJoin(tok, " "));
 }
 
+TEST(BPETrainerTest, ParallelMergeTest) {
+  const std::string input =
+      util::JoinPath(::testing::SrcDir(), kTestInputData);
+
+  // Returns the vocab trained with `num_threads`.
+  auto train = [&](int num_threads) {
+    const std::string prefix = util::JoinPath(
+        ::testing::TempDir(), absl::StrCat("parallel_model", num_threads));
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=", input,
+                                 " --vocab_size=4000 --model_type=bpe",
+                                 " --normalization_rule_name=identity",
+                                 " --split_by_whitespace=false") +
+                    absl::StrCat(" --num_threads=", num_threads))
+                    .ok());
+    std::string vocab;
+    auto file = filesystem::NewReadableFile(prefix + ".vocab");
+    EXPECT_TRUE(file->ReadAll(&vocab));
+    return vocab;
+  };
+
+  // The merges of the threads are counted in the order of the positions.
+  EXPECT_EQ(train(1), train(4));
+}
+
+TEST(BPETrainerTest, ApproximateMergeTest) {
+  const std::string input =
+      util::JoinPath(::testing::SrcDir(), kTestInputData);
+
+  // Returns the vocab trained with `approximate_bpe_merges`.
+  auto train = [&](int approximate_bpe_merges) {
+    const std::string prefix = util::JoinPath(
+        ::testing::TempDir(),
+        absl::StrCat("approximate_model", approximate_bpe_merges));
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=", input,
+                                 " --vocab_size=4000 --model_type=bpe",
+                                 " --normalization_rule_name=identity",
+                                 " --num_threads=4") +
+                    absl::StrCat(" --approximate_bpe_merges=",
+                                 approximate_bpe_merges))
+                    .ok());
+    std::string vocab;
+    auto file = filesystem::NewReadableFile(prefix + ".vocab");
+    EXPECT_TRUE(file->ReadAll(&vocab));
+    return vocab;
+  };
+
+  // The whole corpus is sampled, and the merges are only taken ahead of the
+  // error bound of the sketch, so they are the exact ones.
+  EXPECT_EQ(train(0), train(1000));
+}
+
 }  // namespace
 }  // namespace bpe
 }  // namespace sentencepiece
@@ -148,6 +148,82 @@ Builder::Chars Normalize(const Builder::CharsMap &chars_map,
 
   return normalized;
 }
+
+// Removes the rules of `chars_map` which the shorter rules cover, as
+// Builder::RemoveRedundantMap() does, but only checks the rules for which
+// `needs_check` returns true and keeps the others as they are. The rules of
+// one length only depend on the shorter ones, so they are checked in
+// parallel.
+util::Status RemoveRedundantRules(
+    Builder::CharsMap *chars_map,
+    const std::function<bool(const Builder::Chars &)> &needs_check) {
+  CHECK_OR_RETURN(chars_map);
+
+  using Rule = Builder::CharsMap::value_type;
+  Builder::CharsMap new_chars_map;
+  // The rules to check, indexed by the length of their keys.
+  std::vector<std::vector<const Rule *>> rules_by_length;
+  size_t max_len = 0;
+  for (const auto &p : *chars_map) {
+    max_len = std::max(p.first.size(), max_len);
+    if (p.first.size() == 1 || !needs_check(p.first)) {
+      new_chars_map.insert(p);
+    } else {
+      if (rules_by_length.size() <= p.first.size()) {
+        rules_by_length.resize(p.first.size() + 1);
+      }
+      rules_by_length[p.first.size()].push_back(&p);
+    }
+  }
+  CHECK_GT_OR_RETURN(max_len, 0);
+
+  constexpr size_t kGrain = 256;
+  auto *pool = GetSharedThreadPool();
+
+  // Checks whether the rules with size of `len` can be normalized by
+  // the rules with size of [1 .. len - 1].
+  std::vector<char> redundant;
+  for (size_t len = 2; len < rules_by_length.size(); ++len) {
+    const auto &rules = rules_by_length[len];
+    redundant.assign(rules.size(), false);
+    pool->ParallelFor(rules.size(), kGrain,
+                      [&](int, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; ++i) {
+                          redundant[i] = rules[i]->second ==
+                                         Normalize(new_chars_map,
+                                                   rules[i]->first, len - 1);
+                        }
+                      });
+    for (size_t i = 0; i < rules.size(); ++i) {
+      if (!redundant[i]) new_chars_map.insert(*rules[i]);
+    }
+  }
+
+  // Verify all the checked rules are normalized by `new_chars_map`.
+  std::vector<const Rule *> checked;
+  for (const auto &rules : rules_by_length) {
+    checked.insert(checked.end(), rules.begin(), rules.end());
+  }
+  std::vector<char> verified(checked.size(), false);
+  pool->ParallelFor(checked.size(), kGrain,
+                    [&](int, size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; ++i) {
+                        verified[i] =
+                            checked[i]->second ==
+                            Normalize(new_chars_map, checked[i]->first,
+                                      max_len);
+                      }
+                    });
+  for (size_t i = 0; i < checked.size(); ++i) {
+    CHECK_OR_RETURN(verified[i])
+        << "Rule of " << checked[i]->first.size()
+        << " characters is not normalized by the reduced rules.";
+  }
+
+  *chars_map = std::move(new_chars_map);
+
+  return util::OkStatus();
+}
 }  // namespace
 
 // static
@@ -210,7 +286,8 @@ util::Status Builder::CompileCharsMap(const CharsMap &chars_map,
 
   absl::string_view trie_blob(static_cast<const char *>(trie.array()),
                               trie.size() * trie.unit_size());
-  *output = Normalizer::EncodePrecompiledCharsMap(trie_blob, normalized);
+  *output = Normalizer::EncodePrecompiledCharsMap(
+      trie_blob, normalized, Normalizer::BuildCodepointTable(trie));
 
   LOG(INFO) << "Generated normalizer blob. size=" << output->size();
 
@@ -299,47 +376,82 @@ util::Status BuildMapInternal(
     std::function<Builder::Chars(const Builder::Chars &)> composer,
     std::function<Builder::Chars(const Builder::Chars &)> decomposer) {
 #ifdef ENABLE_NFKC_COMPILE
-  // Set of fully NFKD decomposed characters.
-  std::set<Builder::Chars> nfkd_decomposed;
-
-  // Fully normalized one character to unnormalized one character map.
-  std::map<char32, std::set<char32>> norm2orig;
+  // The codepoints are normalized in parallel. Each shard collects its own
+  // results, which are merged in the order of shards afterwards.
+  struct Shard {
+    // Set of fully NFKD decomposed characters.
+    std::set<Builder::Chars> nfkd_decomposed;
+    // Fully normalized one character to unnormalized one character map.
+    std::map<char32, std::set<char32>> norm2orig;
+    Builder::CharsMap nfkc_map;
+  };
 
-  Builder::CharsMap nfkc_map;  // The final NFKC mapping.
+  auto *pool = GetSharedThreadPool();
+  std::vector<Shard> shards(pool->num_threads());
 
   constexpr int kMaxUnicode = 0x10FFFF;
-  for (char32 cp = 1; cp <= kMaxUnicode; ++cp) {
-    if (!U_IS_UNICODE_CHAR(cp)) {
-      continue;
-    }
-    // Aggregates single character to fully NFKC normalized characters.
-    const auto nfkc = composer({cp});
-    if (nfkc.size() >= 2 || (nfkc.size() == 1 && nfkc[0] != cp)) {
-      nfkc_map[{cp}] = nfkc;
-    }
-    const auto nfkd = decomposer({cp});
-    if (nfkd.size() == 1) {
-      // Aggregates reverse mapping from normalized to unnormalized character.
-      norm2orig[nfkd[0]].insert(cp);
-    } else {
-      // One character is decomposed into multiple characters.
-      nfkd_decomposed.insert(nfkd);
+  pool->ParallelForShards(
+      kMaxUnicode, [&](int shard, size_t begin, size_t end) {
+        auto &s = shards[shard];
+        for (char32 cp = begin + 1; cp <= end; ++cp) {
+          if (!U_IS_UNICODE_CHAR(cp)) {
+            continue;
+          }
+          // Aggregates single character to fully NFKC normalized characters.
+          const auto nfkc = composer({cp});
+          if (nfkc.size() >= 2 || (nfkc.size() == 1 && nfkc[0] != cp)) {
+            s.nfkc_map[{cp}] = nfkc;
+          }
+          const auto nfkd = decomposer({cp});
+          if (nfkd.size() == 1) {
+            // Aggregates reverse mapping from normalized to unnormalized
+            // character.
+            s.norm2orig[nfkd[0]].insert(cp);
+          } else {
+            // One character is decomposed into multiple characters.
+            s.nfkd_decomposed.insert(nfkd);
+          }
+        }
+      });
+
+  std::set<Builder::Chars> nfkd_decomposed;
+  std::map<char32, std::set<char32>> norm2orig;
+  Builder::CharsMap nfkc_map;  // The final NFKC mapping.
+  for (auto &s : shards) {
+    nfkd_decomposed.insert(s.nfkd_decomposed.begin(), s.nfkd_decomposed.end());
+    for (const auto &p : s.norm2orig) {
+      norm2orig[p.first].insert(p.second.begin(), p.second.end());
     }
+    nfkc_map.insert(s.nfkc_map.begin(), s.nfkc_map.end());
+    s = Shard();
   }
 
-  for (const auto &nfkd : nfkd_decomposed) {
-    const auto nfkc = composer(nfkd);
-    // This case is already covered by single-character to NFKC mapping.
-    if (nfkc == nfkd) {
-      continue;
-    }
-    // Expand all possible sequences which are normalized into the same
-    // `nfkd`.
-    for (const auto &nfkd_orig : ExpandUnnormalized(nfkd, norm2orig)) {
-      if (nfkd_orig != nfkc) {
-        nfkc_map[nfkd_orig] = nfkc;
-      }
-    }
+  // Expands the decomposed characters in parallel as well. A sequence is
+  // generated from one `nfkd` only, since it is normalized into it.
+  const std::vector<Builder::Chars> decomposed(nfkd_decomposed.begin(),
+                                               nfkd_decomposed.end());
+  pool->ParallelForShards(
+      decomposed.size(), [&](int shard, size_t begin, size_t end) {
+        auto &s = shards[shard];
+        for (size_t i = begin; i < end; ++i) {
+          const auto &nfkd = decomposed[i];
+          const auto nfkc = composer(nfkd);
+          // This case is already covered by single-character to NFKC
+          // mapping.
+          if (nfkc == nfkd) {
+            continue;
+          }
+          // Expand all possible sequences which are normalized into the
+          // same `nfkd`.
+          for (const auto &nfkd_orig : ExpandUnnormalized(nfkd, norm2orig)) {
+            if (nfkd_orig != nfkc) {
+              s.nfkc_map[nfkd_orig] = nfkc;
+            }
+          }
+        }
+      });
+  for (const auto &s : shards) {
+    for (const auto &p : s.nfkc_map) nfkc_map[p.first] = p.second;
   }
 
   RETURN_IF_ERROR(Builder::RemoveRedundantMap(&nfkc_map));
@@ -648,37 +760,40 @@ util::Status Builder::SaveCharsMap(absl::string_view filename,
 
 // static
 util::Status Builder::RemoveRedundantMap(CharsMap *chars_map) {
-  CHECK_OR_RETURN(chars_map);
+  return RemoveRedundantRules(chars_map, [](const Chars &) { return true; });
+}
 
-  CharsMap new_chars_map;
-  size_t max_len = 0;
-  for (const auto &p : *chars_map) {
-    max_len = std::max(p.first.size(), max_len);
-    if (p.first.size() == 1) {
-      new_chars_map.insert(p);
-    }
+// static
+util::Status Builder::MergeCharsMap(absl::string_view blob,
+                                    const CharsMap &rules,
+                                    std::string *output) {
+  CHECK_OR_RETURN(output);
+
+  CharsMap chars_map;
+  RETURN_IF_ERROR(DecompileCharsMap(blob, &chars_map));
+  std::set<size_t> lengths;
+  for (const auto &p : rules) {
+    CHECK_OR_RETURN(!p.first.empty());
+    chars_map[p.first] = p.second;
+    lengths.insert(p.first.size());
   }
-  CHECK_GT_OR_RETURN(max_len, 0);
 
-  // Checks whether the rules with size of `len` can be normalized by
-  // the rules with size of [1 .. len - 1].
-  for (size_t len = 2; len <= max_len; ++len) {
-    for (const auto &p : *chars_map) {
-      if (p.first.size() == len &&
-          p.second != Normalize(new_chars_map, p.first, len - 1)) {
-        new_chars_map.insert(p);
+  // Only the rules containing a new one may have become redundant: the
+  // shorter rules the others are normalized with are unchanged.
+  auto contains_rule = [&rules, &lengths](const Chars &key) {
+    for (const size_t len : lengths) {
+      if (len > key.size()) break;
+      for (size_t i = 0; i + len <= key.size(); ++i) {
+        if (rules.count(Chars(key.begin() + i, key.begin() + i + len))) {
+          return true;
+        }
       }
     }
-  }
-
-  // Verify all characters in `chars_map` are normalized by `new_chars_map`.
-  for (const auto &p : *chars_map) {
-    CHECK_EQ_OR_RETURN(p.second, Normalize(new_chars_map, p.first, max_len));
-  }
-
-  *chars_map = std::move(new_chars_map);
+    return false;
+  };
+  RETURN_IF_ERROR(RemoveRedundantRules(&chars_map, contains_rule));
 
-  return util::OkStatus();
+  return CompileCharsMap(chars_map, output);
 }
 }  // namespace normalizer
 }  // namespace sentencepiece
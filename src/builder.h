@@ -140,6 +140,14 @@ class Builder {
   // rule is not necessary since the second rule can cover the first rule.
   static util::Status RemoveRedundantMap(CharsMap *chars_map);
 
+  // Compiles the rules of the compiled `blob` with `rules` added into
+  // `output`, replacing the rules of the same keys. The rules of `blob` are
+  // taken as already free of redundant rules, so only the ones containing
+  // an added rule are checked again instead of the whole map.
+  static util::Status MergeCharsMap(absl::string_view blob,
+                                    const CharsMap &rules,
+                                    std::string *output);
+
  private:
   FRIEND_TEST(BuilderTest, RemoveRedundantMapTest);
 };
@@ -44,6 +44,46 @@ TEST(BuilderTest, RemoveRedundantMapTest) {
   EXPECT_NE(chars_map.end(), chars_map.find({0x0061, 0x0062, 0x0063}));
 }
 
+TEST(BuilderTest, MergeCharsMapTest) {
+  std::string blob;
+  EXPECT_TRUE(Builder::GetPrecompiledCharsMap("nmt_nfkc", &blob).ok());
+
+  // ab => AB, abc => ABc, x => yz
+  Builder::CharsMap rules;
+  rules[{0x0061, 0x0062}] = {0x0041, 0x0042};
+  rules[{0x0061, 0x0062, 0x0063}] = {0x0041, 0x0042, 0x0063};
+  rules[{0x0078}] = {0x0079, 0x007A};
+
+  std::string merged;
+  EXPECT_TRUE(Builder::MergeCharsMap(blob, rules, &merged).ok());
+
+  // Same as the map reduced and compiled from scratch.
+  Builder::CharsMap chars_map;
+  EXPECT_TRUE(Builder::DecompileCharsMap(blob, &chars_map).ok());
+  for (const auto &p : rules) chars_map[p.first] = p.second;
+  EXPECT_TRUE(Builder::RemoveRedundantMap(&chars_map).ok());
+  std::string expected;
+  EXPECT_TRUE(Builder::CompileCharsMap(chars_map, &expected).ok());
+  EXPECT_EQ(expected, merged);
+
+  Builder::CharsMap merged_map;
+  EXPECT_TRUE(Builder::DecompileCharsMap(merged, &merged_map).ok());
+  EXPECT_NE(merged_map.end(), merged_map.find({0x0061, 0x0062}));
+  EXPECT_EQ(merged_map.end(), merged_map.find({0x0061, 0x0062, 0x0063}));
+
+  NormalizerSpec spec;
+  spec.set_precompiled_charsmap(merged);
+  spec.set_add_dummy_prefix(false);
+  const Normalizer normalizer(spec);
+  EXPECT_EQ("ABcyz", normalizer.Normalize("abcx"));
+  EXPECT_EQ("ABC", normalizer.Normalize("ＡＢＣ"));
+
+  // Empty key.
+  Builder::CharsMap invalid_rules;
+  invalid_rules[{}] = {0x0061};
+  EXPECT_FALSE(Builder::MergeCharsMap(blob, invalid_rules, &merged).ok());
+}
+
 TEST(BuilderTest, GetPrecompiledCharsMapWithInvalidNameTest) {
   std::string output;
   EXPECT_FALSE(Builder::GetPrecompiledCharsMap("", &output).ok());
@@ -404,6 +404,75 @@ class TrainerSpec::_Internal {
   static void set_has_seed_sentencepieces_file(HasBits* has_bits) {
     (*has_bits)[0] |= 512u;
   }
+  static void set_has_normalized_corpus_cache(HasBits* has_bits) {
+    (*has_bits)[1] |= 1024u;
+  }
+  static void set_has_num_reader_threads(HasBits* has_bits) {
+    (*has_bits)[1] |= 2048u;
+  }
+  static void set_has_precompile_trie(HasBits* has_bits) {
+    (*has_bits)[1] |= 4096u;
+  }
+  static void set_has_seed_sentencepiece_shard_size(HasBits* has_bits) {
+    (*has_bits)[1] |= 8192u;
+  }
+  static void set_has_incremental_e_step_tolerance(HasBits* has_bits) {
+    (*has_bits)[1] |= 16384u;
+  }
+  static void set_has_checkpoint_file(HasBits* has_bits) {
+    (*has_bits)[1] |= 32768u;
+  }
+  static void set_has_resume_from(HasBits* has_bits) {
+    (*has_bits)[1] |= 65536u;
+  }
+  static void set_has_distributed_dir(HasBits* has_bits) {
+    (*has_bits)[1] |= 131072u;
+  }
+  static void set_has_num_distributed_processes(HasBits* has_bits) {
+    (*has_bits)[1] |= 262144u;
+  }
+  static void set_has_distributed_process_id(HasBits* has_bits) {
+    (*has_bits)[1] |= 524288u;
+  }
+  static void set_has_vocab_size_sweep(HasBits* has_bits) {
+    (*has_bits)[1] |= 1048576u;
+  }
+  static void set_has_dedup_input_sentences(HasBits* has_bits) {
+    (*has_bits)[1] |= 2097152u;
+  }
+  static void set_has_em_mini_batch_size(HasBits* has_bits) {
+    (*has_bits)[1] |= 4194304u;
+  }
+  static void set_has_e_step_beam(HasBits* has_bits) {
+    (*has_bits)[1] |= 8388608u;
+  }
+  static void set_has_sentence_store(HasBits* has_bits) {
+    (*has_bits)[1] |= 16777216u;
+  }
+  static void set_has_sentence_store_dir(HasBits* has_bits) {
+    (*has_bits)[1] |= 33554432u;
+  }
+  static void set_has_keep_sentence_store(HasBits* has_bits) {
+    (*has_bits)[1] |= 67108864u;
+  }
+  static void set_has_max_memory_mb(HasBits* has_bits) {
+    (*has_bits)[1] |= 134217728u;
+  }
+  static void set_has_approximate_bpe_merges(HasBits* has_bits) {
+    (*has_bits)[1] |= 268435456u;
+  }
+  static void set_has_e_step_window_size(HasBits* has_bits) {
+    (*has_bits)[1] |= 536870912u;
+  }
+  static void set_has_distributed_timeout_sec(HasBits* has_bits) {
+    (*has_bits)[1] |= 1073741824u;
+  }
+  static void set_has_min_piece_score(HasBits* has_bits) {
+    (*has_bits)[1] |= 2147483648u;
+  }
+  static void set_has_max_piece_score(HasBits* has_bits) {
+    (*has_bits)[2] |= 1u;
+  }
 };
 
 const ::PROTOBUF_NAMESPACE_ID::internal::LazyString TrainerSpec::_i_give_permission_to_break_this_code_default_unk_piece_{{{"<unk>", 5}}, {nullptr}};
@@ -484,6 +553,57 @@ TrainerSpec::TrainerSpec(const TrainerSpec& from)
   ::memcpy(&self_test_sample_size_, &from.self_test_sample_size_,
     static_cast<size_t>(reinterpret_cast<char*>(&pad_id_) -
     reinterpret_cast<char*>(&self_test_sample_size_)) + sizeof(pad_id_));
+  normalized_corpus_cache_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_normalized_corpus_cache()) {
+    normalized_corpus_cache_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_normalized_corpus_cache(),
+      GetArena());
+  }
+  num_reader_threads_ = from.num_reader_threads_;
+  precompile_trie_ = from.precompile_trie_;
+  seed_sentencepiece_shard_size_ = from.seed_sentencepiece_shard_size_;
+  incremental_e_step_tolerance_ = from.incremental_e_step_tolerance_;
+  checkpoint_file_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_checkpoint_file()) {
+    checkpoint_file_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_checkpoint_file(),
+      GetArena());
+  }
+  resume_from_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_resume_from()) {
+    resume_from_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_resume_from(),
+      GetArena());
+  }
+  distributed_dir_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_distributed_dir()) {
+    distributed_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_distributed_dir(),
+      GetArena());
+  }
+  num_distributed_processes_ = from.num_distributed_processes_;
+  distributed_process_id_ = from.distributed_process_id_;
+  vocab_size_sweep_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_vocab_size_sweep()) {
+    vocab_size_sweep_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_vocab_size_sweep(),
+      GetArena());
+  }
+  dedup_input_sentences_ = from.dedup_input_sentences_;
+  em_mini_batch_size_ = from.em_mini_batch_size_;
+  e_step_beam_ = from.e_step_beam_;
+  sentence_store_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_sentence_store()) {
+    sentence_store_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_sentence_store(),
+      GetArena());
+  }
+  sentence_store_dir_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_sentence_store_dir()) {
+    sentence_store_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_sentence_store_dir(),
+      GetArena());
+  }
+  keep_sentence_store_ = from.keep_sentence_store_;
+  max_memory_mb_ = from.max_memory_mb_;
+  approximate_bpe_merges_ = from.approximate_bpe_merges_;
+  e_step_window_size_ = from.e_step_window_size_;
+  distributed_timeout_sec_ = from.distributed_timeout_sec_;
+  min_piece_score_ = from.min_piece_score_;
+  max_piece_score_ = from.max_piece_score_;
   // @@protoc_insertion_point(copy_constructor:sentencepiece.TrainerSpec)
 }
 
@@ -521,6 +641,29 @@ void TrainerSpec::SharedCtor() {
   bos_id_ = 1;
   eos_id_ = 2;
   pad_id_ = -1;
+  normalized_corpus_cache_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  num_reader_threads_ = 1;
+  precompile_trie_ = false;
+  seed_sentencepiece_shard_size_ = 0;
+  incremental_e_step_tolerance_ = 0;
+  checkpoint_file_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  resume_from_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  distributed_dir_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  num_distributed_processes_ = 1;
+  distributed_process_id_ = 0;
+  vocab_size_sweep_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  dedup_input_sentences_ = false;
+  em_mini_batch_size_ = 0;
+  e_step_beam_ = 0;
+  sentence_store_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  sentence_store_dir_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  keep_sentence_store_ = false;
+  max_memory_mb_ = 0;
+  approximate_bpe_merges_ = 0;
+  e_step_window_size_ = 8192;
+  distributed_timeout_sec_ = 3600;
+  min_piece_score_ = 0;
+  max_piece_score_ = 0;
 }
 
 TrainerSpec::~TrainerSpec() {
@@ -541,6 +684,13 @@ void TrainerSpec::SharedDtor() {
   pad_piece_.DestroyNoArena(nullptr);
   pretokenization_delimiter_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
   seed_sentencepieces_file_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  normalized_corpus_cache_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  checkpoint_file_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  resume_from_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  distributed_dir_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  vocab_size_sweep_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  sentence_store_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  sentence_store_dir_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
 }
 
 void TrainerSpec::ArenaDtor(void* object) {
@@ -639,6 +789,43 @@ void TrainerSpec::Clear() {
     eos_id_ = 2;
     pad_id_ = -1;
   }
+  if (cached_has_bits & 0x00000400u) {
+    normalized_corpus_cache_.ClearNonDefaultToEmpty();
+  }
+  num_reader_threads_ = 1;
+  precompile_trie_ = false;
+  seed_sentencepiece_shard_size_ = 0;
+  incremental_e_step_tolerance_ = 0;
+  if (cached_has_bits & 0x00008000u) {
+    checkpoint_file_.ClearNonDefaultToEmpty();
+  }
+  if (cached_has_bits & 0x00010000u) {
+    resume_from_.ClearNonDefaultToEmpty();
+  }
+  if (cached_has_bits & 0x00020000u) {
+    distributed_dir_.ClearNonDefaultToEmpty();
+  }
+  num_distributed_processes_ = 1;
+  distributed_process_id_ = 0;
+  if (cached_has_bits & 0x00100000u) {
+    vocab_size_sweep_.ClearNonDefaultToEmpty();
+  }
+  dedup_input_sentences_ = false;
+  em_mini_batch_size_ = 0;
+  e_step_beam_ = 0;
+  if (cached_has_bits & 0x01000000u) {
+    sentence_store_.ClearNonDefaultToEmpty();
+  }
+  if (cached_has_bits & 0x02000000u) {
+    sentence_store_dir_.ClearNonDefaultToEmpty();
+  }
+  keep_sentence_store_ = false;
+  max_memory_mb_ = 0;
+  approximate_bpe_merges_ = 0;
+  e_step_window_size_ = 8192;
+  distributed_timeout_sec_ = 3600;
+  min_piece_score_ = 0;
+  max_piece_score_ = 0;
   _has_bits_.Clear();
   _internal_metadata_.Clear<std::string>();
 }
@@ -1042,6 +1229,190 @@ const char* TrainerSpec::_InternalParse(const char* ptr, ::PROTOBUF_NAMESPACE_ID
           CHK_(ptr);
         } else goto handle_unusual;
         continue;
+      // optional string normalized_corpus_cache = 55 [default = ""];
+      case 55:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 186)) {
+          auto str = _internal_mutable_normalized_corpus_cache();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional int32 num_reader_threads = 56 [default = 1];
+      case 56:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 192)) {
+          _Internal::set_has_num_reader_threads(&_has_bits_);
+          num_reader_threads_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional bool precompile_trie = 57 [default = false];
+      case 57:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 200)) {
+          _Internal::set_has_precompile_trie(&_has_bits_);
+          precompile_trie_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional uint64 seed_sentencepiece_shard_size = 58 [default = 0];
+      case 58:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 208)) {
+          _Internal::set_has_seed_sentencepiece_shard_size(&_has_bits_);
+          seed_sentencepiece_shard_size_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional float incremental_e_step_tolerance = 59 [default = 0];
+      case 59:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 221)) {
+          _Internal::set_has_incremental_e_step_tolerance(&_has_bits_);
+          incremental_e_step_tolerance_ = ::PROTOBUF_NAMESPACE_ID::internal::UnalignedLoad<float>(ptr);
+          ptr += sizeof(float);
+        } else goto handle_unusual;
+        continue;
+      // optional string checkpoint_file = 60 [default = ""];
+      case 60:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 226)) {
+          auto str = _internal_mutable_checkpoint_file();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional string resume_from = 61 [default = ""];
+      case 61:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 234)) {
+          auto str = _internal_mutable_resume_from();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional string distributed_dir = 62 [default = ""];
+      case 62:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 242)) {
+          auto str = _internal_mutable_distributed_dir();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional int32 num_distributed_processes = 63 [default = 1];
+      case 63:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 248)) {
+          _Internal::set_has_num_distributed_processes(&_has_bits_);
+          num_distributed_processes_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional int32 distributed_process_id = 64 [default = 0];
+      case 64:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 0)) {
+          _Internal::set_has_distributed_process_id(&_has_bits_);
+          distributed_process_id_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional string vocab_size_sweep = 65 [default = ""];
+      case 65:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 10)) {
+          auto str = _internal_mutable_vocab_size_sweep();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional bool dedup_input_sentences = 66 [default = false];
+      case 66:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 16)) {
+          _Internal::set_has_dedup_input_sentences(&_has_bits_);
+          dedup_input_sentences_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional uint64 em_mini_batch_size = 67 [default = 0];
+      case 67:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 24)) {
+          _Internal::set_has_em_mini_batch_size(&_has_bits_);
+          em_mini_batch_size_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional float e_step_beam = 68 [default = 0];
+      case 68:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 37)) {
+          _Internal::set_has_e_step_beam(&_has_bits_);
+          e_step_beam_ = ::PROTOBUF_NAMESPACE_ID::internal::UnalignedLoad<float>(ptr);
+          ptr += sizeof(float);
+        } else goto handle_unusual;
+        continue;
+      // optional string sentence_store = 69 [default = ""];
+      case 69:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 42)) {
+          auto str = _internal_mutable_sentence_store();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional string sentence_store_dir = 70 [default = ""];
+      case 70:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 50)) {
+          auto str = _internal_mutable_sentence_store_dir();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional bool keep_sentence_store = 71 [default = false];
+      case 71:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 56)) {
+          _Internal::set_has_keep_sentence_store(&_has_bits_);
+          keep_sentence_store_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional uint64 max_memory_mb = 72 [default = 0];
+      case 72:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 64)) {
+          _Internal::set_has_max_memory_mb(&_has_bits_);
+          max_memory_mb_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional int32 approximate_bpe_merges = 73 [default = 0];
+      case 73:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 72)) {
+          _Internal::set_has_approximate_bpe_merges(&_has_bits_);
+          approximate_bpe_merges_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional int32 e_step_window_size = 74 [default = 8192];
+      case 74:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 80)) {
+          _Internal::set_has_e_step_window_size(&_has_bits_);
+          e_step_window_size_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional int32 distributed_timeout_sec = 75 [default = 3600];
+      case 75:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 88)) {
+          _Internal::set_has_distributed_timeout_sec(&_has_bits_);
+          distributed_timeout_sec_ = ::PROTOBUF_NAMESPACE_ID::internal::ReadVarint64(&ptr);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
+      // optional float min_piece_score = 76;
+      case 76:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 101)) {
+          _Internal::set_has_min_piece_score(&_has_bits_);
+          min_piece_score_ = ::PROTOBUF_NAMESPACE_ID::internal::UnalignedLoad<float>(ptr);
+          ptr += sizeof(float);
+        } else goto handle_unusual;
+        continue;
+      // optional float max_piece_score = 77;
+      case 77:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 109)) {
+          _Internal::set_has_max_piece_score(&_has_bits_);
+          max_piece_score_ = ::PROTOBUF_NAMESPACE_ID::internal::UnalignedLoad<float>(ptr);
+          ptr += sizeof(float);
+        } else goto handle_unusual;
+        continue;
       default: {
       handle_unusual:
         if ((tag & 7) == 4 || tag == 0) {
@@ -1360,6 +1731,144 @@ failure:
         54, this->_internal_seed_sentencepieces_file(), target);
   }
 
+  // optional string normalized_corpus_cache = 55 [default = ""];
+  if (_internal_has_normalized_corpus_cache()) {
+    target = stream->WriteStringMaybeAliased(
+        55, this->_internal_normalized_corpus_cache(), target);
+  }
+
+  // optional int32 num_reader_threads = 56 [default = 1];
+  if (_internal_has_num_reader_threads()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteInt32ToArray(56, this->_internal_num_reader_threads(), target);
+  }
+
+  // optional bool precompile_trie = 57 [default = false];
+  if (_internal_has_precompile_trie()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteBoolToArray(57, this->_internal_precompile_trie(), target);
+  }
+
+  // optional uint64 seed_sentencepiece_shard_size = 58 [default = 0];
+  if (_internal_has_seed_sentencepiece_shard_size()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteUInt64ToArray(58, this->_internal_seed_sentencepiece_shard_size(), target);
+  }
+
+  // optional float incremental_e_step_tolerance = 59 [default = 0];
+  if (_internal_has_incremental_e_step_tolerance()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteFloatToArray(59, this->_internal_incremental_e_step_tolerance(), target);
+  }
+
+  // optional string checkpoint_file = 60 [default = ""];
+  if (_internal_has_checkpoint_file()) {
+    target = stream->WriteStringMaybeAliased(
+        60, this->_internal_checkpoint_file(), target);
+  }
+
+  // optional string resume_from = 61 [default = ""];
+  if (_internal_has_resume_from()) {
+    target = stream->WriteStringMaybeAliased(
+        61, this->_internal_resume_from(), target);
+  }
+
+  // optional string distributed_dir = 62 [default = ""];
+  if (_internal_has_distributed_dir()) {
+    target = stream->WriteStringMaybeAliased(
+        62, this->_internal_distributed_dir(), target);
+  }
+
+  // optional int32 num_distributed_processes = 63 [default = 1];
+  if (_internal_has_num_distributed_processes()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteInt32ToArray(63, this->_internal_num_distributed_processes(), target);
+  }
+
+  // optional int32 distributed_process_id = 64 [default = 0];
+  if (_internal_has_distributed_process_id()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteInt32ToArray(64, this->_internal_distributed_process_id(), target);
+  }
+
+  // optional string vocab_size_sweep = 65 [default = ""];
+  if (_internal_has_vocab_size_sweep()) {
+    target = stream->WriteStringMaybeAliased(
+        65, this->_internal_vocab_size_sweep(), target);
+  }
+
+  // optional bool dedup_input_sentences = 66 [default = false];
+  if (_internal_has_dedup_input_sentences()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteBoolToArray(66, this->_internal_dedup_input_sentences(), target);
+  }
+
+  // optional uint64 em_mini_batch_size = 67 [default = 0];
+  if (_internal_has_em_mini_batch_size()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteUInt64ToArray(67, this->_internal_em_mini_batch_size(), target);
+  }
+
+  // optional float e_step_beam = 68 [default = 0];
+  if (_internal_has_e_step_beam()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteFloatToArray(68, this->_internal_e_step_beam(), target);
+  }
+
+  // optional string sentence_store = 69 [default = ""];
+  if (_internal_has_sentence_store()) {
+    target = stream->WriteStringMaybeAliased(
+        69, this->_internal_sentence_store(), target);
+  }
+
+  // optional string sentence_store_dir = 70 [default = ""];
+  if (_internal_has_sentence_store_dir()) {
+    target = stream->WriteStringMaybeAliased(
+        70, this->_internal_sentence_store_dir(), target);
+  }
+
+  // optional bool keep_sentence_store = 71 [default = false];
+  if (_internal_has_keep_sentence_store()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteBoolToArray(71, this->_internal_keep_sentence_store(), target);
+  }
+
+  // optional uint64 max_memory_mb = 72 [default = 0];
+  if (_internal_has_max_memory_mb()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteUInt64ToArray(72, this->_internal_max_memory_mb(), target);
+  }
+
+  // optional int32 approximate_bpe_merges = 73 [default = 0];
+  if (_internal_has_approximate_bpe_merges()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteInt32ToArray(73, this->_internal_approximate_bpe_merges(), target);
+  }
+
+  // optional int32 e_step_window_size = 74 [default = 8192];
+  if (_internal_has_e_step_window_size()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteInt32ToArray(74, this->_internal_e_step_window_size(), target);
+  }
+
+  // optional int32 distributed_timeout_sec = 75 [default = 3600];
+  if (_internal_has_distributed_timeout_sec()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteInt32ToArray(75, this->_internal_distributed_timeout_sec(), target);
+  }
+
+  // optional float min_piece_score = 76;
+  if (_internal_has_min_piece_score()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteFloatToArray(76, this->_internal_min_piece_score(), target);
+  }
+
+  // optional float max_piece_score = 77;
+  if (_internal_has_max_piece_score()) {
+    target = stream->EnsureSpace(target);
+    target = ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::WriteFloatToArray(77, this->_internal_max_piece_score(), target);
+  }
+
   // Extension range [200, 536870912)
   target = _extensions_._InternalSerialize(
       200, 536870912, target, stream);
@@ -1689,6 +2198,153 @@ size_t TrainerSpec::ByteSizeLong() const {
     }
 
   }
+  // optional string normalized_corpus_cache = 55 [default = ""];
+  if (_internal_has_normalized_corpus_cache()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_normalized_corpus_cache());
+  }
+
+  // optional int32 num_reader_threads = 56 [default = 1];
+  if (_internal_has_num_reader_threads()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::Int32Size(
+          this->_internal_num_reader_threads());
+  }
+
+  // optional bool precompile_trie = 57 [default = false];
+  if (_internal_has_precompile_trie()) {
+    total_size += 2 + 1;
+  }
+
+  // optional uint64 seed_sentencepiece_shard_size = 58 [default = 0];
+  if (_internal_has_seed_sentencepiece_shard_size()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::UInt64Size(
+          this->_internal_seed_sentencepiece_shard_size());
+  }
+
+  // optional float incremental_e_step_tolerance = 59 [default = 0];
+  if (_internal_has_incremental_e_step_tolerance()) {
+    total_size += 2 + 4;
+  }
+
+  // optional string checkpoint_file = 60 [default = ""];
+  if (_internal_has_checkpoint_file()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_checkpoint_file());
+  }
+
+  // optional string resume_from = 61 [default = ""];
+  if (_internal_has_resume_from()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_resume_from());
+  }
+
+  // optional string distributed_dir = 62 [default = ""];
+  if (_internal_has_distributed_dir()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_distributed_dir());
+  }
+
+  // optional int32 num_distributed_processes = 63 [default = 1];
+  if (_internal_has_num_distributed_processes()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::Int32Size(
+          this->_internal_num_distributed_processes());
+  }
+
+  // optional int32 distributed_process_id = 64 [default = 0];
+  if (_internal_has_distributed_process_id()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::Int32Size(
+          this->_internal_distributed_process_id());
+  }
+
+  // optional string vocab_size_sweep = 65 [default = ""];
+  if (_internal_has_vocab_size_sweep()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_vocab_size_sweep());
+  }
+
+  // optional bool dedup_input_sentences = 66 [default = false];
+  if (_internal_has_dedup_input_sentences()) {
+    total_size += 2 + 1;
+  }
+
+  // optional uint64 em_mini_batch_size = 67 [default = 0];
+  if (_internal_has_em_mini_batch_size()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::UInt64Size(
+          this->_internal_em_mini_batch_size());
+  }
+
+  // optional float e_step_beam = 68 [default = 0];
+  if (_internal_has_e_step_beam()) {
+    total_size += 2 + 4;
+  }
+
+  // optional string sentence_store = 69 [default = ""];
+  if (_internal_has_sentence_store()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_sentence_store());
+  }
+
+  // optional string sentence_store_dir = 70 [default = ""];
+  if (_internal_has_sentence_store_dir()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::StringSize(
+          this->_internal_sentence_store_dir());
+  }
+
+  // optional bool keep_sentence_store = 71 [default = false];
+  if (_internal_has_keep_sentence_store()) {
+    total_size += 2 + 1;
+  }
+
+  // optional uint64 max_memory_mb = 72 [default = 0];
+  if (_internal_has_max_memory_mb()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::UInt64Size(
+          this->_internal_max_memory_mb());
+  }
+
+  // optional int32 approximate_bpe_merges = 73 [default = 0];
+  if (_internal_has_approximate_bpe_merges()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::Int32Size(
+          this->_internal_approximate_bpe_merges());
+  }
+
+  // optional int32 e_step_window_size = 74 [default = 8192];
+  if (_internal_has_e_step_window_size()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::Int32Size(
+          this->_internal_e_step_window_size());
+  }
+
+  // optional int32 distributed_timeout_sec = 75 [default = 3600];
+  if (_internal_has_distributed_timeout_sec()) {
+    total_size += 2 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::Int32Size(
+          this->_internal_distributed_timeout_sec());
+  }
+
+  // optional float min_piece_score = 76;
+  if (_internal_has_min_piece_score()) {
+    total_size += 2 + 4;
+  }
+
+  // optional float max_piece_score = 77;
+  if (_internal_has_max_piece_score()) {
+    total_size += 2 + 4;
+  }
+
   if (PROTOBUF_PREDICT_FALSE(_internal_metadata_.have_unknown_fields())) {
     total_size += _internal_metadata_.unknown_fields<std::string>(::PROTOBUF_NAMESPACE_ID::internal::GetEmptyString).size();
   }
@@ -1860,6 +2516,75 @@ void TrainerSpec::MergeFrom(const TrainerSpec& from) {
     }
     _has_bits_[1] |= cached_has_bits;
   }
+  if (from._internal_has_normalized_corpus_cache()) {
+    _internal_set_normalized_corpus_cache(from._internal_normalized_corpus_cache());
+  }
+  if (from._internal_has_num_reader_threads()) {
+    _internal_set_num_reader_threads(from._internal_num_reader_threads());
+  }
+  if (from._internal_has_precompile_trie()) {
+    _internal_set_precompile_trie(from._internal_precompile_trie());
+  }
+  if (from._internal_has_seed_sentencepiece_shard_size()) {
+    _internal_set_seed_sentencepiece_shard_size(from._internal_seed_sentencepiece_shard_size());
+  }
+  if (from._internal_has_incremental_e_step_tolerance()) {
+    _internal_set_incremental_e_step_tolerance(from._internal_incremental_e_step_tolerance());
+  }
+  if (from._internal_has_checkpoint_file()) {
+    _internal_set_checkpoint_file(from._internal_checkpoint_file());
+  }
+  if (from._internal_has_resume_from()) {
+    _internal_set_resume_from(from._internal_resume_from());
+  }
+  if (from._internal_has_distributed_dir()) {
+    _internal_set_distributed_dir(from._internal_distributed_dir());
+  }
+  if (from._internal_has_num_distributed_processes()) {
+    _internal_set_num_distributed_processes(from._internal_num_distributed_processes());
+  }
+  if (from._internal_has_distributed_process_id()) {
+    _internal_set_distributed_process_id(from._internal_distributed_process_id());
+  }
+  if (from._internal_has_vocab_size_sweep()) {
+    _internal_set_vocab_size_sweep(from._internal_vocab_size_sweep());
+  }
+  if (from._internal_has_dedup_input_sentences()) {
+    _internal_set_dedup_input_sentences(from._internal_dedup_input_sentences());
+  }
+  if (from._internal_has_em_mini_batch_size()) {
+    _internal_set_em_mini_batch_size(from._internal_em_mini_batch_size());
+  }
+  if (from._internal_has_e_step_beam()) {
+    _internal_set_e_step_beam(from._internal_e_step_beam());
+  }
+  if (from._internal_has_sentence_store()) {
+    _internal_set_sentence_store(from._internal_sentence_store());
+  }
+  if (from._internal_has_sentence_store_dir()) {
+    _internal_set_sentence_store_dir(from._internal_sentence_store_dir());
+  }
+  if (from._internal_has_keep_sentence_store()) {
+    _internal_set_keep_sentence_store(from._internal_keep_sentence_store());
+  }
+  if (from._internal_has_max_memory_mb()) {
+    _internal_set_max_memory_mb(from._internal_max_memory_mb());
+  }
+  if (from._internal_has_approximate_bpe_merges()) {
+    _internal_set_approximate_bpe_merges(from._internal_approximate_bpe_merges());
+  }
+  if (from._internal_has_e_step_window_size()) {
+    _internal_set_e_step_window_size(from._internal_e_step_window_size());
+  }
+  if (from._internal_has_distributed_timeout_sec()) {
+    _internal_set_distributed_timeout_sec(from._internal_distributed_timeout_sec());
+  }
+  if (from._internal_has_min_piece_score()) {
+    _internal_set_min_piece_score(from._internal_min_piece_score());
+  }
+  if (from._internal_has_max_piece_score()) {
+    _internal_set_max_piece_score(from._internal_max_piece_score());
+  }
 }
 
 void TrainerSpec::CopyFrom(const TrainerSpec& from) {
@@ -1921,6 +2646,29 @@ void TrainerSpec::InternalSwap(TrainerSpec* other) {
   swap(bos_id_, other->bos_id_);
   swap(eos_id_, other->eos_id_);
   swap(pad_id_, other->pad_id_);
+  normalized_corpus_cache_.Swap(&other->normalized_corpus_cache_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  swap(num_reader_threads_, other->num_reader_threads_);
+  swap(precompile_trie_, other->precompile_trie_);
+  swap(seed_sentencepiece_shard_size_, other->seed_sentencepiece_shard_size_);
+  swap(incremental_e_step_tolerance_, other->incremental_e_step_tolerance_);
+  checkpoint_file_.Swap(&other->checkpoint_file_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  resume_from_.Swap(&other->resume_from_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  distributed_dir_.Swap(&other->distributed_dir_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  swap(num_distributed_processes_, other->num_distributed_processes_);
+  swap(distributed_process_id_, other->distributed_process_id_);
+  vocab_size_sweep_.Swap(&other->vocab_size_sweep_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  swap(dedup_input_sentences_, other->dedup_input_sentences_);
+  swap(em_mini_batch_size_, other->em_mini_batch_size_);
+  swap(e_step_beam_, other->e_step_beam_);
+  sentence_store_.Swap(&other->sentence_store_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  sentence_store_dir_.Swap(&other->sentence_store_dir_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+  swap(keep_sentence_store_, other->keep_sentence_store_);
+  swap(max_memory_mb_, other->max_memory_mb_);
+  swap(approximate_bpe_merges_, other->approximate_bpe_merges_);
+  swap(e_step_window_size_, other->e_step_window_size_);
+  swap(distributed_timeout_sec_, other->distributed_timeout_sec_);
+  swap(min_piece_score_, other->min_piece_score_);
+  swap(max_piece_score_, other->max_piece_score_);
 }
 
 std::string TrainerSpec::GetTypeName() const {
@@ -3078,6 +3826,9 @@ class ModelProto::_Internal {
   static void set_has_denormalizer_spec(HasBits* has_bits) {
     (*has_bits)[0] |= 8u;
   }
+  static void set_has_precompiled_trie(HasBits* has_bits) {
+    (*has_bits)[0] |= 16u;
+  }
 };
 
 const ::sentencepiece::TrainerSpec&
@@ -3110,6 +3861,11 @@ ModelProto::ModelProto(const ModelProto& from)
       pieces_(from.pieces_) {
   _internal_metadata_.MergeFrom<std::string>(from._internal_metadata_);
   _extensions_.MergeFrom(from._extensions_);
+  precompiled_trie_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
+  if (from._internal_has_precompiled_trie()) {
+    precompiled_trie_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, from._internal_precompiled_trie(), 
+      GetArena());
+  }
   if (from._internal_has_trainer_spec()) {
     trainer_spec_ = new ::sentencepiece::TrainerSpec(*from.trainer_spec_);
   } else {
@@ -3135,6 +3891,7 @@ ModelProto::ModelProto(const ModelProto& from)
 
 void ModelProto::SharedCtor() {
   ::PROTOBUF_NAMESPACE_ID::internal::InitSCC(&scc_info_ModelProto_sentencepiece_5fmodel_2eproto.base);
+  precompiled_trie_.UnsafeSetDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
   ::memset(reinterpret_cast<char*>(this) + static_cast<size_t>(
       reinterpret_cast<char*>(&trainer_spec_) - reinterpret_cast<char*>(this)),
       0, static_cast<size_t>(reinterpret_cast<char*>(&denormalizer_spec_) -
@@ -3149,6 +3906,7 @@ ModelProto::~ModelProto() {
 
 void ModelProto::SharedDtor() {
   GOOGLE_DCHECK(GetArena() == nullptr);
+  precompiled_trie_.DestroyNoArena(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited());
   if (this != internal_default_instance()) delete trainer_spec_;
   if (this != internal_default_instance()) delete normalizer_spec_;
   if (this != internal_default_instance()) delete self_test_data_;
@@ -3179,7 +3937,7 @@ void ModelProto::Clear() {
   _extensions_.Clear();
   pieces_.Clear();
   cached_has_bits = _has_bits_[0];
-  if (cached_has_bits & 0x0000000fu) {
+  if (cached_has_bits & 0x0000001fu) {
     if (cached_has_bits & 0x00000001u) {
       GOOGLE_DCHECK(trainer_spec_ != nullptr);
       trainer_spec_->Clear();
@@ -3196,6 +3954,9 @@ void ModelProto::Clear() {
       GOOGLE_DCHECK(denormalizer_spec_ != nullptr);
       denormalizer_spec_->Clear();
     }
+    if (cached_has_bits & 0x00000010u) {
+      precompiled_trie_.ClearNonDefaultToEmpty();
+    }
   }
   _has_bits_.Clear();
   _internal_metadata_.Clear<std::string>();
@@ -3249,6 +4010,14 @@ const char* ModelProto::_InternalParse(const char* ptr, ::PROTOBUF_NAMESPACE_ID:
           CHK_(ptr);
         } else goto handle_unusual;
         continue;
+      // optional bytes precompiled_trie = 6;
+      case 6:
+        if (PROTOBUF_PREDICT_TRUE(static_cast<::PROTOBUF_NAMESPACE_ID::uint8>(tag) == 50)) {
+          auto str = _internal_mutable_precompiled_trie();
+          ptr = ::PROTOBUF_NAMESPACE_ID::internal::InlineGreedyStringParser(str, ptr, ctx);
+          CHK_(ptr);
+        } else goto handle_unusual;
+        continue;
       default: {
       handle_unusual:
         if ((tag & 7) == 4 || tag == 0) {
@@ -3325,6 +4094,12 @@ failure:
         5, _Internal::denormalizer_spec(this), target, stream);
   }
 
+  // optional bytes precompiled_trie = 6;
+  if (cached_has_bits & 0x00000010u) {
+    target = stream->WriteBytesMaybeAliased(
+        6, this->_internal_precompiled_trie(), target);
+  }
+
   // Extension range [200, 536870912)
   target = _extensions_._InternalSerialize(
       200, 536870912, target, stream);
@@ -3355,7 +4130,14 @@ size_t ModelProto::ByteSizeLong() const {
   }
 
   cached_has_bits = _has_bits_[0];
-  if (cached_has_bits & 0x0000000fu) {
+  if (cached_has_bits & 0x0000001fu) {
+    // optional bytes precompiled_trie = 6;
+    if (cached_has_bits & 0x00000010u) {
+      total_size += 1 +
+        ::PROTOBUF_NAMESPACE_ID::internal::WireFormatLite::BytesSize(
+          this->_internal_precompiled_trie());
+    }
+
     // optional .sentencepiece.TrainerSpec trainer_spec = 2;
     if (cached_has_bits & 0x00000001u) {
       total_size += 1 +
@@ -3409,7 +4191,10 @@ void ModelProto::MergeFrom(const ModelProto& from) {
 
   pieces_.MergeFrom(from.pieces_);
   cached_has_bits = from._has_bits_[0];
-  if (cached_has_bits & 0x0000000fu) {
+  if (cached_has_bits & 0x0000001fu) {
+    if (cached_has_bits & 0x00000010u) {
+      _internal_set_precompiled_trie(from._internal_precompiled_trie());
+    }
     if (cached_has_bits & 0x00000001u) {
       _internal_mutable_trainer_spec()->::sentencepiece::TrainerSpec::MergeFrom(from._internal_trainer_spec());
     }
@@ -3459,6 +4244,7 @@ void ModelProto::InternalSwap(ModelProto* other) {
   _internal_metadata_.Swap<std::string>(&other->_internal_metadata_);
   swap(_has_bits_[0], other->_has_bits_[0]);
   pieces_.InternalSwap(&other->pieces_);
+  precompiled_trie_.Swap(&other->precompiled_trie_, &::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
   ::PROTOBUF_NAMESPACE_ID::internal::memswap<
       PROTOBUF_FIELD_OFFSET(ModelProto, denormalizer_spec_)
       + sizeof(ModelProto::denormalizer_spec_)
@@ -307,6 +307,29 @@ class TrainerSpec PROTOBUF_FINAL :
     kBosIdFieldNumber = 41,
     kEosIdFieldNumber = 42,
     kPadIdFieldNumber = 43,
+    kNormalizedCorpusCacheFieldNumber = 55,
+    kNumReaderThreadsFieldNumber = 56,
+    kPrecompileTrieFieldNumber = 57,
+    kSeedSentencepieceShardSizeFieldNumber = 58,
+    kIncrementalEStepToleranceFieldNumber = 59,
+    kCheckpointFileFieldNumber = 60,
+    kResumeFromFieldNumber = 61,
+    kDistributedDirFieldNumber = 62,
+    kNumDistributedProcessesFieldNumber = 63,
+    kDistributedProcessIdFieldNumber = 64,
+    kVocabSizeSweepFieldNumber = 65,
+    kDedupInputSentencesFieldNumber = 66,
+    kEmMiniBatchSizeFieldNumber = 67,
+    kEStepBeamFieldNumber = 68,
+    kSentenceStoreFieldNumber = 69,
+    kSentenceStoreDirFieldNumber = 70,
+    kKeepSentenceStoreFieldNumber = 71,
+    kMaxMemoryMbFieldNumber = 72,
+    kApproximateBpeMergesFieldNumber = 73,
+    kEStepWindowSizeFieldNumber = 74,
+    kDistributedTimeoutSecFieldNumber = 75,
+    kMinPieceScoreFieldNumber = 76,
+    kMaxPieceScoreFieldNumber = 77,
   };
   // repeated string input = 1;
   int input_size() const;
@@ -1020,6 +1043,354 @@ class TrainerSpec PROTOBUF_FINAL :
   void _internal_set_pad_id(::PROTOBUF_NAMESPACE_ID::int32 value);
   public:
 
+  // optional string normalized_corpus_cache = 55 [default = ""];
+  bool has_normalized_corpus_cache() const;
+  private:
+  bool _internal_has_normalized_corpus_cache() const;
+  public:
+  void clear_normalized_corpus_cache();
+  const std::string& normalized_corpus_cache() const;
+  void set_normalized_corpus_cache(const std::string& value);
+  void set_normalized_corpus_cache(std::string&& value);
+  void set_normalized_corpus_cache(const char* value);
+  void set_normalized_corpus_cache(const char* value, size_t size);
+  std::string* mutable_normalized_corpus_cache();
+  std::string* release_normalized_corpus_cache();
+  void set_allocated_normalized_corpus_cache(std::string* normalized_corpus_cache);
+  private:
+  const std::string& _internal_normalized_corpus_cache() const;
+  void _internal_set_normalized_corpus_cache(const std::string& value);
+  std::string* _internal_mutable_normalized_corpus_cache();
+  public:
+
+  // optional int32 num_reader_threads = 56 [default = 1];
+  bool has_num_reader_threads() const;
+  private:
+  bool _internal_has_num_reader_threads() const;
+  public:
+  void clear_num_reader_threads();
+  ::PROTOBUF_NAMESPACE_ID::int32 num_reader_threads() const;
+  void set_num_reader_threads(::PROTOBUF_NAMESPACE_ID::int32 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::int32 _internal_num_reader_threads() const;
+  void _internal_set_num_reader_threads(::PROTOBUF_NAMESPACE_ID::int32 value);
+  public:
+
+  // optional bool precompile_trie = 57 [default = false];
+  bool has_precompile_trie() const;
+  private:
+  bool _internal_has_precompile_trie() const;
+  public:
+  void clear_precompile_trie();
+  bool precompile_trie() const;
+  void set_precompile_trie(bool value);
+  private:
+  bool _internal_precompile_trie() const;
+  void _internal_set_precompile_trie(bool value);
+  public:
+
+  // optional uint64 seed_sentencepiece_shard_size = 58 [default = 0];
+  bool has_seed_sentencepiece_shard_size() const;
+  private:
+  bool _internal_has_seed_sentencepiece_shard_size() const;
+  public:
+  void clear_seed_sentencepiece_shard_size();
+  ::PROTOBUF_NAMESPACE_ID::uint64 seed_sentencepiece_shard_size() const;
+  void set_seed_sentencepiece_shard_size(::PROTOBUF_NAMESPACE_ID::uint64 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::uint64 _internal_seed_sentencepiece_shard_size() const;
+  void _internal_set_seed_sentencepiece_shard_size(::PROTOBUF_NAMESPACE_ID::uint64 value);
+  public:
+
+  // optional float incremental_e_step_tolerance = 59 [default = 0];
+  bool has_incremental_e_step_tolerance() const;
+  private:
+  bool _internal_has_incremental_e_step_tolerance() const;
+  public:
+  void clear_incremental_e_step_tolerance();
+  float incremental_e_step_tolerance() const;
+  void set_incremental_e_step_tolerance(float value);
+  private:
+  float _internal_incremental_e_step_tolerance() const;
+  void _internal_set_incremental_e_step_tolerance(float value);
+  public:
+
+  // optional string checkpoint_file = 60 [default = ""];
+  bool has_checkpoint_file() const;
+  private:
+  bool _internal_has_checkpoint_file() const;
+  public:
+  void clear_checkpoint_file();
+  const std::string& checkpoint_file() const;
+  void set_checkpoint_file(const std::string& value);
+  void set_checkpoint_file(std::string&& value);
+  void set_checkpoint_file(const char* value);
+  void set_checkpoint_file(const char* value, size_t size);
+  std::string* mutable_checkpoint_file();
+  std::string* release_checkpoint_file();
+  void set_allocated_checkpoint_file(std::string* checkpoint_file);
+  private:
+  const std::string& _internal_checkpoint_file() const;
+  void _internal_set_checkpoint_file(const std::string& value);
+  std::string* _internal_mutable_checkpoint_file();
+  public:
+
+  // optional string resume_from = 61 [default = ""];
+  bool has_resume_from() const;
+  private:
+  bool _internal_has_resume_from() const;
+  public:
+  void clear_resume_from();
+  const std::string& resume_from() const;
+  void set_resume_from(const std::string& value);
+  void set_resume_from(std::string&& value);
+  void set_resume_from(const char* value);
+  void set_resume_from(const char* value, size_t size);
+  std::string* mutable_resume_from();
+  std::string* release_resume_from();
+  void set_allocated_resume_from(std::string* resume_from);
+  private:
+  const std::string& _internal_resume_from() const;
+  void _internal_set_resume_from(const std::string& value);
+  std::string* _internal_mutable_resume_from();
+  public:
+
+  // optional string distributed_dir = 62 [default = ""];
+  bool has_distributed_dir() const;
+  private:
+  bool _internal_has_distributed_dir() const;
+  public:
+  void clear_distributed_dir();
+  const std::string& distributed_dir() const;
+  void set_distributed_dir(const std::string& value);
+  void set_distributed_dir(std::string&& value);
+  void set_distributed_dir(const char* value);
+  void set_distributed_dir(const char* value, size_t size);
+  std::string* mutable_distributed_dir();
+  std::string* release_distributed_dir();
+  void set_allocated_distributed_dir(std::string* distributed_dir);
+  private:
+  const std::string& _internal_distributed_dir() const;
+  void _internal_set_distributed_dir(const std::string& value);
+  std::string* _internal_mutable_distributed_dir();
+  public:
+
+  // optional int32 num_distributed_processes = 63 [default = 1];
+  bool has_num_distributed_processes() const;
+  private:
+  bool _internal_has_num_distributed_processes() const;
+  public:
+  void clear_num_distributed_processes();
+  ::PROTOBUF_NAMESPACE_ID::int32 num_distributed_processes() const;
+  void set_num_distributed_processes(::PROTOBUF_NAMESPACE_ID::int32 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::int32 _internal_num_distributed_processes() const;
+  void _internal_set_num_distributed_processes(::PROTOBUF_NAMESPACE_ID::int32 value);
+  public:
+
+  // optional int32 distributed_process_id = 64 [default = 0];
+  bool has_distributed_process_id() const;
+  private:
+  bool _internal_has_distributed_process_id() const;
+  public:
+  void clear_distributed_process_id();
+  ::PROTOBUF_NAMESPACE_ID::int32 distributed_process_id() const;
+  void set_distributed_process_id(::PROTOBUF_NAMESPACE_ID::int32 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::int32 _internal_distributed_process_id() const;
+  void _internal_set_distributed_process_id(::PROTOBUF_NAMESPACE_ID::int32 value);
+  public:
+
+  // optional string vocab_size_sweep = 65 [default = ""];
+  bool has_vocab_size_sweep() const;
+  private:
+  bool _internal_has_vocab_size_sweep() const;
+  public:
+  void clear_vocab_size_sweep();
+  const std::string& vocab_size_sweep() const;
+  void set_vocab_size_sweep(const std::string& value);
+  void set_vocab_size_sweep(std::string&& value);
+  void set_vocab_size_sweep(const char* value);
+  void set_vocab_size_sweep(const char* value, size_t size);
+  std::string* mutable_vocab_size_sweep();
+  std::string* release_vocab_size_sweep();
+  void set_allocated_vocab_size_sweep(std::string* vocab_size_sweep);
+  private:
+  const std::string& _internal_vocab_size_sweep() const;
+  void _internal_set_vocab_size_sweep(const std::string& value);
+  std::string* _internal_mutable_vocab_size_sweep();
+  public:
+
+  // optional bool dedup_input_sentences = 66 [default = false];
+  bool has_dedup_input_sentences() const;
+  private:
+  bool _internal_has_dedup_input_sentences() const;
+  public:
+  void clear_dedup_input_sentences();
+  bool dedup_input_sentences() const;
+  void set_dedup_input_sentences(bool value);
+  private:
+  bool _internal_dedup_input_sentences() const;
+  void _internal_set_dedup_input_sentences(bool value);
+  public:
+
+  // optional uint64 em_mini_batch_size = 67 [default = 0];
+  bool has_em_mini_batch_size() const;
+  private:
+  bool _internal_has_em_mini_batch_size() const;
+  public:
+  void clear_em_mini_batch_size();
+  ::PROTOBUF_NAMESPACE_ID::uint64 em_mini_batch_size() const;
+  void set_em_mini_batch_size(::PROTOBUF_NAMESPACE_ID::uint64 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::uint64 _internal_em_mini_batch_size() const;
+  void _internal_set_em_mini_batch_size(::PROTOBUF_NAMESPACE_ID::uint64 value);
+  public:
+
+  // optional float e_step_beam = 68 [default = 0];
+  bool has_e_step_beam() const;
+  private:
+  bool _internal_has_e_step_beam() const;
+  public:
+  void clear_e_step_beam();
+  float e_step_beam() const;
+  void set_e_step_beam(float value);
+  private:
+  float _internal_e_step_beam() const;
+  void _internal_set_e_step_beam(float value);
+  public:
+
+  // optional string sentence_store = 69 [default = ""];
+  bool has_sentence_store() const;
+  private:
+  bool _internal_has_sentence_store() const;
+  public:
+  void clear_sentence_store();
+  const std::string& sentence_store() const;
+  void set_sentence_store(const std::string& value);
+  void set_sentence_store(std::string&& value);
+  void set_sentence_store(const char* value);
+  void set_sentence_store(const char* value, size_t size);
+  std::string* mutable_sentence_store();
+  std::string* release_sentence_store();
+  void set_allocated_sentence_store(std::string* sentence_store);
+  private:
+  const std::string& _internal_sentence_store() const;
+  void _internal_set_sentence_store(const std::string& value);
+  std::string* _internal_mutable_sentence_store();
+  public:
+
+  // optional string sentence_store_dir = 70 [default = ""];
+  bool has_sentence_store_dir() const;
+  private:
+  bool _internal_has_sentence_store_dir() const;
+  public:
+  void clear_sentence_store_dir();
+  const std::string& sentence_store_dir() const;
+  void set_sentence_store_dir(const std::string& value);
+  void set_sentence_store_dir(std::string&& value);
+  void set_sentence_store_dir(const char* value);
+  void set_sentence_store_dir(const char* value, size_t size);
+  std::string* mutable_sentence_store_dir();
+  std::string* release_sentence_store_dir();
+  void set_allocated_sentence_store_dir(std::string* sentence_store_dir);
+  private:
+  const std::string& _internal_sentence_store_dir() const;
+  void _internal_set_sentence_store_dir(const std::string& value);
+  std::string* _internal_mutable_sentence_store_dir();
+  public:
+
+  // optional bool keep_sentence_store = 71 [default = false];
+  bool has_keep_sentence_store() const;
+  private:
+  bool _internal_has_keep_sentence_store() const;
+  public:
+  void clear_keep_sentence_store();
+  bool keep_sentence_store() const;
+  void set_keep_sentence_store(bool value);
+  private:
+  bool _internal_keep_sentence_store() const;
+  void _internal_set_keep_sentence_store(bool value);
+  public:
+
+  // optional uint64 max_memory_mb = 72 [default = 0];
+  bool has_max_memory_mb() const;
+  private:
+  bool _internal_has_max_memory_mb() const;
+  public:
+  void clear_max_memory_mb();
+  ::PROTOBUF_NAMESPACE_ID::uint64 max_memory_mb() const;
+  void set_max_memory_mb(::PROTOBUF_NAMESPACE_ID::uint64 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::uint64 _internal_max_memory_mb() const;
+  void _internal_set_max_memory_mb(::PROTOBUF_NAMESPACE_ID::uint64 value);
+  public:
+
+  // optional int32 approximate_bpe_merges = 73 [default = 0];
+  bool has_approximate_bpe_merges() const;
+  private:
+  bool _internal_has_approximate_bpe_merges() const;
+  public:
+  void clear_approximate_bpe_merges();
+  ::PROTOBUF_NAMESPACE_ID::int32 approximate_bpe_merges() const;
+  void set_approximate_bpe_merges(::PROTOBUF_NAMESPACE_ID::int32 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::int32 _internal_approximate_bpe_merges() const;
+  void _internal_set_approximate_bpe_merges(::PROTOBUF_NAMESPACE_ID::int32 value);
+  public:
+
+  // optional int32 e_step_window_size = 74 [default = 8192];
+  bool has_e_step_window_size() const;
+  private:
+  bool _internal_has_e_step_window_size() const;
+  public:
+  void clear_e_step_window_size();
+  ::PROTOBUF_NAMESPACE_ID::int32 e_step_window_size() const;
+  void set_e_step_window_size(::PROTOBUF_NAMESPACE_ID::int32 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::int32 _internal_e_step_window_size() const;
+  void _internal_set_e_step_window_size(::PROTOBUF_NAMESPACE_ID::int32 value);
+  public:
+
+  // optional int32 distributed_timeout_sec = 75 [default = 3600];
+  bool has_distributed_timeout_sec() const;
+  private:
+  bool _internal_has_distributed_timeout_sec() const;
+  public:
+  void clear_distributed_timeout_sec();
+  ::PROTOBUF_NAMESPACE_ID::int32 distributed_timeout_sec() const;
+  void set_distributed_timeout_sec(::PROTOBUF_NAMESPACE_ID::int32 value);
+  private:
+  ::PROTOBUF_NAMESPACE_ID::int32 _internal_distributed_timeout_sec() const;
+  void _internal_set_distributed_timeout_sec(::PROTOBUF_NAMESPACE_ID::int32 value);
+  public:
+
+  // optional float min_piece_score = 76;
+  bool has_min_piece_score() const;
+  private:
+  bool _internal_has_min_piece_score() const;
+  public:
+  void clear_min_piece_score();
+  float min_piece_score() const;
+  void set_min_piece_score(float value);
+  private:
+  float _internal_min_piece_score() const;
+  void _internal_set_min_piece_score(float value);
+  public:
+
+  // optional float max_piece_score = 77;
+  bool has_max_piece_score() const;
+  private:
+  bool _internal_has_max_piece_score() const;
+  public:
+  void clear_max_piece_score();
+  float max_piece_score() const;
+  void set_max_piece_score(float value);
+  private:
+  float _internal_max_piece_score() const;
+  void _internal_set_max_piece_score(float value);
+  public:
+
   GOOGLE_PROTOBUF_EXTENSION_ACCESSORS(TrainerSpec)
   // @@protoc_insertion_point(class_scope:sentencepiece.TrainerSpec)
  private:
@@ -1030,7 +1401,7 @@ class TrainerSpec PROTOBUF_FINAL :
   template <typename T> friend class ::PROTOBUF_NAMESPACE_ID::Arena::InternalHelper;
   typedef void InternalArenaConstructable_;
   typedef void DestructorSkippable_;
-  ::PROTOBUF_NAMESPACE_ID::internal::HasBits<2> _has_bits_;
+  ::PROTOBUF_NAMESPACE_ID::internal::HasBits<3> _has_bits_;
   mutable ::PROTOBUF_NAMESPACE_ID::internal::CachedSize _cached_size_;
   ::PROTOBUF_NAMESPACE_ID::RepeatedPtrField<std::string> input_;
   ::PROTOBUF_NAMESPACE_ID::RepeatedPtrField<std::string> accept_language_;
@@ -1083,6 +1454,29 @@ class TrainerSpec PROTOBUF_FINAL :
   ::PROTOBUF_NAMESPACE_ID::int32 bos_id_;
   ::PROTOBUF_NAMESPACE_ID::int32 eos_id_;
   ::PROTOBUF_NAMESPACE_ID::int32 pad_id_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr normalized_corpus_cache_;
+  ::PROTOBUF_NAMESPACE_ID::int32 num_reader_threads_;
+  bool precompile_trie_;
+  ::PROTOBUF_NAMESPACE_ID::uint64 seed_sentencepiece_shard_size_;
+  float incremental_e_step_tolerance_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr checkpoint_file_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr resume_from_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr distributed_dir_;
+  ::PROTOBUF_NAMESPACE_ID::int32 num_distributed_processes_;
+  ::PROTOBUF_NAMESPACE_ID::int32 distributed_process_id_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr vocab_size_sweep_;
+  bool dedup_input_sentences_;
+  ::PROTOBUF_NAMESPACE_ID::uint64 em_mini_batch_size_;
+  float e_step_beam_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr sentence_store_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr sentence_store_dir_;
+  bool keep_sentence_store_;
+  ::PROTOBUF_NAMESPACE_ID::uint64 max_memory_mb_;
+  ::PROTOBUF_NAMESPACE_ID::int32 approximate_bpe_merges_;
+  ::PROTOBUF_NAMESPACE_ID::int32 e_step_window_size_;
+  ::PROTOBUF_NAMESPACE_ID::int32 distributed_timeout_sec_;
+  float min_piece_score_;
+  float max_piece_score_;
   friend struct ::TableStruct_sentencepiece_5fmodel_2eproto;
 };
 // -------------------------------------------------------------------
@@ -1940,6 +2334,7 @@ class ModelProto PROTOBUF_FINAL :
     kTrainerSpecFieldNumber = 2,
     kNormalizerSpecFieldNumber = 3,
     kSelfTestDataFieldNumber = 4,
+    kPrecompiledTrieFieldNumber = 6,
     kDenormalizerSpecFieldNumber = 5,
   };
   // repeated .sentencepiece.ModelProto.SentencePiece pieces = 1;
@@ -1960,6 +2355,26 @@ class ModelProto PROTOBUF_FINAL :
   const ::PROTOBUF_NAMESPACE_ID::RepeatedPtrField< ::sentencepiece::ModelProto_SentencePiece >&
       pieces() const;
 
+  // optional bytes precompiled_trie = 6;
+  bool has_precompiled_trie() const;
+  private:
+  bool _internal_has_precompiled_trie() const;
+  public:
+  void clear_precompiled_trie();
+  const std::string& precompiled_trie() const;
+  void set_precompiled_trie(const std::string& value);
+  void set_precompiled_trie(std::string&& value);
+  void set_precompiled_trie(const char* value);
+  void set_precompiled_trie(const void* value, size_t size);
+  std::string* mutable_precompiled_trie();
+  std::string* release_precompiled_trie();
+  void set_allocated_precompiled_trie(std::string* precompiled_trie);
+  private:
+  const std::string& _internal_precompiled_trie() const;
+  void _internal_set_precompiled_trie(const std::string& value);
+  std::string* _internal_mutable_precompiled_trie();
+  public:
+
   // optional .sentencepiece.TrainerSpec trainer_spec = 2;
   bool has_trainer_spec() const;
   private:
@@ -2045,6 +2460,7 @@ class ModelProto PROTOBUF_FINAL :
   ::PROTOBUF_NAMESPACE_ID::internal::HasBits<1> _has_bits_;
   mutable ::PROTOBUF_NAMESPACE_ID::internal::CachedSize _cached_size_;
   ::PROTOBUF_NAMESPACE_ID::RepeatedPtrField< ::sentencepiece::ModelProto_SentencePiece > pieces_;
+  ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr precompiled_trie_;
   ::sentencepiece::TrainerSpec* trainer_spec_;
   ::sentencepiece::NormalizerSpec* normalizer_spec_;
   ::sentencepiece::SelfTestData* self_test_data_;
@@ -3990,6 +4406,965 @@ inline void TrainerSpec::set_allocated_seed_sentencepieces_file(std::string* see
   // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.seed_sentencepieces_file)
 }
 
+// optional string normalized_corpus_cache = 55 [default = ""];
+inline bool TrainerSpec::_internal_has_normalized_corpus_cache() const {
+  bool value = (_has_bits_[1] & 0x00000400u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_normalized_corpus_cache() const {
+  return _internal_has_normalized_corpus_cache();
+}
+inline void TrainerSpec::clear_normalized_corpus_cache() {
+  normalized_corpus_cache_.ClearToEmpty();
+  _has_bits_[1] &= ~0x00000400u;
+}
+inline const std::string& TrainerSpec::normalized_corpus_cache() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.normalized_corpus_cache)
+  return _internal_normalized_corpus_cache();
+}
+inline void TrainerSpec::set_normalized_corpus_cache(const std::string& value) {
+  _internal_set_normalized_corpus_cache(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.normalized_corpus_cache)
+}
+inline std::string* TrainerSpec::mutable_normalized_corpus_cache() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.normalized_corpus_cache)
+  return _internal_mutable_normalized_corpus_cache();
+}
+inline const std::string& TrainerSpec::_internal_normalized_corpus_cache() const {
+  return normalized_corpus_cache_.Get();
+}
+inline void TrainerSpec::_internal_set_normalized_corpus_cache(const std::string& value) {
+  _has_bits_[1] |= 0x00000400u;
+  normalized_corpus_cache_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_normalized_corpus_cache(std::string&& value) {
+  _has_bits_[1] |= 0x00000400u;
+  normalized_corpus_cache_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.normalized_corpus_cache)
+}
+inline void TrainerSpec::set_normalized_corpus_cache(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x00000400u;
+  normalized_corpus_cache_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.normalized_corpus_cache)
+}
+inline void TrainerSpec::set_normalized_corpus_cache(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x00000400u;
+  normalized_corpus_cache_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.normalized_corpus_cache)
+}
+inline std::string* TrainerSpec::_internal_mutable_normalized_corpus_cache() {
+  _has_bits_[1] |= 0x00000400u;
+  return normalized_corpus_cache_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_normalized_corpus_cache() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.normalized_corpus_cache)
+  if (!_internal_has_normalized_corpus_cache()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x00000400u;
+  return normalized_corpus_cache_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_normalized_corpus_cache(std::string* normalized_corpus_cache) {
+  if (normalized_corpus_cache != nullptr) {
+    _has_bits_[1] |= 0x00000400u;
+  } else {
+    _has_bits_[1] &= ~0x00000400u;
+  }
+  normalized_corpus_cache_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), normalized_corpus_cache,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.normalized_corpus_cache)
+}
+
+// optional int32 num_reader_threads = 56 [default = 1];
+inline bool TrainerSpec::_internal_has_num_reader_threads() const {
+  bool value = (_has_bits_[1] & 0x00000800u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_num_reader_threads() const {
+  return _internal_has_num_reader_threads();
+}
+inline void TrainerSpec::clear_num_reader_threads() {
+  num_reader_threads_ = 1;
+  _has_bits_[1] &= ~0x00000800u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::_internal_num_reader_threads() const {
+  return num_reader_threads_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::num_reader_threads() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.num_reader_threads)
+  return _internal_num_reader_threads();
+}
+inline void TrainerSpec::_internal_set_num_reader_threads(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _has_bits_[1] |= 0x00000800u;
+  num_reader_threads_ = value;
+}
+inline void TrainerSpec::set_num_reader_threads(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _internal_set_num_reader_threads(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.num_reader_threads)
+}
+
+// optional bool precompile_trie = 57 [default = false];
+inline bool TrainerSpec::_internal_has_precompile_trie() const {
+  bool value = (_has_bits_[1] & 0x00001000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_precompile_trie() const {
+  return _internal_has_precompile_trie();
+}
+inline void TrainerSpec::clear_precompile_trie() {
+  precompile_trie_ = false;
+  _has_bits_[1] &= ~0x00001000u;
+}
+inline bool TrainerSpec::_internal_precompile_trie() const {
+  return precompile_trie_;
+}
+inline bool TrainerSpec::precompile_trie() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.precompile_trie)
+  return _internal_precompile_trie();
+}
+inline void TrainerSpec::_internal_set_precompile_trie(bool value) {
+  _has_bits_[1] |= 0x00001000u;
+  precompile_trie_ = value;
+}
+inline void TrainerSpec::set_precompile_trie(bool value) {
+  _internal_set_precompile_trie(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.precompile_trie)
+}
+
+// optional uint64 seed_sentencepiece_shard_size = 58 [default = 0];
+inline bool TrainerSpec::_internal_has_seed_sentencepiece_shard_size() const {
+  bool value = (_has_bits_[1] & 0x00002000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_seed_sentencepiece_shard_size() const {
+  return _internal_has_seed_sentencepiece_shard_size();
+}
+inline void TrainerSpec::clear_seed_sentencepiece_shard_size() {
+  seed_sentencepiece_shard_size_ = 0;
+  _has_bits_[1] &= ~0x00002000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::uint64 TrainerSpec::_internal_seed_sentencepiece_shard_size() const {
+  return seed_sentencepiece_shard_size_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::uint64 TrainerSpec::seed_sentencepiece_shard_size() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.seed_sentencepiece_shard_size)
+  return _internal_seed_sentencepiece_shard_size();
+}
+inline void TrainerSpec::_internal_set_seed_sentencepiece_shard_size(::PROTOBUF_NAMESPACE_ID::uint64 value) {
+  _has_bits_[1] |= 0x00002000u;
+  seed_sentencepiece_shard_size_ = value;
+}
+inline void TrainerSpec::set_seed_sentencepiece_shard_size(::PROTOBUF_NAMESPACE_ID::uint64 value) {
+  _internal_set_seed_sentencepiece_shard_size(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.seed_sentencepiece_shard_size)
+}
+
+// optional float incremental_e_step_tolerance = 59 [default = 0];
+inline bool TrainerSpec::_internal_has_incremental_e_step_tolerance() const {
+  bool value = (_has_bits_[1] & 0x00004000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_incremental_e_step_tolerance() const {
+  return _internal_has_incremental_e_step_tolerance();
+}
+inline void TrainerSpec::clear_incremental_e_step_tolerance() {
+  incremental_e_step_tolerance_ = 0;
+  _has_bits_[1] &= ~0x00004000u;
+}
+inline float TrainerSpec::_internal_incremental_e_step_tolerance() const {
+  return incremental_e_step_tolerance_;
+}
+inline float TrainerSpec::incremental_e_step_tolerance() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.incremental_e_step_tolerance)
+  return _internal_incremental_e_step_tolerance();
+}
+inline void TrainerSpec::_internal_set_incremental_e_step_tolerance(float value) {
+  _has_bits_[1] |= 0x00004000u;
+  incremental_e_step_tolerance_ = value;
+}
+inline void TrainerSpec::set_incremental_e_step_tolerance(float value) {
+  _internal_set_incremental_e_step_tolerance(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.incremental_e_step_tolerance)
+}
+
+// optional string checkpoint_file = 60 [default = ""];
+inline bool TrainerSpec::_internal_has_checkpoint_file() const {
+  bool value = (_has_bits_[1] & 0x00008000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_checkpoint_file() const {
+  return _internal_has_checkpoint_file();
+}
+inline void TrainerSpec::clear_checkpoint_file() {
+  checkpoint_file_.ClearToEmpty();
+  _has_bits_[1] &= ~0x00008000u;
+}
+inline const std::string& TrainerSpec::checkpoint_file() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.checkpoint_file)
+  return _internal_checkpoint_file();
+}
+inline void TrainerSpec::set_checkpoint_file(const std::string& value) {
+  _internal_set_checkpoint_file(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.checkpoint_file)
+}
+inline std::string* TrainerSpec::mutable_checkpoint_file() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.checkpoint_file)
+  return _internal_mutable_checkpoint_file();
+}
+inline const std::string& TrainerSpec::_internal_checkpoint_file() const {
+  return checkpoint_file_.Get();
+}
+inline void TrainerSpec::_internal_set_checkpoint_file(const std::string& value) {
+  _has_bits_[1] |= 0x00008000u;
+  checkpoint_file_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_checkpoint_file(std::string&& value) {
+  _has_bits_[1] |= 0x00008000u;
+  checkpoint_file_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.checkpoint_file)
+}
+inline void TrainerSpec::set_checkpoint_file(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x00008000u;
+  checkpoint_file_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.checkpoint_file)
+}
+inline void TrainerSpec::set_checkpoint_file(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x00008000u;
+  checkpoint_file_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.checkpoint_file)
+}
+inline std::string* TrainerSpec::_internal_mutable_checkpoint_file() {
+  _has_bits_[1] |= 0x00008000u;
+  return checkpoint_file_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_checkpoint_file() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.checkpoint_file)
+  if (!_internal_has_checkpoint_file()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x00008000u;
+  return checkpoint_file_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_checkpoint_file(std::string* checkpoint_file) {
+  if (checkpoint_file != nullptr) {
+    _has_bits_[1] |= 0x00008000u;
+  } else {
+    _has_bits_[1] &= ~0x00008000u;
+  }
+  checkpoint_file_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), checkpoint_file,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.checkpoint_file)
+}
+
+// optional string resume_from = 61 [default = ""];
+inline bool TrainerSpec::_internal_has_resume_from() const {
+  bool value = (_has_bits_[1] & 0x00010000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_resume_from() const {
+  return _internal_has_resume_from();
+}
+inline void TrainerSpec::clear_resume_from() {
+  resume_from_.ClearToEmpty();
+  _has_bits_[1] &= ~0x00010000u;
+}
+inline const std::string& TrainerSpec::resume_from() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.resume_from)
+  return _internal_resume_from();
+}
+inline void TrainerSpec::set_resume_from(const std::string& value) {
+  _internal_set_resume_from(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.resume_from)
+}
+inline std::string* TrainerSpec::mutable_resume_from() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.resume_from)
+  return _internal_mutable_resume_from();
+}
+inline const std::string& TrainerSpec::_internal_resume_from() const {
+  return resume_from_.Get();
+}
+inline void TrainerSpec::_internal_set_resume_from(const std::string& value) {
+  _has_bits_[1] |= 0x00010000u;
+  resume_from_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_resume_from(std::string&& value) {
+  _has_bits_[1] |= 0x00010000u;
+  resume_from_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.resume_from)
+}
+inline void TrainerSpec::set_resume_from(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x00010000u;
+  resume_from_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.resume_from)
+}
+inline void TrainerSpec::set_resume_from(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x00010000u;
+  resume_from_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.resume_from)
+}
+inline std::string* TrainerSpec::_internal_mutable_resume_from() {
+  _has_bits_[1] |= 0x00010000u;
+  return resume_from_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_resume_from() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.resume_from)
+  if (!_internal_has_resume_from()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x00010000u;
+  return resume_from_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_resume_from(std::string* resume_from) {
+  if (resume_from != nullptr) {
+    _has_bits_[1] |= 0x00010000u;
+  } else {
+    _has_bits_[1] &= ~0x00010000u;
+  }
+  resume_from_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), resume_from,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.resume_from)
+}
+
+// optional string distributed_dir = 62 [default = ""];
+inline bool TrainerSpec::_internal_has_distributed_dir() const {
+  bool value = (_has_bits_[1] & 0x00020000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_distributed_dir() const {
+  return _internal_has_distributed_dir();
+}
+inline void TrainerSpec::clear_distributed_dir() {
+  distributed_dir_.ClearToEmpty();
+  _has_bits_[1] &= ~0x00020000u;
+}
+inline const std::string& TrainerSpec::distributed_dir() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.distributed_dir)
+  return _internal_distributed_dir();
+}
+inline void TrainerSpec::set_distributed_dir(const std::string& value) {
+  _internal_set_distributed_dir(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.distributed_dir)
+}
+inline std::string* TrainerSpec::mutable_distributed_dir() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.distributed_dir)
+  return _internal_mutable_distributed_dir();
+}
+inline const std::string& TrainerSpec::_internal_distributed_dir() const {
+  return distributed_dir_.Get();
+}
+inline void TrainerSpec::_internal_set_distributed_dir(const std::string& value) {
+  _has_bits_[1] |= 0x00020000u;
+  distributed_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_distributed_dir(std::string&& value) {
+  _has_bits_[1] |= 0x00020000u;
+  distributed_dir_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.distributed_dir)
+}
+inline void TrainerSpec::set_distributed_dir(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x00020000u;
+  distributed_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.distributed_dir)
+}
+inline void TrainerSpec::set_distributed_dir(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x00020000u;
+  distributed_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.distributed_dir)
+}
+inline std::string* TrainerSpec::_internal_mutable_distributed_dir() {
+  _has_bits_[1] |= 0x00020000u;
+  return distributed_dir_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_distributed_dir() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.distributed_dir)
+  if (!_internal_has_distributed_dir()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x00020000u;
+  return distributed_dir_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_distributed_dir(std::string* distributed_dir) {
+  if (distributed_dir != nullptr) {
+    _has_bits_[1] |= 0x00020000u;
+  } else {
+    _has_bits_[1] &= ~0x00020000u;
+  }
+  distributed_dir_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), distributed_dir,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.distributed_dir)
+}
+
+// optional int32 num_distributed_processes = 63 [default = 1];
+inline bool TrainerSpec::_internal_has_num_distributed_processes() const {
+  bool value = (_has_bits_[1] & 0x00040000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_num_distributed_processes() const {
+  return _internal_has_num_distributed_processes();
+}
+inline void TrainerSpec::clear_num_distributed_processes() {
+  num_distributed_processes_ = 1;
+  _has_bits_[1] &= ~0x00040000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::_internal_num_distributed_processes() const {
+  return num_distributed_processes_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::num_distributed_processes() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.num_distributed_processes)
+  return _internal_num_distributed_processes();
+}
+inline void TrainerSpec::_internal_set_num_distributed_processes(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _has_bits_[1] |= 0x00040000u;
+  num_distributed_processes_ = value;
+}
+inline void TrainerSpec::set_num_distributed_processes(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _internal_set_num_distributed_processes(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.num_distributed_processes)
+}
+
+// optional int32 distributed_process_id = 64 [default = 0];
+inline bool TrainerSpec::_internal_has_distributed_process_id() const {
+  bool value = (_has_bits_[1] & 0x00080000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_distributed_process_id() const {
+  return _internal_has_distributed_process_id();
+}
+inline void TrainerSpec::clear_distributed_process_id() {
+  distributed_process_id_ = 0;
+  _has_bits_[1] &= ~0x00080000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::_internal_distributed_process_id() const {
+  return distributed_process_id_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::distributed_process_id() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.distributed_process_id)
+  return _internal_distributed_process_id();
+}
+inline void TrainerSpec::_internal_set_distributed_process_id(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _has_bits_[1] |= 0x00080000u;
+  distributed_process_id_ = value;
+}
+inline void TrainerSpec::set_distributed_process_id(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _internal_set_distributed_process_id(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.distributed_process_id)
+}
+
+// optional string vocab_size_sweep = 65 [default = ""];
+inline bool TrainerSpec::_internal_has_vocab_size_sweep() const {
+  bool value = (_has_bits_[1] & 0x00100000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_vocab_size_sweep() const {
+  return _internal_has_vocab_size_sweep();
+}
+inline void TrainerSpec::clear_vocab_size_sweep() {
+  vocab_size_sweep_.ClearToEmpty();
+  _has_bits_[1] &= ~0x00100000u;
+}
+inline const std::string& TrainerSpec::vocab_size_sweep() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.vocab_size_sweep)
+  return _internal_vocab_size_sweep();
+}
+inline void TrainerSpec::set_vocab_size_sweep(const std::string& value) {
+  _internal_set_vocab_size_sweep(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.vocab_size_sweep)
+}
+inline std::string* TrainerSpec::mutable_vocab_size_sweep() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.vocab_size_sweep)
+  return _internal_mutable_vocab_size_sweep();
+}
+inline const std::string& TrainerSpec::_internal_vocab_size_sweep() const {
+  return vocab_size_sweep_.Get();
+}
+inline void TrainerSpec::_internal_set_vocab_size_sweep(const std::string& value) {
+  _has_bits_[1] |= 0x00100000u;
+  vocab_size_sweep_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_vocab_size_sweep(std::string&& value) {
+  _has_bits_[1] |= 0x00100000u;
+  vocab_size_sweep_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.vocab_size_sweep)
+}
+inline void TrainerSpec::set_vocab_size_sweep(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x00100000u;
+  vocab_size_sweep_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.vocab_size_sweep)
+}
+inline void TrainerSpec::set_vocab_size_sweep(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x00100000u;
+  vocab_size_sweep_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.vocab_size_sweep)
+}
+inline std::string* TrainerSpec::_internal_mutable_vocab_size_sweep() {
+  _has_bits_[1] |= 0x00100000u;
+  return vocab_size_sweep_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_vocab_size_sweep() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.vocab_size_sweep)
+  if (!_internal_has_vocab_size_sweep()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x00100000u;
+  return vocab_size_sweep_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_vocab_size_sweep(std::string* vocab_size_sweep) {
+  if (vocab_size_sweep != nullptr) {
+    _has_bits_[1] |= 0x00100000u;
+  } else {
+    _has_bits_[1] &= ~0x00100000u;
+  }
+  vocab_size_sweep_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), vocab_size_sweep,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.vocab_size_sweep)
+}
+
+// optional bool dedup_input_sentences = 66 [default = false];
+inline bool TrainerSpec::_internal_has_dedup_input_sentences() const {
+  bool value = (_has_bits_[1] & 0x00200000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_dedup_input_sentences() const {
+  return _internal_has_dedup_input_sentences();
+}
+inline void TrainerSpec::clear_dedup_input_sentences() {
+  dedup_input_sentences_ = false;
+  _has_bits_[1] &= ~0x00200000u;
+}
+inline bool TrainerSpec::_internal_dedup_input_sentences() const {
+  return dedup_input_sentences_;
+}
+inline bool TrainerSpec::dedup_input_sentences() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.dedup_input_sentences)
+  return _internal_dedup_input_sentences();
+}
+inline void TrainerSpec::_internal_set_dedup_input_sentences(bool value) {
+  _has_bits_[1] |= 0x00200000u;
+  dedup_input_sentences_ = value;
+}
+inline void TrainerSpec::set_dedup_input_sentences(bool value) {
+  _internal_set_dedup_input_sentences(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.dedup_input_sentences)
+}
+
+// optional uint64 em_mini_batch_size = 67 [default = 0];
+inline bool TrainerSpec::_internal_has_em_mini_batch_size() const {
+  bool value = (_has_bits_[1] & 0x00400000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_em_mini_batch_size() const {
+  return _internal_has_em_mini_batch_size();
+}
+inline void TrainerSpec::clear_em_mini_batch_size() {
+  em_mini_batch_size_ = 0;
+  _has_bits_[1] &= ~0x00400000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::uint64 TrainerSpec::_internal_em_mini_batch_size() const {
+  return em_mini_batch_size_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::uint64 TrainerSpec::em_mini_batch_size() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.em_mini_batch_size)
+  return _internal_em_mini_batch_size();
+}
+inline void TrainerSpec::_internal_set_em_mini_batch_size(::PROTOBUF_NAMESPACE_ID::uint64 value) {
+  _has_bits_[1] |= 0x00400000u;
+  em_mini_batch_size_ = value;
+}
+inline void TrainerSpec::set_em_mini_batch_size(::PROTOBUF_NAMESPACE_ID::uint64 value) {
+  _internal_set_em_mini_batch_size(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.em_mini_batch_size)
+}
+
+// optional float e_step_beam = 68 [default = 0];
+inline bool TrainerSpec::_internal_has_e_step_beam() const {
+  bool value = (_has_bits_[1] & 0x00800000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_e_step_beam() const {
+  return _internal_has_e_step_beam();
+}
+inline void TrainerSpec::clear_e_step_beam() {
+  e_step_beam_ = 0;
+  _has_bits_[1] &= ~0x00800000u;
+}
+inline float TrainerSpec::_internal_e_step_beam() const {
+  return e_step_beam_;
+}
+inline float TrainerSpec::e_step_beam() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.e_step_beam)
+  return _internal_e_step_beam();
+}
+inline void TrainerSpec::_internal_set_e_step_beam(float value) {
+  _has_bits_[1] |= 0x00800000u;
+  e_step_beam_ = value;
+}
+inline void TrainerSpec::set_e_step_beam(float value) {
+  _internal_set_e_step_beam(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.e_step_beam)
+}
+
+// optional string sentence_store = 69 [default = ""];
+inline bool TrainerSpec::_internal_has_sentence_store() const {
+  bool value = (_has_bits_[1] & 0x01000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_sentence_store() const {
+  return _internal_has_sentence_store();
+}
+inline void TrainerSpec::clear_sentence_store() {
+  sentence_store_.ClearToEmpty();
+  _has_bits_[1] &= ~0x01000000u;
+}
+inline const std::string& TrainerSpec::sentence_store() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.sentence_store)
+  return _internal_sentence_store();
+}
+inline void TrainerSpec::set_sentence_store(const std::string& value) {
+  _internal_set_sentence_store(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.sentence_store)
+}
+inline std::string* TrainerSpec::mutable_sentence_store() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.sentence_store)
+  return _internal_mutable_sentence_store();
+}
+inline const std::string& TrainerSpec::_internal_sentence_store() const {
+  return sentence_store_.Get();
+}
+inline void TrainerSpec::_internal_set_sentence_store(const std::string& value) {
+  _has_bits_[1] |= 0x01000000u;
+  sentence_store_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_sentence_store(std::string&& value) {
+  _has_bits_[1] |= 0x01000000u;
+  sentence_store_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.sentence_store)
+}
+inline void TrainerSpec::set_sentence_store(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x01000000u;
+  sentence_store_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.sentence_store)
+}
+inline void TrainerSpec::set_sentence_store(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x01000000u;
+  sentence_store_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.sentence_store)
+}
+inline std::string* TrainerSpec::_internal_mutable_sentence_store() {
+  _has_bits_[1] |= 0x01000000u;
+  return sentence_store_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_sentence_store() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.sentence_store)
+  if (!_internal_has_sentence_store()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x01000000u;
+  return sentence_store_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_sentence_store(std::string* sentence_store) {
+  if (sentence_store != nullptr) {
+    _has_bits_[1] |= 0x01000000u;
+  } else {
+    _has_bits_[1] &= ~0x01000000u;
+  }
+  sentence_store_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), sentence_store,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.sentence_store)
+}
+
+// optional string sentence_store_dir = 70 [default = ""];
+inline bool TrainerSpec::_internal_has_sentence_store_dir() const {
+  bool value = (_has_bits_[1] & 0x02000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_sentence_store_dir() const {
+  return _internal_has_sentence_store_dir();
+}
+inline void TrainerSpec::clear_sentence_store_dir() {
+  sentence_store_dir_.ClearToEmpty();
+  _has_bits_[1] &= ~0x02000000u;
+}
+inline const std::string& TrainerSpec::sentence_store_dir() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.sentence_store_dir)
+  return _internal_sentence_store_dir();
+}
+inline void TrainerSpec::set_sentence_store_dir(const std::string& value) {
+  _internal_set_sentence_store_dir(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.sentence_store_dir)
+}
+inline std::string* TrainerSpec::mutable_sentence_store_dir() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.TrainerSpec.sentence_store_dir)
+  return _internal_mutable_sentence_store_dir();
+}
+inline const std::string& TrainerSpec::_internal_sentence_store_dir() const {
+  return sentence_store_dir_.Get();
+}
+inline void TrainerSpec::_internal_set_sentence_store_dir(const std::string& value) {
+  _has_bits_[1] |= 0x02000000u;
+  sentence_store_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void TrainerSpec::set_sentence_store_dir(std::string&& value) {
+  _has_bits_[1] |= 0x02000000u;
+  sentence_store_dir_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.TrainerSpec.sentence_store_dir)
+}
+inline void TrainerSpec::set_sentence_store_dir(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[1] |= 0x02000000u;
+  sentence_store_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.TrainerSpec.sentence_store_dir)
+}
+inline void TrainerSpec::set_sentence_store_dir(const char* value,
+    size_t size) {
+  _has_bits_[1] |= 0x02000000u;
+  sentence_store_dir_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.TrainerSpec.sentence_store_dir)
+}
+inline std::string* TrainerSpec::_internal_mutable_sentence_store_dir() {
+  _has_bits_[1] |= 0x02000000u;
+  return sentence_store_dir_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* TrainerSpec::release_sentence_store_dir() {
+  // @@protoc_insertion_point(field_release:sentencepiece.TrainerSpec.sentence_store_dir)
+  if (!_internal_has_sentence_store_dir()) {
+    return nullptr;
+  }
+  _has_bits_[1] &= ~0x02000000u;
+  return sentence_store_dir_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void TrainerSpec::set_allocated_sentence_store_dir(std::string* sentence_store_dir) {
+  if (sentence_store_dir != nullptr) {
+    _has_bits_[1] |= 0x02000000u;
+  } else {
+    _has_bits_[1] &= ~0x02000000u;
+  }
+  sentence_store_dir_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), sentence_store_dir,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.TrainerSpec.sentence_store_dir)
+}
+
+// optional bool keep_sentence_store = 71 [default = false];
+inline bool TrainerSpec::_internal_has_keep_sentence_store() const {
+  bool value = (_has_bits_[1] & 0x04000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_keep_sentence_store() const {
+  return _internal_has_keep_sentence_store();
+}
+inline void TrainerSpec::clear_keep_sentence_store() {
+  keep_sentence_store_ = false;
+  _has_bits_[1] &= ~0x04000000u;
+}
+inline bool TrainerSpec::_internal_keep_sentence_store() const {
+  return keep_sentence_store_;
+}
+inline bool TrainerSpec::keep_sentence_store() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.keep_sentence_store)
+  return _internal_keep_sentence_store();
+}
+inline void TrainerSpec::_internal_set_keep_sentence_store(bool value) {
+  _has_bits_[1] |= 0x04000000u;
+  keep_sentence_store_ = value;
+}
+inline void TrainerSpec::set_keep_sentence_store(bool value) {
+  _internal_set_keep_sentence_store(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.keep_sentence_store)
+}
+
+// optional uint64 max_memory_mb = 72 [default = 0];
+inline bool TrainerSpec::_internal_has_max_memory_mb() const {
+  bool value = (_has_bits_[1] & 0x08000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_max_memory_mb() const {
+  return _internal_has_max_memory_mb();
+}
+inline void TrainerSpec::clear_max_memory_mb() {
+  max_memory_mb_ = 0;
+  _has_bits_[1] &= ~0x08000000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::uint64 TrainerSpec::_internal_max_memory_mb() const {
+  return max_memory_mb_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::uint64 TrainerSpec::max_memory_mb() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.max_memory_mb)
+  return _internal_max_memory_mb();
+}
+inline void TrainerSpec::_internal_set_max_memory_mb(::PROTOBUF_NAMESPACE_ID::uint64 value) {
+  _has_bits_[1] |= 0x08000000u;
+  max_memory_mb_ = value;
+}
+inline void TrainerSpec::set_max_memory_mb(::PROTOBUF_NAMESPACE_ID::uint64 value) {
+  _internal_set_max_memory_mb(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.max_memory_mb)
+}
+
+// optional int32 approximate_bpe_merges = 73 [default = 0];
+inline bool TrainerSpec::_internal_has_approximate_bpe_merges() const {
+  bool value = (_has_bits_[1] & 0x10000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_approximate_bpe_merges() const {
+  return _internal_has_approximate_bpe_merges();
+}
+inline void TrainerSpec::clear_approximate_bpe_merges() {
+  approximate_bpe_merges_ = 0;
+  _has_bits_[1] &= ~0x10000000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::_internal_approximate_bpe_merges() const {
+  return approximate_bpe_merges_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::approximate_bpe_merges() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.approximate_bpe_merges)
+  return _internal_approximate_bpe_merges();
+}
+inline void TrainerSpec::_internal_set_approximate_bpe_merges(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _has_bits_[1] |= 0x10000000u;
+  approximate_bpe_merges_ = value;
+}
+inline void TrainerSpec::set_approximate_bpe_merges(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _internal_set_approximate_bpe_merges(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.approximate_bpe_merges)
+}
+
+// optional int32 e_step_window_size = 74 [default = 8192];
+inline bool TrainerSpec::_internal_has_e_step_window_size() const {
+  bool value = (_has_bits_[1] & 0x20000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_e_step_window_size() const {
+  return _internal_has_e_step_window_size();
+}
+inline void TrainerSpec::clear_e_step_window_size() {
+  e_step_window_size_ = 8192;
+  _has_bits_[1] &= ~0x20000000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::_internal_e_step_window_size() const {
+  return e_step_window_size_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::e_step_window_size() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.e_step_window_size)
+  return _internal_e_step_window_size();
+}
+inline void TrainerSpec::_internal_set_e_step_window_size(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _has_bits_[1] |= 0x20000000u;
+  e_step_window_size_ = value;
+}
+inline void TrainerSpec::set_e_step_window_size(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _internal_set_e_step_window_size(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.e_step_window_size)
+}
+
+// optional int32 distributed_timeout_sec = 75 [default = 3600];
+inline bool TrainerSpec::_internal_has_distributed_timeout_sec() const {
+  bool value = (_has_bits_[1] & 0x40000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_distributed_timeout_sec() const {
+  return _internal_has_distributed_timeout_sec();
+}
+inline void TrainerSpec::clear_distributed_timeout_sec() {
+  distributed_timeout_sec_ = 3600;
+  _has_bits_[1] &= ~0x40000000u;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::_internal_distributed_timeout_sec() const {
+  return distributed_timeout_sec_;
+}
+inline ::PROTOBUF_NAMESPACE_ID::int32 TrainerSpec::distributed_timeout_sec() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.distributed_timeout_sec)
+  return _internal_distributed_timeout_sec();
+}
+inline void TrainerSpec::_internal_set_distributed_timeout_sec(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _has_bits_[1] |= 0x40000000u;
+  distributed_timeout_sec_ = value;
+}
+inline void TrainerSpec::set_distributed_timeout_sec(::PROTOBUF_NAMESPACE_ID::int32 value) {
+  _internal_set_distributed_timeout_sec(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.distributed_timeout_sec)
+}
+
+// optional float min_piece_score = 76;
+inline bool TrainerSpec::_internal_has_min_piece_score() const {
+  bool value = (_has_bits_[1] & 0x80000000u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_min_piece_score() const {
+  return _internal_has_min_piece_score();
+}
+inline void TrainerSpec::clear_min_piece_score() {
+  min_piece_score_ = 0;
+  _has_bits_[1] &= ~0x80000000u;
+}
+inline float TrainerSpec::_internal_min_piece_score() const {
+  return min_piece_score_;
+}
+inline float TrainerSpec::min_piece_score() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.min_piece_score)
+  return _internal_min_piece_score();
+}
+inline void TrainerSpec::_internal_set_min_piece_score(float value) {
+  _has_bits_[1] |= 0x80000000u;
+  min_piece_score_ = value;
+}
+inline void TrainerSpec::set_min_piece_score(float value) {
+  _internal_set_min_piece_score(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.min_piece_score)
+}
+
+// optional float max_piece_score = 77;
+inline bool TrainerSpec::_internal_has_max_piece_score() const {
+  bool value = (_has_bits_[2] & 0x00000001u) != 0;
+  return value;
+}
+inline bool TrainerSpec::has_max_piece_score() const {
+  return _internal_has_max_piece_score();
+}
+inline void TrainerSpec::clear_max_piece_score() {
+  max_piece_score_ = 0;
+  _has_bits_[2] &= ~0x00000001u;
+}
+inline float TrainerSpec::_internal_max_piece_score() const {
+  return max_piece_score_;
+}
+inline float TrainerSpec::max_piece_score() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.TrainerSpec.max_piece_score)
+  return _internal_max_piece_score();
+}
+inline void TrainerSpec::_internal_set_max_piece_score(float value) {
+  _has_bits_[2] |= 0x00000001u;
+  max_piece_score_ = value;
+}
+inline void TrainerSpec::set_max_piece_score(float value) {
+  _internal_set_max_piece_score(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.TrainerSpec.max_piece_score)
+}
+
 // -------------------------------------------------------------------
 
 // NormalizerSpec
@@ -4999,6 +6374,79 @@ inline void ModelProto::set_allocated_denormalizer_spec(::sentencepiece::Normali
   // @@protoc_insertion_point(field_set_allocated:sentencepiece.ModelProto.denormalizer_spec)
 }
 
+// optional bytes precompiled_trie = 6;
+inline bool ModelProto::_internal_has_precompiled_trie() const {
+  bool value = (_has_bits_[0] & 0x00000010u) != 0;
+  return value;
+}
+inline bool ModelProto::has_precompiled_trie() const {
+  return _internal_has_precompiled_trie();
+}
+inline void ModelProto::clear_precompiled_trie() {
+  precompiled_trie_.ClearToEmpty();
+  _has_bits_[0] &= ~0x00000010u;
+}
+inline const std::string& ModelProto::precompiled_trie() const {
+  // @@protoc_insertion_point(field_get:sentencepiece.ModelProto.precompiled_trie)
+  return _internal_precompiled_trie();
+}
+inline void ModelProto::set_precompiled_trie(const std::string& value) {
+  _internal_set_precompiled_trie(value);
+  // @@protoc_insertion_point(field_set:sentencepiece.ModelProto.precompiled_trie)
+}
+inline std::string* ModelProto::mutable_precompiled_trie() {
+  // @@protoc_insertion_point(field_mutable:sentencepiece.ModelProto.precompiled_trie)
+  return _internal_mutable_precompiled_trie();
+}
+inline const std::string& ModelProto::_internal_precompiled_trie() const {
+  return precompiled_trie_.Get();
+}
+inline void ModelProto::_internal_set_precompiled_trie(const std::string& value) {
+  _has_bits_[0] |= 0x00000010u;
+  precompiled_trie_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, value, GetArena());
+}
+inline void ModelProto::set_precompiled_trie(std::string&& value) {
+  _has_bits_[0] |= 0x00000010u;
+  precompiled_trie_.Set(
+    ::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::move(value), GetArena());
+  // @@protoc_insertion_point(field_set_rvalue:sentencepiece.ModelProto.precompiled_trie)
+}
+inline void ModelProto::set_precompiled_trie(const char* value) {
+  GOOGLE_DCHECK(value != nullptr);
+  _has_bits_[0] |= 0x00000010u;
+  precompiled_trie_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(value), GetArena());
+  // @@protoc_insertion_point(field_set_char:sentencepiece.ModelProto.precompiled_trie)
+}
+inline void ModelProto::set_precompiled_trie(const void* value,
+    size_t size) {
+  _has_bits_[0] |= 0x00000010u;
+  precompiled_trie_.Set(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, ::std::string(
+      reinterpret_cast<const char*>(value), size), GetArena());
+  // @@protoc_insertion_point(field_set_pointer:sentencepiece.ModelProto.precompiled_trie)
+}
+inline std::string* ModelProto::_internal_mutable_precompiled_trie() {
+  _has_bits_[0] |= 0x00000010u;
+  return precompiled_trie_.Mutable(::PROTOBUF_NAMESPACE_ID::internal::ArenaStringPtr::EmptyDefault{}, GetArena());
+}
+inline std::string* ModelProto::release_precompiled_trie() {
+  // @@protoc_insertion_point(field_release:sentencepiece.ModelProto.precompiled_trie)
+  if (!_internal_has_precompiled_trie()) {
+    return nullptr;
+  }
+  _has_bits_[0] &= ~0x00000010u;
+  return precompiled_trie_.ReleaseNonDefault(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), GetArena());
+}
+inline void ModelProto::set_allocated_precompiled_trie(std::string* precompiled_trie) {
+  if (precompiled_trie != nullptr) {
+    _has_bits_[0] |= 0x00000010u;
+  } else {
+    _has_bits_[0] &= ~0x00000010u;
+  }
+  precompiled_trie_.SetAllocated(&::PROTOBUF_NAMESPACE_ID::internal::GetEmptyStringAlreadyInited(), precompiled_trie,
+      GetArena());
+  // @@protoc_insertion_point(field_set_allocated:sentencepiece.ModelProto.precompiled_trie)
+}
+
 #ifdef __GNUC__
   #pragma GCC diagnostic pop
 #endif  // __GNUC__
@@ -13,18 +13,41 @@
 // limitations under the License.!
 
 #include "char_model.h"
+
+#include "memory_usage.h"
 #include "util.h"
 
 namespace sentencepiece {
 namespace character {
 
-Model::Model(const ModelProto &model_proto) {
+Model::Model(const ModelProto &model_proto,
+             std::shared_ptr<const CompiledModel> compiled_model) {
   model_proto_ = &model_proto;
+  compiled_model_ = std::move(compiled_model);
   InitializePieces();
+  ReleasePieceMaps();
+  BuildCharIds();
 }
 
 Model::~Model() {}
 
+void Model::BuildCharIds() {
+  if (!status().ok()) return;
+  for (int id = 0; id < GetPieceSize(); ++id) {
+    const absl::string_view piece = IdToPiece(id);
+    size_t mblen = 0;
+    const char32 c = string_util::DecodeUTF8(piece, &mblen);
+    if ((c == kUnicodeError && mblen != 3) || mblen != piece.size()) continue;
+    // PieceToId() resolves the pieces defined twice.
+    if (c < 0x10000) {
+      if (c >= bmp_ids_.size()) bmp_ids_.resize(c + 1, unk_id_);
+      bmp_ids_[c] = PieceToId(piece);
+    } else {
+      astral_ids_[c] = PieceToId(piece);
+    }
+  }
+}
+
 EncodeResult Model::Encode(absl::string_view normalized) const {
   if (!status().ok() || normalized.empty()) {
     return {};
@@ -32,7 +55,19 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
 
   // Splits the input into character sequence
   EncodeResult output;
+  output.reserve(normalized.size());
   while (!normalized.empty()) {
+    // A valid character not starting a user defined symbol is looked up in
+    // the tables.
+    if (!matcher_->HasEntryStartingWith(normalized[0])) {
+      size_t mblen = 0;
+      const char32 c = string_util::DecodeUTF8(normalized, &mblen);
+      if (c != kUnicodeError || mblen == 3) {
+        output.emplace_back(normalized.substr(0, mblen), CharToId(c));
+        normalized.remove_prefix(mblen);
+        continue;
+      }
+    }
     const int mblen = matcher_->PrefixMatch(normalized);
     absl::string_view w(normalized.data(), mblen);
     output.emplace_back(w, PieceToId(w));
@@ -42,5 +77,11 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
   return output;
 }
 
+void Model::AddMemoryUsage(MemoryUsage *usage) const {
+  ModelInterface::AddMemoryUsage(usage);
+  usage->Add("char_ids", memory_usage::Vector(bmp_ids_) +
+                             memory_usage::HashMap(astral_ids_));
+}
+
 }  // namespace character
 }  // namespace sentencepiece
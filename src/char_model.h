@@ -15,8 +15,11 @@
 #ifndef CHAR_MODEL_H_
 #define CHAR_MODEL_H_
 
+#include <vector>
+
 #include "model_interface.h"
 #include "sentencepiece_model.pb.h"
+#include "third_party/absl/container/flat_hash_map.h"
 
 namespace sentencepiece {
 namespace character {
@@ -24,10 +27,32 @@ namespace character {
 // Tokenize text into character sequence
 class Model : public ModelInterface {
  public:
-  explicit Model(const ModelProto &model_proto);
+  // Maps the piece ids from `compiled_model` if it is given.
+  explicit Model(const ModelProto &model_proto,
+                 std::shared_ptr<const CompiledModel> compiled_model = nullptr);
   ~Model() override;
 
   EncodeResult Encode(absl::string_view normalized) const override;
+
+  void AddMemoryUsage(MemoryUsage *usage) const override;
+
+ private:
+  // Builds `bmp_ids_` and `astral_ids_` from the pieces of one character.
+  void BuildCharIds();
+
+  // Returns PieceToId() of the character `c`.
+  int CharToId(char32 c) const {
+    if (c < bmp_ids_.size()) return bmp_ids_[c];
+    if (c < 0x10000) return unk_id_;
+    const auto it = astral_ids_.find(c);
+    return it == astral_ids_.end() ? unk_id_ : it->second;
+  }
+
+  // Ids of the characters of the BMP, up to the largest one of the pieces,
+  // and of the other characters of the pieces. The characters starting a
+  // user defined symbol go through the matcher instead.
+  std::vector<int> bmp_ids_;
+  absl::flat_hash_map<char32, int> astral_ids_;
 };
 }  // namespace character
 }  // namespace sentencepiece
@@ -106,6 +106,46 @@ TEST(ModelTest, EncodeTest) {
   EXPECT_EQ("d", result[5].first);
 }
 
+TEST(ModelTest, EncodeIdsTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.1);
+  AddPiece(&model_proto, "\xE3\x81\x82", 0.2);      // あ
+  AddPiece(&model_proto, "\xF0\x9F\x98\x80", 0.3);  // U+1F600
+  AddPiece(&model_proto, "ABC", 0.4);
+  model_proto.mutable_pieces(7)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+  AddPiece(&model_proto, "\xEF\xBF\xBD", 0.5);  // U+FFFD
+
+  const Model model(model_proto);
+  ASSERT_TRUE(model.status().ok());
+
+  // The ids of the tables are those of PieceToId(): unknown BMP and astral
+  // characters, "A" starting a user defined symbol, a decoded U+FFFD and a
+  // broken character.
+  const std::string input = WS "a\xE3\x81\x82\xE3\x81\x84" WS
+                            "\xF0\x9F\x98\x80\xF0\x9F\x98\x81" "AABCb"
+                            "\xEF\xBF\xBD\xE3\x81";
+  const auto result = model.Encode(input);
+  std::string joined;
+  for (const auto &p : result) {
+    EXPECT_EQ(model.PieceToId(p.first), p.second);
+    joined.append(p.first.data(), p.first.size());
+  }
+  EXPECT_EQ(input, joined);
+  ASSERT_EQ(12, result.size());
+  EXPECT_EQ(5, result[2].second);  // あ
+  EXPECT_EQ(0, result[3].second);  // い
+  EXPECT_EQ(6, result[5].second);  // U+1F600
+  EXPECT_EQ(0, result[6].second);  // U+1F601
+  EXPECT_EQ("A", result[7].first);
+  EXPECT_EQ("ABC", result[8].first);
+  EXPECT_EQ(7, result[8].second);
+  EXPECT_EQ(8, result[10].second);  // U+FFFD
+  EXPECT_EQ(0, result[11].second);  // Broken.
+}
+
 TEST(CharModelTest, NotSupportedTest) {
   ModelProto model_proto = MakeBaseModelProto();
   const Model model(model_proto);
@@ -0,0 +1,271 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "compiled_model.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "filesystem.h"
+#include "third_party/absl/strings/match.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sentencepiece {
+namespace {
+
+constexpr char kMagic[] = "SPMCMODL";
+constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+
+struct Header {
+  char magic[kMagicSize];
+  uint32 version;
+  uint32 num_sections;
+  uint64 checksum;  // port::Fingerprint() of the rest of the file.
+};
+
+struct SectionEntry {
+  uint32 type;
+  uint32 reserved;
+  uint64 offset;
+  uint64 size;
+};
+
+size_t Align(size_t offset) {
+  return (offset + CompiledModel::kAlignment - 1) /
+         CompiledModel::kAlignment * CompiledModel::kAlignment;
+}
+
+}  // namespace
+
+CompiledModel::CompiledModel() {}
+
+CompiledModel::~CompiledModel() { Unmap(); }
+
+// static
+std::string CompiledModel::Serialize(const Sections &sections) {
+  Header header;
+  memcpy(header.magic, kMagic, kMagicSize);
+  header.version = kVersion;
+  header.num_sections = sections.size();
+  header.checksum = 0;
+
+  std::vector<SectionEntry> entries;
+  size_t offset =
+      Align(sizeof(header) + sizeof(SectionEntry) * sections.size());
+  for (const auto &it : sections) {
+    SectionEntry entry;
+    entry.type = it.first;
+    entry.reserved = 0;
+    entry.offset = offset;
+    entry.size = it.second.size();
+    entries.push_back(entry);
+    offset = Align(offset + it.second.size());
+  }
+
+  std::string output(reinterpret_cast<const char *>(&header), sizeof(header));
+  output.append(reinterpret_cast<const char *>(entries.data()),
+                sizeof(SectionEntry) * entries.size());
+  size_t i = 0;
+  for (const auto &it : sections) {
+    output.resize(entries[i++].offset, '\0');
+    output.append(it.second);
+  }
+  header.checksum =
+      port::Fingerprint(absl::string_view(output).substr(sizeof(header)));
+  memcpy(&output[offsetof(Header, checksum)], &header.checksum,
+         sizeof(header.checksum));
+  return output;
+}
+
+util::Status CompiledModel::Load(absl::string_view filename,
+                                 bool huge_pages) {
+  Unmap();
+  buffer_.clear();
+  util::Status status;
+#if !defined(_WIN32)
+  if (huge_pages) {
+    status = LoadToAnonymousMemory(filename);
+    if (status.ok()) status = Parse();
+    if (!status.ok()) Unmap();
+    return status;
+  }
+  const std::string path(filename);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return util::StatusBuilder(util::StatusCode::kNotFound, GTL_LOC)
+           << "\"" << path << "\": " << util::StrError(errno);
+  }
+  struct stat st;
+  void *mapped = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);  // The mapping is kept after closing the file.
+  if (mapped == MAP_FAILED) {
+    return util::InternalError(absl::StrCat("could not map ", filename));
+  }
+  mapped_ = mapped;
+  mapped_size_ = st.st_size;
+  data_ = absl::string_view(static_cast<const char *>(mapped), st.st_size);
+#else
+  // Falls back to reading the whole file, which is a private copy as with
+  // `huge_pages`.
+  auto input = filesystem::NewReadableFile(filename, true);
+  RETURN_IF_ERROR(input->status());
+  if (!input->ReadAll(&buffer_)) {
+    return util::InternalError(absl::StrCat("could not read ", filename));
+  }
+  data_ = buffer_;
+#endif
+  status = Parse();
+  if (!status.ok()) Unmap();
+  return status;
+}
+
+#if !defined(_WIN32)
+util::Status CompiledModel::LoadToAnonymousMemory(absl::string_view filename) {
+  const std::string path(filename);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return util::StatusBuilder(util::StatusCode::kNotFound, GTL_LOC)
+           << "\"" << path << "\": " << util::StrError(errno);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return util::InternalError(absl::StrCat("could not read ", filename));
+  }
+
+  // Over-allocates to trim the region to the huge page boundaries.
+  const size_t size = (st.st_size + kHugePageSize - 1) / kHugePageSize *
+                      kHugePageSize;
+  void *region = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    close(fd);
+    return util::StatusBuilder(util::StatusCode::kResourceExhausted, GTL_LOC)
+           << "could not allocate " << size << " bytes for " << filename
+           << ": " << util::StrError(errno);
+  }
+  char *begin = static_cast<char *>(region);
+  char *aligned = reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(begin) + kHugePageSize - 1) /
+      kHugePageSize * kHugePageSize);
+  if (aligned > begin) munmap(begin, aligned - begin);
+  munmap(aligned + size, begin + size + kHugePageSize - (aligned + size));
+  mapped_ = aligned;
+  mapped_size_ = size;
+
+  bool huge_pages = false;
+#if defined(MADV_HUGEPAGE)
+  huge_pages = madvise(aligned, size, MADV_HUGEPAGE) == 0;
+#endif
+  if (huge_pages) {
+    LOG(INFO) << "Loading " << filename << " into huge pages.";
+  } else {
+    // Still a private copy, rather than the shared mapping of the file.
+    LOG(WARNING) << "Huge pages are not available. Loading " << filename
+                 << " into regular pages.";
+  }
+
+  size_t read_size = 0;
+  while (read_size < static_cast<size_t>(st.st_size)) {
+    const ssize_t n =
+        pread(fd, aligned + read_size, st.st_size - read_size, read_size);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      close(fd);
+      return util::InternalError(absl::StrCat("could not read ", filename));
+    }
+    read_size += n;
+  }
+  close(fd);
+  mprotect(aligned, size, PROT_READ);
+  data_ = absl::string_view(aligned, st.st_size);
+  return util::OkStatus();
+}
+#endif  // !_WIN32
+
+util::Status CompiledModel::LoadFromArray(absl::string_view data) {
+  Unmap();
+  buffer_.clear();
+  CHECK_EQ_OR_RETURN(reinterpret_cast<uintptr_t>(data.data()) % 8, 0)
+      << "The compiled model must be aligned to 8 bytes.";
+  data_ = data;
+  return Parse();
+}
+
+absl::string_view CompiledModel::section(SectionType type) const {
+  const auto it = sections_.find(type);
+  return it == sections_.end() ? absl::string_view() : it->second;
+}
+
+util::Status CompiledModel::Parse() {
+  sections_.clear();
+  Header header;
+  CHECK_OR_RETURN(data_.size() >= sizeof(header) &&
+                  absl::StartsWith(data_, absl::string_view(kMagic)))
+      << "Not a compiled model.";
+  memcpy(&header, data_.data(), sizeof(header));
+  CHECK_EQ_OR_RETURN(header.version, kVersion)
+      << "Unsupported compiled model version.";
+  CHECK_OR_RETURN((data_.size() - sizeof(header)) / sizeof(SectionEntry) >=
+                  header.num_sections)
+      << "Broken compiled model header.";
+  CHECK_EQ_OR_RETURN(header.checksum,
+                     port::Fingerprint(data_.substr(sizeof(header))))
+      << "Corrupted compiled model: checksum mismatch.";
+
+  // The sections follow the section table and lie within the data.
+  const size_t table_end =
+      sizeof(header) + sizeof(SectionEntry) * header.num_sections;
+  for (uint32 i = 0; i < header.num_sections; ++i) {
+    SectionEntry entry;
+    memcpy(&entry, data_.data() + sizeof(header) + sizeof(entry) * i,
+           sizeof(entry));
+    CHECK_OR_RETURN(entry.offset % kAlignment == 0 &&
+                    entry.offset >= table_end &&
+                    entry.offset <= data_.size() &&
+                    entry.size <= data_.size() - entry.offset)
+        << "Broken compiled model section " << entry.type << ".";
+    CHECK_OR_RETURN(sections_
+                        .emplace(static_cast<SectionType>(entry.type),
+                                 data_.substr(entry.offset, entry.size))
+                        .second)
+        << "Duplicated compiled model section " << entry.type << ".";
+  }
+
+  return util::OkStatus();
+}
+
+void CompiledModel::Unmap() {
+#if !defined(_WIN32)
+  if (mapped_ != nullptr) munmap(mapped_, mapped_size_);
+#endif
+  mapped_ = nullptr;
+  mapped_size_ = 0;
+  data_ = absl::string_view();
+  sections_.clear();
+}
+
+}  // namespace sentencepiece
@@ -0,0 +1,101 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef COMPILED_MODEL_H_
+#define COMPILED_MODEL_H_
+
+#include <map>
+#include <string>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+
+// A model file together with the arrays built from it when it is loaded,
+// e.g., the double-array tries, so that loading it skips building them.
+// The file is mapped with mmap() where available and the arrays are used in
+// place, so the processes loading the same file share its pages.
+//
+// Layout, in the native byte order:
+//   Header:   "SPMCMODL", version (uint32), number of sections (uint32),
+//             checksum (uint64) of the section table and the data
+//   Sections: type (uint32), reserved (uint32), offset (uint64), size (uint64)
+//   Data of the sections, every one aligned to kAlignment bytes.
+// The checksum and the bounds of the sections are verified on loading.
+class CompiledModel {
+ public:
+  enum SectionType : uint32 {
+    kModelProto = 1,         // Serialized ModelProto.
+    kPieceIds = 2,           // ModelInterface::piece_ids_.
+    kUnigramTrie = 3,        // unigram::Model::trie_.
+    kUnigramTrieResults = 4,  // unigram::Model::trie_results_size_ (int32).
+    kUserDefinedSymbols = 5   // The trie of ModelInterface::matcher_.
+  };
+
+  using Sections = std::map<SectionType, std::string>;
+
+  static constexpr uint32 kVersion = 2;
+  static constexpr size_t kAlignment = 64;
+  static constexpr size_t kHugePageSize = 2 << 20;
+
+  CompiledModel();
+  ~CompiledModel();
+
+  CompiledModel(const CompiledModel &) = delete;
+  CompiledModel &operator=(const CompiledModel &) = delete;
+
+  // Returns the compiled model file of `sections`.
+  static std::string Serialize(const Sections &sections);
+
+  // Maps `filename`. Fails if it is not a compiled model of kVersion.
+  // With `huge_pages`, the file is read into anonymous memory aligned to
+  // kHugePageSize and advised with MADV_HUGEPAGE instead, which saves TLB
+  // misses on the randomly accessed tries but is not shared between
+  // processes. Where huge pages are not available, the anonymous memory
+  // keeps regular pages, so the model is still a private copy, and a
+  // warning is logged.
+  util::Status Load(absl::string_view filename, bool huge_pages = false);
+
+  // Uses `data` in place, which must outlive this object and be aligned
+  // to 8 bytes.
+  util::Status LoadFromArray(absl::string_view data);
+
+  // Returns the size of the compiled model in bytes.
+  size_t size() const { return data_.size(); }
+
+  // Returns the data of the section `type`, or an empty view.
+  absl::string_view section(SectionType type) const;
+
+ private:
+  util::Status Parse();
+  void Unmap();
+
+  // Reads `filename` into anonymous memory, advised to use huge pages if
+  // they are available.
+  util::Status LoadToAnonymousMemory(absl::string_view filename);
+
+  absl::string_view data_;
+  std::map<SectionType, absl::string_view> sections_;
+
+  // Owns `data_` if the file is read instead of mapped.
+  std::string buffer_;
+  // The mapping of the file or the huge pages, owning `data_`.
+  void *mapped_ = nullptr;
+  size_t mapped_size_ = 0;
+};
+
+}  // namespace sentencepiece
+#endif  // COMPILED_MODEL_H_
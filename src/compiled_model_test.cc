@@ -0,0 +1,128 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "compiled_model.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "filesystem.h"
+#include "testharness.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace {
+
+// Copies `data` to a buffer aligned to 8 bytes.
+absl::string_view Aligned(const std::string &data, std::vector<uint64> *buf) {
+  buf->assign(data.size() / sizeof(uint64) + 1, 0);
+  memcpy(buf->data(), data.data(), data.size());
+  return absl::string_view(reinterpret_cast<const char *>(buf->data()),
+                           data.size());
+}
+
+TEST(CompiledModelTest, SerializeAndLoadTest) {
+  CompiledModel::Sections sections;
+  sections[CompiledModel::kModelProto] = "model";
+  sections[CompiledModel::kPieceIds] = std::string(10, 'x');
+  sections[CompiledModel::kUnigramTrie] = "";
+  const std::string data = CompiledModel::Serialize(sections);
+
+  std::vector<uint64> buf;
+  CompiledModel model;
+  EXPECT_TRUE(model.LoadFromArray(Aligned(data, &buf)).ok());
+  EXPECT_EQ("model", model.section(CompiledModel::kModelProto));
+  EXPECT_EQ(std::string(10, 'x'), model.section(CompiledModel::kPieceIds));
+  EXPECT_TRUE(model.section(CompiledModel::kUnigramTrie).empty());
+  EXPECT_TRUE(model.section(CompiledModel::kUnigramTrieResults).empty());
+
+  // Every section is aligned.
+  const char *base = reinterpret_cast<const char *>(buf.data());
+  for (const auto type :
+       {CompiledModel::kModelProto, CompiledModel::kPieceIds}) {
+    EXPECT_EQ(0, (model.section(type).data() - base) %
+                     CompiledModel::kAlignment);
+  }
+
+  const std::string filename =
+      util::JoinPath(::testing::TempDir(), "compiled_model");
+  {
+    auto output = filesystem::NewWritableFile(filename, true);
+    EXPECT_TRUE(output->Write(data));
+  }
+  CompiledModel mapped;
+  EXPECT_TRUE(mapped.Load(filename).ok());
+  EXPECT_EQ("model", mapped.section(CompiledModel::kModelProto));
+  EXPECT_EQ(std::string(10, 'x'), mapped.section(CompiledModel::kPieceIds));
+
+  CompiledModel huge;
+  EXPECT_TRUE(huge.Load(filename, true).ok());
+  EXPECT_EQ("model", huge.section(CompiledModel::kModelProto));
+  EXPECT_EQ(std::string(10, 'x'), huge.section(CompiledModel::kPieceIds));
+  EXPECT_FALSE(huge.Load(filename + ".not_found", true).ok());
+
+  EXPECT_FALSE(mapped.Load(filename + ".not_found").ok());
+  EXPECT_TRUE(mapped.section(CompiledModel::kModelProto).empty());
+}
+
+TEST(CompiledModelTest, BrokenDataTest) {
+  CompiledModel::Sections sections;
+  sections[CompiledModel::kModelProto] = "model";
+  const std::string data = CompiledModel::Serialize(sections);
+  std::vector<uint64> buf;
+  CompiledModel model;
+
+  EXPECT_FALSE(model.LoadFromArray(Aligned("", &buf)).ok());
+  EXPECT_FALSE(model.LoadFromArray(Aligned("SPMCMODL", &buf)).ok());
+  EXPECT_FALSE(model.LoadFromArray(Aligned("\x0a\x05model", &buf)).ok());
+
+  // Truncated.
+  EXPECT_FALSE(model.LoadFromArray(Aligned(data.substr(0, 20), &buf)).ok());
+  EXPECT_FALSE(
+      model.LoadFromArray(Aligned(data.substr(0, data.size() - 1), &buf))
+          .ok());
+
+  // Unsupported version.
+  std::string other_version = data;
+  other_version[8] = CompiledModel::kVersion + 1;
+  EXPECT_FALSE(model.LoadFromArray(Aligned(other_version, &buf)).ok());
+
+  // Corrupted data of a section.
+  std::string corrupted = data;
+  corrupted.back() ^= 1;
+  EXPECT_FALSE(model.LoadFromArray(Aligned(corrupted, &buf)).ok());
+
+  // A section overlapping the header, with a matching checksum.
+  constexpr size_t kHeaderSize = 24;
+  constexpr size_t kChecksumOffset = 16;
+  std::string overlapping = data;
+  const uint64 offset = 0;
+  memcpy(&overlapping[kHeaderSize + 8], &offset, sizeof(offset));
+  const uint64 checksum =
+      port::Fingerprint(absl::string_view(overlapping).substr(kHeaderSize));
+  memcpy(&overlapping[kChecksumOffset], &checksum, sizeof(checksum));
+  EXPECT_FALSE(model.LoadFromArray(Aligned(overlapping, &buf)).ok());
+
+  // Unaligned.
+  const std::string padded = " " + data;
+  const char *base = Aligned(padded, &buf).data();
+  EXPECT_FALSE(
+      model.LoadFromArray(absl::string_view(base + 1, data.size())).ok());
+
+  EXPECT_TRUE(model.LoadFromArray(Aligned(data, &buf)).ok());
+}
+
+}  // namespace
+}  // namespace sentencepiece
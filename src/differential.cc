@@ -0,0 +1,299 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "differential.h"
+
+#include <utility>
+
+#include "benchmark.h"
+#include "compiled_model.h"
+#include "model_factory.h"
+#include "sentencepiece.pb.h"
+#include "third_party/absl/strings/str_join.h"
+#include "unigram_model.h"
+
+namespace sentencepiece {
+namespace differential {
+namespace {
+
+// Words cached by the cached processor. Large enough to keep the words of
+// a corpus pass, so that the timed passes mostly hit.
+constexpr size_t kEncodeCacheCapacity = 1 << 16;
+
+std::string JoinIds(const std::vector<int> &ids) {
+  return absl::StrJoin(ids, " ");
+}
+
+std::string JoinPieces(const EncodeResult &result) {
+  std::string output;
+  for (const auto &piece : result) {
+    if (!output.empty()) output += ' ';
+    output.append(piece.first.data(), piece.first.size());
+  }
+  return output;
+}
+
+// Ids and byte ranges of the pieces of `spt`.
+std::string JoinAlignedIds(const SentencePieceText &spt) {
+  std::string output;
+  for (const auto &piece : spt.pieces()) {
+    if (!output.empty()) output += ' ';
+    output += std::to_string(piece.id()) + ":" + std::to_string(piece.begin()) +
+              "-" + std::to_string(piece.end());
+  }
+  return output;
+}
+
+// Errors are outputs too, so that a path failing where its reference
+// succeeds is a mismatch.
+std::string ErrorOutput(const util::Status &status) {
+  return "error: " + status.ToString();
+}
+
+// Returns true if the outputs of `pair` for `input` agree, and appends a
+// mismatch to `mismatches` otherwise if it is not null.
+bool CompareOutputs(const Pair &pair, absl::string_view input,
+                    std::vector<Mismatch> *mismatches) {
+  const std::string reference = pair.reference(input);
+  const std::string fast = pair.fast(input);
+  if (fast == reference ||
+      (pair.equivalent && pair.equivalent(reference, fast))) {
+    return true;
+  }
+  if (mismatches) {
+    mismatches->push_back({pair.name, std::string(input), fast, reference});
+  }
+  return false;
+}
+}  // namespace
+
+double PairResult::speedup() const {
+  return fast_seconds == 0.0 ? 0.0 : reference_seconds / fast_seconds;
+}
+
+Harness::Harness(const ModelProto &model_proto) : model_proto_(model_proto) {
+  status_ = sp_.Load(model_proto_);
+  if (!status_.ok()) return;
+  models_.push_back(ModelFactory::Create(model_proto_));
+  const ModelInterface *model = models_.front().get();
+  status_ = model->status();
+  if (!status_.ok()) return;
+
+  // SentencePieceText is the reference of all the encoders of the
+  // processor.
+  auto reference_ids = [this](absl::string_view input) {
+    SentencePieceText spt;
+    const auto status = sp_.Encode(input, &spt);
+    if (!status.ok()) return ErrorOutput(status);
+    std::vector<int> ids;
+    for (const auto &piece : spt.pieces()) ids.push_back(piece.id());
+    return JoinIds(ids);
+  };
+
+  pairs_.push_back({"encode_ids",
+                    [this](absl::string_view input) {
+                      std::vector<int> ids;
+                      const auto status = sp_.Encode(input, &ids);
+                      return status.ok() ? JoinIds(ids) : ErrorOutput(status);
+                    },
+                    reference_ids, nullptr});
+
+  pairs_.push_back({"encode_pieces",
+                    [this](absl::string_view input) {
+                      std::vector<std::string> pieces;
+                      const auto status = sp_.Encode(input, &pieces);
+                      return status.ok() ? absl::StrJoin(pieces, " ")
+                                         : ErrorOutput(status);
+                    },
+                    [this](absl::string_view input) {
+                      SentencePieceText spt;
+                      const auto status = sp_.Encode(input, &spt);
+                      if (!status.ok()) return ErrorOutput(status);
+                      std::vector<std::string> pieces;
+                      for (const auto &piece : spt.pieces()) {
+                        pieces.push_back(piece.piece());
+                      }
+                      return absl::StrJoin(pieces, " ");
+                    },
+                    nullptr});
+
+  pairs_.push_back({"encode_batch",
+                    [this](absl::string_view input) {
+                      BatchEncodeResult result;
+                      const auto status = sp_.EncodeBatch(
+                          {input}, 1, /*with_pieces=*/false,
+                          /*with_alignment=*/true, &result);
+                      if (!status.ok()) return ErrorOutput(status);
+                      std::string output;
+                      for (size_t j = 0; j < result.ids().size(); ++j) {
+                        if (!output.empty()) output += ' ';
+                        output += std::to_string(result.ids()[j]) + ":" +
+                                  std::to_string(result.begins()[j]) + "-" +
+                                  std::to_string(result.ends()[j]);
+                      }
+                      return output;
+                    },
+                    [this](absl::string_view input) {
+                      SentencePieceText spt;
+                      const auto status = sp_.Encode(input, &spt);
+                      return status.ok() ? JoinAlignedIds(spt)
+                                         : ErrorOutput(status);
+                    },
+                    nullptr});
+
+  // Words are encoded on their own with the cache, which may break ties
+  // differently.
+  if (cached_.Load(model_proto_).ok() &&
+      cached_.SetEncodeCacheCapacity(kEncodeCacheCapacity).ok()) {
+    pairs_.push_back({"encode_cache",
+                      [this](absl::string_view input) {
+                        std::vector<std::string> pieces;
+                        const auto status = cached_.Encode(input, &pieces);
+                        return status.ok() ? absl::StrJoin(pieces, " ")
+                                           : ErrorOutput(status);
+                      },
+                      [this](absl::string_view input) {
+                        std::vector<std::string> pieces;
+                        const auto status = sp_.Encode(input, &pieces);
+                        return status.ok() ? absl::StrJoin(pieces, " ")
+                                           : ErrorOutput(status);
+                      },
+                      [model](absl::string_view reference,
+                              absl::string_view fast) {
+                        return model->VerifyOutputsEquivalent(reference, fast);
+                      }});
+  }
+
+  // The arrays of the compiled model are used in place.
+  CompiledModel::Sections sections;
+  sections[CompiledModel::kModelProto] = model_proto_.SerializeAsString();
+  model->AppendCompiledSections(&sections);
+  compiled_model_ = CompiledModel::Serialize(sections);
+  status_ = compiled_.LoadFromCompiledArray(compiled_model_);
+  if (!status_.ok()) return;
+  pairs_.push_back({"compiled_model",
+                    [this](absl::string_view input) {
+                      std::vector<int> ids;
+                      const auto status = compiled_.Encode(input, &ids);
+                      return status.ok() ? JoinIds(ids) : ErrorOutput(status);
+                    },
+                    [this](absl::string_view input) {
+                      std::vector<int> ids;
+                      const auto status = sp_.Encode(input, &ids);
+                      return status.ok() ? JoinIds(ids) : ErrorOutput(status);
+                    },
+                    nullptr});
+
+  // Both paths decode the ids of the input.
+  pairs_.push_back({"decode_ids",
+                    [this](absl::string_view input) {
+                      std::vector<int> ids;
+                      std::string text;
+                      auto status = sp_.Encode(input, &ids);
+                      if (status.ok()) status = sp_.Decode(ids, &text);
+                      return status.ok() ? text : ErrorOutput(status);
+                    },
+                    [this](absl::string_view input) {
+                      std::vector<int> ids;
+                      SentencePieceText spt;
+                      auto status = sp_.Encode(input, &ids);
+                      if (status.ok()) status = sp_.Decode(ids, &spt);
+                      return status.ok() ? spt.text() : ErrorOutput(status);
+                    },
+                    nullptr});
+
+  if (model_proto_.trainer_spec().model_type() == TrainerSpec::UNIGRAM) {
+    AddUnigramPairs();
+  }
+}
+
+Harness::~Harness() {}
+
+void Harness::AddUnigramPairs() {
+  // The models read the normalized inputs, as the processor passes them.
+  // The first model has the default configuration.
+  auto encoder = [this](unigram::Model::EncoderVersion version,
+                        unigram::Model::TrieEngine engine) {
+    if (version != unigram::Model::kOptimized ||
+        engine != unigram::Model::kUnitWalker) {
+      models_.push_back(ModelFactory::Create(model_proto_));
+      auto *unigram = static_cast<unigram::Model *>(models_.back().get());
+      unigram->SetEncoderVersion(version);
+      unigram->SetTrieEngine(engine);
+    }
+    const ModelInterface *model = models_.back().get();
+    return [this, model](absl::string_view input) {
+      return JoinPieces(model->Encode(sp_.Normalize(input)));
+    };
+  };
+  auto optimized =
+      encoder(unigram::Model::kOptimized, unigram::Model::kUnitWalker);
+  auto original =
+      encoder(unigram::Model::kOriginal, unigram::Model::kUnitWalker);
+  auto traverse =
+      encoder(unigram::Model::kOptimized, unigram::Model::kDartsTraverse);
+
+  // Equally scored segmentations may differ after float rounding.
+  const ModelInterface *model = models_.front().get();
+  pairs_.push_back({"unigram_optimized", optimized, original,
+                    [model](absl::string_view reference,
+                            absl::string_view fast) {
+                      return model->VerifyOutputsEquivalent(reference, fast);
+                    }});
+  pairs_.push_back({"unigram_unit_walker", optimized, traverse, nullptr});
+}
+
+bool Harness::Compare(absl::string_view input,
+                      std::vector<Mismatch> *mismatches) const {
+  bool matched = true;
+  for (const auto &pair : pairs_) {
+    matched &= CompareOutputs(pair, input, mismatches);
+  }
+  return matched;
+}
+
+std::vector<PairResult> Harness::Run(const std::vector<std::string> &inputs,
+                                     double min_seconds,
+                                     std::vector<Mismatch> *mismatches) const {
+  std::vector<PairResult> results;
+  for (const auto &pair : pairs_) {
+    PairResult result;
+    result.name = pair.name;
+    for (const auto &input : inputs) {
+      ++result.inputs;
+      if (!CompareOutputs(pair, input, mismatches)) ++result.mismatches;
+    }
+
+    auto time = [&](const std::function<std::string(absl::string_view)> &path) {
+      const auto run = benchmark::Run(
+          [&]() {
+            benchmark::PassStats stats;
+            for (const auto &input : inputs) {
+              stats.tokens += path(input).size();
+              ++stats.calls;
+            }
+            return stats;
+          },
+          min_seconds);
+      return run.seconds / run.passes;
+    };
+    result.fast_seconds = time(pair.fast);
+    result.reference_seconds = time(pair.reference);
+    results.push_back(std::move(result));
+  }
+  return results;
+}
+
+}  // namespace differential
+}  // namespace sentencepiece
@@ -0,0 +1,105 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef DIFFERENTIAL_H_
+#define DIFFERENTIAL_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "model_interface.h"
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace differential {
+
+// A fast path of the encoders and the reference path it must agree with.
+// Both return their output for an input as a string, e.g., the ids joined by
+// spaces.
+struct Pair {
+  std::string name;
+  std::function<std::string(absl::string_view input)> fast;
+  std::function<std::string(absl::string_view input)> reference;
+  // Accepts the different outputs which the model scores equally, i.e., a
+  // tie broken differently. Null when the outputs must be identical.
+  std::function<bool(absl::string_view reference, absl::string_view fast)>
+      equivalent;
+};
+
+// Different outputs of a pair.
+struct Mismatch {
+  std::string pair;
+  std::string input;
+  std::string fast;
+  std::string reference;
+};
+
+// Outputs compared and the time taken by the two paths of a pair.
+struct PairResult {
+  std::string name;
+  int64 inputs = 0;
+  int64 mismatches = 0;
+  double fast_seconds = 0.0;  // Per pass over the inputs.
+  double reference_seconds = 0.0;
+
+  // How many times faster the fast path is.
+  double speedup() const;
+};
+
+// Runs the fast paths of one model next to their references: the ids and
+// pieces encoders skipping SentencePieceText, the batch encoder, the word
+// cache, the compiled model, the decoder of ids, and for unigram models the
+// optimized encoder and its trie walker.
+class Harness {
+ public:
+  explicit Harness(const ModelProto &model_proto);
+  ~Harness();
+
+  util::Status status() const { return status_; }
+
+  const std::vector<Pair> &pairs() const { return pairs_; }
+
+  // Compares the outputs of every pair on `input`. Appends the mismatches
+  // to `mismatches` and returns true if there is none.
+  bool Compare(absl::string_view input,
+               std::vector<Mismatch> *mismatches) const;
+
+  // Compares every pair on all the `inputs`, and then times each path over
+  // them for at least `min_seconds`. Appends the mismatches to
+  // `mismatches` if it is not null.
+  std::vector<PairResult> Run(const std::vector<std::string> &inputs,
+                              double min_seconds,
+                              std::vector<Mismatch> *mismatches) const;
+
+ private:
+  // Adds the pairs of the models of `model_proto_`.
+  void AddUnigramPairs();
+
+  ModelProto model_proto_;
+  std::string compiled_model_;
+  SentencePieceProcessor sp_, cached_, compiled_;
+  // Encoders of the normalized inputs, each with its own configuration.
+  std::vector<std::unique_ptr<ModelInterface>> models_;
+  std::vector<Pair> pairs_;
+  util::Status status_;
+};
+
+}  // namespace differential
+}  // namespace sentencepiece
+#endif  // DIFFERENTIAL_H_
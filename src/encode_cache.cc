@@ -0,0 +1,128 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "encode_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "encode_stats.h"
+#include "memory_usage.h"
+
+namespace sentencepiece {
+
+EncodeCache::EncodeCache(size_t capacity) : capacity_(capacity) {
+  const size_t num_shards = std::max<size_t>(
+      1, std::min(kNumShards, capacity_ / kMinShardCapacity));
+  for (size_t i = 0; i < num_shards; ++i) {
+    auto shard = std::make_unique<Shard>();
+    // Splits the capacity evenly over the shards.
+    const size_t size =
+        capacity_ * (i + 1) / num_shards - capacity_ * i / num_shards;
+    shard->capacity = size;
+    shard->entries.reserve(size);
+    shard->index.reserve(size);
+    shards_.emplace_back(std::move(shard));
+  }
+}
+
+EncodeCache::~EncodeCache() {}
+
+EncodeCache::Shard *EncodeCache::GetShard(absl::string_view word) {
+  return shards_[std::hash<absl::string_view>()(word) % shards_.size()].get();
+}
+
+bool EncodeCache::Lookup(absl::string_view word, Segment *segment) {
+  if (capacity_ > 0) {
+    auto *shard = GetShard(word);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    const auto it = shard->index.find(word);
+    if (it != shard->index.end()) {
+      auto &entry = shard->entries[it->second];
+      entry.referenced = true;
+      *segment = entry.segment;
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      encode_stats::Add(encode_stats::kCacheHits, 1);
+      return true;
+    }
+  }
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  encode_stats::Add(encode_stats::kCacheMisses, 1);
+  return false;
+}
+
+void EncodeCache::Insert(absl::string_view word, const Segment &segment) {
+  if (capacity_ == 0 || word.size() > kMaxWordSize) return;
+  auto *shard = GetShard(word);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  // Another thread may have cached the same word after our lookup.
+  if (shard->index.count(word) > 0) return;
+
+  auto &entries = shard->entries;
+  size_t slot = entries.size();
+  if (slot < shard->capacity) {
+    // Never exceeds the reserved size, so the entries do not move.
+    entries.emplace_back();
+  } else {
+    while (entries[shard->hand].referenced) {
+      entries[shard->hand].referenced = false;
+      shard->hand = (shard->hand + 1) % entries.size();
+    }
+    slot = shard->hand;
+    shard->hand = (shard->hand + 1) % entries.size();
+    shard->index.erase(entries[slot].word);
+  }
+
+  auto &entry = entries[slot];
+  entry.word.assign(word.data(), word.size());
+  entry.segment = segment;
+  entry.referenced = false;
+  shard->index.emplace(entry.word, slot);
+}
+
+void EncodeCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->entries.clear();
+    shard->hand = 0;
+  }
+}
+
+EncodeCache::Stats EncodeCache::stats() const {
+  Stats stats;
+  stats.hits = hits_.load(std::memory_order_relaxed);
+  stats.misses = misses_.load(std::memory_order_relaxed);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.size += shard->index.size();
+  }
+  return stats;
+}
+
+size_t EncodeCache::GetMemoryUsage() const {
+  size_t bytes = memory_usage::Vector(shards_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    bytes += sizeof(Shard) + memory_usage::Vector(shard->entries) +
+             memory_usage::HashMap(shard->index);
+    for (const auto &entry : shard->entries) {
+      bytes += memory_usage::String(entry.word) +
+               memory_usage::Vector(entry.segment);
+    }
+  }
+  return bytes;
+}
+
+}  // namespace sentencepiece
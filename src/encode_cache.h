@@ -0,0 +1,102 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef ENCODE_CACHE_H_
+#define ENCODE_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+
+// Bounded cache from a word to its segmentation.
+// The words are spread over shards with their own mutex, so concurrent
+// encoders rarely wait for each other. Every shard evicts with the CLOCK
+// algorithm: a lookup marks the entry as referenced, and the eviction hand
+// skips (and unmarks) the referenced entries once before evicting them.
+class EncodeCache {
+ public:
+  // Pieces of a word as (byte length, vocab id) pairs.
+  using Segment = std::vector<std::pair<uint32, int>>;
+
+  // Words longer than this are not cached.
+  static constexpr size_t kMaxWordSize = 256;
+
+  struct Stats {
+    int64 hits = 0;
+    int64 misses = 0;
+    size_t size = 0;  // Number of cached words.
+  };
+
+  // Holds at most `capacity` words.
+  explicit EncodeCache(size_t capacity);
+  ~EncodeCache();
+
+  size_t capacity() const { return capacity_; }
+
+  // Copies the segmentation of `word` to `segment` and returns true if
+  // `word` is cached. Counts a hit or a miss.
+  bool Lookup(absl::string_view word, Segment *segment);
+
+  // Caches `segment` for `word`, evicting another word if the shard is full.
+  void Insert(absl::string_view word, const Segment &segment);
+
+  // Removes all the words. The counters are kept.
+  void Clear();
+
+  Stats stats() const;
+
+  // Returns the bytes of the slots and the index.
+  size_t GetMemoryUsage() const;
+
+ private:
+  struct Entry {
+    std::string word;
+    Segment segment;
+    bool referenced = false;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    // Slots are allocated up front, so the keys can point to the words
+    // stored in them.
+    std::vector<Entry> entries;
+    absl::flat_hash_map<absl::string_view, size_t> index;
+    size_t capacity = 0;
+    size_t hand = 0;
+  };
+
+  static constexpr size_t kNumShards = 16;
+  // Smaller caches use fewer shards, so that every shard keeps enough words
+  // to tell the frequent ones apart.
+  static constexpr size_t kMinShardCapacity = 64;
+
+  Shard *GetShard(absl::string_view word);
+
+  size_t capacity_ = 0;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<int64> hits_{0};
+  std::atomic<int64> misses_{0};
+};
+
+}  // namespace sentencepiece
+#endif  // ENCODE_CACHE_H_
@@ -0,0 +1,118 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "encode_cache.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "testharness.h"
+#include "third_party/absl/strings/str_cat.h"
+
+namespace sentencepiece {
+namespace {
+
+TEST(EncodeCacheTest, LookupAndInsertTest) {
+  EncodeCache cache(100);
+  EXPECT_EQ(100, cache.capacity());
+
+  EncodeCache::Segment segment;
+  EXPECT_FALSE(cache.Lookup("hello", &segment));
+  cache.Insert("hello", {{2, 10}, {3, 11}});
+  EXPECT_TRUE(cache.Lookup("hello", &segment));
+  EXPECT_EQ(EncodeCache::Segment({{2, 10}, {3, 11}}), segment);
+
+  // The first segmentation is kept.
+  cache.Insert("hello", {{5, 12}});
+  EXPECT_TRUE(cache.Lookup("hello", &segment));
+  EXPECT_EQ(EncodeCache::Segment({{2, 10}, {3, 11}}), segment);
+
+  const std::string long_word(EncodeCache::kMaxWordSize + 1, 'a');
+  cache.Insert(long_word, {{long_word.size(), 1}});
+  EXPECT_FALSE(cache.Lookup(long_word, &segment));
+
+  auto stats = cache.stats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(1, stats.size);
+
+  cache.Clear();
+  EXPECT_FALSE(cache.Lookup("hello", &segment));
+  stats = cache.stats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(3, stats.misses);
+  EXPECT_EQ(0, stats.size);
+}
+
+TEST(EncodeCacheTest, ClockEvictionTest) {
+  // Small capacities use a single shard.
+  EncodeCache cache(2);
+  EncodeCache::Segment segment;
+  cache.Insert("a", {{1, 1}});
+  cache.Insert("b", {{1, 2}});
+  // "a" is referenced, so "b" is evicted first.
+  EXPECT_TRUE(cache.Lookup("a", &segment));
+  cache.Insert("c", {{1, 3}});
+  EXPECT_TRUE(cache.Lookup("c", &segment));
+  EXPECT_EQ(EncodeCache::Segment({{1, 3}}), segment);
+  EXPECT_FALSE(cache.Lookup("b", &segment));
+  EXPECT_EQ(2, cache.stats().size);
+
+  // The hand has unmarked "a" on the way.
+  EXPECT_TRUE(cache.Lookup("a", &segment));
+  EXPECT_EQ(EncodeCache::Segment({{1, 1}}), segment);
+  EXPECT_EQ(2, cache.stats().size);
+}
+
+TEST(EncodeCacheTest, CapacityTest) {
+  EncodeCache empty(0);
+  EncodeCache::Segment segment;
+  empty.Insert("a", {{1, 1}});
+  EXPECT_FALSE(empty.Lookup("a", &segment));
+  EXPECT_EQ(0, empty.stats().size);
+
+  EncodeCache cache(1000);
+  for (int i = 0; i < 10000; ++i) {
+    cache.Insert(absl::StrCat("w", i), {{1, i}});
+  }
+  EXPECT_EQ(1000, cache.stats().size);
+}
+
+TEST(EncodeCacheTest, ConcurrentTest) {
+  EncodeCache cache(64);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t]() {
+      EncodeCache::Segment segment;
+      for (int i = 0; i < 10000; ++i) {
+        const int n = (i * 7 + t) % 100;
+        const std::string word = absl::StrCat("w", n);
+        if (cache.Lookup(word, &segment)) {
+          EXPECT_EQ(EncodeCache::Segment({{1, n}}), segment);
+        } else {
+          cache.Insert(word, {{1, n}});
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(40000, stats.hits + stats.misses);
+  EXPECT_LE(stats.size, 64);
+}
+
+}  // namespace
+}  // namespace sentencepiece
@@ -0,0 +1,128 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "encode_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace sentencepiece {
+namespace encode_stats {
+namespace {
+
+struct Counters {
+  Counters();
+  ~Counters();
+
+  std::atomic<int64> values[kNumCounters] = {};
+};
+
+// The counters of the live threads, and the sums of the exited ones.
+// Reset() does not write the counters of the threads, which only their
+// owners update, but records the sums to subtract from the later
+// snapshots.
+struct Registry {
+  std::mutex mutex;
+  std::vector<Counters *> threads;
+  int64 exited[kNumCounters] = {};
+  int64 reset[kNumCounters] = {};
+
+  // Sums the counters of all the threads. Requires `mutex`.
+  void Sum(int64 *sums) const {
+    std::copy(exited, exited + kNumCounters, sums);
+    for (const auto *counters : threads) {
+      for (int i = 0; i < kNumCounters; ++i) {
+        sums[i] += counters->values[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+Registry *GetRegistry() {
+  static auto *registry = new Registry;
+  return registry;
+}
+
+Counters::Counters() {
+  auto *registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  registry->threads.push_back(this);
+}
+
+Counters::~Counters() {
+  auto *registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  for (int i = 0; i < kNumCounters; ++i) {
+    registry->exited[i] += values[i].load(std::memory_order_relaxed);
+  }
+  auto &threads = registry->threads;
+  threads.erase(std::find(threads.begin(), threads.end(), this));
+}
+}  // namespace
+
+void AddToThread(Counter counter, int64 value) {
+#ifdef SPM_NO_THREADLOCAL
+  static Counters *shared = new Counters;
+  shared->values[counter].fetch_add(value, std::memory_order_relaxed);
+#else
+  // Only this thread writes, so a plain load and store suffices.
+  static thread_local Counters counters;
+  auto &v = counters.values[counter];
+  v.store(v.load(std::memory_order_relaxed) + value,
+          std::memory_order_relaxed);
+#endif
+}
+
+int64 NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+EncodeStats Snapshot() {
+  int64 sums[kNumCounters];
+  {
+    auto *registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    registry->Sum(sums);
+    for (int i = 0; i < kNumCounters; ++i) sums[i] -= registry->reset[i];
+  }
+
+  EncodeStats stats;
+  stats.calls = sums[kCalls];
+  stats.input_bytes = sums[kInputBytes];
+  stats.normalized_bytes = sums[kNormalizedBytes];
+  stats.trie_lookups = sums[kTrieLookups];
+  stats.lattice_nodes = sums[kLatticeNodes];
+  stats.unknown_tokens = sums[kUnknownTokens];
+  stats.byte_fallback_tokens = sums[kByteFallbackTokens];
+  stats.cache_hits = sums[kCacheHits];
+  stats.cache_misses = sums[kCacheMisses];
+  stats.normalize_nanos = sums[kNormalizeNanos];
+  stats.segment_nanos = sums[kSegmentNanos];
+  stats.output_nanos = sums[kOutputNanos];
+  return stats;
+}
+
+void Reset() {
+  auto *registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  registry->Sum(registry->reset);
+}
+
+}  // namespace encode_stats
+}  // namespace sentencepiece
@@ -0,0 +1,84 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef ENCODE_STATS_H_
+#define ENCODE_STATS_H_
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+
+namespace sentencepiece {
+namespace encode_stats {
+
+// Counters of EncodeStats. Every thread adds to its own copy, which
+// Snapshot() sums, so that the encoders do not share a cache line.
+enum Counter {
+  kCalls,
+  kInputBytes,
+  kNormalizedBytes,
+  kTrieLookups,
+  kLatticeNodes,
+  kUnknownTokens,
+  kByteFallbackTokens,
+  kCacheHits,
+  kCacheMisses,
+  kNormalizeNanos,
+  kSegmentNanos,
+  kOutputNanos,
+  kNumCounters,
+};
+
+#ifdef SPM_ENABLE_ENCODE_STATS
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+void AddToThread(Counter counter, int64 value);
+
+// Adds `value` to `counter`. Compiled out unless kEnabled.
+inline void Add(Counter counter, int64 value) {
+  if constexpr (kEnabled) AddToThread(counter, value);
+}
+
+int64 NowNanos();
+
+// Adds the nanoseconds from its construction until Stop() or its
+// destruction to `counter`. Does not read the clock unless kEnabled.
+class Timer {
+ public:
+  explicit Timer(Counter counter) : counter_(counter) {
+    if constexpr (kEnabled) start_ = NowNanos();
+  }
+  ~Timer() { Stop(); }
+
+  void Stop() {
+    if constexpr (kEnabled) {
+      if (start_ < 0) return;
+      AddToThread(counter_, NowNanos() - start_);
+      start_ = -1;
+    }
+  }
+
+ private:
+  const Counter counter_;
+  int64 start_ = -1;
+};
+
+EncodeStats Snapshot();
+void Reset();
+
+}  // namespace encode_stats
+}  // namespace sentencepiece
+#endif  // ENCODE_STATS_H_
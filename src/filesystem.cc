@@ -14,12 +14,38 @@
 
 #include "filesystem.h"
 
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include "third_party/absl/strings/match.h"
+#include "third_party/absl/strings/str_cat.h"
 #include "util.h"
 
+#ifdef SPM_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef SPM_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(OS_WIN) && defined(UNICODE) && defined(_UNICODE)
 #define WPATH(path) (::sentencepiece::util::Utf8ToWide(path).c_str())
 #else
@@ -28,88 +54,1061 @@
 
 namespace sentencepiece {
 namespace filesystem {
+namespace {
+
+// Streaming codecs of the compressed files. The readers detect them by the
+// magic numbers and the writers by the extensions of the filenames.
+enum class Codec { kNone, kGzip, kZstd };
+
+constexpr char kGzipMagic[] = "\x1f\x8b";
+constexpr char kZstdMagic[] = "\x28\xb5\x2f\xfd";
+constexpr size_t kMaxMagicSize = 4;
 
-class PosixReadableFile : public ReadableFile {
+Codec DetectCodec(absl::string_view head) {
+  if (absl::StartsWith(head, kGzipMagic)) return Codec::kGzip;
+  if (absl::StartsWith(head, kZstdMagic)) return Codec::kZstd;
+  return Codec::kNone;
+}
+
+Codec CodecOfFilename(absl::string_view filename) {
+  if (absl::EndsWith(filename, ".gz")) return Codec::kGzip;
+  if (absl::EndsWith(filename, ".zst")) return Codec::kZstd;
+  return Codec::kNone;
+}
+
+class Compressor {
  public:
-  PosixReadableFile(absl::string_view filename, bool is_binary = false)
-      : is_(filename.empty()
-                ? &std::cin
-                : new std::ifstream(WPATH(filename),
-                                    is_binary ? std::ios::binary | std::ios::in
-                                              : std::ios::in)) {
-    if (!*is_)
-      status_ = util::StatusBuilder(util::StatusCode::kNotFound, GTL_LOC)
-                << "\"" << filename.data() << "\": " << util::StrError(errno);
+  // kFlush makes the output decodable so far, and kFinish ends the stream.
+  enum Mode { kContinue, kFlush, kFinish };
+
+  virtual ~Compressor() {}
+
+  // Compresses `input` and appends the output to `output`.
+  virtual bool Compress(absl::string_view input, Mode mode,
+                        std::string *output) = 0;
+};
+
+class Decompressor {
+ public:
+  virtual ~Decompressor() {}
+
+  // Decompresses `input` and appends the output to `output`. Returns false
+  // if the data is broken.
+  virtual bool Decompress(absl::string_view input, std::string *output) = 0;
+
+  // Returns true if the input so far ends at the end of a stream.
+  virtual bool finished() const = 0;
+};
+
+constexpr size_t kCodecBlockSize = 1 << 16;
+
+#ifdef SPM_ENABLE_ZLIB
+class GzipCompressor : public Compressor {
+ public:
+  GzipCompressor() {
+    memset(&stream_, 0, sizeof(stream_));
+    // 16 + MAX_WBITS writes the gzip format.
+    ok_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+
+  ~GzipCompressor() { deflateEnd(&stream_); }
+
+  bool Compress(absl::string_view input, Mode mode, std::string *output) {
+    if (!ok_) return false;
+    const int flush =
+        mode == kFinish ? Z_FINISH : mode == kFlush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    stream_.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream_.avail_in = input.size();
+    char buf[kCodecBlockSize];
+    do {
+      stream_.next_out = reinterpret_cast<Bytef *>(buf);
+      stream_.avail_out = sizeof(buf);
+      const int ret = deflate(&stream_, flush);
+      if (ret == Z_STREAM_ERROR) return ok_ = false;
+      output->append(buf, sizeof(buf) - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+    return true;
   }
 
-  ~PosixReadableFile() {
-    if (is_ != &std::cin) delete is_;
+ private:
+  z_stream stream_;
+  bool ok_ = false;
+};
+
+class GzipDecompressor : public Decompressor {
+ public:
+  GzipDecompressor() {
+    memset(&stream_, 0, sizeof(stream_));
+    // 32 + MAX_WBITS detects the gzip and zlib headers.
+    ok_ = inflateInit2(&stream_, 32 + MAX_WBITS) == Z_OK;
   }
 
-  util::Status status() const { return status_; }
+  ~GzipDecompressor() { inflateEnd(&stream_); }
+
+  bool Decompress(absl::string_view input, std::string *output) {
+    if (!ok_) return false;
+    stream_.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream_.avail_in = input.size();
+    char buf[kCodecBlockSize];
+    while (stream_.avail_in > 0) {
+      if (finished_) {
+        // The next member of a concatenated file.
+        inflateReset(&stream_);
+        finished_ = false;
+      }
+      stream_.next_out = reinterpret_cast<Bytef *>(buf);
+      stream_.avail_out = sizeof(buf);
+      const int ret = inflate(&stream_, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+        return ok_ = false;
+      }
+      output->append(buf, sizeof(buf) - stream_.avail_out);
+      if (ret == Z_STREAM_END) finished_ = true;
+    }
+    return true;
+  }
+
+  bool finished() const { return finished_; }
+
+ private:
+  z_stream stream_;
+  bool ok_ = false;
+  bool finished_ = false;
+};
+#endif  // SPM_ENABLE_ZLIB
+
+#ifdef SPM_ENABLE_ZSTD
+class ZstdCompressor : public Compressor {
+ public:
+  ZstdCompressor() : stream_(ZSTD_createCCtx()) {}
+  ~ZstdCompressor() { ZSTD_freeCCtx(stream_); }
+
+  bool Compress(absl::string_view input, Mode mode, std::string *output) {
+    if (stream_ == nullptr) return false;
+    const ZSTD_EndDirective directive =
+        mode == kFinish ? ZSTD_e_end
+                        : mode == kFlush ? ZSTD_e_flush : ZSTD_e_continue;
+    ZSTD_inBuffer in = {input.data(), input.size(), 0};
+    char buf[kCodecBlockSize];
+    while (true) {
+      ZSTD_outBuffer out = {buf, sizeof(buf), 0};
+      const size_t remaining =
+          ZSTD_compressStream2(stream_, &out, &in, directive);
+      if (ZSTD_isError(remaining)) return false;
+      output->append(buf, out.pos);
+      if (directive == ZSTD_e_continue ? in.pos == in.size : remaining == 0) {
+        return true;
+      }
+    }
+  }
+
+ private:
+  ZSTD_CCtx *stream_;
+};
+
+class ZstdDecompressor : public Decompressor {
+ public:
+  ZstdDecompressor() : stream_(ZSTD_createDCtx()) {}
+  ~ZstdDecompressor() { ZSTD_freeDCtx(stream_); }
+
+  bool Decompress(absl::string_view input, std::string *output) {
+    if (stream_ == nullptr) return false;
+    ZSTD_inBuffer in = {input.data(), input.size(), 0};
+    char buf[kCodecBlockSize];
+    while (in.pos < in.size) {
+      ZSTD_outBuffer out = {buf, sizeof(buf), 0};
+      const size_t ret = ZSTD_decompressStream(stream_, &out, &in);
+      if (ZSTD_isError(ret)) return false;
+      output->append(buf, out.pos);
+      finished_ = ret == 0;
+    }
+    return true;
+  }
+
+  bool finished() const { return finished_; }
+
+ private:
+  ZSTD_DCtx *stream_;
+  bool finished_ = false;
+};
+#endif  // SPM_ENABLE_ZSTD
+
+const char *CodecName(Codec codec) {
+  return codec == Codec::kGzip ? "gzip" : "zstd";
+}
+
+// Returns nullptr and sets `status` if `codec` is not built in.
+std::unique_ptr<Compressor> NewCompressor(Codec codec, util::Status *status) {
+  switch (codec) {
+#ifdef SPM_ENABLE_ZLIB
+    case Codec::kGzip:
+      return std::make_unique<GzipCompressor>();
+#endif
+#ifdef SPM_ENABLE_ZSTD
+    case Codec::kZstd:
+      return std::make_unique<ZstdCompressor>();
+#endif
+    default:
+      break;
+  }
+  *status = util::UnimplementedError(
+      absl::StrCat(CodecName(codec), " is not supported in this build."));
+  return nullptr;
+}
+
+std::unique_ptr<Decompressor> NewDecompressor(Codec codec,
+                                              util::Status *status) {
+  switch (codec) {
+#ifdef SPM_ENABLE_ZLIB
+    case Codec::kGzip:
+      return std::make_unique<GzipDecompressor>();
+#endif
+#ifdef SPM_ENABLE_ZSTD
+    case Codec::kZstd:
+      return std::make_unique<ZstdDecompressor>();
+#endif
+    default:
+      break;
+  }
+  *status = util::UnimplementedError(
+      absl::StrCat(CodecName(codec), " is not supported in this build."));
+  return nullptr;
+}
+
+#if defined(_WIN32)
+int FileSeek(FILE *fp, int64 offset, int whence) {
+  return _fseeki64(fp, offset, whence);
+}
+int64 FileTell(FILE *fp) { return _ftelli64(fp); }
+#else
+int FileSeek(FILE *fp, int64 offset, int whence) {
+  return fseeko(fp, offset, whence);
+}
+int64 FileTell(FILE *fp) { return ftello(fp); }
+#endif
+
+}  // namespace
+
+// Splits the bytes of ReadRaw() into lines in a large buffer with memchr(),
+// which is much faster than std::getline() on an ifstream. Compressed text
+// files are decompressed in a background thread, which feeds the buffer.
+// They have no random access.
+//
+// The subclasses call DetectCompression() at the end of their constructors
+// and StopDecompression() at the beginning of their destructors, as the
+// background thread calls ReadRaw().
+class LineBufferedFile : public ReadableFile {
+ public:
+  static constexpr size_t kBufferSize = 1 << 20;
+  // The decompressed blocks waiting in `blocks_`.
+  static constexpr size_t kMaxBlocks = 8;
+
+  LineBufferedFile() {}
+  ~LineBufferedFile() override { StopDecompression(); }
+
+  util::Status status() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+  }
+
+  bool ReadLine(std::string *line) override {
+    absl::string_view view;
+    if (!ReadLine(&view)) return false;
+    line->assign(view.data(), view.size());
+    return true;
+  }
+
+  bool ReadLine(absl::string_view *line) override {
+    size_t scanned = begin_;  // The bytes before have no newline.
+    while (true) {
+      const char *newline = static_cast<const char *>(
+          memchr(buffer_.data() + scanned, '\n', end_ - scanned));
+      if (newline != nullptr) {
+        const size_t pos = newline - buffer_.data();
+        *line = absl::string_view(buffer_.data() + begin_, pos - begin_);
+        begin_ = pos + 1;
+        return true;
+      }
+      // Fill() moves the unread bytes to the front.
+      scanned = end_ - begin_;
+      if (!Fill()) break;
+    }
+    // The last line without a newline.
+    if (begin_ == end_) return false;
+    *line = absl::string_view(buffer_.data() + begin_, end_ - begin_);
+    begin_ = end_;
+    return true;
+  }
+
+  bool ReadAll(std::string *line) override {
+    line->assign(buffer_.data() + begin_, end_ - begin_);
+    begin_ = end_ = 0;
+    char buf[1 << 16];
+    size_t n = 0;
+    while ((n = ReadBytes(buf, sizeof(buf))) > 0) line->append(buf, n);
+    return status().ok();
+  }
+
+  int64 Read(char *data, size_t size) override {
+    size_t n = std::min(size, end_ - begin_);
+    if (n > 0) memcpy(data, buffer_.data() + begin_, n);
+    begin_ += n;
+    while (n < size) {
+      const size_t m = ReadBytes(data + n, size - n);
+      if (m == 0) break;
+      end_offset_ += m;
+      n += m;
+    }
+    return n;
+  }
+
+  bool Seek(int64 offset) override {
+    if (!IsSeekable() || !SeekRaw(offset)) return false;
+    begin_ = end_ = 0;
+    end_offset_ = offset;
+    return true;
+  }
+
+  int64 Tell() override {
+    if (!IsSeekable()) return -1;
+    return end_offset_ - static_cast<int64>(end_ - begin_);
+  }
+
+  int64 Size() override { return IsSeekable() ? SizeRaw() : -1; }
+
+ protected:
+  // Reads at most `size` bytes of the file into `data`. Returns 0 at the end.
+  virtual size_t ReadRaw(char *data, size_t size) = 0;
+
+  // Random access to the file, if SupportsSeek().
+  virtual bool SupportsSeek() const { return false; }
+  virtual bool SeekRaw(int64 offset) { return false; }
+  virtual int64 SizeRaw() { return -1; }
+
+  // Stops translating the newlines of the raw reads before decompressing.
+  virtual void SetRawBinaryMode() {}
+
+  void set_status(const util::Status &status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+  }
 
-  bool ReadLine(std::string *line) {
-    return static_cast<bool>(std::getline(*is_, *line));
+  // Starts decompressing the file if it begins with the magic number of a
+  // codec. Text files only.
+  void DetectCompression(absl::string_view filename, bool is_binary) {
+    if (is_binary || !status().ok()) return;
+    // Peeks the magic number.
+    buffer_.resize(kBufferSize);
+    while (end_ < kMaxMagicSize) {
+      const size_t n = ReadRaw(buffer_.data() + end_, kMaxMagicSize - end_);
+      if (n == 0) break;
+      end_ += n;
+    }
+    end_offset_ = end_;
+    const Codec codec = DetectCodec(absl::string_view(buffer_.data(), end_));
+    if (codec == Codec::kNone) return;
+    util::Status status;
+    auto decompressor = NewDecompressor(codec, &status);
+    if (decompressor == nullptr) {
+      set_status(status);
+      return;
+    }
+    std::string head(buffer_.data(), end_);
+    end_ = end_offset_ = 0;
+    SetRawBinaryMode();
+    decompress_thread_ = std::thread(
+        [this, codec, head, name = std::string(filename),
+         decompressor = std::move(decompressor)]() {
+          DecompressInBackground(name, codec, head, decompressor.get());
+        });
+  }
+
+  void StopDecompression() {
+    if (!decompress_thread_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    decompress_thread_.join();
+  }
+
+ private:
+  bool IsSeekable() const {
+    return SupportsSeek() && !decompress_thread_.joinable();
+  }
+
+  // Moves the unread bytes to the front of the buffer and reads more after
+  // them. The buffer grows for the lines longer than it. Returns false at
+  // the end of the file.
+  bool Fill() {
+    if (begin_ > 0) {
+      memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    if (buffer_.size() < kBufferSize) {
+      buffer_.resize(kBufferSize);
+    } else if (end_ == buffer_.size()) {
+      buffer_.resize(2 * buffer_.size());
+    }
+    const size_t n = ReadBytes(buffer_.data() + end_, buffer_.size() - end_);
+    end_ += n;
+    end_offset_ += n;
+    return n > 0;
+  }
+
+  // Reads at most `size` bytes of the file, or of the decompressed data.
+  // Returns 0 at the end.
+  size_t ReadBytes(char *data, size_t size) {
+    if (!decompress_thread_.joinable()) return ReadRaw(data, size);
+    if (block_pos_ == block_.size()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return !blocks_.empty() || decoded_; });
+      if (blocks_.empty()) return 0;
+      block_ = std::move(blocks_.front());
+      blocks_.pop_front();
+      block_pos_ = 0;
+      cond_.notify_all();
+    }
+    const size_t n = std::min(size, block_.size() - block_pos_);
+    memcpy(data, block_.data() + block_pos_, n);
+    block_pos_ += n;
+    return n;
+  }
+
+  void DecompressInBackground(const std::string &filename, Codec codec,
+                              const std::string &head,
+                              Decompressor *decompressor) {
+    std::vector<char> input(kCodecBlockSize);
+    util::Status status;
+    absl::string_view view = head;
+    while (true) {
+      std::string block;
+      if (!decompressor->Decompress(view, &block)) {
+        status = util::DataLossError(absl::StrCat("\"", filename, "\": broken ") +
+                                     absl::StrCat(CodecName(codec), " data."));
+        break;
+      }
+      if (!block.empty()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock,
+                   [this]() { return blocks_.size() < kMaxBlocks || stop_; });
+        if (stop_) return;
+        blocks_.push_back(std::move(block));
+        cond_.notify_all();
+      }
+      const size_t n = ReadRaw(input.data(), input.size());
+      if (n == 0) break;
+      view = absl::string_view(input.data(), n);
+    }
+    if (status.ok() && !decompressor->finished()) {
+      status = util::DataLossError(
+          absl::StrCat("\"", filename, "\": truncated ") +
+          absl::StrCat(CodecName(codec), " data."));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!status.ok()) {
+      LOG(ERROR) << status.message();
+      status_ = status;
+    }
+    decoded_ = true;
+    cond_.notify_all();
+  }
+
+  util::Status status_;
+  std::vector<char> buffer_;
+  size_t begin_ = 0;  // The unread bytes are buffer_[begin_, end_).
+  size_t end_ = 0;
+  int64 end_offset_ = 0;  // The file offset of buffer_[end_].
+
+  // The decompressed data. `decompress_thread_` pushes the blocks, and
+  // ReadBytes() reads `block_` from `block_pos_`.
+  std::thread decompress_thread_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::string> blocks_;
+  bool decoded_ = false;
+  bool stop_ = false;
+  std::string block_;
+  size_t block_pos_ = 0;
+};
+
+// A local file or stdin read with fread().
+class PosixReadableFile : public LineBufferedFile {
+ public:
+  PosixReadableFile(absl::string_view filename, bool is_binary = false)
+      : is_stdin_(filename.empty()) {
+    if (is_stdin_) {
+      fp_ = stdin;
+    } else {
+      const std::string path(filename);
+#if defined(OS_WIN) && defined(UNICODE) && defined(_UNICODE)
+      fp_ = _wfopen(WPATH(path), is_binary ? L"rb" : L"r");
+#else
+      fp_ = fopen(WPATH(path), is_binary ? "rb" : "r");
+#endif
+    }
+    if (fp_ == nullptr) {
+      set_status(util::StatusBuilder(util::StatusCode::kNotFound, GTL_LOC)
+                 << "\"" << filename.data()
+                 << "\": " << util::StrError(errno));
+      return;
+    }
+    DetectCompression(filename, is_binary);
+  }
+
+  ~PosixReadableFile() override {
+    StopDecompression();
+    if (fp_ != nullptr && !is_stdin_) fclose(fp_);
   }
 
-  bool ReadAll(std::string *line) {
-    if (is_ == &std::cin) {
+  bool ReadAll(std::string *line) override {
+    if (is_stdin_) {
       LOG(ERROR) << "ReadAll is not supported for stdin.";
       return false;
     }
-    line->assign(std::istreambuf_iterator<char>(*is_),
-                 std::istreambuf_iterator<char>());
+    if (fp_ == nullptr) return false;
+    return LineBufferedFile::ReadAll(line);
+  }
+
+ protected:
+  size_t ReadRaw(char *data, size_t size) override {
+    return fp_ == nullptr ? 0 : fread(data, 1, size, fp_);
+  }
+
+  bool SupportsSeek() const override { return !is_stdin_ && fp_ != nullptr; }
+
+  bool SeekRaw(int64 offset) override {
+    clearerr(fp_);
+    return FileSeek(fp_, offset, SEEK_SET) == 0;
+  }
+
+  void SetRawBinaryMode() override {
+#if defined(_WIN32)
+    _setmode(_fileno(fp_), _O_BINARY);
+#endif
+  }
+
+  int64 SizeRaw() override {
+    const int64 pos = FileTell(fp_);
+    if (pos < 0 || FileSeek(fp_, 0, SEEK_END) != 0) return -1;
+    const int64 size = FileTell(fp_);
+    FileSeek(fp_, pos, SEEK_SET);
+    return size;
+  }
+
+ private:
+  FILE *fp_ = nullptr;
+  const bool is_stdin_;
+};
+
+// Reads the blocks of a RangeReader ahead in parallel.
+class RangeReadableFile : public LineBufferedFile {
+ public:
+  RangeReadableFile(absl::string_view filename,
+                    std::unique_ptr<RangeReader> reader, bool is_binary,
+                    size_t block_size, int max_parallel_reads)
+      : reader_(std::move(reader)),
+        block_size_(std::max<size_t>(block_size, 1)),
+        max_window_size_(std::max(max_parallel_reads, 1)) {
+    set_status(reader_->status());
+    if (!status().ok()) return;
+    size_ = reader_->Size();
+    pool_ = std::make_unique<ThreadPool>(max_window_size_);
+    DetectCompression(filename, is_binary);
+  }
+
+  ~RangeReadableFile() override {
+    StopDecompression();
+    CancelReads();
+  }
+
+ protected:
+  size_t ReadRaw(char *data, size_t size) override {
+    while (block_pos_ == block_.size()) {
+      if (!NextBlock()) return 0;
+    }
+    const size_t n = std::min(size, block_.size() - block_pos_);
+    memcpy(data, block_.data() + block_pos_, n);
+    block_pos_ += n;
+    return n;
+  }
+
+  bool SupportsSeek() const override { return pool_ != nullptr; }
+
+  bool SeekRaw(int64 offset) override {
+    if (offset < 0 || offset > size_) return false;
+    CancelReads();
+    next_offset_ = offset;
+    block_.clear();
+    block_pos_ = 0;
+    window_size_ = 1;
     return true;
   }
 
+  int64 SizeRaw() override { return size_; }
+
  private:
-  util::Status status_;
-  std::istream *is_;
+  struct Block {
+    std::string data;
+    util::Status status;
+    bool ready = false;
+  };
+
+  // Schedules the reads of the window, and moves its first block to
+  // `block_`. The window grows while the file is read sequentially.
+  bool NextBlock() {
+    if (pool_ == nullptr) return false;
+    ScheduleReads();
+    if (window_.empty()) return false;
+    std::shared_ptr<Block> front = window_.front();
+    {
+      std::unique_lock<std::mutex> lock(window_mutex_);
+      window_ready_.wait(lock, [&front]() { return front->ready; });
+    }
+    window_.pop_front();
+    if (!front->status.ok()) {
+      set_status(front->status);
+      CancelReads();
+      next_offset_ = size_;
+      return false;
+    }
+    block_ = std::move(front->data);
+    block_pos_ = 0;
+    window_size_ = std::min(2 * window_size_, max_window_size_);
+    ScheduleReads();
+    return !block_.empty();
+  }
+
+  void ScheduleReads() {
+    while (window_.size() < static_cast<size_t>(window_size_) &&
+           next_offset_ < size_) {
+      auto block = std::make_shared<Block>();
+      const int64 offset = next_offset_;
+      const size_t size = std::min<int64>(block_size_, size_ - offset);
+      next_offset_ += size;
+      window_.push_back(block);
+      pool_->Schedule([this, block, offset, size]() {
+        std::string data;
+        util::Status status = reader_->ReadRange(offset, size, &data);
+        if (status.ok() && data.size() != size) {
+          status = util::DataLossError(
+              absl::StrCat("short read at ", std::to_string(offset), " of ") +
+              absl::StrCat(std::to_string(size), " bytes."));
+        }
+        std::lock_guard<std::mutex> lock(window_mutex_);
+        block->data = std::move(data);
+        block->status = std::move(status);
+        block->ready = true;
+        window_ready_.notify_all();
+      });
+    }
+  }
+
+  // Waits for the reads in flight and drops them.
+  void CancelReads() {
+    if (pool_ != nullptr) pool_->Wait();
+    window_.clear();
+  }
+
+  std::unique_ptr<RangeReader> reader_;
+  const size_t block_size_;
+  const int max_window_size_;
+  int64 size_ = 0;
+  std::unique_ptr<ThreadPool> pool_;
+
+  std::deque<std::shared_ptr<Block>> window_;
+  int window_size_ = 1;  // The number of the blocks read ahead.
+  int64 next_offset_ = 0;
+  std::mutex window_mutex_;
+  std::condition_variable window_ready_;
+  std::string block_;
+  size_t block_pos_ = 0;
 };
 
+// Writes through a large buffer with fwrite(). With `async_flush`, a
+// background thread writes the full buffer while the caller fills another.
+// The files with the extensions of the codecs are compressed when the
+// buffers are written.
 class PosixWritableFile : public WritableFile {
  public:
-  PosixWritableFile(absl::string_view filename, bool is_binary = false)
-      : os_(filename.empty()
-                ? &std::cout
-                : new std::ofstream(WPATH(filename),
-                                    is_binary ? std::ios::binary | std::ios::out
-                                              : std::ios::out)) {
-    if (!*os_)
+  static constexpr size_t kBufferSize = 1 << 20;
+
+  PosixWritableFile(absl::string_view filename, bool is_binary = false,
+                    bool async_flush = false)
+      : is_stdout_(filename.empty()) {
+    const Codec codec = CodecOfFilename(filename);
+    if (codec != Codec::kNone) {
+      compressor_ = NewCompressor(codec, &status_);
+      if (compressor_ == nullptr) return;
+      is_binary = true;
+    }
+    if (is_stdout_) {
+      fp_ = stdout;
+    } else {
+      const std::string path(filename);
+#if defined(OS_WIN) && defined(UNICODE) && defined(_UNICODE)
+      fp_ = _wfopen(WPATH(path), is_binary ? L"wb" : L"w");
+#else
+      fp_ = fopen(WPATH(path), is_binary ? "wb" : "w");
+#endif
+    }
+    if (fp_ == nullptr) {
       status_ =
           util::StatusBuilder(util::StatusCode::kPermissionDenied, GTL_LOC)
           << "\"" << filename.data() << "\": " << util::StrError(errno);
+      return;
+    }
+    buffer_.reserve(kBufferSize);
+    if (async_flush) {
+      flushing_.reserve(kBufferSize);
+      flush_thread_ = std::thread([this]() { FlushInBackground(); });
+    }
   }
 
   ~PosixWritableFile() {
-    if (os_ != &std::cout) delete os_;
+    FlushAll(Compressor::kFinish);
+    if (flush_thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cond_.notify_all();
+      flush_thread_.join();
+    }
+    if (fp_ != nullptr && !is_stdout_) fclose(fp_);
   }
 
   util::Status status() const { return status_; }
 
   bool Write(absl::string_view text) {
-    os_->write(text.data(), text.size());
-    return os_->good();
+    if (fp_ == nullptr) return false;
+    if (buffer_.size() + text.size() > kBufferSize) {
+      FlushBuffer();
+      if (text.size() >= kBufferSize && !flush_thread_.joinable()) {
+        return WriteToFile(text);
+      }
+    }
+    buffer_.append(text.data(), text.size());
+    return !failed_;
+  }
+
+  bool WriteLine(absl::string_view text) {
+    if (!Write(text)) return false;
+    buffer_ += '\n';
+    return true;
   }
 
-  bool WriteLine(absl::string_view text) { return Write(text) && Write("\n"); }
+  bool Flush() { return FlushAll(Compressor::kFlush); }
 
  private:
+  // Writes all the buffers to the file, and flushes or finishes the
+  // compressed stream with `mode`.
+  bool FlushAll(Compressor::Mode mode) {
+    if (fp_ == nullptr) return false;
+    FlushBuffer();
+    if (flush_thread_.joinable()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return !pending_; });
+    }
+    if (compressor_ != nullptr) WriteToFile("", mode);
+    if (fflush(fp_) != 0) failed_ = true;
+    return !failed_;
+  }
+
+  // Writes `buffer_` to the file, or hands it to the background thread.
+  void FlushBuffer() {
+    if (buffer_.empty()) return;
+    if (!flush_thread_.joinable()) {
+      WriteToFile(buffer_);
+      buffer_.clear();
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return !pending_; });
+      buffer_.swap(flushing_);
+      pending_ = true;
+    }
+    cond_.notify_all();
+    buffer_.clear();
+  }
+
+  bool WriteToFile(absl::string_view text,
+                   Compressor::Mode mode = Compressor::kContinue) {
+    if (compressor_ != nullptr) {
+      compressed_.clear();
+      if (!compressor_->Compress(text, mode, &compressed_)) {
+        failed_ = true;
+        return false;
+      }
+      text = compressed_;
+    }
+    if (fwrite(text.data(), 1, text.size(), fp_) != text.size()) {
+      failed_ = true;
+    }
+    return !failed_;
+  }
+
+  void FlushInBackground() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this]() { return pending_ || stop_; });
+      if (!pending_) return;
+      lock.unlock();
+      WriteToFile(flushing_);
+      flushing_.clear();
+      lock.lock();
+      pending_ = false;
+      cond_.notify_all();
+    }
+  }
+
   util::Status status_;
-  std::ostream *os_;
+  FILE *fp_ = nullptr;
+  const bool is_stdout_;
+  std::string buffer_;
+  std::atomic<bool> failed_{false};
+  std::unique_ptr<Compressor> compressor_;
+  std::string compressed_;
+
+  // The buffer written by `flush_thread_` while `pending_`.
+  std::string flushing_;
+  std::thread flush_thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool pending_ = false;
+  bool stop_ = false;
 };
 
 using DefaultReadableFile = PosixReadableFile;
 using DefaultWritableFile = PosixWritableFile;
 
+namespace {
+
+// The files of an unknown scheme.
+class UnavailableReadableFile : public ReadableFile {
+ public:
+  explicit UnavailableReadableFile(util::Status status)
+      : status_(std::move(status)) {}
+  util::Status status() const override { return status_; }
+  bool ReadLine(std::string *line) override { return false; }
+  bool ReadAll(std::string *line) override { return false; }
+
+ private:
+  util::Status status_;
+};
+
+class UnavailableWritableFile : public WritableFile {
+ public:
+  explicit UnavailableWritableFile(util::Status status)
+      : status_(std::move(status)) {}
+  util::Status status() const override { return status_; }
+  bool Write(absl::string_view text) override { return false; }
+  bool WriteLine(absl::string_view text) override { return false; }
+
+ private:
+  util::Status status_;
+};
+
+// Reads the ranges of a local file with pread(), e.g., a file of a network
+// file system or of an object storage mounted with FUSE, where the parallel
+// reads hide the latency.
+class LocalRangeReader : public RangeReader {
+ public:
+  explicit LocalRangeReader(absl::string_view filename) {
+    const std::string path(filename);
+#if defined(_WIN32)
+    fp_ = fopen(WPATH(path), "rb");
+    if (fp_ != nullptr && FileSeek(fp_, 0, SEEK_END) == 0) {
+      size_ = FileTell(fp_);
+    }
+    const bool opened = fp_ != nullptr;
+#else
+    fd_ = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd_ >= 0 && fstat(fd_, &st) == 0) size_ = st.st_size;
+    const bool opened = fd_ >= 0;
+#endif
+    if (!opened) {
+      status_ = util::StatusBuilder(util::StatusCode::kNotFound, GTL_LOC)
+                << "\"" << path << "\": " << util::StrError(errno);
+    }
+  }
+
+  ~LocalRangeReader() override {
+#if defined(_WIN32)
+    if (fp_ != nullptr) fclose(fp_);
+#else
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+
+  util::Status status() const override { return status_; }
+  int64 Size() override { return size_; }
+
+  util::Status ReadRange(int64 offset, size_t size,
+                         std::string *data) override {
+    data->resize(size);
+    size_t read_size = 0;
+#if defined(_WIN32)
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (FileSeek(fp_, offset, SEEK_SET) == 0) {
+      read_size = fread(&(*data)[0], 1, size, fp_);
+    }
+#else
+    while (read_size < size) {
+      const ssize_t n =
+          pread(fd_, &(*data)[read_size], size - read_size, offset + read_size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      read_size += n;
+    }
+#endif
+    data->resize(read_size);
+    return util::OkStatus();
+  }
+
+ private:
+  util::Status status_;
+  int64 size_ = -1;
+#if defined(_WIN32)
+  FILE *fp_ = nullptr;
+  std::mutex mutex_;
+#else
+  int fd_ = -1;
+#endif
+};
+
+// "file://<path>" is a local path.
+class LocalFileSystem : public FileSystem {
+ public:
+  std::unique_ptr<ReadableFile> NewReadableFile(absl::string_view filename,
+                                                bool is_binary) override {
+    return std::make_unique<DefaultReadableFile>(StripScheme(filename),
+                                                 is_binary);
+  }
+
+  std::unique_ptr<WritableFile> NewWritableFile(absl::string_view filename,
+                                                bool is_binary,
+                                                bool async_flush) override {
+    return std::make_unique<DefaultWritableFile>(StripScheme(filename),
+                                                 is_binary, async_flush);
+  }
+
+  static absl::string_view StripScheme(absl::string_view filename) {
+    const size_t pos = filename.find("://");
+    return pos == absl::string_view::npos ? filename : filename.substr(pos + 3);
+  }
+};
+
+// "prefetch://<path>" reads a local path with the parallel range reads of
+// LocalRangeReader. The reference implementation of the remote backends.
+class PrefetchFileSystem : public LocalFileSystem {
+ public:
+  std::unique_ptr<ReadableFile> NewReadableFile(absl::string_view filename,
+                                                bool is_binary) override {
+    const absl::string_view path = StripScheme(filename);
+    return NewRangeReadableFile(path, std::make_unique<LocalRangeReader>(path),
+                                is_binary);
+  }
+};
+
+// The schemes of the filenames, e.g., "gs" of "gs://bucket/object".
+absl::string_view SchemeOf(absl::string_view filename) {
+  const size_t pos = filename.find("://");
+  if (pos == absl::string_view::npos || pos == 0) return "";
+  for (const char c : filename.substr(0, pos)) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '+' && c != '-' &&
+        c != '.') {
+      return "";
+    }
+  }
+  return filename.substr(0, pos);
+}
+
+class FileSystemRegistry {
+ public:
+  static FileSystemRegistry *GetInstance() {
+    static FileSystemRegistry *registry = new FileSystemRegistry;
+    return registry;
+  }
+
+  void Register(absl::string_view scheme,
+                std::unique_ptr<FileSystem> file_system) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_systems_[std::string(scheme)] = std::move(file_system);
+  }
+
+  // Returns nullptr if no backend is registered for `scheme`.
+  FileSystem *Get(absl::string_view scheme) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = file_systems_.find(std::string(scheme));
+    return it == file_systems_.end() ? nullptr : it->second.get();
+  }
+
+ private:
+  FileSystemRegistry() {
+    file_systems_["file"] = std::make_unique<LocalFileSystem>();
+    file_systems_["prefetch"] = std::make_unique<PrefetchFileSystem>();
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<FileSystem>> file_systems_;
+};
+
+util::Status UnknownSchemeError(absl::string_view filename) {
+  return util::StatusBuilder(util::StatusCode::kUnimplemented, GTL_LOC)
+         << "\"" << filename << "\": no file system is registered for \""
+         << SchemeOf(filename) << "://\".";
+}
+
+}  // namespace
+
+void RegisterFileSystem(absl::string_view scheme,
+                        std::unique_ptr<FileSystem> file_system) {
+  FileSystemRegistry::GetInstance()->Register(scheme, std::move(file_system));
+}
+
+std::unique_ptr<ReadableFile> NewRangeReadableFile(
+    absl::string_view filename, std::unique_ptr<RangeReader> reader,
+    bool is_binary, size_t block_size, int max_parallel_reads) {
+  return std::make_unique<RangeReadableFile>(
+      filename, std::move(reader), is_binary, block_size, max_parallel_reads);
+}
+
 std::unique_ptr<ReadableFile> NewReadableFile(absl::string_view filename,
                                               bool is_binary) {
-  return std::make_unique<DefaultReadableFile>(filename, is_binary);
+  const absl::string_view scheme = SchemeOf(filename);
+  if (scheme.empty()) {
+    return std::make_unique<DefaultReadableFile>(filename, is_binary);
+  }
+  FileSystem *file_system = FileSystemRegistry::GetInstance()->Get(scheme);
+  if (file_system == nullptr) {
+    return std::make_unique<UnavailableReadableFile>(
+        UnknownSchemeError(filename));
+  }
+  return file_system->NewReadableFile(filename, is_binary);
 }
 
 std::unique_ptr<WritableFile> NewWritableFile(absl::string_view filename,
-                                              bool is_binary) {
-  return std::make_unique<DefaultWritableFile>(filename, is_binary);
+                                              bool is_binary,
+                                              bool async_flush) {
+  const absl::string_view scheme = SchemeOf(filename);
+  if (scheme.empty()) {
+    return std::make_unique<DefaultWritableFile>(filename, is_binary,
+                                                 async_flush);
+  }
+  FileSystem *file_system = FileSystemRegistry::GetInstance()->Get(scheme);
+  if (file_system == nullptr) {
+    return std::make_unique<UnavailableWritableFile>(
+        UnknownSchemeError(filename));
+  }
+  return file_system->NewWritableFile(filename, is_binary, async_flush);
 }
 
 }  // namespace filesystem
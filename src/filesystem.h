@@ -36,6 +36,27 @@ class ReadableFile {
   virtual util::Status status() const = 0;
   virtual bool ReadLine(std::string *line) = 0;
   virtual bool ReadAll(std::string *line) = 0;
+
+  // Reads a line without copying it. `line` points to a buffer of this file
+  // and is valid until the next read.
+  virtual bool ReadLine(absl::string_view *line) {
+    if (!ReadLine(&line_)) return false;
+    *line = line_;
+    return true;
+  }
+
+  // Reads at most `size` bytes into `data`, e.g., of a binary file. Returns
+  // the number of the bytes read, 0 at the end, or -1 if not supported.
+  virtual int64 Read(char *data, size_t size) { return -1; }
+
+  // Random access used to read a file in byte ranges. Files which do not
+  // support it, e.g., stdin, return false or -1.
+  virtual bool Seek(int64 offset) { return false; }
+  virtual int64 Tell() { return -1; }
+  virtual int64 Size() { return -1; }
+
+ private:
+  std::string line_;
 };
 
 class WritableFile {
@@ -47,12 +68,66 @@ class WritableFile {
   virtual util::Status status() const = 0;
   virtual bool Write(absl::string_view text) = 0;
   virtual bool WriteLine(absl::string_view text) = 0;
+
+  // Writes the buffered text to the file. The text is also flushed when the
+  // file is destroyed.
+  virtual bool Flush() { return true; }
 };
 
+// Text files compressed with gzip or zstd are decompressed transparently,
+// detected by their magic numbers. Binary files are read as they are.
 std::unique_ptr<ReadableFile> NewReadableFile(absl::string_view filename,
                                               bool is_binary = false);
+// With `async_flush`, the full buffers are written in a background thread
+// so that Write() does not wait for the disk. Files named *.gz or *.zst are
+// compressed with gzip or zstd.
 std::unique_ptr<WritableFile> NewWritableFile(absl::string_view filename,
-                                              bool is_binary = false);
+                                              bool is_binary = false,
+                                              bool async_flush = false);
+
+// Random access to the bytes of a file, e.g., of an object in a remote
+// storage read with range requests.
+class RangeReader {
+ public:
+  virtual ~RangeReader() {}
+
+  virtual util::Status status() const = 0;
+  virtual int64 Size() = 0;
+
+  // Reads the bytes [offset, offset + size) into `data`, fewer only at the
+  // end of the file. Called from several threads at once.
+  virtual util::Status ReadRange(int64 offset, size_t size,
+                                 std::string *data) = 0;
+};
+
+// Reads `reader` in blocks of `block_size` bytes. Up to `max_parallel_reads`
+// blocks are read ahead in parallel. The read-ahead starts at one block
+// after every Seek() and doubles while the file is read sequentially, so the
+// chunks of a parallel reader do not read much past their ends.
+std::unique_ptr<ReadableFile> NewRangeReadableFile(
+    absl::string_view filename, std::unique_ptr<RangeReader> reader,
+    bool is_binary = false, size_t block_size = 4 << 20,
+    int max_parallel_reads = 8);
+
+// A backend of the filenames "<scheme>://...", e.g., "gs://bucket/object".
+// `filename` of the methods includes the scheme.
+class FileSystem {
+ public:
+  virtual ~FileSystem() {}
+
+  virtual std::unique_ptr<ReadableFile> NewReadableFile(
+      absl::string_view filename, bool is_binary) = 0;
+  virtual std::unique_ptr<WritableFile> NewWritableFile(
+      absl::string_view filename, bool is_binary, bool async_flush) = 0;
+};
+
+// Makes NewReadableFile() and NewWritableFile() open the filenames of
+// `scheme` with `file_system`, replacing the former backend of `scheme`.
+// "file://" is a local path, and "prefetch://" is a local path read with
+// parallel range reads, e.g., on a network file system. The other schemes
+// fail unless registered. Call it before opening the files.
+void RegisterFileSystem(absl::string_view scheme,
+                        std::unique_ptr<FileSystem> file_system);
 
 }  // namespace filesystem
 }  // namespace sentencepiece
@@ -14,10 +14,21 @@
 
 #include "filesystem.h"
 #include "testharness.h"
+#include "third_party/absl/strings/match.h"
+#include "third_party/absl/strings/numbers.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "util.h"
 
 namespace sentencepiece {
+namespace {
+
+std::string DetectFormatForTest(absl::string_view data) {
+  if (absl::StartsWith(data, "\x1f\x8b")) return ".gz";
+  if (absl::StartsWith(data, "\x28\xb5\x2f\xfd")) return ".zst";
+  return "";
+}
+
+}  // namespace
 
 TEST(UtilTest, FilesystemTest) {
   const std::vector<std::string> kData = {
@@ -44,6 +55,272 @@ TEST(UtilTest, FilesystemTest) {
     }
     EXPECT_FALSE(input->ReadLine(&line));
   }
+
+  {
+    auto input = filesystem::NewReadableFile(
+        util::JoinPath(::testing::TempDir(), "test_file"));
+    const int64 size = kData[0].size() + 1;
+    EXPECT_EQ(size, input->Size());
+    EXPECT_EQ(0, input->Tell());
+    EXPECT_TRUE(input->Seek(2));
+    EXPECT_EQ(2, input->Tell());
+    std::string line;
+    EXPECT_TRUE(input->ReadLine(&line));
+    EXPECT_EQ(kData[0].substr(2), line);
+    EXPECT_EQ(size, input->Tell());
+    EXPECT_FALSE(input->ReadLine(&line));
+    // Seek() recovers from EOF.
+    EXPECT_TRUE(input->Seek(0));
+    EXPECT_TRUE(input->ReadLine(&line));
+    EXPECT_EQ(kData[0], line);
+  }
+}
+
+TEST(UtilTest, FilesystemReadLineTest) {
+  // Lines longer than the buffer, empty lines, and no newline at the end.
+  const std::vector<std::string> kData = {
+      std::string(3 << 20, 'a'), "", "b", std::string(1 << 20, 'c'), "",
+      "d"};
+  const std::string filename =
+      util::JoinPath(::testing::TempDir(), "test_lines");
+  {
+    auto output = filesystem::NewWritableFile(filename);
+    for (size_t i = 0; i < kData.size(); ++i) {
+      output->Write(kData[i]);
+      if (i + 1 < kData.size()) output->Write("\n");
+    }
+  }
+
+  {
+    auto input = filesystem::NewReadableFile(filename);
+    absl::string_view line;
+    int64 offset = 0;
+    for (size_t i = 0; i < kData.size(); ++i) {
+      EXPECT_TRUE(input->ReadLine(&line));
+      EXPECT_EQ(kData[i], line);
+      offset += kData[i].size() + (i + 1 < kData.size() ? 1 : 0);
+      EXPECT_EQ(offset, input->Tell());
+    }
+    EXPECT_FALSE(input->ReadLine(&line));
+    EXPECT_EQ(offset, input->Size());
+  }
+
+  {
+    // Mixes the copying and the view reads.
+    auto input = filesystem::NewReadableFile(filename);
+    std::string line;
+    absl::string_view view;
+    EXPECT_TRUE(input->ReadLine(&line));
+    EXPECT_EQ(kData[0], line);
+    EXPECT_TRUE(input->ReadLine(&view));
+    EXPECT_EQ(kData[1], view);
+    EXPECT_TRUE(input->ReadLine(&line));
+    EXPECT_EQ(kData[2], line);
+    std::string rest;
+    EXPECT_TRUE(input->ReadAll(&rest));
+    EXPECT_EQ(absl::StrCat(kData[3], "\n", kData[4]) + "\n" + kData[5], rest);
+  }
+}
+
+TEST(UtilTest, FilesystemWriteTest) {
+  const std::string filename =
+      util::JoinPath(::testing::TempDir(), "test_write");
+  for (const bool async_flush : {false, true}) {
+    // Writes more than the buffer, some pieces larger than it.
+    std::string expected;
+    {
+      auto output = filesystem::NewWritableFile(filename, true, async_flush);
+      EXPECT_TRUE(output->status().ok());
+      for (int i = 0; i < 3000; ++i) {
+        const std::string text(i % 1000 == 999 ? (2 << 20) : i, 'a' + i % 26);
+        EXPECT_TRUE(output->WriteLine(text));
+        expected += text + "\n";
+        if (i == 1500) {
+          EXPECT_TRUE(output->Flush());
+          std::string written;
+          EXPECT_TRUE(
+              filesystem::NewReadableFile(filename, true)->ReadAll(&written));
+          EXPECT_EQ(expected, written);
+        }
+      }
+    }
+    std::string written;
+    EXPECT_TRUE(filesystem::NewReadableFile(filename, true)->ReadAll(&written));
+    EXPECT_EQ(expected, written);
+  }
+}
+
+TEST(UtilTest, FilesystemCompressedFileTest) {
+  for (const char *extension : {".gz", ".zst"}) {
+    const std::string filename = util::JoinPath(
+        ::testing::TempDir(), absl::StrCat("test_compressed", extension));
+#if !defined(SPM_ENABLE_ZLIB)
+    if (std::string(extension) == ".gz") {
+      EXPECT_FALSE(filesystem::NewWritableFile(filename)->status().ok());
+      continue;
+    }
+#endif
+#if !defined(SPM_ENABLE_ZSTD)
+    if (std::string(extension) == ".zst") {
+      EXPECT_FALSE(filesystem::NewWritableFile(filename)->status().ok());
+      continue;
+    }
+#endif
+    std::vector<std::string> lines;
+    for (int i = 0; i < 100000; ++i) lines.push_back(absl::StrCat("line ", i));
+    for (const bool async_flush : {false, true}) {
+      {
+        auto output = filesystem::NewWritableFile(filename, false, async_flush);
+        EXPECT_TRUE(output->status().ok());
+        for (const auto &line : lines) EXPECT_TRUE(output->WriteLine(line));
+      }
+      std::string compressed;
+      EXPECT_TRUE(
+          filesystem::NewReadableFile(filename, true)->ReadAll(&compressed));
+      EXPECT_EQ(DetectFormatForTest(compressed), extension);
+
+      auto input = filesystem::NewReadableFile(filename);
+      EXPECT_TRUE(input->status().ok());
+      EXPECT_EQ(-1, input->Size());
+      absl::string_view line;
+      for (const auto &expected : lines) {
+        EXPECT_TRUE(input->ReadLine(&line));
+        EXPECT_EQ(expected, line);
+      }
+      EXPECT_FALSE(input->ReadLine(&line));
+      EXPECT_TRUE(input->status().ok());
+
+      // A truncated file.
+      {
+        auto output = filesystem::NewWritableFile(
+            util::JoinPath(::testing::TempDir(), "test_truncated"), true);
+        output->Write(compressed.substr(0, compressed.size() / 2));
+      }
+      input = filesystem::NewReadableFile(
+          util::JoinPath(::testing::TempDir(), "test_truncated"));
+      while (input->ReadLine(&line)) {
+      }
+      EXPECT_FALSE(input->status().ok());
+    }
+  }
+}
+
+namespace {
+
+// The ranges of `data`, failing at `error_offset`.
+class StringRangeReader : public filesystem::RangeReader {
+ public:
+  StringRangeReader(const std::string &data, int64 error_offset)
+      : data_(data), error_offset_(error_offset) {}
+
+  util::Status status() const override { return util::OkStatus(); }
+  int64 Size() override { return data_.size(); }
+
+  util::Status ReadRange(int64 offset, size_t size,
+                         std::string *data) override {
+    if (offset <= error_offset_ && error_offset_ < offset + size) {
+      return util::UnavailableError("error");
+    }
+    *data = data_.substr(offset, size);
+    return util::OkStatus();
+  }
+
+ private:
+  const std::string data_;
+  const int64 error_offset_;
+};
+
+// "mock://<error offset>" reads `data` in the blocks of 7 bytes.
+class MockFileSystem : public filesystem::FileSystem {
+ public:
+  explicit MockFileSystem(const std::string &data) : data_(data) {}
+
+  std::unique_ptr<filesystem::ReadableFile> NewReadableFile(
+      absl::string_view filename, bool is_binary) override {
+    int64 error_offset = -1;
+    EXPECT_TRUE(absl::SimpleAtoi(filename.substr(7), &error_offset));
+    return filesystem::NewRangeReadableFile(
+        filename, std::make_unique<StringRangeReader>(data_, error_offset),
+        is_binary, 7, 3);
+  }
+
+  std::unique_ptr<filesystem::WritableFile> NewWritableFile(
+      absl::string_view filename, bool is_binary, bool async_flush) override {
+    return nullptr;
+  }
+
+ private:
+  const std::string data_;
+};
+
+}  // namespace
+
+TEST(UtilTest, FilesystemSchemeTest) {
+  std::vector<std::string> lines;
+  std::string data;
+  for (int i = 0; i < 100; ++i) {
+    lines.push_back(std::string(i % 20, 'a' + i % 26));
+    data += lines.back() + "\n";
+  }
+  filesystem::RegisterFileSystem("mock", std::make_unique<MockFileSystem>(data));
+
+  {
+    auto input = filesystem::NewReadableFile("mock://-1");
+    EXPECT_TRUE(input->status().ok());
+    EXPECT_EQ(data.size(), input->Size());
+    absl::string_view line;
+    for (const auto &expected : lines) {
+      EXPECT_TRUE(input->ReadLine(&line));
+      EXPECT_EQ(expected, line);
+    }
+    EXPECT_FALSE(input->ReadLine(&line));
+    EXPECT_EQ(data.size(), input->Tell());
+
+    // Random access.
+    EXPECT_TRUE(input->Seek(lines[0].size() + 1));
+    EXPECT_TRUE(input->ReadLine(&line));
+    EXPECT_EQ(lines[1], line);
+    EXPECT_EQ(lines[0].size() + lines[1].size() + 2, input->Tell());
+    EXPECT_TRUE(input->Seek(3));
+    std::string rest;
+    EXPECT_TRUE(input->ReadAll(&rest));
+    EXPECT_EQ(data.substr(3), rest);
+  }
+
+  {
+    auto input = filesystem::NewReadableFile("mock://100");
+    absl::string_view line;
+    while (input->ReadLine(&line)) {
+    }
+    EXPECT_FALSE(input->status().ok());
+  }
+
+  // The local files with the schemes.
+  const std::string filename =
+      util::JoinPath(::testing::TempDir(), "test_scheme");
+  {
+    auto output = filesystem::NewWritableFile(absl::StrCat("file://", filename));
+    EXPECT_TRUE(output->status().ok());
+    output->Write(data);
+  }
+  for (const char *scheme : {"file://", "prefetch://"}) {
+    auto input = filesystem::NewReadableFile(absl::StrCat(scheme, filename));
+    EXPECT_TRUE(input->status().ok());
+    EXPECT_EQ(data.size(), input->Size());
+    std::string line;
+    for (const auto &expected : lines) {
+      EXPECT_TRUE(input->ReadLine(&line));
+      EXPECT_EQ(expected, line);
+    }
+    EXPECT_FALSE(input->ReadLine(&line));
+    EXPECT_FALSE(
+        filesystem::NewReadableFile(absl::StrCat(scheme, filename, ".unknown"))
+            ->status()
+            .ok());
+  }
+
+  EXPECT_FALSE(filesystem::NewReadableFile("unknown://file")->status().ok());
+  EXPECT_FALSE(filesystem::NewWritableFile("unknown://file")->status().ok());
 }
 
 TEST(UtilTest, FilesystemInvalidFileTest) {
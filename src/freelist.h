@@ -33,12 +33,9 @@ class FreeList {
   }
 
   // `Free` doesn't free the object but reuse the allocated memory chunks.
+  // The elements are cleared when they are handed out again, so neither
+  // resetting the list nor allocating a chunk touches its memory.
   void Free() {
-    const int size = std::min<int>(chunk_index_ + 1, freelist_.size());
-    for (int i = 0; i < size; ++i) {
-      T* chunk = freelist_[i];
-      memset(static_cast<void*>(chunk), 0, sizeof(*chunk) * chunk_size_);
-    }
     chunk_index_ = 0;
     element_index_ = 0;
   }
@@ -46,6 +43,9 @@ class FreeList {
   // Returns the number of allocated elements.
   size_t size() const { return chunk_size_ * chunk_index_ + element_index_; }
 
+  // Returns the number of elements the chunks can hold.
+  size_t capacity() const { return chunk_size_ * freelist_.size(); }
+
   void swap(FreeList<T>& other) {
     std::swap(freelist_, other.freelist_);
     std::swap(element_index_, other.element_index_);
@@ -66,12 +66,11 @@ class FreeList {
     }
 
     if (chunk_index_ == freelist_.size()) {
-      T* chunk = new T[chunk_size_];
-      memset(static_cast<void*>(chunk), 0, sizeof(*chunk) * chunk_size_);
-      freelist_.push_back(chunk);
+      freelist_.push_back(new T[chunk_size_]);
     }
 
     T* result = freelist_[chunk_index_] + element_index_;
+    memset(static_cast<void*>(result), 0, sizeof(*result));
     ++element_index_;
 
     return result;
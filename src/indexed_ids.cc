@@ -0,0 +1,118 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "indexed_ids.h"
+
+#include <cstring>
+
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace indexed_ids {
+namespace {
+
+uint64 DecodeLittleEndian(const char *data, int size) {
+  uint64 value = 0;
+  for (int i = size - 1; i >= 0; --i) {
+    value = (value << 8) | static_cast<unsigned char>(data[i]);
+  }
+  return value;
+}
+
+}  // namespace
+
+void AppendLittleEndian(uint64 value, int size, std::string *output) {
+  for (int i = 0; i < size; ++i) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void AppendIds(const std::vector<int> &ids, int id_size, std::string *output) {
+  for (const int id : ids) AppendLittleEndian(id, id_size, output);
+}
+
+std::string IndexHeader(int id_size) {
+  std::string header(kMagic, kMagicSize);
+  AppendLittleEndian(id_size, 4, &header);
+  AppendLittleEndian(0, 4, &header);
+  AppendLittleEndian(0, 8, &header);  // The offset of the first document.
+  return header;
+}
+
+Reader::Reader() {}
+Reader::~Reader() {}
+
+util::Status Reader::Open(absl::string_view filename,
+                          absl::string_view index_filename) {
+  data_ = filesystem::NewReadableFile(filename, true);
+  RETURN_IF_ERROR(data_->status());
+  index_ = filesystem::NewReadableFile(index_filename, true);
+  RETURN_IF_ERROR(index_->status());
+  offset_ = 0;
+  status_ = util::OkStatus();
+
+  std::string header;
+  CHECK_OR_RETURN(ReadFully(index_.get(), kHeaderSize + 8, &header) &&
+                  header.compare(0, kMagicSize, kMagic) == 0)
+      << "\"" << index_filename << "\" is not an index of packed ids.";
+  id_size_ = DecodeLittleEndian(header.data() + kMagicSize, 4);
+  CHECK_OR_RETURN(id_size_ == 2 || id_size_ == 4)
+      << "Unsupported id size " << id_size_ << ".";
+  CHECK_EQ_OR_RETURN(DecodeLittleEndian(header.data() + kHeaderSize, 8), 0);
+  return util::OkStatus();
+}
+
+bool Reader::Next(std::vector<int> *ids) {
+  ids->clear();
+  if (!status_.ok() || index_ == nullptr) return false;
+  std::string offset;
+  if (!ReadFully(index_.get(), 8, &offset)) {
+    if (!offset.empty()) {
+      status_ = util::DataLossError("Truncated index of packed ids.");
+    }
+    return false;
+  }
+  const uint64 end = DecodeLittleEndian(offset.data(), 8);
+  if (end < offset_) {
+    status_ = util::DataLossError("Broken index of packed ids.");
+    return false;
+  }
+  if (!ReadFully(data_.get(), (end - offset_) * id_size_, &buffer_)) {
+    status_ = util::DataLossError("Truncated packed ids.");
+    return false;
+  }
+  ids->resize(end - offset_);
+  for (size_t i = 0; i < ids->size(); ++i) {
+    (*ids)[i] = DecodeLittleEndian(buffer_.data() + i * id_size_, id_size_);
+  }
+  offset_ = end;
+  return true;
+}
+
+bool Reader::ReadFully(filesystem::ReadableFile *file, size_t size,
+                       std::string *data) {
+  data->resize(size);
+  size_t read_size = 0;
+  while (read_size < size) {
+    const int64 n = file->Read(&(*data)[read_size], size - read_size);
+    if (n <= 0) break;
+    read_size += n;
+  }
+  data->resize(read_size);
+  return read_size == size;
+}
+
+}  // namespace indexed_ids
+}  // namespace sentencepiece
@@ -0,0 +1,85 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef INDEXED_IDS_H_
+#define INDEXED_IDS_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "filesystem.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace indexed_ids {
+
+// The packed ids of the documents written by spm_encode with
+// --output_format=id_uint16 or id_uint32, which data loaders can mmap.
+//
+// Data file:  the ids of all the documents, uint16 or uint32 each.
+// Index file: "SPMIDXV1", id size in bytes (uint32), 0 (uint32), and the
+//             offsets of the documents in the ids (uint64), from 0 to the
+//             number of all the ids. The number of the documents is
+//             (file size - kHeaderSize) / 8 - 1.
+// All the numbers are in little endian.
+constexpr char kMagic[] = "SPMIDXV1";
+constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+constexpr size_t kHeaderSize = 16;
+
+// Appends the `size` lower bytes of `value` to `output` in little endian.
+void AppendLittleEndian(uint64 value, int size, std::string *output);
+
+// Appends `ids` packed in `id_size` bytes each to `output`.
+void AppendIds(const std::vector<int> &ids, int id_size, std::string *output);
+
+// Returns the header of the index file, with the first offset.
+std::string IndexHeader(int id_size);
+
+// Reads the documents of a data file and its index in order.
+class Reader {
+ public:
+  Reader();
+  ~Reader();
+
+  util::Status Open(absl::string_view filename,
+                    absl::string_view index_filename);
+
+  // Bytes of an id, 2 or 4.
+  int id_size() const { return id_size_; }
+
+  // Reads the ids of the next document. Returns false at the end, or on an
+  // error reported by status().
+  bool Next(std::vector<int> *ids);
+
+  util::Status status() const { return status_; }
+
+ private:
+  // Reads exactly `size` bytes of `file`.
+  bool ReadFully(filesystem::ReadableFile *file, size_t size,
+                 std::string *data);
+
+  std::unique_ptr<filesystem::ReadableFile> data_;
+  std::unique_ptr<filesystem::ReadableFile> index_;
+  util::Status status_;
+  int id_size_ = 0;
+  uint64 offset_ = 0;  // The offset of the next document.
+  std::string buffer_;
+};
+
+}  // namespace indexed_ids
+}  // namespace sentencepiece
+#endif  // INDEXED_IDS_H_
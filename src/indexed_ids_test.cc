@@ -0,0 +1,80 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "indexed_ids.h"
+
+#include <string>
+#include <vector>
+
+#include "filesystem.h"
+#include "testharness.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace indexed_ids {
+namespace {
+
+void WriteFile(const std::string &filename, const std::string &data) {
+  auto output = filesystem::NewWritableFile(filename, true);
+  EXPECT_TRUE(output->Write(data));
+}
+
+TEST(IndexedIdsTest, ReadTest) {
+  const std::vector<std::vector<int>> kDocuments = {
+      {1, 2, 3}, {}, {65535, 0}, {7}};
+  const std::string filename =
+      util::JoinPath(::testing::TempDir(), "indexed_ids");
+  for (const int id_size : {2, 4}) {
+    std::string data;
+    std::string index = IndexHeader(id_size);
+    EXPECT_EQ(kHeaderSize + 8, index.size());
+    uint64 offset = 0;
+    for (const auto &ids : kDocuments) {
+      AppendIds(ids, id_size, &data);
+      offset += ids.size();
+      AppendLittleEndian(offset, 8, &index);
+    }
+    EXPECT_EQ(offset * id_size, data.size());
+    WriteFile(filename, data);
+    WriteFile(filename + ".idx", index);
+
+    Reader reader;
+    EXPECT_TRUE(reader.Open(filename, filename + ".idx").ok());
+    EXPECT_EQ(id_size, reader.id_size());
+    std::vector<int> ids;
+    for (const auto &expected : kDocuments) {
+      EXPECT_TRUE(reader.Next(&ids));
+      EXPECT_EQ(expected, ids);
+    }
+    EXPECT_FALSE(reader.Next(&ids));
+    EXPECT_TRUE(reader.status().ok());
+
+    // Truncated ids.
+    WriteFile(filename, data.substr(0, data.size() - 1));
+    EXPECT_TRUE(reader.Open(filename, filename + ".idx").ok());
+    while (reader.Next(&ids)) {
+    }
+    EXPECT_FALSE(reader.status().ok());
+  }
+
+  // Not an index.
+  WriteFile(filename + ".idx", "SPMIDXV2");
+  Reader reader;
+  EXPECT_FALSE(reader.Open(filename, filename + ".idx").ok());
+  EXPECT_FALSE(reader.Open(filename, filename + ".not_found").ok());
+}
+
+}  // namespace
+}  // namespace indexed_ids
+}  // namespace sentencepiece
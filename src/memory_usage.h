@@ -0,0 +1,62 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef MEMORY_USAGE_H_
+#define MEMORY_USAGE_H_
+
+#include <string>
+#include <vector>
+
+#include "third_party/absl/strings/string_view.h"
+#include "third_party/darts_clone/darts.h"
+
+namespace sentencepiece {
+namespace memory_usage {
+
+// Approximate heap bytes of the containers for MemoryUsage, without the
+// allocator overhead.
+
+inline size_t String(const std::string &s) {
+  // Short strings are stored in the object itself.
+  return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+
+template <typename T>
+size_t Vector(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+inline size_t Vector(const std::vector<bool> &v) { return v.capacity() / 8; }
+
+// The buckets and a node of the value and two pointers per element, as in
+// std::unordered_map. An empty map has one bucket inside the object.
+template <typename Map>
+size_t HashMap(const Map &m) {
+  const size_t buckets = m.bucket_count() > 1 ? m.bucket_count() : 0;
+  return buckets * sizeof(void *) +
+         m.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void *));
+}
+
+// The units of `trie`, or 0 if it is null or its units are `mapped`, i.e.,
+// it does not own them.
+inline size_t Trie(const Darts::DoubleArray *trie,
+                   absl::string_view mapped = absl::string_view()) {
+  if (trie == nullptr) return 0;
+  if (!mapped.empty() && trie->array() == mapped.data()) return 0;
+  return trie->total_size();
+}
+
+}  // namespace memory_usage
+}  // namespace sentencepiece
+#endif  // MEMORY_USAGE_H_
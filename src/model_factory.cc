@@ -23,21 +23,22 @@ namespace sentencepiece {
 
 // Instantiate Model instance from |model_proto|
 std::unique_ptr<ModelInterface> ModelFactory::Create(
-    const ModelProto& model_proto) {
+    const ModelProto& model_proto,
+    std::shared_ptr<const CompiledModel> compiled_model) {
   const auto& trainer_spec = model_proto.trainer_spec();
 
   switch (trainer_spec.model_type()) {
     case TrainerSpec::UNIGRAM:
-      return std::make_unique<unigram::Model>(model_proto);
+      return std::make_unique<unigram::Model>(model_proto, compiled_model);
       break;
     case TrainerSpec::BPE:
-      return std::make_unique<bpe::Model>(model_proto);
+      return std::make_unique<bpe::Model>(model_proto, compiled_model);
       break;
     case TrainerSpec::WORD:
-      return std::make_unique<word::Model>(model_proto);
+      return std::make_unique<word::Model>(model_proto, compiled_model);
       break;
     case TrainerSpec::CHAR:
-      return std::make_unique<character::Model>(model_proto);
+      return std::make_unique<character::Model>(model_proto, compiled_model);
       break;
     default:
       LOG(ERROR) << "Unknown model_type: " << trainer_spec.model_type();
@@ -24,8 +24,11 @@ namespace sentencepiece {
 
 class ModelFactory {
  public:
-  // Creates Model instance from |model_proto|.
-  static std::unique_ptr<ModelInterface> Create(const ModelProto &model_proto);
+  // Creates Model instance from |model_proto|. The arrays found in
+  // |compiled_model| are used in place instead of being built.
+  static std::unique_ptr<ModelInterface> Create(
+      const ModelProto &model_proto,
+      std::shared_ptr<const CompiledModel> compiled_model = nullptr);
 };
 }  // namespace sentencepiece
 #endif  // MODEL_FACTORY_H_
@@ -15,15 +15,61 @@
 #include "model_interface.h"
 
 #include <algorithm>
+#include <cstring>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "memory_usage.h"
 #include "sentencepiece_model.pb.h"
+#include "third_party/absl/strings/str_cat.h"
 #include "third_party/absl/strings/str_format.h"
 #include "util.h"
 
 namespace sentencepiece {
 
+namespace {
+thread_local const VocabularyMask *current_vocabulary_mask = nullptr;
+
+// Returns the fingerprint of the pieces and of their types, which decide the
+// contents of the tries.
+uint64 PiecesFingerprint(const ModelProto &model_proto) {
+  uint64 fp = model_proto.pieces_size();
+  for (const auto &sp : model_proto.pieces()) {
+    const auto &piece = sp.piece();
+    fp = port::FingerprintCat(fp, sp.type());
+    fp = port::FingerprintCat(fp, piece.size());
+    for (size_t i = 0; i < piece.size(); i += sizeof(uint64)) {
+      uint64 chunk = 0;
+      memcpy(&chunk, piece.data() + i,
+             std::min(sizeof(uint64), piece.size() - i));
+      fp = port::FingerprintCat(fp, chunk);
+    }
+  }
+  return fp;
+}
+}  // namespace
+
+ScopedVocabularyMask::ScopedVocabularyMask(const VocabularyMask *mask)
+    : prev_(current_vocabulary_mask) {
+  current_vocabulary_mask = mask;
+}
+
+ScopedVocabularyMask::~ScopedVocabularyMask() {
+  current_vocabulary_mask = prev_;
+}
+
+const VocabularyMask *ScopedVocabularyMask::current() {
+  return current_vocabulary_mask;
+}
+
 ModelInterface::ModelInterface(const ModelProto &model_proto)
-    : model_proto_(&model_proto), status_(util::OkStatus()) {}
+    : model_proto_(&model_proto), status_(util::OkStatus()) {
+  byte_to_id_.fill(-1);
+}
 ModelInterface::~ModelInterface() {}
 
 #define RETURN_PIECE(name, default_value)                                \
@@ -48,7 +94,146 @@ absl::string_view ModelInterface::pad_piece() const {
 
 #undef RETURN_PIECE
 
+void ModelInterface::EncodeBatch(const std::vector<absl::string_view> &inputs,
+                                 EncodeScratch *scratch,
+                                 EncodeBatchResult *output) const {
+  output->pieces.clear();
+  output->offsets.assign(1, 0);
+  for (const auto normalized : inputs) {
+    const auto result = Encode(normalized);
+    output->pieces.insert(output->pieces.end(), result.begin(), result.end());
+    output->offsets.push_back(output->pieces.size());
+  }
+}
+
+EncodeResult ModelInterface::SampleEncodeWithGenerator(
+    absl::string_view normalized, float alpha,
+    SampleGenerator *generator) const {
+  if (IsSeededSampleEncodeAvailable()) {
+    return SampleEncodeWithSeed(normalized, alpha, (*generator)());
+  }
+  LOG(ERROR) << "Not implemented.";
+  return EncodeResult();
+}
+
+namespace {
+// Space symbol (U+2581)
+constexpr absl::string_view kSpaceSymbol = "\xe2\x96\x81";
+}  // namespace
+
+bool ModelInterface::PiecesAreWithinWords(std::string *piece) const {
+  if (!model_proto_) return false;
+  // A word is a segmentation unit when no piece crosses its boundaries,
+  // i.e., whitespaces only appear at the beginning (or the end) of pieces.
+  const bool treat_ws_as_suffix =
+      model_proto_->trainer_spec().treat_whitespace_as_suffix();
+  for (const auto &sp : model_proto_->pieces()) {
+    if (sp.type() == ModelProto::SentencePiece::CONTROL ||
+        sp.type() == ModelProto::SentencePiece::UNKNOWN ||
+        sp.type() == ModelProto::SentencePiece::BYTE) {
+      continue;
+    }
+    const absl::string_view w = sp.piece();
+    const size_t pos =
+        treat_ws_as_suffix ? w.find(kSpaceSymbol) : w.rfind(kSpaceSymbol);
+    const size_t boundary =
+        treat_ws_as_suffix ? w.size() - kSpaceSymbol.size() : 0;
+    if (pos != absl::string_view::npos && pos != boundary) {
+      if (piece != nullptr) *piece = sp.piece();
+      return false;
+    }
+  }
+  return true;
+}
+
+util::Status ModelInterface::SetEncodeCacheCapacity(size_t capacity) {
+  RETURN_IF_ERROR(status());
+  if (capacity == 0) {
+    encode_cache_.reset();
+    return util::OkStatus();
+  }
+
+  std::string piece;
+  if (!PiecesAreWithinWords(&piece)) {
+    return util::FailedPreconditionError(
+        absl::StrCat("The encode cache needs pieces without inner "
+                     "whitespaces, but \"",
+                     piece, "\" has one."));
+  }
+
+  encode_cache_ = std::make_unique<EncodeCache>(capacity);
+  return util::OkStatus();
+}
+
+void ModelInterface::OnPieceTypesChanged() {
+  InitializePieceAttributes();
+  if (encode_cache_) encode_cache_->Clear();
+}
+
+EncodeResult ModelInterface::EncodeWithCache(
+    absl::string_view normalized,
+    const std::function<EncodeResult(absl::string_view)> &encode_word) const {
+  const bool treat_ws_as_suffix =
+      model_proto_->trainer_spec().treat_whitespace_as_suffix();
+  const char *begin = normalized.data();
+  const char *end = normalized.data() + normalized.size();
+
+  EncodeResult results;
+  EncodeCache::Segment segment;
+  const auto *token = ScopedCancellation::current();
+  while (begin < end) {
+    // A word starts with a whitespace, or ends with it when
+    // `treat_ws_as_suffix` is true.
+    const char *word_end = begin;
+    while (word_end < end) {
+      const int mblen =
+          std::min<int>(string_util::OneCharLen(word_end), end - word_end);
+      const bool is_ws = absl::string_view(word_end, mblen) == kSpaceSymbol;
+      if (is_ws && !treat_ws_as_suffix && word_end != begin) break;
+      word_end += mblen;
+      if (is_ws && treat_ws_as_suffix) break;
+    }
+    const absl::string_view word(begin, word_end - begin);
+    begin = word_end;
+
+    if (word.size() > EncodeCache::kMaxWordSize) {
+      const auto word_results = encode_word(word);
+      results.insert(results.end(), word_results.begin(), word_results.end());
+      continue;
+    }
+
+    if (encode_cache_->Lookup(word, &segment)) {
+      size_t pos = 0;
+      for (const auto &p : segment) {
+        results.emplace_back(word.substr(pos, p.first), p.second);
+        pos += p.first;
+      }
+      continue;
+    }
+
+    const auto word_results = encode_word(word);
+    // The segmentation of a cancelled encode is not cached.
+    if (token != nullptr && token->IsCancelled()) return results;
+    segment.clear();
+    for (const auto &p : word_results) {
+      segment.emplace_back(p.first.size(), p.second);
+    }
+    encode_cache_->Insert(word, segment);
+    results.insert(results.end(), word_results.begin(), word_results.end());
+  }
+
+  return results;
+}
+
 int ModelInterface::PieceToId(absl::string_view piece) const {
+  if (piece_ids_) {
+    // A length of 0 would make the trie read a NUL-terminated key.
+    if (piece.empty()) return unk_id_;
+    int id = -1;
+    piece_ids_->exactMatchSearch(piece.data(), id, piece.size());
+    return id < 0 ? unk_id_ : id;
+  }
+
   auto it = reserved_id_map_.find(piece);
   if (it != reserved_id_map_.end()) {
     return it->second;
@@ -60,10 +245,31 @@ int ModelInterface::PieceToId(absl::string_view piece) const {
   return unk_id_;
 }
 
+void ModelInterface::InitializePieceAttributes() {
+  scores_.clear();
+  types_.clear();
+  has_user_defined_or_unused_ = false;
+  if (!model_proto_) return;
+  scores_.reserve(model_proto_->pieces_size());
+  types_.reserve(model_proto_->pieces_size());
+  for (const auto &sp : model_proto_->pieces()) {
+    scores_.push_back(sp.score());
+    types_.push_back(static_cast<uint8>(sp.type()));
+    has_user_defined_or_unused_ |=
+        sp.type() == ModelProto::SentencePiece::USER_DEFINED ||
+        sp.type() == ModelProto::SentencePiece::UNUSED;
+  }
+}
+
 void ModelInterface::InitializePieces() {
+  InitializePieceAttributes();
+  InitializePrecompiledTrie();
   pieces_.clear();
   reserved_id_map_.clear();
   unk_id_ = -1;
+  byte_to_id_.fill(-1);
+  id_to_byte_.clear();
+  min_byte_id_ = 0;
 
   std::set<absl::string_view> user_defined_symbols;
   std::vector<bool> byte_found(256, false);
@@ -124,6 +330,7 @@ void ModelInterface::InitializePieces() {
       const int byte = PieceToByte(sp.piece());
       if (0 <= byte && byte < 256) {
         byte_found[byte] = true;
+        byte_to_id_[byte] = i;
       } else {
         status_ =
             util::InternalError("byte piece " + sp.piece() + " is invalid.");
@@ -147,22 +354,269 @@ void ModelInterface::InitializePieces() {
     }
   }
 
-  matcher_ = std::make_unique<normalizer::PrefixMatcher>(user_defined_symbols);
+  BuildByteIds();
+
+  matcher_ = std::make_unique<normalizer::PrefixMatcher>(
+      user_defined_symbols,
+      GetPrebuiltSection(CompiledModel::kUserDefinedSymbols));
+
+  BuildPieceIds();
 }
 
-std::vector<absl::string_view> SplitIntoWords(absl::string_view text,
-                                              bool treat_ws_as_suffix,
-                                              bool allow_ws_only_pieces) {
+void ModelInterface::BuildByteIds() {
+  int min_id = -1, max_id = -1;
+  for (const int id : byte_to_id_) {
+    if (id < 0) continue;
+    if (min_id < 0 || id < min_id) min_id = id;
+    max_id = std::max(max_id, id);
+  }
+  if (min_id < 0) return;
+  min_byte_id_ = min_id;
+  id_to_byte_.assign(max_id - min_id + 1, -1);
+  for (int byte = 0; byte < 256; ++byte) {
+    if (byte_to_id_[byte] >= 0) id_to_byte_[byte_to_id_[byte] - min_id] = byte;
+  }
+}
+
+void ModelInterface::BuildPieceIds() {
+  piece_ids_.reset();
+
+  auto mapped = std::make_unique<Darts::DoubleArray>();
+  if (MapCompiledArray(CompiledModel::kPieceIds, mapped.get())) {
+    piece_ids_ = std::move(mapped);
+    return;
+  }
+
+  // The reserved pieces take precedence over the normal pieces.
+  std::vector<std::pair<absl::string_view, int>> pieces(
+      reserved_id_map_.begin(), reserved_id_map_.end());
+  for (const auto &it : pieces_) {
+    if (reserved_id_map_.count(it.first) == 0) pieces.emplace_back(it);
+  }
+  if (pieces.empty()) return;
+
+  // DoubleArray::build() only accepts sorted keys.
+  std::sort(pieces.begin(), pieces.end());
+  std::vector<const char *> keys(pieces.size());
+  std::vector<size_t> lengths(pieces.size());
+  std::vector<int> values(pieces.size());
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    keys[i] = pieces[i].first.data();
+    lengths[i] = pieces[i].first.size();
+    values[i] = pieces[i].second;
+  }
+
+  auto piece_ids = std::make_unique<Darts::DoubleArray>();
+  // Keeps the hash maps on failure.
+  if (piece_ids->build(keys.size(), const_cast<char **>(keys.data()),
+                       lengths.data(), values.data()) == 0) {
+    piece_ids_ = std::move(piece_ids);
+  }
+}
+
+void ModelInterface::ReleasePieceMaps() {
+  if (!piece_ids_ || !status_.ok()) return;
+  PieceToIdMap().swap(pieces_);
+  PieceToIdMap().swap(reserved_id_map_);
+}
+
+void ModelInterface::InitializePrecompiledTrie() {
+  precompiled_trie_.clear();
+  absl::string_view data = model_proto_->precompiled_trie();
+  if (data.empty()) return;
+  // The tries are rebuilt from the pieces when the blob is broken.
+  auto ignore = [](absl::string_view reason) {
+    LOG(WARNING) << "precompiled_trie " << reason << ". Ignored.";
+  };
+  uint64 fingerprint = 0, checksum = 0;
+  if (data.size() < sizeof(fingerprint) + sizeof(checksum)) {
+    return ignore("is truncated");
+  }
+  memcpy(&fingerprint, data.data(), sizeof(fingerprint));
+  memcpy(&checksum, data.data() + sizeof(fingerprint), sizeof(checksum));
+  data.remove_prefix(sizeof(fingerprint) + sizeof(checksum));
+  // The tries are stale if the pieces are changed after they are built.
+  if (fingerprint != PiecesFingerprint(*model_proto_)) {
+    return ignore("does not match the pieces");
+  }
+  if (checksum != port::Fingerprint(data)) {
+    return ignore("is corrupted");
+  }
+
+  std::map<CompiledModel::SectionType, absl::string_view> sections;
+  while (!data.empty()) {
+    uint32 header[2];  // type, size
+    if (data.size() < sizeof(header)) return ignore("is truncated");
+    memcpy(header, data.data(), sizeof(header));
+    data.remove_prefix(sizeof(header));
+    const size_t padded_size = (static_cast<size_t>(header[1]) + 3) / 4 * 4;
+    if (data.size() < padded_size) return ignore("is truncated");
+    if (!sections
+             .emplace(static_cast<CompiledModel::SectionType>(header[0]),
+                      data.substr(0, header[1]))
+             .second) {
+      return ignore("has duplicated sections");
+    }
+    data.remove_prefix(padded_size);
+  }
+  precompiled_trie_ = std::move(sections);
+}
+
+std::string ModelInterface::SerializePrecompiledTrie() const {
+  if (!model_proto_) return "";
+  CompiledModel::Sections sections;
+  AppendCompiledSections(&sections);
+
+  // The pieces fingerprint, the checksum of the sections, and the sections.
+  const uint64 fingerprint = PiecesFingerprint(*model_proto_);
+  std::string output(reinterpret_cast<const char *>(&fingerprint),
+                     sizeof(fingerprint));
+  output.resize(sizeof(fingerprint) + sizeof(uint64));
+  for (const auto &it : sections) {
+    // The arrays are kept aligned to their 4-byte units.
+    const uint32 header[2] = {it.first, static_cast<uint32>(it.second.size())};
+    output.append(reinterpret_cast<const char *>(header), sizeof(header));
+    output.append(it.second);
+    output.resize((output.size() + 3) / 4 * 4, '\0');
+  }
+  const size_t body = sizeof(fingerprint) + sizeof(uint64);
+  const uint64 checksum =
+      port::Fingerprint(absl::string_view(output).substr(body));
+  memcpy(&output[sizeof(fingerprint)], &checksum, sizeof(checksum));
+  return output;
+}
+
+absl::string_view ModelInterface::GetPrebuiltSection(
+    CompiledModel::SectionType type) const {
+  if (compiled_model_) {
+    const auto data = compiled_model_->section(type);
+    if (!data.empty()) return data;
+  }
+  const auto it = precompiled_trie_.find(type);
+  return it == precompiled_trie_.end() ? absl::string_view() : it->second;
+}
+
+bool ModelInterface::MapCompiledArray(CompiledModel::SectionType type,
+                                      Darts::DoubleArray *array) const {
+  const auto data = GetPrebuiltSection(type);
+  if (reinterpret_cast<uintptr_t>(data.data()) % array->unit_size() != 0) {
+    return false;
+  }
+  if (data.empty() || data.size() % array->unit_size() != 0) return false;
+  array->set_array(data.data(), data.size() / array->unit_size());
+  return true;
+}
+
+void ModelInterface::AppendCompiledSections(
+    CompiledModel::Sections *sections) const {
+  if (piece_ids_) {
+    (*sections)[CompiledModel::kPieceIds].assign(
+        static_cast<const char *>(piece_ids_->array()),
+        piece_ids_->total_size());
+  }
+  const auto matcher = matcher_ ? matcher_->trie_array() : absl::string_view();
+  if (!matcher.empty()) {
+    (*sections)[CompiledModel::kUserDefinedSymbols] = std::string(matcher);
+  }
+}
+
+void ModelInterface::AddMemoryUsage(MemoryUsage *usage) const {
+  if (compiled_model_) usage->Add("compiled_model", compiled_model_->size());
+  usage->Add("piece_attributes", memory_usage::Vector(scores_) +
+                                     memory_usage::Vector(types_));
+  usage->Add("piece_maps", memory_usage::HashMap(pieces_) +
+                               memory_usage::HashMap(reserved_id_map_));
+  usage->Add("byte_ids",
+             sizeof(byte_to_id_) + memory_usage::Vector(id_to_byte_));
+  usage->Add("piece_ids",
+             memory_usage::Trie(piece_ids_.get(),
+                                GetPrebuiltSection(CompiledModel::kPieceIds)));
+  if (matcher_) usage->Add("user_defined_symbols", matcher_->GetMemoryUsage());
+  if (encode_cache_) usage->Add("encode_cache", encode_cache_->GetMemoryUsage());
+}
+
+namespace {
+
+// Returns the position of the first U+2581 at or after `pos` in the bytes
+// of `text`, or npos. The bytes are compared 16 (or 32 with AVX2) at a time:
+// a lane matches when it and the next two bytes are E2 96 81.
+size_t FindSpaceSymbol(absl::string_view text, size_t pos) {
+  const char *data = text.data();
+  const size_t size = text.size();
+#if defined(__AVX2__)
+  const __m256i e2 = _mm256_set1_epi8(static_cast<char>(0xE2));
+  const __m256i x96 = _mm256_set1_epi8(static_cast<char>(0x96));
+  const __m256i x81 = _mm256_set1_epi8(static_cast<char>(0x81));
+  for (; pos + 2 + 32 <= size; pos += 32) {
+    const char *p = data + pos;
+    const __m256i m = _mm256_and_si256(
+        _mm256_cmpeq_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), e2),
+        _mm256_and_si256(
+            _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1)),
+                x96),
+            _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 2)),
+                x81)));
+    const uint32 mask = static_cast<uint32>(_mm256_movemask_epi8(m));
+    if (mask != 0) return pos + __builtin_ctz(mask);
+  }
+#elif defined(__SSE2__)
+  const __m128i e2 = _mm_set1_epi8(static_cast<char>(0xE2));
+  const __m128i x96 = _mm_set1_epi8(static_cast<char>(0x96));
+  const __m128i x81 = _mm_set1_epi8(static_cast<char>(0x81));
+  for (; pos + 2 + 16 <= size; pos += 16) {
+    const char *p = data + pos;
+    const __m128i m = _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)),
+                       e2),
+        _mm_and_si128(
+            _mm_cmpeq_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1)),
+                x96),
+            _mm_cmpeq_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 2)),
+                x81)));
+    const int mask = _mm_movemask_epi8(m);
+    if (mask != 0) return pos + __builtin_ctz(mask);
+  }
+#endif
+  while (pos + kSpaceSymbol.size() <= size) {
+    const void *found = memchr(data + pos, kSpaceSymbol[0],
+                               size - pos - kSpaceSymbol.size() + 1);
+    if (found == nullptr) break;
+    pos = static_cast<const char *>(found) - data;
+    if (data[pos + 1] == kSpaceSymbol[1] && data[pos + 2] == kSpaceSymbol[2]) {
+      return pos;
+    }
+    ++pos;
+  }
+  return absl::string_view::npos;
+}
+
+// Whether the U+2581 at `pos` may be swallowed by a preceding lead byte
+// whose OneCharLen() reaches over `pos`, which only happens in malformed
+// UTF-8.
+bool MayBeInsideChar(absl::string_view text, size_t pos) {
+  for (size_t n = 1; n <= 3 && n <= pos; ++n) {
+    if (string_util::OneCharLen(text.data() + pos - n) > n) return true;
+  }
+  return false;
+}
+
+// Walks `text` one character at a time, the reference of SplitIntoWords()
+// for malformed UTF-8.
+void SplitIntoWordsByChar(absl::string_view text, bool treat_ws_as_suffix,
+                          bool allow_ws_only_pieces,
+                          std::vector<absl::string_view> *result) {
   const char *begin = text.data();
   const char *end = text.data() + text.size();
 
-  // Space symbol (U+2581)
-  const absl::string_view kSpaceSymbol = "\xe2\x96\x81";
   bool in_ws_sequence = false;
 
-  std::vector<absl::string_view> result;
   if (treat_ws_as_suffix) {  // put ws tokens at the end of non-ws sequences.
-    if (begin < end) result.emplace_back(begin, 0);
+    if (begin < end) result->emplace_back(begin, 0);
     while (begin < end) {
       const int mblen =
           std::min<int>(string_util::OneCharLen(begin), end - begin);
@@ -171,17 +625,17 @@ std::vector<absl::string_view> SplitIntoWords(absl::string_view text,
       if (is_ws) {  // keep track of sequences consecutive ws tokens.
         in_ws_sequence = true;
       } else if (in_ws_sequence) {
-        if (allow_ws_only_pieces) result.emplace_back(begin, 0);
+        if (allow_ws_only_pieces) result->emplace_back(begin, 0);
 
         in_ws_sequence = false;
       }
 
-      result.back() =
-          absl::string_view(result.back().data(), result.back().size() + mblen);
+      result->back() = absl::string_view(result->back().data(),
+                                         result->back().size() + mblen);
       begin += mblen;
 
       if (begin < end && is_ws && !allow_ws_only_pieces)
-        result.emplace_back(begin, 0);
+        result->emplace_back(begin, 0);
     }
   } else {
     while (begin < end) {
@@ -192,18 +646,70 @@ std::vector<absl::string_view> SplitIntoWords(absl::string_view text,
       // if is whitespace (and not in sequence if allow_ws_only_pieces is True)
       if (begin == text.data() ||
           (is_ws && (!in_ws_sequence || !allow_ws_only_pieces))) {
-        result.emplace_back(begin, 0);  // add empty string piece.
+        result->emplace_back(begin, 0);  // add empty string piece.
         in_ws_sequence = true;
       }
 
       if (in_ws_sequence && !is_ws) in_ws_sequence = false;
 
-      result.back() =
-          absl::string_view(result.back().data(), result.back().size() + mblen);
+      result->back() = absl::string_view(result->back().data(),
+                                         result->back().size() + mblen);
       begin += mblen;
     }
   }
+}
 
+}  // namespace
+
+void SplitIntoWords(absl::string_view text, bool treat_ws_as_suffix,
+                    bool allow_ws_only_pieces,
+                    std::vector<absl::string_view> *words) {
+  words->clear();
+  if (text.empty()) return;
+
+  // Jumps from a U+2581 to the next instead of walking every character.
+  // A word starts at the beginning of the text, and
+  //  - at a U+2581 (unless it follows another one with
+  //    `allow_ws_only_pieces`), or with `treat_ws_as_suffix`,
+  //  - after a U+2581 (unless another one follows with
+  //    `allow_ws_only_pieces`).
+  const size_t ws_len = kSpaceSymbol.size();
+  size_t word_begin = 0;
+  size_t prev_ws = absl::string_view::npos;
+  for (size_t pos = FindSpaceSymbol(text, 0); pos != absl::string_view::npos;
+       pos = FindSpaceSymbol(text, pos + ws_len)) {
+    if (MayBeInsideChar(text, pos)) {
+      words->clear();
+      SplitIntoWordsByChar(text, treat_ws_as_suffix, allow_ws_only_pieces,
+                           words);
+      return;
+    }
+    const bool follows_ws = prev_ws != absl::string_view::npos &&
+                            prev_ws + ws_len == pos;
+    size_t next_begin = pos;
+    if (treat_ws_as_suffix) {
+      next_begin = pos + ws_len;
+      if (allow_ws_only_pieces &&
+          text.substr(next_begin, ws_len) == kSpaceSymbol) {
+        next_begin = word_begin;
+      }
+    } else if (pos == 0 || (allow_ws_only_pieces && follows_ws)) {
+      next_begin = word_begin;
+    }
+    if (next_begin != word_begin && next_begin < text.size()) {
+      words->push_back(text.substr(word_begin, next_begin - word_begin));
+      word_begin = next_begin;
+    }
+    prev_ws = pos;
+  }
+  words->push_back(text.substr(word_begin));
+}
+
+std::vector<absl::string_view> SplitIntoWords(absl::string_view text,
+                                              bool treat_ws_as_suffix,
+                                              bool allow_ws_only_pieces) {
+  std::vector<absl::string_view> result;
+  SplitIntoWords(text, treat_ws_as_suffix, allow_ws_only_pieces, &result);
   return result;
 }
 
@@ -212,20 +718,17 @@ std::string ByteToPiece(unsigned char c) {
 }
 
 int PieceToByte(absl::string_view piece) {
-  using PieceToByteMap = absl::flat_hash_map<std::string, unsigned char>;
-  static const auto *const kMap = []() -> PieceToByteMap * {
-    auto *m = new PieceToByteMap();
-    for (int i = 0; i < 256; ++i) {
-      (*m)[ByteToPiece(i)] = i;
-    }
-    return m;
-  }();
-  const auto it = kMap->find(std::string(piece));
-  if (it == kMap->end()) {
+  // Only the upper case digits of ByteToPiece().
+  auto digit = [](char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  if (piece.size() != 6 || piece.substr(0, 3) != "<0x" || piece[5] != '>') {
     return -1;
-  } else {
-    return it->second;
   }
+  const int high = digit(piece[3]), low = digit(piece[4]);
+  return high < 0 || low < 0 ? -1 : high * 16 + low;
 }
 
 }  // namespace sentencepiece
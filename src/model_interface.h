@@ -15,6 +15,9 @@
 #ifndef MODEL_INTERFACE_H_
 #define MODEL_INTERFACE_H_
 
+#include <array>
+#include <functional>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -22,6 +25,8 @@
 #include <vector>
 
 #include "common.h"
+#include "compiled_model.h"
+#include "encode_cache.h"
 #include "normalizer.h"
 #include "sentencepiece_model.pb.h"
 #include "sentencepiece_processor.h"
@@ -37,6 +42,11 @@ std::vector<absl::string_view> SplitIntoWords(
     absl::string_view text, bool treat_ws_as_suffix = false,
     bool allow_ws_only_pieces = false);
 
+// Same as above, but stores the words into `words`, reusing its capacity.
+void SplitIntoWords(absl::string_view text, bool treat_ws_as_suffix,
+                    bool allow_ws_only_pieces,
+                    std::vector<absl::string_view> *words);
+
 // Converts byte (0-255) to piece (e.g., 58 -> "<0x3A>").
 std::string ByteToPiece(unsigned char c);
 
@@ -47,6 +57,92 @@ int PieceToByte(absl::string_view piece);
 using EncodeResult = std::vector<std::pair<absl::string_view, int>>;
 using NBestEncodeResult = std::vector<std::pair<EncodeResult, float>>;
 
+// Vocabulary restriction of SentencePieceProcessor::SetVocabulary(). True for
+// the ids of the pieces the encoders must not emit. Replaces the UNUSED type
+// of the pieces in the model proto.
+using VocabularyMask = std::vector<bool>;
+
+// Restricts the vocabulary of the models encoding on the running thread to
+// `mask` while alive, so that processors sharing one model can each have
+// their own restriction. Null lifts the restriction. Scopes can be nested.
+class ScopedVocabularyMask {
+ public:
+  explicit ScopedVocabularyMask(const VocabularyMask *mask);
+  ~ScopedVocabularyMask();
+
+  ScopedVocabularyMask(const ScopedVocabularyMask &) = delete;
+  ScopedVocabularyMask &operator=(const ScopedVocabularyMask &) = delete;
+
+  // Returns the mask of the innermost scope of the running thread, or null.
+  static const VocabularyMask *current();
+
+ private:
+  const VocabularyMask *prev_;
+};
+
+// Polls the CancellationToken of the ScopedCancellation of the running
+// thread every `interval` calls of Cancelled(), so that the inner loops of
+// the encoders pay a decrement without a token. Once cancelled, an encoder
+// returns at once, and its output is discarded by the processor.
+class CancellationCheck {
+ public:
+  explicit CancellationCheck(int interval = 256)
+      : token_(ScopedCancellation::current()),
+        interval_(interval),
+        countdown_(interval) {}
+
+  bool Cancelled() {
+    if (token_ == nullptr || --countdown_ > 0) return false;
+    countdown_ = interval_;
+    return token_->IsCancelled();
+  }
+
+ private:
+  const CancellationToken *token_;
+  const int interval_;
+  int countdown_;
+};
+
+// Flat result of ModelInterface::EncodeBatch(). The pieces of the i-th input
+// are pieces[offsets[i], offsets[i + 1]) and point into the input.
+struct EncodeBatchResult {
+  EncodeResult pieces;
+  std::vector<size_t> offsets;
+};
+
+// Work buffers of ModelInterface::EncodeBatch() owned by the caller.
+// Reusing the same scratch across calls lets the buffers keep their capacity,
+// so encoding does not touch the heap once they have grown. A scratch must not
+// be used by concurrent calls.
+struct EncodeScratch {
+  // Last piece of the best path ending at every byte position of the
+  // optimized unigram Viterbi.
+  struct PathNode {
+    int id = -1;         // The vocab id (maybe -1 for UNK).
+    int starts_at = -1;  // Starting byte position of the last piece.
+  };
+  std::vector<PathNode> best_path;
+  // Scores of the best paths, indexed by the byte position modulo its size.
+  // Only the positions within the longest piece from the current one are
+  // alive, so its size does not depend on the input length.
+  std::vector<float> best_path_scores;
+
+  // Pieces found by the optimized unigram sampler. The pieces ending at the
+  // same byte position are chained in the order they are found.
+  struct SampleArc {
+    int id = -1;         // The vocab id (maybe -1 for UNK).
+    int starts_at = -1;  // Starting byte position of the piece.
+    float score = 0.0;   // Score of the piece.
+    int next = -1;       // Next piece ending at the same position, or -1.
+  };
+  std::vector<SampleArc> sample_arcs;
+  // First and last index of the pieces ending at every byte position.
+  std::vector<std::pair<int, int>> sample_arcs_ending_at;
+  // Forward scores (log sum of the path weights) ending at every byte
+  // position.
+  std::vector<float> forward_scores;
+};
+
 class ModelProto;
 
 // Underlying model interface.
@@ -63,7 +159,7 @@ class ModelInterface {
 
   // `model_proto` should not be deleted until ModelInterface is destroyed.
   explicit ModelInterface(const ModelProto &model_proto);
-  ModelInterface() {}
+  ModelInterface() { byte_to_id_.fill(-1); }
 
   virtual ~ModelInterface();
 
@@ -81,6 +177,14 @@ class ModelInterface {
   // The concatenation of pieces must be the same as `normalized`.
   virtual EncodeResult Encode(absl::string_view normalized) const = 0;
 
+  // Encodes all the normalized strings in `inputs` into `output`, replacing
+  // its contents. The result is the same as calling Encode() on every input.
+  // Models can override this to reuse the buffers in `scratch` across the
+  // inputs instead of allocating them per sentence.
+  virtual void EncodeBatch(const std::vector<absl::string_view> &inputs,
+                           EncodeScratch *scratch,
+                           EncodeBatchResult *output) const;
+
   // The same as above, but returns nbest result with score.
   virtual NBestEncodeResult NBestEncode(absl::string_view normalized,
                                         int nbest_size) const {
@@ -94,6 +198,23 @@ class ModelInterface {
     return EncodeResult();
   }
 
+  // The same as SampleEncode(), but the random numbers are drawn from a
+  // generator keyed by `seed` instead of the thread-local one, so the result
+  // only depends on `seed`. Valid only when IsSeededSampleEncodeAvailable().
+  virtual EncodeResult SampleEncodeWithSeed(absl::string_view normalized,
+                                            float alpha, uint64 seed) const {
+    LOG(ERROR) << "Not implemented.";
+    return EncodeResult();
+  }
+
+  // The same as SampleEncode(), but the random numbers are drawn from
+  // `generator` instead of the thread-local one. By default, the model
+  // draws a seed of SampleEncodeWithSeed() from it when it is available.
+  // Valid only when IsSampleEncodeAvailable().
+  virtual EncodeResult SampleEncodeWithGenerator(
+      absl::string_view normalized, float alpha,
+      SampleGenerator *generator) const;
+
   // Sample `samples` many tokenisations from the segmentation lattice
   // If `wor` is true, the samples are taken without replacement, and the scores
   // are the inclusion probabilities of the elements in the sample; otherwise
@@ -120,6 +241,9 @@ class ModelInterface {
   // Return true if SampleEncode returns a valid result.
   virtual bool IsSampleEncodeAvailable() const { return false; }
 
+  // Return true if SampleEncodeWithSeed returns a valid result.
+  virtual bool IsSeededSampleEncodeAvailable() const { return false; }
+
   // Return true if NBestEncode returns a valid result.
   virtual bool IsNBestEncodeAvailable() const { return false; }
 
@@ -149,43 +273,76 @@ class ModelInterface {
   // Returns the score of `id`.
   // Score represents a log probability of the piece.
   // We can roughly estimate the unigram frequency of the piece.
-  virtual float GetScore(int id) const {
-    return model_proto_->pieces(id).score();
-  }
+  virtual float GetScore(int id) const { return GetScoreInlined(id); }
 
   // Returns true if `id` is unknown symbol.
-  virtual bool IsUnknown(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::UNKNOWN);
-  }
+  virtual bool IsUnknown(int id) const { return IsUnknownInlined(id); }
 
   // Returns true if `id` is control symbol.
-  virtual bool IsControl(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::CONTROL);
-  }
+  virtual bool IsControl(int id) const { return IsControlInlined(id); }
 
-  // Returns true if `id` is unused symbol.
-  virtual bool IsUnused(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::UNUSED);
-  }
+  // Returns true if `id` is unused symbol, taking the vocabulary restriction
+  // of the running thread into account.
+  virtual bool IsUnused(int id) const { return IsUnusedInlined(id); }
 
   // Returns true if `id` is user defined symbol.
-  virtual bool IsUserDefined(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::USER_DEFINED);
-  }
+  virtual bool IsUserDefined(int id) const { return IsUserDefinedInlined(id); }
 
   // Returns true if `id` is byte symbol.
-  virtual bool IsByte(int id) const {
-    return (model_proto_->pieces(id).type() == ModelProto::SentencePiece::BYTE);
-  }
+  virtual bool IsByte(int id) const { return IsByteInlined(id); }
 
   virtual bool ByteFallbackEnabled() const {
     return model_proto_ && model_proto_->trainer_spec().byte_fallback();
   }
 
+  // Returns the id of the byte piece of `byte`, i.e.,
+  // PieceToId(ByteToPiece(byte)), from a table built by InitializePieces().
+  int ByteToId(unsigned char byte) const {
+    const int id = byte_to_id_[byte];
+    return id >= 0 ? id : PieceToId(ByteToPiece(byte));
+  }
+
+  // Returns the byte of the byte piece `id`, or -1 if `id` is not a byte
+  // piece.
+  int IdToByte(int id) const {
+    const size_t index = static_cast<size_t>(id - min_byte_id_);
+    if (index < id_to_byte_.size()) return id_to_byte_[index];
+    return id_to_byte_.empty() && IsByte(id) ? PieceToByte(IdToPiece(id))
+                                             : -1;
+  }
+
+  // Returns true if whitespaces only appear at the beginning (or the end with
+  // treat_whitespace_as_suffix) of the pieces, so that the segmentation of a
+  // whitespace-delimited word does not depend on the words around it.
+  // Otherwise stores a piece with an inner whitespace to `piece` if it is not
+  // null.
+  bool PiecesAreWithinWords(std::string *piece) const;
+
+  // Caches the segmentation of at most `capacity` whitespace-delimited words
+  // in Encode(). 0 disables the cache. Returns an error when a piece has a
+  // whitespace inside, since the segmentation of a word then depends on the
+  // words around it.
+  util::Status SetEncodeCacheCapacity(size_t capacity);
+
+  // Called after the types of the pieces in the model proto are changed,
+  // e.g., by SentencePieceProcessor::SetVocabulary(). Drops the cached
+  // segmentations, and models rebuild the state derived from the types.
+  virtual void OnPieceTypesChanged();
+
+  // Returns the word cache, or nullptr if it is disabled.
+  EncodeCache *encode_cache() const { return encode_cache_.get(); }
+
+  // Adds the arrays built from the model proto to `sections`, so that a
+  // compiled model loads without building them again.
+  virtual void AppendCompiledSections(CompiledModel::Sections *sections) const;
+
+  // Adds the memory held by the model, without the model proto, to `usage`.
+  virtual void AddMemoryUsage(MemoryUsage *usage) const;
+
+  // Returns the tries built from the model proto as
+  // ModelProto::precompiled_trie.
+  std::string SerializePrecompiledTrie() const;
+
   // Verifies if the `expected` and `actual` outputs are equivalent. `expected`
   // and `actual` are sentence pieces joined by space (` `). Normally it means
   // that the two strings are identical. In some model, due to float rounding
@@ -199,37 +356,97 @@ class ModelInterface {
  protected:
   void InitializePieces();
 
+  // Builds `piece_ids_` from `pieces_` and `reserved_id_map_`, or maps it
+  // from a prebuilt section.
+  void BuildPieceIds();
+
+  // Frees the hash maps `pieces_` and `reserved_id_map_` once `piece_ids_`
+  // is built, as PieceToId() no longer reads them. For the models which do
+  // not look up the maps themselves. Only the maps are dropped: the piece
+  // strings stay in the model proto, and the scores and types in their
+  // per-id arrays.
+  void ReleasePieceMaps();
+
+  // Sets `precompiled_trie_` from `model_proto_` if its fingerprint matches
+  // the pieces and its checksum matches its sections. Otherwise the tries
+  // are built from the pieces.
+  void InitializePrecompiledTrie();
+
+  // Builds `id_to_byte_` from `byte_to_id_`.
+  void BuildByteIds();
+
+  // Returns the section `type` of `compiled_model_`, or else of
+  // `precompiled_trie_`. Empty if neither has it.
+  absl::string_view GetPrebuiltSection(CompiledModel::SectionType type) const;
+
+  // Sets `array` to the prebuilt section `type` in place. Returns false if
+  // there is no such section.
+  bool MapCompiledArray(CompiledModel::SectionType type,
+                        Darts::DoubleArray *array) const;
+
+  // Copies the scores and the types of the pieces in `model_proto_` to
+  // `scores_` and `types_`. Called whenever the pieces are changed.
+  void InitializePieceAttributes();
+
   // Non-virtual (inlined) implementation for faster execution.
-  inline float GetScoreInlined(int id) const {
-    return model_proto_->pieces(id).score();
-  }
+  inline float GetScoreInlined(int id) const { return scores_[id]; }
 
   inline bool IsUnknownInlined(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::UNKNOWN);
+    return types_[id] == ModelProto::SentencePiece::UNKNOWN;
   }
 
   inline bool IsControlInlined(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::CONTROL);
+    return types_[id] == ModelProto::SentencePiece::CONTROL;
+  }
+
+  // Inner loops look up ScopedVocabularyMask::current() once and pass it.
+  inline bool IsUnusedInlined(int id, const VocabularyMask *mask) const {
+    return mask ? (*mask)[id] : types_[id] == ModelProto::SentencePiece::UNUSED;
   }
 
   inline bool IsUnusedInlined(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::UNUSED);
+    return IsUnusedInlined(id, ScopedVocabularyMask::current());
+  }
+
+  // Returns true if Encode() can use `encode_cache_`. The cached
+  // segmentations are computed without a vocabulary restriction.
+  bool IsEncodeCacheAvailable() const {
+    return encode_cache_ != nullptr && status().ok() &&
+           ScopedVocabularyMask::current() == nullptr;
   }
 
   inline bool IsUserDefinedInlined(int id) const {
-    return (model_proto_->pieces(id).type() ==
-            ModelProto::SentencePiece::USER_DEFINED);
+    return types_[id] == ModelProto::SentencePiece::USER_DEFINED;
   }
 
   inline bool IsByteInlined(int id) const {
-    return (model_proto_->pieces(id).type() == ModelProto::SentencePiece::BYTE);
+    return types_[id] == ModelProto::SentencePiece::BYTE;
   }
 
+  // Encodes `normalized` word by word. The segmentation of every word is
+  // taken from `encode_cache_`, or computed with `encode_word` and cached.
+  EncodeResult EncodeWithCache(
+      absl::string_view normalized,
+      const std::function<EncodeResult(absl::string_view)> &encode_word) const;
+
   const ModelProto *model_proto_ = nullptr;
 
+  // Compiled model of `model_proto_` the arrays are mapped from, or null.
+  std::shared_ptr<const CompiledModel> compiled_model_;
+
+  // Sections of `model_proto_->precompiled_trie()`, pointing into it.
+  std::map<CompiledModel::SectionType, absl::string_view> precompiled_trie_;
+
+  // Scores and ModelProto::SentencePiece::Type of the pieces, indexed by id.
+  // Flat copies of `model_proto_`, so that the lattice and the decoders read
+  // contiguous arrays instead of the proto messages.
+  std::vector<float> scores_;
+  std::vector<uint8> types_;
+
+  // True if some piece is USER_DEFINED or UNUSED, the types the encoders
+  // test for every piece they find.
+  bool has_user_defined_or_unused_ = false;
+
   // PrefixMatcher for user defined symbols.
   std::unique_ptr<normalizer::PrefixMatcher> matcher_;
 
@@ -239,11 +456,66 @@ class ModelInterface {
   // piece -> id map for control, unknown, and byte pieces
   PieceToIdMap reserved_id_map_;
 
+  // piece -> id of all the pieces, so that PieceToId() looks up a piece only
+  // once. Null when the model is not initialized with InitializePieces().
+  std::unique_ptr<Darts::DoubleArray> piece_ids_;
+
+  // Ids of the byte pieces by byte, and their bytes by id from
+  // `min_byte_id_`, which is 256 entries when the byte pieces are
+  // consecutive. -1 for the bytes without a piece and the ids of the other
+  // pieces in between.
+  std::array<int, 256> byte_to_id_;
+  std::vector<int16> id_to_byte_;
+  int min_byte_id_ = 0;
+
   // unknown id.
   int unk_id_ = 0;
 
   // status.
   util::Status status_;
+
+  // Segmentation of the recently encoded words.
+  std::unique_ptr<EncodeCache> encode_cache_;
+
+ private:
+  friend class PieceTypes;
+};
+
+// The type queries of the per-piece loops of the processor, e.g., building
+// the output of an encode or decoding. The built-in models, resolved once
+// by the processor when it creates the model, share the implementation of
+// ModelInterface, so their types are read inline from the flat array
+// instead of through a virtual call per piece. Other implementations, e.g.,
+// the mocks of the tests, are asked through the virtual methods. Made for
+// every call, as the types change with OnPieceTypesChanged().
+class PieceTypes {
+ public:
+  PieceTypes(const ModelInterface &model, bool builtin)
+      : model_(model),
+        types_(builtin ? model.types_.data() : nullptr),
+        byte_fallback_(model.ByteFallbackEnabled()) {}
+
+  bool IsUnknown(int id) const {
+    return types_ ? types_[id] == ModelProto::SentencePiece::UNKNOWN
+                  : model_.IsUnknown(id);
+  }
+
+  bool IsControl(int id) const {
+    return types_ ? types_[id] == ModelProto::SentencePiece::CONTROL
+                  : model_.IsControl(id);
+  }
+
+  bool IsByte(int id) const {
+    return types_ ? types_[id] == ModelProto::SentencePiece::BYTE
+                  : model_.IsByte(id);
+  }
+
+  bool byte_fallback() const { return byte_fallback_; }
+
+ private:
+  const ModelInterface &model_;
+  const uint8 *types_;
+  const bool byte_fallback_;
 };
 }  // namespace sentencepiece
 #endif  // MODEL_INTERFACE_H_
@@ -204,6 +204,148 @@ TEST(ModelInterfaceTest, PieceToIdTest) {
     EXPECT_NEAR(0.3, model->GetScore(5), 0.0001);
     EXPECT_NEAR(0.4, model->GetScore(6), 0.0001);
     EXPECT_NEAR(0.5, model->GetScore(7), 0.0001);
+
+    // The types are copied from the proto, and refreshed when they change.
+    model_proto.mutable_pieces(6)->set_type(ModelProto::SentencePiece::NORMAL);
+    EXPECT_TRUE(model->IsUnused(6));
+    model->OnPieceTypesChanged();
+    EXPECT_FALSE(model->IsUnused(6));
+  }
+}
+
+TEST(ModelInterfaceTest, PieceTypesTest) {
+  for (const auto type : kModelTypes) {
+    ModelProto model_proto = MakeBaseModelProto(type, true);
+    for (int i = 0; i < 256; ++i) AddBytePiece(&model_proto, i);
+    AddPiece(&model_proto, "a");
+
+    auto model = ModelFactory::Create(model_proto);
+    EXPECT_TRUE(model->status().ok());
+    // The inline and the virtual queries agree.
+    for (const bool builtin : {true, false}) {
+      const PieceTypes types(*model, builtin);
+      EXPECT_TRUE(types.byte_fallback());
+      for (int id = 0; id < model->GetPieceSize(); ++id) {
+        EXPECT_EQ(model->IsUnknown(id), types.IsUnknown(id));
+        EXPECT_EQ(model->IsControl(id), types.IsControl(id));
+        EXPECT_EQ(model->IsByte(id), types.IsByte(id));
+      }
+    }
+    EXPECT_TRUE(PieceTypes(*model, true).IsByte(3));
+
+    // The types changed later are read by the next PieceTypes.
+    model_proto.mutable_pieces(259)->set_type(
+        ModelProto::SentencePiece::CONTROL);
+    model->OnPieceTypesChanged();
+    EXPECT_TRUE(PieceTypes(*model, true).IsControl(259));
+  }
+}
+
+TEST(ModelInterfaceTest, PieceToIdReservedFirstTest) {
+  for (const auto type : kModelTypes) {
+    ModelProto model_proto = MakeBaseModelProto(type);
+    AddPiece(&model_proto, "a");    // 3
+    AddPiece(&model_proto, "<s>");  // 4
+    AddPiece(&model_proto, "ab");   // 5
+
+    auto model = ModelFactory::Create(model_proto);
+    EXPECT_TRUE(model->status().ok());
+    EXPECT_EQ(1, model->PieceToId("<s>"));
+    EXPECT_EQ(3, model->PieceToId("a"));
+    EXPECT_EQ(5, model->PieceToId("ab"));
+    EXPECT_EQ(0, model->PieceToId(absl::string_view("abc", 0)));
+    EXPECT_EQ(3, model->PieceToId(absl::string_view("abc", 1)));
+    EXPECT_EQ(0, model->PieceToId("<s"));
+  }
+}
+
+TEST(ModelInterfaceTest, EncodeBatchTest) {
+  for (const auto type : kModelTypes) {
+    ModelProto model_proto = MakeBaseModelProto(type);
+    AddPiece(&model_proto, "a", 0.1);
+    AddPiece(&model_proto, "b", 0.2);
+    AddPiece(&model_proto, "c", 0.3);
+    AddPiece(&model_proto, "ab", 0.4);
+    AddPiece(&model_proto, "abc", 0.5);
+    auto model = ModelFactory::Create(model_proto);
+    ASSERT_TRUE(model->status().ok());
+
+    const std::vector<absl::string_view> inputs = {"abc", "", "xab", "ab",
+                                                   "cba"};
+    EncodeScratch scratch;
+    EncodeBatchResult output;
+    // The scratch and the output can be reused across calls.
+    for (int iter = 0; iter < 2; ++iter) {
+      model->EncodeBatch(inputs, &scratch, &output);
+      ASSERT_EQ(inputs.size() + 1, output.offsets.size());
+      EXPECT_EQ(0, output.offsets[0]);
+      EXPECT_EQ(output.pieces.size(), output.offsets.back());
+      for (size_t i = 0; i < inputs.size(); ++i) {
+        const EncodeResult expected = model->Encode(inputs[i]);
+        const EncodeResult actual(
+            output.pieces.begin() + output.offsets[i],
+            output.pieces.begin() + output.offsets[i + 1]);
+        EXPECT_EQ(expected, actual);
+      }
+    }
+
+    model->EncodeBatch({}, &scratch, &output);
+    EXPECT_TRUE(output.pieces.empty());
+    EXPECT_EQ(std::vector<size_t>({0}), output.offsets);
+  }
+}
+
+TEST(ModelInterfaceTest, EncodeCacheTest) {
+  for (const auto type : {TrainerSpec::UNIGRAM, TrainerSpec::BPE}) {
+    for (const bool suffix : {false, true}) {
+      ModelProto model_proto = MakeBaseModelProto(type);
+      model_proto.mutable_trainer_spec()->set_treat_whitespace_as_suffix(
+          suffix);
+      // Dyadic scores keep the path scores exact, so ties compare equal.
+      const std::vector<std::string> kPieces = {"a", "b", "ab", "ba", "aba",
+                                                WS};
+      for (size_t i = 0; i < kPieces.size(); ++i) {
+        AddPiece(&model_proto, kPieces[i], -0.5 * (i + 1));
+        AddPiece(&model_proto, suffix ? kPieces[i] + WS : WS + kPieces[i],
+                 -0.25 * (i + 1));
+      }
+      auto model = ModelFactory::Create(model_proto);
+      ASSERT_TRUE(model->status().ok());
+      // The last piece is WS WS, which has an inner whitespace.
+      EXPECT_FALSE(model->SetEncodeCacheCapacity(100).ok());
+      EXPECT_EQ(nullptr, model->encode_cache());
+
+      model_proto.mutable_pieces()->RemoveLast();
+      model = ModelFactory::Create(model_proto);
+      ASSERT_TRUE(model->status().ok());
+
+      const std::vector<std::string> kChars = {"a", "b", "x", WS};
+      std::vector<std::string> inputs;
+      for (int i = 0; i < 200; ++i) {
+        std::string input;
+        for (int n = rand() % 30; n >= 0; --n) {
+          input += kChars[rand() % kChars.size()];
+        }
+        inputs.push_back(input);
+      }
+      std::vector<EncodeResult> expected;
+      for (const auto &input : inputs) expected.push_back(model->Encode(input));
+
+      ASSERT_TRUE(model->SetEncodeCacheCapacity(16).ok());
+      ASSERT_TRUE(model->encode_cache() != nullptr);
+      for (int iter = 0; iter < 2; ++iter) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          EXPECT_EQ(expected[i], model->Encode(inputs[i]));
+        }
+      }
+      const auto stats = model->encode_cache()->stats();
+      EXPECT_GT(stats.hits, 0);
+      EXPECT_GT(stats.misses, 0);
+      EXPECT_LE(stats.size, 16);
+
+      EXPECT_TRUE(model->SetEncodeCacheCapacity(0).ok());
+      EXPECT_EQ(nullptr, model->encode_cache());
+    }
   }
 }
 
@@ -276,6 +418,35 @@ TEST(ModelInterfaceTest, ByteFallbackModelTest) {
   }
 }
 
+TEST(ModelInterfaceTest, ByteIdsTest) {
+  for (const auto type : kModelTypes) {
+    // The byte pieces are not consecutive, nor in the order of the bytes.
+    ModelProto model_proto = MakeBaseModelProto(type, true);
+    for (int i = 255; i >= 128; --i) AddBytePiece(&model_proto, i);
+    AddPiece(&model_proto, "a");
+    for (int i = 0; i < 128; ++i) AddBytePiece(&model_proto, i);
+    auto model = ModelFactory::Create(model_proto);
+    ASSERT_TRUE(model->status().ok());
+
+    for (int byte = 0; byte < 256; ++byte) {
+      const int id = model->PieceToId(ByteToPiece(byte));
+      EXPECT_EQ(id, model->ByteToId(byte));
+      EXPECT_EQ(byte, model->IdToByte(id));
+    }
+    EXPECT_EQ(-1, model->IdToByte(model->PieceToId("a")));
+    EXPECT_EQ(-1, model->IdToByte(0));
+    EXPECT_EQ(-1, model->IdToByte(model->GetPieceSize() + 10));
+  }
+
+  // Without byte pieces.
+  ModelProto model_proto = MakeBaseModelProto(TrainerSpec::UNIGRAM);
+  AddPiece(&model_proto, "a");
+  auto model = ModelFactory::Create(model_proto);
+  ASSERT_TRUE(model->status().ok());
+  EXPECT_EQ(-1, model->IdToByte(model->PieceToId("a")));
+  EXPECT_EQ(model->PieceToId("<unk>"), model->ByteToId('a'));
+}
+
 std::string RandomString(int length) {
   const char kAlphaNum[] =
       "0123456789"
@@ -457,6 +628,63 @@ TEST(ModelInterfaceTest, SplitIntoWordsWhiteSpaceOnly) {
   }
 }
 
+// The character walk SplitIntoWords() used to make.
+std::vector<absl::string_view> SplitIntoWordsByChar(absl::string_view text,
+                                                    bool treat_ws_as_suffix,
+                                                    bool allow_ws_only_pieces) {
+  const absl::string_view ws = WS;
+  const char *begin = text.data();
+  const char *end = text.data() + text.size();
+  bool in_ws_sequence = false;
+  std::vector<absl::string_view> result;
+  while (begin < end) {
+    const int mblen =
+        std::min<int>(string_util::OneCharLen(begin), end - begin);
+    const bool is_ws = absl::string_view(begin, mblen) == ws;
+    if (treat_ws_as_suffix) {
+      if (begin == text.data() ||
+          (!is_ws && in_ws_sequence && allow_ws_only_pieces)) {
+        result.emplace_back(begin, 0);
+      }
+      in_ws_sequence = is_ws;
+    } else {
+      if (begin == text.data() ||
+          (is_ws && (!in_ws_sequence || !allow_ws_only_pieces))) {
+        result.emplace_back(begin, 0);
+      }
+      in_ws_sequence = is_ws;
+    }
+    result.back() =
+        absl::string_view(result.back().data(), result.back().size() + mblen);
+    begin += mblen;
+    if (treat_ws_as_suffix && begin < end && is_ws && !allow_ws_only_pieces) {
+      result.emplace_back(begin, 0);
+    }
+  }
+  return result;
+}
+
+TEST(ModelInterfaceTest, SplitIntoWordsRandomTest) {
+  // Includes the bytes of U+2581 alone, and lead bytes swallowing it.
+  const std::vector<std::string> kFragments = {
+      "a", "bc", WS, WS WS, "\xE2", "\x96", "\x81", "\xC3", "\xE3\x81", "\xF0",
+      "\xC3\xA9", "\xE3\x81\x82", "\xF0\x9F\x98\x80"};
+  std::vector<absl::string_view> words;
+  for (int i = 0; i < 5000; ++i) {
+    std::string text;
+    const int size = rand() % (i % 10 == 0 ? 200 : 20);
+    for (int j = 0; j < size; ++j) {
+      text += kFragments[rand() % kFragments.size()];
+    }
+    for (const bool suffix : {false, true}) {
+      for (const bool allow_ws_only : {false, true}) {
+        SplitIntoWords(text, suffix, allow_ws_only, &words);
+        EXPECT_EQ(SplitIntoWordsByChar(text, suffix, allow_ws_only), words);
+      }
+    }
+  }
+}
+
 TEST(ModelInterfaceTest, ByteToPieceTest) {
   EXPECT_EQ(ByteToPiece(0), "<0x00>");
   EXPECT_EQ(ByteToPiece(1), "<0x01>");
@@ -14,10 +14,16 @@
 
 #include "normalizer.h"
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "common.h"
+#include "memory_usage.h"
 #include "third_party/absl/strings/match.h"
 #include "third_party/absl/strings/string_view.h"
 #include "third_party/absl/strings/strip.h"
@@ -28,6 +34,38 @@ namespace sentencepiece {
 namespace normalizer {
 
 constexpr int Normalizer::kMaxTrieResultsSize;
+constexpr int32 Normalizer::kNoRule;
+constexpr int32 Normalizer::kUseTrie;
+constexpr uint16 Normalizer::kNoRulePage;
+
+namespace {
+// Trailer of the codepoint table in the precompiled charsmap. The normalized
+// string always ends with "\0", so a blob without the table never ends with
+// it.
+constexpr absl::string_view kCodepointTableMagic = "CPT1";
+
+// Number of the codepoints in a page of the codepoint table.
+constexpr size_t kCodepointPageSize = 256;
+
+// Sizes of the page index and an entry of the codepoint table in bytes.
+constexpr size_t kCodepointIndexSize = 256 * 2;
+constexpr size_t kCodepointEntrySize = 8;
+
+void AppendLittleEndian(uint32 value, size_t size, std::string *output) {
+  for (size_t i = 0; i < size; ++i) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+uint32 ReadLittleEndian(const char *data, size_t size) {
+  uint32 value = 0;
+  for (size_t i = 0; i < size; ++i) {
+    value |= static_cast<uint32>(static_cast<unsigned char>(data[i]))
+             << (8 * i);
+  }
+  return value;
+}
+}  // namespace
 
 Normalizer::Normalizer(const NormalizerSpec &spec,
                        const TrainerSpec &trainer_spec)
@@ -45,33 +83,147 @@ Normalizer::Normalizer(const NormalizerSpec &spec)
 Normalizer::~Normalizer() {}
 
 void Normalizer::Init() {
-  absl::string_view index = spec_->precompiled_charsmap();
-  if (!index.empty()) {
-    absl::string_view trie_blob, normalized;
+  const absl::string_view charsmap = spec_->precompiled_charsmap();
+  if (!charsmap.empty()) {
+    status_ = GetCharsMapTables(spec_->name(), charsmap, &tables_);
+    if (!status_.ok()) return;
+    trie_ = &tables_->trie;
+    normalized_ = tables_->normalized;
+    codepoint_pages_ = tables_->codepoint_pages.data();
+    codepoint_entries_ = tables_->codepoint_entries.data();
+  }
+  InitIdentityAscii();
+}
+
+// static
+util::Status Normalizer::LoadCharsMapTables(absl::string_view charsmap,
+                                            CharsMapTables *tables) {
+  absl::string_view trie_blob, normalized, codepoint_table;
 #ifdef IS_BIG_ENDIAN
-    status_ = DecodePrecompiledCharsMap(index, &trie_blob, &normalized,
-                                        &precompiled_charsmap_buffer_);
+  RETURN_IF_ERROR(DecodePrecompiledCharsMap(charsmap, &trie_blob, &normalized,
+                                            &tables->trie_buffer,
+                                            &codepoint_table));
 #else
-    status_ = DecodePrecompiledCharsMap(index, &trie_blob, &normalized);
+  RETURN_IF_ERROR(DecodePrecompiledCharsMap(charsmap, &trie_blob, &normalized,
+                                            nullptr, &codepoint_table));
 #endif
-    if (!status_.ok()) return;
 
-    // Reads the body of double array.
-    trie_ = std::make_unique<Darts::DoubleArray>();
+  // Reads the body of double array.
+  // The second arg of set_array is not the size of blob,
+  // but the number of double array units.
+  tables->trie.set_array(trie_blob.data(),
+                         trie_blob.size() / tables->trie.unit_size());
+
+  tables->normalized = normalized.data();
+
+  if (codepoint_table.empty()) {
+    // Blobs compiled before the codepoint table.
+    LoadCodepointTable(*GetBuiltCodepointTable(charsmap, tables->trie),
+                       tables);
+  } else {
+    RETURN_IF_ERROR(VerifyCodepointTable(codepoint_table, normalized.size(),
+                                         tables->trie.size()));
+    LoadCodepointTable(codepoint_table, tables);
+  }
+  return util::OkStatus();
+}
+
+namespace {
+// Names of the charsmaps of Builder::GetPrecompiledCharsMap().
+bool IsBuiltinRule(absl::string_view name) {
+  for (const absl::string_view rule :
+       {"nfkc", "nmt_nfkc", "nfkc_cf", "nmt_nfkc_cf"}) {
+    if (name == rule) return true;
+  }
+  return false;
+}
+}  // namespace
+
+// static
+util::Status Normalizer::GetCharsMapTables(
+    absl::string_view name, absl::string_view charsmap,
+    std::shared_ptr<const CharsMapTables> *tables) {
+  if (!IsBuiltinRule(name)) {
+    auto own = std::make_shared<CharsMapTables>();
+    RETURN_IF_ERROR(LoadCharsMapTables(charsmap, own.get()));
+    *tables = std::move(own);
+    return util::OkStatus();
+  }
 
-    // The second arg of set_array is not the size of blob,
-    // but the number of double array units.
-    trie_->set_array(const_cast<char *>(trie_blob.data()),
-                     trie_blob.size() / trie_->unit_size());
+  // The tables of every builtin rule loaded, kept while a normalizer uses
+  // them. A charsmap of another version under the same name replaces them.
+  struct Cache {
+    std::mutex mutex;
+    std::map<std::string, std::weak_ptr<const CharsMapTables>> tables;
+  };
+  static auto *cache = new Cache;
+
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  auto &cached = cache->tables[std::string(name)];
+  auto shared = cached.lock();
+  if (shared == nullptr || shared->charsmap != charsmap) {
+    auto own = std::make_shared<CharsMapTables>();
+    own->charsmap.assign(charsmap.data(), charsmap.size());
+    RETURN_IF_ERROR(LoadCharsMapTables(own->charsmap, own.get()));
+    shared = std::move(own);
+    cached = shared;
+  }
+  *tables = std::move(shared);
+  return util::OkStatus();
+}
+
+void Normalizer::SetPrefixMatcher(const PrefixMatcher *matcher) {
+  matcher_ = matcher;
+  InitIdentityAscii();
+}
 
-    normalized_ = normalized.data();
+void Normalizer::InitIdentityAscii() {
+  is_identity_ascii_.fill(false);
+  if (!status_.ok()) return;
+  for (int c = 1; c < 128; ++c) {
+    const char key = static_cast<char>(c);
+    if (key == ' ') continue;
+    if (matcher_ != nullptr && matcher_->HasEntryStartingWith(key)) continue;
+    bool identity = true;
+    if (trie_ != nullptr) {
+      size_t node_pos = 0, key_pos = 0;
+      const int result = trie_->traverse(&key, node_pos, key_pos, 1);
+      if (result >= 0) {
+        // A rule for `key` alone.
+        identity = false;
+      } else if (result == -1) {
+        // Rules for longer keys. The ones followed by a non-ASCII character
+        // are handled by IdentityAsciiPrefixLength().
+        for (int next = 1; next < 128 && identity; ++next) {
+          const char next_key = static_cast<char>(next);
+          size_t next_node_pos = node_pos, next_key_pos = 0;
+          identity = trie_->traverse(&next_key, next_node_pos, next_key_pos,
+                                     1) == -2;
+        }
+      }
+    }
+    is_identity_ascii_[c] = identity;
+  }
+}
+
+size_t Normalizer::IdentityAsciiPrefixLength(absl::string_view input) const {
+  size_t length = 0;
+  while (length < input.size() &&
+         is_identity_ascii_[static_cast<unsigned char>(input[length])]) {
+    ++length;
+  }
+  // A rule may combine the last byte with the following non-ASCII character.
+  if (length > 0 && length < input.size() &&
+      static_cast<unsigned char>(input[length]) >= 0x80) {
+    --length;
   }
+  return length;
 }
 
 util::Status Normalizer::Normalize(absl::string_view input,
                                    std::string *normalized,
                                    std::vector<size_t> *norm_to_orig) const {
-  norm_to_orig->clear();
+  if (norm_to_orig != nullptr) norm_to_orig->clear();
   normalized->clear();
 
   if (input.empty()) {
@@ -80,10 +232,33 @@ util::Status Normalizer::Normalize(absl::string_view input,
 
   RETURN_IF_ERROR(status());
 
+  // The spec may be changed after the construction, so the specialization
+  // is picked for every input rather than for every character.
+  using NormalizeFn = util::Status (Normalizer::*)(
+      absl::string_view, std::string *, std::vector<size_t> *) const;
+  static constexpr NormalizeFn kNormalizeFns[2][2][2] = {
+      {{&Normalizer::NormalizeWithFlags<false, false, false>,
+        &Normalizer::NormalizeWithFlags<false, false, true>},
+       {&Normalizer::NormalizeWithFlags<false, true, false>,
+        &Normalizer::NormalizeWithFlags<false, true, true>}},
+      {{&Normalizer::NormalizeWithFlags<true, false, false>,
+        &Normalizer::NormalizeWithFlags<true, false, true>},
+       {&Normalizer::NormalizeWithFlags<true, true, false>,
+        &Normalizer::NormalizeWithFlags<true, true, true>}}};
+  const NormalizeFn normalize =
+      kNormalizeFns[spec_->escape_whitespaces()]
+                   [spec_->remove_extra_whitespaces()][norm_to_orig != nullptr];
+  return (this->*normalize)(input, normalized, norm_to_orig);
+}
+
+template <bool kEscapeWhitespaces, bool kRemoveExtraWhitespaces, bool kAlign>
+util::Status Normalizer::NormalizeWithFlags(
+    absl::string_view input, std::string *normalized,
+    std::vector<size_t> *norm_to_orig) const {
   int consumed = 0;
 
   // Ignores heading space.
-  if (spec_->remove_extra_whitespaces()) {
+  if constexpr (kRemoveExtraWhitespaces) {
     while (!input.empty()) {
       const auto p = NormalizePrefix(input);
       if (p.first != " ") {
@@ -102,22 +277,28 @@ util::Status Normalizer::Normalize(absl::string_view input,
   // Reserves the output buffer to avoid re-allocations.
   const size_t kReservedSize = input.size() * 3;
   normalized->reserve(kReservedSize);
-  norm_to_orig->reserve(kReservedSize);
+  if constexpr (kAlign) norm_to_orig->reserve(kReservedSize);
+
+  // Aligns the next `size` bytes of `normalized` to `orig`.
+  auto add_alignment = [&norm_to_orig](size_t orig, size_t size) {
+    if constexpr (kAlign) {
+      for (size_t n = 0; n < size; ++n) norm_to_orig->push_back(orig);
+    }
+  };
 
   // Replaces white space with U+2581 (LOWER ONE EIGHT BLOCK)
   // if escape_whitespaces() is set (default = true).
   const absl::string_view kSpaceSymbol = "\xe2\x96\x81";
 
   // adds kSpaceSymbol to the current context.
-  auto add_ws = [this, &consumed, &normalized, &norm_to_orig, &kSpaceSymbol]() {
-    if (spec_->escape_whitespaces()) {
+  auto add_ws = [this, &consumed, &normalized, &add_alignment,
+                 &kSpaceSymbol]() {
+    if constexpr (kEscapeWhitespaces) {
       normalized->append(kSpaceSymbol.data(), kSpaceSymbol.size());
-      for (size_t n = 0; n < kSpaceSymbol.size(); ++n) {
-        norm_to_orig->push_back(consumed);
-      }
+      add_alignment(consumed, kSpaceSymbol.size());
     } else {
       normalized->append(" ");
-      norm_to_orig->push_back(consumed);
+      add_alignment(consumed, 1);
     }
   };
 
@@ -127,8 +308,23 @@ util::Status Normalizer::Normalize(absl::string_view input,
   // "_world" as one symbol.
   if (!treat_whitespace_as_suffix_ && spec_->add_dummy_prefix()) add_ws();
 
-  bool is_prev_space = spec_->remove_extra_whitespaces();
+  bool is_prev_space = kRemoveExtraWhitespaces;
   while (!input.empty()) {
+    // Copies the bytes left as they are at once, skipping the trie lookups.
+    const size_t length = IdentityAsciiPrefixLength(input);
+    if (length > 0) {
+      normalized->append(input.data(), length);
+      if constexpr (kAlign) {
+        for (size_t n = 0; n < length; ++n) {
+          norm_to_orig->push_back(consumed + n);
+        }
+      }
+      consumed += length;
+      input.remove_prefix(length);
+      is_prev_space = false;
+      continue;
+    }
+
     auto p = NormalizePrefix(input);
     absl::string_view sp = p.first;
 
@@ -140,15 +336,13 @@ util::Status Normalizer::Normalize(absl::string_view input,
     if (!sp.empty()) {
       const char *data = sp.data();
       for (size_t n = 0; n < sp.size(); ++n) {
-        if (spec_->escape_whitespaces() && data[n] == ' ') {
+        if (kEscapeWhitespaces && data[n] == ' ') {
           // replace ' ' with kSpaceSymbol.
           normalized->append(kSpaceSymbol.data(), kSpaceSymbol.size());
-          for (size_t m = 0; m < kSpaceSymbol.size(); ++m) {
-            norm_to_orig->push_back(consumed);
-          }
+          add_alignment(consumed, kSpaceSymbol.size());
         } else {
           *normalized += data[n];
-          norm_to_orig->push_back(consumed);
+          add_alignment(consumed, 1);
         }
       }
       // Checks whether the last character of sp is whitespace.
@@ -157,41 +351,196 @@ util::Status Normalizer::Normalize(absl::string_view input,
 
     consumed += p.second;
     input.remove_prefix(p.second);
-    if (!spec_->remove_extra_whitespaces()) {
+    if constexpr (!kRemoveExtraWhitespaces) {
       is_prev_space = false;
     }
   }
 
   // Ignores trailing space.
-  if (spec_->remove_extra_whitespaces()) {
-    const absl::string_view space =
-        spec_->escape_whitespaces() ? kSpaceSymbol : " ";
+  if constexpr (kRemoveExtraWhitespaces) {
+    const absl::string_view space = kEscapeWhitespaces ? kSpaceSymbol : " ";
     while (absl::EndsWith(*normalized, space)) {
       const int length = normalized->size() - space.size();
       CHECK_GE_OR_RETURN(length, 0);
-      consumed = (*norm_to_orig)[length];
       normalized->resize(length);
-      norm_to_orig->resize(length);
+      if constexpr (kAlign) {
+        consumed = (*norm_to_orig)[length];
+        norm_to_orig->resize(length);
+      }
     }
   }
 
   // Adds a space symbol as a suffix (default is false)
   if (treat_whitespace_as_suffix_ && spec_->add_dummy_prefix()) add_ws();
 
-  norm_to_orig->push_back(consumed);
-
-  CHECK_EQ_OR_RETURN(norm_to_orig->size(), normalized->size() + 1);
+  if constexpr (kAlign) {
+    norm_to_orig->push_back(consumed);
+    CHECK_EQ_OR_RETURN(norm_to_orig->size(), normalized->size() + 1);
+  }
 
   return util::OkStatus();
 }
 
 std::string Normalizer::Normalize(absl::string_view input) const {
-  std::vector<size_t> norm_to_orig;
   std::string normalized;
-  Normalize(input, &normalized, &norm_to_orig).IgnoreError();
+  Normalize(input, &normalized, nullptr).IgnoreError();
   return normalized;
 }
 
+util::Status Normalizer::Normalize(absl::string_view input,
+                                   absl::string_view *normalized,
+                                   std::string *buffer,
+                                   std::vector<size_t> *norm_to_orig) const {
+  buffer->clear();
+  if (input.empty() || !spec_->add_dummy_prefix()) {
+    if (IsNormalized(input, norm_to_orig)) {
+      *normalized = input;
+      return util::OkStatus();
+    }
+  } else if (status_.ok() &&
+             IsNormalizedExceptDummyPrefix(input, norm_to_orig)) {
+    // Only the dummy prefix, or suffix, is added, aligned as Normalize()
+    // aligns it.
+    const absl::string_view ws =
+        spec_->escape_whitespaces() ? "\xe2\x96\x81" : " ";
+    buffer->reserve(input.size() + ws.size());
+    if (treat_whitespace_as_suffix_) {
+      buffer->append(input.data(), input.size());
+      buffer->append(ws.data(), ws.size());
+      if (norm_to_orig != nullptr) {
+        norm_to_orig->insert(norm_to_orig->end(), ws.size(), input.size());
+      }
+    } else {
+      buffer->append(ws.data(), ws.size());
+      buffer->append(input.data(), input.size());
+      if (norm_to_orig != nullptr) {
+        norm_to_orig->insert(norm_to_orig->begin(), ws.size(), 0);
+      }
+    }
+    *normalized = *buffer;
+    return util::OkStatus();
+  }
+  RETURN_IF_ERROR(Normalize(input, buffer, norm_to_orig));
+  *normalized = *buffer;
+  return util::OkStatus();
+}
+
+util::Status Normalizer::NormalizeInPlace(std::string *text) const {
+  CHECK_OR_RETURN(text);
+  if (text->empty()) return util::OkStatus();
+  RETURN_IF_ERROR(status());
+
+  // The whitespace options change the text outside of the rules.
+  if (spec_->add_dummy_prefix() || spec_->escape_whitespaces() ||
+      spec_->remove_extra_whitespaces()) {
+    std::string normalized;
+    RETURN_IF_ERROR(Normalize(*text, &normalized, nullptr));
+    text->swap(normalized);
+    return util::OkStatus();
+  }
+
+  // `normalized` is only filled from the first prefix the rules change.
+  std::string normalized;
+  bool changed = false;
+  absl::string_view input = *text;
+  while (!input.empty()) {
+    const size_t length = IdentityAsciiPrefixLength(input);
+    if (length > 0) {
+      if (changed) normalized.append(input.data(), length);
+      input.remove_prefix(length);
+      continue;
+    }
+
+    const auto p = NormalizePrefix(input);
+    if (!changed && p.first != input.substr(0, p.second)) {
+      changed = true;
+      normalized.reserve(text->size() * 3);
+      normalized.append(text->data(), input.data() - text->data());
+    }
+    if (changed) normalized.append(p.first.data(), p.first.size());
+    input.remove_prefix(p.second);
+  }
+
+  if (changed) text->swap(normalized);
+  return util::OkStatus();
+}
+
+size_t Normalizer::GetMemoryUsage() const {
+  if (tables_ == nullptr) return 0;
+  size_t bytes = memory_usage::String(tables_->charsmap) +
+                 memory_usage::Vector(tables_->codepoint_pages) +
+                 memory_usage::Vector(tables_->codepoint_entries);
+#ifdef IS_BIG_ENDIAN
+  bytes += memory_usage::String(tables_->trie_buffer);
+#endif
+  return bytes;
+}
+
+bool Normalizer::IsNormalized(absl::string_view input,
+                              std::vector<size_t> *norm_to_orig) const {
+  if (norm_to_orig != nullptr) norm_to_orig->clear();
+  if (!status_.ok()) return false;
+  // Normalize() returns no alignment for an empty input.
+  if (input.empty()) return true;
+  if (spec_->add_dummy_prefix()) return false;
+  return IsNormalizedExceptDummyPrefix(input, norm_to_orig);
+}
+
+bool Normalizer::IsNormalizedExceptDummyPrefix(
+    absl::string_view input, std::vector<size_t> *norm_to_orig) const {
+  if (norm_to_orig != nullptr) norm_to_orig->clear();
+  const bool escape_whitespaces = spec_->escape_whitespaces();
+  const bool remove_extra_whitespaces = spec_->remove_extra_whitespaces();
+
+  // A trailing U+2581 is removed as an escaped whitespace.
+  if (escape_whitespaces && remove_extra_whitespaces &&
+      absl::EndsWith(input, "\xe2\x96\x81")) {
+    return false;
+  }
+
+  if (norm_to_orig != nullptr) norm_to_orig->reserve(input.size() + 1);
+  // The bytes of a prefix normalized at once are aligned to its beginning.
+  size_t consumed = 0;
+  auto add_alignment = [&norm_to_orig, &consumed](size_t size, bool each) {
+    if (norm_to_orig == nullptr) return;
+    for (size_t n = 0; n < size; ++n) {
+      norm_to_orig->push_back(each ? consumed + n : consumed);
+    }
+  };
+
+  bool is_prev_space = remove_extra_whitespaces;
+  while (!input.empty()) {
+    const size_t length = IdentityAsciiPrefixLength(input);
+    if (length > 0) {
+      add_alignment(length, true);
+      consumed += length;
+      input.remove_prefix(length);
+      is_prev_space = false;
+      continue;
+    }
+
+    const auto p = NormalizePrefix(input);
+    if (p.first != input.substr(0, p.second)) return false;
+    if (p.first.find(' ') != absl::string_view::npos) {
+      if (escape_whitespaces) return false;
+      // Heading, trailing and repeated spaces are removed.
+      if (remove_extra_whitespaces &&
+          (is_prev_space || p.first != " " || p.second == input.size())) {
+        return false;
+      }
+      is_prev_space = true;
+    } else {
+      is_prev_space = false;
+    }
+    add_alignment(p.second, false);
+    consumed += p.second;
+    input.remove_prefix(p.second);
+  }
+
+  if (norm_to_orig != nullptr) norm_to_orig->push_back(consumed);
+  return true;
+}
+
 std::pair<absl::string_view, int> Normalizer::NormalizePrefix(
     absl::string_view input) const {
   std::pair<absl::string_view, int> result;
@@ -207,6 +556,46 @@ std::pair<absl::string_view, int> Normalizer::NormalizePrefix(
   size_t longest_length = 0;
   int longest_value = 0;
 
+  if (codepoint_pages_ != nullptr) {
+    // Most of the BMP codepoints are normalized without searching the trie
+    // from the root.
+    size_t length = 0;
+    const char32 c = string_util::DecodeUTF8(input, &length);
+    if (c < 0x10000 && (c != kUnicodeError || length == 3)) {
+      const uint16 page = codepoint_pages_[c / kCodepointPageSize];
+      if (page == kNoRulePage) {
+        return std::make_pair(input.substr(0, length), length);
+      }
+      const auto &entry = codepoint_entries_[page * kCodepointPageSize +
+                                            c % kCodepointPageSize];
+      if (entry.value != kUseTrie) {
+        if (entry.value != kNoRule) {
+          longest_length = length;
+          longest_value = entry.value;
+        }
+        if (entry.node != 0 && input.size() > length) {
+          Darts::DoubleArray::result_pair_type
+              trie_results[Normalizer::kMaxTrieResultsSize];
+          const size_t num_nodes = trie_->commonPrefixSearch(
+              input.data() + length, trie_results,
+              Normalizer::kMaxTrieResultsSize, input.size() - length,
+              entry.node);
+          for (size_t k = 0; k < num_nodes; ++k) {
+            if (length + trie_results[k].length > longest_length) {
+              longest_length = length + trie_results[k].length;
+              longest_value = trie_results[k].value;
+            }
+          }
+        }
+        if (longest_length == 0) {
+          return std::make_pair(input.substr(0, length), length);
+        }
+        return std::make_pair(absl::string_view(&normalized_[longest_value]),
+                              longest_length);
+      }
+    }
+  }
+
   if (trie_ != nullptr) {
     // Allocates trie_results in stack, which makes the encoding speed 36%
     // faster. (38k sentences/sec => 60k sentences/sec). Builder checks that the
@@ -254,7 +643,8 @@ std::pair<absl::string_view, int> Normalizer::NormalizePrefix(
 
 // static
 std::string Normalizer::EncodePrecompiledCharsMap(
-    absl::string_view trie_blob, absl::string_view normalized) {
+    absl::string_view trie_blob, absl::string_view normalized,
+    absl::string_view codepoint_table) {
   // <trie size(4byte)><double array trie><normalized string>
   std::string blob;
   blob.append(string_util::EncodePOD<uint32_t>(trie_blob.size()));
@@ -267,13 +657,21 @@ std::string Normalizer::EncodePrecompiledCharsMap(
 
   blob.append(normalized.data(), normalized.size());
 
+  // <codepoint table><table size(4byte)><magic>
+  if (!codepoint_table.empty()) {
+    blob.append(codepoint_table.data(), codepoint_table.size());
+    AppendLittleEndian(codepoint_table.size(), 4, &blob);
+    blob.append(kCodepointTableMagic.data(), kCodepointTableMagic.size());
+  }
+
   return blob;
 }
 
 // static
 util::Status Normalizer::DecodePrecompiledCharsMap(
     absl::string_view blob, absl::string_view *trie_blob,
-    absl::string_view *normalized, std::string *buffer) {
+    absl::string_view *normalized, std::string *buffer,
+    absl::string_view *codepoint_table) {
   uint32_t trie_blob_size = 0;
   if (blob.size() <= sizeof(trie_blob_size) ||
       !string_util::DecodePOD<uint32_t>(
@@ -303,26 +701,198 @@ util::Status Normalizer::DecodePrecompiledCharsMap(
 #endif
 
   blob.remove_prefix(trie_blob_size);
+
+  absl::string_view table;
+  if (absl::EndsWith(blob, kCodepointTableMagic)) {
+    const size_t trailer_size = 4 + kCodepointTableMagic.size();
+    CHECK_LE_OR_RETURN(trailer_size, blob.size())
+        << "Codepoint table is broken.";
+    const size_t table_size = ReadLittleEndian(
+        blob.data() + blob.size() - trailer_size, 4);
+    CHECK_LE_OR_RETURN(table_size, blob.size() - trailer_size)
+        << "Codepoint table size exceeds the input blob size.";
+    table = blob.substr(blob.size() - trailer_size - table_size, table_size);
+    blob.remove_suffix(trailer_size + table_size);
+  }
+  if (codepoint_table != nullptr) *codepoint_table = table;
+
   *normalized = absl::string_view(blob.data(), blob.size());
 
   return util::OkStatus();
 }
 
-PrefixMatcher::PrefixMatcher(const std::set<absl::string_view> &dic) {
+// static
+std::shared_ptr<const std::string> Normalizer::GetBuiltCodepointTable(
+    absl::string_view charsmap, const Darts::DoubleArray &trie) {
+  // The built tables by charsmap. They are dropped together once there are
+  // too many of them, which only happens with the rules of many models.
+  constexpr size_t kMaxBuiltCodepointTables = 16;
+  struct Cache {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const std::string>, std::less<>>
+        tables;
+  };
+  static auto *cache = new Cache;
+
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  const auto it = cache->tables.find(charsmap);
+  if (it != cache->tables.end()) return it->second;
+  if (cache->tables.size() >= kMaxBuiltCodepointTables) cache->tables.clear();
+  auto table = std::make_shared<const std::string>(BuildCodepointTable(trie));
+  cache->tables.emplace(std::string(charsmap), table);
+  return table;
+}
+
+// static
+std::string Normalizer::BuildCodepointTable(const Darts::DoubleArray &trie) {
+  std::vector<uint16> index(256, kNoRulePage);
+  std::vector<CodepointEntry> entries;
+  for (char32 c = 0; c < 0x10000; ++c) {
+    CodepointEntry entry = {kNoRule, 0};
+    if (c == 0 || !string_util::IsValidCodepoint(c)) {
+      entry.value = kUseTrie;
+    } else {
+      char key[4];
+      const size_t size = string_util::EncodeUTF8(c, key);
+      size_t node_pos = 0, key_pos = 0;
+      int result = -2;
+      while (key_pos < size) {
+        result = trie.traverse(key, node_pos, key_pos, key_pos + 1);
+        if (result == -2) break;
+        // A rule on a part of the codepoint is left to the trie.
+        if (result >= 0 && key_pos < size) {
+          entry.value = kUseTrie;
+          break;
+        }
+      }
+      if (result != -2 && entry.value != kUseTrie) {
+        if (result >= 0) entry.value = result;
+        for (int next = 1; next < 256; ++next) {
+          const char next_key = static_cast<char>(next);
+          size_t next_node_pos = node_pos, next_key_pos = 0;
+          if (trie.traverse(&next_key, next_node_pos, next_key_pos, 1) != -2) {
+            entry.node = node_pos;
+            break;
+          }
+        }
+      }
+    }
+    if (entry.value == kNoRule && entry.node == 0) continue;
+    uint16 &page = index[c / kCodepointPageSize];
+    if (page == kNoRulePage) {
+      page = entries.size() / kCodepointPageSize;
+      entries.resize(entries.size() + kCodepointPageSize,
+                     CodepointEntry{kNoRule, 0});
+    }
+    entries[page * kCodepointPageSize + c % kCodepointPageSize] = entry;
+  }
+
+  std::string table;
+  table.reserve(kCodepointIndexSize + entries.size() * kCodepointEntrySize);
+  for (const uint16 page : index) AppendLittleEndian(page, 2, &table);
+  for (const auto &entry : entries) {
+    AppendLittleEndian(entry.value, 4, &table);
+    AppendLittleEndian(entry.node, 4, &table);
+  }
+  return table;
+}
+
+// static
+util::Status Normalizer::VerifyCodepointTable(
+    absl::string_view codepoint_table, size_t normalized_size,
+    size_t trie_size) {
+  CHECK_GE_OR_RETURN(codepoint_table.size(), kCodepointIndexSize)
+      << "Codepoint table is broken.";
+  const size_t pages_size = codepoint_table.size() - kCodepointIndexSize;
+  CHECK_EQ_OR_RETURN(pages_size % (kCodepointPageSize * kCodepointEntrySize),
+                     0)
+      << "Codepoint table is broken.";
+  const size_t num_pages =
+      pages_size / (kCodepointPageSize * kCodepointEntrySize);
+  for (size_t i = 0; i < kCodepointIndexSize; i += 2) {
+    const uint32 page = ReadLittleEndian(codepoint_table.data() + i, 2);
+    CHECK_OR_RETURN(page == kNoRulePage || page < num_pages)
+        << "Codepoint table has an invalid page.";
+  }
+  for (size_t i = kCodepointIndexSize; i < codepoint_table.size();
+       i += kCodepointEntrySize) {
+    const int32 value =
+        static_cast<int32>(ReadLittleEndian(codepoint_table.data() + i, 4));
+    const uint32 node = ReadLittleEndian(codepoint_table.data() + i + 4, 4);
+    CHECK_OR_RETURN(value == kNoRule || value == kUseTrie ||
+                    (value >= 0 && value < normalized_size))
+        << "Codepoint table has an invalid value.";
+    CHECK_LT_OR_RETURN(node, trie_size)
+        << "Codepoint table has an invalid node.";
+  }
+  return util::OkStatus();
+}
+
+// static
+void Normalizer::LoadCodepointTable(absl::string_view codepoint_table,
+                                    CharsMapTables *tables) {
+  auto &pages = tables->codepoint_pages;
+  pages.resize(256);
+  for (size_t i = 0; i < pages.size(); ++i) {
+    pages[i] = ReadLittleEndian(codepoint_table.data() + i * 2, 2);
+  }
+  codepoint_table.remove_prefix(kCodepointIndexSize);
+  auto &entries = tables->codepoint_entries;
+  entries.resize(codepoint_table.size() / kCodepointEntrySize);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const char *data = codepoint_table.data() + i * kCodepointEntrySize;
+    entries[i].value = static_cast<int32>(ReadLittleEndian(data, 4));
+    entries[i].node = ReadLittleEndian(data + 4, 4);
+  }
+}
+
+PrefixMatcher::PrefixMatcher(const std::set<absl::string_view> &dic,
+                             absl::string_view precompiled_trie) {
   if (dic.empty()) return;
-  std::vector<const char *> key;
-  key.reserve(dic.size());
-  for (const auto &it : dic) key.push_back(it.data());
   trie_ = std::make_unique<Darts::DoubleArray>();
-  if (trie_->build(key.size(), const_cast<char **>(&key[0]), nullptr,
-                   nullptr) != 0) {
-    LOG(ERROR) << "Failed to build the TRIE for PrefixMatcher";
-    trie_.reset();
+  if (!precompiled_trie.empty() &&
+      precompiled_trie.size() % trie_->unit_size() == 0 &&
+      reinterpret_cast<uintptr_t>(precompiled_trie.data()) %
+              trie_->unit_size() ==
+          0) {
+    trie_->set_array(precompiled_trie.data(),
+                     precompiled_trie.size() / trie_->unit_size());
+  } else {
+    std::vector<const char *> key;
+    key.reserve(dic.size());
+    for (const auto &it : dic) key.push_back(it.data());
+    if (trie_->build(key.size(), const_cast<char **>(&key[0]), nullptr,
+                     nullptr) != 0) {
+      LOG(ERROR) << "Failed to build the TRIE for PrefixMatcher";
+      trie_.reset();
+      return;
+    }
+    owns_trie_ = true;
   }
+  for (const auto &it : dic) {
+    if (it.empty()) continue;
+    const unsigned char c = static_cast<unsigned char>(it[0]);
+    first_bytes_.set(c);
+    if (it.size() == 1) {
+      one_byte_entries_.set(c);
+    } else {
+      first_pairs_.set(PairHash(c, static_cast<unsigned char>(it[1])));
+    }
+  }
+}
+
+absl::string_view PrefixMatcher::trie_array() const {
+  if (trie_ == nullptr) return absl::string_view();
+  return absl::string_view(static_cast<const char *>(trie_->array()),
+                           trie_->total_size());
+}
+
+size_t PrefixMatcher::GetMemoryUsage() const {
+  return owns_trie_ ? trie_->total_size() : 0;
 }
 
 int PrefixMatcher::PrefixMatch(absl::string_view w, bool *found) const {
-  if (trie_ == nullptr) {
+  if (trie_ == nullptr || w.empty() || !MayStartEntry(w)) {
     if (found) *found = false;
     return std::min<int>(w.size(), string_util::OneCharLen(w.data()));
   }
@@ -348,17 +918,38 @@ int PrefixMatcher::PrefixMatch(absl::string_view w, bool *found) const {
 std::string PrefixMatcher::GlobalReplace(absl::string_view w,
                                          absl::string_view out) const {
   std::string result;
-  while (!w.empty()) {
+  if (!GlobalReplace(w, out, &result)) result.assign(w.data(), w.size());
+  return result;
+}
+
+bool PrefixMatcher::GlobalReplace(absl::string_view w, absl::string_view out,
+                                  std::string *result) const {
+  result->clear();
+  if (trie_ == nullptr) return false;
+
+  // `w` is copied lazily from `copied` up to the next match.
+  bool replaced = false;
+  size_t copied = 0;
+  size_t pos = 0;
+  while (pos < w.size()) {
+    // Skips the characters starting no entry without the trie.
+    if (!MayStartEntry(w.substr(pos))) {
+      pos += string_util::OneCharLen(w.data() + pos);
+      continue;
+    }
     bool found = false;
-    const int mblen = PrefixMatch(w, &found);
+    const int mblen = PrefixMatch(w.substr(pos), &found);
     if (found) {
-      result.append(out.data(), out.size());
-    } else {
-      result.append(w.data(), mblen);
+      result->append(w.data() + copied, pos - copied);
+      result->append(out.data(), out.size());
+      copied = pos + mblen;
+      replaced = true;
     }
-    w.remove_prefix(mblen);
+    pos += mblen;
   }
-  return result;
+
+  if (replaced) result->append(w.data() + copied, w.size() - copied);
+  return replaced;
 }
 
 }  // namespace normalizer
@@ -15,6 +15,8 @@
 #ifndef NORMALIZER_NORMALIZER_H_
 #define NORMALIZER_NORMALIZER_H_
 
+#include <array>
+#include <bitset>
 #include <memory>
 #include <set>
 #include <string>
@@ -34,8 +36,11 @@ namespace normalizer {
 // prefix of a query.
 class PrefixMatcher {
  public:
-  // Initializes the PrefixMatcher with `dic`.
-  explicit PrefixMatcher(const std::set<absl::string_view> &dic);
+  // Initializes the PrefixMatcher with `dic`. The trie is not built but
+  // used in place from `precompiled_trie` if it is given, which must be
+  // trie_array() of a PrefixMatcher of the same `dic` and outlive this.
+  explicit PrefixMatcher(const std::set<absl::string_view> &dic,
+                         absl::string_view precompiled_trie = {});
 
   // Finds the longest string in dic, which is a prefix of `w`.
   // Returns the UTF8 byte length of matched string.
@@ -46,8 +51,53 @@ class PrefixMatcher {
   // Replaces entries in `w` with `out`.
   std::string GlobalReplace(absl::string_view w, absl::string_view out) const;
 
+  // Writes `w` with the entries replaced by `out` into `result`, reusing its
+  // buffer. Returns false and leaves `result` empty when `w` contains no
+  // entries, so the caller can keep using `w` without a copy.
+  bool GlobalReplace(absl::string_view w, absl::string_view out,
+                     std::string *result) const;
+
+  // Returns the units of the trie, or an empty view if `dic` is empty.
+  absl::string_view trie_array() const;
+
+  // Returns the bytes of the trie built by this object, i.e., 0 if it is
+  // used in place from `precompiled_trie`.
+  size_t GetMemoryUsage() const;
+
+  // Returns true if an entry in dic starts with the byte `c`.
+  bool HasEntryStartingWith(char c) const {
+    return first_bytes_[static_cast<unsigned char>(c)];
+  }
+
  private:
+  // Returns false if no entry can be a prefix of the non-empty `w`, checking
+  // its first two bytes without the trie.
+  bool MayStartEntry(absl::string_view w) const {
+    const unsigned char c = static_cast<unsigned char>(w[0]);
+    if (!first_bytes_[c]) return false;
+    if (one_byte_entries_[c]) return true;
+    return w.size() >= 2 &&
+           first_pairs_[PairHash(c, static_cast<unsigned char>(w[1]))];
+  }
+
+  // Hashes the first two bytes of an entry into the bits of `first_pairs_`.
+  static size_t PairHash(unsigned char c1, unsigned char c2) {
+    return ((c1 * 257u + c2) * 0x9E3779B1u) >> (32 - kFirstPairBits);
+  }
+
   std::unique_ptr<Darts::DoubleArray> trie_;
+  bool owns_trie_ = false;
+
+  // The first bytes of the entries. PrefixMatch() skips the trie at the
+  // other bytes, so the text without entries is scanned quickly.
+  std::bitset<256> first_bytes_;
+
+  // The entries of one byte, and a Bloom filter of the first two bytes of
+  // the longer entries. They skip the trie at most of the positions of a
+  // first byte shared by the text, e.g., the lead bytes of UTF-8.
+  static constexpr int kFirstPairBits = 12;
+  std::bitset<256> one_byte_entries_;
+  std::bitset<1 << kFirstPairBits> first_pairs_;
 };
 
 // Normalizer implements a simple text normalizer with
@@ -68,9 +118,7 @@ class Normalizer {
   Normalizer(const NormalizerSpec &spec, const TrainerSpec &trainer_Spec);
   virtual ~Normalizer();
 
-  virtual void SetPrefixMatcher(const PrefixMatcher *matcher) {
-    matcher_ = matcher;
-  }
+  virtual void SetPrefixMatcher(const PrefixMatcher *matcher);
 
   // Returns Status.
   // Normalizes function is valid only when status is OK.
@@ -85,6 +133,8 @@ class Normalizer {
   // - Adds a prefix space.
   // - Replaces a space with a meta symbol.
   // - Removing heading, tailing and other redundant spaces.
+  // |norm_to_orig| can be nullptr when the alignment is not needed, which
+  // saves filling it.
   virtual util::Status Normalize(absl::string_view input,
                                  std::string *normalized,
                                  std::vector<size_t> *norm_to_orig) const;
@@ -93,13 +143,55 @@ class Normalizer {
   // This function is used in sentencepiece training.
   virtual std::string Normalize(absl::string_view input) const;
 
+  // Same as above, but skips the copy when the normalization leaves `input`
+  // as it is: `*normalized` then points to `input` and |norm_to_orig| is the
+  // identity. Otherwise the normalized string is stored in `buffer` and
+  // `*normalized` points to it. An input which only gets the dummy prefix
+  // is copied to `buffer` after it without running the normalization.
+  util::Status Normalize(absl::string_view input,
+                         absl::string_view *normalized, std::string *buffer,
+                         std::vector<size_t> *norm_to_orig) const;
+
+  // Normalizes `text` in place. The text is scanned once and is only
+  // rewritten from the first byte the normalization changes, so a text left
+  // as it is costs no copy. Used for the denormalization of decoded texts.
+  util::Status NormalizeInPlace(std::string *text) const;
+
+  // Returns the bytes of the tables built from the spec. The rules are used
+  // in place from the spec, which is not counted. The tables shared with
+  // the other normalizers of a builtin rule are counted by each of them.
+  size_t GetMemoryUsage() const;
+
+  // Returns true if Normalize() returns `input` as it is, scanning `input`
+  // without writing the output. |norm_to_orig| is then set to the alignment
+  // of Normalize() unless it is nullptr.
+  bool IsNormalized(absl::string_view input,
+                    std::vector<size_t> *norm_to_orig = nullptr) const;
+
   friend class Builder;
 
  private:
+  // Returns true if Normalize() returns `input` as it is, apart from the
+  // dummy prefix of add_dummy_prefix, and sets |norm_to_orig| as
+  // IsNormalized() does for the input without the dummy prefix.
+  bool IsNormalizedExceptDummyPrefix(absl::string_view input,
+                                     std::vector<size_t> *norm_to_orig) const;
+
   FRIEND_TEST(NormalizerTest, EncodeDecodePrecompiledCharsMapTest);
+  FRIEND_TEST(NormalizerTest, IdentityAsciiTest);
+  FRIEND_TEST(NormalizerTest, CodepointTableTest);
+  FRIEND_TEST(NormalizerTest, SharedCharsMapTablesTest);
 
   void Init();
 
+  // Normalize() of a non-empty input, with the whitespace options of the
+  // spec and whether to fill |norm_to_orig| as template arguments, so that
+  // the loops over the input do not test them again for every character.
+  template <bool kEscapeWhitespaces, bool kRemoveExtraWhitespaces, bool kAlign>
+  util::Status NormalizeWithFlags(absl::string_view input,
+                                  std::string *normalized,
+                                  std::vector<size_t> *norm_to_orig) const;
+
   // Normalizes the prefix of |input| and returns the pair of
   // normalized prefix and length we must consume after
   // normalization.
@@ -115,42 +207,136 @@ class Normalizer {
   std::pair<absl::string_view, int> NormalizePrefix(
       absl::string_view input) const;
 
+  // Computes `is_identity_ascii_` from the rules and `matcher_`.
+  void InitIdentityAscii();
+
+  // Returns the length of the ASCII prefix of `input` that NormalizePrefix()
+  // leaves as is, one byte at a time.
+  size_t IdentityAsciiPrefixLength(absl::string_view input) const;
+
   // Encodes trie_blob and normalized string and return compiled blob.
-  static std::string EncodePrecompiledCharsMap(absl::string_view trie_blob,
-                                               absl::string_view normalized);
+  // The optional `codepoint_table` is appended after them with a trailer,
+  // which the older decoders take as a part of the normalized string and
+  // never read.
+  static std::string EncodePrecompiledCharsMap(
+      absl::string_view trie_blob, absl::string_view normalized,
+      absl::string_view codepoint_table = "");
+
+  // Decodes blob into trie_blob and normalized string. `codepoint_table` is
+  // set to the codepoint table, or an empty string if the blob has none.
+  static util::Status DecodePrecompiledCharsMap(
+      absl::string_view blob, absl::string_view *trie_blob,
+      absl::string_view *normalized, std::string *buffer = nullptr,
+      absl::string_view *codepoint_table = nullptr);
+
+  // Makes the codepoint table of `trie`. It is a page table over the BMP
+  // codepoints: 256 little-endian uint16 page numbers indexed by the upper
+  // byte of the codepoint (kNoRulePage for the pages without rules),
+  // followed by the pages of 256 CodepointEntry, each of which is stored as
+  // a little-endian int32 value and a little-endian uint32 node.
+  static std::string BuildCodepointTable(const Darts::DoubleArray &trie);
 
-  // Decodes blob into trie_blob and normalized string.
-  static util::Status DecodePrecompiledCharsMap(absl::string_view blob,
-                                                absl::string_view *trie_blob,
-                                                absl::string_view *normalized,
-                                                std::string *buffer = nullptr);
+  // Returns BuildCodepointTable() of `trie`, the trie of `charsmap`. The
+  // tables of the last charsmaps are kept, so that the normalizers of a
+  // charsmap without a codepoint table build it once.
+  static std::shared_ptr<const std::string> GetBuiltCodepointTable(
+      absl::string_view charsmap, const Darts::DoubleArray &trie);
+
+  // Verifies `codepoint_table` against the normalized string of the size
+  // `normalized_size` and the trie of `trie_size` units.
+  static util::Status VerifyCodepointTable(absl::string_view codepoint_table,
+                                           size_t normalized_size,
+                                           size_t trie_size);
+
+  struct CharsMapTables;
+
+  // Decodes the precompiled `charsmap` into `tables`, which point into it.
+  static util::Status LoadCharsMapTables(absl::string_view charsmap,
+                                         CharsMapTables *tables);
+
+  // Returns the tables of `charsmap` in `tables`. The tables of a builtin
+  // rule `name` are shared by all the normalizers of the process with the
+  // same charsmap, and point into their own copy of it.
+  static util::Status GetCharsMapTables(
+      absl::string_view name, absl::string_view charsmap,
+      std::shared_ptr<const CharsMapTables> *tables);
+
+  // Copies `codepoint_table` to the codepoint pages and entries of `tables`.
+  static void LoadCodepointTable(absl::string_view codepoint_table,
+                                 CharsMapTables *tables);
+
+  // Rules of a BMP codepoint.
+  struct CodepointEntry {
+    // Offset of the normalized string of the codepoint, kNoRule or kUseTrie.
+    int32 value;
+    // Trie node after the codepoint, from which the longer rules starting
+    // with the codepoint are searched, or 0 if there are none.
+    uint32 node;
+  };
+
+  // Values of CodepointEntry other than the offsets.
+  // No rule matches the codepoint alone, so the codepoint is kept as is.
+  static constexpr int32 kNoRule = -1;
+  // A rule matches a part of the codepoint, so the trie is needed.
+  static constexpr int32 kUseTrie = -2;
+  static constexpr uint16 kNoRulePage = 0xFFFF;
 
   // Maximum size of the return value of Trie, which corresponds
   // to the maximum size of shared common prefix in the chars map.
   static constexpr int kMaxTrieResultsSize = 32;
 
-  // Internal trie for efficient longest matching.
-  std::unique_ptr<Darts::DoubleArray> trie_;
+  // Tables decoded from the precompiled charsmap.
+  struct CharsMapTables {
+    // Copy of the charsmap the shared tables point into.
+    std::string charsmap;
+
+#ifdef IS_BIG_ENDIAN
+    // Stores the blob for TRIE encoded in big-endian.
+    std::string trie_buffer;
+#endif
 
-  // "\0" delimitered output string.
+    // Internal trie for efficient longest matching.
+    Darts::DoubleArray trie;
+
+    // "\0" delimitered output string.
+    // the value of |trie| stores pointers to this string.
+    const char *normalized = nullptr;
+
+    // Codepoint table of BuildCodepointTable().
+    std::vector<uint16> codepoint_pages;
+    std::vector<CodepointEntry> codepoint_entries;
+  };
+
+  // Tables of the precompiled charsmap of the spec, or null without one.
+  std::shared_ptr<const CharsMapTables> tables_;
+
+  // Internal trie for efficient longest matching in `tables_`.
+  const Darts::DoubleArray *trie_ = nullptr;
+
+  // "\0" delimitered output string in `tables_`.
   // the value of |trie_| stores pointers to this string.
   const char *normalized_ = nullptr;
 
+  // Codepoint table in `tables_`, or null without the trie.
+  // NormalizePrefix() looks up the BMP codepoints in it before the trie.
+  const uint16 *codepoint_pages_ = nullptr;
+  const CodepointEntry *codepoint_entries_ = nullptr;
+
   // Spec for normalization.
   const NormalizerSpec *spec_;
 
   // Prefix matcher;
   const PrefixMatcher *matcher_ = nullptr;
 
+  // True for the ASCII bytes other than the space that normalize to
+  // themselves whatever ASCII byte follows, and start no user defined symbol.
+  // Indexed by unsigned bytes, so the non-ASCII bytes are always false.
+  std::array<bool, 256> is_identity_ascii_{};
+
   // Split hello world into "hello_" and "world_" instead of
   // "_hello" and "_world".
   const bool treat_whitespace_as_suffix_ = false;
 
-#ifdef IS_BIG_ENDIAN
-  // Stores the blob for TRIE encoded in big-endian.
-  std::string precompiled_charsmap_buffer_;
-#endif
-
   // Normalizer's status.
   util::Status status_;
 };
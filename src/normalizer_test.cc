@@ -12,12 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <set>
 #include <vector>
 
 #include "builder.h"
 #include "normalizer.h"
 #include "sentencepiece_trainer.h"
 #include "testharness.h"
+#include "third_party/absl/strings/match.h"
 #include "util.h"
 
 namespace sentencepiece {
@@ -369,6 +371,308 @@ TEST(NormalizerTest, EncodeDecodePrecompiledCharsMapTest) {
   EXPECT_FALSE(Normalizer::DecodePrecompiledCharsMap("", &trie_blob,
                                                      &normalized_blob, &buf)
                    .ok());
+
+  // Blobs without the codepoint table.
+  absl::string_view codepoint_table = "x";
+  EXPECT_TRUE(Normalizer::DecodePrecompiledCharsMap(
+                  blob, &trie_blob, &normalized_blob, &buf, &codepoint_table)
+                  .ok());
+  EXPECT_EQ("bar", normalized_blob);
+  EXPECT_TRUE(codepoint_table.empty());
+
+  const std::string blob_with_table =
+      Normalizer::EncodePrecompiledCharsMap("foo", "bar", "table");
+  EXPECT_TRUE(Normalizer::DecodePrecompiledCharsMap(blob_with_table,
+                                                    &trie_blob,
+                                                    &normalized_blob, &buf,
+                                                    &codepoint_table)
+                  .ok());
+  EXPECT_EQ("foo", trie_blob);
+  EXPECT_EQ("bar", normalized_blob);
+  EXPECT_EQ("table", codepoint_table);
+}
+
+TEST(NormalizerTest, CodepointTableTest) {
+  const std::vector<std::string> kChars = {
+      "a", " ", "\t", "Ａ", "①", "\xE3\x8D\xBF", "ｸ", "ﾞ", "\xCC\x81", "e",
+      "\xE4\xB8\x80", "\xF0\x9F\x98\x80", "\xF0\x9D\x90\x80", "\xEF\xBF\xBD",
+      "\xFF", "か", "\xE3\x82\x99", "А", "\xCC\x86"};
+
+  Builder::CharsMap chars_map;
+  chars_map[{0x61}] = {0x41};                // a => A
+  chars_map[{0x65, 0x301}] = {0xE9};         // e + acute => é
+  chars_map[{0xFF21}] = {0x41, 0x41};        // Ａ => AA
+  chars_map[{0x1F600}] = {0x3A, 0x29};       // emoji => :)
+  std::string compiled;
+  EXPECT_TRUE(Builder::CompileCharsMap(chars_map, &compiled).ok());
+  absl::string_view trie_blob, normalized_blob, codepoint_table;
+  EXPECT_TRUE(Normalizer::DecodePrecompiledCharsMap(
+                  compiled, &trie_blob, &normalized_blob, nullptr,
+                  &codepoint_table)
+                  .ok());
+  EXPECT_FALSE(codepoint_table.empty());
+  EXPECT_TRUE(Normalizer::VerifyCodepointTable(
+                  codepoint_table, normalized_blob.size(),
+                  trie_blob.size() / Darts::DoubleArray().unit_size())
+                  .ok());
+  EXPECT_FALSE(Normalizer::VerifyCodepointTable("broken", 10, 10).ok());
+
+  NormalizerSpec compiled_spec;
+  compiled_spec.set_precompiled_charsmap(compiled);
+
+  // A charsmap compiled before the codepoint table gets the same one, which
+  // is built once.
+  NormalizerSpec legacy_spec;
+  legacy_spec.set_precompiled_charsmap(
+      Normalizer::EncodePrecompiledCharsMap(trie_blob, normalized_blob));
+  {
+    const Normalizer normalizer(compiled_spec), legacy_normalizer(legacy_spec);
+    EXPECT_TRUE(legacy_normalizer.status().ok());
+    EXPECT_EQ(normalizer.tables_->codepoint_pages,
+              legacy_normalizer.tables_->codepoint_pages);
+    Darts::DoubleArray trie;
+    trie.set_array(trie_blob.data(), trie_blob.size() / trie.unit_size());
+    const auto table = Normalizer::GetBuiltCodepointTable(
+        legacy_spec.precompiled_charsmap(), trie);
+    EXPECT_EQ(codepoint_table, *table);
+    EXPECT_EQ(table, Normalizer::GetBuiltCodepointTable(
+                         legacy_spec.precompiled_charsmap(), trie));
+  }
+
+  std::vector<NormalizerSpec> specs = {
+      SentencePieceTrainer::GetNormalizerSpec("nmt_nfkc"),
+      SentencePieceTrainer::GetNormalizerSpec("nfkc_cf"), compiled_spec,
+      legacy_spec};
+  for (const auto &spec : specs) {
+    Normalizer normalizer(spec), expected_normalizer(spec);
+    EXPECT_TRUE(normalizer.status().ok());
+    EXPECT_NE(nullptr, normalizer.codepoint_pages_);
+    // Normalizes every character with the trie.
+    expected_normalizer.codepoint_pages_ = nullptr;
+
+    for (int trial = 0; trial < 1000; ++trial) {
+      std::string input;
+      const int size = rand() % 20;
+      for (int i = 0; i < size; ++i) {
+        input += kChars[rand() % kChars.size()];
+      }
+      std::string normalized, expected;
+      std::vector<size_t> norm_to_orig, expected_norm_to_orig;
+      EXPECT_TRUE(
+          normalizer.Normalize(input, &normalized, &norm_to_orig).ok());
+      EXPECT_TRUE(
+          expected_normalizer
+              .Normalize(input, &expected, &expected_norm_to_orig)
+              .ok());
+      EXPECT_EQ(expected, normalized);
+      EXPECT_EQ(expected_norm_to_orig, norm_to_orig);
+    }
+  }
+}
+
+TEST(NormalizerTest, SharedCharsMapTablesTest) {
+  const auto spec = SentencePieceTrainer::GetNormalizerSpec("nmt_nfkc");
+  auto copied_spec = spec;
+  const Normalizer normalizer(spec), other_normalizer(copied_spec);
+  EXPECT_TRUE(normalizer.status().ok());
+  EXPECT_TRUE(other_normalizer.status().ok());
+  // The copies of the builtin charsmap share one set of tables.
+  EXPECT_EQ(normalizer.tables_, other_normalizer.tables_);
+  EXPECT_EQ(spec.precompiled_charsmap(), normalizer.tables_->charsmap);
+  EXPECT_NE(copied_spec.precompiled_charsmap().data(),
+            other_normalizer.tables_->charsmap.data());
+  EXPECT_EQ(WS "ABC", normalizer.Normalize("ＡＢＣ"));
+  EXPECT_EQ(WS "ABC", other_normalizer.Normalize("ＡＢＣ"));
+
+  // Other rules, and other charsmaps under a builtin name, get their own.
+  const auto cf_spec = SentencePieceTrainer::GetNormalizerSpec("nfkc_cf");
+  const Normalizer cf_normalizer(cf_spec);
+  EXPECT_NE(normalizer.tables_, cf_normalizer.tables_);
+
+  auto renamed_spec = cf_spec;
+  renamed_spec.set_name("nmt_nfkc");
+  const Normalizer renamed_normalizer(renamed_spec);
+  EXPECT_NE(normalizer.tables_, renamed_normalizer.tables_);
+  EXPECT_EQ(cf_normalizer.Normalize("ＡＢＣ"),
+            renamed_normalizer.Normalize("ＡＢＣ"));
+
+  auto unnamed_spec = spec;
+  unnamed_spec.clear_name();
+  const Normalizer unnamed_normalizer(unnamed_spec);
+  EXPECT_NE(normalizer.tables_, unnamed_normalizer.tables_);
+  EXPECT_TRUE(unnamed_normalizer.tables_->charsmap.empty());
+}
+
+TEST(NormalizerTest, IdentityAsciiTest) {
+  const std::vector<std::string> kChars = {
+      "a", "b", "c", "A", "1", ".", " ", "\t", "\x7F", "\xCC\x81", "Ａ", "①",
+      "ｸ", "ﾞ", WS};
+  const PrefixMatcher matcher({"ab", "c" WS});
+  for (const char *name : {"nmt_nfkc", "nfkc_cf", "identity"}) {
+    for (const bool remove_extra_whitespaces : {true, false}) {
+      for (const bool with_matcher : {false, true}) {
+        auto spec = SentencePieceTrainer::GetNormalizerSpec(name);
+        spec.set_remove_extra_whitespaces(remove_extra_whitespaces);
+        Normalizer normalizer(spec), expected_normalizer(spec);
+        if (with_matcher) {
+          normalizer.SetPrefixMatcher(&matcher);
+          expected_normalizer.SetPrefixMatcher(&matcher);
+        }
+        EXPECT_EQ(!with_matcher, normalizer.is_identity_ascii_['a']);
+        EXPECT_FALSE(normalizer.is_identity_ascii_[' ']);
+        // Normalizes every byte with the rules.
+        expected_normalizer.is_identity_ascii_.fill(false);
+
+        for (int trial = 0; trial < 1000; ++trial) {
+          std::string input;
+          const int size = rand() % 20;
+          for (int i = 0; i < size; ++i) {
+            input += kChars[rand() % kChars.size()];
+          }
+          std::string normalized, expected;
+          std::vector<size_t> norm_to_orig, expected_norm_to_orig;
+          EXPECT_TRUE(
+              normalizer.Normalize(input, &normalized, &norm_to_orig).ok());
+          EXPECT_TRUE(expected_normalizer
+                          .Normalize(input, &expected, &expected_norm_to_orig)
+                          .ok());
+          EXPECT_EQ(expected, normalized);
+          EXPECT_EQ(expected_norm_to_orig, norm_to_orig);
+        }
+      }
+    }
+  }
+}
+
+TEST(NormalizerTest, IsNormalizedTest) {
+  const std::vector<std::string> kChars = {
+      "a", "b", " ", " ", "\xE2\x96\x81", "Ａ", "①", "\xCC\x81", "\xE4\xB8\x80",
+      "\xF0\x9F\x98\x80", "\xFF", "か", "\xE3\x82\x99"};
+  for (const char *name : {"nmt_nfkc", "nfkc_cf", "identity"}) {
+    for (const bool add_dummy_prefix : {true, false}) {
+      for (const bool remove_extra_whitespaces : {true, false}) {
+        for (const bool escape_whitespaces : {true, false}) {
+          auto spec = SentencePieceTrainer::GetNormalizerSpec(name);
+          spec.set_add_dummy_prefix(add_dummy_prefix);
+          spec.set_remove_extra_whitespaces(remove_extra_whitespaces);
+          spec.set_escape_whitespaces(escape_whitespaces);
+          const Normalizer normalizer(spec);
+          EXPECT_EQ(!add_dummy_prefix, normalizer.IsNormalized("abc"));
+
+          for (int trial = 0; trial < 1000; ++trial) {
+            std::string input;
+            const int size = rand() % 8;
+            for (int i = 0; i < size; ++i) {
+              input += kChars[rand() % kChars.size()];
+            }
+            std::string expected, buffer;
+            std::vector<size_t> expected_norm_to_orig, norm_to_orig;
+            EXPECT_TRUE(
+                normalizer.Normalize(input, &expected, &expected_norm_to_orig)
+                    .ok());
+            absl::string_view normalized;
+            EXPECT_TRUE(
+                normalizer.Normalize(input, &normalized, &buffer, &norm_to_orig)
+                    .ok());
+            EXPECT_EQ(expected, normalized);
+            EXPECT_EQ(expected_norm_to_orig, norm_to_orig);
+            if (normalizer.IsNormalized(input)) {
+              EXPECT_EQ(input, expected);
+              EXPECT_EQ(input.data(), normalized.data());
+              EXPECT_TRUE(buffer.empty());
+            } else {
+              EXPECT_EQ(buffer.data(), normalized.data());
+            }
+          }
+        }
+      }
+    }
+  }
+
+  auto spec = SentencePieceTrainer::GetNormalizerSpec("identity");
+  spec.set_add_dummy_prefix(false);
+  const Normalizer normalizer(spec);
+  EXPECT_TRUE(normalizer.IsNormalized("abc"));
+  EXPECT_TRUE(normalizer.IsNormalized("ＡＢＣ①"));
+  EXPECT_FALSE(normalizer.IsNormalized("a b"));
+  EXPECT_FALSE(normalizer.IsNormalized("\xFF"));
+  spec.set_escape_whitespaces(false);
+  const Normalizer unescaped_normalizer(spec);
+  EXPECT_TRUE(unescaped_normalizer.IsNormalized("a b c"));
+  EXPECT_FALSE(unescaped_normalizer.IsNormalized("a  b"));
+  EXPECT_FALSE(unescaped_normalizer.IsNormalized(" a"));
+  EXPECT_FALSE(unescaped_normalizer.IsNormalized("a "));
+
+  // The dummy prefix, or suffix, is added to the input without normalizing
+  // it again.
+  spec.set_add_dummy_prefix(true);
+  spec.set_escape_whitespaces(true);
+  TrainerSpec trainer_spec;
+  for (const bool suffix : {false, true}) {
+    trainer_spec.set_treat_whitespace_as_suffix(suffix);
+    const Normalizer dummy_normalizer(spec, trainer_spec);
+    EXPECT_FALSE(dummy_normalizer.IsNormalized("abc"));
+    EXPECT_EQ(suffix ? "abc" WS : WS "abc", dummy_normalizer.Normalize("abc"));
+    for (const char *input : {"abc", "ＡＢＣ①", "a b"}) {
+      std::string expected, buffer;
+      std::vector<size_t> expected_norm_to_orig, norm_to_orig;
+      EXPECT_TRUE(
+          dummy_normalizer.Normalize(input, &expected, &expected_norm_to_orig)
+              .ok());
+      absl::string_view normalized;
+      EXPECT_TRUE(
+          dummy_normalizer.Normalize(input, &normalized, &buffer, &norm_to_orig)
+              .ok());
+      EXPECT_EQ(expected, normalized);
+      EXPECT_EQ(expected_norm_to_orig, norm_to_orig);
+    }
+  }
+}
+
+TEST(NormalizerTest, NormalizeInPlaceTest) {
+  const std::vector<std::string> kChars = {
+      "a", "b", " ", " ", "\xE2\x96\x81", "Ａ", "①", "\xCC\x81", "\xE4\xB8\x80",
+      "\xF0\x9F\x98\x80", "\xFF", "か", "\xE3\x82\x99"};
+  for (const char *name : {"nmt_nfkc", "nfkc_cf", "identity"}) {
+    for (const bool add_dummy_prefix : {true, false}) {
+      for (const bool remove_extra_whitespaces : {true, false}) {
+        for (const bool escape_whitespaces : {true, false}) {
+          auto spec = SentencePieceTrainer::GetNormalizerSpec(name);
+          spec.set_add_dummy_prefix(add_dummy_prefix);
+          spec.set_remove_extra_whitespaces(remove_extra_whitespaces);
+          spec.set_escape_whitespaces(escape_whitespaces);
+          const Normalizer normalizer(spec);
+          for (int trial = 0; trial < 1000; ++trial) {
+            std::string text;
+            const int size = rand() % 8;
+            for (int i = 0; i < size; ++i) {
+              text += kChars[rand() % kChars.size()];
+            }
+            const std::string expected = normalizer.Normalize(text);
+            EXPECT_TRUE(normalizer.NormalizeInPlace(&text).ok());
+            EXPECT_EQ(expected, text);
+          }
+        }
+      }
+    }
+  }
+
+  // A denormalizer leaves the text as it is unless a rule changes it.
+  auto spec = SentencePieceTrainer::GetNormalizerSpec("nmt_nfkc");
+  spec.set_add_dummy_prefix(false);
+  spec.set_remove_extra_whitespaces(false);
+  spec.set_escape_whitespaces(false);
+  const Normalizer normalizer(spec);
+  std::string text = "abc  def";
+  const char *data = text.data();
+  EXPECT_TRUE(normalizer.NormalizeInPlace(&text).ok());
+  EXPECT_EQ("abc  def", text);
+  EXPECT_EQ(data, text.data());
+  text = "abc ＡＢＣ def";
+  EXPECT_TRUE(normalizer.NormalizeInPlace(&text).ok());
+  EXPECT_EQ("abc ABC def", text);
+
+  EXPECT_FALSE(normalizer.NormalizeInPlace(nullptr).ok());
 }
 
 TEST(NormalizerTest, StatusTest) {
@@ -408,10 +712,61 @@ TEST(NormalizerTest, PrefixMatcherTest) {
   EXPECT_TRUE(found);
   EXPECT_EQ(3, matcher.PrefixMatch("東京大学", &found));
   EXPECT_FALSE(found);
+  EXPECT_EQ(3, matcher.PrefixMatch("京", &found));
+  EXPECT_FALSE(found);
+
+  EXPECT_TRUE(matcher.HasEntryStartingWith('a'));
+  EXPECT_TRUE(matcher.HasEntryStartingWith('x'));
+  EXPECT_TRUE(matcher.HasEntryStartingWith("京"[0]));
+  EXPECT_FALSE(matcher.HasEntryStartingWith('b'));
+  EXPECT_FALSE(matcher.HasEntryStartingWith("東"[0]));
 
   EXPECT_EQ("", matcher.GlobalReplace("", ""));
   EXPECT_EQ("", matcher.GlobalReplace("abc", ""));
   EXPECT_EQ("--de-pqr", matcher.GlobalReplace("xyabcdeabpqr", "-"));
+
+  std::string result = "garbage";
+  EXPECT_TRUE(matcher.GlobalReplace("xyabcdeabpqr", "-", &result));
+  EXPECT_EQ("--de-pqr", result);
+  EXPECT_TRUE(matcher.GlobalReplace("deab", "<>", &result));
+  EXPECT_EQ("de<>", result);
+  EXPECT_FALSE(matcher.GlobalReplace("pqr", "-", &result));
+  EXPECT_TRUE(result.empty());
+  EXPECT_FALSE(matcher.GlobalReplace("", "-", &result));
+}
+
+TEST(NormalizerTest, PrefixMatcherSkipTest) {
+  // Entries of one byte and entries sharing their first bytes with the text
+  // are found as the trie finds them.
+  const std::vector<std::string> kChars = {"a", "b", "c", "京", "都", "東"};
+  for (int trial = 0; trial < 100; ++trial) {
+    std::set<std::string> entries;
+    for (int i = 0; i < 5; ++i) {
+      std::string entry;
+      const int size = 1 + rand() % 3;
+      for (int j = 0; j < size; ++j) entry += kChars[rand() % kChars.size()];
+      entries.insert(entry);
+    }
+    if (rand() % 2) entries.insert("\xE4");
+    const std::set<absl::string_view> dic(entries.begin(), entries.end());
+    const PrefixMatcher matcher(dic);
+
+    std::string text;
+    for (int i = 0; i < 8; ++i) text += kChars[rand() % kChars.size()];
+    for (size_t pos = 0; pos < text.size(); ++pos) {
+      const absl::string_view w = absl::string_view(text).substr(pos);
+      int expected = 0;
+      for (const auto &entry : entries) {
+        if (absl::StartsWith(w, entry)) {
+          expected = std::max<int>(expected, entry.size());
+        }
+      }
+      bool found = false;
+      const int mblen = matcher.PrefixMatch(w, &found);
+      EXPECT_EQ(expected > 0, found);
+      if (found) EXPECT_EQ(expected, mblen);
+    }
+  }
 }
 
 TEST(NormalizerTest, PrefixMatcherWithEmptyTest) {
@@ -431,9 +786,14 @@ TEST(NormalizerTest, PrefixMatcherWithEmptyTest) {
   EXPECT_FALSE(found);
   EXPECT_EQ(3, matcher.PrefixMatch("東京大学", &found));
   EXPECT_FALSE(found);
+  EXPECT_FALSE(matcher.HasEntryStartingWith('a'));
 
   EXPECT_EQ("", matcher.GlobalReplace("", ""));
   EXPECT_EQ("abc", matcher.GlobalReplace("abc", ""));
+
+  std::string result;
+  EXPECT_FALSE(matcher.GlobalReplace("abc", "", &result));
+  EXPECT_TRUE(result.empty());
 }
 
 }  // namespace normalizer
@@ -14,6 +14,7 @@
 #include "pretokenizer_for_training.h"
 
 #include <string>
+#include <vector>
 
 #include "third_party/absl/strings/str_replace.h"
 
@@ -32,6 +33,30 @@ std::vector<std::string> PretokenizerForTrainingInterface::PreTokenize(
   return Postprocess(Tokenize(Preprocess(text)));
 }
 
+std::vector<std::vector<std::string>>
+PretokenizerForTrainingInterface::PreTokenizeBatch(
+    const std::vector<absl::string_view> &texts) const {
+  std::vector<std::string> preprocessed;
+  preprocessed.reserve(texts.size());
+  for (const auto text : texts) preprocessed.push_back(Preprocess(text));
+  const std::vector<absl::string_view> views(preprocessed.begin(),
+                                             preprocessed.end());
+  std::vector<std::vector<std::string>> results;
+  results.reserve(texts.size());
+  for (const auto &spt : TokenizeBatch(views)) {
+    results.push_back(Postprocess(spt));
+  }
+  return results;
+}
+
+std::vector<SentencePieceText> PretokenizerForTrainingInterface::TokenizeBatch(
+    const std::vector<absl::string_view> &texts) const {
+  std::vector<SentencePieceText> results;
+  results.reserve(texts.size());
+  for (const auto text : texts) results.push_back(Tokenize(text));
+  return results;
+}
+
 // static
 std::string PretokenizerForTrainingInterface::Preprocess(
     absl::string_view text) {
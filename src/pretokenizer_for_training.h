@@ -17,6 +17,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "common.h"
 #include "sentencepiece.pb.h"
@@ -46,12 +47,22 @@ class PretokenizerForTrainingInterface {
   // output: I love sentence<tab>piece.
   std::vector<std::string> PreTokenize(absl::string_view text) const;
 
+  // PreTokenize() of every text in `texts`, which calls TokenizeBatch()
+  // once.
+  std::vector<std::vector<std::string>> PreTokenizeBatch(
+      const std::vector<absl::string_view> &texts) const;
+
   // Returns pre-tokenized result.
   // Note that the pre-tokenized constraint is specified with the
   // byte offsets (SentencePiece::begin, SentencePiece::end) over
   // the input text.
   virtual SentencePieceText Tokenize(absl::string_view text) const = 0;
 
+  // Returns Tokenize() of every text in `texts`. Pre-tokenizers which are
+  // faster on batches override it. Trainers call it from multiple threads.
+  virtual std::vector<SentencePieceText> TokenizeBatch(
+      const std::vector<absl::string_view> &texts) const;
+
  private:
   static std::string Preprocess(absl::string_view text);
   static std::vector<std::string> Postprocess(const SentencePieceText &spt);
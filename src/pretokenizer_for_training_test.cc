@@ -105,5 +105,25 @@ TEST(PretokenizerForTrainingTest, BaseTest) {
   }
 }
 
+TEST(PretokenizerForTrainingTest, BatchTest) {
+  MockPretokenizer mock;
+  SentencePieceText spt;
+  for (const auto &it : std::vector<std::pair<int, int>>{{0, 2}, {2, 4}}) {
+    auto *piece = spt.add_pieces();
+    piece->set_surface("ab");
+    piece->set_begin(it.first);
+    piece->set_end(it.second);
+  }
+  mock.SetOutput(spt);
+
+  const std::vector<absl::string_view> texts = {"abab", "", "abab"};
+  const auto results = mock.PreTokenizeBatch(texts);
+  ASSERT_EQ(texts.size(), results.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    EXPECT_EQ(mock.PreTokenize(texts[i]), results[i]);
+  }
+  EXPECT_TRUE(mock.PreTokenizeBatch({}).empty());
+}
+
 }  // namespace pretokenizer
 }  // namespace sentencepiece
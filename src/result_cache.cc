@@ -0,0 +1,130 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "result_cache.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "memory_usage.h"
+
+namespace sentencepiece {
+
+ResultCache::ResultCache(size_t max_bytes) : max_bytes_(max_bytes) {
+  const size_t num_shards = std::max<size_t>(
+      1, std::min(kNumShards, max_bytes_ / kMinShardBytes));
+  for (size_t i = 0; i < num_shards; ++i) {
+    auto shard = std::make_unique<Shard>();
+    shard->max_bytes =
+        max_bytes_ * (i + 1) / num_shards - max_bytes_ * i / num_shards;
+    shards_.emplace_back(std::move(shard));
+  }
+}
+
+ResultCache::~ResultCache() {}
+
+// static
+size_t ResultCache::EntryBytes(size_t input_size, size_t num_ids) {
+  return input_size + num_ids * sizeof(int) + sizeof(Entry) +
+         2 * sizeof(void *) +
+         sizeof(std::pair<const absl::string_view, List::iterator>) +
+         3 * sizeof(void *);
+}
+
+ResultCache::Shard *ResultCache::GetShard(absl::string_view input) {
+  return shards_[std::hash<absl::string_view>()(input) % shards_.size()]
+      .get();
+}
+
+bool ResultCache::Lookup(absl::string_view input, std::vector<int> *ids) {
+  if (max_bytes_ > 0) {
+    auto *shard = GetShard(input);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    const auto it = shard->index.find(input);
+    if (it != shard->index.end()) {
+      // Moves the entry to the front; the iterators stay valid.
+      shard->entries.splice(shard->entries.begin(), shard->entries,
+                            it->second);
+      const auto &cached = it->second->ids;
+      ids->insert(ids->end(), cached.begin(), cached.end());
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void ResultCache::Insert(absl::string_view input, std::vector<int> ids) {
+  if (max_bytes_ == 0) return;
+  auto *shard = GetShard(input);
+  const size_t bytes = EntryBytes(input.size(), ids.size());
+  if (bytes > shard->max_bytes) return;
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  // Another thread may have cached the same input after our lookup.
+  if (shard->index.count(input) > 0) return;
+
+  while (shard->bytes + bytes > shard->max_bytes) {
+    const auto &last = shard->entries.back();
+    shard->bytes -= EntryBytes(last.input.size(), last.ids.size());
+    shard->index.erase(last.input);
+    shard->entries.pop_back();
+  }
+
+  shard->entries.emplace_front();
+  auto &entry = shard->entries.front();
+  entry.input.assign(input.data(), input.size());
+  entry.ids = std::move(ids);
+  entry.ids.shrink_to_fit();
+  shard->index.emplace(entry.input, shard->entries.begin());
+  shard->bytes += bytes;
+}
+
+void ResultCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->entries.clear();
+    shard->bytes = 0;
+  }
+}
+
+ResultCache::Stats ResultCache::stats() const {
+  Stats stats;
+  stats.hits = hits_.load(std::memory_order_relaxed);
+  stats.misses = misses_.load(std::memory_order_relaxed);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.size += shard->index.size();
+    stats.bytes += shard->bytes;
+  }
+  return stats;
+}
+
+size_t ResultCache::GetMemoryUsage() const {
+  size_t bytes = memory_usage::Vector(shards_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    bytes += sizeof(Shard) + memory_usage::HashMap(shard->index) +
+             shard->entries.size() * (sizeof(Entry) + 2 * sizeof(void *));
+    for (const auto &entry : shard->entries) {
+      bytes += memory_usage::String(entry.input) +
+               memory_usage::Vector(entry.ids);
+    }
+  }
+  return bytes;
+}
+
+}  // namespace sentencepiece
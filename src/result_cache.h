@@ -0,0 +1,98 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef RESULT_CACHE_H_
+#define RESULT_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+
+// Bounded cache from a whole input to its ids, for servers receiving the
+// same queries again and again. Unlike EncodeCache, the size is bounded in
+// bytes, as the inputs and their ids vary in length. The inputs are spread
+// over shards with their own mutex and least-recently-used list.
+class ResultCache {
+ public:
+  struct Stats {
+    int64 hits = 0;
+    int64 misses = 0;
+    size_t size = 0;   // Number of cached inputs.
+    size_t bytes = 0;  // Bytes charged for them.
+  };
+
+  // Holds at most about `max_bytes` bytes of inputs and ids.
+  explicit ResultCache(size_t max_bytes);
+  ~ResultCache();
+
+  size_t max_bytes() const { return max_bytes_; }
+
+  // Appends the ids of `input` to `ids` and returns true if `input` is
+  // cached. Counts a hit or a miss.
+  bool Lookup(absl::string_view input, std::vector<int> *ids);
+
+  // Caches `ids` for `input`, evicting the least recently used inputs of
+  // the shard to make room. An entry larger than a shard is not cached.
+  void Insert(absl::string_view input, std::vector<int> ids);
+
+  // Removes all the inputs. The counters are kept.
+  void Clear();
+
+  Stats stats() const;
+
+  // Returns the bytes of the entries and the index.
+  size_t GetMemoryUsage() const;
+
+ private:
+  struct Entry {
+    std::string input;
+    std::vector<int> ids;
+  };
+  using List = std::list<Entry>;
+
+  struct Shard {
+    std::mutex mutex;
+    List entries;  // The most recently used first.
+    absl::flat_hash_map<absl::string_view, List::iterator> index;
+    size_t max_bytes = 0;
+    size_t bytes = 0;
+  };
+
+  static constexpr size_t kNumShards = 16;
+  // Smaller caches use fewer shards, so that a shard holds long inputs.
+  static constexpr size_t kMinShardBytes = 1 << 16;
+
+  // Bytes charged for an entry: the input, the ids, the list node and the
+  // index node.
+  static size_t EntryBytes(size_t input_size, size_t num_ids);
+
+  Shard *GetShard(absl::string_view input);
+
+  size_t max_bytes_ = 0;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<int64> hits_{0};
+  std::atomic<int64> misses_{0};
+};
+
+}  // namespace sentencepiece
+#endif  // RESULT_CACHE_H_
@@ -0,0 +1,115 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "result_cache.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "testharness.h"
+#include "third_party/absl/strings/str_cat.h"
+
+namespace sentencepiece {
+namespace {
+
+TEST(ResultCacheTest, LookupAndInsertTest) {
+  ResultCache cache(10000);
+  EXPECT_EQ(10000, cache.max_bytes());
+
+  std::vector<int> ids = {1};
+  EXPECT_FALSE(cache.Lookup("hello world", &ids));
+  cache.Insert("hello world", {10, 11});
+  EXPECT_TRUE(cache.Lookup("hello world", &ids));
+  EXPECT_EQ(std::vector<int>({1, 10, 11}), ids);
+
+  // The first ids are kept.
+  cache.Insert("hello world", {12});
+  ids.clear();
+  EXPECT_TRUE(cache.Lookup("hello world", &ids));
+  EXPECT_EQ(std::vector<int>({10, 11}), ids);
+
+  // Larger than the cache.
+  const std::string long_input(20000, 'a');
+  cache.Insert(long_input, {1});
+  EXPECT_FALSE(cache.Lookup(long_input, &ids));
+
+  auto stats = cache.stats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(1, stats.size);
+  EXPECT_GT(stats.bytes, 0);
+  EXPECT_GT(cache.GetMemoryUsage(), 0);
+
+  cache.Clear();
+  EXPECT_FALSE(cache.Lookup("hello world", &ids));
+  stats = cache.stats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(3, stats.misses);
+  EXPECT_EQ(0, stats.size);
+  EXPECT_EQ(0, stats.bytes);
+}
+
+TEST(ResultCacheTest, LruEvictionTest) {
+  // Small caches use a single shard.
+  const std::string input(1000, 'a');
+  ResultCache cache(3500);
+  cache.Insert(input + "0", {0});
+  cache.Insert(input + "1", {1});
+  cache.Insert(input + "2", {2});
+  EXPECT_EQ(3, cache.stats().size);
+
+  // The use of "0" makes "1" the least recently used.
+  std::vector<int> ids;
+  EXPECT_TRUE(cache.Lookup(input + "0", &ids));
+  cache.Insert(input + "3", {3});
+  EXPECT_EQ(3, cache.stats().size);
+  EXPECT_TRUE(cache.Lookup(input + "0", &ids));
+  EXPECT_FALSE(cache.Lookup(input + "1", &ids));
+  EXPECT_TRUE(cache.Lookup(input + "2", &ids));
+  EXPECT_TRUE(cache.Lookup(input + "3", &ids));
+  EXPECT_LE(cache.stats().bytes, 3500);
+
+  // A long entry evicts several short ones.
+  cache.Insert(std::string(3000, 'b'), {4});
+  EXPECT_EQ(1, cache.stats().size);
+}
+
+TEST(ResultCacheTest, ConcurrentTest) {
+  ResultCache cache(1 << 20);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t]() {
+      std::vector<int> ids;
+      for (int i = 0; i < 10000; ++i) {
+        const int n = (i * 7 + t) % 5000;
+        const std::string input = absl::StrCat("input ", n);
+        ids.clear();
+        if (cache.Lookup(input, &ids)) {
+          EXPECT_EQ(std::vector<int>({n, n + 1}), ids);
+        } else {
+          cache.Insert(input, {n, n + 1});
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  const auto stats = cache.stats();
+  EXPECT_EQ(40000, stats.hits + stats.misses);
+  EXPECT_LE(stats.bytes, 1 << 20);
+}
+
+}  // namespace
+}  // namespace sentencepiece
@@ -0,0 +1,993 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "sentence_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "memory_usage.h"
+#include "third_party/absl/strings/match.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+#ifdef SPM_ENABLE_LEVELDB
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#endif
+
+namespace sentencepiece {
+
+namespace sentence_record {
+namespace {
+
+constexpr char kMagic[] = "SPMSENTS";
+constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+
+}  // namespace
+
+void AppendVarint(uint64 value, std::string *output) {
+  while (value >= 0x80) {
+    output->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  output->push_back(static_cast<char>(value));
+}
+
+bool ConsumeVarint(absl::string_view *input, uint64 *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && !input->empty(); shift += 7) {
+    const uint64 byte = static_cast<unsigned char>(input->front());
+    input->remove_prefix(1);
+    *value |= (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+void Encode(absl::string_view text, int64 freq, std::string *output) {
+  output->clear();
+  AppendVarint(static_cast<uint64>(freq), output);
+  output->append(text.data(), text.size());
+}
+
+bool Decode(absl::string_view record, absl::string_view *text, int64 *freq) {
+  uint64 value = 0;
+  if (!ConsumeVarint(&record, &value)) return false;
+  *freq = static_cast<int64>(value);
+  *text = record;
+  return true;
+}
+
+std::string EncodeHeader(size_t size) {
+  std::string output(kMagic, kMagicSize);
+  AppendVarint(kVersion, &output);
+  AppendVarint(size, &output);
+  return output;
+}
+
+util::Status DecodeHeader(absl::string_view header, size_t *size) {
+  CHECK_OR_RETURN(absl::StartsWith(header, absl::string_view(kMagic)))
+      << "Not a sentence store.";
+  header.remove_prefix(kMagicSize);
+  uint64 version = 0, value = 0;
+  CHECK_OR_RETURN(ConsumeVarint(&header, &version))
+      << "Broken sentence store header.";
+  CHECK_EQ_OR_RETURN(version, kVersion)
+      << "Unsupported sentence store version.";
+  CHECK_OR_RETURN(ConsumeVarint(&header, &value) && header.empty())
+      << "Broken sentence store header.";
+  *size = static_cast<size_t>(value);
+  return util::OkStatus();
+}
+
+}  // namespace sentence_record
+
+util::Status SentenceStore::RemoveIf(
+    const std::function<bool(const Sentence &sentence)> &pred) {
+  RETURN_IF_ERROR(Flush());
+  size_t size = 0;
+  auto cursor = NewCursor();
+  for (; !cursor->done(); cursor->Next()) {
+    if (pred(cursor->value())) continue;
+    if (size != cursor->index()) {
+      RETURN_IF_ERROR(Set(size, cursor->value()));
+    }
+    ++size;
+  }
+  RETURN_IF_ERROR(cursor->status());
+  return Truncate(size);
+}
+
+namespace {
+
+class InMemorySentenceStore : public SentenceStore {
+ public:
+  InMemorySentenceStore() {}
+  ~InMemorySentenceStore() override {}
+
+  util::Status status() const override { return util::OkStatus(); }
+
+  size_t size() const override { return sentences_.size(); }
+
+  util::Status Add(Sentence sentence) override {
+    sentences_.emplace_back(std::move(sentence));
+    return util::OkStatus();
+  }
+
+  util::Status Flush() override { return util::OkStatus(); }
+
+  util::Status Get(size_t index, Sentence *sentence) const override {
+    CHECK_LT_OR_RETURN(index, sentences_.size());
+    *sentence = sentences_[index];
+    return util::OkStatus();
+  }
+
+  util::Status Set(size_t index, Sentence sentence) override {
+    CHECK_LT_OR_RETURN(index, sentences_.size());
+    sentences_[index] = std::move(sentence);
+    return util::OkStatus();
+  }
+
+  util::Status Truncate(size_t size) override {
+    CHECK_LE_OR_RETURN(size, sentences_.size());
+    sentences_.resize(size);
+    if (size == 0) sentences_.shrink_to_fit();
+    return util::OkStatus();
+  }
+
+  util::Status RemoveIf(
+      const std::function<bool(const Sentence &sentence)> &pred) override {
+    sentences_.erase(
+        std::remove_if(sentences_.begin(), sentences_.end(), pred),
+        sentences_.end());
+    return util::OkStatus();
+  }
+
+  size_t GetMemoryUsage() const override {
+    size_t bytes = memory_usage::Vector(sentences_);
+    for (const auto &sentence : sentences_) {
+      bytes += memory_usage::String(sentence.first);
+    }
+    return bytes;
+  }
+
+  std::unique_ptr<Cursor> NewCursor(size_t begin, size_t end) const override {
+    return std::make_unique<VectorCursor>(&sentences_, begin,
+                                          std::min(end, sentences_.size()));
+  }
+
+ private:
+  class VectorCursor : public Cursor {
+   public:
+    VectorCursor(const std::vector<Sentence> *sentences, size_t begin,
+                 size_t end)
+        : sentences_(sentences), index_(begin), end_(end) {}
+
+    bool done() const override { return index_ >= end_; }
+    void Next() override { ++index_; }
+    size_t index() const override { return index_; }
+    const Sentence &value() const override { return (*sentences_)[index_]; }
+    util::Status status() const override { return util::OkStatus(); }
+
+   private:
+    const std::vector<Sentence> *sentences_ = nullptr;
+    size_t index_ = 0;
+    size_t end_ = 0;
+  };
+
+  std::vector<Sentence> sentences_;
+};
+
+#if !defined(_WIN32)
+// Creates a new directory named `prefix` plus a unique suffix under `parent`,
+// or under TMPDIR (/tmp if unset) if `parent` is empty, and sets `dir` to its
+// path. Returns false with errno set on failure.
+bool MakeTempDir(absl::string_view parent, absl::string_view prefix,
+                 std::string *dir) {
+  if (parent.empty()) {
+    const char *tmpdir = getenv("TMPDIR");
+    parent = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+  }
+  *dir = util::JoinPath(parent, absl::StrCat(prefix, ".XXXXXX"));
+  return mkdtemp(&(*dir)[0]) != nullptr;
+}
+#endif  // !_WIN32
+
+#ifdef SPM_ENABLE_LEVELDB
+// The key is the big-endian sentence index so that the lexicographic order
+// of LevelDB keys matches the numeric order of the indices.
+std::string EncodeKey(size_t index) {
+  std::string key(sizeof(uint64), '\0');
+  for (int i = sizeof(uint64) - 1; i >= 0; --i) {
+    key[i] = static_cast<char>(index & 0xff);
+    index >>= 8;
+  }
+  return key;
+}
+
+// The header is stored under the empty key, which sorts before all the
+// sentence keys.
+constexpr char kHeaderKey[] = "";
+
+// Decodes `record` into `sentence`, reusing the buffer of `sentence->first`.
+bool DecodeRecord(const leveldb::Slice &record,
+                  SentenceStore::Sentence *sentence) {
+  absl::string_view text;
+  if (!sentence_record::Decode(absl::string_view(record.data(), record.size()),
+                               &text, &sentence->second)) {
+    return false;
+  }
+  sentence->first.assign(text.data(), text.size());
+  return true;
+}
+
+util::Status ToStatus(const leveldb::Status &status) {
+  if (status.ok()) return util::OkStatus();
+  return util::InternalError(absl::StrCat("LevelDB: ", status.ToString()));
+}
+
+class LevelDBSentenceStore : public SentenceStore {
+ public:
+  // Creates a new database if `reuse` is false, in a new temporary
+  // directory if `path` is empty, and fails if there is one at `path`
+  // already. Otherwise opens the existing one and restores the size from its
+  // header. A new database is removed on deletion unless `keep` is true.
+  LevelDBSentenceStore(absl::string_view path, bool reuse, bool keep)
+      : path_(path.data(), path.size()), reuse_(reuse), keep_(keep) {
+    leveldb::Options options;
+    if (!reuse_) {
+#if !defined(_WIN32)
+      if (path_.empty() && !MakeTempDir("", "spm_sentences_db", &path_)) {
+        status_ = util::StatusBuilder(util::StatusCode::kInternal, GTL_LOC)
+                  << "\"" << path_ << "\": " << util::StrError(errno);
+        return;
+      }
+#else
+      if (path_.empty()) path_ = "sentences_db";
+#endif  // !_WIN32
+      // Another store may be using an existing database, which is never
+      // destroyed here.
+      options.create_if_missing = true;
+      options.error_if_exists = true;
+    }
+    leveldb::DB *db = nullptr;
+    status_ = ToStatus(leveldb::DB::Open(options, path_, &db));
+    db_.reset(db);
+    if (!status_.ok()) return;
+
+    if (reuse_) {
+      std::string header;
+      status_ = ToStatus(db_->Get(leveldb::ReadOptions(), kHeaderKey, &header));
+      if (status_.ok()) status_ = sentence_record::DecodeHeader(header, &size_);
+    } else {
+      status_ = WriteHeader();
+    }
+  }
+
+  ~LevelDBSentenceStore() override {
+    if (db_ == nullptr) return;
+    db_.reset();
+    // Only the databases created by this store are destroyed.
+    if (!reuse_ && !keep_) leveldb::DestroyDB(path_, leveldb::Options());
+  }
+
+  util::Status status() const override { return status_; }
+
+  size_t size() const override { return size_; }
+
+  util::Status Add(Sentence sentence) override {
+    RETURN_IF_ERROR(status_);
+    sentence_record::Encode(sentence.first, sentence.second, &record_);
+    batch_.Put(EncodeKey(size_++), record_);
+    if (++num_pending_ >= kMaxBatchSize) return Flush();
+    return util::OkStatus();
+  }
+
+  util::Status Flush() override {
+    RETURN_IF_ERROR(status_);
+    if (num_pending_ == 0) return util::OkStatus();
+    batch_.Put(kHeaderKey, sentence_record::EncodeHeader(size_));
+    const auto status = db_->Write(leveldb::WriteOptions(), &batch_);
+    batch_.Clear();
+    num_pending_ = 0;
+    return ToStatus(status);
+  }
+
+  util::Status Get(size_t index, Sentence *sentence) const override {
+    RETURN_IF_ERROR(status_);
+    CHECK_LT_OR_RETURN(index, size_);
+    std::string value;
+    RETURN_IF_ERROR(
+        ToStatus(db_->Get(leveldb::ReadOptions(), EncodeKey(index), &value)));
+    CHECK_OR_RETURN(DecodeRecord(value, sentence))
+        << "Broken record at " << index;
+    return util::OkStatus();
+  }
+
+  util::Status Set(size_t index, Sentence sentence) override {
+    RETURN_IF_ERROR(status_);
+    CHECK_LT_OR_RETURN(index, size_);
+    // Set() may run concurrently, so the record buffer is not shared.
+    std::string record;
+    sentence_record::Encode(sentence.first, sentence.second, &record);
+    return ToStatus(
+        db_->Put(leveldb::WriteOptions(), EncodeKey(index), record));
+  }
+
+  util::Status Truncate(size_t size) override {
+    RETURN_IF_ERROR(Flush());
+    CHECK_LE_OR_RETURN(size, size_);
+    std::unique_ptr<leveldb::Iterator> it(
+        db_->NewIterator(leveldb::ReadOptions()));
+    leveldb::WriteBatch batch;
+    for (it->Seek(EncodeKey(size)); it->Valid(); it->Next()) {
+      batch.Delete(it->key());
+    }
+    RETURN_IF_ERROR(ToStatus(it->status()));
+    batch.Put(kHeaderKey, sentence_record::EncodeHeader(size));
+    RETURN_IF_ERROR(ToStatus(db_->Write(leveldb::WriteOptions(), &batch)));
+    size_ = size;
+    return util::OkStatus();
+  }
+
+  std::unique_ptr<Cursor> NewCursor(size_t begin, size_t end) const override {
+    return std::make_unique<LevelDBCursor>(db_.get(), begin,
+                                           std::min(end, size_));
+  }
+
+ private:
+  util::Status WriteHeader() {
+    return ToStatus(db_->Put(leveldb::WriteOptions(), kHeaderKey,
+                             sentence_record::EncodeHeader(size_)));
+  }
+
+  class LevelDBCursor : public Cursor {
+   public:
+    LevelDBCursor(leveldb::DB *db, size_t begin, size_t end)
+        : index_(begin), end_(end) {
+      if (db == nullptr || done()) return;
+      leveldb::ReadOptions options;
+      // Scans should not evict the blocks used by random access.
+      options.fill_cache = false;
+      it_.reset(db->NewIterator(options));
+      it_->Seek(EncodeKey(begin));
+      Load();
+    }
+
+    bool done() const override { return index_ >= end_; }
+
+    void Next() override {
+      ++index_;
+      it_->Next();
+      Load();
+    }
+
+    size_t index() const override { return index_; }
+    const Sentence &value() const override { return value_; }
+    util::Status status() const override { return status_; }
+
+   private:
+    void Load() {
+      if (done()) return;
+      if (!it_->Valid() || it_->key() != leveldb::Slice(EncodeKey(index_)) ||
+          !DecodeRecord(it_->value(), &value_)) {
+        status_ = it_->status().ok()
+                      ? util::InternalError(absl::StrCat(
+                            "Missing or broken record at ", index_))
+                      : ToStatus(it_->status());
+        index_ = end_;
+      }
+    }
+
+    std::unique_ptr<leveldb::Iterator> it_;
+    size_t index_ = 0;
+    size_t end_ = 0;
+    Sentence value_;
+    util::Status status_;
+  };
+
+  // Number of sentences buffered in one WriteBatch.
+  static constexpr int kMaxBatchSize = 4096;
+
+  std::string path_;
+  bool reuse_ = false;
+  bool keep_ = false;
+  std::unique_ptr<leveldb::DB> db_;
+  leveldb::WriteBatch batch_;
+  std::string record_;
+  int num_pending_ = 0;
+  size_t size_ = 0;
+  util::Status status_;
+};
+#endif  // SPM_ENABLE_LEVELDB
+
+}  // namespace
+
+std::unique_ptr<SentenceStore> NewInMemorySentenceStore() {
+  return std::make_unique<InMemorySentenceStore>();
+}
+
+namespace {
+// Sentences are packed into blocks of this size. A longer sentence gets a
+// block of its own.
+constexpr size_t kArenaBlockSize = 1 << 20;
+
+class ArenaCursor : public SentenceStore::Cursor {
+ public:
+  ArenaCursor(const SentenceArena *arena, size_t begin, size_t end)
+      : arena_(arena), index_(begin), end_(end) {
+    Load();
+  }
+
+  bool done() const override { return index_ >= end_; }
+
+  void Next() override {
+    ++index_;
+    Load();
+  }
+
+  size_t index() const override { return index_; }
+  const SentenceStore::Sentence &value() const override { return value_; }
+  util::Status status() const override { return util::OkStatus(); }
+
+ private:
+  // Copies the current sentence into `value_`, reusing its buffer.
+  void Load() {
+    if (done()) return;
+    const absl::string_view text = arena_->text(index_);
+    value_.first.assign(text.data(), text.size());
+    value_.second = arena_->freq(index_);
+  }
+
+  const SentenceArena *arena_ = nullptr;
+  size_t index_ = 0;
+  size_t end_ = 0;
+  SentenceStore::Sentence value_;
+};
+}  // namespace
+
+SentenceArena::SentenceArena() {}
+SentenceArena::~SentenceArena() {}
+
+util::Status SentenceArena::status() const { return util::OkStatus(); }
+
+util::Status SentenceArena::Flush() { return util::OkStatus(); }
+
+char *SentenceArena::Allocate(size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size > kArenaBlockSize / 4) {
+    blocks_.emplace_back(new char[size]);
+    allocated_ += size;
+    return blocks_.back().get();
+  }
+  if (size > block_left_ || block_ptr_ == nullptr) {
+    blocks_.emplace_back(new char[kArenaBlockSize]);
+    allocated_ += kArenaBlockSize;
+    block_ptr_ = blocks_.back().get();
+    block_left_ = kArenaBlockSize;
+  }
+  char *result = block_ptr_;
+  block_ptr_ += size;
+  block_left_ -= size;
+  return result;
+}
+
+util::Status SentenceArena::Add(Sentence sentence) {
+  return AddText(sentence.first, sentence.second);
+}
+
+util::Status SentenceArena::AddText(absl::string_view text, int64 freq) {
+  CHECK_LE_OR_RETURN(text.size(), std::numeric_limits<uint32>::max());
+  char *data = Allocate(text.size());
+  memcpy(data, text.data(), text.size());
+  texts_.push_back(data);
+  sizes_.push_back(text.size());
+  freqs_.push_back(freq);
+  return util::OkStatus();
+}
+
+util::Status SentenceArena::Get(size_t index, Sentence *sentence) const {
+  CHECK_LT_OR_RETURN(index, size());
+  const absl::string_view text = this->text(index);
+  sentence->first.assign(text.data(), text.size());
+  sentence->second = freqs_[index];
+  return util::OkStatus();
+}
+
+util::Status SentenceArena::Set(size_t index, Sentence sentence) {
+  CHECK_LT_OR_RETURN(index, size());
+  const auto &text = sentence.first;
+  CHECK_LE_OR_RETURN(text.size(), std::numeric_limits<uint32>::max());
+  // Only the blocks are shared with the other threads setting the other
+  // sentences, and Allocate() locks them.
+  if (text.size() > sizes_[index]) texts_[index] = Allocate(text.size());
+  memcpy(texts_[index], text.data(), text.size());
+  sizes_[index] = text.size();
+  freqs_[index] = sentence.second;
+  return util::OkStatus();
+}
+
+util::Status SentenceArena::Truncate(size_t size) {
+  CHECK_LE_OR_RETURN(size, this->size());
+  texts_.resize(size);
+  sizes_.resize(size);
+  freqs_.resize(size);
+  if (size == 0) {
+    texts_.shrink_to_fit();
+    sizes_.shrink_to_fit();
+    freqs_.shrink_to_fit();
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocks_.clear();
+    blocks_.shrink_to_fit();
+    block_ptr_ = nullptr;
+    block_left_ = 0;
+    allocated_ = 0;
+  }
+  return util::OkStatus();
+}
+
+util::Status SentenceArena::RemoveIf(
+    const std::function<bool(const Sentence &sentence)> &pred) {
+  // Only the positions are moved. The bytes of the removed sentences are
+  // released by Clear().
+  Sentence sentence;
+  size_t size = 0;
+  for (size_t i = 0; i < this->size(); ++i) {
+    RETURN_IF_ERROR(Get(i, &sentence));
+    if (pred(sentence)) continue;
+    texts_[size] = texts_[i];
+    sizes_[size] = sizes_[i];
+    freqs_[size] = freqs_[i];
+    ++size;
+  }
+  return Truncate(size);
+}
+
+size_t SentenceArena::GetMemoryUsage() const {
+  const size_t bytes = memory_usage::Vector(texts_) +
+                       memory_usage::Vector(sizes_) +
+                       memory_usage::Vector(freqs_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes + memory_usage::Vector(blocks_) + allocated_;
+}
+
+std::unique_ptr<SentenceStore::Cursor> SentenceArena::NewCursor(
+    size_t begin, size_t end) const {
+  return std::make_unique<ArenaCursor>(this, begin, std::min(end, size()));
+}
+
+namespace {
+
+class CopyOnWriteSentenceStore : public SentenceStore {
+ public:
+  CopyOnWriteSentenceStore(
+      std::shared_ptr<const SentenceStore> base,
+      std::function<std::unique_ptr<SentenceStore>()> new_store)
+      : base_(std::move(base)),
+        new_store_(std::move(new_store)),
+        reader_(base_.get()) {}
+
+  util::Status status() const override { return reader()->status(); }
+
+  size_t size() const override { return reader()->size(); }
+
+  util::Status Add(Sentence sentence) override {
+    RETURN_IF_ERROR(Copy(size()));
+    return copy_->Add(std::move(sentence));
+  }
+
+  util::Status AddText(absl::string_view text, int64 freq) override {
+    RETURN_IF_ERROR(Copy(size()));
+    return copy_->AddText(text, freq);
+  }
+
+  util::Status Flush() override {
+    return copied() ? copy_->Flush() : base_->status();
+  }
+
+  util::Status Get(size_t index, Sentence *sentence) const override {
+    return reader()->Get(index, sentence);
+  }
+
+  util::Status Set(size_t index, Sentence sentence) override {
+    CHECK_LT_OR_RETURN(index, size());
+    RETURN_IF_ERROR(Copy(size()));
+    return copy_->Set(index, std::move(sentence));
+  }
+
+  util::Status Truncate(size_t size) override {
+    CHECK_LE_OR_RETURN(size, this->size());
+    RETURN_IF_ERROR(Copy(size));
+    return copy_->Truncate(size);
+  }
+
+  util::Status RemoveIf(
+      const std::function<bool(const Sentence &sentence)> &pred) override {
+    RETURN_IF_ERROR(Copy(size()));
+    return copy_->RemoveIf(pred);
+  }
+
+  size_t GetMemoryUsage() const override {
+    return base_->GetMemoryUsage() +
+           (copied() ? copy_->GetMemoryUsage() : 0);
+  }
+
+  std::unique_ptr<Cursor> NewCursor(size_t begin, size_t end) const override {
+    return reader()->NewCursor(begin, end);
+  }
+
+ private:
+  const SentenceStore *reader() const {
+    return reader_.load(std::memory_order_acquire);
+  }
+  bool copied() const { return reader() != base_.get(); }
+
+  // Copies the first `size` sentences of `base_` into `copy_` once, and
+  // makes the reads use `copy_` from then on.
+  util::Status Copy(size_t size) {
+    std::call_once(copy_once_, [&]() {
+      auto store = new_store_();
+      copy_status_ = store->status();
+      auto cursor = base_->NewCursor(0, size);
+      for (; copy_status_.ok() && !cursor->done(); cursor->Next()) {
+        const auto &w = cursor->value();
+        copy_status_ = store->AddText(w.first, w.second);
+      }
+      if (copy_status_.ok()) copy_status_ = cursor->status();
+      if (copy_status_.ok()) copy_status_ = store->Flush();
+      if (!copy_status_.ok()) return;
+      copy_ = std::move(store);
+      reader_.store(copy_.get(), std::memory_order_release);
+    });
+    return copy_status_;
+  }
+
+  std::shared_ptr<const SentenceStore> base_;
+  std::function<std::unique_ptr<SentenceStore>()> new_store_;
+  std::once_flag copy_once_;
+  util::Status copy_status_;
+  std::unique_ptr<SentenceStore> copy_;
+  std::atomic<const SentenceStore *> reader_;
+};
+
+}  // namespace
+
+std::unique_ptr<SentenceStore> NewCopyOnWriteSentenceStore(
+    std::shared_ptr<const SentenceStore> base,
+    std::function<std::unique_ptr<SentenceStore>()> new_store) {
+  return std::make_unique<CopyOnWriteSentenceStore>(std::move(base),
+                                                    std::move(new_store));
+}
+
+#if !defined(_WIN32)
+namespace {
+
+class LogSentenceStore : public SentenceStore {
+ public:
+  // The segments are written to a new directory under `parent`, so that
+  // the stores sharing `parent` never see the segments of each other.
+  LogSentenceStore(absl::string_view parent, bool keep, size_t segment_size)
+      : parent_(parent.data(), parent.size()),
+        keep_(keep),
+        segment_size_(std::max<size_t>(segment_size, 4096)) {
+    if (!parent_.empty()) {
+      created_parent_ = mkdir(parent_.c_str(), 0755) == 0;
+      if (!created_parent_ && errno != EEXIST) {
+        status_ = util::StatusBuilder(util::StatusCode::kInternal, GTL_LOC)
+                  << "\"" << parent_ << "\": " << util::StrError(errno);
+        return;
+      }
+    }
+    if (!MakeTempDir(parent_, "spm_sentences", &dir_)) {
+      status_ = util::StatusBuilder(util::StatusCode::kInternal, GTL_LOC)
+                << "\"" << dir_ << "\": " << util::StrError(errno);
+      dir_.clear();
+      return;
+    }
+    if (keep_) LOG(INFO) << "Writing the sentences to " << dir_;
+  }
+
+  ~LogSentenceStore() override {
+    RemoveSegments();
+    if (dir_.empty() || keep_) return;
+    rmdir(dir_.c_str());
+    if (created_parent_) rmdir(parent_.c_str());
+  }
+
+  util::Status status() const override { return status_; }
+
+  size_t size() const override { return records_.size(); }
+
+  util::Status Add(Sentence sentence) override {
+    return AddText(sentence.first, sentence.second);
+  }
+
+  util::Status AddText(absl::string_view text, int64 freq) override {
+    RETURN_IF_ERROR(status_);
+    char *record = nullptr;
+    uint32 size = 0;
+    RETURN_IF_ERROR(Write(text, freq, nullptr, 0, &record, &size));
+    records_.push_back(record);
+    sizes_.push_back(size);
+    return util::OkStatus();
+  }
+
+  // The records are in the mapped segments as soon as they are written.
+  util::Status Flush() override { return status_; }
+
+  util::Status Get(size_t index, Sentence *sentence) const override {
+    RETURN_IF_ERROR(status_);
+    CHECK_LT_OR_RETURN(index, size());
+    absl::string_view text;
+    CHECK_OR_RETURN(sentence_record::Decode(record(index), &text,
+                                            &sentence->second))
+        << "Broken record at " << index;
+    sentence->first.assign(text.data(), text.size());
+    return util::OkStatus();
+  }
+
+  util::Status Set(size_t index, Sentence sentence) override {
+    RETURN_IF_ERROR(status_);
+    CHECK_LT_OR_RETURN(index, size());
+    // Only the segments are shared with the other threads setting the other
+    // sentences, and Write() locks them.
+    return Write(sentence.first, sentence.second, records_[index],
+                 sizes_[index], &records_[index], &sizes_[index]);
+  }
+
+  util::Status Truncate(size_t size) override {
+    CHECK_LE_OR_RETURN(size, this->size());
+    records_.resize(size);
+    sizes_.resize(size);
+    if (size == 0) {
+      records_.shrink_to_fit();
+      sizes_.shrink_to_fit();
+      RemoveSegments();
+    }
+    return util::OkStatus();
+  }
+
+  util::Status RemoveIf(
+      const std::function<bool(const Sentence &sentence)> &pred) override {
+    // Only the offsets are moved, as in SentenceArena.
+    Sentence sentence;
+    size_t size = 0;
+    for (size_t i = 0; i < this->size(); ++i) {
+      RETURN_IF_ERROR(Get(i, &sentence));
+      if (pred(sentence)) continue;
+      records_[size] = records_[i];
+      sizes_[size] = sizes_[i];
+      ++size;
+    }
+    return Truncate(size);
+  }
+
+  size_t GetMemoryUsage() const override {
+    const size_t bytes =
+        memory_usage::Vector(records_) + memory_usage::Vector(sizes_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes + memory_usage::Vector(segments_);
+  }
+
+  std::unique_ptr<Cursor> NewCursor(size_t begin, size_t end) const override {
+    return std::make_unique<LogCursor>(this, begin, std::min(end, size()));
+  }
+
+  absl::string_view record(size_t index) const {
+    return absl::string_view(records_[index], sizes_[index]);
+  }
+
+ private:
+  struct Segment {
+    std::string path;
+    char *data = nullptr;
+    size_t size = 0;
+    size_t used = 0;
+  };
+
+  class LogCursor : public Cursor {
+   public:
+    LogCursor(const LogSentenceStore *store, size_t begin, size_t end)
+        : store_(store), index_(begin), end_(end) {
+      Load();
+    }
+
+    bool done() const override { return index_ >= end_; }
+
+    void Next() override {
+      ++index_;
+      Load();
+    }
+
+    size_t index() const override { return index_; }
+    const Sentence &value() const override { return value_; }
+    util::Status status() const override { return status_; }
+
+   private:
+    void Load() {
+      if (done()) return;
+      absl::string_view text;
+      if (!sentence_record::Decode(store_->record(index_), &text,
+                                   &value_.second)) {
+        status_ = util::InternalError(
+            absl::StrCat("Broken record at ", index_));
+        index_ = end_;
+        return;
+      }
+      value_.first.assign(text.data(), text.size());
+    }
+
+    const LogSentenceStore *store_ = nullptr;
+    size_t index_ = 0;
+    size_t end_ = 0;
+    Sentence value_;
+    util::Status status_;
+  };
+
+  // Writes the record of (`text`, `freq`) over the `old_size` bytes at `old`
+  // if it fits, and to the end of the log otherwise. Thread safe.
+  util::Status Write(absl::string_view text, int64 freq, char *old,
+                     size_t old_size, char **record, uint32 *size) {
+    // The varint is short enough not to allocate.
+    std::string prefix;
+    sentence_record::AppendVarint(static_cast<uint64>(freq), &prefix);
+    const size_t record_size = prefix.size() + text.size();
+    CHECK_LE_OR_RETURN(record_size, std::numeric_limits<uint32>::max());
+    char *data = old;
+    if (old == nullptr || record_size > old_size) {
+      RETURN_IF_ERROR(Allocate(record_size, &data));
+    }
+    memcpy(data, prefix.data(), prefix.size());
+    memcpy(data + prefix.size(), text.data(), text.size());
+    *record = data;
+    *size = record_size;
+    return util::OkStatus();
+  }
+
+  // Returns `size` bytes at the end of the log, mapping a new segment when
+  // the last one is full. The segments are never remapped, so the records
+  // stay where they are written.
+  util::Status Allocate(size_t size, char **data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segments_.empty() ||
+        segments_.back().used + size > segments_.back().size) {
+      Segment segment;
+      segment.path =
+          util::JoinPath(dir_, absl::StrCat("segment-", segments_.size()));
+      segment.size = std::max(segment_size_, size);
+      const int fd =
+          open(segment.path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+      void *mapped = MAP_FAILED;
+      if (fd >= 0 && ftruncate(fd, segment.size) == 0) {
+        mapped = mmap(nullptr, segment.size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+      }
+      const int error = errno;
+      if (fd >= 0) close(fd);  // The mapping is kept after closing the file.
+      if (mapped == MAP_FAILED) {
+        if (fd >= 0) unlink(segment.path.c_str());
+        return util::StatusBuilder(util::StatusCode::kInternal, GTL_LOC)
+               << "\"" << segment.path << "\": " << util::StrError(error);
+      }
+      segment.data = static_cast<char *>(mapped);
+      segments_.push_back(std::move(segment));
+    }
+    auto &segment = segments_.back();
+    *data = segment.data + segment.used;
+    segment.used += size;
+    return util::OkStatus();
+  }
+
+  // Unmaps the segments, and removes their files unless `keep_`. The kept
+  // files are cut to the bytes written.
+  void RemoveSegments() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &segment : segments_) {
+      munmap(segment.data, segment.size);
+      if (!keep_) {
+        unlink(segment.path.c_str());
+      } else if (truncate(segment.path.c_str(), segment.used) != 0) {
+        LOG(WARNING) << "Failed to truncate " << segment.path;
+      }
+    }
+    segments_.clear();
+    segments_.shrink_to_fit();
+  }
+
+  const std::string parent_;
+  std::string dir_;
+  const bool keep_ = false;
+  const size_t segment_size_ = 0;
+  bool created_parent_ = false;
+  util::Status status_;
+
+  // The offset table.
+  std::vector<char *> records_;
+  std::vector<uint32> sizes_;
+
+  mutable std::mutex mutex_;  // Guards the segments below.
+  std::vector<Segment> segments_;
+};
+
+}  // namespace
+#endif  // !_WIN32
+
+#ifdef SPM_ENABLE_LEVELDB
+std::unique_ptr<SentenceStore> NewLevelDBSentenceStore(absl::string_view path,
+                                                       bool keep) {
+  return std::make_unique<LevelDBSentenceStore>(path, false, keep);
+}
+
+std::unique_ptr<SentenceStore> OpenLevelDBSentenceStore(
+    absl::string_view path) {
+  return std::make_unique<LevelDBSentenceStore>(path, true, true);
+}
+#endif  // SPM_ENABLE_LEVELDB
+
+#if !defined(_WIN32)
+std::unique_ptr<SentenceStore> NewLogSentenceStore(absl::string_view dir,
+                                                   bool keep,
+                                                   size_t segment_size) {
+  return std::make_unique<LogSentenceStore>(dir, keep, segment_size);
+}
+#endif  // !_WIN32
+
+std::unique_ptr<SentenceStore> NewSentenceStore() {
+#ifdef SPM_ENABLE_LEVELDB
+  return NewLevelDBSentenceStore("");
+#else
+  return std::make_unique<SentenceArena>();
+#endif
+}
+
+std::unique_ptr<SentenceStore> NewSentenceStore(absl::string_view type,
+                                                absl::string_view dir,
+                                                bool keep) {
+  if (type.empty()) {
+#ifdef SPM_ENABLE_LEVELDB
+    type = "leveldb";
+#else
+    type = "arena";
+#endif
+  }
+  if (type == "arena") return std::make_unique<SentenceArena>();
+#ifdef SPM_ENABLE_LEVELDB
+  if (type == "leveldb") {
+    return NewLevelDBSentenceStore(dir, keep);
+  }
+#endif
+#if !defined(_WIN32)
+  if (type == "log") return NewLogSentenceStore(dir, keep);
+#endif
+  return nullptr;
+}
+
+}  // namespace sentencepiece
@@ -0,0 +1,249 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SENTENCE_STORE_H_
+#define SENTENCE_STORE_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+
+// Storage of the (sentence, frequency) pairs loaded for training.
+// The trainer only accesses the sentences through this interface so that
+// the sampled corpus does not need to fit in memory.
+//
+// Sentences are appended with Add() and become visible to Get() and
+// cursors after Flush(). Set() rewrites an existing sentence in place and
+// may be called concurrently from multiple threads as long as the indices
+// are distinct. Cursors are independent of each other, so every thread can
+// scan its own range.
+class SentenceStore {
+ public:
+  using Sentence = std::pair<std::string, int64>;
+
+  // Sequential scan over the sentences in [begin, end).
+  class Cursor {
+   public:
+    virtual ~Cursor() {}
+
+    virtual bool done() const = 0;
+    virtual void Next() = 0;
+
+    // Index of the current sentence.
+    virtual size_t index() const = 0;
+    virtual const Sentence &value() const = 0;
+    virtual util::Status status() const = 0;
+  };
+
+  virtual ~SentenceStore() {}
+
+  virtual util::Status status() const = 0;
+
+  // Returns the number of sentences, including the ones not flushed yet.
+  virtual size_t size() const = 0;
+  bool empty() const { return size() == 0; }
+
+  // Appends `sentence` to the end of the store.
+  virtual util::Status Add(Sentence sentence) = 0;
+
+  // Appends the sentence of `text` and `freq`. The stores keeping the text
+  // in their own buffers copy it from `text` without a std::string.
+  virtual util::Status AddText(absl::string_view text, int64 freq) {
+    return Add(std::make_pair(std::string(text), freq));
+  }
+
+  // Writes all the sentences buffered by Add().
+  virtual util::Status Flush() = 0;
+
+  // Reads the `index`-th sentence.
+  virtual util::Status Get(size_t index, Sentence *sentence) const = 0;
+
+  // Replaces the `index`-th sentence with `sentence`.
+  virtual util::Status Set(size_t index, Sentence sentence) = 0;
+
+  // Shrinks the store to the first `size` sentences.
+  virtual util::Status Truncate(size_t size) = 0;
+
+  // Removes all the sentences.
+  util::Status Clear() { return Truncate(0); }
+
+  // Removes the sentences for which `pred` returns true.
+  // The order of the remaining sentences is preserved.
+  virtual util::Status RemoveIf(
+      const std::function<bool(const Sentence &sentence)> &pred);
+
+  // Returns the approximate bytes of memory held by the store. The disk-backed
+  // stores do not count their caches.
+  virtual size_t GetMemoryUsage() const { return 0; }
+
+  // Returns a cursor over the sentences in [begin, end).
+  virtual std::unique_ptr<Cursor> NewCursor(size_t begin,
+                                            size_t end) const = 0;
+
+  // Returns a cursor over all the sentences.
+  std::unique_ptr<Cursor> NewCursor() const { return NewCursor(0, size()); }
+};
+
+// Binary encoding of the sentences kept by the disk-backed stores.
+//
+// A record is <varint frequency><sentence bytes>. The sentence length is
+// implied by the record size, so decoding just points into the record.
+// The header is <magic><varint version><varint number of sentences> and
+// lets a store written by another run or machine be validated and reused.
+// All the integers are little-endian base-128 varints, so the encoding
+// does not depend on the host.
+namespace sentence_record {
+
+constexpr uint32 kVersion = 1;
+
+// Appends `value` to `output` as a varint.
+void AppendVarint(uint64 value, std::string *output);
+
+// Consumes a varint from the front of `input`. Returns false if broken.
+bool ConsumeVarint(absl::string_view *input, uint64 *value);
+
+// Clears `output` and encodes (`text`, `freq`) into it. Reusing the same
+// `output` avoids an allocation per record.
+void Encode(absl::string_view text, int64 freq, std::string *output);
+
+// Decodes `record`. `text` points into `record`; nothing is copied.
+// Returns false if `record` is broken.
+bool Decode(absl::string_view record, absl::string_view *text, int64 *freq);
+
+std::string EncodeHeader(size_t size);
+
+// Returns an error if `header` is broken or has a different version.
+util::Status DecodeHeader(absl::string_view header, size_t *size);
+
+}  // namespace sentence_record
+
+// Returns a store keeping all the sentences in memory.
+std::unique_ptr<SentenceStore> NewInMemorySentenceStore();
+
+// In-memory store packing the sentences into large byte blocks instead of
+// one std::string per sentence. A sentence costs its bytes plus 20 bytes of
+// position, size and frequency, and the blocks are never moved, so the
+// store does not fragment the heap with hundreds of millions of short lines.
+//
+// Set() rewrites a sentence in place when it is not longer than before, as
+// the normalized sentences usually are. A longer one is written to the end
+// of the blocks and its old bytes are only released by Clear().
+class SentenceArena : public SentenceStore {
+ public:
+  SentenceArena();
+  ~SentenceArena() override;
+
+  util::Status status() const override;
+  size_t size() const override { return freqs_.size(); }
+
+  util::Status Add(Sentence sentence) override;
+  util::Status AddText(absl::string_view text, int64 freq) override;
+  util::Status Flush() override;
+  util::Status Get(size_t index, Sentence *sentence) const override;
+  util::Status Set(size_t index, Sentence sentence) override;
+  util::Status Truncate(size_t size) override;
+  util::Status RemoveIf(
+      const std::function<bool(const Sentence &sentence)> &pred) override;
+  size_t GetMemoryUsage() const override;
+  std::unique_ptr<Cursor> NewCursor(size_t begin, size_t end) const override;
+
+  // Returns the `index`-th sentence without copying it. The view is valid
+  // until the sentence is set again or the store is truncated.
+  absl::string_view text(size_t index) const {
+    return absl::string_view(texts_[index], sizes_[index]);
+  }
+  int64 freq(size_t index) const { return freqs_[index]; }
+
+ private:
+  // Returns `size` bytes in the blocks. Thread safe.
+  char *Allocate(size_t size);
+
+  std::vector<char *> texts_;
+  std::vector<uint32> sizes_;
+  std::vector<int64> freqs_;
+
+  mutable std::mutex mutex_;  // Guards the blocks below.
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char *block_ptr_ = nullptr;
+  size_t block_left_ = 0;
+  size_t allocated_ = 0;
+};
+
+// Returns a store reading the sentences of `base`, which may be shared with
+// other stores and is never written, until the first write, which copies
+// them into a store made by `new_store` first. Truncate() only copies the
+// sentences it keeps, so Clear() copies nothing. The first write may be
+// concurrent Set()s, and the reads of `base` may run in other threads.
+std::unique_ptr<SentenceStore> NewCopyOnWriteSentenceStore(
+    std::shared_ptr<const SentenceStore> base,
+    std::function<std::unique_ptr<SentenceStore>()> new_store);
+
+#ifdef SPM_ENABLE_LEVELDB
+// Returns a store backed by a LevelDB database created at `path`, or in a
+// new directory under TMPDIR if `path` is empty. The store has an error
+// status if there is a database at `path` already, which is left intact.
+// The database is removed when the store is deleted unless `keep` is true.
+std::unique_ptr<SentenceStore> NewLevelDBSentenceStore(absl::string_view path,
+                                                       bool keep = false);
+
+// Reopens the LevelDB database at `path` written by a previous run.
+// The database is kept when the store is deleted. The returned store
+// has an error status if the header is missing or of another version.
+std::unique_ptr<SentenceStore> OpenLevelDBSentenceStore(
+    absl::string_view path);
+#endif  // SPM_ENABLE_LEVELDB
+
+#if !defined(_WIN32)
+// Returns a store appending the records of sentence_record to segment files
+// of `segment_size` bytes in `dir`, each mapped into memory once, so the
+// sentences are read in place and the kernel may write their pages back and
+// drop them under memory pressure. Only the offset table of 12 bytes per
+// sentence stays on the heap. Set() rewrites a record in place when it
+// fits, and appends it otherwise.
+//
+// The segments are written to a new directory with a unique name under
+// `dir`, which is created if missing, or under TMPDIR if `dir` is empty, so
+// that the stores sharing `dir` are independent. The segments and the new
+// directory, and `dir` if the store created it and it is empty, are removed
+// when the store is deleted unless `keep` is true.
+std::unique_ptr<SentenceStore> NewLogSentenceStore(
+    absl::string_view dir, bool keep = false,
+    size_t segment_size = 64 << 20);
+#endif  // !_WIN32
+
+// Returns the default store of this build. The LevelDB backed store is used
+// when the library is built with SPM_ENABLE_LEVELDB, and SentenceArena
+// otherwise.
+std::unique_ptr<SentenceStore> NewSentenceStore();
+
+// Returns the store of `type`, one of "arena", "leveldb" and "log", or the
+// default store of this build if `type` is empty. `dir` and `keep` are the
+// directory of a disk-backed store and whether its files are kept; see
+// TrainerSpec::sentence_store. Returns nullptr if `type` is unknown or not
+// available in this build.
+std::unique_ptr<SentenceStore> NewSentenceStore(absl::string_view type,
+                                                absl::string_view dir,
+                                                bool keep);
+
+}  // namespace sentencepiece
+#endif  // SENTENCE_STORE_H_
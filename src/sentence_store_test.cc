@@ -0,0 +1,262 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "sentence_store.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "filesystem.h"
+#include "testharness.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace {
+
+std::vector<SentenceStore::Sentence> ReadAll(const SentenceStore &store,
+                                             size_t begin, size_t end) {
+  std::vector<SentenceStore::Sentence> result;
+  auto cursor = store.NewCursor(begin, end);
+  for (; !cursor->done(); cursor->Next()) {
+    EXPECT_EQ(begin + result.size(), cursor->index());
+    result.push_back(cursor->value());
+  }
+  EXPECT_TRUE(cursor->status().ok());
+  return result;
+}
+
+void RunStoreTest(SentenceStore *store) {
+  ASSERT_TRUE(store->status().ok());
+  EXPECT_TRUE(store->empty());
+
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(store->Add(std::make_pair(absl::StrCat("s", i), i)).ok());
+  }
+  EXPECT_TRUE(store->Flush().ok());
+  EXPECT_EQ(10, store->size());
+
+  SentenceStore::Sentence sentence;
+  EXPECT_TRUE(store->Get(3, &sentence).ok());
+  EXPECT_EQ("s3", sentence.first);
+  EXPECT_EQ(3, sentence.second);
+  EXPECT_FALSE(store->Get(10, &sentence).ok());
+
+  EXPECT_TRUE(store->Set(3, std::make_pair("t3", 30)).ok());
+  EXPECT_FALSE(store->Set(10, std::make_pair("t10", 100)).ok());
+
+  auto all = ReadAll(*store, 0, store->size());
+  ASSERT_EQ(10, all.size());
+  EXPECT_EQ("s0", all[0].first);
+  EXPECT_EQ("t3", all[3].first);
+  EXPECT_EQ(30, all[3].second);
+  EXPECT_EQ("s9", all[9].first);
+
+  // The end of the range is clipped to the size.
+  auto range = ReadAll(*store, 8, 100);
+  ASSERT_EQ(2, range.size());
+  EXPECT_EQ("s8", range[0].first);
+  EXPECT_EQ("s9", range[1].first);
+  EXPECT_TRUE(ReadAll(*store, 5, 5).empty());
+
+  // Removes the odd frequencies, keeping the order.
+  EXPECT_TRUE(store
+                  ->RemoveIf([](const SentenceStore::Sentence &s) {
+                    return s.second % 2 == 1;
+                  })
+                  .ok());
+  all = ReadAll(*store, 0, store->size());
+  ASSERT_EQ(6, all.size());
+  EXPECT_EQ("s0", all[0].first);
+  EXPECT_EQ("s2", all[1].first);
+  EXPECT_EQ("t3", all[2].first);
+  EXPECT_EQ("s4", all[3].first);
+  EXPECT_EQ("s8", all[5].first);
+
+  EXPECT_TRUE(store->Truncate(2).ok());
+  EXPECT_EQ(2, store->size());
+  EXPECT_FALSE(store->Truncate(3).ok());
+
+  EXPECT_TRUE(store->Clear().ok());
+  EXPECT_TRUE(store->empty());
+  EXPECT_TRUE(ReadAll(*store, 0, 10).empty());
+}
+
+}  // namespace
+
+TEST(SentenceStoreTest, RecordTest) {
+  std::string record;
+  absl::string_view text;
+  int64 freq = 0;
+  for (const int64 value : {0LL, 1LL, 127LL, 128LL, 300LL, 1LL << 40, -1LL}) {
+    sentence_record::Encode("hello", value, &record);
+    EXPECT_TRUE(sentence_record::Decode(record, &text, &freq));
+    EXPECT_EQ("hello", text);
+    EXPECT_EQ(value, freq);
+    EXPECT_EQ(record.data() + record.size() - 5, text.data());
+  }
+
+  sentence_record::Encode("", 5, &record);
+  EXPECT_EQ(1, record.size());
+  EXPECT_TRUE(sentence_record::Decode(record, &text, &freq));
+  EXPECT_TRUE(text.empty());
+  EXPECT_EQ(5, freq);
+
+  EXPECT_FALSE(sentence_record::Decode("", &text, &freq));
+  EXPECT_FALSE(sentence_record::Decode("\x80", &text, &freq));
+}
+
+TEST(SentenceStoreTest, HeaderTest) {
+  size_t size = 0;
+  EXPECT_TRUE(
+      sentence_record::DecodeHeader(sentence_record::EncodeHeader(12345), &size)
+          .ok());
+  EXPECT_EQ(12345, size);
+
+  EXPECT_FALSE(sentence_record::DecodeHeader("", &size).ok());
+  EXPECT_FALSE(sentence_record::DecodeHeader("SPMSENTS", &size).ok());
+  EXPECT_FALSE(sentence_record::DecodeHeader("NOTSENTS\x01\x01", &size).ok());
+  // Unknown version.
+  EXPECT_FALSE(sentence_record::DecodeHeader("SPMSENTS\x02\x01", &size).ok());
+  // Trailing garbage.
+  EXPECT_FALSE(
+      sentence_record::DecodeHeader(
+          absl::StrCat(sentence_record::EncodeHeader(1), "x"), &size)
+          .ok());
+}
+
+TEST(SentenceStoreTest, InMemoryTest) {
+  auto store = NewInMemorySentenceStore();
+  RunStoreTest(store.get());
+}
+
+TEST(SentenceStoreTest, ArenaTest) {
+  SentenceArena arena;
+  RunStoreTest(&arena);
+
+  EXPECT_TRUE(arena.Add(std::make_pair("abcdef", 1)).ok());
+  EXPECT_TRUE(arena.Add(std::make_pair("", 2)).ok());
+  EXPECT_TRUE(arena.Add(std::make_pair(std::string(1 << 20, 'x'), 3)).ok());
+  ASSERT_EQ(3, arena.size());
+  EXPECT_EQ("abcdef", arena.text(0));
+  EXPECT_EQ("", arena.text(1));
+  EXPECT_EQ(1 << 20, arena.text(2).size());
+  EXPECT_EQ(3, arena.freq(2));
+
+  // A sentence not longer than before is rewritten in place.
+  const char *data = arena.text(0).data();
+  EXPECT_TRUE(arena.Set(0, std::make_pair("abc", 4)).ok());
+  EXPECT_EQ("abc", arena.text(0));
+  EXPECT_EQ(data, arena.text(0).data());
+  EXPECT_EQ(4, arena.freq(0));
+  EXPECT_TRUE(arena.Set(1, std::make_pair("longer", 5)).ok());
+  EXPECT_EQ("longer", arena.text(1));
+  EXPECT_EQ("abc", arena.text(0));
+  EXPECT_GT(arena.GetMemoryUsage(), 1 << 20);
+
+  auto all = ReadAll(arena, 0, arena.size());
+  ASSERT_EQ(3, all.size());
+  EXPECT_EQ("longer", all[1].first);
+  EXPECT_EQ(5, all[1].second);
+
+  EXPECT_TRUE(arena.Clear().ok());
+  EXPECT_TRUE(arena.empty());
+}
+
+TEST(SentenceStoreTest, DefaultTest) {
+  auto store = NewSentenceStore();
+  RunStoreTest(store.get());
+}
+
+#if !defined(_WIN32)
+TEST(SentenceStoreTest, LogTest) {
+  const std::string dir = util::JoinPath(::testing::TempDir(), "log_store");
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+  // Returns the first segment of the only store in `dir`.
+  auto get_segment = [&dir]() {
+    std::vector<std::string> subdirs;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+      subdirs.push_back(entry.path().string());
+    }
+    EXPECT_EQ(1, subdirs.size());
+    return subdirs.empty() ? std::string()
+                           : util::JoinPath(subdirs[0], "segment-0");
+  };
+  {
+    // Small segments so that the records span many of them.
+    auto store = NewLogSentenceStore(dir, false, 4096);
+    RunStoreTest(store.get());
+
+    EXPECT_TRUE(store->Add(std::make_pair("abcdef", 1)).ok());
+    EXPECT_TRUE(store->Add(std::make_pair(std::string(10000, 'x'), 2)).ok());
+    EXPECT_TRUE(store->Add(std::make_pair("", 3)).ok());
+    EXPECT_TRUE(store->Set(0, std::make_pair("abc", 4)).ok());
+    EXPECT_TRUE(store->Set(2, std::make_pair(std::string(5000, 'y'), 5)).ok());
+
+    // Another store in the same directory keeps its own segments.
+    auto other = NewLogSentenceStore(dir, false, 4096);
+    EXPECT_TRUE(other->Add(std::make_pair("other", 1)).ok());
+    other.reset();
+    EXPECT_EQ(0, access(get_segment().c_str(), F_OK));
+
+    SentenceStore::Sentence sentence;
+    EXPECT_TRUE(store->Get(1, &sentence).ok());
+    EXPECT_EQ(std::string(10000, 'x'), sentence.first);
+    EXPECT_EQ(2, sentence.second);
+    auto all = ReadAll(*store, 0, store->size());
+    ASSERT_EQ(3, all.size());
+    EXPECT_EQ("abc", all[0].first);
+    EXPECT_EQ(4, all[0].second);
+    EXPECT_EQ(std::string(5000, 'y'), all[2].first);
+    EXPECT_EQ(5, all[2].second);
+  }
+  // The segments and the directory are removed with the store.
+  EXPECT_NE(0, access(dir.c_str(), F_OK));
+
+  {
+    auto store = NewLogSentenceStore(dir, true, 4096);
+    EXPECT_TRUE(store->Add(std::make_pair("kept", 1)).ok());
+  }
+  const std::string segment = get_segment();
+  std::string record;
+  ASSERT_TRUE(
+      filesystem::NewReadableFile(segment, true)->ReadAll(&record));
+  EXPECT_EQ("\x01kept", record);
+  std::filesystem::remove_all(dir, ec);
+
+  // A new directory under TMPDIR.
+  auto store = NewLogSentenceStore("");
+  RunStoreTest(store.get());
+}
+#endif  // !_WIN32
+
+TEST(SentenceStoreTest, TypeTest) {
+  RunStoreTest(NewSentenceStore("", "", false).get());
+  RunStoreTest(NewSentenceStore("arena", "", false).get());
+#if !defined(_WIN32)
+  RunStoreTest(NewSentenceStore("log", "", false).get());
+#endif
+#ifndef SPM_ENABLE_LEVELDB
+  EXPECT_EQ(nullptr, NewSentenceStore("leveldb", "", false));
+#endif
+  EXPECT_EQ(nullptr, NewSentenceStore("unknown", "", false));
+}
+
+}  // namespace sentencepiece
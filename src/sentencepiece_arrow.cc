@@ -0,0 +1,205 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "sentencepiece_arrow.h"
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+namespace sentencepiece {
+namespace {
+
+static_assert(sizeof(int) == sizeof(int32_t), "The ids must be int32.");
+
+// Buffers of the output array, shared by it and its child, which the
+// consumer may move out of it.
+struct ArrowIdsBuffers {
+  BatchEncodeResult result;
+  std::vector<int32_t> offsets32;
+  std::vector<int64_t> offsets64;
+  std::vector<uint8_t> validity;
+};
+
+struct ArrowArrayData {
+  std::shared_ptr<ArrowIdsBuffers> buffers;
+  const void *buffer_ptrs[2] = {nullptr, nullptr};
+  ArrowArray child;  // Of the list array.
+  ArrowArray *children[1] = {&child};
+};
+
+struct ArrowSchemaData {
+  std::string format;
+  std::string name;
+  ArrowSchema child;  // Of the list type.
+  ArrowSchema *children[1] = {&child};
+};
+
+void ReleaseArrowArray(ArrowArray *array) {
+  if (array->release == nullptr) return;
+  for (int64_t i = 0; i < array->n_children; ++i) {
+    ArrowArray *child = array->children[i];
+    if (child->release != nullptr) child->release(child);
+  }
+  delete static_cast<ArrowArrayData *>(array->private_data);
+  array->release = nullptr;
+}
+
+void ReleaseArrowSchema(ArrowSchema *schema) {
+  if (schema->release == nullptr) return;
+  for (int64_t i = 0; i < schema->n_children; ++i) {
+    ArrowSchema *child = schema->children[i];
+    if (child->release != nullptr) child->release(child);
+  }
+  delete static_cast<ArrowSchemaData *>(schema->private_data);
+  schema->release = nullptr;
+}
+
+// Fills `array` of `n_buffers` buffers and of the child of `data` if
+// `n_children` is 1.
+void InitArrowArray(ArrowArrayData *data, int64_t length, int64_t null_count,
+                    int64_t n_buffers, int64_t n_children, ArrowArray *array) {
+  array->length = length;
+  array->null_count = null_count;
+  array->offset = 0;
+  array->n_buffers = n_buffers;
+  array->n_children = n_children;
+  array->buffers = data->buffer_ptrs;
+  array->children = n_children > 0 ? data->children : nullptr;
+  array->dictionary = nullptr;
+  array->release = ReleaseArrowArray;
+  array->private_data = data;
+}
+
+void InitArrowSchema(ArrowSchemaData *data, int64_t n_children,
+                     ArrowSchema *schema) {
+  schema->format = data->format.c_str();
+  schema->name = data->name.c_str();
+  schema->metadata = nullptr;
+  schema->flags = ARROW_FLAG_NULLABLE;
+  schema->n_children = n_children;
+  schema->children = n_children > 0 ? data->children : nullptr;
+  schema->dictionary = nullptr;
+  schema->release = ReleaseArrowSchema;
+  schema->private_data = data;
+}
+
+template <typename T>
+void SplitStrings(const ArrowArray &input, std::vector<absl::string_view> *ins) {
+  const auto *offsets = static_cast<const T *>(input.buffers[1]);
+  const char *data = static_cast<const char *>(input.buffers[2]);
+  ins->resize(input.length);
+  for (int64_t i = 0; i < input.length; ++i) {
+    const T begin = offsets[input.offset + i];
+    const T end = offsets[input.offset + i + 1];
+    (*ins)[i] = absl::string_view(data + begin, end - begin);
+  }
+}
+
+}  // namespace
+
+util::Status EncodeArrowArray(const SentencePieceProcessor &sp,
+                              const ArrowSchema &input_schema,
+                              const ArrowArray &input, int num_threads,
+                              ArrowSchema *output_schema, ArrowArray *output) {
+  CHECK_OR_RETURN(output_schema);
+  CHECK_OR_RETURN(output);
+  CHECK_OR_RETURN(input_schema.release != nullptr && input.release != nullptr)
+      << "The input array is released.";
+  const std::string format =
+      input_schema.format == nullptr ? "" : input_schema.format;
+  CHECK_OR_RETURN(format == "u" || format == "U")
+      << "The input must be a string or large string array, not \"" << format
+      << "\".";
+  const bool large = format == "U";
+  CHECK_OR_RETURN(input.n_buffers == 3 && input.length >= 0 &&
+                  input.offset >= 0 &&
+                  (input.length == 0 || input.buffers[1] != nullptr))
+      << "Broken string array.";
+
+  std::vector<absl::string_view> ins;
+  if (large) {
+    SplitStrings<int64_t>(input, &ins);
+  } else {
+    SplitStrings<int32_t>(input, &ins);
+  }
+
+  auto buffers = std::make_shared<ArrowIdsBuffers>();
+  RETURN_IF_ERROR(sp.EncodeBatch(ins, num_threads, /*with_pieces=*/false,
+                                 /*with_alignment=*/false, &buffers->result));
+
+  // The validity bitmap starts at the offset of the input.
+  const auto *validity = static_cast<const uint8_t *>(input.buffers[0]);
+  int64_t null_count = 0;
+  if (validity != nullptr) {
+    buffers->validity.assign((input.length + 7) / 8, 0);
+    for (int64_t i = 0; i < input.length; ++i) {
+      const int64_t j = input.offset + i;
+      if (validity[j / 8] & (1 << (j % 8))) {
+        buffers->validity[i / 8] |= 1 << (i % 8);
+      } else {
+        ++null_count;
+      }
+    }
+  }
+
+  const auto &offsets = buffers->result.offsets();
+  if (large) {
+    buffers->offsets64.assign(offsets.begin(), offsets.end());
+  } else {
+    CHECK_LE_OR_RETURN(
+        buffers->result.ids().size(),
+        static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+        << "Too many ids for a list array. Use a large string array.";
+    buffers->offsets32.assign(offsets.begin(), offsets.end());
+  }
+  if (offsets.empty()) {
+    // The offsets of an empty list array still have one element.
+    buffers->offsets32.assign(1, 0);
+    buffers->offsets64.assign(1, 0);
+  }
+
+  auto *list = new ArrowArrayData;
+  list->buffers = buffers;
+  list->buffer_ptrs[0] =
+      buffers->validity.empty() ? nullptr : buffers->validity.data();
+  list->buffer_ptrs[1] =
+      large ? static_cast<const void *>(buffers->offsets64.data())
+            : static_cast<const void *>(buffers->offsets32.data());
+  auto *ids = new ArrowArrayData;
+  ids->buffers = buffers;
+  // The data buffers are not null even if they are empty.
+  static const int32_t kNoIds[1] = {0};
+  ids->buffer_ptrs[1] = buffers->result.ids().empty()
+                            ? kNoIds
+                            : buffers->result.ids().data();
+  InitArrowArray(ids, buffers->result.ids().size(), 0, 2, 0, &list->child);
+  InitArrowArray(list, input.length, null_count, 2, 1, output);
+
+  auto *list_type = new ArrowSchemaData;
+  list_type->format = large ? "+L" : "+l";
+  list_type->name = input_schema.name == nullptr ? "" : input_schema.name;
+  auto *ids_type = new ArrowSchemaData;
+  ids_type->format = "i";
+  ids_type->name = "item";
+  InitArrowSchema(ids_type, 0, &list_type->child);
+  InitArrowSchema(list_type, 1, output_schema);
+
+  return util::OkStatus();
+}
+
+}  // namespace sentencepiece
@@ -0,0 +1,87 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SENTENCEPIECE_ARROW_H_
+#define SENTENCEPIECE_ARROW_H_
+
+#include <cstdint>
+
+#include "sentencepiece_processor.h"
+
+// The structs of the Arrow C data interface, which is ABI stable and meant
+// to be copied, so that Arrow is not a dependency.
+// https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+
+struct ArrowSchema {
+  // Array type description
+  const char *format;
+  const char *name;
+  const char *metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema **children;
+  struct ArrowSchema *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void **buffers;
+  struct ArrowArray **children;
+  struct ArrowArray *dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray *);
+  // Opaque producer-specific data
+  void *private_data;
+};
+
+}  // extern "C"
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+namespace sentencepiece {
+
+// Encodes the strings of the Arrow array `input` of the type `input_schema`
+// with SentencePieceProcessor::EncodeBatch() on `num_threads` threads.
+// `input` is a string ("u") or large string ("U") array, and is encoded
+// in place. `output` is the list<int32> ("+l") or large_list<int32> ("+L")
+// array of the ids, whose null lists are the null strings, and
+// `output_schema` is its type. The ids are the buffer of the flat batch
+// result, without a copy. The caller owns `output` and `output_schema` and
+// calls their release callbacks.
+util::Status EncodeArrowArray(const SentencePieceProcessor &sp,
+                              const ArrowSchema &input_schema,
+                              const ArrowArray &input, int num_threads,
+                              ArrowSchema *output_schema, ArrowArray *output);
+
+}  // namespace sentencepiece
+#endif  // SENTENCEPIECE_ARROW_H_
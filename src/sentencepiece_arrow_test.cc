@@ -0,0 +1,203 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "sentencepiece_arrow.h"
+
+#include <string>
+#include <vector>
+
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_trainer.h"
+#include "testharness.h"
+
+namespace sentencepiece {
+namespace {
+
+// Input string array of `values`, where the values of `nulls` are null.
+template <typename T>
+class StringArray {
+ public:
+  StringArray(const std::vector<std::string> &values,
+              const std::vector<int> &nulls) {
+    offsets_.push_back(0);
+    for (const auto &value : values) {
+      data_ += value;
+      offsets_.push_back(data_.size());
+    }
+    validity_.assign((values.size() + 7) / 8, 0xFF);
+    for (const int i : nulls) validity_[i / 8] &= ~(1 << (i % 8));
+    buffers_[0] = nulls.empty() ? nullptr : validity_.data();
+    buffers_[1] = offsets_.data();
+    buffers_[2] = data_.data();
+
+    schema_.format = sizeof(T) == 8 ? "U" : "u";
+    schema_.name = "text";
+    schema_.metadata = nullptr;
+    schema_.flags = ARROW_FLAG_NULLABLE;
+    schema_.n_children = 0;
+    schema_.children = nullptr;
+    schema_.dictionary = nullptr;
+    schema_.release = [](ArrowSchema *schema) { schema->release = nullptr; };
+    schema_.private_data = nullptr;
+
+    array_.length = values.size();
+    array_.null_count = nulls.size();
+    array_.offset = 0;
+    array_.n_buffers = 3;
+    array_.n_children = 0;
+    array_.buffers = buffers_;
+    array_.children = nullptr;
+    array_.dictionary = nullptr;
+    array_.release = [](ArrowArray *array) { array->release = nullptr; };
+    array_.private_data = nullptr;
+  }
+
+  const ArrowSchema &schema() const { return schema_; }
+  ArrowArray *mutable_array() { return &array_; }
+
+ private:
+  std::string data_;
+  std::vector<T> offsets_;
+  std::vector<uint8_t> validity_;
+  const void *buffers_[3];
+  ArrowSchema schema_;
+  ArrowArray array_;
+};
+
+void LoadModel(SentencePieceProcessor *sp) {
+  ModelProto model_proto;
+  auto *unk = model_proto.add_pieces();
+  unk->set_type(ModelProto::SentencePiece::UNKNOWN);
+  unk->set_piece("<unk>");
+  for (const char *piece : {"\xE2\x96\x81", "a", "b", "\xE2\x96\x81" "a",
+                            "ab"}) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_piece(piece);
+    sp->set_score(-1.0);
+  }
+  *model_proto.mutable_normalizer_spec() =
+      SentencePieceTrainer::GetNormalizerSpec("identity");
+  EXPECT_TRUE(sp->Load(model_proto).ok());
+}
+
+template <typename T>
+void EncodeArrowArrayTest() {
+  SentencePieceProcessor sp;
+  LoadModel(&sp);
+
+  const std::vector<std::string> values = {"ab", "", "a b", "null", "ba",
+                                           "c",  "a", "b",  "abab"};
+  StringArray<T> input(values, {3});
+  std::vector<std::vector<int>> expected;
+  for (const auto &value : values) {
+    expected.emplace_back();
+    EXPECT_TRUE(sp.Encode(value, &expected.back()).ok());
+  }
+
+  // Also encodes a slice, whose offset is not on a byte of the bitmap.
+  for (const int64_t offset : {0, 3}) {
+    input.mutable_array()->offset = offset;
+    input.mutable_array()->length = values.size() - offset;
+    ArrowSchema schema;
+    ArrowArray array;
+    EXPECT_TRUE(EncodeArrowArray(sp, input.schema(), *input.mutable_array(),
+                                 2, &schema, &array)
+                    .ok());
+    EXPECT_EQ(std::string(sizeof(T) == 8 ? "+L" : "+l"), schema.format);
+    EXPECT_EQ(std::string("text"), schema.name);
+    EXPECT_EQ(1, schema.n_children);
+    EXPECT_EQ(std::string("i"), schema.children[0]->format);
+
+    EXPECT_EQ(static_cast<int64_t>(values.size()) - offset, array.length);
+    EXPECT_EQ(1, array.null_count);
+    EXPECT_EQ(2, array.n_buffers);
+    EXPECT_EQ(1, array.n_children);
+    const auto *validity = static_cast<const uint8_t *>(array.buffers[0]);
+    const auto *offsets = static_cast<const T *>(array.buffers[1]);
+    const ArrowArray *child = array.children[0];
+    const auto *ids = static_cast<const int32_t *>(child->buffers[1]);
+    EXPECT_EQ(offsets[array.length], child->length);
+    for (int64_t i = 0; i < array.length; ++i) {
+      EXPECT_EQ(i + offset != 3, (validity[i / 8] >> (i % 8)) & 1);
+      const std::vector<int> row(ids + offsets[i], ids + offsets[i + 1]);
+      EXPECT_EQ(expected[i + offset], row);
+    }
+
+    // The child outlives the list when it is moved out.
+    ArrowArray moved = *child;
+    array.children[0]->release = nullptr;
+    array.release(&array);
+    EXPECT_TRUE(array.release == nullptr);
+    EXPECT_EQ(expected[offset], std::vector<int>(
+                                    static_cast<const int32_t *>(
+                                        moved.buffers[1]),
+                                    static_cast<const int32_t *>(
+                                        moved.buffers[1]) +
+                                        expected[offset].size()));
+    moved.release(&moved);
+    schema.release(&schema);
+    EXPECT_TRUE(schema.release == nullptr);
+  }
+
+  // Empty array.
+  input.mutable_array()->offset = 0;
+  input.mutable_array()->length = 0;
+  ArrowSchema schema;
+  ArrowArray array;
+  EXPECT_TRUE(EncodeArrowArray(sp, input.schema(), *input.mutable_array(), 2,
+                               &schema, &array)
+                  .ok());
+  EXPECT_EQ(0, array.length);
+  EXPECT_EQ(0, static_cast<const T *>(array.buffers[1])[0]);
+  EXPECT_EQ(0, array.children[0]->length);
+  EXPECT_TRUE(array.children[0]->buffers[1] != nullptr);
+  array.release(&array);
+  schema.release(&schema);
+}
+
+TEST(SentencePieceArrowTest, EncodeStringArrayTest) {
+  EncodeArrowArrayTest<int32_t>();
+}
+
+TEST(SentencePieceArrowTest, EncodeLargeStringArrayTest) {
+  EncodeArrowArrayTest<int64_t>();
+}
+
+TEST(SentencePieceArrowTest, InvalidInputTest) {
+  SentencePieceProcessor sp;
+  LoadModel(&sp);
+  StringArray<int32_t> input({"a"}, {});
+  ArrowSchema schema;
+  ArrowArray array;
+
+  ArrowSchema binary = input.schema();
+  binary.format = "z";
+  EXPECT_FALSE(
+      EncodeArrowArray(sp, binary, *input.mutable_array(), 1, &schema, &array)
+          .ok());
+
+  input.mutable_array()->release(input.mutable_array());
+  EXPECT_FALSE(EncodeArrowArray(sp, input.schema(), *input.mutable_array(), 1,
+                                &schema, &array)
+                   .ok());
+
+  SentencePieceProcessor not_loaded;
+  StringArray<int32_t> other({"a"}, {});
+  EXPECT_FALSE(EncodeArrowArray(not_loaded, other.schema(),
+                                *other.mutable_array(), 1, &schema, &array)
+                   .ok());
+}
+
+}  // namespace
+}  // namespace sentencepiece
@@ -15,20 +15,30 @@
 #include "sentencepiece_processor.h"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <functional>
 #include <iterator>
 #include <map>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <set>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "common.h"
+#include "compiled_model.h"
+#include "encode_stats.h"
 #include "filesystem.h"
+#include "memory_usage.h"
 #include "model_factory.h"
 #include "model_interface.h"
 #include "normalizer.h"
+#include "result_cache.h"
 #include "sentencepiece.pb.h"
 #include "third_party/absl/strings/numbers.h"
 #include "third_party/absl/strings/str_cat.h"
@@ -40,6 +50,10 @@
 #include "unigram_model.h"
 #include "util.h"
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 namespace sentencepiece {
 namespace {
 
@@ -63,20 +77,8 @@ std::vector<absl::string_view> ToPieceArray(const std::vector<std::string> &v) {
 void ConvertToUnicodeSpansInternal(SentencePieceText *spt) {
   if (spt == nullptr || spt->text().empty()) return;
 
-  std::vector<int> utf8_to_unicode(spt->text().size() + 1, 0);
-  absl::string_view str = spt->text();
-  size_t prev = 0;
-  int ulen = 0;
-  while (!str.empty()) {
-    const size_t mblen = std::max<int>(1, string_util::OneCharLen(str.data()));
-    for (int i = prev; i < prev + mblen; ++i) {
-      utf8_to_unicode[i] = ulen;
-    }
-    ++ulen;
-    prev += mblen;
-    str.remove_prefix(mblen);
-  }
-  utf8_to_unicode[prev] = ulen;
+  std::vector<int> utf8_to_unicode;
+  string_util::ByteToCharOffsets(spt->text(), &utf8_to_unicode);
 
   auto clip = [&](int s) {
     return std::min<int>(std::max<int>(0, s), utf8_to_unicode.size() - 1);
@@ -97,6 +99,14 @@ ImmutableSentencePieceText::ImmutableSentencePieceText(
     const SentencePieceText &spt)
     : spt_(&spt) {}
 
+ImmutableSentencePieceText::ImmutableSentencePieceText(
+    std::shared_ptr<google::protobuf::Arena> arena)
+    // Shares the ownership of the arena, the proto being freed with it.
+    : rep_(arena, google::protobuf::Arena::CreateMessage<SentencePieceText>(
+                      arena.get())) {
+  spt_ = rep_.get();
+}
+
 ImmutableSentencePieceText::~ImmutableSentencePieceText() {}
 
 ImmutableSentencePieceText_ImmutableSentencePiece::
@@ -174,6 +184,12 @@ util::bytes ImmutableSentencePieceText::SerializeAsString() const {
 }
 
 ImmutableNBestSentencePieceText::ImmutableNBestSentencePieceText() {}
+ImmutableNBestSentencePieceText::ImmutableNBestSentencePieceText(
+    std::shared_ptr<google::protobuf::Arena> arena)
+    : rep_(arena,
+           google::protobuf::Arena::CreateMessage<NBestSentencePieceText>(
+               arena.get())) {}
+
 ImmutableNBestSentencePieceText::~ImmutableNBestSentencePieceText() {}
 
 size_t ImmutableNBestSentencePieceText::nbests_size() const {
@@ -212,10 +228,182 @@ util::bytes ImmutableNBestSentencePieceText::SerializeAsString() const {
   return rep_ ? rep_->SerializeAsString() : "";
 }
 
+BatchEncodeResult::BatchEncodeResult() {}
+BatchEncodeResult::~BatchEncodeResult() {}
+
+absl::string_view BatchEncodeResult::piece(size_t j) const {
+  return absl::string_view(pieces_).substr(
+      piece_offsets_[j], piece_offsets_[j + 1] - piece_offsets_[j]);
+}
+
+void BatchEncodeResult::Clear() {
+  ids_.clear();
+  offsets_.clear();
+  pieces_.clear();
+  piece_offsets_.clear();
+  begins_.clear();
+  ends_.clear();
+  for (auto &chunk : chunks_) chunk.Clear();
+}
+
+void BatchSampleResult::Clear() {
+  ids_.clear();
+  id_offsets_.clear();
+  scores_.clear();
+  sample_offsets_.clear();
+}
+
+NBestResult::NBestResult() {}
+NBestResult::~NBestResult() {}
+
+void NBestResult::Add(const EncodeResult &pieces, float score) {
+  if (offsets_.empty()) offsets_.push_back(0);
+  for (const auto &p : pieces) pieces_.emplace_back(p.first.size(), p.second);
+  offsets_.push_back(pieces_.size());
+  scores_.push_back(score);
+}
+
+util::Status NBestResult::ToProto(size_t i, SentencePieceText *spt) const {
+  CHECK_OR_RETURN(spt) << "output proto is null";
+  CHECK_LT_OR_RETURN(i, size());
+  spt->Clear();
+  // The pieces point into normalized_, as the ones of the model do. The
+  // control pieces take no bytes and are written as they are.
+  EncodeResult pieces;
+  pieces.reserve(offsets_[i + 1] - offsets_[i]);
+  size_t consumed = 0;
+  for (size_t j = offsets_[i]; j < offsets_[i + 1]; ++j) {
+    const auto &p = pieces_[j];
+    if (p.first == 0) {
+      pieces.emplace_back(processor_->model_->IdToPiece(p.second), p.second);
+    } else {
+      CHECK_LE_OR_RETURN(consumed + p.first, normalized_.size());
+      pieces.emplace_back(
+          absl::string_view(normalized_).substr(consumed, p.first), p.second);
+      consumed += p.first;
+    }
+  }
+  spt->set_score(scores_[i]);
+  return processor_->PopulateSentencePieceText(text_, normalized_,
+                                               norm_to_orig_, pieces, spt);
+}
+
+util::Status NBestResult::ToProto(NBestSentencePieceText *nbest_spt) const {
+  CHECK_OR_RETURN(nbest_spt) << "output proto is null";
+  nbest_spt->Clear();
+  for (size_t i = 0; i < size(); ++i) {
+    RETURN_IF_ERROR(ToProto(i, nbest_spt->add_nbests()));
+  }
+  return util::OkStatus();
+}
+
+void NBestResult::Clear() {
+  processor_ = nullptr;
+  text_.clear();
+  normalized_.clear();
+  norm_to_orig_.clear();
+  pieces_.clear();
+  offsets_.clear();
+  scores_.clear();
+}
+
+SampleGenerator::result_type SampleGenerator::operator()() {
+  return random::SplitMix64(key_, counter_++);
+}
+
+namespace {
+thread_local const CancellationToken *current_cancellation_token = nullptr;
+
+int64 SteadyNanos(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+}  // namespace
+
+void CancellationToken::SetTimeout(int64_t timeout_us) {
+  SetDeadline(std::chrono::steady_clock::now() +
+              std::chrono::microseconds(timeout_us));
+}
+
+void CancellationToken::SetDeadline(
+    std::chrono::steady_clock::time_point deadline) {
+  deadline_ns_.store(SteadyNanos(deadline), std::memory_order_relaxed);
+}
+
+bool CancellationToken::IsCancelled() const {
+  if (cancelled_.load(std::memory_order_relaxed)) return true;
+  const int64 deadline = deadline_ns_.load(std::memory_order_relaxed);
+  return deadline != INT64_MAX &&
+         SteadyNanos(std::chrono::steady_clock::now()) >= deadline;
+}
+
+util::Status CancellationToken::status() const {
+  if (cancelled_.load(std::memory_order_relaxed)) {
+    return util::StatusBuilder(util::StatusCode::kCancelled, GTL_LOC)
+           << "The encode is cancelled.";
+  }
+  if (IsCancelled()) {
+    return util::StatusBuilder(util::StatusCode::kDeadlineExceeded, GTL_LOC)
+           << "The encode exceeds its deadline.";
+  }
+  return util::OkStatus();
+}
+
+ScopedCancellation::ScopedCancellation(const CancellationToken *token)
+    : prev_(current_cancellation_token) {
+  current_cancellation_token = token;
+}
+
+ScopedCancellation::~ScopedCancellation() {
+  current_cancellation_token = prev_;
+}
+
+const CancellationToken *ScopedCancellation::current() {
+  return current_cancellation_token;
+}
+
+namespace {
+// Returns the status of the CancellationToken of the running thread, which
+// fails the encodes whose models returned early.
+util::Status CancellationStatus() {
+  const auto *token = current_cancellation_token;
+  return token == nullptr ? util::OkStatus() : token->status();
+}
+}  // namespace
+
+VocabularyTable::VocabularyTable() {}
+VocabularyTable::~VocabularyTable() {}
+
+absl::string_view VocabularyTable::piece(size_t i) const {
+  return absl::string_view(pieces_).substr(
+      piece_offsets_[i], piece_offsets_[i + 1] - piece_offsets_[i]);
+}
+
+void VocabularyTable::Clear() {
+  pieces_.clear();
+  piece_offsets_.clear();
+  scores_.clear();
+  types_.clear();
+}
+
+void BatchEncodeResult::Chunk::Clear() {
+  ids.clear();
+  sizes.clear();
+  pieces.clear();
+  piece_sizes.clear();
+  begins.clear();
+  ends.clear();
+}
+
 SentencePieceProcessor::SentencePieceProcessor() {}
 SentencePieceProcessor::~SentencePieceProcessor() {}
 
 util::Status SentencePieceProcessor::Load(absl::string_view filename) {
+  auto compiled_model = std::make_shared<CompiledModel>();
+  if (compiled_model->Load(filename, use_huge_pages_).ok()) {
+    return LoadCompiledModel(std::move(compiled_model));
+  }
   auto model_proto = std::make_unique<ModelProto>();
   RETURN_IF_ERROR(io::LoadModelProto(filename, model_proto.get()));
   return Load(std::move(model_proto));
@@ -231,6 +419,14 @@ util::Status SentencePieceProcessor::Load(const ModelProto &model_proto) {
   return Load(std::move(model_proto_copy));
 }
 
+std::future<util::Status> SentencePieceProcessor::LoadAsync(
+    absl::string_view filename) {
+  return std::async(std::launch::async,
+                    [this, filename = std::string(filename)]() {
+                      return Load(filename);
+                    });
+}
+
 util::Status SentencePieceProcessor::LoadFromSerializedProto(
     absl::string_view serialized) {
   auto model_proto = std::make_unique<ModelProto>();
@@ -241,22 +437,124 @@ util::Status SentencePieceProcessor::LoadFromSerializedProto(
 
 util::Status SentencePieceProcessor::Load(
     std::unique_ptr<ModelProto> model_proto) {
+  return LoadWithCompiledModel(std::move(model_proto), nullptr);
+}
+
+util::Status SentencePieceProcessor::LoadFromCompiledArray(
+    absl::string_view data) {
+  auto compiled_model = std::make_shared<CompiledModel>();
+  RETURN_IF_ERROR(compiled_model->LoadFromArray(data));
+  return LoadCompiledModel(std::move(compiled_model));
+}
+
+util::Status SentencePieceProcessor::LoadCompiledModel(
+    std::shared_ptr<const CompiledModel> compiled_model) {
+  auto model_proto = std::make_unique<ModelProto>();
+  const auto serialized = compiled_model->section(CompiledModel::kModelProto);
+  CHECK_OR_RETURN(
+      model_proto->ParseFromArray(serialized.data(), serialized.size()))
+      << "could not parse ModelProto in the compiled model.";
+  return LoadWithCompiledModel(std::move(model_proto),
+                               std::move(compiled_model));
+}
+
+util::Status SentencePieceProcessor::LoadWithCompiledModel(
+    std::unique_ptr<ModelProto> model_proto,
+    std::shared_ptr<const CompiledModel> compiled_model) {
   model_proto_ = std::move(model_proto);
-  model_ = ModelFactory::Create(*model_proto_);
-  normalizer_ = std::make_unique<normalizer::Normalizer>(
-      model_proto_->normalizer_spec(), model_proto_->trainer_spec());
-  if (model_proto_->has_denormalizer_spec() &&
-      !model_proto_->denormalizer_spec().precompiled_charsmap().empty()) {
-    denormalizer_ = std::make_unique<normalizer::Normalizer>(
-        model_proto_->denormalizer_spec());
+  const ModelProto &proto = *model_proto_;
+
+  // The normalizers are independent of the model. They are built in
+  // parallel with the tries of a large model, and in this thread when the
+  // tries are prebuilt or small, where starting a thread costs more than it
+  // saves.
+  constexpr int kMinParallelLoadPieces = 1 << 15;
+  const bool builds_tries =
+      compiled_model == nullptr && proto.precompiled_trie().empty();
+  const auto launch =
+      builds_tries && proto.pieces_size() >= kMinParallelLoadPieces
+          ? std::launch::async
+          : std::launch::deferred;
+  auto normalizer = std::async(launch, [&proto]() {
+    return std::make_unique<normalizer::Normalizer>(proto.normalizer_spec(),
+                                                    proto.trainer_spec());
+  });
+  std::future<std::unique_ptr<normalizer::Normalizer>> denormalizer;
+  if (proto.has_denormalizer_spec() &&
+      !proto.denormalizer_spec().precompiled_charsmap().empty()) {
+    denormalizer = std::async(launch, [&proto]() {
+      return std::make_unique<normalizer::Normalizer>(
+          proto.denormalizer_spec());
+    });
   }
+  model_ = ModelFactory::Create(proto, std::move(compiled_model));
+  builtin_model_ = true;
+  normalizer_ = normalizer.get();
+  denormalizer_ = denormalizer.valid() ? denormalizer.get() : nullptr;
+  vocabulary_mask_.reset();
 
   // Escapes user-defined-symbols in normalizer.
   normalizer_->SetPrefixMatcher(model_->prefix_matcher());
 
   RETURN_IF_ERROR(status());
 
-  // Running self-testing.
+  InitDecodeSurfaces();
+  cut_at_whitespace_ = max_tokens_ > 0 && CanCutAtWhitespace();
+  if (!CanCutAtWhitespace()) parallel_chunk_bytes_ = 0;
+  ClearResultCache();
+
+  self_test_status_ = util::OkStatus();
+  background_self_test_ = std::shared_future<util::Status>();
+  auto mode = self_test_mode_;
+  if (mode == SelfTestMode::kDebugOnly) {
+#ifdef NDEBUG
+    mode = SelfTestMode::kSkip;
+#else
+    mode = SelfTestMode::kOnLoad;
+#endif
+  }
+  if (model_proto_->self_test_data().samples().empty() ||
+      mode == SelfTestMode::kSkip) {
+    return util::OkStatus();
+  }
+
+  if (mode == SelfTestMode::kBackground) {
+    // Tests a view of the model, which stays alive if this is reloaded.
+    auto view = std::make_shared<SentencePieceProcessor>();
+    RETURN_IF_ERROR(view->ShareModel(*this));
+    background_self_test_ = std::async(std::launch::async, [view]() {
+                              const auto status = view->RunSelfTest();
+                              if (!status.ok()) LOG(ERROR) << status.message();
+                              return status;
+                            }).share();
+    return util::OkStatus();
+  }
+
+  self_test_status_ = RunSelfTest();
+  return self_test_status_;
+}
+
+void SentencePieceProcessor::SetSelfTestMode(SelfTestMode mode) {
+  self_test_mode_ = mode;
+}
+
+void SentencePieceProcessor::SetUseHugePages(bool use_huge_pages) {
+  use_huge_pages_ = use_huge_pages;
+}
+
+util::Status SentencePieceProcessor::SelfTestStatus() const {
+  if (background_self_test_.valid()) return background_self_test_.get();
+  return self_test_status_;
+}
+
+util::Status SentencePieceProcessor::RunSelfTest() const {
+  if (max_tokens_ > 0 || max_input_bytes_ > 0) {
+    // The samples are encoded as a whole.
+    SentencePieceProcessor view;
+    RETURN_IF_ERROR(view.ShareModel(*this));
+    return view.RunSelfTest();
+  }
+
   std::vector<std::string> errors, sps;
   for (const auto &s : model_proto_->self_test_data().samples()) {
     RETURN_IF_ERROR(Encode(s.input(), &sps));
@@ -280,14 +578,163 @@ util::Status SentencePieceProcessor::Load(
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::SaveCompiledModel(
+    absl::string_view filename) const {
+  RETURN_IF_ERROR(status());
+  CompiledModel::Sections sections;
+  sections[CompiledModel::kModelProto] = model_proto_->SerializeAsString();
+  model_->AppendCompiledSections(&sections);
+
+  auto output = filesystem::NewWritableFile(filename, true);
+  RETURN_IF_ERROR(output->status());
+  CHECK_OR_RETURN(output->Write(CompiledModel::Serialize(sections)))
+      << "could not write " << filename;
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::ShareModel(
+    const SentencePieceProcessor &other) {
+  RETURN_IF_ERROR(other.status());
+  model_proto_ = other.model_proto_;
+  model_ = other.model_;
+  builtin_model_ = other.builtin_model_;
+  normalizer_ = other.normalizer_;
+  denormalizer_ = other.denormalizer_;
+  decode_surfaces_ = other.decode_surfaces_;
+  vocabulary_mask_ = other.vocabulary_mask_;
+  encode_extra_options_.clear();
+  decode_extra_options_.clear();
+  encode_layout_ = ExtraOptionLayout();
+  decode_layout_ = ExtraOptionLayout();
+  max_tokens_ = 0;
+  max_input_bytes_ = 0;
+  cut_at_whitespace_ = false;
+  parallel_chunk_bytes_ = 0;
+  ClearResultCache();
+  return util::OkStatus();
+}
+
 util::Status SentencePieceProcessor::SetEncodeExtraOptions(
     absl::string_view extra_options) {
-  return ParseExtraOptions(extra_options, &encode_extra_options_);
+  const auto status = ParseExtraOptions(extra_options, &encode_extra_options_);
+  encode_layout_ = GetExtraOptionLayout(encode_extra_options_);
+  ClearResultCache();
+  return status;
 }
 
 util::Status SentencePieceProcessor::SetDecodeExtraOptions(
     absl::string_view extra_options) {
-  return ParseExtraOptions(extra_options, &decode_extra_options_);
+  const auto status = ParseExtraOptions(extra_options, &decode_extra_options_);
+  decode_layout_ = GetExtraOptionLayout(decode_extra_options_);
+  return status;
+}
+
+util::Status SentencePieceProcessor::SetEncodeCacheCapacity(size_t capacity) {
+  RETURN_IF_ERROR(status());
+  // The cached words may break the ties differently.
+  ClearResultCache();
+  return model_->SetEncodeCacheCapacity(capacity);
+}
+
+util::Status SentencePieceProcessor::GetEncodeCacheStats(
+    int64_t *hits, int64_t *misses) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(hits && misses);
+  const auto *cache = model_->encode_cache();
+  CHECK_OR_RETURN(cache) << "The encode cache is not enabled.";
+  const auto stats = cache->stats();
+  *hits = stats.hits;
+  *misses = stats.misses;
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SetResultCacheCapacity(size_t max_bytes) {
+  RETURN_IF_ERROR(status());
+  if (max_bytes == 0) {
+    result_cache_.reset();
+  } else {
+    result_cache_ = std::make_unique<ResultCache>(max_bytes);
+  }
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::GetResultCacheStats(
+    int64_t *hits, int64_t *misses) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(hits && misses);
+  CHECK_OR_RETURN(result_cache_) << "The result cache is not enabled.";
+  const auto stats = result_cache_->stats();
+  *hits = stats.hits;
+  *misses = stats.misses;
+  return util::OkStatus();
+}
+
+void SentencePieceProcessor::ClearResultCache() {
+  if (result_cache_) result_cache_->Clear();
+}
+
+// static
+bool SentencePieceProcessor::EncodeStatsEnabled() {
+  return encode_stats::kEnabled;
+}
+
+// static
+EncodeStats SentencePieceProcessor::GetEncodeStats() {
+  return encode_stats::Snapshot();
+}
+
+// static
+void SentencePieceProcessor::ResetEncodeStats() { encode_stats::Reset(); }
+
+void MemoryUsage::Add(absl::string_view name, size_t bytes) {
+  for (auto &component : components) {
+    if (component.first == name) {
+      component.second += bytes;
+      return;
+    }
+  }
+  components.emplace_back(std::string(name), bytes);
+}
+
+size_t MemoryUsage::bytes(absl::string_view name) const {
+  for (const auto &component : components) {
+    if (component.first == name) return component.second;
+  }
+  return 0;
+}
+
+size_t MemoryUsage::total() const {
+  size_t total = 0;
+  for (const auto &component : components) total += component.second;
+  return total;
+}
+
+MemoryUsage SentencePieceProcessor::GetMemoryUsage() const {
+  MemoryUsage usage;
+  if (model_proto_) {
+    // The serialized size approximates the strings of the messages.
+    usage.Add("model_proto",
+              model_proto_->ByteSizeLong() +
+                  model_proto_->pieces_size() *
+                      sizeof(ModelProto::SentencePiece));
+  }
+  if (model_) model_->AddMemoryUsage(&usage);
+  if (normalizer_) usage.Add("normalizer", normalizer_->GetMemoryUsage());
+  if (denormalizer_) {
+    usage.Add("denormalizer", denormalizer_->GetMemoryUsage());
+  }
+  if (decode_surfaces_) {
+    size_t bytes = memory_usage::Vector(*decode_surfaces_);
+    for (const auto &surface : *decode_surfaces_) {
+      bytes += memory_usage::String(surface.surface);
+    }
+    usage.Add("decode_surfaces", bytes);
+  }
+  if (vocabulary_mask_) {
+    usage.Add("vocabulary_mask", memory_usage::Vector(*vocabulary_mask_));
+  }
+  if (result_cache_) usage.Add("result_cache", result_cache_->GetMemoryUsage());
+  return usage;
 }
 
 util::Status SentencePieceProcessor::status() const {
@@ -310,35 +757,100 @@ util::Status SentencePieceProcessor::SetVocabulary(
   const std::set<absl::string_view> vocab(valid_vocab.begin(),
                                           valid_vocab.end());
 
+  // The model stays intact, so that processors sharing it can each have their
+  // own vocabulary.
+  auto mask = std::make_shared<std::vector<bool>>(model_proto_->pieces_size());
   for (int i = 0; i < model_proto_->pieces_size(); ++i) {
-    auto *piece = model_proto_->mutable_pieces(i);
-    if (piece->type() == ModelProto::SentencePiece::CONTROL ||
-        piece->type() == ModelProto::SentencePiece::UNKNOWN ||
-        piece->type() == ModelProto::SentencePiece::USER_DEFINED) {
+    const auto &piece = model_proto_->pieces(i);
+    if (piece.type() == ModelProto::SentencePiece::CONTROL ||
+        piece.type() == ModelProto::SentencePiece::UNKNOWN ||
+        piece.type() == ModelProto::SentencePiece::USER_DEFINED ||
+        piece.type() == ModelProto::SentencePiece::BYTE) {
       continue;
     }
-    if (vocab.find(piece->piece()) != vocab.end() ||
-        string_util::OneCharLen(piece->piece().c_str()) ==
-            piece->piece().size()) {
-      piece->set_type(ModelProto::SentencePiece::NORMAL);
-    } else {
-      piece->set_type(ModelProto::SentencePiece::UNUSED);
-    }
+    (*mask)[i] = vocab.find(piece.piece()) == vocab.end() &&
+                 string_util::OneCharLen(piece.piece().c_str()) !=
+                     piece.piece().size();
   }
+  vocabulary_mask_ = std::move(mask);
+  ClearResultCache();
 
   return util::OkStatus();
 }
 
-util::Status SentencePieceProcessor::ResetVocabulary() {
+util::Status SentencePieceProcessor::ExportCompactModel(
+    bool remap_ids, ModelProto *model_proto, std::vector<int> *id_map) const {
   RETURN_IF_ERROR(status());
-  for (auto &piece : *(model_proto_->mutable_pieces())) {
-    if (piece.type() == ModelProto::SentencePiece::UNUSED)
-      piece.set_type(ModelProto::SentencePiece::NORMAL);
+  CHECK_OR_RETURN(model_proto && id_map) << "output container is null";
+
+  // The unused pieces are never in the lattices of a unigram model, while
+  // the BPE merges go through them and resegment them afterwards.
+  const bool remove =
+      remap_ids &&
+      model_proto_->trainer_spec().model_type() == TrainerSpec::UNIGRAM;
+  const int size = model_proto_->pieces_size();
+  *model_proto = *model_proto_;
+  model_proto->clear_pieces();
+  model_proto->clear_precompiled_trie();
+  id_map->assign(size, -1);
+  for (int id = 0; id < size; ++id) {
+    const bool unused = IsUnused(id);
+    if (unused && remove) continue;
+    (*id_map)[id] = model_proto->pieces_size();
+    auto *piece = model_proto->add_pieces();
+    *piece = model_proto_->pieces(id);
+    if (unused) piece->set_type(ModelProto::SentencePiece::UNUSED);
+  }
+
+  auto *spec = model_proto->mutable_trainer_spec();
+  auto remap = [&](int id) {
+    return id >= 0 && id < size ? (*id_map)[id] : id;
+  };
+  if (remap(spec->unk_id()) != spec->unk_id()) {
+    spec->set_unk_id(remap(spec->unk_id()));
+  }
+  if (remap(spec->bos_id()) != spec->bos_id()) {
+    spec->set_bos_id(remap(spec->bos_id()));
+  }
+  if (remap(spec->eos_id()) != spec->eos_id()) {
+    spec->set_eos_id(remap(spec->eos_id()));
+  }
+  if (remap(spec->pad_id()) != spec->pad_id()) {
+    spec->set_pad_id(remap(spec->pad_id()));
   }
+  if (const auto *unigram =
+          dynamic_cast<const unigram::Model *>(model_.get())) {
+    spec->set_min_piece_score(unigram->min_score());
+    spec->set_max_piece_score(unigram->max_score());
+  }
+
+  SentencePieceProcessor compact;
+  compact.SetSelfTestMode(SelfTestMode::kSkip);
+  RETURN_IF_ERROR(compact.Load(*model_proto));
+  // The samples are encoded as the self test of the compacted model runs,
+  // without the extra options, the limits and SetInputNormalized() of this
+  // processor, but with its vocabulary restriction.
+  SentencePieceProcessor restricted;
+  RETURN_IF_ERROR(restricted.ShareModel(*this));
+  auto *samples = model_proto->mutable_self_test_data()->mutable_samples();
+  for (auto &sample : *samples) {
+    std::vector<std::string> pieces;
+    RETURN_IF_ERROR(restricted.Encode(sample.input(), &pieces));
+    sample.set_expected(absl::StrJoin(pieces, " "));
+  }
+  model_proto->set_precompiled_trie(
+      compact.model_->SerializePrecompiledTrie());
 
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::ResetVocabulary() {
+  RETURN_IF_ERROR(status());
+  vocabulary_mask_.reset();
+  ClearResultCache();
+  return util::OkStatus();
+}
+
 util::Status SentencePieceProcessor::LoadVocabulary(absl::string_view filename,
                                                     int threshold) {
   auto input = filesystem::NewReadableFile(filename);
@@ -374,16 +886,339 @@ util::Status SentencePieceProcessor::LoadVocabulary(absl::string_view filename,
   CHECK_OR_RETURN(proto) << "output proto is null"; \
   proto->Clear();
 
+namespace {
+// Returns ByteToPiece(b) without building the string every time.
+const std::string &GetBytePiece(char b) {
+  static const auto *kBytePieces = [] {
+    auto *pieces = new std::array<std::string, 256>;
+    for (int c = 0; c < 256; ++c) (*pieces)[c] = ByteToPiece(c);
+    return pieces;
+  }();
+  return (*kBytePieces)[static_cast<unsigned char>(b)];
+}
+
+// Adds an encode of `input` into `result` to the EncodeStats. A continuous
+// run of unknown pieces is one unknown token, as in the output.
+void CountEncode(const ModelInterface &model, absl::string_view input,
+                 absl::string_view normalized, const EncodeResult &result) {
+  if constexpr (encode_stats::kEnabled) {
+    encode_stats::Add(encode_stats::kCalls, 1);
+    encode_stats::Add(encode_stats::kInputBytes, input.size());
+    encode_stats::Add(encode_stats::kNormalizedBytes, normalized.size());
+    int64 unknown = 0, byte_fallback = 0;
+    bool is_prev_unk = false;
+    for (const auto &p : result) {
+      const bool is_unk = model.IsUnknown(p.second);
+      if (is_unk && model.ByteFallbackEnabled()) {
+        byte_fallback += p.first.size();
+      } else if (is_unk && !is_prev_unk) {
+        ++unknown;
+      }
+      is_prev_unk = is_unk;
+    }
+    encode_stats::Add(encode_stats::kUnknownTokens, unknown);
+    encode_stats::Add(encode_stats::kByteFallbackTokens, byte_fallback);
+  }
+}
+
+// Returns the number of ids of the pieces `result` AppendIds() outputs,
+// before the limits and the extra options.
+size_t CountIds(const PieceTypes &types, const EncodeResult &result) {
+  size_t num_ids = 0;
+  bool is_prev_unk = false;
+  for (const auto &p : result) {
+    const bool is_unk = types.IsUnknown(p.second);
+    if (is_unk && types.byte_fallback()) {
+      num_ids += p.first.size();
+    } else if (!(is_prev_unk && is_unk)) {
+      // A continuous run of unknown pieces is merged into one.
+      ++num_ids;
+    }
+    is_prev_unk = is_unk;
+  }
+  return num_ids;
+}
+
+// A span of an encode, timed for the EncodeStats and reported to the
+// EncodeTracer if any, from its construction until End() or its
+// destruction.
+class EncodeSpan {
+ public:
+  EncodeSpan(EncodeTracer *tracer, EncodeTracer::Span span,
+             encode_stats::Counter counter, size_t size)
+      : tracer_(tracer), span_(span), timer_(counter) {
+    if (tracer_) tracer_->BeginSpan(span_, size);
+  }
+  ~EncodeSpan() { End(); }
+
+  void End() {
+    timer_.Stop();
+    if (tracer_) tracer_->EndSpan(span_);
+    tracer_ = nullptr;
+  }
+
+ private:
+  EncodeTracer *tracer_;
+  const EncodeTracer::Span span_;
+  encode_stats::Timer timer_;
+};
+
+// Returns true if `text` can be cut before text[pos] for a model of
+// CanCutAtWhitespace(). The whitespace must follow a printable ASCII
+// character, which is never normalized into a whitespace.
+bool IsWhitespaceCut(absl::string_view text, size_t pos) {
+  if (pos == 0 || pos >= text.size()) return false;
+  const char prev = text[pos - 1];
+  return text[pos] == ' ' && prev > ' ' && prev < 0x7f;
+}
+
+// Bytes of the input per piece, from which the limited encoders start to
+// search for a prefix with enough pieces.
+constexpr size_t kBytesPerPieceEstimate = 8;
+}  // namespace
+
+void SentencePieceProcessor::SetEncodeTracer(EncodeTracer *tracer) {
+  encode_tracer_ = tracer;
+}
+
+util::Status SentencePieceProcessor::SetEncodeLimits(size_t max_tokens,
+                                                     size_t max_input_bytes) {
+  RETURN_IF_ERROR(status());
+  max_tokens_ = max_tokens;
+  max_input_bytes_ = max_input_bytes;
+  cut_at_whitespace_ = max_tokens_ > 0 && CanCutAtWhitespace();
+  ClearResultCache();
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SetParallelEncode(size_t chunk_bytes,
+                                                       int num_threads) {
+  RETURN_IF_ERROR(status());
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  if (chunk_bytes > 0 && !CanCutAtWhitespace()) {
+    return util::StatusBuilder(util::StatusCode::kFailedPrecondition, GTL_LOC)
+           << "The segmentation of this model cannot be cut at whitespaces.";
+  }
+  parallel_chunk_bytes_ = chunk_bytes;
+  parallel_num_threads_ = num_threads;
+  return util::OkStatus();
+}
+
+namespace {
+// Sets the alignment of Normalize() leaving `input` as it is, which is
+// empty for an empty input.
+void SetIdentityAlignment(absl::string_view input,
+                          std::vector<size_t> *norm_to_orig) {
+  norm_to_orig->resize(input.empty() ? 0 : input.size() + 1);
+  std::iota(norm_to_orig->begin(), norm_to_orig->end(), 0);
+}
+}  // namespace
+
+util::Status SentencePieceProcessor::SetInputNormalized(bool normalized) {
+  RETURN_IF_ERROR(status());
+  input_normalized_ = normalized;
+  ClearResultCache();
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::NormalizeInput(
+    absl::string_view input, absl::string_view *normalized,
+    std::string *buffer, std::vector<size_t> *norm_to_orig) const {
+  if (!input_normalized_) {
+    return normalizer_->Normalize(input, normalized, buffer, norm_to_orig);
+  }
+  buffer->clear();
+  *normalized = input;
+  if (norm_to_orig != nullptr) SetIdentityAlignment(input, norm_to_orig);
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::NormalizeInput(
+    absl::string_view input, std::string *normalized,
+    std::vector<size_t> *norm_to_orig) const {
+  if (!input_normalized_) {
+    return normalizer_->Normalize(input, normalized, norm_to_orig);
+  }
+  normalized->assign(input.data(), input.size());
+  if (norm_to_orig != nullptr) SetIdentityAlignment(input, norm_to_orig);
+  return util::OkStatus();
+}
+
+bool SentencePieceProcessor::CanCutAtWhitespace() const {
+  // A segment starting with a whitespace normalizes to the same text as in
+  // the whole input: the heading whitespaces are removed and the dummy
+  // prefix is added in their place.
+  const auto &model_proto = model_->model_proto();
+  const auto &normalizer_spec = model_proto.normalizer_spec();
+  return model_->PiecesAreWithinWords(nullptr) &&
+         normalizer_spec.add_dummy_prefix() &&
+         normalizer_spec.remove_extra_whitespaces() &&
+         normalizer_spec.escape_whitespaces() &&
+         !model_proto.trainer_spec().treat_whitespace_as_suffix();
+}
+
+util::Status SentencePieceProcessor::LimitEncodeInput(
+    absl::string_view input, absl::string_view *prefix) const {
+  if (max_input_bytes_ > 0 && input.size() > max_input_bytes_) {
+    size_t size = max_input_bytes_;
+    // Backs off to the first byte of a character.
+    while (size > 0 && (input[size] & 0xC0) == 0x80) --size;
+    input = input.substr(0, size);
+  }
+  *prefix = input;
+  if (max_tokens_ == 0 || !cut_at_whitespace_) return util::OkStatus();
+
+  // Counts the pieces of growing prefixes as Encode() emits them, until one
+  // has enough. The segmentation of the prefix is that of the whole input.
+  std::string buffer;
+  size_t size = max_tokens_ * kBytesPerPieceEstimate;
+  while (size < input.size()) {
+    size_t cut = size;
+    while (cut < input.size() && !IsWhitespaceCut(input, cut)) ++cut;
+    if (cut == input.size()) break;
+
+    absl::string_view normalized;
+    RETURN_IF_ERROR(NormalizeInput(input.substr(0, cut), &normalized,
+                                   &buffer, nullptr));
+    const ScopedVocabularyMask mask(vocabulary_mask_.get());
+    const auto result = model_->Encode(normalized);
+    RETURN_IF_ERROR(CancellationStatus());
+    if (CountIds(GetPieceTypes(), result) >= max_tokens_) {
+      *prefix = input.substr(0, cut);
+      break;
+    }
+    size = 2 * cut;
+  }
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::NormalizeAndSegment(
+    absl::string_view input, absl::string_view *normalized,
+    std::string *buffer, std::vector<size_t> *norm_to_orig,
+    EncodeResult *result) const {
+  if (parallel_chunk_bytes_ > 0 && !input_normalized_ &&
+      input.size() >= 2 * parallel_chunk_bytes_ &&
+      !GetSharedThreadPool()->IsWorkerThread()) {
+    return ParallelNormalizeAndSegment(input, normalized, buffer, norm_to_orig,
+                                       result);
+  }
+  EncodeSpan normalize_span(encode_tracer_, EncodeTracer::NORMALIZE,
+                            encode_stats::kNormalizeNanos, input.size());
+  RETURN_IF_ERROR(NormalizeInput(input, normalized, buffer, norm_to_orig));
+  normalize_span.End();
+  EncodeSpan segment_span(encode_tracer_, EncodeTracer::SEGMENT,
+                          encode_stats::kSegmentNanos, normalized->size());
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
+  *result = model_->Encode(*normalized);
+  return CancellationStatus();
+}
+
+util::Status SentencePieceProcessor::ParallelNormalizeAndSegment(
+    absl::string_view input, absl::string_view *normalized,
+    std::string *buffer, std::vector<size_t> *norm_to_orig,
+    EncodeResult *result) const {
+  // A chunk starting with a whitespace normalizes to the same text as in
+  // the whole input (see CanCutAtWhitespace()), so the outputs of the chunks
+  // are concatenated.
+  std::vector<size_t> cuts = {0};
+  for (size_t pos = parallel_chunk_bytes_; pos < input.size();
+       pos = cuts.back() + parallel_chunk_bytes_) {
+    size_t cut = pos;
+    while (cut < input.size() && !IsWhitespaceCut(input, cut)) ++cut;
+    if (cut == input.size()) break;
+    cuts.push_back(cut);
+  }
+  cuts.push_back(input.size());
+
+  struct Chunk {
+    std::string buffer;
+    absl::string_view normalized;
+    std::vector<size_t> norm_to_orig;
+    EncodeResult result;
+    util::Status status;
+  };
+  const size_t num_chunks = cuts.size() - 1;
+  std::vector<Chunk> chunks(num_chunks);
+  EncodeSpan normalize_span(encode_tracer_, EncodeTracer::NORMALIZE,
+                            encode_stats::kNormalizeNanos, input.size());
+  const auto *token = ScopedCancellation::current();
+  GetSharedThreadPool()->ParallelFor(
+      num_chunks, 1, parallel_num_threads_,
+      [&](int, size_t begin, size_t end) {
+        const ScopedCancellation cancellation(token);
+        for (size_t c = begin; c < end; ++c) {
+          auto &chunk = chunks[c];
+          chunk.status = NormalizeInput(
+              input.substr(cuts[c], cuts[c + 1] - cuts[c]), &chunk.normalized,
+              &chunk.buffer,
+              norm_to_orig != nullptr ? &chunk.norm_to_orig : nullptr);
+          if (!chunk.status.ok()) continue;
+          const ScopedVocabularyMask mask(vocabulary_mask_.get());
+          chunk.result = model_->Encode(chunk.normalized);
+        }
+      });
+  normalize_span.End();
+  RETURN_IF_ERROR(CancellationStatus());
+
+  // Joins the normalized chunks into `buffer`, moving the pieces there.
+  size_t size = 0, num_pieces = 0;
+  for (const auto &chunk : chunks) {
+    RETURN_IF_ERROR(chunk.status);
+    size += chunk.normalized.size();
+    num_pieces += chunk.result.size();
+  }
+  buffer->clear();
+  buffer->reserve(size);
+  result->clear();
+  result->reserve(num_pieces);
+  if (norm_to_orig != nullptr) {
+    norm_to_orig->clear();
+    norm_to_orig->reserve(size + 1);
+  }
+  const PieceTypes types = GetPieceTypes();
+  for (size_t c = 0; c < num_chunks; ++c) {
+    const auto &chunk = chunks[c];
+    const size_t offset = buffer->size();
+    buffer->append(chunk.normalized.data(), chunk.normalized.size());
+    for (const auto &p : chunk.result) {
+      // Control pieces point into the model and do not consume the input.
+      if (types.IsControl(p.second)) {
+        result->push_back(p);
+        continue;
+      }
+      const size_t pos = p.first.data() - chunk.normalized.data();
+      result->emplace_back(absl::string_view(buffer->data() + offset + pos,
+                                             p.first.size()),
+                           p.second);
+    }
+    const auto &n2o = chunk.norm_to_orig;
+    if (norm_to_orig != nullptr && !n2o.empty()) {
+      // The end of a chunk is the beginning of the next, whose first
+      // whitespace the whole input aligns to the cut, not to the word
+      // after it as the dummy prefix of the chunk.
+      if (!norm_to_orig->empty()) norm_to_orig->pop_back();
+      const size_t prefix = c > 0 ? strlen(kSpaceSymbol) : 0;
+      for (size_t i = 0; i < n2o.size(); ++i) {
+        norm_to_orig->push_back(cuts[c] + (i < prefix ? 0 : n2o[i]));
+      }
+    }
+  }
+  *normalized = *buffer;
+  return util::OkStatus();
+}
+
 //////////////////////////////////////////////////////////////
 // Simple API.
 util::Status SentencePieceProcessor::Encode(
     absl::string_view input, std::vector<std::string> *pieces) const {
   CHECK_OR_RETURN_STATUS_STL(pieces);
 
-  SentencePieceText spt;
-  RETURN_IF_ERROR(Encode(input, &spt));
-  for (const auto &sp : spt.pieces()) {
-    pieces->emplace_back(sp.piece());
+  std::string buffer;
+  EncodeResult result;
+  RETURN_IF_ERROR(EncodeWithoutAlignment(input, &buffer, &result));
+  pieces->reserve(result.size());
+  for (const auto &p : result) {
+    pieces->emplace_back(p.first.data(), p.first.size());
   }
 
   return util::OkStatus();
@@ -392,12 +1227,334 @@ util::Status SentencePieceProcessor::Encode(
 util::Status SentencePieceProcessor::Encode(absl::string_view input,
                                             std::vector<int> *ids) const {
   CHECK_OR_RETURN_STATUS_STL(ids);
+  std::string buffer;
+  return AppendIds(input, &buffer, ids);
+}
+
+util::Status SentencePieceProcessor::AppendIds(absl::string_view input,
+                                               std::string *buffer,
+                                               std::vector<int> *ids) const {
+  if (result_cache_ == nullptr) return AppendIdsUncached(input, buffer, ids);
+  if (result_cache_->Lookup(input, ids)) return util::OkStatus();
+  const size_t start = ids->size();
+  RETURN_IF_ERROR(AppendIdsUncached(input, buffer, ids));
+  result_cache_->Insert(input, std::vector<int>(ids->begin() + start,
+                                                ids->end()));
+  return util::OkStatus();
+}
 
-  SentencePieceText spt;
-  RETURN_IF_ERROR(Encode(input, &spt));
-  for (const auto &sp : spt.pieces()) {
-    ids->emplace_back(sp.id());
+util::Status SentencePieceProcessor::AppendIdsUncached(
+    absl::string_view input, std::string *buffer,
+    std::vector<int> *ids) const {
+  RETURN_IF_ERROR(LimitEncodeInput(input, &input));
+  absl::string_view normalized;
+  EncodeResult result;
+  RETURN_IF_ERROR(
+      NormalizeAndSegment(input, &normalized, buffer, nullptr, &result));
+  EncodeSpan output_span(encode_tracer_, EncodeTracer::OUTPUT,
+                         encode_stats::kOutputNanos, result.size());
+  CountEncode(*model_, input, normalized, result);
+  return AppendResultIds(normalized, result, ids);
+}
+
+PieceTypes SentencePieceProcessor::GetPieceTypes() const {
+  return PieceTypes(*model_, builtin_model_);
+}
+
+util::Status SentencePieceProcessor::AppendResultIds(
+    absl::string_view normalized, const EncodeResult &result,
+    std::vector<int> *ids) const {
+  // Follows EncodeWithoutAlignment(), writing the ids alone.
+  const auto &layout = encode_layout_;
+  // Reserving on every append would copy the ids of the previous inputs.
+  if (ids->empty()) {
+    ids->reserve(result.size() + layout.prefix.size() + layout.suffix.size());
+  }
+  for (const auto option : layout.prefix) {
+    ids->push_back(GetControlPiece(option).second);
+  }
+  const size_t start = ids->size();
+  const PieceTypes types = GetPieceTypes();
+  size_t consumed = 0;
+  bool is_prev_unk = false;
+  for (const auto &p : result) {
+    const absl::string_view w = p.first;  // piece
+    const int id = p.second;              // id
+
+    CHECK_OR_RETURN(!w.empty()) << "Empty piece is not allowed.";
+
+    const bool is_unk = types.IsUnknown(id);
+
+    if (types.IsControl(id)) {
+      ids->push_back(id);
+    } else {
+      if (is_unk && types.byte_fallback()) {
+        for (const char b : w) {
+          ids->push_back(model_->ByteToId(b));
+        }
+      } else if (!(is_prev_unk && is_unk)) {
+        // A continuous run of unknown pieces is merged into one.
+        ids->push_back(id);
+      }
+      consumed += w.size();
+    }
+    is_prev_unk = is_unk;
+  }
+
+  CHECK_EQ_OR_RETURN(consumed, normalized.size())
+      << "all normalized characters are not consumed.";
+
+  if (max_tokens_ > 0 && ids->size() - start > max_tokens_) {
+    ids->resize(start + max_tokens_);
+  }
+  if (layout.reverse) std::reverse(ids->begin() + start, ids->end());
+  for (const auto option : layout.suffix) {
+    ids->push_back(GetControlPiece(option).second);
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::EncodeWithOffsets(
+    absl::string_view input, bool unicode_offsets, std::vector<int> *ids,
+    std::vector<uint32_t> *begins, std::vector<uint32_t> *ends) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(ids && begins && ends) << "output container is null";
+  ids->clear();
+  begins->clear();
+  ends->clear();
+  OffsetsScratch scratch;
+  return AppendIdsWithOffsets(input, unicode_offsets, &scratch, ids, begins,
+                              ends);
+}
+
+util::Status SentencePieceProcessor::EncodeUTF16(
+    std::u16string_view input, std::vector<int> *ids,
+    std::vector<uint32_t> *begins, std::vector<uint32_t> *ends) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(ids) << "output container is null";
+  CHECK_OR_RETURN((begins == nullptr) == (ends == nullptr))
+      << "begins and ends must be given together";
+  ids->clear();
+  std::string utf8;
+  if (begins == nullptr) {
+    string_util::UTF16ToUTF8(input, &utf8, nullptr);
+    std::string buffer;
+    return AppendIds(utf8, &buffer, ids);
+  }
+
+  // The byte offsets of the pieces are looked up in the code units of the
+  // transcoding.
+  std::vector<uint32> units;
+  string_util::UTF16ToUTF8(input, &utf8, &units);
+  begins->clear();
+  ends->clear();
+  OffsetsScratch scratch;
+  RETURN_IF_ERROR(
+      AppendIdsWithOffsets(utf8, false, &scratch, ids, begins, ends));
+  for (auto &begin : *begins) begin = units[begin];
+  for (auto &end : *ends) end = units[end];
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::AppendIdsWithOffsets(
+    absl::string_view input, bool unicode_offsets, OffsetsScratch *scratch,
+    std::vector<int> *ids, std::vector<uint32_t> *begins,
+    std::vector<uint32_t> *ends) const {
+  RETURN_IF_ERROR(LimitEncodeInput(input, &input));
+  absl::string_view normalized;
+  EncodeResult result;
+  RETURN_IF_ERROR(NormalizeAndSegment(input, &normalized, &scratch->buffer,
+                                      &scratch->norm_to_orig, &result));
+  EncodeSpan output_span(encode_tracer_, EncodeTracer::OUTPUT,
+                         encode_stats::kOutputNanos, result.size());
+  CountEncode(*model_, input, normalized, result);
+  return AppendResultIdsWithOffsets(input, normalized, result, unicode_offsets,
+                                    scratch, ids, begins, ends);
+}
+
+util::Status SentencePieceProcessor::AppendResultIdsWithOffsets(
+    absl::string_view input, absl::string_view normalized,
+    const EncodeResult &result, bool unicode_offsets, OffsetsScratch *scratch,
+    std::vector<int> *ids, std::vector<uint32_t> *begins,
+    std::vector<uint32_t> *ends) const {
+  // Follows PopulateSentencePieceText(), writing the ids and the offsets
+  // alone.
+  const auto &norm_to_orig = scratch->norm_to_orig;
+  const auto &layout = encode_layout_;
+  auto add = [&](int id, size_t begin, size_t end) {
+    ids->push_back(id);
+    begins->push_back(begin);
+    ends->push_back(end);
+  };
+  auto add_control_pieces = [&](const std::vector<ExtraOption> &options) {
+    for (const auto option : options) {
+      const size_t offset = option == BOS ? 0 : input.size();
+      add(GetControlPiece(option).second, offset, offset);
+    }
+  };
+
+  const size_t first = ids->size();
+  add_control_pieces(layout.prefix);
+  const size_t start = ids->size();
+  const PieceTypes types = GetPieceTypes();
+  size_t consumed = 0;
+  bool is_prev_unk = false;
+  for (const auto &p : result) {
+    const absl::string_view w = p.first;  // piece
+    const int id = p.second;              // id
+
+    CHECK_OR_RETURN(!w.empty()) << "Empty piece is not allowed.";
+
+    const bool is_unk = types.IsUnknown(id);
+
+    if (types.IsControl(id)) {
+      add(id, norm_to_orig[consumed], norm_to_orig[consumed]);
+    } else {
+      const size_t end = consumed + w.size();
+      CHECK_LT_OR_RETURN(end, norm_to_orig.size());
+      const size_t orig_begin = norm_to_orig[consumed];
+      const size_t orig_end = norm_to_orig[end];
+      CHECK_LE_OR_RETURN(orig_end, input.size());
+      CHECK_LE_OR_RETURN(orig_begin, orig_end);
+
+      if (is_unk && types.byte_fallback()) {
+        // The last byte piece holds the surface of the unknown character.
+        for (size_t i = 0; i < w.size(); ++i) {
+          add(model_->ByteToId(w[i]), orig_begin,
+              i + 1 == w.size() ? orig_end : orig_begin);
+        }
+      } else if (is_prev_unk && is_unk) {
+        // A continuous run of unknown pieces is merged into one.
+        ends->back() = orig_end;
+      } else {
+        add(id, orig_begin, orig_end);
+      }
+      consumed = end;
+    }
+    is_prev_unk = is_unk;
+  }
+
+  CHECK_EQ_OR_RETURN(consumed, normalized.size())
+      << "all normalized characters are not consumed.";
+
+  if (max_tokens_ > 0 && ids->size() - start > max_tokens_) {
+    ids->resize(start + max_tokens_);
+    begins->resize(start + max_tokens_);
+    ends->resize(start + max_tokens_);
+  }
+  if (layout.reverse) {
+    std::reverse(ids->begin() + start, ids->end());
+    std::reverse(begins->begin() + start, begins->end());
+    std::reverse(ends->begin() + start, ends->end());
+  }
+  add_control_pieces(layout.suffix);
+
+  if (unicode_offsets) {
+    auto &char_offsets = scratch->char_offsets;
+    string_util::ByteToCharOffsets(input, &char_offsets);
+    for (size_t i = first; i < ids->size(); ++i) {
+      (*begins)[i] = char_offsets[(*begins)[i]];
+      (*ends)[i] = char_offsets[(*ends)[i]];
+    }
+  }
+
+  return util::OkStatus();
+}
+
+struct SentencePieceProcessor::BufferScratch {
+  OffsetsScratch offsets;
+  std::vector<absl::string_view> inputs;  // The input of the model alone.
+  EncodeScratch encode;
+  EncodeBatchResult result;
+  std::vector<int> ids;
+  std::vector<uint32_t> begins;
+  std::vector<uint32_t> ends;
+};
+
+util::Status SentencePieceProcessor::EncodeToBuffer(
+    absl::string_view input, int *ids, size_t capacity, size_t *num_ids,
+    uint32_t *begins, uint32_t *ends) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(num_ids) << "output container is null";
+  CHECK_OR_RETURN(ids || capacity == 0) << "output buffer is null";
+  CHECK_OR_RETURN((begins == nullptr) == (ends == nullptr))
+      << "begins and ends must be given together";
+  const bool with_offsets = begins != nullptr;
+
+  thread_local BufferScratch scratch;
+  RETURN_IF_ERROR(LimitEncodeInput(input, &input));
+  EncodeSpan normalize_span(encode_tracer_, EncodeTracer::NORMALIZE,
+                            encode_stats::kNormalizeNanos, input.size());
+  absl::string_view normalized;
+  RETURN_IF_ERROR(NormalizeInput(
+      input, &normalized, &scratch.offsets.buffer,
+      with_offsets ? &scratch.offsets.norm_to_orig : nullptr));
+  normalize_span.End();
+  EncodeSpan segment_span(encode_tracer_, EncodeTracer::SEGMENT,
+                          encode_stats::kSegmentNanos, normalized.size());
+  {
+    // The batch encoder of the model reuses the buffers of `scratch`.
+    const ScopedVocabularyMask mask(vocabulary_mask_.get());
+    scratch.inputs.assign(1, normalized);
+    model_->EncodeBatch(scratch.inputs, &scratch.encode, &scratch.result);
+  }
+  segment_span.End();
+  RETURN_IF_ERROR(CancellationStatus());
+  const auto &result = scratch.result.pieces;
+  EncodeSpan output_span(encode_tracer_, EncodeTracer::OUTPUT,
+                         encode_stats::kOutputNanos, result.size());
+  CountEncode(*model_, input, normalized, result);
+
+  scratch.ids.clear();
+  if (with_offsets) {
+    scratch.begins.clear();
+    scratch.ends.clear();
+    RETURN_IF_ERROR(AppendResultIdsWithOffsets(
+        input, normalized, result, /*unicode_offsets=*/false,
+        &scratch.offsets, &scratch.ids, &scratch.begins, &scratch.ends));
+  } else {
+    RETURN_IF_ERROR(AppendResultIds(normalized, result, &scratch.ids));
+  }
+
+  *num_ids = scratch.ids.size();
+  if (*num_ids > capacity) {
+    return util::StatusBuilder(util::StatusCode::kResourceExhausted, GTL_LOC)
+           << "The buffer of " << capacity << " ids is smaller than the "
+           << *num_ids << " ids of the input.";
+  }
+  std::copy(scratch.ids.begin(), scratch.ids.end(), ids);
+  if (with_offsets) {
+    std::copy(scratch.begins.begin(), scratch.begins.end(), begins);
+    std::copy(scratch.ends.begin(), scratch.ends.end(), ends);
+  }
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::CountTokens(absl::string_view input,
+                                                 size_t *num_tokens) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(num_tokens) << "output container is null";
+  if (result_cache_) {
+    // Caches the ids, so that the next count or encode of `input` hits.
+    std::string buffer;
+    std::vector<int> ids;
+    RETURN_IF_ERROR(AppendIds(input, &buffer, &ids));
+    *num_tokens = ids.size();
+    return util::OkStatus();
   }
+  RETURN_IF_ERROR(LimitEncodeInput(input, &input));
+  std::string buffer;
+  absl::string_view normalized;
+  EncodeResult result;
+  RETURN_IF_ERROR(
+      NormalizeAndSegment(input, &normalized, &buffer, nullptr, &result));
+  CountEncode(*model_, input, normalized, result);
+
+  // The ids AppendIds() outputs, with the limit and the extra options.
+  *num_tokens = CountIds(GetPieceTypes(), result);
+  if (max_tokens_ > 0) *num_tokens = std::min(*num_tokens, max_tokens_);
+  *num_tokens += encode_layout_.prefix.size() + encode_layout_.suffix.size();
 
   return util::OkStatus();
 }
@@ -423,10 +1580,32 @@ util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
                                             std::string *detokenized) const {
   CHECK_OR_RETURN_STATUS_STL(detokenized);
 
-  SentencePieceText spt;
-  RETURN_IF_ERROR(Decode(ids, &spt));
-  *detokenized = std::move(*spt.mutable_text());
+  // The extra options rewrite the pieces of the SentencePieceText.
+  if (!decode_extra_options_.empty() || !decode_surfaces_) {
+    SentencePieceText spt;
+    RETURN_IF_ERROR(Decode(ids, &spt));
+    *detokenized = std::move(*spt.mutable_text());
+    return util::OkStatus();
+  }
 
+  // Follows Decode(pieces, SentencePieceText*) with the surfaces of the ids.
+  StreamingDecoder decoder(*this);
+  for (const int id : ids) RETURN_IF_ERROR(decoder.Append(id, detokenized));
+  RETURN_IF_ERROR(decoder.ProcessBytes(true, detokenized));
+
+  if (denormalizer_) {
+    RETURN_IF_ERROR(denormalizer_->NormalizeInPlace(detokenized));
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::DecodeUTF16(
+    const std::vector<int> &ids, std::u16string *detokenized) const {
+  CHECK_OR_RETURN(detokenized) << "output container is null";
+  std::string utf8;
+  RETURN_IF_ERROR(Decode(ids, &utf8));
+  string_util::UTF8ToUTF16(utf8, detokenized);
   return util::OkStatus();
 }
 
@@ -494,6 +1673,535 @@ util::Status SentencePieceProcessor::SampleEncode(absl::string_view input,
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha,
+    SampleGenerator *generator, std::vector<std::string> *pieces) const {
+  CHECK_OR_RETURN_STATUS_STL(pieces);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(SampleEncode(input, nbest_size, alpha, generator, &spt));
+  for (const auto &sp : spt.pieces()) {
+    pieces->emplace_back(sp.piece());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha,
+    SampleGenerator *generator, std::vector<int> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(SampleEncode(input, nbest_size, alpha, generator, &spt));
+  for (const auto &sp : spt.pieces()) {
+    ids->emplace_back(sp.id());
+  }
+
+  return util::OkStatus();
+}
+
+namespace {
+// The chunks of a batch: the k-th chunk is the inputs in
+// [bounds[k], bounds[k + 1]), and `order` is the order the threads claim
+// them in.
+struct BatchChunks {
+  size_t size() const { return bounds.size() - 1; }
+
+  std::vector<size_t> bounds;
+  std::vector<size_t> order;
+};
+
+// Splits the inputs of a batch into contiguous chunks with about the same
+// number of bytes, a few per thread, so that a handful of long inputs does
+// not leave one thread as a straggler. Short inputs are grouped until a
+// chunk is worth scheduling, and a long input gets a chunk of its own. The
+// chunks are claimed longest first, so that the long ones do not start
+// last; the outputs are still indexed by the chunk.
+template <typename T>
+BatchChunks SplitBatch(const std::vector<T> &inputs, int num_threads) {
+  constexpr size_t kChunksPerThread = 4;
+  // Smaller chunks cost more to schedule than to encode.
+  constexpr size_t kMinChunkBytes = 4096;
+  // Empty inputs still cost something.
+  auto cost = [&inputs](size_t i) { return inputs[i].size() + 1; };
+
+  size_t total = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) total += cost(i);
+  const size_t target = std::max(
+      kMinChunkBytes, total / (std::max(1, num_threads) * kChunksPerThread));
+
+  BatchChunks chunks;
+  chunks.bounds = {0};
+  std::vector<size_t> chunk_bytes;
+  size_t bytes = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    bytes += cost(i);
+    if (bytes >= target || i + 1 == inputs.size()) {
+      chunks.bounds.push_back(i + 1);
+      chunk_bytes.push_back(bytes);
+      bytes = 0;
+    }
+  }
+
+  chunks.order.resize(chunk_bytes.size());
+  std::iota(chunks.order.begin(), chunks.order.end(), 0);
+  std::stable_sort(chunks.order.begin(), chunks.order.end(),
+                   [&chunk_bytes](size_t a, size_t b) {
+                     return chunk_bytes[a] > chunk_bytes[b];
+                   });
+  return chunks;
+}
+
+// Runs `fn(chunk, begin, end)` for every chunk of `chunks` on up to
+// `num_threads` threads of the shared pool, reporting the chunks to `tracer`
+// if it is not null. The CancellationToken of the calling thread is checked
+// by the encodes on the pool too, and fails the chunks not started yet once
+// cancelled. Returns the first error by index.
+util::Status RunBatch(
+    const BatchChunks &chunks, int num_threads,
+    const std::function<util::Status(size_t chunk, size_t begin, size_t end)>
+        &fn,
+    EncodeTracer *tracer = nullptr) {
+  const auto &bounds = chunks.bounds;
+  const size_t num_chunks = chunks.size();
+  std::vector<util::Status> status(num_chunks);
+  const auto *token = ScopedCancellation::current();
+  auto run = [&](int, size_t begin, size_t end) {
+    const ScopedCancellation cancellation(token);
+    for (size_t k = begin; k < end; ++k) {
+      const size_t c = chunks.order[k];
+      if (token != nullptr && token->IsCancelled()) {
+        status[c] = token->status();
+        continue;
+      }
+      if (tracer) {
+        tracer->BeginSpan(EncodeTracer::BATCH_CHUNK, bounds[c + 1] - bounds[c]);
+      }
+      status[c] = fn(c, bounds[c], bounds[c + 1]);
+      if (tracer) tracer->EndSpan(EncodeTracer::BATCH_CHUNK);
+    }
+  };
+  if (num_threads == 1 || num_chunks <= 1) {
+    run(0, 0, num_chunks);
+  } else {
+    GetSharedThreadPool()->ParallelFor(num_chunks, 1, num_threads, run);
+  }
+  for (const auto &s : status) RETURN_IF_ERROR(s);
+  return util::OkStatus();
+}
+
+// Runs `fn(inputs[i], &(*outputs)[i])` for every input, as RunBatch() does.
+template <typename T, typename Output, typename Fn>
+util::Status RunBatch(const std::vector<T> &inputs, int num_threads,
+                      std::vector<Output> *outputs, const Fn &fn,
+                      EncodeTracer *tracer = nullptr) {
+  CHECK_OR_RETURN(outputs) << "output container is null";
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  outputs->clear();
+  outputs->resize(inputs.size());
+  return RunBatch(
+      SplitBatch(inputs, num_threads), num_threads,
+      [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          RETURN_IF_ERROR(fn(inputs[i], &(*outputs)[i]));
+        }
+        return util::OkStatus();
+      },
+      tracer);
+}
+
+// Runs `sample(chunk, i, stream_seed)` for every input i of `chunks` on
+// `num_threads` threads, where `stream_seed` is derived from (`seed`, i).
+// The random generator of the running thread is restored after every chunk,
+// so the sampled result of i does not depend on the thread it runs on.
+// Returns the first error by index.
+util::Status RunSampleBatch(
+    const BatchChunks &chunks, uint64 seed, int num_threads,
+    const std::function<util::Status(size_t chunk, size_t index,
+                                     uint32 stream_seed)> &sample,
+    EncodeTracer *tracer) {
+  return RunBatch(
+      chunks, num_threads,
+      [&](size_t c, size_t begin, size_t end) {
+        auto *mt = random::GetRandomGenerator();
+        const auto saved = std::make_unique<std::mt19937>(*mt);
+        util::Status status;
+        for (size_t i = begin; i < end && status.ok(); ++i) {
+          status = sample(c, i, random::GetStreamSeed(seed, i));
+        }
+        *mt = *saved;
+        return status;
+      },
+      tracer);
+}
+}  // namespace
+
+util::Status SentencePieceProcessor::SampleEncodeBatch(
+    const std::vector<absl::string_view> &inputs, int nbest_size, float alpha,
+    uint64_t seed, int num_threads,
+    std::vector<std::vector<std::string>> *pieces) const {
+  CHECK_OR_RETURN_STATUS_STL(pieces);
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  pieces->resize(inputs.size());
+  return RunSampleBatch(
+      SplitBatch(inputs, num_threads), seed, num_threads,
+      [&](size_t, size_t i, uint32 stream_seed) {
+        SentencePieceText spt;
+        RETURN_IF_ERROR(
+            SampleEncodeWithSeed(inputs[i], nbest_size, alpha, stream_seed,
+                                 &spt));
+        auto &output = (*pieces)[i];
+        output.clear();
+        for (const auto &sp : spt.pieces()) output.emplace_back(sp.piece());
+        return util::OkStatus();
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::SampleEncodeBatch(
+    const std::vector<absl::string_view> &inputs, int nbest_size, float alpha,
+    uint64_t seed, int num_threads, std::vector<std::vector<int>> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  ids->resize(inputs.size());
+  return RunSampleBatch(
+      SplitBatch(inputs, num_threads), seed, num_threads,
+      [&](size_t, size_t i, uint32 stream_seed) {
+        SentencePieceText spt;
+        RETURN_IF_ERROR(
+            SampleEncodeWithSeed(inputs[i], nbest_size, alpha, stream_seed,
+                                 &spt));
+        auto &output = (*ids)[i];
+        output.clear();
+        for (const auto &sp : spt.pieces()) output.emplace_back(sp.id());
+        return util::OkStatus();
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::SampleEncodeAndScoreBatch(
+    const std::vector<absl::string_view> &inputs, int num_samples,
+    float alpha, bool wor, bool include_best, uint64_t seed, int num_threads,
+    BatchSampleResult *result) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(result) << "output container is null";
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  CHECK_OR_RETURN(model_->IsSampleEncodeAndScoreAvailable())
+      << "SampleEncodeAndScore is not available for the current model.";
+  result->Clear();
+
+  // Every chunk of inputs is sampled into its own buffers, which are
+  // concatenated in order at the end as EncodeBatch() does.
+  struct Chunk {
+    std::string buffer;
+    std::vector<int> ids;
+    std::vector<size_t> id_sizes;
+    std::vector<float> scores;
+    std::vector<size_t> sample_sizes;
+  };
+  const auto batch_chunks = SplitBatch(inputs, num_threads);
+  std::vector<Chunk> chunks(batch_chunks.size());
+
+  RETURN_IF_ERROR(RunSampleBatch(
+      batch_chunks, seed, num_threads,
+      [&](size_t c, size_t i, uint32 stream_seed) -> util::Status {
+        auto &chunk = chunks[c];
+        absl::string_view input, normalized;
+        RETURN_IF_ERROR(LimitEncodeInput(inputs[i], &input));
+        RETURN_IF_ERROR(
+            NormalizeInput(input, &normalized, &chunk.buffer, nullptr));
+        random::GetRandomGenerator()->seed(stream_seed);
+        const ScopedVocabularyMask mask(vocabulary_mask_.get());
+        const auto samples = model_->SampleEncodeAndScore(
+            normalized, alpha, num_samples, wor, include_best);
+        CHECK_OR_RETURN(!samples.empty())
+            << "SampleEncodeAndScore returns empty result.";
+        for (const auto &sample : samples) {
+          const size_t prev_size = chunk.ids.size();
+          RETURN_IF_ERROR(AppendResultIds(normalized, sample.first, &chunk.ids));
+          chunk.id_sizes.push_back(chunk.ids.size() - prev_size);
+          chunk.scores.push_back(sample.second);
+        }
+        chunk.sample_sizes.push_back(samples.size());
+        return util::OkStatus();
+      },
+      encode_tracer_));
+
+  result->id_offsets_.push_back(0);
+  result->sample_offsets_.push_back(0);
+  for (const auto &chunk : chunks) {
+    result->ids_.insert(result->ids_.end(), chunk.ids.begin(),
+                        chunk.ids.end());
+    for (const size_t size : chunk.id_sizes) {
+      result->id_offsets_.push_back(result->id_offsets_.back() + size);
+    }
+    result->scores_.insert(result->scores_.end(), chunk.scores.begin(),
+                           chunk.scores.end());
+    for (const size_t size : chunk.sample_sizes) {
+      result->sample_offsets_.push_back(result->sample_offsets_.back() + size);
+    }
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    bool with_pieces, bool with_alignment, BatchEncodeResult *result) const {
+  return EncodeBatch(inputs, num_threads, with_pieces, with_alignment, false,
+                     result);
+}
+
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    bool with_pieces, bool with_alignment, bool unicode_offsets,
+    BatchEncodeResult *result) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(result) << "output container is null";
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  result->Clear();
+
+  // Every chunk of inputs is encoded into its own buffers, which are
+  // concatenated in order at the end.
+  const auto batch_chunks = SplitBatch(inputs, num_threads);
+  const size_t num_chunks = batch_chunks.size();
+  auto &chunks = result->chunks_;
+  if (chunks.size() < num_chunks) chunks.resize(num_chunks);
+
+  RETURN_IF_ERROR(RunBatch(batch_chunks, num_threads, [&](size_t c,
+                                                          size_t begin,
+                                                          size_t end) {
+    auto &chunk = chunks[c];
+    OffsetsScratch scratch;
+    SentencePieceText spt;
+    for (size_t i = begin; i < end; ++i) {
+      const size_t prev_size = chunk.ids.size();
+      if (!with_pieces && !with_alignment) {
+        RETURN_IF_ERROR(AppendIds(inputs[i], &scratch.buffer, &chunk.ids));
+      } else if (!with_pieces) {
+        RETURN_IF_ERROR(AppendIdsWithOffsets(inputs[i], unicode_offsets,
+                                             &scratch, &chunk.ids,
+                                             &chunk.begins, &chunk.ends));
+      } else {
+        RETURN_IF_ERROR(Encode(inputs[i], &spt));
+        if (with_alignment && unicode_offsets) {
+          ConvertToUnicodeSpansInternal(&spt);
+        }
+        for (const auto &sp : spt.pieces()) {
+          chunk.ids.push_back(sp.id());
+          if (with_pieces) {
+            chunk.pieces.append(sp.piece());
+            chunk.piece_sizes.push_back(sp.piece().size());
+          }
+          if (with_alignment) {
+            chunk.begins.push_back(sp.begin());
+            chunk.ends.push_back(sp.end());
+          }
+        }
+      }
+      chunk.sizes.push_back(chunk.ids.size() - prev_size);
+    }
+    return util::OkStatus();
+  }, encode_tracer_));
+
+  size_t num_ids = 0, num_bytes = 0;
+  for (size_t c = 0; c < num_chunks; ++c) {
+    num_ids += chunks[c].ids.size();
+    num_bytes += chunks[c].pieces.size();
+  }
+  auto &offsets = result->offsets_;
+  auto &piece_offsets = result->piece_offsets_;
+  result->ids_.reserve(num_ids);
+  offsets.reserve(inputs.size() + 1);
+  offsets.push_back(0);
+  if (with_pieces) {
+    result->pieces_.reserve(num_bytes);
+    piece_offsets.reserve(num_ids + 1);
+    piece_offsets.push_back(0);
+  }
+  if (with_alignment) {
+    result->begins_.reserve(num_ids);
+    result->ends_.reserve(num_ids);
+  }
+  for (size_t c = 0; c < num_chunks; ++c) {
+    const auto &chunk = chunks[c];
+    for (const size_t size : chunk.sizes) {
+      offsets.push_back(offsets.back() + size);
+    }
+    result->ids_.insert(result->ids_.end(), chunk.ids.begin(),
+                        chunk.ids.end());
+    result->pieces_.append(chunk.pieces);
+    for (const size_t size : chunk.piece_sizes) {
+      piece_offsets.push_back(piece_offsets.back() + size);
+    }
+    result->begins_.insert(result->begins_.end(), chunk.begins.begin(),
+                           chunk.begins.end());
+    result->ends_.insert(result->ends_.end(), chunk.ends.begin(),
+                         chunk.ends.end());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::CountTokensBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<size_t> *num_tokens) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(
+      inputs, num_threads, num_tokens,
+      [this](absl::string_view input, size_t *output) {
+        return CountTokens(input, output);
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<std::vector<std::string>> *pieces) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(
+      inputs, num_threads, pieces,
+      [this](absl::string_view input, std::vector<std::string> *output) {
+        return Encode(input, output);
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<std::vector<int>> *ids) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(
+      inputs, num_threads, ids,
+      [this](absl::string_view input, std::vector<int> *output) {
+        return Encode(input, output);
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::EncodeUTF16Batch(
+    const std::vector<std::u16string_view> &inputs, int num_threads,
+    std::vector<std::vector<int>> *ids) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(
+      inputs, num_threads, ids,
+      [this](std::u16string_view input, std::vector<int> *output) {
+        return EncodeUTF16(input, output);
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::DecodeBatch(
+    const std::vector<std::vector<std::string>> &pieces, int num_threads,
+    std::vector<std::string> *detokenized) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(pieces, num_threads, detokenized,
+                  [this](const std::vector<std::string> &input,
+                         std::string *output) {
+                    return Decode(input, output);
+                  });
+}
+
+util::Status SentencePieceProcessor::DecodeBatch(
+    const std::vector<std::vector<absl::string_view>> &pieces,
+    int num_threads, std::vector<std::string> *detokenized) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(pieces, num_threads, detokenized,
+                  [this](const std::vector<absl::string_view> &input,
+                         std::string *output) {
+                    return Decode(input, output);
+                  });
+}
+
+util::Status SentencePieceProcessor::DecodeBatch(
+    const std::vector<std::vector<int>> &ids, int num_threads,
+    std::vector<std::string> *detokenized) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(
+      ids, num_threads, detokenized,
+      [this](const std::vector<int> &input, std::string *output) {
+        return Decode(input, output);
+      });
+}
+
+util::Status SentencePieceProcessor::NBestEncodeBatch(
+    const std::vector<absl::string_view> &inputs, int nbest_size,
+    int num_threads,
+    std::vector<std::vector<std::vector<std::string>>> *pieces) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(inputs, num_threads, pieces,
+                  [this, nbest_size](
+                      absl::string_view input,
+                      std::vector<std::vector<std::string>> *output) {
+                    return NBestEncode(input, nbest_size, output);
+                  },
+                  encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::NBestEncodeBatch(
+    const std::vector<absl::string_view> &inputs, int nbest_size,
+    int num_threads, std::vector<std::vector<std::vector<int>>> *ids) const {
+  RETURN_IF_ERROR(status());
+  return RunBatch(inputs, num_threads, ids,
+                  [this, nbest_size](absl::string_view input,
+                                     std::vector<std::vector<int>> *output) {
+                    return NBestEncode(input, nbest_size, output);
+                  },
+                  encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<ImmutableSentencePieceText> *spts) const {
+  RETURN_IF_ERROR(status());
+  auto arena = std::make_shared<google::protobuf::Arena>();
+  return RunBatch(
+      inputs, num_threads, spts,
+      [this, &arena](absl::string_view input,
+                     ImmutableSentencePieceText *output) {
+        *output = ImmutableSentencePieceText(arena);
+        return Encode(input, output->mutable_proto());
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::NBestEncodeBatch(
+    const std::vector<absl::string_view> &inputs, int nbest_size,
+    int num_threads,
+    std::vector<ImmutableNBestSentencePieceText> *nbest_spts) const {
+  RETURN_IF_ERROR(status());
+  auto arena = std::make_shared<google::protobuf::Arena>();
+  return RunBatch(
+      inputs, num_threads, nbest_spts,
+      [this, nbest_size, &arena](absl::string_view input,
+                                 ImmutableNBestSentencePieceText *output) {
+        *output = ImmutableNBestSentencePieceText(arena);
+        return NBestEncode(input, nbest_size, output->mutable_proto());
+      },
+      encode_tracer_);
+}
+
+util::Status SentencePieceProcessor::SampleEncodeWithSeed(
+    absl::string_view input, int nbest_size, float alpha, uint32_t stream_seed,
+    SentencePieceText *spt) const {
+  if (!model_->IsSeededSampleEncodeAvailable() ||
+      (model_->IsNBestEncodeAvailable() && nbest_size >= 0)) {
+    random::GetRandomGenerator()->seed(stream_seed);
+    return SampleEncode(input, nbest_size, alpha, spt);
+  }
+
+  CHECK_OR_RETURN_STATUS_PROTO(spt);
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  RETURN_IF_ERROR(NormalizeInput(input, &normalized, &norm_to_orig));
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
+  const auto result = model_->SampleEncodeWithSeed(normalized, alpha,
+                                                   stream_seed);
+  return PopulateSentencePieceText(input, normalized, norm_to_orig, result,
+                                   spt);
+}
+
 util::Status SentencePieceProcessor::SampleEncodeAndScore(
     absl::string_view input, int num_samples, float alpha, bool wor,
     bool include_best,
@@ -548,6 +2256,31 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
     absl::string_view input, absl::string_view normalized,
     const std::vector<size_t> &norm_to_orig, const EncodeResult &result,
     SentencePieceText *spt) const {
+  return PopulateSentencePieceText(input, normalized, norm_to_orig, result,
+                                   encode_layout_, spt);
+}
+
+util::Status SentencePieceProcessor::PopulateSentencePieceText(
+    absl::string_view input, absl::string_view normalized,
+    const std::vector<size_t> &norm_to_orig, const EncodeResult &result,
+    const ExtraOptionLayout &layout, SentencePieceText *spt) const {
+  // Control symbols of the extra options have no surface either. BOS is at
+  // the beginning and EOS at the end of the input wherever they are placed.
+  auto AddControlPieces = [&](const std::vector<ExtraOption> &options) {
+    for (const auto option : options) {
+      const auto control = GetControlPiece(option);
+      const uint32 offset = option == BOS ? 0 : input.size();
+      auto *sp = spt->add_pieces();
+      sp->set_piece(control.first.data(), control.first.size());
+      sp->set_id(control.second);
+      sp->set_begin(offset);
+      sp->set_end(offset);
+    }
+  };
+
+  AddControlPieces(layout.prefix);
+  const int start = spt->pieces_size();
+  const PieceTypes types = GetPieceTypes();
   size_t consumed = 0;
   bool is_prev_unk = false;
   for (const auto &p : result) {
@@ -556,9 +2289,9 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
 
     CHECK_OR_RETURN(!w.empty()) << "Empty piece is not allowed.";
 
-    const bool is_unk = IsUnknown(id);
+    const bool is_unk = types.IsUnknown(id);
 
-    if (IsControl(id)) {
+    if (types.IsControl(id)) {
       // Control symbol has no corresponding source surface, so begin == end.
       auto *sp = spt->add_pieces();
       sp->set_piece(w.data(), w.size());
@@ -578,16 +2311,15 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
       const auto surface =
           absl::ClippedSubstr(input, orig_begin, orig_end - orig_begin);
 
-      if (is_unk && model_->ByteFallbackEnabled()) {
+      if (is_unk && types.byte_fallback()) {
         // Decomposes an unknown piece into UTF-8 bytes
         for (int i = 0; i < w.size(); ++i) {
           // Create a byte piece
           const char b = w[i];
           auto *sp = spt->add_pieces();
-          const auto piece = ByteToPiece(b);
-          auto sp_id = model_->PieceToId(piece);
+          const auto &piece = GetBytePiece(b);
           sp->set_piece(piece.data(), piece.size());
-          sp->set_id(sp_id);
+          sp->set_id(model_->ByteToId(b));
 
           // The last byte piece holds the surface of the original unknown
           // character. The other byte pieces have no surface.
@@ -628,22 +2360,121 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
   CHECK_EQ_OR_RETURN(consumed, normalized.size())
       << "all normalized characters are not consumed.";
 
-  spt->set_text(input.data(), input.size());
-
-  RETURN_IF_ERROR(ApplyExtraOptions(encode_extra_options_, spt));
+  spt->set_text(input.data(), input.size());
+
+  auto *pieces = spt->mutable_pieces();
+  if (layout.max_tokens > 0 && pieces->size() - start > layout.max_tokens) {
+    pieces->DeleteSubrange(start + layout.max_tokens,
+                           pieces->size() - start - layout.max_tokens);
+  }
+  if (layout.reverse) {
+    std::reverse(pieces->pointer_begin() + start, pieces->pointer_end());
+  }
+  if (layout.unk_piece) {
+    for (int i = start; i < pieces->size(); ++i) {
+      auto *sp = pieces->Mutable(i);
+      if (types.IsUnknown(sp->id())) {
+        sp->set_piece(model_->unk_piece().data(), model_->unk_piece().size());
+      }
+    }
+  }
+  AddControlPieces(layout.suffix);
+
+  return util::OkStatus();
+}  // namespace sentencepiece
+
+util::Status SentencePieceProcessor::EncodeWithoutAlignment(
+    absl::string_view input, std::string *buffer, EncodeResult *output) const {
+  RETURN_IF_ERROR(LimitEncodeInput(input, &input));
+  absl::string_view normalized;
+  EncodeResult result;
+  RETURN_IF_ERROR(
+      NormalizeAndSegment(input, &normalized, buffer, nullptr, &result));
+  EncodeSpan output_span(encode_tracer_, EncodeTracer::OUTPUT,
+                         encode_stats::kOutputNanos, result.size());
+  CountEncode(*model_, input, normalized, result);
+
+  // Follows PopulateSentencePieceText().
+  const auto &layout = encode_layout_;
+  output->clear();
+  output->reserve(result.size() + layout.prefix.size() + layout.suffix.size());
+  for (const auto option : layout.prefix) {
+    output->emplace_back(GetControlPiece(option));
+  }
+  const size_t start = output->size();
+  const PieceTypes types = GetPieceTypes();
+  size_t consumed = 0;
+  bool is_prev_unk = false;
+  for (const auto &p : result) {
+    const absl::string_view w = p.first;  // piece
+    const int id = p.second;              // id
+
+    CHECK_OR_RETURN(!w.empty()) << "Empty piece is not allowed.";
+
+    const bool is_unk = types.IsUnknown(id);
+
+    if (types.IsControl(id)) {
+      output->emplace_back(w, id);
+    } else {
+      if (is_unk && types.byte_fallback()) {
+        // Decomposes an unknown piece into UTF-8 bytes
+        for (const char b : w) {
+          output->emplace_back(GetBytePiece(b), model_->ByteToId(b));
+        }
+      } else if (is_prev_unk && is_unk) {
+        // Merges continuous run of unknown pieces, which is the span of
+        // `normalized` from the first one.
+        auto &last = output->back().first;
+        last = absl::string_view(normalized.data() + consumed - last.size(),
+                                 last.size() + w.size());
+      } else {
+        output->emplace_back(w, id);
+      }
+      consumed += w.size();
+    }
+    is_prev_unk = is_unk;
+  }
+
+  CHECK_EQ_OR_RETURN(consumed, normalized.size())
+      << "all normalized characters are not consumed.";
+
+  if (max_tokens_ > 0 && output->size() - start > max_tokens_) {
+    output->resize(start + max_tokens_);
+  }
+  if (layout.reverse) std::reverse(output->begin() + start, output->end());
+  if (layout.unk_piece) {
+    for (size_t i = start; i < output->size(); ++i) {
+      auto &p = (*output)[i];
+      if (types.IsUnknown(p.second)) p.first = model_->unk_piece();
+    }
+  }
+  for (const auto option : layout.suffix) {
+    output->emplace_back(GetControlPiece(option));
+  }
 
   return util::OkStatus();
-}  // namespace sentencepiece
+}
 
 util::Status SentencePieceProcessor::Encode(absl::string_view input,
                                             SentencePieceText *spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(spt);
+  RETURN_IF_ERROR(LimitEncodeInput(input, &input));
 
-  std::string normalized;
+  absl::string_view normalized;
+  std::string buffer;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
-
-  const auto result = model_->Encode(normalized);
+  EncodeResult result;
+  RETURN_IF_ERROR(NormalizeAndSegment(input, &normalized, &buffer,
+                                      &norm_to_orig, &result));
+  EncodeSpan output_span(encode_tracer_, EncodeTracer::OUTPUT,
+                         encode_stats::kOutputNanos, result.size());
+  CountEncode(*model_, input, normalized, result);
+  if (max_tokens_ > 0) {
+    ExtraOptionLayout layout = encode_layout_;
+    layout.max_tokens = max_tokens_;
+    return PopulateSentencePieceText(input, normalized, norm_to_orig, result,
+                                     layout, spt);
+  }
   RETURN_IF_ERROR(
       PopulateSentencePieceText(input, normalized, norm_to_orig, result, spt));
 
@@ -657,12 +2488,14 @@ util::Status SentencePieceProcessor::NBestEncode(
 
   std::string normalized;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  RETURN_IF_ERROR(NormalizeInput(input, &normalized, &norm_to_orig));
 
   CHECK_OR_RETURN(model_->IsNBestEncodeAvailable())
       << "NBestEncode is not available for the current model.";
 
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
   const auto nbests = model_->NBestEncode(normalized, nbest_size);
+  RETURN_IF_ERROR(CancellationStatus());
   CHECK_OR_RETURN(!nbests.empty()) << "NBestEncode returns empty result.";
 
   for (const auto &result : nbests) {
@@ -678,26 +2511,47 @@ util::Status SentencePieceProcessor::NBestEncode(
 util::Status SentencePieceProcessor::SampleEncode(
     absl::string_view input, int nbest_size, float alpha,
     SentencePieceText *spt) const {
+  return SampleEncodeWithGenerator(input, nbest_size, alpha, nullptr, spt);
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha,
+    SampleGenerator *generator, SentencePieceText *spt) const {
+  CHECK_OR_RETURN(generator) << "generator is null";
+  return SampleEncodeWithGenerator(input, nbest_size, alpha, generator, spt);
+}
+
+util::Status SentencePieceProcessor::SampleEncodeWithGenerator(
+    absl::string_view input, int nbest_size, float alpha,
+    SampleGenerator *generator, SentencePieceText *spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(spt);
 
   CHECK_LE_OR_RETURN(nbest_size, 512) << "nbest_size must be nbest_size <= 512";
 
   std::string normalized;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  RETURN_IF_ERROR(NormalizeInput(input, &normalized, &norm_to_orig));
 
   if (!model_->IsNBestEncodeAvailable() || nbest_size < 0) {
     CHECK_OR_RETURN(model_->IsSampleEncodeAvailable())
         << "SampleEncode is not available for the current model.";
-    const auto result = model_->SampleEncode(normalized, alpha);
+    const ScopedVocabularyMask mask(vocabulary_mask_.get());
+    const auto result =
+        generator == nullptr
+            ? model_->SampleEncode(normalized, alpha)
+            : model_->SampleEncodeWithGenerator(normalized, alpha, generator);
     RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
                                               result, spt));
   } else if (nbest_size == 1 || nbest_size == 0) {
+    const ScopedVocabularyMask mask(vocabulary_mask_.get());
     const auto result = model_->Encode(normalized);
+    RETURN_IF_ERROR(CancellationStatus());
     RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
                                               result, spt));
   } else if (nbest_size > 1) {
+    const ScopedVocabularyMask mask(vocabulary_mask_.get());
     const auto nbests = model_->NBestEncode(normalized, nbest_size);
+    RETURN_IF_ERROR(CancellationStatus());
     CHECK_OR_RETURN(!nbests.empty()) << "NBestEncode returns empty result.";
 
     std::vector<double> log_probs;
@@ -712,10 +2566,12 @@ util::Status SentencePieceProcessor::SampleEncode(
         log_probs.begin(), log_probs.end(), std::back_inserter(probs),
         [Z](const auto &log_prob) { return std::exp(log_prob - Z); });
 
-    auto *mt = random::GetRandomGenerator();
     std::discrete_distribution<int> dist(probs.begin(), probs.end());
+    const int index = generator == nullptr
+                          ? dist(*random::GetRandomGenerator())
+                          : dist(*generator);
     RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
-                                              nbests[dist(*mt)].first, spt));
+                                              nbests[index].first, spt));
   }
 
   return util::OkStatus();
@@ -728,8 +2584,9 @@ util::Status SentencePieceProcessor::SampleEncodeAndScore(
       << "SampleEncodeAndScore is not available for the current model.";
   std::string normalized;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  RETURN_IF_ERROR(NormalizeInput(input, &normalized, &norm_to_orig));
 
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
   const auto results = model_->SampleEncodeAndScore(normalized, alpha, samples,
                                                     wor, include_best);
   CHECK_OR_RETURN(!results.empty())
@@ -745,6 +2602,53 @@ util::Status SentencePieceProcessor::SampleEncodeAndScore(
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::NBestEncode(absl::string_view input,
+                                                 int nbest_size,
+                                                 NBestResult *result) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(result) << "output container is null";
+  result->Clear();
+  CHECK_OR_RETURN(model_->IsNBestEncodeAvailable())
+      << "NBestEncode is not available for the current model.";
+  RETURN_IF_ERROR(
+      NormalizeInput(input, &result->normalized_, &result->norm_to_orig_));
+
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
+  const auto nbests = model_->NBestEncode(result->normalized_, nbest_size);
+  RETURN_IF_ERROR(CancellationStatus());
+  CHECK_OR_RETURN(!nbests.empty()) << "NBestEncode returns empty result.";
+
+  result->processor_ = this;
+  result->text_.assign(input.data(), input.size());
+  for (const auto &nbest : nbests) result->Add(nbest.first, nbest.second);
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SampleEncodeAndScore(
+    absl::string_view input, int samples, float alpha, bool wor,
+    bool include_best, NBestResult *result) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(result) << "output container is null";
+  result->Clear();
+  CHECK_OR_RETURN(model_->IsSampleEncodeAndScoreAvailable())
+      << "SampleEncodeAndScore is not available for the current model.";
+  RETURN_IF_ERROR(
+      NormalizeInput(input, &result->normalized_, &result->norm_to_orig_));
+
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
+  const auto samples_result = model_->SampleEncodeAndScore(
+      result->normalized_, alpha, samples, wor, include_best);
+  CHECK_OR_RETURN(!samples_result.empty())
+      << "SampleEncodeAndScore returns empty result.";
+
+  result->processor_ = this;
+  result->text_.assign(input.data(), input.size());
+  for (const auto &sample : samples_result) {
+    result->Add(sample.first, sample.second);
+  }
+  return util::OkStatus();
+}
+
 util::Status SentencePieceProcessor::CalculateEntropy(absl::string_view input,
                                                       float alpha,
                                                       float *entropy) const {
@@ -752,12 +2656,32 @@ util::Status SentencePieceProcessor::CalculateEntropy(absl::string_view input,
       << "CalculateEntropy is not available for the current model.";
   std::string normalized;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  RETURN_IF_ERROR(NormalizeInput(input, &normalized, &norm_to_orig));
 
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
   *entropy = model_->CalculateEntropy(normalized, alpha);
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::CalculateEntropyBatch(
+    const std::vector<absl::string_view> &inputs, float alpha,
+    int num_threads, std::vector<float> *entropies) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(model_->IsCalculateEntropyAvailable())
+      << "CalculateEntropy is not available for the current model.";
+  return RunBatch(
+      inputs, num_threads, entropies,
+      [this, alpha](absl::string_view input, float *entropy) {
+        std::string buffer;
+        absl::string_view normalized;
+        RETURN_IF_ERROR(NormalizeInput(input, &normalized, &buffer, nullptr));
+        const ScopedVocabularyMask mask(vocabulary_mask_.get());
+        *entropy = model_->CalculateEntropy(normalized, alpha);
+        return util::OkStatus();
+      },
+      encode_tracer_);
+}
+
 util::Status SentencePieceProcessor::Decode(
     const std::vector<std::string> &pieces, SentencePieceText *spt) const {
   return Decode(ToPieceArray(pieces), spt);
@@ -767,6 +2691,7 @@ util::Status SentencePieceProcessor::Decode(
     const std::vector<absl::string_view> &pieces,
     SentencePieceText *spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(spt);
+  const PieceTypes types = GetPieceTypes();
 
   const char *unk_surface = kDefaultUnknownSymbol;
   if (model_proto_ && model_proto_->trainer_spec().has_unk_surface())
@@ -779,9 +2704,9 @@ util::Status SentencePieceProcessor::Decode(
   auto DecodeSentencePiece =
       [&](absl::string_view piece, int id,
           bool is_bos_ws) -> std::pair<std::string, bool> {
-    if (IsControl(id)) {                 // <s>, </s>
+    if (types.IsControl(id)) {                 // <s>, </s>
       return std::make_pair("", false);  // invisible symbol.
-    } else if (IsUnknown(id)) {
+    } else if (types.IsUnknown(id)) {
       if (IdToPiece(id) == piece) {  // <unk>
         return std::make_pair(unk_surface, false);
       } else {  // return piece when piece is not <unk>.
@@ -810,13 +2735,31 @@ util::Status SentencePieceProcessor::Decode(
                           has_bos_ws);
   };
 
-  for (absl::string_view w : pieces) {
+  // Adds the pieces in the order of the decode extra options.
+  const auto &layout = decode_layout_;
+  auto AddPiece = [&](absl::string_view w, int id) {
     auto *sp = spt->add_pieces();
+    if (layout.unk_piece && types.IsUnknown(id)) w = model_->unk_piece();
     sp->mutable_piece()->assign(w.data(), w.size());
-    sp->set_id(PieceToId(w));
+    sp->set_id(id);
+  };
+  spt->mutable_pieces()->Reserve(pieces.size() + layout.prefix.size() +
+                                 layout.suffix.size());
+  for (const auto option : layout.prefix) {
+    const auto control = GetControlPiece(option);
+    AddPiece(control.first, control.second);
+  }
+  if (layout.reverse) {
+    for (auto it = pieces.rbegin(); it != pieces.rend(); ++it) {
+      AddPiece(*it, PieceToId(*it));
+    }
+  } else {
+    for (const absl::string_view w : pieces) AddPiece(w, PieceToId(w));
+  }
+  for (const auto option : layout.suffix) {
+    const auto control = GetControlPiece(option);
+    AddPiece(control.first, control.second);
   }
-
-  RETURN_IF_ERROR(ApplyExtraOptions(decode_extra_options_, spt));
 
   std::string *text = spt->mutable_text();
   auto SetSurface = [&](int index, absl::string_view surface) {
@@ -837,7 +2780,7 @@ util::Status SentencePieceProcessor::Decode(
     std::string bytes;
     for (int i = token_index_begin; i < token_index_end; ++i) {
       const auto &sp = spt->pieces(i);
-      const int byte = PieceToByte(sp.piece());
+      const int byte = model_->IdToByte(sp.id());
       CHECK_LE_OR_RETURN(0, byte);
       bytes.append(1, byte);
     }
@@ -887,7 +2830,7 @@ util::Status SentencePieceProcessor::Decode(
 
   for (int i = 0; i < spt->pieces_size(); ++i) {
     const auto &sp = spt->pieces(i);
-    if (!IsByte(sp.id())) {
+    if (!types.IsByte(sp.id())) {
       RETURN_IF_ERROR(ProcessBytePieces(byte_start, i));
 
       // if we have seen a bos_ws token or any non-empty token
@@ -903,7 +2846,7 @@ util::Status SentencePieceProcessor::Decode(
   RETURN_IF_ERROR(ProcessBytePieces(byte_start, spt->pieces_size()));
 
   if (denormalizer_) {
-    *text = denormalizer_->Normalize(*text);
+    RETURN_IF_ERROR(denormalizer_->NormalizeInPlace(text));
   }
 
   return util::OkStatus();
@@ -924,6 +2867,43 @@ util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
   return Decode(pieces, spt);
 }
 
+void SentencePieceProcessor::InitDecodeSurfaces() {
+  decode_surfaces_.reset();
+  if (!model_ || !model_->status().ok()) return;
+
+  const char *unk_surface = kDefaultUnknownSymbol;
+  if (model_proto_ && model_proto_->trainer_spec().has_unk_surface())
+    unk_surface = model_proto_->trainer_spec().unk_surface().c_str();
+
+  std::vector<DecodeSurface> surfaces(model_->GetPieceSize());
+  for (int i = 0; i < surfaces.size(); ++i) {
+    const absl::string_view piece = model_->IdToPiece(i);
+    // Decode() looks the piece up again.
+    const int id = model_->PieceToId(piece);
+    auto &entry = surfaces[i];
+    if (model_->IsByte(id)) {
+      const int byte = model_->IdToByte(id);
+      // Leaves the error to Decode() of the SentencePieceText.
+      if (byte < 0) return;
+      entry.type = DecodeSurface::BYTE;
+      entry.byte = static_cast<char>(byte);
+    } else if (model_->IsControl(id)) {
+      entry.type = DecodeSurface::CONTROL;
+    } else if (model_->IsUnknown(id)) {
+      entry.type = DecodeSurface::UNKNOWN;
+      entry.surface =
+          model_->IdToPiece(id) == piece ? unk_surface : std::string(piece);
+    } else {
+      entry.has_space_prefix = absl::StartsWith(piece, kSpaceSymbol);
+      entry.surface = absl::StrReplaceAll(piece, {{kSpaceSymbol, " "}});
+    }
+  }
+  if (!surfaces.empty()) {
+    decode_surfaces_ =
+        std::make_shared<const std::vector<DecodeSurface>>(std::move(surfaces));
+  }
+}
+
 #define CHECK_STATUS_OR_RETURN_DEFAULT(value)                                \
   if (!status().ok()) {                                                      \
     LOG(ERROR) << status().message() << "\nReturns default value " << value; \
@@ -983,6 +2963,7 @@ bool SentencePieceProcessor::IsUnknown(int id) const {
 
 bool SentencePieceProcessor::IsUnused(int id) const {
   CHECK_STATUS_OR_RETURN_DEFAULT(false);
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
   return model_->IsUnused(id);
 }
 
@@ -991,6 +2972,42 @@ bool SentencePieceProcessor::IsByte(int id) const {
   return model_->IsByte(id);
 }
 
+util::Status SentencePieceProcessor::GetVocabularyTable(
+    VocabularyTable *table) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(table) << "output container is null";
+  table->Clear();
+  const int size = model_->GetPieceSize();
+  size_t bytes = 0;
+  for (int id = 0; id < size; ++id) bytes += model_->IdToPiece(id).size();
+  table->pieces_.reserve(bytes);
+  table->piece_offsets_.reserve(size + 1);
+  table->scores_.reserve(size);
+  table->types_.reserve(size);
+
+  table->piece_offsets_.push_back(0);
+  const ScopedVocabularyMask mask(vocabulary_mask_.get());
+  for (int id = 0; id < size; ++id) {
+    table->pieces_ += model_->IdToPiece(id);
+    table->piece_offsets_.push_back(table->pieces_.size());
+    table->scores_.push_back(model_->GetScore(id));
+    auto type = ModelProto::SentencePiece::NORMAL;
+    if (model_->IsUnknown(id)) {
+      type = ModelProto::SentencePiece::UNKNOWN;
+    } else if (model_->IsControl(id)) {
+      type = ModelProto::SentencePiece::CONTROL;
+    } else if (model_->IsUserDefined(id)) {
+      type = ModelProto::SentencePiece::USER_DEFINED;
+    } else if (model_->IsByte(id)) {
+      type = ModelProto::SentencePiece::BYTE;
+    } else if (model_->IsUnused(id)) {
+      type = ModelProto::SentencePiece::UNUSED;
+    }
+    table->types_.push_back(type);
+  }
+  return util::OkStatus();
+}
+
 int SentencePieceProcessor::unk_id() const {
   const int id = PieceToId(absl::string_view(model_->unk_piece().data()));
   if (IsUnknown(id)) return id;
@@ -1016,51 +3033,38 @@ int SentencePieceProcessor::pad_id() const {
 }
 
 // static
-util::Status SentencePieceProcessor::ApplyExtraOptions(
-    const std::vector<ExtraOption> &extra_options,
-    SentencePieceText *spt) const {
-  for (const auto &extra_option : extra_options) {
+SentencePieceProcessor::ExtraOptionLayout
+SentencePieceProcessor::GetExtraOptionLayout(
+    const std::vector<ExtraOption> &extra_options) {
+  ExtraOptionLayout layout;
+  for (const auto extra_option : extra_options) {
     switch (extra_option) {
       case REVERSE:
-        std::reverse(spt->mutable_pieces()->begin(),
-                     spt->mutable_pieces()->end());
+        // The control pieces around move to the other side.
+        layout.prefix.swap(layout.suffix);
+        std::reverse(layout.prefix.begin(), layout.prefix.end());
+        std::reverse(layout.suffix.begin(), layout.suffix.end());
+        layout.reverse = !layout.reverse;
+        break;
+      case EOS:
+        layout.suffix.push_back(EOS);
+        break;
+      case BOS:
+        layout.prefix.insert(layout.prefix.begin(), BOS);
+        break;
+      case UNK_PIECE:
+        layout.unk_piece = true;
         break;
-      case EOS: {
-        auto *piece = spt->add_pieces();
-        piece->set_id(PieceToId(absl::string_view(model_->eos_piece().data())));
-        piece->set_piece(model_->eos_piece().data(),
-                         model_->eos_piece().size());
-        piece->set_begin(spt->text().size());
-        piece->set_end(spt->text().size());
-      } break;
-      case BOS: {
-        auto *array = spt->mutable_pieces();
-        array->Add();
-        for (int i = array->size() - 1; i > 0; --i) {
-          array->SwapElements(i - 1, i);
-        }
-        auto *piece = array->Mutable(0);
-        piece->set_id(PieceToId(absl::string_view(model_->bos_piece().data())));
-        piece->set_piece(model_->bos_piece().data(),
-                         model_->bos_piece().size());
-        piece->set_begin(0);
-        piece->set_end(0);
-      } break;
-      case UNK_PIECE: {
-        for (int i = 0; i < spt->pieces_size(); ++i) {
-          auto *piece = spt->mutable_pieces(i);
-          if (IsUnknown(piece->id())) {
-            piece->set_piece(model_->unk_piece().data(),
-                             model_->unk_piece().size());
-          }
-        }
-      } break;
-      default:
-        return util::InternalError("unknown extra_option type.");
     }
   }
+  return layout;
+}
 
-  return util::OkStatus();
+std::pair<absl::string_view, int> SentencePieceProcessor::GetControlPiece(
+    ExtraOption option) const {
+  const absl::string_view piece =
+      option == BOS ? model_->bos_piece() : model_->eos_piece();
+  return std::make_pair(piece, PieceToId(piece));
 }
 
 // static
@@ -1102,11 +3106,17 @@ util::Status SentencePieceProcessor::ParseExtraOptions(
 
 void SentencePieceProcessor::SetModel(std::unique_ptr<ModelInterface> &&model) {
   model_ = std::move(model);
+  builtin_model_ = false;
+  // Decode() of ids goes through the SentencePieceText with the new model.
+  decode_surfaces_.reset();
+  vocabulary_mask_.reset();
+  ClearResultCache();
 }
 
 void SentencePieceProcessor::SetNormalizer(
     std::unique_ptr<normalizer::Normalizer> &&normalizer) {
   normalizer_ = std::move(normalizer);
+  ClearResultCache();
 }
 
 const ModelProto &SentencePieceProcessor::model_proto() const {
@@ -1121,6 +3131,695 @@ NormalizerSpec *SentencePieceProcessor::mutable_normalizer_spec() const {
   return model_proto_ ? model_proto_->mutable_normalizer_spec() : nullptr;
 }
 
+namespace {
+// Segments longer than this are cut at the last whitespace before, so that
+// a large chunk is not normalized at once.
+constexpr size_t kMaxStreamingSegmentSize = 1 << 16;
+}  // namespace
+
+StreamingEncoder::StreamingEncoder(const SentencePieceProcessor &sp)
+    : sp_(sp) {
+  if (!sp_.status().ok()) return;
+  const auto &extra_options = sp_.encode_extra_options_;
+  streaming_ = sp_.CanCutAtWhitespace() &&
+               std::find(extra_options.begin(), extra_options.end(),
+                         SentencePieceProcessor::REVERSE) ==
+                   extra_options.end();
+}
+
+StreamingEncoder::~StreamingEncoder() {}
+
+util::Status StreamingEncoder::Feed(absl::string_view chunk,
+                                    std::vector<std::string> *pieces) {
+  CHECK_OR_RETURN(pieces) << "output container is null";
+  SentencePieceText spt;
+  RETURN_IF_ERROR(Feed(chunk, &spt));
+  for (const auto &sp : spt.pieces()) pieces->emplace_back(sp.piece());
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::Feed(absl::string_view chunk,
+                                    std::vector<int> *ids) {
+  CHECK_OR_RETURN(ids) << "output container is null";
+  SentencePieceText spt;
+  RETURN_IF_ERROR(Feed(chunk, &spt));
+  for (const auto &sp : spt.pieces()) ids->emplace_back(sp.id());
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::Finish(std::vector<std::string> *pieces) {
+  CHECK_OR_RETURN(pieces) << "output container is null";
+  SentencePieceText spt;
+  RETURN_IF_ERROR(Finish(&spt));
+  for (const auto &sp : spt.pieces()) pieces->emplace_back(sp.piece());
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::Finish(std::vector<int> *ids) {
+  CHECK_OR_RETURN(ids) << "output container is null";
+  SentencePieceText spt;
+  RETURN_IF_ERROR(Finish(&spt));
+  for (const auto &sp : spt.pieces()) ids->emplace_back(sp.id());
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::Feed(absl::string_view chunk,
+                                    SentencePieceText *spt) {
+  RETURN_IF_ERROR(sp_.status());
+  buffer_.append(chunk.data(), chunk.size());
+  if (!streaming_) return util::OkStatus();
+
+  size_t begin = 0;
+  size_t cut = 0;
+  for (size_t pos = std::max<size_t>(scanned_, 1); pos < buffer_.size();
+       ++pos) {
+    if (!IsCut(pos)) continue;
+    if (cut > begin && pos - begin > kMaxStreamingSegmentSize) {
+      RETURN_IF_ERROR(EncodeSegment(begin, cut, false, spt));
+      begin = cut;
+    }
+    cut = pos;
+  }
+  if (cut > begin) {
+    RETURN_IF_ERROR(EncodeSegment(begin, cut, false, spt));
+    begin = cut;
+  }
+
+  buffer_.erase(0, begin);
+  scanned_ = buffer_.size();
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::Finish(SentencePieceText *spt) {
+  RETURN_IF_ERROR(sp_.status());
+  RETURN_IF_ERROR(EncodeSegment(0, buffer_.size(), true, spt));
+  buffer_.clear();
+  scanned_ = 0;
+  is_first_ = true;
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::EncodeSegment(size_t begin, size_t end,
+                                             bool is_last,
+                                             SentencePieceText *spt) {
+  const absl::string_view input =
+      absl::string_view(buffer_).substr(begin, end - begin);
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  RETURN_IF_ERROR(sp_.NormalizeInput(input, &normalized, &norm_to_orig));
+
+  // BOS and EOS only surround the whole document.
+  std::vector<SentencePieceProcessor::ExtraOption> extra_options;
+  for (const auto option : sp_.encode_extra_options_) {
+    if ((option == SentencePieceProcessor::BOS && !is_first_) ||
+        (option == SentencePieceProcessor::EOS && !is_last)) {
+      continue;
+    }
+    extra_options.push_back(option);
+  }
+
+  SentencePieceText segment;
+  const ScopedVocabularyMask mask(sp_.vocabulary_mask_.get());
+  const auto result = sp_.model_->Encode(normalized);
+  RETURN_IF_ERROR(CancellationStatus());
+  RETURN_IF_ERROR(sp_.PopulateSentencePieceText(
+      input, normalized, norm_to_orig, result,
+      SentencePieceProcessor::GetExtraOptionLayout(extra_options), &segment));
+  spt->mutable_pieces()->MergeFrom(segment.pieces());
+  is_first_ = false;
+  return util::OkStatus();
+}
+
+bool StreamingEncoder::IsCut(size_t pos) const {
+  return IsWhitespaceCut(buffer_, pos);
+}
+
+PrefixEncoder::PrefixEncoder(const SentencePieceProcessor &sp)
+    : sp_(sp), state_(std::make_unique<StreamingEncoder>(sp)) {}
+
+PrefixEncoder::~PrefixEncoder() {}
+
+util::Status PrefixEncoder::SetPrefix(absl::string_view prefix) {
+  RETURN_IF_ERROR(sp_.status());
+  auto state = std::make_unique<StreamingEncoder>(sp_);
+  SentencePieceText spt;
+  RETURN_IF_ERROR(state->Feed(prefix, &spt));
+  state_ = std::move(state);
+  prefix_pieces_.clear();
+  prefix_ids_.clear();
+  for (const auto &sp : spt.pieces()) {
+    prefix_pieces_.emplace_back(sp.piece());
+    prefix_ids_.push_back(sp.id());
+  }
+  return util::OkStatus();
+}
+
+util::Status PrefixEncoder::Encode(absl::string_view suffix,
+                                   std::vector<std::string> *pieces) const {
+  CHECK_OR_RETURN(pieces) << "output container is null";
+  StreamingEncoder encoder(*state_);
+  *pieces = prefix_pieces_;
+  RETURN_IF_ERROR(encoder.Feed(suffix, pieces));
+  return encoder.Finish(pieces);
+}
+
+util::Status PrefixEncoder::Encode(absl::string_view suffix,
+                                   std::vector<int> *ids) const {
+  CHECK_OR_RETURN(ids) << "output container is null";
+  StreamingEncoder encoder(*state_);
+  *ids = prefix_ids_;
+  RETURN_IF_ERROR(encoder.Feed(suffix, ids));
+  return encoder.Finish(ids);
+}
+
+MultiModelEncoder::MultiModelEncoder() {}
+MultiModelEncoder::~MultiModelEncoder() {}
+
+util::Status MultiModelEncoder::Init(
+    const std::vector<const SentencePieceProcessor *> &processors) {
+  CHECK_OR_RETURN(!processors.empty()) << "no processor is given";
+  for (const auto *sp : processors) {
+    CHECK_OR_RETURN(sp) << "processor is null";
+    RETURN_IF_ERROR(sp->status());
+  }
+
+  // The normalizer depends on the normalizer spec, the whitespace options
+  // and the user defined symbols, which it keeps as they are.
+  auto user_defined_symbols = [](const ModelProto &proto) {
+    std::vector<std::string> symbols;
+    for (const auto &piece : proto.pieces()) {
+      if (piece.type() == ModelProto::SentencePiece::USER_DEFINED) {
+        symbols.push_back(piece.piece());
+      }
+    }
+    std::sort(symbols.begin(), symbols.end());
+    return symbols;
+  };
+  auto same_normalizer = [&](const SentencePieceProcessor &a,
+                             const SentencePieceProcessor &b) {
+    if (a.normalizer_ == b.normalizer_) return true;
+    const auto &proto_a = a.model_->model_proto();
+    const auto &proto_b = b.model_->model_proto();
+    const auto &spec_a = proto_a.normalizer_spec();
+    const auto &spec_b = proto_b.normalizer_spec();
+    return spec_a.precompiled_charsmap() == spec_b.precompiled_charsmap() &&
+           spec_a.add_dummy_prefix() == spec_b.add_dummy_prefix() &&
+           spec_a.remove_extra_whitespaces() ==
+               spec_b.remove_extra_whitespaces() &&
+           spec_a.escape_whitespaces() == spec_b.escape_whitespaces() &&
+           proto_a.trainer_spec().treat_whitespace_as_suffix() ==
+               proto_b.trainer_spec().treat_whitespace_as_suffix() &&
+           user_defined_symbols(proto_a) == user_defined_symbols(proto_b);
+  };
+  for (size_t i = 1; i < processors.size(); ++i) {
+    CHECK_OR_RETURN(
+        processors[0]->input_normalized_ == processors[i]->input_normalized_ &&
+        same_normalizer(*processors[0], *processors[i]))
+        << "the normalizer of processor " << i
+        << " differs from that of processor 0";
+  }
+
+  processors_ = processors;
+  return util::OkStatus();
+}
+
+util::Status MultiModelEncoder::Encode(
+    absl::string_view input, std::vector<std::vector<int>> *ids) const {
+  CHECK_OR_RETURN(ids) << "output container is null";
+  CHECK_OR_RETURN(!processors_.empty()) << "Init() is not called";
+  ids->resize(processors_.size());
+
+  absl::string_view normalized;
+  std::string buffer;
+  RETURN_IF_ERROR(
+      processors_[0]->NormalizeInput(input, &normalized, &buffer, nullptr));
+  for (size_t i = 0; i < processors_.size(); ++i) {
+    const auto &sp = *processors_[i];
+    auto *output = &(*ids)[i];
+    output->clear();
+    if (sp.max_tokens_ > 0 || sp.max_input_bytes_ > 0) {
+      RETURN_IF_ERROR(sp.Encode(input, output));
+      continue;
+    }
+    const ScopedVocabularyMask mask(sp.vocabulary_mask_.get());
+    const auto result = sp.model_->Encode(normalized);
+    RETURN_IF_ERROR(CancellationStatus());
+    CountEncode(*sp.model_, input, normalized, result);
+    RETURN_IF_ERROR(sp.AppendResultIds(normalized, result, output));
+  }
+  return util::OkStatus();
+}
+
+util::Status MultiModelEncoder::Encode(
+    absl::string_view input, std::vector<SentencePieceText> *spts) const {
+  CHECK_OR_RETURN(spts) << "output container is null";
+  CHECK_OR_RETURN(!processors_.empty()) << "Init() is not called";
+  spts->resize(processors_.size());
+
+  absl::string_view normalized;
+  std::string buffer;
+  std::vector<size_t> norm_to_orig;
+  RETURN_IF_ERROR(processors_[0]->NormalizeInput(input, &normalized, &buffer,
+                                                 &norm_to_orig));
+  for (size_t i = 0; i < processors_.size(); ++i) {
+    const auto &sp = *processors_[i];
+    auto *spt = &(*spts)[i];
+    spt->Clear();
+    if (sp.max_tokens_ > 0 || sp.max_input_bytes_ > 0) {
+      RETURN_IF_ERROR(sp.Encode(input, spt));
+      continue;
+    }
+    const ScopedVocabularyMask mask(sp.vocabulary_mask_.get());
+    const auto result = sp.model_->Encode(normalized);
+    RETURN_IF_ERROR(CancellationStatus());
+    CountEncode(*sp.model_, input, normalized, result);
+    RETURN_IF_ERROR(sp.PopulateSentencePieceText(input, normalized,
+                                                 norm_to_orig, result, spt));
+  }
+  return util::OkStatus();
+}
+
+IncrementalEncoder::IncrementalEncoder(const SentencePieceProcessor &sp)
+    : sp_(sp) {
+  if (!sp_.status().ok()) return;
+  incremental_ = sp_.CanCutAtWhitespace();
+}
+
+IncrementalEncoder::~IncrementalEncoder() {}
+
+util::Status IncrementalEncoder::Reset(absl::string_view text) {
+  RETURN_IF_ERROR(sp_.status());
+  text_.assign(text.data(), text.size());
+  ids_.clear();
+  begins_.clear();
+  ends_.clear();
+  encoded_size_ = text_.size();
+  return EncodeWindow(0, text_.size(), &ids_, &begins_, &ends_);
+}
+
+util::Status IncrementalEncoder::Replace(size_t begin, size_t end,
+                                         absl::string_view replacement) {
+  RETURN_IF_ERROR(sp_.status());
+  CHECK_LE_OR_RETURN(begin, end);
+  CHECK_LE_OR_RETURN(end, text_.size());
+  if (!incremental_) {
+    std::string text = text_;
+    text.replace(begin, end - begin, replacement.data(), replacement.size());
+    return Reset(text);
+  }
+
+  // The window [window_begin, window_end) of the old document starts and
+  // ends at whitespace cuts outside of the edit, so that the text before and
+  // after it is segmented as before, and no piece crosses its ends.
+  auto first_piece_at = [this](size_t pos) {
+    return std::lower_bound(begins_.begin(), begins_.end(), pos) -
+           begins_.begin();
+  };
+  auto crosses = [this, &first_piece_at](size_t pos) {
+    const size_t i = first_piece_at(pos);
+    return i > 0 && ends_[i - 1] > pos;
+  };
+  size_t window_begin = begin;
+  do {
+    window_begin = window_begin == 0 ? 0 : window_begin - 1;
+    while (window_begin > 0 && !IsWhitespaceCut(text_, window_begin)) {
+      --window_begin;
+    }
+  } while (window_begin > 0 && crosses(window_begin));
+  size_t window_end = end;
+  do {
+    ++window_end;
+    while (window_end < text_.size() && !IsWhitespaceCut(text_, window_end)) {
+      ++window_end;
+    }
+    window_end = std::min(window_end, text_.size());
+  } while (window_end < text_.size() && crosses(window_end));
+
+  const size_t first = first_piece_at(window_begin);
+  const size_t last =
+      window_end == text_.size() ? ids_.size() : first_piece_at(window_end);
+  text_.replace(begin, end - begin, replacement.data(), replacement.size());
+  const size_t new_window_end = window_end - end + begin + replacement.size();
+  encoded_size_ = new_window_end - window_begin;
+
+  std::vector<int> ids;
+  std::vector<uint32_t> begins, ends;
+  RETURN_IF_ERROR(
+      EncodeWindow(window_begin, new_window_end, &ids, &begins, &ends));
+
+  // Shifts the pieces after the window, and splices the window in.
+  for (size_t i = last; i < ids_.size(); ++i) {
+    begins_[i] = begins_[i] - window_end + new_window_end;
+    ends_[i] = ends_[i] - window_end + new_window_end;
+  }
+  ids_.erase(ids_.begin() + first, ids_.begin() + last);
+  begins_.erase(begins_.begin() + first, begins_.begin() + last);
+  ends_.erase(ends_.begin() + first, ends_.begin() + last);
+  ids_.insert(ids_.begin() + first, ids.begin(), ids.end());
+  begins_.insert(begins_.begin() + first, begins.begin(), begins.end());
+  ends_.insert(ends_.begin() + first, ends.begin(), ends.end());
+  MergeUnknown(first + ids.size());
+  MergeUnknown(first);
+  return util::OkStatus();
+}
+
+util::Status IncrementalEncoder::EncodeWindow(
+    size_t begin, size_t end, std::vector<int> *ids,
+    std::vector<uint32_t> *begins, std::vector<uint32_t> *ends) const {
+  const absl::string_view input =
+      absl::string_view(text_).substr(begin, end - begin);
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  RETURN_IF_ERROR(sp_.NormalizeInput(input, &normalized, &norm_to_orig));
+  if (begin > 0) {
+    // The whole document aligns the first whitespace to the cut, not to the
+    // word after it as the dummy prefix of the window.
+    const size_t size = std::min(strlen(kSpaceSymbol), norm_to_orig.size());
+    std::fill(norm_to_orig.begin(), norm_to_orig.begin() + size, 0);
+  }
+
+  SentencePieceText spt;
+  const ScopedVocabularyMask mask(sp_.vocabulary_mask_.get());
+  const auto result = sp_.model_->Encode(normalized);
+  RETURN_IF_ERROR(CancellationStatus());
+  RETURN_IF_ERROR(sp_.PopulateSentencePieceText(
+      input, normalized, norm_to_orig, result,
+      SentencePieceProcessor::ExtraOptionLayout(), &spt));
+  for (const auto &piece : spt.pieces()) {
+    ids->push_back(piece.id());
+    begins->push_back(begin + piece.begin());
+    ends->push_back(begin + piece.end());
+  }
+  return util::OkStatus();
+}
+
+void IncrementalEncoder::MergeUnknown(size_t pos) {
+  if (pos == 0 || pos >= ids_.size() || sp_.model_->ByteFallbackEnabled() ||
+      !sp_.IsUnknown(ids_[pos - 1]) || !sp_.IsUnknown(ids_[pos])) {
+    return;
+  }
+  ends_[pos - 1] = ends_[pos];
+  ids_.erase(ids_.begin() + pos);
+  begins_.erase(begins_.begin() + pos);
+  ends_.erase(ends_.begin() + pos);
+}
+
+namespace {
+// Returns true if `bytes` is a proper prefix of a valid UTF-8 character,
+// which the following bytes may complete.
+bool IsIncompleteUTF8(absl::string_view bytes) {
+  if (bytes.empty()) return false;
+  const unsigned char lead = bytes[0];
+  size_t size = 0;
+  char32 min_cp = 0;
+  if ((lead & 0xE0) == 0xC0) {
+    size = 2;
+    min_cp = 0x0080;
+  } else if ((lead & 0xF0) == 0xE0) {
+    size = 3;
+    min_cp = 0x0800;
+  } else if ((lead & 0xF8) == 0xF0) {
+    size = 4;
+    min_cp = 0x10000;
+  } else {
+    return false;
+  }
+  if (bytes.size() >= size) return false;
+
+  // The range of the codepoints starting with `bytes`.
+  char32 lo = lead & (0x7F >> size);
+  for (size_t i = 1; i < bytes.size(); ++i) {
+    if (!string_util::IsTrailByte(bytes[i])) return false;
+    lo = (lo << 6) | (bytes[i] & 0x3F);
+  }
+  const int rest = 6 * (size - bytes.size());
+  lo <<= rest;
+  const char32 hi = lo | ((1 << rest) - 1);
+
+  // The same codepoints as string_util::DecodeUTF8() accepts.
+  const char32 begin = std::max(lo, min_cp);
+  const char32 end = std::min<char32>(hi, 0x10FFFF);
+  return begin <= end && !(begin >= 0xD800 && end <= 0xDFFF);
+}
+}  // namespace
+
+StreamingDecoder::StreamingDecoder(const SentencePieceProcessor &sp)
+    : sp_(sp) {
+  const auto &extra_options = sp_.decode_extra_options_;
+  streaming_ = sp_.status().ok() && sp_.decode_surfaces_ &&
+               !sp_.denormalizer_ &&
+               std::find(extra_options.begin(), extra_options.end(),
+                         SentencePieceProcessor::REVERSE) ==
+                   extra_options.end();
+}
+
+StreamingDecoder::~StreamingDecoder() {}
+
+util::Status StreamingDecoder::Feed(int id, std::string *text) {
+  CHECK_OR_RETURN(text) << "output container is null";
+  if (!streaming_) {
+    ids_.push_back(id);
+    return util::OkStatus();
+  }
+  RETURN_IF_ERROR(Append(id, text));
+  return ProcessBytes(false, text);
+}
+
+util::Status StreamingDecoder::Feed(const std::vector<int> &ids,
+                                    std::string *text) {
+  for (const int id : ids) RETURN_IF_ERROR(Feed(id, text));
+  return util::OkStatus();
+}
+
+util::Status StreamingDecoder::Finish(std::string *text) {
+  CHECK_OR_RETURN(text) << "output container is null";
+  util::Status status;
+  if (streaming_) {
+    status = ProcessBytes(true, text);
+  } else {
+    std::string decoded;
+    status = sp_.Decode(ids_, &decoded);
+    text->append(decoded);
+  }
+  ids_.clear();
+  bytes_.clear();
+  is_bos_ws_ = true;
+  bos_ws_seen_ = false;
+  has_text_ = false;
+  return status;
+}
+
+util::Status StreamingDecoder::Append(int id, std::string *text) {
+  const auto &surfaces = *sp_.decode_surfaces_;
+  if (id < 0 || id >= static_cast<int>(surfaces.size())) {
+    return util::Status(util::StatusCode::kOutOfRange,
+                        absl::StrCat("Invalid id: ", id));
+  }
+  const auto &entry = surfaces[id];
+  if (entry.type == SentencePieceProcessor::DecodeSurface::BYTE) {
+    bytes_.push_back(entry.byte);
+    return util::OkStatus();
+  }
+  RETURN_IF_ERROR(ProcessBytes(true, text));
+
+  // if we have seen a bos_ws token or any non-empty token
+  if (bos_ws_seen_ || has_text_) is_bos_ws_ = false;
+
+  const auto *model_proto = sp_.model_proto_.get();
+  const bool remove_extra_whitespaces =
+      model_proto && model_proto->normalizer_spec().remove_extra_whitespaces();
+  const bool strip_bos_ws =
+      !model_proto || model_proto->normalizer_spec().add_dummy_prefix() ||
+      remove_extra_whitespaces;
+
+  bos_ws_seen_ = false;
+  absl::string_view surface = entry.surface;
+  if (entry.type == SentencePieceProcessor::DecodeSurface::NORMAL &&
+      is_bos_ws_ && strip_bos_ws && entry.has_space_prefix) {
+    surface.remove_prefix(1);
+    // if we are removing extra whitespace, we remove all leading whitespace
+    bos_ws_seen_ = !remove_extra_whitespaces;
+  }
+  text->append(surface.data(), surface.size());
+  has_text_ |= !surface.empty();
+  return util::OkStatus();
+}
+
+util::Status StreamingDecoder::ProcessBytes(bool is_last, std::string *text) {
+  absl::string_view rest(bytes_);
+  while (!rest.empty()) {
+    if (!is_last && IsIncompleteUTF8(rest)) break;
+    size_t consumed;
+    if (string_util::IsValidDecodeUTF8(rest, &consumed)) {
+      text->append(rest.data(), consumed);
+    } else {
+      // Maps a structurally invalid byte to REPLACEMENT CHARACTER (U+FFFD).
+      CHECK_EQ_OR_RETURN(consumed, 1);
+      text->append(kReplacementCharacter);
+    }
+    has_text_ = true;
+    rest.remove_prefix(consumed);
+  }
+  bytes_.erase(0, bytes_.size() - rest.size());
+  return util::OkStatus();
+}
+
+namespace {
+// Generations of ReloadableSentencePieceProcessor. Unique over all the
+// instances, so that a thread caches the snapshot of one generation only.
+uint64_t NextSnapshotGeneration() {
+  static std::atomic<uint64_t> generation(0);
+  return generation.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+// The snapshot the calling thread last got from Get().
+struct CachedSnapshot {
+  uint64_t generation = 0;
+  std::shared_ptr<const std::vector<std::shared_ptr<const SentencePieceProcessor>>>
+      replicas;
+};
+
+CachedSnapshot &GetThreadLocalSnapshot() {
+  thread_local CachedSnapshot cached;
+  return cached;
+}
+
+// NUMA topology read from sysfs once: the CPUs of every node with CPUs, and
+// the index of that node in `node_cpus` for every CPU.
+struct NumaTopology {
+  std::vector<std::vector<int>> node_cpus;
+  std::vector<int> cpu_to_node;
+};
+
+const NumaTopology &GetNumaTopology() {
+  static const NumaTopology *topology = []() {
+    auto *topology = new NumaTopology;
+#if defined(__linux__)
+    // Node ids may have gaps, so a few are probed past the last one found.
+    for (int node = 0, misses = 0; misses < 8; ++node) {
+      auto input = filesystem::NewReadableFile(
+          absl::StrCat("/sys/devices/system/node/node", node) + "/cpulist");
+      std::string list;
+      if (!input->status().ok() || !input->ReadAll(&list)) {
+        ++misses;
+        continue;
+      }
+      misses = 0;
+      std::vector<int> cpus;
+      // A node with memory only has no CPUs.
+      if (!ParseCpuList(list, &cpus) || cpus.empty()) continue;
+      for (const int cpu : cpus) {
+        if (cpu >= topology->cpu_to_node.size()) {
+          topology->cpu_to_node.resize(cpu + 1, 0);
+        }
+        topology->cpu_to_node[cpu] = topology->node_cpus.size();
+      }
+      topology->node_cpus.push_back(std::move(cpus));
+    }
+#endif
+    return topology;
+  }();
+  return *topology;
+}
+
+// Returns the index of the NUMA node the calling thread runs on.
+int GetCurrentNumaNode() {
+#if defined(__linux__)
+  const auto &cpu_to_node = GetNumaTopology().cpu_to_node;
+  const int cpu = sched_getcpu();
+  if (cpu >= 0 && cpu < cpu_to_node.size()) return cpu_to_node[cpu];
+#endif
+  return 0;
+}
+
+// Runs `func` on a thread bound to `cpus`.
+void RunOnCpus(const std::vector<int> &cpus, const std::function<void()> &func) {
+  std::thread thread([&cpus, &func]() {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+      if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    // Loads the replica anyway if the CPUs are not allowed.
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+    func();
+  });
+  thread.join();
+}
+}  // namespace
+
+ReloadableSentencePieceProcessor::ReloadableSentencePieceProcessor()
+    : generation_(NextSnapshotGeneration()),
+      snapshot_(std::make_shared<Replicas>(
+          1, std::make_shared<SentencePieceProcessor>())) {}
+
+ReloadableSentencePieceProcessor::~ReloadableSentencePieceProcessor() {}
+
+util::Status ReloadableSentencePieceProcessor::Load(
+    absl::string_view filename) {
+  const auto &node_cpus = GetNumaTopology().node_cpus;
+  if (!replicate_ || node_cpus.size() <= 1) {
+    auto processor = std::make_shared<SentencePieceProcessor>();
+    RETURN_IF_ERROR(processor->Load(filename));
+    return Publish(std::move(processor));
+  }
+
+  auto replicas = std::make_shared<Replicas>();
+  for (const auto &cpus : node_cpus) {
+    auto processor = std::make_shared<SentencePieceProcessor>();
+    processor->SetUseHugePages(true);
+    util::Status status;
+    // The memory of the replica is first touched, hence allocated, on the
+    // node.
+    RunOnCpus(cpus, [&]() { status = processor->Load(filename); });
+    RETURN_IF_ERROR(status);
+    replicas->push_back(std::move(processor));
+  }
+  PublishReplicas(std::move(replicas));
+  return util::OkStatus();
+}
+
+util::Status ReloadableSentencePieceProcessor::Publish(
+    std::shared_ptr<const SentencePieceProcessor> processor) {
+  CHECK_OR_RETURN(processor) << "processor must not be null.";
+  PublishReplicas(std::make_shared<Replicas>(1, std::move(processor)));
+  return util::OkStatus();
+}
+
+void ReloadableSentencePieceProcessor::PublishReplicas(
+    std::shared_ptr<const Replicas> replicas) {
+  std::shared_ptr<const Replicas> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old = std::move(snapshot_);
+    snapshot_ = std::move(replicas);
+    generation_.store(NextSnapshotGeneration(), std::memory_order_release);
+  }
+  // `old` is released out of the lock.
+}
+
+std::shared_ptr<const SentencePieceProcessor>
+ReloadableSentencePieceProcessor::Get() const {
+  auto &cached = GetThreadLocalSnapshot();
+  if (cached.generation != generation_.load(std::memory_order_acquire)) {
+    // The previous snapshot is released out of the lock.
+    const auto previous = std::move(cached.replicas);
+    std::lock_guard<std::mutex> lock(mutex_);
+    cached.replicas = snapshot_;
+    cached.generation = generation_.load(std::memory_order_relaxed);
+  }
+  const auto &replicas = *cached.replicas;
+  if (replicas.size() == 1) return replicas[0];
+  return replicas[GetCurrentNumaNode() % replicas.size()];
+}
+
+size_t ReloadableSentencePieceProcessor::num_replicas() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return snapshot_->size();
+}
+
 // Set seed value of random generator.
 // Do not set static_cast<unique_int>(-1),
 // as this seed is reserved for initializing from
@@ -15,8 +15,14 @@
 #ifndef SENTENCEPIECE_PROCESSOR_H_
 #define SENTENCEPIECE_PROCESSOR_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -28,6 +34,12 @@ using std::string_view;
 }  // namespace absl
 #endif  // SWIG
 
+namespace google {
+namespace protobuf {
+class Arena;
+}  // namespace protobuf
+}  // namespace google
+
 namespace sentencepiece {
 namespace util {
 
@@ -131,10 +143,13 @@ class Status {
 //
 
 class NBestSentencePieceText;
+class CompiledModel;
 class ModelInterface;
+class PieceTypes;
 class SentencePieceText;
 class ModelProto;
 class NormalizerSpec;
+class ResultCache;
 
 namespace normalizer {
 class Normalizer;
@@ -182,6 +197,12 @@ class ImmutableSentencePieceText {
   ImmutableSentencePieceText();
   virtual ~ImmutableSentencePieceText();
 
+  // Allocates the proto, its pieces and their strings on `arena` instead of
+  // one by one on the heap. The arena is kept alive by this object and its
+  // copies.
+  explicit ImmutableSentencePieceText(
+      std::shared_ptr<google::protobuf::Arena> arena);
+
   std::vector<ImmutableSentencePieceText_ImmutableSentencePiece> pieces() const;
 
   size_t pieces_size() const;
@@ -217,6 +238,10 @@ class ImmutableNBestSentencePieceText {
   ImmutableNBestSentencePieceText();
   virtual ~ImmutableNBestSentencePieceText();
 
+  // Allocates the proto on `arena`, as ImmutableSentencePieceText does.
+  explicit ImmutableNBestSentencePieceText(
+      std::shared_ptr<google::protobuf::Arena> arena);
+
   std::vector<ImmutableSentencePieceText> nbests() const;
 
   size_t nbests_size() const;
@@ -235,6 +260,323 @@ class ImmutableNBestSentencePieceText {
   std::shared_ptr<NBestSentencePieceText> rep_;
 };
 
+// Encoded inputs of SentencePieceProcessor::EncodeBatch() in a few flat
+// arrays instead of a vector per input (CSR style). The ids of the i-th input
+// are ids()[offsets()[i], offsets()[i + 1]). The piece and alignment arrays
+// are parallel to ids() and only filled when requested. Reusing a result for
+// the next batch keeps the capacity of the arrays, so a steady stream of
+// batches stops allocating.
+class BatchEncodeResult {
+ public:
+  BatchEncodeResult();
+  virtual ~BatchEncodeResult();
+
+  // Number of inputs.
+  size_t size() const { return offsets_.empty() ? 0 : offsets_.size() - 1; }
+
+  // Ids of all the inputs, and where every input starts in them.
+  // `offsets` has size() + 1 elements.
+  const std::vector<int> &ids() const { return ids_; }
+  const std::vector<size_t> &offsets() const { return offsets_; }
+
+  // Pieces of all the ids concatenated. The j-th piece is
+  // pieces()[piece_offsets()[j], piece_offsets()[j + 1]).
+  const std::string &pieces() const { return pieces_; }
+  const std::vector<size_t> &piece_offsets() const { return piece_offsets_; }
+  absl::string_view piece(size_t j) const;
+
+  // Byte offsets (or character offsets with `unicode_offsets`) of the
+  // surface of every id in its input, as SentencePieceText::begin() and end().
+  const std::vector<uint32_t> &begins() const { return begins_; }
+  const std::vector<uint32_t> &ends() const { return ends_; }
+
+  void Clear();
+
+ private:
+  friend class SentencePieceProcessor;
+
+  // Output of a range of inputs encoded by one thread.
+  struct Chunk {
+    std::vector<int> ids;
+    std::vector<size_t> sizes;  // Number of ids of every input.
+    std::string pieces;
+    std::vector<size_t> piece_sizes;
+    std::vector<uint32_t> begins;
+    std::vector<uint32_t> ends;
+    void Clear();
+  };
+
+  std::vector<int> ids_;
+  std::vector<size_t> offsets_;
+  std::string pieces_;
+  std::vector<size_t> piece_offsets_;
+  std::vector<uint32_t> begins_;
+  std::vector<uint32_t> ends_;
+  // Kept across the calls for their capacity.
+  std::vector<Chunk> chunks_;
+};
+
+// Sampled segmentations of SentencePieceProcessor::SampleEncodeAndScoreBatch()
+// in flat arrays, as BatchEncodeResult. The samples of the i-th input are
+// [sample_offsets()[i], sample_offsets()[i + 1]), and the j-th sample is
+// ids()[id_offsets()[j], id_offsets()[j + 1]) with the score scores()[j].
+class BatchSampleResult {
+ public:
+  // Number of inputs.
+  size_t size() const {
+    return sample_offsets_.empty() ? 0 : sample_offsets_.size() - 1;
+  }
+
+  const std::vector<int> &ids() const { return ids_; }
+  const std::vector<size_t> &id_offsets() const { return id_offsets_; }
+  const std::vector<float> &scores() const { return scores_; }
+  const std::vector<size_t> &sample_offsets() const { return sample_offsets_; }
+
+  void Clear();
+
+ private:
+  friend class SentencePieceProcessor;
+
+  std::vector<int> ids_;
+  std::vector<size_t> id_offsets_;
+  std::vector<float> scores_;
+  std::vector<size_t> sample_offsets_;
+};
+
+class SentencePieceProcessor;
+
+// Hypotheses of SentencePieceProcessor::NBestEncode() and
+// SampleEncodeAndScore() sharing one copy of the input, of its normalized
+// text and of the alignment between them. A hypothesis only keeps the ids
+// and the lengths of its pieces in the normalized text, and its
+// SentencePieceText, with the pieces and the surfaces, is built on request.
+// The processor must outlive the result.
+class NBestResult {
+ public:
+  NBestResult();
+  virtual ~NBestResult();
+
+  // Number of hypotheses.
+  size_t size() const { return scores_.size(); }
+
+  // The input shared by the hypotheses.
+  const std::string &text() const { return text_; }
+
+  float score(size_t i) const { return scores_[i]; }
+
+  // Builds the SentencePieceText of the i-th hypothesis, or the
+  // NBestSentencePieceText of all of them, as NBestEncode() outputs them.
+  util::Status ToProto(size_t i, SentencePieceText *spt) const;
+  util::Status ToProto(NBestSentencePieceText *nbest_spt) const;
+
+  void Clear();
+
+ private:
+  friend class SentencePieceProcessor;
+
+  // Adds the hypothesis `pieces` of normalized_ with `score`.
+  void Add(const std::vector<std::pair<absl::string_view, int>> &pieces,
+           float score);
+
+  const SentencePieceProcessor *processor_ = nullptr;
+  std::string text_;
+  std::string normalized_;
+  std::vector<size_t> norm_to_orig_;
+  // (bytes in normalized_, id) of the pieces of all the hypotheses. Those
+  // of the i-th are [offsets_[i], offsets_[i + 1]).
+  std::vector<std::pair<uint32_t, int>> pieces_;
+  std::vector<size_t> offsets_;
+  std::vector<float> scores_;
+};
+
+// Random generator of the sampling encoders owned by the caller, e.g., one
+// per request, so that a sample only depends on its seed and on the samples
+// drawn before with it. The i-th number is a SplitMix64 hash of the seed and
+// i, so the state is 16 bytes, cheap to create and to copy, and the encoders
+// draw from it without looking up the generator of the thread. It must not
+// be used by concurrent calls.
+class SampleGenerator {
+ public:
+  using result_type = uint64_t;
+
+  explicit SampleGenerator(uint64_t seed) : key_(seed) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~result_type(0); }
+
+  result_type operator()();
+
+ private:
+  uint64_t key_ = 0;
+  uint64_t counter_ = 0;
+};
+
+// All the pieces of a model with their scores and types in flat arrays, as
+// SentencePieceProcessor::GetVocabularyTable() returns them. The piece of id
+// i is pieces()[piece_offsets()[i], piece_offsets()[i + 1]).
+class VocabularyTable {
+ public:
+  VocabularyTable();
+  virtual ~VocabularyTable();
+
+  // Number of pieces.
+  size_t size() const { return scores_.size(); }
+
+  const std::string &pieces() const { return pieces_; }
+  const std::vector<size_t> &piece_offsets() const { return piece_offsets_; }
+  absl::string_view piece(size_t i) const;
+
+  const std::vector<float> &scores() const { return scores_; }
+
+  // ModelProto::SentencePiece::Type of every piece, e.g., 1 for NORMAL and
+  // 3 for CONTROL.
+  const std::vector<uint8_t> &types() const { return types_; }
+
+  void Clear();
+
+ private:
+  friend class SentencePieceProcessor;
+
+  std::string pieces_;
+  std::vector<size_t> piece_offsets_;
+  std::vector<float> scores_;
+  std::vector<uint8_t> types_;
+};
+
+// Counters of the encoders of all the processors of the process, summed
+// over the threads. Only collected when the library is built with
+// -DSPM_ENABLE_ENCODE_STATS=ON, which adds a few instructions to every
+// encode; all zero otherwise. The sampling and n-best encoders are not
+// counted.
+struct EncodeStats {
+  int64_t calls = 0;             // Encoded inputs.
+  int64_t input_bytes = 0;       // Bytes of the inputs.
+  int64_t normalized_bytes = 0;  // Bytes of the normalized inputs.
+  // Bytes walked in the trie and candidate pieces of the segmentation, of
+  // the unigram models.
+  int64_t trie_lookups = 0;
+  int64_t lattice_nodes = 0;
+  int64_t unknown_tokens = 0;    // Unknown pieces in the output.
+  int64_t byte_fallback_tokens = 0;
+  int64_t cache_hits = 0;  // Words found in the encode cache.
+  int64_t cache_misses = 0;
+  // Nanoseconds spent normalizing, segmenting and building the output.
+  int64_t normalize_nanos = 0;
+  int64_t segment_nanos = 0;
+  int64_t output_nanos = 0;
+
+  double trie_lookups_per_byte() const {
+    return normalized_bytes == 0
+               ? 0.0
+               : static_cast<double>(trie_lookups) / normalized_bytes;
+  }
+  double cache_hit_rate() const {
+    return cache_hits + cache_misses == 0
+               ? 0.0
+               : static_cast<double>(cache_hits) / (cache_hits + cache_misses);
+  }
+};
+
+// Approximate bytes of memory held by a loaded model or a trainer, by
+// component. Only the memory owned by the object is counted: the arrays used
+// in place from a compiled model are reported once as "compiled_model" and
+// not again in the components built from it. The allocator overhead is not
+// included.
+struct MemoryUsage {
+  std::vector<std::pair<std::string, size_t>> components;
+
+  // Adds `bytes` to the component `name`.
+  void Add(absl::string_view name, size_t bytes);
+
+  // Returns the bytes of the component `name`, or 0.
+  size_t bytes(absl::string_view name) const;
+
+  // Returns the sum of all the components.
+  size_t total() const;
+};
+
+// Receives the spans of the encoders of a processor, e.g., to report them
+// to a distributed tracing system next to the rest of a request. Set with
+// SentencePieceProcessor::SetEncodeTracer(). The spans of one encode are
+// nested in BATCH_CHUNK when it runs in a batch, and are not nested in each
+// other. The sampling and n-best encoders report BATCH_CHUNK alone.
+class EncodeTracer {
+ public:
+  enum Span {
+    NORMALIZE,    // `size` is the bytes of the input.
+    SEGMENT,      // `size` is the bytes of the normalized input.
+    OUTPUT,       // `size` is the number of pieces before the extra options.
+    BATCH_CHUNK,  // `size` is the number of inputs of the chunk.
+  };
+
+  virtual ~EncodeTracer() {}
+
+  // Called on the thread running the span, at its beginning and at its end,
+  // also when it fails. Called concurrently by the batch encoders.
+  virtual void BeginSpan(Span span, size_t size) = 0;
+  virtual void EndSpan(Span span) = 0;
+};
+
+// A deadline and a cancellation flag of the encodes of a request, e.g., so
+// that a server sheds a request on a pathological input instead of letting
+// it hold a worker. Installed with ScopedCancellation. Thread-safe: Cancel()
+// may be called from any thread while the encodes run.
+class CancellationToken {
+ public:
+  CancellationToken() = default;
+
+  CancellationToken(const CancellationToken &) = delete;
+  CancellationToken &operator=(const CancellationToken &) = delete;
+
+  // Cancels the encodes still running `timeout_us` microseconds from now.
+  void SetTimeout(int64_t timeout_us);
+
+  // Cancels the encodes still running at `deadline`.
+  void SetDeadline(std::chrono::steady_clock::time_point deadline);
+
+  // Cancels the encodes now.
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // Returns true once cancelled or past the deadline.
+  bool IsCancelled() const;
+
+  // Returns kCancelled after Cancel(), kDeadlineExceeded past the deadline,
+  // and OK otherwise.
+  util::Status status() const;
+
+ private:
+  std::atomic<bool> cancelled_{false};
+  // Nanoseconds of the steady clock. The maximum means no deadline.
+  std::atomic<int64_t> deadline_ns_{INT64_MAX};
+};
+
+// Makes the encoders called on the running thread while alive, including
+// the threads of their batches, check `token`: the segmentation loops poll
+// it every few hundred characters, merges or hypotheses, and the encoders
+// then return token->status() with an unspecified output. The inputs of a
+// batch not started yet fail at once. Null lifts the token. Scopes can be
+// nested. `token` must outlive the scope. The loops of the sampling and
+// entropy encoders and of the decoders are not polled.
+//
+//   CancellationToken token;
+//   token.SetTimeout(50000);
+//   const ScopedCancellation scope(&token);
+//   const auto status = sp.NBestEncode(text, 64, &pieces);
+class ScopedCancellation {
+ public:
+  explicit ScopedCancellation(const CancellationToken *token);
+  ~ScopedCancellation();
+
+  ScopedCancellation(const ScopedCancellation &) = delete;
+  ScopedCancellation &operator=(const ScopedCancellation &) = delete;
+
+  // Returns the token of the innermost scope of the running thread, or null.
+  static const CancellationToken *current();
+
+ private:
+  const CancellationToken *prev_;
+};
+
 class SentencePieceProcessor {
  public:
   SentencePieceProcessor();
@@ -242,8 +584,15 @@ class SentencePieceProcessor {
 
   // Loads model from `filename`.
   // Returns false if `filename` cannot be loaded.
+  // A compiled model saved with SaveCompiledModel() is mapped into memory
+  // and its arrays are used in place.
   virtual util::Status Load(absl::string_view filename);
 
+  // Loads model from `filename` on another thread, so that the caller can
+  // do other work meanwhile. This object must not be used until the
+  // returned future is ready.
+  virtual std::future<util::Status> LoadAsync(absl::string_view filename);
+
   // Loads model from `filename`.
   // Crash if `filename` cannot be loaded.
   virtual void LoadOrDie(absl::string_view filename);
@@ -260,6 +609,46 @@ class SentencePieceProcessor {
   // Useful to load the model from a platform independent blob object.
   virtual util::Status LoadFromSerializedProto(absl::string_view serialized);
 
+  // Loads the model saved with SaveCompiledModel() from `data`, e.g., a model
+  // embedded in the binary. Its arrays are used in place instead of being
+  // copied to the heap, so `data` must outlive this object (and the ones
+  // sharing its model), and be aligned to 8 bytes.
+  virtual util::Status LoadFromCompiledArray(absl::string_view data);
+
+  // When Load() runs the self test of the model, i.e., encodes the samples
+  // of its self_test_data and compares them with the expected pieces.
+  enum class SelfTestMode {
+    kOnLoad,      // Load() fails if the test fails (default).
+    kSkip,        // Never.
+    kBackground,  // On another thread after Load() returns.
+    kDebugOnly,   // kOnLoad without NDEBUG, kSkip otherwise.
+  };
+
+  // Sets the self test mode of the following Load() calls.
+  virtual void SetSelfTestMode(SelfTestMode mode);
+
+  // Sets whether the following Load() calls of a compiled model read it into
+  // huge pages instead of mapping the file. See CompiledModel::Load().
+  virtual void SetUseHugePages(bool use_huge_pages);
+
+  // Returns the result of the self test of the loaded model, waiting for it
+  // in kBackground mode. OK if the test is skipped.
+  virtual util::Status SelfTestStatus() const;
+
+  // Saves the loaded model together with the arrays built from it, e.g.,
+  // the tries. Loading the compiled model skips building them, and the
+  // processes mapping the same file share its pages. The format depends on
+  // the version and the byte order; keep the model proto as the source.
+  virtual util::Status SaveCompiledModel(absl::string_view filename) const;
+
+  // Shares the model loaded in `other` instead of loading it again. The
+  // model is immutable and reference counted, so many processors can share
+  // one copy and outlive `other`, e.g., one per thread or per request with
+  // its own extra options. The extra options and the encode limits are not
+  // shared, while the vocabulary restriction of `other` is. The encode cache
+  // is shared, and should be set up before sharing.
+  virtual util::Status ShareModel(const SentencePieceProcessor &other);
+
   // Returns the status. Encode/Decode methods are valid when status is OK.
   virtual util::Status status() const;
 
@@ -269,6 +658,81 @@ class SentencePieceProcessor {
   // Sets decode extra_option sequence.
   virtual util::Status SetDecodeExtraOptions(absl::string_view extra_option);
 
+  // Caches the segmentation of at most `capacity` whitespace-delimited words,
+  // which speeds up inputs repeating the same words. 0 disables the cache.
+  // Only available when no piece has a whitespace inside, e.g., in models
+  // trained with --split_by_whitespace. Sampling encoders bypass the cache.
+  // Words are encoded on their own, so a tie between equally scored
+  // segmentations may be broken differently than without the cache.
+  virtual util::Status SetEncodeCacheCapacity(size_t capacity);
+
+  // Returns the number of the encoded words found in the cache or not.
+  virtual util::Status GetEncodeCacheStats(int64_t *hits,
+                                           int64_t *misses) const;
+
+  // Caches the ids of whole inputs in about `max_bytes` bytes, evicting the
+  // least recently used ones, which speeds up servers receiving the same
+  // queries again. 0 disables the cache. Only Encode() and EncodeBatch() to
+  // ids and CountTokens() use it; the sampling encoders and the outputs with
+  // pieces or offsets bypass it. The cache belongs to this processor, is
+  // safe to use from concurrent encodes, and is cleared when the extra
+  // options, the vocabulary, the encode limits or the model change.
+  virtual util::Status SetResultCacheCapacity(size_t max_bytes);
+
+  // Returns the number of the inputs found in the result cache or not.
+  virtual util::Status GetResultCacheStats(int64_t *hits,
+                                           int64_t *misses) const;
+
+  // Returns true if the library collects EncodeStats.
+  static bool EncodeStatsEnabled();
+
+  // Returns a snapshot of the EncodeStats of the process. Counters of the
+  // encodes running concurrently may be partially included.
+  static EncodeStats GetEncodeStats();
+
+  // Zeroes the EncodeStats of the process.
+  static void ResetEncodeStats();
+
+  // Returns the memory held by the loaded model, e.g., the model proto, the
+  // tries and the normalizer, and by this processor. The model is shared
+  // with the processors of ShareModel(), so its memory is reported by all
+  // of them.
+  virtual MemoryUsage GetMemoryUsage() const;
+
+  // Reports the spans of the encoders of this processor to `tracer`, which
+  // must outlive the encodes. Not owned. nullptr, the default, disables the
+  // tracing, which then costs a branch per span.
+  virtual void SetEncodeTracer(EncodeTracer *tracer);
+
+  // Limits the output of Encode() and EncodeBatch() to the first
+  // `max_tokens` pieces of the input, before the pieces of the extra options
+  // are added and the pieces are reversed, and the input to its first
+  // `max_input_bytes` bytes, cut at a character boundary. 0 disables a limit.
+  // When no piece crosses a whitespace and the normalizer removes the extra
+  // whitespaces (see StreamingEncoder), a long input is normalized and
+  // segmented only up to a whitespace after enough pieces, instead of as a
+  // whole. The sampling and n-best encoders are not limited, except
+  // SampleEncodeAndScoreBatch().
+  virtual util::Status SetEncodeLimits(size_t max_tokens,
+                                       size_t max_input_bytes);
+
+  // Encodes the inputs of 2 * `chunk_bytes` bytes or more, e.g., whole
+  // books, in chunks cut at the first whitespace after every `chunk_bytes`
+  // bytes, normalized and segmented on up to `num_threads` threads of the
+  // shared pool. The output is the same as encoding the input as a whole,
+  // offsets included. Only available with the models whose segmentation
+  // can be cut at whitespaces (see SetEncodeLimits()). The batch encoders,
+  // which already run on the pool, and the inputs of SetInputNormalized()
+  // are encoded as a whole. 0 disables it.
+  virtual util::Status SetParallelEncode(size_t chunk_bytes, int num_threads);
+
+  // Declares that the inputs of the encoders are already normalized, e.g.,
+  // by a SentencePieceNormalizer with the normalizer spec of this model, so
+  // that the whitespaces are escaped and the dummy prefix is added. The
+  // encoders then skip the normalizer, and the offsets of their outputs are
+  // those of the normalized input. Normalize() still normalizes.
+  virtual util::Status SetInputNormalized(bool normalized);
+
   //////////////////////////////////////////////////////////////
   // Vocabulary restriction.
   // Background:
@@ -288,6 +752,20 @@ class SentencePieceProcessor {
   virtual util::Status LoadVocabulary(absl::string_view filename,
                                       int threshold);
 
+  // Writes the loaded model to `model_proto` with the pieces excluded by
+  // SetVocabulary() and the UNUSED pieces removed, so that a restricted
+  // deployment loads a smaller model. `id_map` maps every old id to its new
+  // id, or to -1 if removed. Without `remap_ids`, or for the models other
+  // than unigram, whose merges or lookups may still go through them, the
+  // pieces are kept as UNUSED and the ids do not change. The self test is
+  // rebuilt with the outputs of the restricted model, without the extra
+  // options and the encode limits of this processor, so that loading the
+  // model checks that it encodes as the restricted one, and the tries are
+  // prebuilt in ModelProto::precompiled_trie.
+  virtual util::Status ExportCompactModel(bool remap_ids,
+                                          ModelProto *model_proto,
+                                          std::vector<int> *id_map) const;
+
   //////////////////////////////////////////////////////////////
   // Simple Encode and Decode API.
   //
@@ -299,6 +777,103 @@ class SentencePieceProcessor {
   virtual util::Status Encode(absl::string_view input,
                               std::vector<int> *ids) const;
 
+  // Encodes every input in `inputs` as Encode() does, on `num_threads`
+  // threads, replacing the contents of `result`. The pieces are stored with
+  // `with_pieces`, and the byte offsets of the pieces in the inputs with
+  // `with_alignment`. Returns the first error by index.
+  virtual util::Status EncodeBatch(const std::vector<absl::string_view> &inputs,
+                                   int num_threads, bool with_pieces,
+                                   bool with_alignment,
+                                   BatchEncodeResult *result) const;
+
+  // Sets `num_tokens` to the number of ids Encode() outputs for `input`,
+  // with the limits and the extra options, without building them: the input
+  // is normalized and segmented, and the pieces are only counted.
+  virtual util::Status CountTokens(absl::string_view input,
+                                   size_t *num_tokens) const;
+
+  // CountTokens() of every input in `inputs`, as EncodeBatch() does.
+  virtual util::Status CountTokensBatch(
+      const std::vector<absl::string_view> &inputs, int num_threads,
+      std::vector<size_t> *num_tokens) const;
+
+  // Same as above, with the offsets of the pieces in Unicode characters
+  // instead of bytes with `unicode_offsets`, as
+  // ImmutableSentencePieceText::ConvertToUnicodeSpans() makes them.
+  virtual util::Status EncodeBatch(const std::vector<absl::string_view> &inputs,
+                                   int num_threads, bool with_pieces,
+                                   bool with_alignment, bool unicode_offsets,
+                                   BatchEncodeResult *result) const;
+
+  // Encodes `input` into the ids of Encode() and the offsets
+  // [begins[i], ends[i]) of their surfaces in `input`, the ones of the
+  // SentencePieceText, without building the pieces and the surfaces. The
+  // offsets are in bytes, or in Unicode characters with `unicode_offsets`.
+  virtual util::Status EncodeWithOffsets(absl::string_view input,
+                                         bool unicode_offsets,
+                                         std::vector<int> *ids,
+                                         std::vector<uint32_t> *begins,
+                                         std::vector<uint32_t> *ends) const;
+
+  // Encodes the UTF-16 `input`, e.g., a string of Java, C# or JavaScript,
+  // into the ids of Encode() and, with `begins` and `ends`, the offsets of
+  // EncodeWithOffsets() in UTF-16 code units. The input is transcoded to
+  // UTF-8 once, keeping the code unit of every byte on the way, so that the
+  // offsets are mapped without another pass over the input. An unpaired
+  // surrogate is encoded as U+FFFD.
+  virtual util::Status EncodeUTF16(std::u16string_view input,
+                                   std::vector<int> *ids,
+                                   std::vector<uint32_t> *begins = nullptr,
+                                   std::vector<uint32_t> *ends = nullptr) const;
+
+  // EncodeUTF16() of every input in `inputs`, without the offsets, as
+  // EncodeBatch() does.
+  virtual util::Status EncodeUTF16Batch(
+      const std::vector<std::u16string_view> &inputs, int num_threads,
+      std::vector<std::vector<int>> *ids) const;
+
+  // Decodes `ids` into the UTF-16 `detokenized`.
+  virtual util::Status DecodeUTF16(const std::vector<int> &ids,
+                                   std::u16string *detokenized) const;
+
+  // Encodes `input` into the ids of Encode() written to `ids`, which has
+  // room for `capacity` ids, and sets `*num_ids` to their number. With
+  // `begins` and `ends` of the same capacity, also writes the byte offsets
+  // of EncodeWithOffsets(). When the ids do not fit, fails with
+  // kResourceExhausted, writing nothing but the required capacity to
+  // `*num_ids`. Reuses the buffers of the calling thread and skips the
+  // result cache, so that the calls do not allocate once the buffers have
+  // grown to the longest input (with the unigram model; the other models
+  // allocate their pieces). Meant for the callers through a C FFI.
+  virtual util::Status EncodeToBuffer(absl::string_view input, int *ids,
+                                      size_t capacity, size_t *num_ids,
+                                      uint32_t *begins = nullptr,
+                                      uint32_t *ends = nullptr) const;
+
+  // Batch versions of the methods above and below. They run on up to
+  // `num_threads` threads of a process-wide pool, in chunks of inputs with
+  // about the same number of bytes, and replace the contents of the output.
+  // Return the first error by index.
+  virtual util::Status EncodeBatch(
+      const std::vector<absl::string_view> &inputs, int num_threads,
+      std::vector<std::vector<std::string>> *pieces) const;
+
+  virtual util::Status EncodeBatch(const std::vector<absl::string_view> &inputs,
+                                   int num_threads,
+                                   std::vector<std::vector<int>> *ids) const;
+
+  virtual util::Status DecodeBatch(
+      const std::vector<std::vector<std::string>> &pieces, int num_threads,
+      std::vector<std::string> *detokenized) const;
+
+  virtual util::Status DecodeBatch(
+      const std::vector<std::vector<absl::string_view>> &pieces,
+      int num_threads, std::vector<std::string> *detokenized) const;
+
+  virtual util::Status DecodeBatch(const std::vector<std::vector<int>> &ids,
+                                   int num_threads,
+                                   std::vector<std::string> *detokenized) const;
+
   // Given a sequence of pieces, decodes it into a detokenized output.
   virtual util::Status Decode(const std::vector<std::string> &pieces,
                               std::string *detokenized) const;
@@ -323,6 +898,29 @@ class SentencePieceProcessor {
   virtual util::Status NBestEncode(absl::string_view input, int nbest_size,
                                    std::vector<std::vector<int>> *ids) const;
 
+  // NBestEncode() of every input in `inputs`, as EncodeBatch() does.
+  virtual util::Status NBestEncodeBatch(
+      const std::vector<absl::string_view> &inputs, int nbest_size,
+      int num_threads,
+      std::vector<std::vector<std::vector<std::string>>> *pieces) const;
+
+  virtual util::Status NBestEncodeBatch(
+      const std::vector<absl::string_view> &inputs, int nbest_size,
+      int num_threads,
+      std::vector<std::vector<std::vector<int>>> *ids) const;
+
+  // Encode() and NBestEncode() of every input into the protos, as
+  // EncodeBatch() does. The protos of a batch are allocated on one arena,
+  // which is freed when the last of them is destroyed.
+  virtual util::Status EncodeBatch(
+      const std::vector<absl::string_view> &inputs, int num_threads,
+      std::vector<ImmutableSentencePieceText> *spts) const;
+
+  virtual util::Status NBestEncodeBatch(
+      const std::vector<absl::string_view> &inputs, int nbest_size,
+      int num_threads,
+      std::vector<ImmutableNBestSentencePieceText> *nbest_spts) const;
+
   //////////////////////////////////////////////////////////////
   // Sampling API.
   //
@@ -351,6 +949,33 @@ class SentencePieceProcessor {
   virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
                                     float alpha, std::vector<int> *ids) const;
 
+  // Same as above, but the random numbers are drawn from `generator`
+  // instead of the generator of the thread, e.g., to sample every request
+  // reproducibly with a generator of its own.
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, SampleGenerator *generator,
+                                    std::vector<std::string> *pieces) const;
+
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, SampleGenerator *generator,
+                                    std::vector<int> *ids) const;
+
+  // Samples the segmentation of every input in `inputs` as SampleEncode()
+  // does, on `num_threads` threads. The random stream of inputs[i] is seeded
+  // by `seed` and i alone, so the result only depends on `seed`, not on
+  // `num_threads` or scheduling. Pass a new seed every epoch to re-sample a
+  // corpus. The random generator of the calling thread is left untouched.
+  virtual util::Status SampleEncodeBatch(
+      const std::vector<absl::string_view> &inputs, int nbest_size,
+      float alpha, uint64_t seed, int num_threads,
+      std::vector<std::vector<std::string>> *pieces) const;
+
+  // Same as above, but returns sequences of ids.
+  virtual util::Status SampleEncodeBatch(
+      const std::vector<absl::string_view> &inputs, int nbest_size,
+      float alpha, uint64_t seed, int num_threads,
+      std::vector<std::vector<int>> *ids) const;
+
   //////////////////////////////////////////////////////////////
   // SampleEncodeAndScore API.
   //
@@ -377,6 +1002,17 @@ class SentencePieceProcessor {
       bool include_best,
       std::vector<std::pair<std::vector<int>, float>> *ids) const;
 
+  // SampleEncodeAndScore() of every input in `inputs` into ids, on
+  // `num_threads` threads of the shared pool, with the random streams of
+  // SampleEncodeBatch(): the result only depends on `seed`. Unlike
+  // SampleEncodeAndScore(), the inputs and the ids of the samples are
+  // limited by SetEncodeLimits() as those of Encode(). Replaces the contents
+  // of `result`. Returns the first error by index.
+  virtual util::Status SampleEncodeAndScoreBatch(
+      const std::vector<absl::string_view> &inputs, int num_samples,
+      float alpha, bool wor, bool include_best, uint64_t seed,
+      int num_threads, BatchSampleResult *result) const;
+
   //////////////////////////////////////////////////////////////
   // Entropy API.
   //
@@ -385,6 +1021,12 @@ class SentencePieceProcessor {
   virtual util::Status CalculateEntropy(absl::string_view input, float alpha,
                                         float *entropy) const;
 
+  // CalculateEntropy() of every input in `inputs` into `entropies`, as
+  // EncodeBatch() does.
+  virtual util::Status CalculateEntropyBatch(
+      const std::vector<absl::string_view> &inputs, float alpha,
+      int num_threads, std::vector<float> *entropies) const;
+
   //////////////////////////////////////////////////////////////
   // Advanced API returning SentencePieceText, which manages
   // utf8-byte alignments between user-input/detokenized text
@@ -407,10 +1049,24 @@ class SentencePieceProcessor {
   virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
                                     float alpha, SentencePieceText *spt) const;
 
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, SampleGenerator *generator,
+                                    SentencePieceText *spt) const;
+
   virtual util::Status SampleEncodeAndScore(
       absl::string_view input, int num_samples, float alpha, bool wor,
       bool include_best, NBestSentencePieceText *samples_spt) const;
 
+  // Same as above, into the NBestResult, which keeps a single copy of the
+  // input for all the hypotheses.
+  virtual util::Status NBestEncode(absl::string_view input, int nbest_size,
+                                   NBestResult *result) const;
+
+  virtual util::Status SampleEncodeAndScore(absl::string_view input,
+                                            int num_samples, float alpha,
+                                            bool wor, bool include_best,
+                                            NBestResult *result) const;
+
   // DEPRECATED: Remove this API and use std::vector<std::string_view>
   virtual util::Status Decode(const std::vector<std::string> &pieces,
                               SentencePieceText *spt) const;
@@ -459,6 +1115,10 @@ class SentencePieceProcessor {
     DEFINE_SPP_DIRECT_FUNC_IMPL(Encode, std::vector<int>, input);
   }
 
+  virtual size_t CountTokens(absl::string_view input) const {
+    DEFINE_SPP_DIRECT_FUNC_IMPL(CountTokens, size_t, input);
+  }
+
   virtual std::vector<std::vector<std::string>> NBestEncodeAsPieces(
       absl::string_view input, int nbest_size) const {
     DEFINE_SPP_DIRECT_FUNC_IMPL(
@@ -661,6 +1321,11 @@ class SentencePieceProcessor {
   // Returns true if `id` is byte symbol.
   virtual bool IsByte(int id) const;
 
+  // Replaces `table` with IdToPiece(), GetScore() and the type of every id
+  // at once. The pieces excluded by SetVocabulary() are UNUSED, as
+  // IsUnused() reports them.
+  virtual util::Status GetVocabularyTable(VocabularyTable *table) const;
+
   // Returns the reserved id.
   // Returns -1 if not defined.
 
@@ -701,11 +1366,37 @@ class SentencePieceProcessor {
  private:
   enum ExtraOption { REVERSE, BOS, EOS, UNK_PIECE };
 
+  // Load() of the model proto in `compiled_model`, using its arrays.
+  util::Status LoadCompiledModel(
+      std::shared_ptr<const CompiledModel> compiled_model);
+
+  // Load() of a model proto whose arrays are mapped from `compiled_model`,
+  // if it is not null.
+  util::Status LoadWithCompiledModel(
+      std::unique_ptr<ModelProto> model_proto,
+      std::shared_ptr<const CompiledModel> compiled_model);
+
   util::Status ParseExtraOptions(absl::string_view extra_option,
                                  std::vector<ExtraOption> *extra_options) const;
 
-  util::Status ApplyExtraOptions(const std::vector<ExtraOption> &extra_options,
-                                 SentencePieceText *spt) const;
+  // Output of extra options applied one after another: the control pieces of
+  // `prefix`, the pieces of the input, reversed if `reverse`, then the control
+  // pieces of `suffix`. The outputs are built in this order at once instead
+  // of being reordered by every option.
+  struct ExtraOptionLayout {
+    std::vector<ExtraOption> prefix;  // BOS or EOS.
+    std::vector<ExtraOption> suffix;  // BOS or EOS.
+    bool reverse = false;
+    bool unk_piece = false;
+    // Of the pieces of the input, before they are reversed. 0 for no limit.
+    size_t max_tokens = 0;
+  };
+
+  static ExtraOptionLayout GetExtraOptionLayout(
+      const std::vector<ExtraOption> &extra_options);
+
+  // Returns the piece and the id of BOS or EOS.
+  std::pair<absl::string_view, int> GetControlPiece(ExtraOption option) const;
 
   util::Status PopulateSentencePieceText(
       absl::string_view input, absl::string_view normalized,
@@ -713,15 +1404,543 @@ class SentencePieceProcessor {
       const std::vector<std::pair<absl::string_view, int>> &result,
       SentencePieceText *spt) const;
 
-  std::unique_ptr<ModelInterface> model_;
-  std::unique_ptr<normalizer::Normalizer> normalizer_;
-  std::unique_ptr<normalizer::Normalizer> denormalizer_;
+  // Same as above, but applies `layout` instead of the encode extra options.
+  util::Status PopulateSentencePieceText(
+      absl::string_view input, absl::string_view normalized,
+      const std::vector<size_t> &norm_to_orig,
+      const std::vector<std::pair<absl::string_view, int>> &result,
+      const ExtraOptionLayout &layout, SentencePieceText *spt) const;
+
+  // Buffers of AppendIdsWithOffsets() reused across inputs.
+  struct OffsetsScratch {
+    std::string buffer;
+    std::vector<size_t> norm_to_orig;
+    std::vector<int> char_offsets;
+  };
+
+  // Appends the ids of `input` and the offsets of their surfaces, as
+  // EncodeWithOffsets() makes them, to `ids`, `begins` and `ends`.
+  util::Status AppendIdsWithOffsets(absl::string_view input,
+                                    bool unicode_offsets,
+                                    OffsetsScratch *scratch,
+                                    std::vector<int> *ids,
+                                    std::vector<uint32_t> *begins,
+                                    std::vector<uint32_t> *ends) const;
+
+  // Appends the ids and the offsets of the pieces `result` of `normalized`,
+  // the normalization of `input` with `scratch->norm_to_orig`, as
+  // AppendIdsWithOffsets() makes them.
+  util::Status AppendResultIdsWithOffsets(
+      absl::string_view input, absl::string_view normalized,
+      const std::vector<std::pair<absl::string_view, int>> &result,
+      bool unicode_offsets, OffsetsScratch *scratch, std::vector<int> *ids,
+      std::vector<uint32_t> *begins, std::vector<uint32_t> *ends) const;
+
+  // Buffers of EncodeToBuffer() reused by the calls of a thread.
+  struct BufferScratch;
+
+  // Returns the types of the pieces of `model_` for the per-piece loops.
+  PieceTypes GetPieceTypes() const;
+
+  // Appends the ids of the pieces `result` of `normalized` as Encode()
+  // outputs them, with the encode extra options and max tokens.
+  util::Status AppendResultIds(
+      absl::string_view normalized,
+      const std::vector<std::pair<absl::string_view, int>> &result,
+      std::vector<int> *ids) const;
+
+  // Appends the ids of Encode() of `input` to `ids`, from `result_cache_`
+  // when enabled. `buffer` holds the normalized string.
+  util::Status AppendIds(absl::string_view input, std::string *buffer,
+                         std::vector<int> *ids) const;
+  util::Status AppendIdsUncached(absl::string_view input, std::string *buffer,
+                                 std::vector<int> *ids) const;
+
+  // Empties `result_cache_` when the ids of the inputs change.
+  void ClearResultCache();
+
+  // Encodes `input` into the pieces and ids of Encode(), skipping the
+  // alignment to `input`. The pieces point into `input`, `buffer` holding
+  // the normalized string when it differs from `input`, or the model.
+  util::Status EncodeWithoutAlignment(
+      absl::string_view input, std::string *buffer,
+      std::vector<std::pair<absl::string_view, int>> *output) const;
+
+  // Returns true if the segmentation of a prefix of the input ending before
+  // a whitespace does not depend on the text after it.
+  bool CanCutAtWhitespace() const;
+
+  // Returns the prefix of `input` which the limited encoders read: the
+  // first max_input_bytes_ bytes, and with `cut_at_whitespace_` the first
+  // prefix ending before a whitespace with max_tokens_ pieces or more.
+  util::Status LimitEncodeInput(absl::string_view input,
+                                absl::string_view *prefix) const;
+
+  // Normalizes `input` as NormalizeInput() and segments the normalized
+  // string into `result`, in parallel chunks when SetParallelEncode()
+  // applies to `input`. The pieces of `result` point into `normalized` or
+  // the model, and `normalized` into `input` or `buffer`.
+  util::Status NormalizeAndSegment(absl::string_view input,
+                                   absl::string_view *normalized,
+                                   std::string *buffer,
+                                   std::vector<size_t> *norm_to_orig,
+                                   std::vector<std::pair<absl::string_view, int>>
+                                       *result) const;
+  util::Status ParallelNormalizeAndSegment(
+      absl::string_view input, absl::string_view *normalized,
+      std::string *buffer, std::vector<size_t> *norm_to_orig,
+      std::vector<std::pair<absl::string_view, int>> *result) const;
+
+  // Normalizes `input` with normalizer_, or returns it as it is with the
+  // identity alignment when `input_normalized_` is set. The alignment is
+  // only filled when |norm_to_orig| is not nullptr.
+  util::Status NormalizeInput(absl::string_view input,
+                              absl::string_view *normalized,
+                              std::string *buffer,
+                              std::vector<size_t> *norm_to_orig) const;
+  util::Status NormalizeInput(absl::string_view input,
+                              std::string *normalized,
+                              std::vector<size_t> *norm_to_orig) const;
+
+  // SampleEncode() drawing from `generator`, or from the thread-local
+  // generator when it is null.
+  util::Status SampleEncodeWithGenerator(absl::string_view input,
+                                         int nbest_size, float alpha,
+                                         SampleGenerator *generator,
+                                         SentencePieceText *spt) const;
+
+  // SampleEncode() of an input of SampleEncodeBatch() with the seed of its
+  // random stream. The model draws the numbers from `stream_seed` when it
+  // supports it, and the thread-local generator is seeded by it otherwise.
+  util::Status SampleEncodeWithSeed(absl::string_view input, int nbest_size,
+                                    float alpha, uint32_t stream_seed,
+                                    SentencePieceText *spt) const;
+
+  // Decoded surface of an id, with which Decode() of ids skips the
+  // SentencePieceText.
+  struct DecodeSurface {
+    enum Type { NORMAL, CONTROL, UNKNOWN, BYTE };
+    Type type = NORMAL;
+    // The piece with kSpaceSymbol replaced with " " for NORMAL, and the
+    // surface of unknown pieces for UNKNOWN.
+    std::string surface;
+    // True if the NORMAL piece starts with kSpaceSymbol.
+    bool has_space_prefix = false;
+    // The byte of a BYTE piece.
+    char byte = 0;
+  };
+
+  // Builds `decode_surfaces_` from the loaded model.
+  void InitDecodeSurfaces();
+
+  // Encodes the self test samples of the model without extra options.
+  util::Status RunSelfTest() const;
+
+  friend class StreamingEncoder;
+  friend class StreamingDecoder;
+  friend class NBestResult;
+  friend class MultiModelEncoder;
+  friend class IncrementalEncoder;
+
+  // Shared with the processors created by ShareModel().
+  std::shared_ptr<ModelInterface> model_;
+
+  // True if `model_` is one of the built-in models of ModelFactory rather
+  // than one given to SetModel(), so that the per-piece loops read its
+  // PieceTypes inline.
+  bool builtin_model_ = false;
+
+  std::shared_ptr<normalizer::Normalizer> normalizer_;
+  std::shared_ptr<normalizer::Normalizer> denormalizer_;
 
   // Underlying model protocol buffer. The same lifetime as model_.
-  std::unique_ptr<ModelProto> model_proto_;
+  std::shared_ptr<ModelProto> model_proto_;
 
   std::vector<ExtraOption> encode_extra_options_;
   std::vector<ExtraOption> decode_extra_options_;
+  ExtraOptionLayout encode_layout_;
+  ExtraOptionLayout decode_layout_;
+
+  // Set by SetEncodeLimits(). `cut_at_whitespace_` is CanCutAtWhitespace()
+  // of the loaded model when max_tokens_ is set.
+  size_t max_tokens_ = 0;
+  size_t max_input_bytes_ = 0;
+  bool cut_at_whitespace_ = false;
+
+  // Set by SetParallelEncode() when CanCutAtWhitespace().
+  size_t parallel_chunk_bytes_ = 0;
+  int parallel_num_threads_ = 0;
+
+  // Set by SetInputNormalized().
+  bool input_normalized_ = false;
+
+  // Indexed by id. Null when Decode() of ids has to go through the
+  // SentencePieceText.
+  std::shared_ptr<const std::vector<DecodeSurface>> decode_surfaces_;
+
+  // Set by SetVocabulary(). True for the ids of the pieces not to emit.
+  // Installed with ScopedVocabularyMask around the calls to the model, so
+  // the model itself is never modified.
+  std::shared_ptr<const std::vector<bool>> vocabulary_mask_;
+
+  // Set by SetResultCacheCapacity(). Holds the ids of AppendIds() with the
+  // current extra options, vocabulary and limits, so it is cleared by
+  // ClearResultCache() whenever one of them changes.
+  std::unique_ptr<ResultCache> result_cache_;
+
+  // Set by SetEncodeTracer(). Not owned.
+  EncodeTracer *encode_tracer_ = nullptr;
+
+  SelfTestMode self_test_mode_ = SelfTestMode::kOnLoad;
+  bool use_huge_pages_ = false;
+  // Result of the self test run on Load(), or of the one still running in
+  // the background when `background_self_test_` is valid.
+  util::Status self_test_status_;
+  std::shared_future<util::Status> background_self_test_;
+};
+
+// Encodes a document that arrives in chunks, e.g., a large log or a book,
+// without holding all of it. When no piece crosses a whitespace (e.g., the
+// model is trained with --split_by_whitespace), the segmentation before a
+// whitespace does not depend on the text after it. The document is then cut
+// and encoded at whitespaces, and only the incomplete last word is kept.
+// Other models, and the "reverse" encode extra option, keep the whole
+// document until Finish().
+//
+// The concatenated output is the same as Encode() of the whole document,
+// except that ties between equally scored segmentations may be broken
+// differently. Normalization rules matching a whitespace are not supported.
+//
+//  StreamingEncoder encoder(sp);
+//  std::vector<int> ids;
+//  while (ReadChunk(&chunk)) CHECK_OK(encoder.Feed(chunk, &ids));
+//  CHECK_OK(encoder.Finish(&ids));
+class StreamingEncoder {
+ public:
+  // `sp` must outlive the encoder and must not be modified while in use.
+  explicit StreamingEncoder(const SentencePieceProcessor &sp);
+  virtual ~StreamingEncoder();
+
+  // Copies the state, e.g., after feeding a prefix shared by many documents
+  // (see PrefixEncoder).
+  StreamingEncoder(const StreamingEncoder &) = default;
+
+  // Appends `chunk` to the document, and appends the pieces which became
+  // final to `pieces`.
+  virtual util::Status Feed(absl::string_view chunk,
+                            std::vector<std::string> *pieces);
+
+  // Same as above, but appends ids.
+  virtual util::Status Feed(absl::string_view chunk, std::vector<int> *ids);
+
+  // Appends the remaining pieces of the document to `pieces`. The encoder can
+  // then be fed a new document.
+  virtual util::Status Finish(std::vector<std::string> *pieces);
+
+  // Same as above, but appends ids.
+  virtual util::Status Finish(std::vector<int> *ids);
+
+  // Returns the number of bytes kept for the pieces which are not final.
+  size_t buffered_size() const { return buffer_.size(); }
+
+ private:
+  friend class PrefixEncoder;
+
+  util::Status Feed(absl::string_view chunk, SentencePieceText *spt);
+  util::Status Finish(SentencePieceText *spt);
+
+  // Encodes buffer_[begin, end) and appends the pieces to `spt`.
+  util::Status EncodeSegment(size_t begin, size_t end, bool is_last,
+                             SentencePieceText *spt);
+
+  // Returns true if the document can be cut before buffer_[pos].
+  bool IsCut(size_t pos) const;
+
+  const SentencePieceProcessor &sp_;
+  // True if the document is cut at whitespaces.
+  bool streaming_ = false;
+  // True until the first segment of the document is encoded.
+  bool is_first_ = true;
+  std::string buffer_;
+  // Prefix of `buffer_` already searched for a cut.
+  size_t scanned_ = 0;
+};
+
+// Encodes inputs starting with the same text, e.g., the fixed system prompt
+// or template of LLM requests, without normalizing and segmenting that
+// prefix for every input. The prefix is fed once to a StreamingEncoder,
+// whose pieces before the last whitespace cut are kept, and a copy of the
+// encoder is fed every suffix. Only the last word of the prefix is encoded
+// again. The output is thus that of StreamingEncoder, i.e., Encode() of
+// prefix + suffix but for ties; with the models StreamingEncoder cannot
+// cut, the whole prefix is encoded again with every suffix.
+//
+//  PrefixEncoder encoder(sp);
+//  CHECK_OK(encoder.SetPrefix(system_prompt));
+//  for (const auto &query : queries) CHECK_OK(encoder.Encode(query, &ids));
+class PrefixEncoder {
+ public:
+  // `sp` must outlive the encoder and must not be modified while in use.
+  explicit PrefixEncoder(const SentencePieceProcessor &sp);
+  virtual ~PrefixEncoder();
+
+  // Encodes `prefix` for the following Encode() calls. The prefix is empty
+  // until it is set.
+  virtual util::Status SetPrefix(absl::string_view prefix);
+
+  // Sets `pieces` to the pieces of prefix + `suffix`. Thread-safe.
+  virtual util::Status Encode(absl::string_view suffix,
+                              std::vector<std::string> *pieces) const;
+
+  // Same as above, but sets `ids`.
+  virtual util::Status Encode(absl::string_view suffix,
+                              std::vector<int> *ids) const;
+
+  // Returns the number of bytes of the prefix encoded again with every
+  // suffix.
+  size_t uncached_size() const { return state_->buffered_size(); }
+
+ private:
+  const SentencePieceProcessor &sp_;
+  // The encoder fed with the prefix.
+  std::unique_ptr<StreamingEncoder> state_;
+  // Output of feeding the prefix.
+  std::vector<std::string> prefix_pieces_;
+  std::vector<int> prefix_ids_;
+};
+
+// Encodes an input with several processors which normalize it the same way,
+// e.g., the models of an A/B experiment trained with the same normalizer
+// spec. The input is normalized once and the segmentation of every model
+// runs on the shared normalized text and alignment, so that a model costs
+// its segmentation only. The outputs are those of Encode() of every
+// processor.
+//
+//  MultiModelEncoder encoder;
+//  CHECK_OK(encoder.Init({&sp_a, &sp_b}));
+//  std::vector<std::vector<int>> ids;  // ids[0] of sp_a, ids[1] of sp_b.
+//  CHECK_OK(encoder.Encode(input, &ids));
+class MultiModelEncoder {
+ public:
+  MultiModelEncoder();
+  virtual ~MultiModelEncoder();
+
+  // Sets the processors to encode with, which must outlive the encoder and
+  // must not be modified while in use. Fails unless all of them have the
+  // same normalizer spec, whitespace options, user defined symbols and
+  // SetInputNormalized().
+  virtual util::Status Init(
+      const std::vector<const SentencePieceProcessor *> &processors);
+
+  // Sets (*ids)[i] to the ids of `input` with the i-th processor.
+  // Thread-safe. A processor with SetEncodeLimits() encodes the input on its
+  // own, and the result caches are not used.
+  virtual util::Status Encode(absl::string_view input,
+                              std::vector<std::vector<int>> *ids) const;
+
+  // Same as above, but sets the SentencePieceText of every processor.
+  virtual util::Status Encode(absl::string_view input,
+                              std::vector<SentencePieceText> *spts) const;
+
+  // Returns the number of the processors.
+  size_t size() const { return processors_.size(); }
+
+ private:
+  std::vector<const SentencePieceProcessor *> processors_;
+};
+
+// Keeps the ids and the byte offsets of a document up to date with its
+// edits, e.g., of the buffer of an editor, without encoding the whole
+// document again for every edit. An edit only re-encodes a window around
+// it, widened to the nearest whitespace cuts (see StreamingEncoder) and to
+// the pieces crossing them, and splices the ids of the window in. With the
+// models StreamingEncoder cannot cut, the whole document is encoded again.
+//
+// The output is EncodeWithOffsets() of the document with byte offsets,
+// without the encode extra options and limits, except that ties between
+// equally scored segmentations may be broken differently.
+//
+//  IncrementalEncoder encoder(sp);
+//  CHECK_OK(encoder.Reset(buffer));
+//  CHECK_OK(encoder.Replace(begin, end, typed));  // On every keystroke.
+//  Show(encoder.ids().size());
+class IncrementalEncoder {
+ public:
+  // `sp` must outlive the encoder and must not be modified while in use.
+  explicit IncrementalEncoder(const SentencePieceProcessor &sp);
+  virtual ~IncrementalEncoder();
+
+  // Encodes `text` as the whole document.
+  virtual util::Status Reset(absl::string_view text);
+
+  // Replaces the bytes [begin, end) of the document with `replacement`,
+  // and updates the ids and the offsets.
+  virtual util::Status Replace(size_t begin, size_t end,
+                               absl::string_view replacement);
+
+  // The document, and its ids and the byte offsets of their surfaces.
+  const std::string &text() const { return text_; }
+  const std::vector<int> &ids() const { return ids_; }
+  const std::vector<uint32_t> &begins() const { return begins_; }
+  const std::vector<uint32_t> &ends() const { return ends_; }
+
+  // Returns the bytes encoded by the last Reset() or Replace().
+  size_t encoded_size() const { return encoded_size_; }
+
+ private:
+  // Encodes text_[begin, end) into `ids`, `begins` and `ends`, with the
+  // offsets in text_.
+  util::Status EncodeWindow(size_t begin, size_t end, std::vector<int> *ids,
+                            std::vector<uint32_t> *begins,
+                            std::vector<uint32_t> *ends) const;
+
+  // Merges the unknown pieces at `pos` and `pos` - 1 as Encode() merges a
+  // run of unknown pieces.
+  void MergeUnknown(size_t pos);
+
+  const SentencePieceProcessor &sp_;
+  // True if the document is cut at whitespaces.
+  bool incremental_ = false;
+  std::string text_;
+  std::vector<int> ids_;
+  std::vector<uint32_t> begins_;
+  std::vector<uint32_t> ends_;
+  size_t encoded_size_ = 0;
+};
+
+// Decodes ids arriving one by one, e.g., from a generative model, without
+// decoding the whole prefix again for every id. Feed() appends the text that
+// became final. The bytes of an incomplete UTF-8 character in byte pieces
+// are held back until the character is complete or a non-byte piece follows.
+// Models with a denormalizer, and the "reverse" decode extra option, keep all
+// the ids until Finish().
+//
+// The concatenated output is the same as Decode() of all the ids.
+//
+//  StreamingDecoder decoder(sp);
+//  std::string text;
+//  while (Generate(&id)) {
+//    CHECK_OK(decoder.Feed(id, &text));
+//    Print(text);
+//    text.clear();
+//  }
+//  CHECK_OK(decoder.Finish(&text));
+class StreamingDecoder {
+ public:
+  // `sp` must outlive the decoder and must not be modified while in use.
+  explicit StreamingDecoder(const SentencePieceProcessor &sp);
+  virtual ~StreamingDecoder();
+
+  // Decodes `id` and appends the text which became final to `text`.
+  virtual util::Status Feed(int id, std::string *text);
+
+  // Same as above, but decodes several ids.
+  virtual util::Status Feed(const std::vector<int> &ids, std::string *text);
+
+  // Appends the remaining text to `text`. The decoder can then be fed a new
+  // sequence.
+  virtual util::Status Finish(std::string *text);
+
+  // Returns the number of bytes held back for an incomplete character.
+  size_t buffered_size() const { return bytes_.size(); }
+
+ private:
+  friend class SentencePieceProcessor;
+
+  // Appends the surface of `id` to `text`, following Decode() of ids.
+  util::Status Append(int id, std::string *text);
+
+  // Appends the characters of `bytes_` to `text`. An incomplete character at
+  // the end is kept unless `is_last`.
+  util::Status ProcessBytes(bool is_last, std::string *text);
+
+  const SentencePieceProcessor &sp_;
+  // True if the text is appended as the ids are fed.
+  bool streaming_ = false;
+  // Ids kept until Finish() unless streaming.
+  std::vector<int> ids_;
+  // Bytes of the trailing byte pieces.
+  std::string bytes_;
+  // Whether a bos whitespace token is expected, as in Decode().
+  bool is_bos_ws_ = true;
+  bool bos_ws_seen_ = false;
+  // True once some text is decoded.
+  bool has_text_ = false;
+};
+
+// A processor whose model can be reloaded while other threads encode with it,
+// read-copy-update style. Load() builds a new processor and publishes it as
+// the current snapshot only if it loads. The snapshots are immutable, and a
+// call in flight finishes on the one it started with.
+//
+//  ReloadableSentencePieceProcessor sp;
+//  CHECK_OK(sp.Load("//path/spm.model"));
+//  // In the worker threads:
+//  CHECK_OK(sp.Get()->Encode(input, &ids));
+//  // In a control thread, while the workers run:
+//  CHECK_OK(sp.Load("//path/new_spm.model"));
+//
+// Get() takes no lock unless a new snapshot has been published since the
+// calling thread last called it. The thread keeps a reference to the
+// snapshot until then, so an old model is freed once every thread using it
+// has moved on.
+//
+// On multi-socket hosts, SetReplicatePerNumaNode() makes Load() keep one
+// replica of the model in the memory of every NUMA node, and Get() return
+// the replica local to the calling thread.
+class ReloadableSentencePieceProcessor {
+ public:
+  // The current snapshot is an unloaded processor until Load().
+  ReloadableSentencePieceProcessor();
+  virtual ~ReloadableSentencePieceProcessor();
+
+  ReloadableSentencePieceProcessor(const ReloadableSentencePieceProcessor &) =
+      delete;
+  ReloadableSentencePieceProcessor &operator=(
+      const ReloadableSentencePieceProcessor &) = delete;
+
+  // Loads `filename` into a new processor and publishes it. Keeps the current
+  // snapshot if `filename` cannot be loaded.
+  virtual util::Status Load(absl::string_view filename);
+
+  // Publishes `processor`, which must not be modified afterwards. All the
+  // NUMA nodes share it.
+  virtual util::Status Publish(
+      std::shared_ptr<const SentencePieceProcessor> processor);
+
+  // Sets whether the following Load() calls load a replica of the model per
+  // NUMA node, each on a thread bound to the CPUs of the node so that its
+  // memory is allocated there. Compiled models are then read instead of
+  // mapped, as the page cache has a single copy. No effect on a single node
+  // or where the NUMA topology is not known (outside Linux).
+  void SetReplicatePerNumaNode(bool replicate) { replicate_ = replicate; }
+
+  // Returns the current snapshot, the replica of the NUMA node of the calling
+  // thread if it is replicated.
+  std::shared_ptr<const SentencePieceProcessor> Get() const;
+
+  // Returns the number of the replicas of the current snapshot.
+  size_t num_replicas() const;
+
+  // Returns the number of the current snapshot, unique over all the
+  // instances of this class. Changes whenever a snapshot is published.
+  uint64_t generation() const {
+    return generation_.load(std::memory_order_acquire);
+  }
+
+ private:
+  // Replicas of a snapshot, indexed by NUMA node.
+  using Replicas = std::vector<std::shared_ptr<const SentencePieceProcessor>>;
+
+  // Publishes `replicas`, which is not empty.
+  void PublishReplicas(std::shared_ptr<const Replicas> replicas);
+
+  std::atomic<uint64_t> generation_;
+  // Guards `snapshot_`, only taken when it is published or first read by a
+  // thread.
+  mutable std::mutex mutex_;
+  std::shared_ptr<const Replicas> snapshot_;
+  bool replicate_ = false;
 };
 
 // Set seed value of random generator.
@@ -734,6 +1953,29 @@ void SetRandomGeneratorSeed(unsigned int seed);
 // The log is emitted only when min_log_level >= output_log_level.
 void SetMinLogLevel(int v);
 
+// Sets the threads of the process: the pools of unspecified size, e.g., the
+// shared pool of the batch calls, which also runs those of the Python
+// module, and the one of a trainer without num_threads, have `num_threads`
+// workers, or GetNumThreads() if 0, and the workers of all the pools are
+// pinned to `cpus`, e.g., "0-3,8", or "node:1" for the CPUs of NUMA node 1,
+// so that they do not run on the CPUs of the other threads of the process.
+// Empty `cpus` does not pin them.
+// Call it once before the first batch call, after which the shared pool
+// cannot change anymore.
+util::Status SetThreadOptions(int num_threads, absl::string_view cpus = "");
+
+// Returns the size of the pools of unspecified size: the num_threads of
+// SetThreadOptions(), or the number of the CPUs the process may run on,
+// respecting its affinity mask and the CPU quota of its cgroup, e.g., of a
+// container.
+int GetNumThreads();
+
+// Runs `closure` on a worker of the shared pool of the batch calls, e.g.,
+// for the batch calls of a language binding, so that the process keeps a
+// single pool. Blocks while the queue of the pool is full. `closure` must
+// not wait for the other closures.
+void ScheduleOnSharedThreadPool(std::function<void()> closure);
+
 // IO related functions to absorb model formats.
 namespace io {
 // Loads `model_proto` from `filename`.
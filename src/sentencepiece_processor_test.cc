@@ -14,6 +14,12 @@
 
 #include "sentencepiece_processor.h"
 
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <utility>
 
 #include "builder.h"
@@ -26,6 +32,7 @@
 #include "testharness.h"
 #include "third_party/absl/container/flat_hash_map.h"
 #include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_join.h"
 #include "third_party/absl/strings/string_view.h"
 #include "util.h"
 
@@ -971,6 +978,78 @@ TEST(SentencePieceProcessorTest, LoadSerializedProtoTest) {
             sp.model_proto().SerializeAsString());
 }
 
+TEST(SentencePieceProcessorTest, LoadAsyncTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+  *(model_proto.mutable_denormalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  const std::string filename =
+      util::JoinPath(::testing::TempDir(), "load_async.model");
+  {
+    auto output = filesystem::NewWritableFile(filename, true);
+    EXPECT_TRUE(output->Write(model_proto.SerializeAsString()));
+  }
+
+  SentencePieceProcessor sp;
+  auto loaded = sp.LoadAsync(filename);
+  EXPECT_TRUE(loaded.get().ok());
+  EXPECT_EQ(model_proto.SerializeAsString(),
+            sp.model_proto().SerializeAsString());
+  std::vector<std::string> pieces;
+  EXPECT_TRUE(sp.Encode("a", &pieces).ok());
+  EXPECT_EQ(std::vector<std::string>({WS, "a"}), pieces);
+
+  EXPECT_FALSE(sp.LoadAsync(filename + ".not_found").get().ok());
+}
+
+TEST(SentencePieceProcessorTest, SelfTestModeTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+  auto *sample = model_proto.mutable_self_test_data()->add_samples();
+  sample->set_input("a");
+  sample->set_expected("b");  // Never passes.
+  const std::string serialized = model_proto.SerializeAsString();
+
+  SentencePieceProcessor sp;
+  EXPECT_FALSE(sp.LoadFromSerializedProto(serialized).ok());
+  EXPECT_FALSE(sp.SelfTestStatus().ok());
+
+  sp.SetSelfTestMode(SentencePieceProcessor::SelfTestMode::kSkip);
+  EXPECT_TRUE(sp.LoadFromSerializedProto(serialized).ok());
+  EXPECT_TRUE(sp.SelfTestStatus().ok());
+
+  sp.SetSelfTestMode(SentencePieceProcessor::SelfTestMode::kBackground);
+  EXPECT_TRUE(sp.LoadFromSerializedProto(serialized).ok());
+  EXPECT_FALSE(sp.SelfTestStatus().ok());
+  EXPECT_FALSE(sp.SelfTestStatus().ok());
+  // Reloading while the test may still run.
+  EXPECT_TRUE(sp.LoadFromSerializedProto(serialized).ok());
+  EXPECT_TRUE(sp.LoadFromSerializedProto(serialized).ok());
+  EXPECT_FALSE(sp.SelfTestStatus().ok());
+
+  sp.SetSelfTestMode(SentencePieceProcessor::SelfTestMode::kDebugOnly);
+#ifdef NDEBUG
+  EXPECT_TRUE(sp.LoadFromSerializedProto(serialized).ok());
+#else
+  EXPECT_FALSE(sp.LoadFromSerializedProto(serialized).ok());
+#endif
+
+  sample->set_expected(WS " a");
+  sp.SetSelfTestMode(SentencePieceProcessor::SelfTestMode::kBackground);
+  EXPECT_TRUE(sp.LoadFromSerializedProto(model_proto.SerializeAsString()).ok());
+  EXPECT_TRUE(sp.SelfTestStatus().ok());
+}
+
 TEST(SentencePieceProcessorTest, EndToEndTest) {
   ModelProto model_proto;
   auto *sp1 = model_proto.add_pieces();
@@ -1264,6 +1343,58 @@ TEST(SentencePieceProcessorTest, EndToEndTest) {
     EXPECT_EQ("abc", output);
   }
 
+  {
+    // Any combination of the options is the same as applying them one after
+    // another.
+    EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
+    std::vector<int> plain_ids;
+    std::vector<std::string> plain_pieces;
+    EXPECT_TRUE(sp.Encode("abcx", &plain_ids).ok());
+    EXPECT_TRUE(sp.Encode("abcx", &plain_pieces).ok());
+    const char *kOptions[] = {"bos", "eos", "reverse", "unk"};
+    for (int trial = 0; trial < 100; ++trial) {
+      std::vector<std::string> options;
+      std::vector<int> expected_ids = plain_ids;
+      std::vector<std::string> expected_pieces = plain_pieces;
+      const int size = rand() % 5 + 1;
+      for (int i = 0; i < size; ++i) {
+        options.emplace_back(kOptions[rand() % 4]);
+        if (options.back() == "bos") {
+          expected_ids.insert(expected_ids.begin(), 1);
+          expected_pieces.insert(expected_pieces.begin(), "<s>");
+        } else if (options.back() == "eos") {
+          expected_ids.push_back(2);
+          expected_pieces.push_back("</s>");
+        } else if (options.back() == "reverse") {
+          std::reverse(expected_ids.begin(), expected_ids.end());
+          std::reverse(expected_pieces.begin(), expected_pieces.end());
+        } else {
+          for (size_t j = 0; j < expected_ids.size(); ++j) {
+            if (expected_ids[j] == 0) expected_pieces[j] = "<unk>";
+          }
+        }
+      }
+      EXPECT_TRUE(sp.SetEncodeExtraOptions(absl::StrJoin(options, ":")).ok());
+
+      std::vector<int> ids;
+      std::vector<std::string> pieces;
+      SentencePieceText spt;
+      EXPECT_TRUE(sp.Encode("abcx", &ids).ok());
+      EXPECT_TRUE(sp.Encode("abcx", &pieces).ok());
+      EXPECT_TRUE(sp.Encode("abcx", &spt).ok());
+      EXPECT_EQ(expected_ids, ids);
+      EXPECT_EQ(expected_pieces, pieces);
+      EXPECT_EQ(expected_ids.size(), spt.pieces_size());
+      for (int j = 0; j < spt.pieces_size(); ++j) {
+        EXPECT_EQ(expected_ids[j], spt.pieces(j).id());
+        EXPECT_EQ(expected_pieces[j], spt.pieces(j).piece());
+        // BOS and EOS stay at the beginning and the end of the input.
+        if (spt.pieces(j).id() == 1) EXPECT_EQ(0, spt.pieces(j).begin());
+        if (spt.pieces(j).id() == 2) EXPECT_EQ(4, spt.pieces(j).end());
+      }
+    }
+  }
+
   EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
   EXPECT_TRUE(sp.SetDecodeExtraOptions("").ok());
 
@@ -1561,64 +1692,2333 @@ TEST(SentencePieceProcessorTest, VocabularyTest) {
   EXPECT_FALSE(sp.IsUnused(7));
 }
 
-TEST(SentencePieceProcessorTest, ImmutableSentencePieceTextTest) {
-  ImmutableSentencePieceText spt;
-  EXPECT_TRUE(spt.text().empty());
-  EXPECT_EQ(spt.score(), 0.0);
-  EXPECT_TRUE(spt.SerializeAsString().empty());
+TEST(SentencePieceProcessorTest, GetVocabularyTableTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const std::string prefix = util::JoinPath(::testing::TempDir(), "vocab");
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                               " --vocab_size=1000 --byte_fallback=true",
+                               " --user_defined_symbols=<sep>"))
+                  .ok());
+  SentencePieceProcessor sp;
+  VocabularyTable table;
+  EXPECT_FALSE(sp.GetVocabularyTable(&table).ok());
+  ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+
+  auto check_table = [&sp](const VocabularyTable &table) {
+    ASSERT_EQ(sp.GetPieceSize(), table.size());
+    EXPECT_EQ(table.size() + 1, table.piece_offsets().size());
+    for (int id = 0; id < sp.GetPieceSize(); ++id) {
+      EXPECT_EQ(sp.IdToPiece(id), table.piece(id));
+      EXPECT_EQ(sp.GetScore(id), table.scores()[id]);
+      const int type = table.types()[id];
+      EXPECT_EQ(sp.IsUnknown(id), type == ModelProto::SentencePiece::UNKNOWN);
+      EXPECT_EQ(sp.IsControl(id), type == ModelProto::SentencePiece::CONTROL);
+      EXPECT_EQ(sp.IsByte(id), type == ModelProto::SentencePiece::BYTE);
+      EXPECT_EQ(sp.IsUnused(id), type == ModelProto::SentencePiece::UNUSED);
+    }
+  };
 
-  auto *v = spt.mutable_proto();
+  EXPECT_TRUE(sp.GetVocabularyTable(&table).ok());
+  check_table(table);
+  EXPECT_EQ(ModelProto::SentencePiece::USER_DEFINED,
+            table.types()[sp.PieceToId("<sep>")]);
 
-  v->set_text("hello world");
-  v->set_score(1.0);
-  for (int i = 0; i < 10; ++i) {
-    auto *p = v->add_pieces();
-    p->set_surface(absl::StrCat("surface_", i));
-    p->set_piece(absl::StrCat("surface_", i));
-    p->set_id(i);
-    p->set_begin(i + 10);
-    p->set_end(i + 20);
+  EXPECT_TRUE(sp.SetVocabulary({"\xe2\x96\x81the"}).ok());
+  EXPECT_TRUE(sp.GetVocabularyTable(&table).ok());
+  check_table(table);
+  EXPECT_EQ(ModelProto::SentencePiece::NORMAL,
+            table.types()[sp.PieceToId("\xe2\x96\x81the")]);
+}
+
+TEST(SentencePieceProcessorTest, ExportCompactModelTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  // The second text has characters out of the vocabulary, whose penalty
+  // depends on the lowest score of the original pieces.
+  const std::vector<std::string> texts = {"I saw a girl with a telescope.",
+                                          "I saw \u732B with a \u2603."};
+  for (const std::string type : {"unigram", "bpe"}) {
+    const std::string prefix =
+        util::JoinPath(::testing::TempDir(), absl::StrCat("compact_", type));
+    ASSERT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                                 " --vocab_size=1000 --model_type=", type,
+                                 " --self_test_sample_size=10"))
+                    .ok());
+    SentencePieceProcessor sp;
+    ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+    EXPECT_TRUE(sp.SetVocabulary({WS "I", WS "saw", WS "a", WS "with"}).ok());
+    for (const bool remap_ids : {true, false}) {
+      ModelProto model_proto;
+      std::vector<int> id_map;
+      EXPECT_TRUE(sp.ExportCompactModel(remap_ids, &model_proto, &id_map).ok());
+      EXPECT_EQ(sp.GetPieceSize(), id_map.size());
+      EXPECT_FALSE(model_proto.precompiled_trie().empty());
+      for (const auto &sample : model_proto.self_test_data().samples()) {
+        std::vector<std::string> pieces;
+        EXPECT_TRUE(sp.Encode(sample.input(), &pieces).ok());
+        EXPECT_EQ(absl::StrJoin(pieces, " "), sample.expected());
+      }
+
+      // The compacted model passes its self test and encodes as the
+      // restricted one.
+      SentencePieceProcessor compact;
+      ASSERT_TRUE(compact.Load(model_proto).ok());
+      for (const auto &text : texts) {
+        std::vector<std::string> expected_pieces, pieces;
+        std::vector<int> expected_ids, ids;
+        EXPECT_TRUE(sp.Encode(text, &expected_pieces).ok());
+        EXPECT_TRUE(sp.Encode(text, &expected_ids).ok());
+        EXPECT_TRUE(compact.Encode(text, &pieces).ok());
+        EXPECT_TRUE(compact.Encode(text, &ids).ok());
+        EXPECT_EQ(expected_pieces, pieces);
+        ASSERT_EQ(expected_ids.size(), ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+          EXPECT_EQ(id_map[expected_ids[i]], ids[i]);
+        }
+      }
+      EXPECT_EQ(compact.PieceToId("<unk>"), compact.unk_id());
+      EXPECT_EQ(compact.PieceToId("</s>"), compact.eos_id());
+
+      // The extra options and the limits of the exporting processor are not
+      // applied to the self test.
+      SentencePieceProcessor with_options;
+      ASSERT_TRUE(with_options.ShareModel(sp).ok());
+      EXPECT_TRUE(with_options.SetEncodeExtraOptions("bos:eos:reverse").ok());
+      EXPECT_TRUE(with_options.SetEncodeLimits(2, 3).ok());
+      EXPECT_TRUE(with_options.SetInputNormalized(true).ok());
+      ModelProto with_options_proto;
+      std::vector<int> with_options_id_map;
+      EXPECT_TRUE(with_options
+                      .ExportCompactModel(remap_ids, &with_options_proto,
+                                          &with_options_id_map)
+                      .ok());
+      EXPECT_EQ(model_proto.SerializeAsString(),
+                with_options_proto.SerializeAsString());
+      SentencePieceProcessor with_options_compact;
+      EXPECT_TRUE(with_options_compact.Load(with_options_proto).ok());
+
+      // Only the unigram pieces are removed.
+      int removed = 0;
+      for (int id = 0; id < sp.GetPieceSize(); ++id) {
+        if (id_map[id] < 0) {
+          EXPECT_TRUE(sp.IsUnused(id));
+          ++removed;
+          continue;
+        }
+        EXPECT_EQ(sp.IdToPiece(id), compact.IdToPiece(id_map[id]));
+        EXPECT_EQ(sp.IsUnused(id), compact.IsUnused(id_map[id]));
+      }
+      EXPECT_EQ(removed, sp.GetPieceSize() - compact.GetPieceSize());
+      if (remap_ids && type == "unigram") {
+        EXPECT_GT(removed, 0);
+      } else {
+        EXPECT_EQ(0, removed);
+      }
+    }
   }
+}
 
-  EXPECT_EQ(v->pieces_size(), spt.pieces_size());
-  for (int i = 0; i < spt.pieces_size(); ++i) {
-    EXPECT_EQ(v->pieces(i).surface(), spt.pieces(i).surface());
-    EXPECT_EQ(v->pieces(i).piece(), spt.pieces(i).piece());
-    EXPECT_EQ(v->pieces(i).id(), spt.pieces(i).id());
-    EXPECT_EQ(v->pieces(i).begin(), spt.pieces(i).begin());
-    EXPECT_EQ(v->pieces(i).end(), spt.pieces(i).end());
+TEST(SentencePieceProcessorTest, EncodeCacheTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "aa", 0.0);
+  AddPiece(&model_proto, WS "aa", 1.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  int64_t hits = 0, misses = 0;
+  EXPECT_FALSE(sp.GetEncodeCacheStats(&hits, &misses).ok());
+  EXPECT_TRUE(sp.SetEncodeCacheCapacity(100).ok());
+
+  std::vector<std::string> pieces;
+  EXPECT_TRUE(sp.Encode("aa aa aa", &pieces).ok());
+  EXPECT_EQ(std::vector<std::string>(3, WS "aa"), pieces);
+  EXPECT_TRUE(sp.GetEncodeCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(2, hits);
+  EXPECT_EQ(1, misses);
+
+  // A restricted vocabulary bypasses the cache of the whole vocabulary.
+  EXPECT_TRUE(sp.SetVocabulary({"aa"}).ok());
+  EXPECT_TRUE(sp.Encode("aa aa", &pieces).ok());
+  EXPECT_EQ(std::vector<std::string>({WS, "aa", WS, "aa"}), pieces);
+  EXPECT_TRUE(sp.GetEncodeCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(2, hits);
+  EXPECT_EQ(1, misses);
+
+  EXPECT_TRUE(sp.ResetVocabulary().ok());
+  EXPECT_TRUE(sp.Encode("aa aa", &pieces).ok());
+  EXPECT_EQ(std::vector<std::string>(2, WS "aa"), pieces);
+  EXPECT_TRUE(sp.GetEncodeCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(4, hits);
+  EXPECT_EQ(1, misses);
+
+  EXPECT_TRUE(sp.SetEncodeCacheCapacity(0).ok());
+  EXPECT_FALSE(sp.GetEncodeCacheStats(&hits, &misses).ok());
+}
+
+TEST(SentencePieceProcessorTest, EncodeToBufferTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const std::string prefix =
+      util::JoinPath(::testing::TempDir(), "encode_to_buffer");
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                               " --vocab_size=1000"))
+                  .ok());
+  SentencePieceProcessor sp;
+  ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+
+  const std::string text = "I saw a girl with a telescope.";
+  const std::vector<int> expected = sp.EncodeAsIds(text);
+  std::vector<int> ids(expected.size() + 1, -1);
+  size_t num_ids = 0;
+
+  // Too small a buffer is left as it is, with the required size.
+  EXPECT_EQ(util::StatusCode::kResourceExhausted,
+            sp.EncodeToBuffer(text, ids.data(), expected.size() - 1, &num_ids)
+                .code());
+  EXPECT_EQ(expected.size(), num_ids);
+  EXPECT_EQ(std::vector<int>(ids.size(), -1), ids);
+  EXPECT_EQ(util::StatusCode::kResourceExhausted,
+            sp.EncodeToBuffer(text, nullptr, 0, &num_ids).code());
+  EXPECT_EQ(expected.size(), num_ids);
+
+  EXPECT_TRUE(
+      sp.EncodeToBuffer(text, ids.data(), ids.size(), &num_ids).ok());
+  EXPECT_EQ(expected.size(), num_ids);
+  EXPECT_EQ(expected, std::vector<int>(ids.begin(), ids.begin() + num_ids));
+
+  EXPECT_TRUE(sp.EncodeToBuffer("", nullptr, 0, &num_ids).ok());
+  EXPECT_EQ(0, num_ids);
+  EXPECT_FALSE(sp.EncodeToBuffer(text, ids.data(), ids.size(), nullptr).ok());
+  std::vector<uint32_t> begins(ids.size());
+  EXPECT_FALSE(sp.EncodeToBuffer(text, ids.data(), ids.size(), &num_ids,
+                                 begins.data(), nullptr)
+                   .ok());
+
+  // The buffers of the threads are their own.
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&sp, t]() {
+      const std::string text = absl::StrCat("Hello world ", std::to_string(t));
+      std::vector<int> ids(64);
+      size_t num_ids = 0;
+      for (int n = 0; n < 100; ++n) {
+        EXPECT_TRUE(
+            sp.EncodeToBuffer(text, ids.data(), ids.size(), &num_ids).ok());
+        EXPECT_EQ(sp.EncodeAsIds(text),
+                  std::vector<int>(ids.begin(), ids.begin() + num_ids));
+      }
+    });
   }
+  for (auto &thread : threads) thread.join();
+}
 
-  auto check_proto = [&v](const ImmutableSentencePieceText &s) {
-    int n = 0;
-    for (auto &p : s.pieces()) {
-      EXPECT_EQ(v->pieces(n).surface(), p.surface());
-      EXPECT_EQ(v->pieces(n).piece(), p.piece());
-      EXPECT_EQ(v->pieces(n).id(), p.id());
-      EXPECT_EQ(v->pieces(n).begin(), p.begin());
-      EXPECT_EQ(v->pieces(n).end(), p.end());
-      ++n;
-    }
-    EXPECT_EQ(v->text(), s.text());
-    EXPECT_EQ(v->score(), s.score());
-    EXPECT_EQ(v->SerializeAsString(), s.SerializeAsString());
+TEST(SentencePieceProcessorTest, InputNormalizedTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const std::string prefix =
+      util::JoinPath(::testing::TempDir(), "input_normalized");
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                               " --vocab_size=1000"))
+                  .ok());
+  SentencePieceProcessor sp;
+  ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+  SentencePieceNormalizer normalizer;
+  ASSERT_TRUE(normalizer.Load(prefix + ".model").ok());
+
+  const std::string text = "  I saw a girl with a telescope.";
+  const std::vector<int> expected = sp.EncodeAsIds(text);
+  const std::string normalized = normalizer.Normalize(text);
+
+  EXPECT_TRUE(sp.SetInputNormalized(true).ok());
+  EXPECT_EQ(expected, sp.EncodeAsIds(normalized));
+  EXPECT_EQ(sp.NBestEncodeAsIds(text, 3).size(),
+            sp.NBestEncodeAsIds(normalized, 3).size());
+  EXPECT_EQ(expected.size(), sp.CountTokens(normalized));
+
+  // The offsets are those of the normalized input.
+  SentencePieceText spt;
+  EXPECT_TRUE(sp.Encode(normalized, &spt).ok());
+  EXPECT_EQ(normalized, spt.text());
+  ASSERT_EQ(expected.size(), spt.pieces_size());
+  for (int k = 0; k < spt.pieces_size(); ++k) {
+    const auto &piece = spt.pieces(k);
+    EXPECT_EQ(expected[k], piece.id());
+    EXPECT_EQ(piece.piece(),
+              normalized.substr(piece.begin(), piece.end() - piece.begin()));
+  }
+  EXPECT_EQ(normalized.size(), spt.pieces(spt.pieces_size() - 1).end());
+
+  // Normalize() still normalizes.
+  std::string renormalized;
+  EXPECT_TRUE(sp.Normalize(text, &renormalized).ok());
+  EXPECT_EQ(normalized, renormalized);
+
+  EXPECT_TRUE(sp.SetInputNormalized(false).ok());
+  EXPECT_EQ(expected, sp.EncodeAsIds(text));
+}
+
+TEST(SentencePieceProcessorTest, MultiModelEncoderTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  auto train = [&input](absl::string_view name, absl::string_view flags) {
+    const std::string prefix = util::JoinPath(::testing::TempDir(), name);
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                                 " --vocab_size=1000 ", flags))
+                    .ok());
+    auto sp = std::make_unique<SentencePieceProcessor>();
+    EXPECT_TRUE(sp->Load(prefix + ".model").ok());
+    return sp;
   };
+  const auto unigram = train("multi_unigram", "--model_type=unigram");
+  const auto bpe = train("multi_bpe", "--model_type=bpe");
+  const auto identity =
+      train("multi_identity", "--normalization_rule_name=identity");
+  ASSERT_TRUE(bpe->SetEncodeExtraOptions("bos:eos").ok());
 
-  // test copy.
-  const auto spt2 = spt;
-  check_proto(spt2);
+  MultiModelEncoder encoder;
+  std::vector<std::vector<int>> ids;
+  EXPECT_FALSE(encoder.Encode("Hello", &ids).ok());
+  EXPECT_FALSE(encoder.Init({}).ok());
+  EXPECT_FALSE(encoder.Init({unigram.get(), identity.get()}).ok());
+  ASSERT_TRUE(encoder.Init({unigram.get(), bpe.get()}).ok());
+  EXPECT_EQ(2, encoder.size());
+
+  for (const char *text :
+       {"", "I saw a girl with a telescope.", "  ＡＢＣ  hello  "}) {
+    EXPECT_TRUE(encoder.Encode(text, &ids).ok());
+    ASSERT_EQ(2, ids.size());
+    EXPECT_EQ(unigram->EncodeAsIds(text), ids[0]);
+    EXPECT_EQ(bpe->EncodeAsIds(text), ids[1]);
+
+    std::vector<SentencePieceText> spts;
+    EXPECT_TRUE(encoder.Encode(text, &spts).ok());
+    ASSERT_EQ(2, spts.size());
+    for (int i = 0; i < 2; ++i) {
+      SentencePieceText expected;
+      EXPECT_TRUE((i == 0 ? unigram : bpe)->Encode(text, &expected).ok());
+      EXPECT_EQ(expected.SerializeAsString(), spts[i].SerializeAsString());
+    }
+  }
 
-  // test assign.
-  const ImmutableSentencePieceText spt3(spt);
-  check_proto(spt3);
+  // A processor with encode limits encodes on its own.
+  ASSERT_TRUE(unigram->SetEncodeLimits(3, 0).ok());
+  EXPECT_TRUE(encoder.Encode("I saw a girl with a telescope.", &ids).ok());
+  EXPECT_EQ(3, ids[0].size());
+  EXPECT_TRUE(unigram->SetEncodeLimits(0, 0).ok());
 
-  // default piece.
-  const ImmutableSentencePieceText_ImmutableSentencePiece piece;
-  EXPECT_TRUE(piece.surface().empty());
-  EXPECT_TRUE(piece.piece().empty());
-  EXPECT_EQ(piece.begin(), 0);
-  EXPECT_EQ(piece.end(), 0);
-  EXPECT_EQ(piece.id(), 0);
+  EXPECT_TRUE(unigram->SetInputNormalized(true).ok());
+  EXPECT_FALSE(encoder.Init({unigram.get(), bpe.get()}).ok());
+}
+
+TEST(SentencePieceProcessorTest, ResultCacheTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "aa", 0.0);
+  AddPiece(&model_proto, WS "aa", 1.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  const std::vector<int> expected = sp.EncodeAsIds("aa aa");
+
+  int64_t hits = 0, misses = 0;
+  EXPECT_FALSE(sp.GetResultCacheStats(&hits, &misses).ok());
+  EXPECT_TRUE(sp.SetResultCacheCapacity(1 << 20).ok());
+
+  std::vector<int> ids;
+  EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(expected, ids);
+  EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(expected, ids);
+  size_t num_tokens = 0;
+  EXPECT_TRUE(sp.CountTokens("aa aa", &num_tokens).ok());
+  EXPECT_EQ(expected.size(), num_tokens);
+  EXPECT_TRUE(sp.GetResultCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(2, hits);
+  EXPECT_EQ(1, misses);
+  EXPECT_GT(sp.GetMemoryUsage().bytes("result_cache"), 0);
+
+  // The pieces bypass the cache.
+  std::vector<std::string> pieces;
+  EXPECT_TRUE(sp.Encode("aa aa", &pieces).ok());
+  EXPECT_TRUE(sp.GetResultCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(2, hits);
+  EXPECT_EQ(1, misses);
+
+  // The extra options, the vocabulary and the limits clear the cache.
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("bos").ok());
+  EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(1, ids[0]);
+  EXPECT_EQ(expected.size() + 1, ids.size());
+  EXPECT_TRUE(sp.SetVocabulary({"aa"}).ok());
+  EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(5, ids.size());
+  EXPECT_TRUE(sp.SetEncodeLimits(2, 0).ok());
+  EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(3, ids.size());
+  EXPECT_TRUE(sp.GetResultCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(2, hits);
+  EXPECT_EQ(4, misses);
+
+  // Processors sharing the model have caches of their own.
+  SentencePieceProcessor shared;
+  EXPECT_TRUE(shared.ShareModel(sp).ok());
+  EXPECT_FALSE(shared.GetResultCacheStats(&hits, &misses).ok());
+
+  EXPECT_TRUE(sp.SetResultCacheCapacity(0).ok());
+  EXPECT_FALSE(sp.GetResultCacheStats(&hits, &misses).ok());
+  EXPECT_EQ(0, sp.GetMemoryUsage().bytes("result_cache"));
+}
+
+TEST(SentencePieceProcessorTest, EncodeStatsTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "aa", 0.0);
+  AddPiece(&model_proto, WS "aa", 1.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  EXPECT_TRUE(sp.SetEncodeCacheCapacity(100).ok());
+
+  SentencePieceProcessor::ResetEncodeStats();
+  std::vector<int> ids;
+  EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+  std::vector<std::string> pieces;
+  EXPECT_TRUE(sp.Encode("aa bb", &pieces).ok());
+  EXPECT_EQ(std::vector<std::string>({WS "aa", WS, "bb"}), pieces);
+  SentencePieceText spt;
+  EXPECT_TRUE(sp.Encode("aa", &spt).ok());
+
+  const auto stats = SentencePieceProcessor::GetEncodeStats();
+  if (!SentencePieceProcessor::EncodeStatsEnabled()) {
+    EXPECT_EQ(0, stats.calls);
+    EXPECT_EQ(0, stats.trie_lookups);
+    EXPECT_EQ(0, stats.cache_hits);
+    EXPECT_EQ(0, stats.normalize_nanos);
+    EXPECT_EQ(0.0, stats.cache_hit_rate());
+    return;
+  }
+
+  EXPECT_EQ(3, stats.calls);
+  EXPECT_EQ(12, stats.input_bytes);
+  EXPECT_EQ(25, stats.normalized_bytes);
+  // "▁aa" is cached by the first input and found by the others.
+  EXPECT_EQ(3, stats.cache_hits);
+  EXPECT_EQ(2, stats.cache_misses);
+  EXPECT_NEAR(0.6, stats.cache_hit_rate(), 1e-6);
+  EXPECT_EQ(1, stats.unknown_tokens);
+  EXPECT_EQ(0, stats.byte_fallback_tokens);
+  EXPECT_GT(stats.trie_lookups, 0);
+  EXPECT_GT(stats.lattice_nodes, 0);
+  EXPECT_GT(stats.trie_lookups_per_byte(), 0.0);
+  EXPECT_GE(stats.normalize_nanos, 0);
+  EXPECT_GE(stats.segment_nanos, 0);
+  EXPECT_GE(stats.output_nanos, 0);
+
+  SentencePieceProcessor::ResetEncodeStats();
+  EXPECT_EQ(0, SentencePieceProcessor::GetEncodeStats().calls);
+}
+
+// Records the spans as "+NAME:size" and "-NAME".
+class RecordingTracer : public EncodeTracer {
+ public:
+  void BeginSpan(Span span, size_t size) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(absl::StrCat("+", kNames[span], ":", size));
+  }
+  void EndSpan(Span span) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(absl::StrCat("-", kNames[span]));
+  }
+
+  std::vector<std::string> events_;
+
+ private:
+  static constexpr const char *kNames[] = {"normalize", "segment", "output",
+                                           "chunk"};
+  std::mutex mutex_;
+};
+
+TEST(SentencePieceProcessorTest, EncodeTracerTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "aa", 0.0);
+  AddPiece(&model_proto, WS "aa", 1.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("bos:eos").ok());
+
+  RecordingTracer tracer;
+  sp.SetEncodeTracer(&tracer);
+  const std::vector<std::string> spans = {
+      "+normalize:5", "-normalize", "+segment:10", "-segment",
+      "+output:2",    "-output"};
+  for (int i = 0; i < 3; ++i) {
+    tracer.events_.clear();
+    std::vector<int> ids;
+    std::vector<std::string> pieces;
+    SentencePieceText spt;
+    if (i == 0) EXPECT_TRUE(sp.Encode("aa aa", &ids).ok());
+    if (i == 1) EXPECT_TRUE(sp.Encode("aa aa", &pieces).ok());
+    if (i == 2) EXPECT_TRUE(sp.Encode("aa aa", &spt).ok());
+    EXPECT_EQ(spans, tracer.events_);
+  }
+
+  // A single chunk of two inputs.
+  tracer.events_.clear();
+  std::vector<std::vector<int>> ids;
+  EXPECT_TRUE(sp.EncodeBatch({"aa aa", "aa aa"}, 1, &ids).ok());
+  std::vector<std::string> batch_spans = {"+chunk:2"};
+  for (int i = 0; i < 2; ++i) {
+    batch_spans.insert(batch_spans.end(), spans.begin(), spans.end());
+  }
+  batch_spans.push_back("-chunk");
+  EXPECT_EQ(batch_spans, tracer.events_);
+
+  // The spans of concurrent chunks interleave, but every span ends.
+  tracer.events_.clear();
+  BatchEncodeResult result;
+  const std::string input(100, 'a');
+  const std::vector<absl::string_view> inputs(1000, input);
+  EXPECT_TRUE(sp.EncodeBatch(inputs, 4, false, false, &result).ok());
+  int begins = 0, ends = 0, chunks = 0;
+  for (const auto &event : tracer.events_) {
+    if (event[0] == '+') ++begins;
+    if (event[0] == '-') ++ends;
+    if (event.find("chunk") != std::string::npos) ++chunks;
+  }
+  EXPECT_EQ(begins, ends);
+  EXPECT_EQ(3 * 1000 + chunks / 2, begins);
+  EXPECT_GT(chunks, 2);
+
+  sp.SetEncodeTracer(nullptr);
+  tracer.events_.clear();
+  std::vector<int> single;
+  EXPECT_TRUE(sp.Encode("aa", &single).ok());
+  EXPECT_TRUE(tracer.events_.empty());
+}
+
+TEST(SentencePieceProcessorTest, CancellationTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "aa", 0.0);
+  AddPiece(&model_proto, WS "aa", 1.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  const std::vector<int> expected = sp.EncodeAsIds("aa aa");
+  EXPECT_TRUE(sp.SetEncodeCacheCapacity(1024).ok());
+
+  // A long input without whitespaces, whose loops poll the token.
+  const std::string input(1 << 16, 'a');
+  const std::vector<absl::string_view> inputs(64, "aa aa");
+  for (const bool deadline : {false, true}) {
+    const auto code = deadline ? util::StatusCode::kDeadlineExceeded
+                               : util::StatusCode::kCancelled;
+    CancellationToken token;
+    EXPECT_FALSE(token.IsCancelled());
+    EXPECT_TRUE(token.status().ok());
+    if (deadline) {
+      token.SetTimeout(0);
+    } else {
+      token.Cancel();
+    }
+    EXPECT_TRUE(token.IsCancelled());
+    EXPECT_EQ(code, token.status().code());
+
+    const ScopedCancellation scope(&token);
+    EXPECT_EQ(&token, ScopedCancellation::current());
+    std::vector<int> ids;
+    std::string detokenized;
+    std::vector<std::vector<int>> batch_ids;
+    std::vector<std::vector<std::string>> nbests;
+    BatchEncodeResult result;
+    size_t num_tokens = 0;
+    EXPECT_EQ(code, sp.Encode(input, &ids).code());
+    EXPECT_EQ(code, sp.Encode("aa aa", &ids).code());
+    EXPECT_EQ(code, sp.CountTokens(input, &num_tokens).code());
+    EXPECT_EQ(code, sp.NBestEncode(input, 8, &nbests).code());
+    EXPECT_EQ(code, sp.NBestEncode(input, 100, &nbests).code());
+    EXPECT_EQ(code, sp.EncodeBatch(inputs, 4, &batch_ids).code());
+    EXPECT_EQ(code, sp.EncodeBatch(inputs, 4, false, false, &result).code());
+
+    // Decoding is not cancelled.
+    EXPECT_TRUE(sp.Decode(expected, &detokenized).ok());
+  }
+  EXPECT_EQ(nullptr, ScopedCancellation::current());
+
+  // The cancelled encodes were not cached.
+  EXPECT_EQ(expected, sp.EncodeAsIds("aa aa"));
+
+  // A deadline not reached yet.
+  CancellationToken token;
+  token.SetDeadline(std::chrono::steady_clock::now() + std::chrono::hours(1));
+  const ScopedCancellation scope(&token);
+  std::vector<std::vector<int>> batch_ids;
+  EXPECT_TRUE(sp.EncodeBatch(inputs, 4, &batch_ids).ok());
+  for (const auto &ids : batch_ids) EXPECT_EQ(expected, ids);
+  {
+    // An inner scope lifts the token.
+    const ScopedCancellation inner(nullptr);
+    token.Cancel();
+    EXPECT_EQ(expected, sp.EncodeAsIds("aa aa"));
+  }
+  std::vector<int> ids;
+  EXPECT_EQ(util::StatusCode::kCancelled, sp.Encode("aa aa", &ids).code());
+}
+
+TEST(SentencePieceProcessorTest, EncodeUTF16Test) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, WS "a", 1.0);
+  AddPiece(&model_proto, "テ", 0.0);
+  AddPiece(&model_proto, "😀", 0.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  // "aテ 😀a", where the emoji is a surrogate pair.
+  const std::u16string input = u"a\u30C6 \U0001F600a";
+  const std::string utf8 = "aテ 😀a";
+  const std::vector<int> expected = sp.EncodeAsIds(utf8);
+  std::vector<int> ids;
+  std::vector<uint32_t> begins, ends;
+  EXPECT_TRUE(sp.EncodeUTF16(input, &ids).ok());
+  EXPECT_EQ(expected, ids);
+  EXPECT_TRUE(sp.EncodeUTF16(input, &ids, &begins, &ends).ok());
+  EXPECT_EQ(expected, ids);
+  EXPECT_EQ(std::vector<int>({5, 6, 3, 7, 4}), ids);
+  EXPECT_EQ(std::vector<uint32_t>({0, 1, 2, 3, 5}), begins);
+  EXPECT_EQ(std::vector<uint32_t>({1, 2, 3, 5, 6}), ends);
+
+  std::vector<std::vector<int>> batch_ids;
+  EXPECT_TRUE(sp.EncodeUTF16Batch({input, input, u""}, 2, &batch_ids).ok());
+  EXPECT_EQ(std::vector<std::vector<int>>({expected, expected, {}}),
+            batch_ids);
+
+  std::u16string detokenized;
+  EXPECT_TRUE(sp.DecodeUTF16(ids, &detokenized).ok());
+  EXPECT_EQ(input, detokenized);
+
+  // An unpaired surrogate is encoded as U+FFFD, which the normalizer
+  // removes.
+  EXPECT_TRUE(
+      sp.EncodeUTF16(std::u16string({u'a', 0xD800}), &ids, &begins, &ends)
+          .ok());
+  EXPECT_EQ(sp.EncodeAsIds("a\xEF\xBF\xBD"), ids);
+  EXPECT_EQ(std::vector<int>({5}), ids);
+  EXPECT_EQ(std::vector<uint32_t>({0}), begins);
+  EXPECT_EQ(std::vector<uint32_t>({1}), ends);
+
+  EXPECT_FALSE(sp.EncodeUTF16(input, &ids, &begins, nullptr).ok());
+}
+
+TEST(SentencePieceProcessorTest, MemoryUsageTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  for (const std::string type : {"unigram", "bpe"}) {
+    const std::string prefix =
+        util::JoinPath(::testing::TempDir(), absl::StrCat("memory_", type));
+    ASSERT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                                 " --vocab_size=1000 --model_type=", type,
+                                 " --user_defined_symbols=<sep>"))
+                    .ok());
+
+    SentencePieceProcessor sp;
+    EXPECT_EQ(0, sp.GetMemoryUsage().total());
+    ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+    auto usage = sp.GetMemoryUsage();
+    size_t total = 0;
+    for (const auto &component : usage.components) total += component.second;
+    EXPECT_EQ(total, usage.total());
+    EXPECT_GT(usage.bytes("model_proto"), 0);
+    EXPECT_GT(usage.bytes("piece_attributes"), 0);
+    EXPECT_GT(usage.bytes("piece_ids"), 0);
+    EXPECT_GT(usage.bytes("user_defined_symbols"), 0);
+    EXPECT_EQ(0, usage.bytes("compiled_model"));
+    EXPECT_EQ(0, usage.bytes("encode_cache"));
+    if (type == "unigram") EXPECT_GT(usage.bytes("unigram_trie"), 0);
+    if (type == "bpe") EXPECT_GT(usage.bytes("bpe_merges"), 0);
+    // Only BPE looks up the piece maps after the trie is built.
+    if (type == "unigram") EXPECT_EQ(0, usage.bytes("piece_maps"));
+    if (type == "bpe") EXPECT_GT(usage.bytes("piece_maps"), 0);
+
+    EXPECT_TRUE(sp.SetEncodeCacheCapacity(100).ok());
+    std::vector<int> ids;
+    EXPECT_TRUE(sp.Encode("I saw a girl with a telescope.", &ids).ok());
+    EXPECT_GT(sp.GetMemoryUsage().bytes("encode_cache"), 0);
+
+    // The arrays of a compiled model are used in place and not counted
+    // again.
+    ASSERT_TRUE(sp.SaveCompiledModel(prefix + ".compiled").ok());
+    SentencePieceProcessor compiled;
+    ASSERT_TRUE(compiled.Load(prefix + ".compiled").ok());
+    usage = compiled.GetMemoryUsage();
+    EXPECT_GT(usage.bytes("compiled_model"), 0);
+    EXPECT_EQ(0, usage.bytes("piece_ids"));
+    EXPECT_EQ(0, usage.bytes("user_defined_symbols"));
+    EXPECT_EQ(0, usage.bytes("unigram_trie"));
+  }
+}
+
+TEST(SentencePieceProcessorTest, CompiledModelTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  std::vector<std::string> lines;
+  {
+    auto file = filesystem::NewReadableFile(input);
+    std::string line;
+    while (lines.size() < 500 && file->ReadLine(&line)) lines.push_back(line);
+  }
+
+  for (const std::string type : {"unigram", "bpe"}) {
+    const std::string prefix =
+        util::JoinPath(::testing::TempDir(), absl::StrCat("compiled_", type));
+    ASSERT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                                 " --vocab_size=1000 --model_type=", type))
+                    .ok());
+
+    SentencePieceProcessor sp, compiled;
+    ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+    EXPECT_TRUE(sp.SaveCompiledModel(prefix + ".compiled").ok());
+    ASSERT_TRUE(compiled.Load(prefix + ".compiled").ok());
+    EXPECT_EQ(sp.serialized_model_proto(), compiled.serialized_model_proto());
+
+    for (int id = 0; id < sp.GetPieceSize(); ++id) {
+      EXPECT_EQ(id, compiled.PieceToId(sp.IdToPiece(id)));
+    }
+    EXPECT_EQ(sp.unk_id(), compiled.PieceToId("__not_a_piece__"));
+
+    for (const auto &line : lines) {
+      std::vector<int> ids, compiled_ids;
+      EXPECT_TRUE(sp.Encode(line, &ids).ok());
+      EXPECT_TRUE(compiled.Encode(line, &compiled_ids).ok());
+      EXPECT_EQ(ids, compiled_ids);
+      if (type != "unigram") continue;
+      std::vector<std::vector<int>> nbests, compiled_nbests;
+      EXPECT_TRUE(sp.NBestEncode(line, 4, &nbests).ok());
+      EXPECT_TRUE(compiled.NBestEncode(line, 4, &compiled_nbests).ok());
+      EXPECT_EQ(nbests, compiled_nbests);
+    }
+
+    SentencePieceProcessor huge;
+    huge.SetUseHugePages(true);
+    ASSERT_TRUE(huge.Load(prefix + ".compiled").ok());
+    for (const auto &line : lines) {
+      std::vector<int> ids, huge_ids;
+      EXPECT_TRUE(sp.Encode(line, &ids).ok());
+      EXPECT_TRUE(huge.Encode(line, &huge_ids).ok());
+      EXPECT_EQ(ids, huge_ids);
+    }
+
+    // The compiled model can be compiled again.
+    EXPECT_TRUE(compiled.SaveCompiledModel(prefix + ".compiled2").ok());
+    SentencePieceProcessor compiled2;
+    ASSERT_TRUE(compiled2.Load(prefix + ".compiled2").ok());
+    std::vector<int> ids, compiled_ids;
+    EXPECT_TRUE(sp.Encode(lines[0], &ids).ok());
+    EXPECT_TRUE(compiled2.Encode(lines[0], &compiled_ids).ok());
+    EXPECT_EQ(ids, compiled_ids);
+
+    // Used in place from a buffer.
+    std::string data;
+    {
+      auto file = filesystem::NewReadableFile(prefix + ".compiled", true);
+      ASSERT_TRUE(file->ReadAll(&data));
+    }
+    std::vector<uint64> buf(data.size() / sizeof(uint64) + 1);
+    memcpy(buf.data(), data.data(), data.size());
+    const char *base = reinterpret_cast<const char *>(buf.data());
+    SentencePieceProcessor in_place;
+    EXPECT_FALSE(
+        in_place.LoadFromCompiledArray(absl::string_view(base + 1, 100)).ok());
+    ASSERT_TRUE(
+        in_place.LoadFromCompiledArray(absl::string_view(base, data.size()))
+            .ok());
+    EXPECT_EQ(sp.serialized_model_proto(), in_place.serialized_model_proto());
+    for (const auto &line : lines) {
+      EXPECT_TRUE(sp.Encode(line, &ids).ok());
+      EXPECT_TRUE(in_place.Encode(line, &compiled_ids).ok());
+      EXPECT_EQ(ids, compiled_ids);
+    }
+  }
+
+  SentencePieceProcessor sp;
+  EXPECT_FALSE(sp.SaveCompiledModel(
+                     util::JoinPath(::testing::TempDir(), "not_loaded"))
+                   .ok());
+}
+
+TEST(SentencePieceProcessorTest, ShareModelTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, 0.0);
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "aa", 0.0);
+  AddPiece(&model_proto, WS "aa", 1.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor unloaded, view;
+  EXPECT_FALSE(view.ShareModel(unloaded).ok());
+
+  auto sp = std::make_unique<SentencePieceProcessor>();
+  EXPECT_TRUE(sp->Load(model_proto).ok());
+  EXPECT_TRUE(sp->SetEncodeExtraOptions("eos").ok());
+  EXPECT_TRUE(view.ShareModel(*sp).ok());
+  EXPECT_EQ(sp->GetPieceSize(), view.GetPieceSize());
+
+  // The extra options are not shared.
+  std::vector<int> ids;
+  EXPECT_TRUE(sp->Encode("aa aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({6, 6, 2}), ids);
+  EXPECT_TRUE(view.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({6, 6}), ids);
+  EXPECT_TRUE(view.SetEncodeExtraOptions("bos").ok());
+  EXPECT_TRUE(view.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 6, 6}), ids);
+  EXPECT_TRUE(sp->Encode("aa aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({6, 6, 2}), ids);
+
+  std::string text;
+  EXPECT_TRUE(view.Decode({6, 3, 4}, &text).ok());
+  EXPECT_EQ("aa a", text);
+
+  // Restricting the vocabulary of a view leaves the others intact.
+  EXPECT_TRUE(view.SetVocabulary({"aa"}).ok());
+  EXPECT_TRUE(view.Encode("aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 3, 5}), ids);
+  EXPECT_TRUE(sp->Encode("aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({6, 2}), ids);
+  EXPECT_FALSE(sp->IsUnused(6));
+  EXPECT_TRUE(view.IsUnused(6));
+  EXPECT_TRUE(view.ResetVocabulary().ok());
+  EXPECT_TRUE(view.Encode("aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 6}), ids);
+  EXPECT_TRUE(view.SetVocabulary({"aa"}).ok());
+
+  // The shared model outlives the processor it is loaded in.
+  SentencePieceProcessor view2;
+  EXPECT_TRUE(view2.ShareModel(*sp).ok());
+  sp.reset();
+  EXPECT_TRUE(view2.Encode("aa aa", &ids).ok());
+  EXPECT_EQ(std::vector<int>({6, 6}), ids);
+  EXPECT_TRUE(view2.Decode(ids, &text).ok());
+  EXPECT_EQ("aa aa", text);
+}
+
+TEST(ReloadableSentencePieceProcessorTest, ReloadTest) {
+  ModelProto model_a, model_b;
+  for (auto *model_proto : {&model_a, &model_b}) {
+    auto *sp1 = model_proto->add_pieces();
+    sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+    sp1->set_piece("<unk>");
+    AddPiece(model_proto, WS, 0.0);
+    AddPiece(model_proto, "a", 0.0);
+    *(model_proto->mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+  }
+  AddPiece(&model_b, WS "a", 1.0);  // 3
+
+  const std::string filename_a =
+      util::JoinPath(::testing::TempDir(), "reload_a.model");
+  const std::string filename_b =
+      util::JoinPath(::testing::TempDir(), "reload_b.model");
+  EXPECT_TRUE(io::SaveModelProto(filename_a, model_a).ok());
+  EXPECT_TRUE(io::SaveModelProto(filename_b, model_b).ok());
+
+  ReloadableSentencePieceProcessor sp;
+  std::vector<int> ids;
+  EXPECT_FALSE(sp.Get()->status().ok());
+  const uint64_t unloaded = sp.generation();
+
+  EXPECT_TRUE(sp.Load(filename_a).ok());
+  EXPECT_NE(unloaded, sp.generation());
+  const auto snapshot_a = sp.Get();
+  EXPECT_EQ(snapshot_a, sp.Get());
+  EXPECT_TRUE(snapshot_a->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 2}), ids);
+
+  // The failed load keeps the current snapshot.
+  const uint64_t generation_a = sp.generation();
+  EXPECT_FALSE(sp.Load(filename_a + ".not_found").ok());
+  EXPECT_EQ(generation_a, sp.generation());
+  EXPECT_EQ(snapshot_a, sp.Get());
+  EXPECT_FALSE(sp.Publish(nullptr).ok());
+
+  // The previous snapshot stays usable after a reload.
+  EXPECT_TRUE(sp.Load(filename_b).ok());
+  EXPECT_TRUE(sp.Get()->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({3}), ids);
+  EXPECT_TRUE(snapshot_a->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 2}), ids);
+
+  // Another instance has its own snapshot.
+  ReloadableSentencePieceProcessor other;
+  EXPECT_TRUE(other.Load(filename_a).ok());
+  EXPECT_TRUE(other.Get()->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 2}), ids);
+  EXPECT_TRUE(sp.Get()->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({3}), ids);
+
+  EXPECT_EQ(1, sp.num_replicas());
+
+  // Replicas per NUMA node, if the host has several.
+  ReloadableSentencePieceProcessor replicated;
+  replicated.SetReplicatePerNumaNode(true);
+  EXPECT_TRUE(replicated.Load(filename_b).ok());
+  EXPECT_LE(1, replicated.num_replicas());
+  EXPECT_TRUE(replicated.Get()->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({3}), ids);
+  EXPECT_FALSE(replicated.Load(filename_b + ".not_found").ok());
+  EXPECT_TRUE(replicated.Get()->Encode("a", &ids).ok());
+  EXPECT_EQ(std::vector<int>({3}), ids);
+
+  // Reloads while other threads encode.
+  std::atomic<bool> done(false);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  for (int n = 0; n < 4; ++n) {
+    threads.emplace_back([&]() {
+      std::vector<int> ids;
+      while (!done.load()) {
+        if (!sp.Get()->Encode("a a", &ids).ok() ||
+            (ids != std::vector<int>({1, 2, 1, 2}) &&
+             ids != std::vector<int>({3, 3}))) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(sp.Load(i % 2 == 0 ? filename_a : filename_b).ok());
+  }
+  done = true;
+  for (auto &thread : threads) thread.join();
+  EXPECT_EQ(0, failures.load());
+}
+
+TEST(SentencePieceProcessorTest, SampleEncodeBatchTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "aa", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "aa", -2.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 200; ++i) {
+    texts.emplace_back(std::string(i % 7 + 1, 'a') + " " +
+                       std::string(i % 5 + 2, 'a'));
+  }
+  const std::vector<absl::string_view> inputs(texts.begin(), texts.end());
+
+  const std::mt19937 caller_generator = *random::GetRandomGenerator();
+
+  std::vector<std::vector<int>> expected, actual;
+  EXPECT_TRUE(sp.SampleEncodeBatch(inputs, -1, 0.5, 1234, 1, &expected).ok());
+  EXPECT_EQ(inputs.size(), expected.size());
+  for (int num_threads : {2, 3, 8}) {
+    EXPECT_TRUE(sp.SampleEncodeBatch(inputs, -1, 0.5, 1234, num_threads,
+                                     &actual)
+                    .ok());
+    EXPECT_EQ(expected, actual);
+  }
+
+  // The i-th stream is seeded by the seed and i alone.
+  for (size_t i : {0, 17, 199}) {
+    random::GetRandomGenerator()->seed(random::GetStreamSeed(1234, i));
+    std::vector<int> ids;
+    EXPECT_TRUE(sp.SampleEncode(inputs[i], -1, 0.5, &ids).ok());
+    EXPECT_EQ(expected[i], ids);
+  }
+  *random::GetRandomGenerator() = caller_generator;
+
+  // Another seed re-samples the batch.
+  EXPECT_TRUE(sp.SampleEncodeBatch(inputs, -1, 0.5, 5678, 4, &actual).ok());
+  EXPECT_NE(expected, actual);
+  EXPECT_TRUE(*random::GetRandomGenerator() == caller_generator);
+
+  std::vector<std::vector<std::string>> pieces;
+  EXPECT_TRUE(sp.SampleEncodeBatch(inputs, 4, 0.5, 1234, 2, &pieces).ok());
+  EXPECT_EQ(inputs.size(), pieces.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    EXPECT_EQ(WS + texts[i].replace(texts[i].find(' '), 1, WS),
+              absl::StrJoin(pieces[i], ""));
+  }
+
+  EXPECT_FALSE(sp.SampleEncodeBatch(inputs, -1, 0.5, 1234, 0, &actual).ok());
+}
+
+TEST(SentencePieceProcessorTest, SampleGeneratorTest) {
+  for (const auto type : {TrainerSpec::UNIGRAM, TrainerSpec::BPE}) {
+    ModelProto model_proto;
+    auto *sp1 = model_proto.add_pieces();
+    auto *sp2 = model_proto.add_pieces();
+    auto *sp3 = model_proto.add_pieces();
+
+    sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+    sp1->set_piece("<unk>");
+    sp2->set_type(ModelProto::SentencePiece::CONTROL);
+    sp2->set_piece("<s>");
+    sp3->set_type(ModelProto::SentencePiece::CONTROL);
+    sp3->set_piece("</s>");
+
+    AddPiece(&model_proto, WS, -1.0);
+    AddPiece(&model_proto, "a", -1.0);
+    AddPiece(&model_proto, "aa", -1.5);
+    AddPiece(&model_proto, WS "a", -1.5);
+    AddPiece(&model_proto, WS "aa", -2.0);
+
+    model_proto.mutable_trainer_spec()->set_model_type(type);
+    *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(model_proto).ok());
+
+    const std::mt19937 thread_generator = *random::GetRandomGenerator();
+    const std::string text = "aaaaaa aaaaa aaaa";
+    for (const int nbest_size : {-1, 4}) {
+      // The samples only depend on the seed of the generator.
+      SampleGenerator generator1(1234), generator2(1234), generator3(5678);
+      std::vector<std::vector<int>> samples1, samples2, samples3;
+      for (int n = 0; n < 20; ++n) {
+        std::vector<int> ids;
+        EXPECT_TRUE(
+            sp.SampleEncode(text, nbest_size, 0.5, &generator1, &ids).ok());
+        samples1.push_back(ids);
+        ids.clear();
+        EXPECT_TRUE(
+            sp.SampleEncode(text, nbest_size, 0.5, &generator2, &ids).ok());
+        samples2.push_back(ids);
+        std::vector<std::string> pieces;
+        EXPECT_TRUE(
+            sp.SampleEncode(text, nbest_size, 0.5, &generator3, &pieces)
+                .ok());
+        EXPECT_EQ(WS "aaaaaa" WS "aaaaa" WS "aaaa", absl::StrJoin(pieces, ""));
+        ids.clear();
+        for (const auto &piece : pieces) ids.push_back(sp.PieceToId(piece));
+        samples3.push_back(ids);
+      }
+      EXPECT_EQ(samples1, samples2);
+      EXPECT_NE(samples1, samples3);
+      // The samples differ from one another.
+      EXPECT_NE(samples1, std::vector<std::vector<int>>(20, samples1[0]));
+    }
+    EXPECT_TRUE(*random::GetRandomGenerator() == thread_generator);
+
+    std::vector<int> ids;
+    EXPECT_FALSE(sp.SampleEncode(text, -1, 0.5, nullptr, &ids).ok());
+  }
+}
+
+TEST(SentencePieceProcessorTest, SampleEncodeAndScoreBatchTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "aa", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "aa", -2.0);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("bos:eos").ok());
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 100; ++i) {
+    texts.emplace_back(std::string(i % 7 + 1, 'a') + " " +
+                       std::string(i % 5 + 2, 'a'));
+  }
+  const std::vector<absl::string_view> inputs(texts.begin(), texts.end());
+
+  std::vector<float> entropies;
+  EXPECT_TRUE(sp.CalculateEntropyBatch(inputs, 0.5, 3, &entropies).ok());
+  EXPECT_EQ(inputs.size(), entropies.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    float entropy = 0.0;
+    EXPECT_TRUE(sp.CalculateEntropy(inputs[i], 0.5, &entropy).ok());
+    EXPECT_EQ(entropy, entropies[i]);
+  }
+  EXPECT_FALSE(sp.CalculateEntropyBatch(inputs, 0.5, 0, &entropies).ok());
+
+  const std::mt19937 caller_generator = *random::GetRandomGenerator();
+
+  for (const bool wor : {false, true}) {
+    BatchSampleResult expected, actual;
+    EXPECT_TRUE(
+        sp.SampleEncodeAndScoreBatch(inputs, 3, 0.5, wor, wor, 1234, 1,
+                                     &expected)
+            .ok());
+    EXPECT_EQ(inputs.size(), expected.size());
+    EXPECT_EQ(expected.scores().size() + 1, expected.id_offsets().size());
+    for (int num_threads : {2, 8}) {
+      EXPECT_TRUE(sp.SampleEncodeAndScoreBatch(inputs, 3, 0.5, wor, wor, 1234,
+                                               num_threads, &actual)
+                      .ok());
+      EXPECT_EQ(expected.ids(), actual.ids());
+      EXPECT_EQ(expected.id_offsets(), actual.id_offsets());
+      EXPECT_EQ(expected.scores(), actual.scores());
+      EXPECT_EQ(expected.sample_offsets(), actual.sample_offsets());
+    }
+
+    // The samples of i are the ones of SampleEncodeAndScore() on the i-th
+    // stream.
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      random::GetRandomGenerator()->seed(random::GetStreamSeed(1234, i));
+      std::vector<std::pair<std::vector<int>, float>> samples;
+      EXPECT_TRUE(sp.SampleEncodeAndScore(inputs[i], 3, 0.5, wor, wor,
+                                          &samples)
+                      .ok());
+      const auto &offsets = expected.sample_offsets();
+      EXPECT_EQ(samples.size(), offsets[i + 1] - offsets[i]);
+      for (size_t k = 0; k < samples.size(); ++k) {
+        const size_t j = offsets[i] + k;
+        const std::vector<int> ids(
+            expected.ids().begin() + expected.id_offsets()[j],
+            expected.ids().begin() + expected.id_offsets()[j + 1]);
+        EXPECT_EQ(samples[k].first, ids);
+        EXPECT_EQ(samples[k].second, expected.scores()[j]);
+      }
+    }
+    *random::GetRandomGenerator() = caller_generator;
+  }
+
+  BatchSampleResult result;
+  EXPECT_TRUE(sp.SampleEncodeAndScoreBatch(inputs, 3, 0.5, false, false, 1234,
+                                           4, &result)
+                  .ok());
+  EXPECT_TRUE(*random::GetRandomGenerator() == caller_generator);
+  EXPECT_FALSE(sp.SampleEncodeAndScoreBatch(inputs, 3, 0.5, false, false,
+                                            1234, 0, &result)
+                   .ok());
+
+  // The inputs are cut to max_input_bytes as those of Encode().
+  EXPECT_TRUE(sp.SetEncodeLimits(0, 3).ok());
+  EXPECT_TRUE(sp.SampleEncodeAndScoreBatch(inputs, 3, 0.5, false, false, 1234,
+                                           4, &result)
+                  .ok());
+  std::vector<absl::string_view> cut;
+  for (const auto input : inputs) cut.push_back(input.substr(0, 3));
+  BatchSampleResult expected;
+  EXPECT_TRUE(sp.SetEncodeLimits(0, 0).ok());
+  EXPECT_TRUE(sp.SampleEncodeAndScoreBatch(cut, 3, 0.5, false, false, 1234, 4,
+                                           &expected)
+                  .ok());
+  EXPECT_EQ(expected.ids(), result.ids());
+  EXPECT_EQ(expected.id_offsets(), result.id_offsets());
+}
+
+TEST(SentencePieceProcessorTest, EncodeBatchTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, "ab", -1.5);
+  for (int c = 0; c < 256; ++c) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_type(ModelProto::SentencePiece::BYTE);
+    sp->set_piece(ByteToPiece(c));
+  }
+  model_proto.mutable_trainer_spec()->set_byte_fallback(true);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  // "c" and "あ" fall back to bytes. A few long inputs make chunks of
+  // their own, which run before the shorter ones.
+  const char *kChars[] = {"a", "b", " ", "c", "\xE3\x81\x82"};
+  std::vector<std::string> texts;
+  for (int i = 0; i < 300; ++i) {
+    std::string text;
+    const int size = i % 50 == 7 ? 3000 : rand() % 12;
+    for (int j = 0; j < size; ++j) text += kChars[rand() % 5];
+    texts.emplace_back(text);
+  }
+  const std::vector<absl::string_view> inputs(texts.begin(), texts.end());
+
+  // The same result is reused for all the batches.
+  BatchEncodeResult result;
+  for (const auto *extra_options : {"", "bos:eos:reverse"}) {
+    EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+    for (const int num_threads : {1, 3}) {
+      for (const bool with_pieces : {false, true}) {
+        for (const bool with_alignment : {false, true}) {
+          EXPECT_TRUE(sp.EncodeBatch(inputs, num_threads, with_pieces,
+                                     with_alignment, &result)
+                          .ok());
+          EXPECT_EQ(inputs.size(), result.size());
+          EXPECT_EQ(inputs.size() + 1, result.offsets().size());
+          EXPECT_EQ(result.ids().size(), result.offsets().back());
+          EXPECT_EQ(with_pieces ? result.ids().size() + 1 : 0,
+                    result.piece_offsets().size());
+          EXPECT_EQ(with_alignment ? result.ids().size() : 0,
+                    result.begins().size());
+          EXPECT_EQ(result.begins().size(), result.ends().size());
+          for (size_t i = 0; i < inputs.size(); ++i) {
+            SentencePieceText spt;
+            EXPECT_TRUE(sp.Encode(inputs[i], &spt).ok());
+            const size_t offset = result.offsets()[i];
+            EXPECT_EQ(spt.pieces_size(), result.offsets()[i + 1] - offset);
+            for (int k = 0; k < spt.pieces_size(); ++k) {
+              const size_t j = offset + k;
+              EXPECT_EQ(spt.pieces(k).id(), result.ids()[j]);
+              if (with_pieces) {
+                EXPECT_EQ(spt.pieces(k).piece(), result.piece(j));
+              }
+              if (with_alignment) {
+                EXPECT_EQ(spt.pieces(k).begin(), result.begins()[j]);
+                EXPECT_EQ(spt.pieces(k).end(), result.ends()[j]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<int> ids;
+  EXPECT_TRUE(sp.Encode("ab c", &ids).ok());
+  EXPECT_TRUE(sp.EncodeBatch({"ab c"}, 1, false, false, &result).ok());
+  EXPECT_EQ(ids, result.ids());
+
+  EXPECT_TRUE(sp.EncodeBatch({}, 2, true, true, &result).ok());
+  EXPECT_EQ(0, result.size());
+  EXPECT_TRUE(result.ids().empty());
+
+  EXPECT_FALSE(sp.EncodeBatch(inputs, 0, false, false, &result).ok());
+  EXPECT_FALSE(sp.EncodeBatch(inputs, 1, false, false, nullptr).ok());
+}
+
+TEST(SentencePieceProcessorTest, BatchTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, "ab", -1.5);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  // Long enough to be split into several chunks, with a few long inputs.
+  const char *kChars[] = {"a", "b", " ", "c"};
+  std::vector<std::string> texts;
+  for (int i = 0; i < 2000; ++i) {
+    std::string text;
+    const int size = i % 100 == 0 ? 3000 : rand() % 30;
+    for (int j = 0; j < size; ++j) text += kChars[rand() % 4];
+    texts.emplace_back(text);
+  }
+  const std::vector<absl::string_view> inputs(texts.begin(), texts.end());
+
+  for (const int num_threads : {1, 4}) {
+    std::vector<std::vector<int>> ids;
+    std::vector<std::vector<std::string>> pieces;
+    EXPECT_TRUE(sp.EncodeBatch(inputs, num_threads, &ids).ok());
+    EXPECT_TRUE(sp.EncodeBatch(inputs, num_threads, &pieces).ok());
+    EXPECT_EQ(inputs.size(), ids.size());
+    EXPECT_EQ(inputs.size(), pieces.size());
+
+    std::vector<std::string> from_ids, from_pieces;
+    EXPECT_TRUE(sp.DecodeBatch(ids, num_threads, &from_ids).ok());
+    EXPECT_TRUE(sp.DecodeBatch(pieces, num_threads, &from_pieces).ok());
+
+    std::vector<std::vector<std::vector<int>>> nbest_ids;
+    EXPECT_TRUE(sp.NBestEncodeBatch(inputs, 2, num_threads, &nbest_ids).ok());
+    EXPECT_EQ(inputs.size(), nbest_ids.size());
+
+    std::vector<ImmutableSentencePieceText> spts;
+    std::vector<ImmutableNBestSentencePieceText> nbest_spts;
+    EXPECT_TRUE(sp.EncodeBatch(inputs, num_threads, &spts).ok());
+    EXPECT_TRUE(sp.NBestEncodeBatch(inputs, 2, num_threads, &nbest_spts).ok());
+    EXPECT_EQ(inputs.size(), spts.size());
+    EXPECT_EQ(inputs.size(), nbest_spts.size());
+
+    for (size_t i = 0; i < inputs.size(); i += 7) {
+      std::vector<int> expected_ids;
+      std::vector<std::string> expected_pieces;
+      std::string expected_text, expected_text_from_pieces;
+      std::vector<std::vector<int>> expected_nbest;
+      EXPECT_TRUE(sp.Encode(inputs[i], &expected_ids).ok());
+      EXPECT_TRUE(sp.Encode(inputs[i], &expected_pieces).ok());
+      EXPECT_TRUE(sp.Decode(expected_ids, &expected_text).ok());
+      EXPECT_TRUE(
+          sp.Decode(expected_pieces, &expected_text_from_pieces).ok());
+      EXPECT_TRUE(sp.NBestEncode(inputs[i], 2, &expected_nbest).ok());
+      EXPECT_EQ(expected_ids, ids[i]);
+      EXPECT_EQ(expected_pieces, pieces[i]);
+      EXPECT_EQ(expected_text, from_ids[i]);
+      EXPECT_EQ(expected_text_from_pieces, from_pieces[i]);
+      EXPECT_EQ(expected_nbest, nbest_ids[i]);
+      EXPECT_EQ(sp.EncodeAsSerializedProto(inputs[i]),
+                spts[i].SerializeAsString());
+      EXPECT_EQ(sp.NBestEncodeAsSerializedProto(inputs[i], 2),
+                nbest_spts[i].SerializeAsString());
+    }
+  }
+
+  // The copies of the protos on an arena keep it alive.
+  ImmutableSentencePieceText spt;
+  {
+    auto arena = std::make_shared<google::protobuf::Arena>();
+    ImmutableSentencePieceText on_arena(arena);
+    EXPECT_TRUE(sp.Encode("ab a", on_arena.mutable_proto()).ok());
+    EXPECT_EQ(arena.get(), on_arena.mutable_proto()->GetArena());
+    spt = on_arena;
+  }
+  EXPECT_EQ("ab a", spt.text());
+  EXPECT_EQ(sp.EncodeAsSerializedProto("ab a"), spt.SerializeAsString());
+
+  // The outputs are replaced.
+  std::vector<std::vector<int>> ids = {{1, 2}};
+  EXPECT_TRUE(sp.EncodeBatch({}, 2, &ids).ok());
+  EXPECT_TRUE(ids.empty());
+
+  // Returns the error of an invalid id.
+  std::vector<std::string> texts_out;
+  const std::vector<std::vector<int>> invalid_ids = {{4}, {100}};
+  EXPECT_FALSE(sp.DecodeBatch(invalid_ids, 2, &texts_out).ok());
+  EXPECT_FALSE(sp.EncodeBatch(inputs, 0, &ids).ok());
+}
+
+TEST(SentencePieceProcessorTest, StreamingEncoderTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, "ab", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "ab", -1.75);
+  AddPiece(&model_proto, "bab", -2.25);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const std::vector<std::string> kWords = {"a", "ab", "bab", "x", "abba", " ",
+                                           "  "};
+  auto encode_in_chunks = [&sp](const std::string &document,
+                                size_t *max_buffered_size) {
+    StreamingEncoder encoder(sp);
+    std::vector<std::string> pieces;
+    *max_buffered_size = 0;
+    for (size_t begin = 0; begin < document.size();) {
+      const size_t size = rand() % 20 + 1;
+      EXPECT_TRUE(encoder.Feed(document.substr(begin, size), &pieces).ok());
+      *max_buffered_size =
+          std::max(*max_buffered_size, encoder.buffered_size());
+      begin += size;
+    }
+    EXPECT_TRUE(encoder.Finish(&pieces).ok());
+    EXPECT_EQ(0, encoder.buffered_size());
+    return pieces;
+  };
+
+  for (const auto *extra_options : {"", "bos:eos", "reverse:bos"}) {
+    EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+    for (int trial = 0; trial < 100; ++trial) {
+      std::string document;
+      for (int i = 0; i < 200; ++i) {
+        document += kWords[rand() % kWords.size()];
+        document += ' ';
+      }
+      std::vector<std::string> expected;
+      EXPECT_TRUE(sp.Encode(document, &expected).ok());
+      size_t max_buffered_size = 0;
+      EXPECT_EQ(expected, encode_in_chunks(document, &max_buffered_size));
+      // Only the last word and chunk are kept, unless reversed.
+      if (std::string(extra_options) == "reverse:bos") {
+        EXPECT_EQ(document.size(), max_buffered_size);
+      } else {
+        EXPECT_LT(max_buffered_size, 40);
+      }
+    }
+  }
+
+  // An empty document gets BOS and EOS like Encode("").
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("bos:eos").ok());
+  StreamingEncoder encoder(sp);
+  std::vector<int> ids;
+  EXPECT_TRUE(encoder.Finish(&ids).ok());
+  EXPECT_EQ(std::vector<int>({1, 2}), ids);
+
+  // A piece across words makes the encoder keep the whole document.
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
+  AddPiece(&model_proto, "a" WS "a", -1.0);
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  const std::string document = "a a b a a ab a a";
+  std::vector<std::string> expected;
+  EXPECT_TRUE(sp.Encode(document, &expected).ok());
+  size_t max_buffered_size = 0;
+  EXPECT_EQ(expected, encode_in_chunks(document, &max_buffered_size));
+  EXPECT_EQ(document.size(), max_buffered_size);
+}
+
+TEST(SentencePieceProcessorTest, PrefixEncoderTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, "ab", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "ab", -1.75);
+  AddPiece(&model_proto, "bab", -2.25);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const std::vector<std::string> kWords = {"a", "ab", "bab", "x", "abba", " ",
+                                           "  "};
+  auto random_text = [&kWords](int num_words) {
+    std::string text;
+    for (int i = 0; i < num_words; ++i) {
+      text += kWords[rand() % kWords.size()];
+      text += ' ';
+    }
+    return text;
+  };
+
+  // The prefix is empty until it is set.
+  PrefixEncoder encoder(sp);
+  std::vector<int> ids;
+  EXPECT_TRUE(encoder.Encode("ab a", &ids).ok());
+  EXPECT_EQ(sp.EncodeAsIds("ab a"), ids);
+
+  for (const auto *extra_options : {"", "bos:eos"}) {
+    EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+    for (int trial = 0; trial < 20; ++trial) {
+      const std::string prefix = random_text(100);
+      EXPECT_TRUE(encoder.SetPrefix(prefix).ok());
+      // Only the last word of the prefix is encoded again.
+      EXPECT_LT(encoder.uncached_size(), 10);
+      for (int n = 0; n < 10; ++n) {
+        const std::string suffix = random_text(rand() % 10);
+        std::vector<std::string> pieces;
+        EXPECT_TRUE(encoder.Encode(suffix, &pieces).ok());
+        EXPECT_EQ(sp.EncodeAsPieces(prefix + suffix), pieces);
+        EXPECT_TRUE(encoder.Encode(suffix, &ids).ok());
+        EXPECT_EQ(sp.EncodeAsIds(prefix + suffix), ids);
+      }
+    }
+  }
+
+  // A piece across words makes the encoder keep the whole prefix.
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
+  AddPiece(&model_proto, "a" WS "a", -1.0);
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  PrefixEncoder whole(sp);
+  EXPECT_TRUE(whole.SetPrefix("a a b a").ok());
+  EXPECT_EQ(7, whole.uncached_size());
+  EXPECT_TRUE(whole.Encode(" a ab", &ids).ok());
+  EXPECT_EQ(sp.EncodeAsIds("a a b a a ab"), ids);
+}
+
+TEST(SentencePieceProcessorTest, IncrementalEncoderTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, "ab", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "ab", -1.75);
+  AddPiece(&model_proto, "bab", -2.25);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  // The extra options do not apply.
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("bos:eos").ok());
+  SentencePieceProcessor full;
+  EXPECT_TRUE(full.Load(model_proto).ok());
+
+  const std::vector<std::string> kWords = {
+      "a", "ab", "bab", "x", "xx", "ab\xC3\xA9", " ", "  ", "b\xC3\xA9" "a"};
+  auto random_text = [&kWords](int num_words) {
+    std::string text;
+    for (int i = 0; i < num_words; ++i) text += kWords[rand() % kWords.size()];
+    return text;
+  };
+  // Returns a random position at a character boundary.
+  auto random_pos = [](const std::string &text) {
+    size_t pos = rand() % (text.size() + 1);
+    while (pos < text.size() && (text[pos] & 0xC0) == 0x80) --pos;
+    return pos;
+  };
+  auto expect_encoded = [&full](const IncrementalEncoder &encoder) {
+    std::vector<int> ids;
+    std::vector<uint32_t> begins, ends;
+    EXPECT_TRUE(
+        full.EncodeWithOffsets(encoder.text(), false, &ids, &begins, &ends)
+            .ok());
+    EXPECT_EQ(ids, encoder.ids());
+    EXPECT_EQ(begins, encoder.begins());
+    EXPECT_EQ(ends, encoder.ends());
+  };
+
+  for (int trial = 0; trial < 20; ++trial) {
+    IncrementalEncoder encoder(sp);
+    EXPECT_TRUE(encoder.Reset(random_text(trial * 20)).ok());
+    expect_encoded(encoder);
+    for (int edit = 0; edit < 50; ++edit) {
+      const std::string &text = encoder.text();
+      size_t begin = random_pos(text), end = random_pos(text);
+      if (begin > end) std::swap(begin, end);
+      if (end - begin > 10) end = begin;
+      EXPECT_TRUE(encoder.Replace(begin, end, random_text(rand() % 3)).ok());
+      expect_encoded(encoder);
+    }
+  }
+
+  // An edit of a long document only encodes the words around it.
+  IncrementalEncoder encoder(sp);
+  std::string document;
+  for (int i = 0; i < 1000; ++i) document += "ab bab ";
+  EXPECT_TRUE(encoder.Reset(document).ok());
+  EXPECT_EQ(document.size(), encoder.encoded_size());
+  EXPECT_TRUE(encoder.Replace(3500, 3501, "x a").ok());
+  expect_encoded(encoder);
+  EXPECT_LT(encoder.encoded_size(), 20);
+  EXPECT_FALSE(encoder.Replace(10, 5, "").ok());
+  EXPECT_FALSE(encoder.Replace(0, encoder.text().size() + 1, "").ok());
+
+  // A piece across words makes the encoder encode the whole document.
+  AddPiece(&model_proto, "a" WS "a", -1.0);
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  EXPECT_TRUE(full.Load(model_proto).ok());
+  IncrementalEncoder whole(sp);
+  EXPECT_TRUE(whole.Reset("a a b a a ab a a").ok());
+  EXPECT_TRUE(whole.Replace(4, 5, "a").ok());
+  expect_encoded(whole);
+  EXPECT_EQ(whole.text().size(), whole.encoded_size());
+}
+
+TEST(SentencePieceProcessorTest, EncodeLimitsTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, "ab", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "ab", -1.75);
+  AddPiece(&model_proto, "bab", -2.25);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor unloaded;
+  EXPECT_FALSE(unloaded.SetEncodeLimits(10, 0).ok());
+
+  SentencePieceProcessor full, sp;
+  EXPECT_TRUE(full.Load(model_proto).ok());
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const std::vector<std::string> kWords = {"a", "ab", "bab", "x", "abba", " "};
+  std::vector<std::string> documents = {"", "ab", "  ab  "};
+  for (int trial = 0; trial < 20; ++trial) {
+    std::string document;
+    for (int i = 0; i < 200; ++i) {
+      document += kWords[rand() % kWords.size()];
+      document += ' ';
+    }
+    documents.push_back(document);
+  }
+
+  for (const auto *extra_options : {"", "bos:eos", "reverse:bos"}) {
+    EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+    for (const size_t max_tokens : {1, 5, 50, 100000}) {
+      EXPECT_TRUE(sp.SetEncodeLimits(max_tokens, 0).ok());
+      std::vector<std::vector<int>> expected_ids;
+      for (const auto &document : documents) {
+        // The first pieces of the whole document, then the extra options.
+        std::vector<std::string> expected;
+        EXPECT_TRUE(full.Encode(document, &expected).ok());
+        if (expected.size() > max_tokens) expected.resize(max_tokens);
+        if (std::string(extra_options) == "bos:eos") {
+          expected.insert(expected.begin(), "<s>");
+          expected.push_back("</s>");
+        } else if (std::string(extra_options) == "reverse:bos") {
+          std::reverse(expected.begin(), expected.end());
+          expected.insert(expected.begin(), "<s>");
+        }
+
+        std::vector<std::string> pieces;
+        EXPECT_TRUE(sp.Encode(document, &pieces).ok());
+        EXPECT_EQ(expected, pieces);
+        SentencePieceText spt;
+        EXPECT_TRUE(sp.Encode(document, &spt).ok());
+        std::vector<int> ids;
+        EXPECT_EQ(expected.size(), spt.pieces_size());
+        for (int i = 0; i < spt.pieces_size(); ++i) {
+          EXPECT_EQ(expected[i], spt.pieces(i).piece());
+          ids.push_back(spt.pieces(i).id());
+        }
+        std::vector<int> encoded_ids;
+        EXPECT_TRUE(sp.Encode(document, &encoded_ids).ok());
+        EXPECT_EQ(ids, encoded_ids);
+        expected_ids.push_back(ids);
+      }
+
+      std::vector<absl::string_view> inputs(documents.begin(),
+                                            documents.end());
+      std::vector<std::vector<int>> ids;
+      EXPECT_TRUE(sp.EncodeBatch(inputs, 2, &ids).ok());
+      EXPECT_EQ(expected_ids, ids);
+      std::vector<size_t> num_tokens;
+      EXPECT_TRUE(sp.CountTokensBatch(inputs, 2, &num_tokens).ok());
+      EXPECT_EQ(expected_ids.size(), num_tokens.size());
+      for (size_t i = 0; i < expected_ids.size(); ++i) {
+        EXPECT_EQ(expected_ids[i].size(), num_tokens[i]);
+      }
+    }
+  }
+
+  // Only a prefix of a long document is segmented.
+  EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
+  EXPECT_TRUE(sp.SetEncodeLimits(5, 0).ok());
+  EXPECT_TRUE(sp.SetEncodeCacheCapacity(100).ok());
+  std::vector<int> ids;
+  EXPECT_TRUE(sp.Encode(documents.back(), &ids).ok());
+  EXPECT_EQ(5, ids.size());
+  int64_t hits = 0, misses = 0;
+  EXPECT_TRUE(sp.GetEncodeCacheStats(&hits, &misses).ok());
+  EXPECT_LT(hits + misses, 50);
+  EXPECT_TRUE(sp.SetEncodeCacheCapacity(0).ok());
+
+  // The input is cut at a character boundary.
+  EXPECT_TRUE(sp.SetEncodeLimits(0, 3).ok());
+  std::vector<std::string> pieces, expected;
+  EXPECT_TRUE(sp.Encode("ab\xC3\xA9", &pieces).ok());
+  EXPECT_TRUE(full.Encode("ab", &expected).ok());
+  EXPECT_EQ(expected, pieces);
+  EXPECT_TRUE(sp.SetEncodeLimits(0, 4).ok());
+  EXPECT_TRUE(sp.Encode("ab\xC3\xA9", &pieces).ok());
+  EXPECT_TRUE(full.Encode("ab\xC3\xA9", &expected).ok());
+  EXPECT_EQ(expected, pieces);
+
+  // Disabled.
+  EXPECT_TRUE(sp.SetEncodeLimits(0, 0).ok());
+  EXPECT_TRUE(sp.Encode(documents.back(), &pieces).ok());
+  EXPECT_TRUE(full.Encode(documents.back(), &expected).ok());
+  EXPECT_EQ(expected, pieces);
+
+  // A processor sharing the model has no limits.
+  EXPECT_TRUE(sp.SetEncodeLimits(1, 0).ok());
+  SentencePieceProcessor shared;
+  EXPECT_TRUE(shared.ShareModel(sp).ok());
+  EXPECT_TRUE(shared.Encode(documents.back(), &pieces).ok());
+  EXPECT_EQ(expected, pieces);
+}
+
+
+TEST(SentencePieceProcessorTest, ParallelEncodeTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -1.0);
+  AddPiece(&model_proto, "ab", -1.5);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, WS "ab", -1.75);
+  AddPiece(&model_proto, "bab", -2.25);
+
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor full, sp;
+  EXPECT_TRUE(full.Load(model_proto).ok());
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  EXPECT_FALSE(sp.SetParallelEncode(16, 0).ok());
+
+  // Unknown and multi-byte characters, and runs of whitespaces.
+  const std::vector<std::string> kWords = {
+      "a", "ab", "bab", "x", "ab\xC3\xA9", "  ", "\xC3\xA9" "b"};
+  std::vector<std::string> documents = {"", "ab", "  ab  "};
+  for (int trial = 0; trial < 10; ++trial) {
+    std::string document;
+    for (int i = 0; i < 300; ++i) {
+      document += kWords[rand() % kWords.size()];
+      document += ' ';
+    }
+    documents.push_back(document);
+  }
+
+  for (const auto *extra_options : {"", "bos:eos", "reverse:bos"}) {
+    EXPECT_TRUE(full.SetEncodeExtraOptions(extra_options).ok());
+    EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+    for (const size_t chunk_bytes : {1, 7, 64, 100000}) {
+      EXPECT_TRUE(sp.SetParallelEncode(chunk_bytes, 4).ok());
+      for (const auto &document : documents) {
+        std::vector<int> expected_ids, ids;
+        EXPECT_TRUE(full.Encode(document, &expected_ids).ok());
+        EXPECT_TRUE(sp.Encode(document, &ids).ok());
+        EXPECT_EQ(expected_ids, ids);
+
+        std::vector<std::string> expected_pieces, pieces;
+        EXPECT_TRUE(full.Encode(document, &expected_pieces).ok());
+        EXPECT_TRUE(sp.Encode(document, &pieces).ok());
+        EXPECT_EQ(expected_pieces, pieces);
+
+        SentencePieceText expected_spt, spt;
+        EXPECT_TRUE(full.Encode(document, &expected_spt).ok());
+        EXPECT_TRUE(sp.Encode(document, &spt).ok());
+        EXPECT_EQ(expected_spt.SerializeAsString(), spt.SerializeAsString());
+
+        for (const bool unicode_offsets : {false, true}) {
+          std::vector<uint32_t> expected_begins, expected_ends, begins, ends;
+          EXPECT_TRUE(full.EncodeWithOffsets(document, unicode_offsets,
+                                             &expected_ids, &expected_begins,
+                                             &expected_ends)
+                          .ok());
+          EXPECT_TRUE(sp.EncodeWithOffsets(document, unicode_offsets, &ids,
+                                           &begins, &ends)
+                          .ok());
+          EXPECT_EQ(expected_ids, ids);
+          EXPECT_EQ(expected_begins, begins);
+          EXPECT_EQ(expected_ends, ends);
+        }
+
+        size_t num_tokens = 0;
+        EXPECT_TRUE(sp.CountTokens(document, &num_tokens).ok());
+        EXPECT_EQ(expected_ids.size(), num_tokens);
+      }
+    }
+  }
+
+  // Disabled, and not available when a piece may cross a whitespace.
+  EXPECT_TRUE(sp.SetParallelEncode(0, 1).ok());
+  model_proto.mutable_normalizer_spec()->set_remove_extra_whitespaces(false);
+  SentencePieceProcessor uncut;
+  EXPECT_TRUE(uncut.Load(model_proto).ok());
+  EXPECT_EQ(util::StatusCode::kFailedPrecondition,
+            uncut.SetParallelEncode(16, 4).code());
+}
+TEST(SentencePieceProcessorTest, EncodeWithoutAlignmentTest) {
+  for (const bool byte_fallback : {false, true}) {
+    ModelProto model_proto;
+    auto *sp1 = model_proto.add_pieces();
+    auto *sp2 = model_proto.add_pieces();
+    auto *sp3 = model_proto.add_pieces();
+
+    sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+    sp1->set_piece("<unk>");
+    sp2->set_type(ModelProto::SentencePiece::CONTROL);
+    sp2->set_piece("<s>");
+    sp3->set_type(ModelProto::SentencePiece::CONTROL);
+    sp3->set_piece("</s>");
+
+    AddPiece(&model_proto, WS, -1.0);
+    AddPiece(&model_proto, "a", -1.0);
+    AddPiece(&model_proto, "b", -1.0);
+    AddPiece(&model_proto, "ab", -1.5);
+    AddPiece(&model_proto, WS "a", -1.5);
+    if (byte_fallback) {
+      for (int c = 0; c < 256; ++c) {
+        auto *sp = model_proto.add_pieces();
+        sp->set_type(ModelProto::SentencePiece::BYTE);
+        sp->set_piece(ByteToPiece(c));
+      }
+      model_proto.mutable_trainer_spec()->set_byte_fallback(true);
+    }
+
+    *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(model_proto).ok());
+
+    // Encode() into pieces or ids skips the alignment, and must agree with
+    // the SentencePieceText.
+    const std::vector<std::string> kChars = {"a", "b", " ", "x", "y", "あ"};
+    for (const auto *extra_options :
+         {"", "bos:eos", "reverse:bos", "eos:reverse:unk", "unk"}) {
+      EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+      for (int trial = 0; trial < 100; ++trial) {
+        std::string input;
+        const int size = rand() % 20;
+        for (int i = 0; i < size; ++i) input += kChars[rand() % kChars.size()];
+
+        SentencePieceText spt;
+        EXPECT_TRUE(sp.Encode(input, &spt).ok());
+        std::vector<std::string> expected_pieces;
+        std::vector<int> expected_ids;
+        for (const auto &piece : spt.pieces()) {
+          expected_pieces.emplace_back(piece.piece());
+          expected_ids.emplace_back(piece.id());
+        }
+
+        std::vector<std::string> pieces;
+        std::vector<int> ids;
+        EXPECT_TRUE(sp.Encode(input, &pieces).ok());
+        EXPECT_TRUE(sp.Encode(input, &ids).ok());
+        EXPECT_EQ(expected_pieces, pieces);
+        EXPECT_EQ(expected_ids, ids);
+
+        // CountTokens() counts them without building them.
+        size_t num_tokens = 0;
+        EXPECT_TRUE(sp.CountTokens(input, &num_tokens).ok());
+        EXPECT_EQ(expected_ids.size(), num_tokens);
+        EXPECT_EQ(expected_ids.size(), sp.CountTokens(input));
+
+        // EncodeToBuffer() writes them into the buffers of the caller.
+        std::vector<int> buffer(expected_ids.size());
+        size_t num_ids = 0;
+        EXPECT_TRUE(sp.EncodeToBuffer(input, buffer.data(), buffer.size(),
+                                      &num_ids)
+                        .ok());
+        EXPECT_EQ(expected_ids.size(), num_ids);
+        EXPECT_EQ(expected_ids, buffer);
+
+        // EncodeWithOffsets() outputs the offsets of the SentencePieceText,
+        // in bytes or in Unicode characters.
+        for (const bool unicode_offsets : {false, true}) {
+          ImmutableSentencePieceText converted;
+          *converted.mutable_proto() = spt;
+          if (unicode_offsets) converted.ConvertToUnicodeSpans();
+          std::vector<uint32_t> expected_begins, expected_ends;
+          for (const auto &piece : converted.mutable_proto()->pieces()) {
+            expected_begins.push_back(piece.begin());
+            expected_ends.push_back(piece.end());
+          }
+          std::vector<uint32_t> begins, ends;
+          EXPECT_TRUE(
+              sp.EncodeWithOffsets(input, unicode_offsets, &ids, &begins, &ends)
+                  .ok());
+          EXPECT_EQ(expected_ids, ids);
+          EXPECT_EQ(expected_begins, begins);
+          EXPECT_EQ(expected_ends, ends);
+          if (!unicode_offsets) {
+            std::vector<uint32_t> buffer_begins(ids.size()),
+                buffer_ends(ids.size());
+            EXPECT_TRUE(sp.EncodeToBuffer(input, buffer.data(), buffer.size(),
+                                          &num_ids, buffer_begins.data(),
+                                          buffer_ends.data())
+                            .ok());
+            EXPECT_EQ(expected_ids, buffer);
+            EXPECT_EQ(expected_begins, buffer_begins);
+            EXPECT_EQ(expected_ends, buffer_ends);
+          }
+
+          BatchEncodeResult result;
+          EXPECT_TRUE(sp.EncodeBatch({input, input}, 2, false, true,
+                                     unicode_offsets, &result)
+                          .ok());
+          expected_begins.insert(expected_begins.end(), begins.begin(),
+                                 begins.end());
+          EXPECT_EQ(expected_begins, result.begins());
+          BatchEncodeResult with_pieces;
+          EXPECT_TRUE(sp.EncodeBatch({input, input}, 2, true, true,
+                                     unicode_offsets, &with_pieces)
+                          .ok());
+          EXPECT_EQ(expected_begins, with_pieces.begins());
+          EXPECT_EQ(result.ends(), with_pieces.ends());
+        }
+      }
+    }
+  }
+}
+
+TEST(SentencePieceProcessorTest, DecodeSurfacesTest) {
+  for (const bool add_dummy_prefix : {true, false}) {
+    for (const bool remove_extra_whitespaces : {true, false}) {
+      ModelProto model_proto;
+      auto *sp1 = model_proto.add_pieces();
+      auto *sp2 = model_proto.add_pieces();
+      auto *sp3 = model_proto.add_pieces();
+
+      sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+      sp1->set_piece("<unk>");
+      sp2->set_type(ModelProto::SentencePiece::CONTROL);
+      sp2->set_piece("<s>");
+      sp3->set_type(ModelProto::SentencePiece::CONTROL);
+      sp3->set_piece("</s>");
+
+      AddPiece(&model_proto, WS, -1.0);
+      AddPiece(&model_proto, "a", -1.0);
+      AddPiece(&model_proto, WS "a", -1.5);
+      AddPiece(&model_proto, "b" WS "c", -1.5);
+      AddPiece(&model_proto, WS WS, -1.5);
+      for (int c = 0; c < 256; ++c) {
+        auto *sp = model_proto.add_pieces();
+        sp->set_type(ModelProto::SentencePiece::BYTE);
+        sp->set_piece(ByteToPiece(c));
+      }
+      model_proto.mutable_trainer_spec()->set_byte_fallback(true);
+      model_proto.mutable_trainer_spec()->set_unk_surface("??");
+
+      *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+      model_proto.mutable_normalizer_spec()->set_add_dummy_prefix(
+          add_dummy_prefix);
+      model_proto.mutable_normalizer_spec()->set_remove_extra_whitespaces(
+          remove_extra_whitespaces);
+
+      SentencePieceProcessor sp;
+      EXPECT_TRUE(sp.Load(model_proto).ok());
+
+      // Decode() into a string uses the surfaces of the ids, and must agree
+      // with the SentencePieceText.
+      // The pieces before the byte pieces, and the bytes of "あ" and "x".
+      const int kNumPieces = 8;
+      const unsigned char kBytes[] = {0xE3, 0x81, 0x82, 'x'};
+      for (const auto *extra_options : {"", "reverse"}) {
+        EXPECT_TRUE(sp.SetDecodeExtraOptions(extra_options).ok());
+        for (int trial = 0; trial < 1000; ++trial) {
+          std::vector<int> ids;
+          const int size = rand() % 10;
+          for (int i = 0; i < size; ++i) {
+            if (rand() % 3 > 0) {
+              ids.push_back(rand() % kNumPieces);
+            } else {
+              ids.push_back(sp.PieceToId(ByteToPiece(kBytes[rand() % 4])));
+            }
+          }
+
+          SentencePieceText spt;
+          std::string detokenized;
+          EXPECT_TRUE(sp.Decode(ids, &spt).ok());
+          EXPECT_TRUE(sp.Decode(ids, &detokenized).ok());
+          EXPECT_EQ(spt.text(), detokenized);
+        }
+      }
+
+      std::string detokenized;
+      EXPECT_TRUE(sp.SetDecodeExtraOptions("").ok());
+      EXPECT_FALSE(
+          sp.Decode(std::vector<int>({sp.GetPieceSize()}), &detokenized).ok());
+      EXPECT_FALSE(sp.Decode(std::vector<int>({-1}), &detokenized).ok());
+    }
+  }
+}
+
+TEST(SentencePieceProcessorTest, StreamingDecoderTest) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, WS "a", -1.5);
+  AddPiece(&model_proto, "b" WS "c", -1.5);
+  AddPiece(&model_proto, WS WS, -1.5);
+  for (int c = 0; c < 256; ++c) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_type(ModelProto::SentencePiece::BYTE);
+    sp->set_piece(ByteToPiece(c));
+  }
+  model_proto.mutable_trainer_spec()->set_byte_fallback(true);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  auto ByteId = [&sp](unsigned char c) { return sp.PieceToId(ByteToPiece(c)); };
+
+  // The bytes of "あ", U+1F600, a surrogate, and stray bytes.
+  const unsigned char kBytes[] = {0xE3, 0x81, 0x82, 0xF0, 0x9F,
+                                  0x98, 0x80, 0xED, 0xA0, 'x'};
+  const int kNumPieces = 8;
+  for (const auto *extra_options : {"", "bos:eos", "reverse"}) {
+    EXPECT_TRUE(sp.SetDecodeExtraOptions(extra_options).ok());
+    StreamingDecoder decoder(sp);
+    for (int trial = 0; trial < 1000; ++trial) {
+      std::vector<int> ids;
+      const int size = rand() % 10;
+      for (int i = 0; i < size; ++i) {
+        if (rand() % 3 > 0) {
+          ids.push_back(rand() % kNumPieces);
+        } else {
+          ids.push_back(ByteId(kBytes[rand() % 10]));
+        }
+      }
+
+      std::string expected;
+      EXPECT_TRUE(sp.Decode(ids, &expected).ok());
+
+      // The decoder is reused for every trial.
+      std::string text;
+      for (const int id : ids) {
+        const size_t prev = text.size();
+        EXPECT_TRUE(decoder.Feed(id, &text).ok());
+        // Only complete characters are emitted.
+        EXPECT_TRUE(string_util::IsStructurallyValid(
+            absl::string_view(text).substr(prev)));
+      }
+      EXPECT_TRUE(decoder.Finish(&text).ok());
+      EXPECT_EQ(expected, text);
+    }
+  }
+
+  EXPECT_TRUE(sp.SetDecodeExtraOptions("").ok());
+  {
+    StreamingDecoder decoder(sp);
+    std::string text;
+    EXPECT_TRUE(decoder.Feed(5, &text).ok());
+    EXPECT_EQ("a", text);
+    text.clear();
+
+    // "あ" is held back until the last byte arrives.
+    EXPECT_TRUE(decoder.Feed({ByteId(0xE3), ByteId(0x81)}, &text).ok());
+    EXPECT_EQ("", text);
+    EXPECT_EQ(2, decoder.buffered_size());
+    EXPECT_TRUE(decoder.Feed(ByteId(0x82), &text).ok());
+    EXPECT_EQ("\xE3\x81\x82", text);
+    EXPECT_EQ(0, decoder.buffered_size());
+    text.clear();
+
+    // A byte which no character starts with is replaced at once.
+    EXPECT_TRUE(decoder.Feed({ByteId(0xE3), ByteId(0x41)}, &text).ok());
+    EXPECT_EQ("\xEF\xBF\xBD" "A", text);
+    text.clear();
+
+    // The incomplete character is replaced by the next piece or Finish().
+    EXPECT_TRUE(decoder.Feed({ByteId(0xF0), ByteId(0x9F)}, &text).ok());
+    EXPECT_EQ("", text);
+    EXPECT_TRUE(decoder.Feed(5, &text).ok());
+    EXPECT_EQ("\xEF\xBF\xBD\xEF\xBF\xBD a", text);
+    text.clear();
+    EXPECT_TRUE(decoder.Feed(ByteId(0xE3), &text).ok());
+    EXPECT_TRUE(decoder.Finish(&text).ok());
+    EXPECT_EQ("\xEF\xBF\xBD", text);
+    EXPECT_EQ(0, decoder.buffered_size());
+
+    EXPECT_FALSE(decoder.Feed(sp.GetPieceSize(), &text).ok());
+    EXPECT_FALSE(decoder.Feed(-1, &text).ok());
+  }
+
+  {
+    // All the ids are kept until Finish() with the reverse option.
+    EXPECT_TRUE(sp.SetDecodeExtraOptions("reverse").ok());
+    StreamingDecoder decoder(sp);
+    std::string text;
+    EXPECT_TRUE(decoder.Feed({4, 6}, &text).ok());
+    EXPECT_EQ("", text);
+    EXPECT_TRUE(decoder.Finish(&text).ok());
+    EXPECT_EQ("b ca", text);
+  }
+}
+
+TEST(SentencePieceProcessorTest, ImmutableSentencePieceTextTest) {
+  ImmutableSentencePieceText spt;
+  EXPECT_TRUE(spt.text().empty());
+  EXPECT_EQ(spt.score(), 0.0);
+  EXPECT_TRUE(spt.SerializeAsString().empty());
+
+  auto *v = spt.mutable_proto();
+
+  v->set_text("hello world");
+  v->set_score(1.0);
+  for (int i = 0; i < 10; ++i) {
+    auto *p = v->add_pieces();
+    p->set_surface(absl::StrCat("surface_", i));
+    p->set_piece(absl::StrCat("surface_", i));
+    p->set_id(i);
+    p->set_begin(i + 10);
+    p->set_end(i + 20);
+  }
+
+  EXPECT_EQ(v->pieces_size(), spt.pieces_size());
+  for (int i = 0; i < spt.pieces_size(); ++i) {
+    EXPECT_EQ(v->pieces(i).surface(), spt.pieces(i).surface());
+    EXPECT_EQ(v->pieces(i).piece(), spt.pieces(i).piece());
+    EXPECT_EQ(v->pieces(i).id(), spt.pieces(i).id());
+    EXPECT_EQ(v->pieces(i).begin(), spt.pieces(i).begin());
+    EXPECT_EQ(v->pieces(i).end(), spt.pieces(i).end());
+  }
+
+  auto check_proto = [&v](const ImmutableSentencePieceText &s) {
+    int n = 0;
+    for (auto &p : s.pieces()) {
+      EXPECT_EQ(v->pieces(n).surface(), p.surface());
+      EXPECT_EQ(v->pieces(n).piece(), p.piece());
+      EXPECT_EQ(v->pieces(n).id(), p.id());
+      EXPECT_EQ(v->pieces(n).begin(), p.begin());
+      EXPECT_EQ(v->pieces(n).end(), p.end());
+      ++n;
+    }
+    EXPECT_EQ(v->text(), s.text());
+    EXPECT_EQ(v->score(), s.score());
+    EXPECT_EQ(v->SerializeAsString(), s.SerializeAsString());
+  };
+
+  // test copy.
+  const auto spt2 = spt;
+  check_proto(spt2);
+
+  // test assign.
+  const ImmutableSentencePieceText spt3(spt);
+  check_proto(spt3);
+
+  // default piece.
+  const ImmutableSentencePieceText_ImmutableSentencePiece piece;
+  EXPECT_TRUE(piece.surface().empty());
+  EXPECT_TRUE(piece.piece().empty());
+  EXPECT_EQ(piece.begin(), 0);
+  EXPECT_EQ(piece.end(), 0);
+  EXPECT_EQ(piece.id(), 0);
+}
+
+TEST(SentencePieceProcessorTest, NBestResultTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const std::string prefix = util::JoinPath(::testing::TempDir(), "nbest");
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                               " --vocab_size=1000 --byte_fallback=true",
+                               " --user_defined_symbols=<sep>"))
+                  .ok());
+  SentencePieceProcessor sp;
+  ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+
+  NBestResult result;
+  NBestSentencePieceText expected, actual;
+  SentencePieceText spt;
+  for (const std::string text : {"I saw a girl with a telescope.",
+                                 "  Hello<sep>world \xe4\xb8\x96 ", ""}) {
+    for (const auto &extra_options : {"", "bos:eos:reverse"}) {
+      ASSERT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+      ASSERT_TRUE(sp.NBestEncode(text, 10, &expected).ok());
+      ASSERT_TRUE(sp.NBestEncode(text, 10, &result).ok());
+      EXPECT_EQ(text, result.text());
+      EXPECT_EQ(expected.nbests_size(), result.size());
+      EXPECT_TRUE(result.ToProto(&actual).ok());
+      EXPECT_EQ(expected.SerializeAsString(), actual.SerializeAsString());
+      for (size_t i = 0; i < result.size(); ++i) {
+        EXPECT_EQ(expected.nbests(i).score(), result.score(i));
+        EXPECT_TRUE(result.ToProto(i, &spt).ok());
+        EXPECT_EQ(expected.nbests(i).SerializeAsString(),
+                  spt.SerializeAsString());
+      }
+      EXPECT_FALSE(result.ToProto(result.size(), &spt).ok());
+
+      // No segmentation of an empty input is sampled, as with the proto.
+      if (text.empty()) {
+        EXPECT_FALSE(
+            sp.SampleEncodeAndScore(text, 5, 0.5, true, true, &result).ok());
+        continue;
+      }
+      ASSERT_TRUE(sp.SampleEncodeAndScore(text, 5, 0.5, true, true, &result)
+                      .ok());
+      EXPECT_EQ(5, result.size());
+      EXPECT_TRUE(result.ToProto(&actual).ok());
+      // The best segmentation comes first.
+      ASSERT_TRUE(sp.Encode(text, &spt).ok());
+      EXPECT_EQ(spt.pieces_size(), actual.nbests(0).pieces_size());
+      for (const auto &sample : actual.nbests()) {
+        EXPECT_EQ(text, sample.text());
+      }
+    }
+  }
 }
 
 TEST(SentencePieceProcessorTest, ImmutableNBestSentencePieceTextTest) {
@@ -14,7 +14,11 @@
 
 #include "sentencepiece_trainer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "builder.h"
@@ -88,6 +92,102 @@ util::Status SentencePieceTrainer::Train(
   return util::OkStatus();
 }
 
+// static
+util::Status SentencePieceTrainer::TrainModels(
+    const std::vector<TrainerSpec> &trainer_specs,
+    const NormalizerSpec &normalizer_spec,
+    const NormalizerSpec &denormalizer_spec,
+    SentenceIterator *sentence_iterator, int num_parallel,
+    std::vector<std::string> *serialized_model_protos) {
+  CHECK_OR_RETURN(!trainer_specs.empty());
+  CHECK_GT_OR_RETURN(num_parallel, 0);
+  auto copied_normalizer_spec = normalizer_spec;
+  RETURN_IF_ERROR(PopulateNormalizerSpec(&copied_normalizer_spec, false));
+  auto copied_denormalizer_spec = denormalizer_spec;
+  RETURN_IF_ERROR(PopulateNormalizerSpec(&copied_denormalizer_spec, true));
+
+  std::vector<std::unique_ptr<TrainerInterface>> trainers;
+  for (const auto &trainer_spec : trainer_specs) {
+    trainers.push_back(TrainerFactory::Create(
+        trainer_spec, copied_normalizer_spec, copied_denormalizer_spec));
+    RETURN_IF_ERROR(trainers.back()->status());
+  }
+
+  LOG(INFO) << "Loading the corpus of " << trainers.size()
+            << " models with : \n"
+            << PrintProto(trainer_specs[0], "trainer_spec")
+            << PrintProto(copied_normalizer_spec, "normalizer_spec");
+  std::shared_ptr<const LoadedCorpus> corpus;
+  RETURN_IF_ERROR(trainers[0]->LoadCorpus(sentence_iterator, &corpus));
+  for (size_t i = 1; i < trainers.size(); ++i) {
+    trainers[i]->SetLoadedCorpus(corpus);
+  }
+  corpus.reset();
+
+  if (serialized_model_protos != nullptr) {
+    serialized_model_protos->assign(trainers.size(), "");
+  }
+  std::vector<util::Status> statuses(trainers.size());
+  std::atomic<size_t> next{0};
+  auto run = [&]() {
+    for (size_t i = next++; i < trainers.size(); i = next++) {
+      LOG(INFO) << "Starts training with : \n"
+                << PrintProto(trainer_specs[i], "trainer_spec");
+      if (serialized_model_protos != nullptr) {
+        ModelProto model_proto;
+        statuses[i] = trainers[i]->Train(nullptr, &model_proto);
+        (*serialized_model_protos)[i] = model_proto.SerializeAsString();
+      } else {
+        statuses[i] = trainers[i]->Train(nullptr, nullptr);
+      }
+      // Frees the sentences a trainer copied as soon as it is done.
+      trainers[i].reset();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < std::min<size_t>(num_parallel, trainers.size());
+       ++t) {
+    threads.emplace_back(run);
+  }
+  run();
+  for (auto &thread : threads) thread.join();
+
+  for (const auto &status : statuses) RETURN_IF_ERROR(status);
+  return util::OkStatus();
+}
+
+// static
+util::Status SentencePieceTrainer::TrainModels(
+    const std::vector<std::string> &args, SentenceIterator *sentence_iterator,
+    int num_parallel, std::vector<std::string> *serialized_model_protos) {
+  CHECK_OR_RETURN(!args.empty());
+  std::vector<TrainerSpec> trainer_specs(args.size());
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  for (size_t i = 0; i < args.size(); ++i) {
+    LOG(INFO) << "Running command: " << args[i];
+    NormalizerSpec model_normalizer_spec;
+    NormalizerSpec model_denormalizer_spec;
+    RETURN_IF_ERROR(MergeSpecsFromArgs(args[i], &trainer_specs[i],
+                                       &model_normalizer_spec,
+                                       &model_denormalizer_spec));
+    if (i == 0) {
+      normalizer_spec = model_normalizer_spec;
+      denormalizer_spec = model_denormalizer_spec;
+      continue;
+    }
+    CHECK_OR_RETURN(model_normalizer_spec.SerializeAsString() ==
+                        normalizer_spec.SerializeAsString() &&
+                    model_denormalizer_spec.SerializeAsString() ==
+                        denormalizer_spec.SerializeAsString())
+        << "The models of a corpus must have the same normalizer and "
+           "denormalizer options: "
+        << args[i];
+  }
+  return TrainModels(trainer_specs, normalizer_spec, denormalizer_spec,
+                     sentence_iterator, num_parallel, serialized_model_protos);
+}
+
 // static
 NormalizerSpec SentencePieceTrainer::GetNormalizerSpec(absl::string_view name) {
   NormalizerSpec spec;
@@ -213,6 +313,28 @@ class VectorSentenceIterator : public SentenceIterator {
   std::vector<std::string>::const_iterator iter_;
   std::vector<std::string>::const_iterator end_;
 };
+
+// Iterates the sentences as views. value() is only built when a caller
+// asks for it; the trainer reads view().
+class StringViewSentenceIterator : public SentenceIterator {
+ public:
+  explicit StringViewSentenceIterator(
+      const std::vector<absl::string_view> &values)
+      : iter_(values.begin()), end_(values.end()) {}
+  bool done() const override { return iter_ == end_; }
+  void Next() override { ++iter_; }
+  const std::string &value() const override {
+    value_.assign(iter_->data(), iter_->size());
+    return value_;
+  }
+  absl::string_view view() const override { return *iter_; }
+  util::Status status() const override { return util::OkStatus(); }
+
+ private:
+  std::vector<absl::string_view>::const_iterator iter_;
+  std::vector<absl::string_view>::const_iterator end_;
+  mutable std::string value_;
+};
 }  // namespace
 
 // static
@@ -232,6 +354,23 @@ util::Status SentencePieceTrainer::Train(
   return Train(kwargs, &iter, serialized_model_proto);
 }
 
+// static
+util::Status SentencePieceTrainer::Train(
+    absl::string_view args, const std::vector<absl::string_view> &sentences,
+    std::string *serialized_model_proto) {
+  StringViewSentenceIterator iter(sentences);
+  return Train(args, &iter, serialized_model_proto);
+}
+
+// static
+util::Status SentencePieceTrainer::Train(
+    const std::unordered_map<std::string, std::string> &kwargs,
+    const std::vector<absl::string_view> &sentences,
+    std::string *serialized_model_proto) {
+  StringViewSentenceIterator iter(sentences);
+  return Train(kwargs, &iter, serialized_model_proto);
+}
+
 // static
 util::Status SentencePieceTrainer::PopulateNormalizerSpec(
     NormalizerSpec *normalizer_spec, bool is_denormalizer) {
@@ -280,6 +419,7 @@ util::Status SentencePieceTrainer::PopulateModelTypeFromString(
 
 namespace {
 const pretokenizer::PretokenizerForTrainingInterface *g_pretokenizer = nullptr;
+std::atomic<TrainerObserver *> g_trainer_observer(nullptr);
 }  // namespace
 
 // static
@@ -295,6 +435,16 @@ SentencePieceTrainer::GetPretokenizerForTraining() {
   return g_pretokenizer;
 }
 
+// static
+void SentencePieceTrainer::SetTrainerObserver(TrainerObserver *observer) {
+  g_trainer_observer.store(observer);
+}
+
+// static
+TrainerObserver *SentencePieceTrainer::GetTrainerObserver() {
+  return g_trainer_observer.load();
+}
+
 SentencePieceNormalizer::SentencePieceNormalizer() {}
 SentencePieceNormalizer::~SentencePieceNormalizer() {}
 
@@ -358,6 +508,32 @@ std::string SentencePieceNormalizer::Normalize(absl::string_view input) const {
   return normalized;
 }
 
+util::Status SentencePieceNormalizer::NormalizeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<std::string> *normalized) const {
+  CHECK_OR_RETURN(normalizer_);
+  CHECK_OR_RETURN(normalized);
+  CHECK_GT_OR_RETURN(num_threads, 0);
+  // Small chunks balance the threads when sentence lengths vary.
+  constexpr size_t kGrain = 64;
+  normalized->resize(inputs.size());
+  std::vector<util::Status> status(inputs.size());
+  auto run = [&](int, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      status[i] = normalizer_->Normalize(inputs[i], &(*normalized)[i], nullptr);
+    }
+  };
+  // Runs on the shared pool rather than on new threads every batch.
+  auto *pool = GetSharedThreadPool();
+  if (num_threads == 1 || pool->IsWorkerThread()) {
+    run(0, 0, inputs.size());
+  } else {
+    pool->ParallelFor(inputs.size(), kGrain, num_threads, run);
+  }
+  for (const auto &s : status) RETURN_IF_ERROR(s);
+  return util::OkStatus();
+}
+
 NormalizerSpec *SentencePieceNormalizer::mutable_normalizer_spec() const {
   return model_proto_ ? model_proto_->mutable_normalizer_spec() : nullptr;
 }
@@ -369,20 +545,8 @@ std::string SentencePieceNormalizer::serialized_model_proto() const {
 void ConvertToUnicodeAlignment(absl::string_view orig, absl::string_view norm,
                                std::vector<size_t> *norm_to_orig) {
   auto utf8_to_unicode_offsets = [](absl::string_view str) {
-    std::vector<int> utf8_to_unicode(str.size() + 1, 0);
-    size_t prev = 0;
-    int ulen = 0;
-    while (!str.empty()) {
-      const size_t mblen =
-          std::max<int>(1, string_util::OneCharLen(str.data()));
-      for (int i = prev; i < prev + mblen; ++i) {
-        utf8_to_unicode[i] = ulen;
-      }
-      ++ulen;
-      prev += mblen;
-      str.remove_prefix(mblen);
-    }
-    utf8_to_unicode[prev] = ulen;
+    std::vector<int> utf8_to_unicode;
+    string_util::ByteToCharOffsets(str, &utf8_to_unicode);
     return utf8_to_unicode;
   };
 
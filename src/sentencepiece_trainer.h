@@ -53,6 +53,58 @@ class SentenceIterator {
   virtual void Next() = 0;
   virtual const std::string &value() const = 0;
   virtual util::Status status() const = 0;
+
+  // Returns the current sentence, which is valid until Next(). The trainer
+  // reads the sentences with this method, so an iterator over sentences
+  // held elsewhere can override it to return them without building the
+  // std::string of value().
+  virtual absl::string_view view() const { return value(); }
+};
+
+// Structured progress of the training, passed to TrainerObserver.
+// Only the fields noted for the `type` are set, besides `phase`,
+// `elapsed_time` and `peak_rss`.
+struct TrainerEvent {
+  enum Type {
+    PHASE_BEGIN,       // A phase, e.g., "normalize" or "e_step", begins.
+    PHASE_END,         // The phase ends: wall_time, cpu_time, memory_bytes.
+    SENTENCES_LOADED,  // The sentences are normalized: num_sentences.
+    EM_ITERATION,      // An EM sub-iteration of the unigram trainer ends:
+                       // iteration, objective, num_tokens, num_pieces.
+    PIECES_PRUNED,     // The unigram trainer pruned pieces: num_pieces.
+    MERGE_PROGRESS,    // The BPE trainer added pieces: num_pieces,
+                       // merges_per_second.
+    MEMORY_DECISION,   // The trainer changed how it runs to stay within
+                       // max_memory_mb: decision, memory_bytes.
+  };
+
+  Type type = PHASE_BEGIN;
+  std::string phase;          // Name of the current phase.
+  double elapsed_time = 0.0;  // Wall seconds since the training started.
+  int64_t peak_rss = 0;       // Peak resident set size of the process in
+                              // bytes, or 0 if unknown.
+
+  double wall_time = 0.0;  // Wall seconds of the phase.
+  double cpu_time = 0.0;   // CPU seconds of all the threads of the process.
+  int64_t num_sentences = 0;
+  int iteration = 0;  // Index of the sub-iteration in the EM iteration.
+  double objective = 0.0;
+  int64_t num_tokens = 0;
+  int64_t num_pieces = 0;
+  double merges_per_second = 0.0;  // Since the merge phase began.
+  int64_t memory_bytes = 0;  // Bytes held by the trainer, see
+                             // TrainerInterface::GetMemoryUsage().
+  std::string decision;      // E.g., "spill_sentences"; see
+                             // TrainerSpec::max_memory_mb.
+};
+
+// Receives the TrainerEvents of every training.
+class TrainerObserver {
+ public:
+  virtual ~TrainerObserver() {}
+
+  // Called on the thread running the training, which waits for it.
+  virtual void OnEvent(const TrainerEvent &event) = 0;
 };
 
 class SentencePieceTrainer {
@@ -106,6 +158,45 @@ class SentencePieceTrainer {
       const std::vector<std::string> &sentences,
       std::string *serialized_model_proto = nullptr);
 
+  // The same as above, but passes the sentences as views, e.g., into one
+  // buffer holding the whole corpus, which is not copied as a whole. The
+  // sentences are only read while loading the corpus, and the trainer
+  // copies the ones it keeps into its own store, since normalization
+  // rewrites them. The buffer only needs to outlive this call.
+  static util::Status Train(absl::string_view args,
+                            const std::vector<absl::string_view> &sentences,
+                            std::string *serialized_model_proto = nullptr);
+
+  static util::Status Train(
+      const std::unordered_map<std::string, std::string> &kwargs,
+      const std::vector<absl::string_view> &sentences,
+      std::string *serialized_model_proto = nullptr);
+
+  // Trains a model for every spec of `trainer_specs`, e.g., of the unigram,
+  // BPE and char types, loading the corpus once: the first trainer reads,
+  // samples and normalizes the sentences, and all the trainers share them,
+  // each copying them only when it rewrites them. The specs may only differ
+  // in the options used after loading, e.g., model_type, vocab_size and
+  // model_prefix (see normalized_corpus_cache). `num_parallel` trainers
+  // run at the same time, each on its own num_threads threads. When
+  // `serialized_model_protos` is not null, it receives the models in the
+  // order of `trainer_specs` instead of model_prefix.
+  static util::Status TrainModels(
+      const std::vector<TrainerSpec> &trainer_specs,
+      const NormalizerSpec &normalizer_spec,
+      const NormalizerSpec &denormalizer_spec,
+      SentenceIterator *sentence_iterator = nullptr, int num_parallel = 1,
+      std::vector<std::string> *serialized_model_protos = nullptr);
+
+  // The same as above, but with a command-line string per model, e.g.,
+  // {"--input=data --model_prefix=u --model_type=unigram",
+  //  "--input=data --model_prefix=b --model_type=bpe"}. The normalizer and
+  // denormalizer options must be the same in all of them.
+  static util::Status TrainModels(
+      const std::vector<std::string> &args,
+      SentenceIterator *sentence_iterator = nullptr, int num_parallel = 1,
+      std::vector<std::string> *serialized_model_protos = nullptr);
+
   // Handy function to make a normalizer spec from the pre-compiled
   // normalization name. Do not use this method in production as it crashes
   // When `name` is invalid. Useful for unittesting.
@@ -141,6 +232,14 @@ class SentencePieceTrainer {
   static const pretokenizer::PretokenizerForTrainingInterface *
   GetPretokenizerForTraining();
 
+  // Sets the observer receiving the progress of the trainings started
+  // afterwards, or removes it with nullptr. `observer` is not owned and
+  // must outlive the trainings.
+  static void SetTrainerObserver(TrainerObserver *observer);
+
+  // Returns the current observer, or nullptr.
+  static TrainerObserver *GetTrainerObserver();
+
   // Helper function to set `field_name=value` in `message`.
   // When `field_name` is repeated, multiple values can be passed
   // with comma-separated values. `field_name` must not be a nested message.
@@ -188,6 +287,13 @@ class SentencePieceNormalizer {
 
   virtual std::string Normalize(absl::string_view input) const;
 
+  // Normalizes every input in `inputs` on up to `num_threads` workers of
+  // GetSharedThreadPool(), storing the result of inputs[i] in
+  // (*normalized)[i]. Runs in the calling thread if it is one of them.
+  virtual util::Status NormalizeBatch(
+      const std::vector<absl::string_view> &inputs, int num_threads,
+      std::vector<std::string> *normalized) const;
+
   virtual NormalizerSpec *mutable_normalizer_spec() const;
 
   virtual std::string serialized_model_proto() const;
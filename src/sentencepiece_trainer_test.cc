@@ -14,6 +14,8 @@
 
 #include "sentencepiece_trainer.h"
 
+#include <algorithm>
+
 #include "filesystem.h"
 #include "sentencepiece_model.pb.h"
 #include "testharness.h"
@@ -101,6 +103,25 @@ TEST(SentencePieceTrainerTest, TrainFromArgsTest) {
   CheckVocab(model + ".model", 9186);
 }
 
+TEST(SentencePieceTrainerTest, PrecompileTrieTest) {
+  const std::string input =
+      util::JoinPath(::testing::SrcDir(), kTestData);
+  const std::string model =
+      util::JoinPath(::testing::TempDir(), "m");
+
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", model,
+                               " --vocab_size=1000 --self_test_sample_size=10",
+                               " --precompile_trie"))
+                  .ok());
+  SentencePieceProcessor sp;
+  // Loading runs the self test with the precompiled tries.
+  ASSERT_TRUE(sp.Load(model + ".model").ok());
+  EXPECT_TRUE(sp.model_proto().trainer_spec().precompile_trie());
+  EXPECT_FALSE(sp.model_proto().precompiled_trie().empty());
+  EXPECT_GT(sp.model_proto().self_test_data().samples_size(), 0);
+}
+
 TEST(SentencePieceTrainerTest, TrainFromIterator) {
   class VectorIterator : public SentenceIterator {
    public:
@@ -152,6 +173,45 @@ TEST(SentencePieceTrainerTest, TrainFromIterator) {
   CheckNormalizer(model + ".model", true, false);
 }
 
+TEST(SentencePieceTrainerTest, TrainFromStringViews) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), kTestData);
+
+  // The whole corpus in one buffer, and the views of its lines.
+  std::string buffer;
+  std::vector<std::pair<size_t, size_t>> lines;
+  {
+    auto fs = filesystem::NewReadableFile(input);
+    CHECK_OK(fs->status());
+    std::string line;
+    while (fs->ReadLine(&line)) {
+      lines.emplace_back(buffer.size(), line.size());
+      buffer += line;
+    }
+  }
+  std::vector<absl::string_view> views;
+  std::vector<std::string> sentences;
+  for (const auto &line : lines) {
+    views.emplace_back(buffer.data() + line.first, line.second);
+    sentences.emplace_back(views.back());
+  }
+
+  std::string expected, model_proto;
+  ASSERT_TRUE(SentencePieceTrainer::Train({{"vocab_size", "1000"}}, sentences,
+                                          &expected)
+                  .ok());
+  ASSERT_TRUE(SentencePieceTrainer::Train({{"vocab_size", "1000"}}, views,
+                                          &model_proto)
+                  .ok());
+  EXPECT_EQ(expected, model_proto);
+
+  const std::string model = util::JoinPath(::testing::TempDir(), "m");
+  ASSERT_TRUE(
+      SentencePieceTrainer::Train(
+          absl::StrCat("--model_prefix=", model, " --vocab_size=1000"), views)
+          .ok());
+  CheckVocab(model + ".model", 1000);
+}
+
 TEST(SentencePieceTrainerTest, TrainWithCustomNormalizationRule) {
   std::string input =
       util::JoinPath(::testing::SrcDir(), kTestData);
@@ -208,6 +268,150 @@ TEST(SentencePieceTrainerTest, TrainTest) {
   ASSERT_TRUE(SentencePieceTrainer::Train(trainer_spec).ok());
 }
 
+TEST(SentencePieceTrainerTest, TrainerObserverTest) {
+  class Recorder : public TrainerObserver {
+   public:
+    void OnEvent(const TrainerEvent &event) override {
+      events.push_back(event);
+    }
+    std::vector<TrainerEvent> events;
+  };
+
+  auto count = [](const std::vector<TrainerEvent> &events,
+                  TrainerEvent::Type type) {
+    return std::count_if(
+        events.begin(), events.end(),
+        [type](const TrainerEvent &event) { return event.type == type; });
+  };
+
+  const std::string input = util::JoinPath(::testing::SrcDir(), kTestData);
+  for (const std::string type : {"unigram", "bpe"}) {
+    Recorder recorder;
+    SentencePieceTrainer::SetTrainerObserver(&recorder);
+    EXPECT_EQ(&recorder, SentencePieceTrainer::GetTrainerObserver());
+    ASSERT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--input=", input, " --model_prefix=",
+                                 util::JoinPath(::testing::TempDir(), "m"),
+                                 " --vocab_size=1000 --model_type=", type))
+                    .ok());
+    SentencePieceTrainer::SetTrainerObserver(nullptr);
+
+    const auto &events = recorder.events;
+    ASSERT_FALSE(events.empty());
+    EXPECT_EQ(TrainerEvent::PHASE_BEGIN, events.front().type);
+    EXPECT_EQ("load_sentences", events.front().phase);
+    EXPECT_EQ(TrainerEvent::PHASE_END, events.back().type);
+    EXPECT_EQ("save", events.back().phase);
+    EXPECT_EQ(count(events, TrainerEvent::PHASE_BEGIN),
+              count(events, TrainerEvent::PHASE_END));
+    for (size_t i = 1; i < events.size(); ++i) {
+      EXPECT_GE(events[i].elapsed_time, events[i - 1].elapsed_time);
+    }
+
+    EXPECT_EQ(1, count(events, TrainerEvent::SENTENCES_LOADED));
+    for (const auto &event : events) {
+      if (event.type == TrainerEvent::SENTENCES_LOADED) {
+        EXPECT_EQ("normalize", event.phase);
+        EXPECT_GT(event.num_sentences, 0);
+      } else if (event.type == TrainerEvent::EM_ITERATION) {
+        EXPECT_EQ("m_step", event.phase);
+        EXPECT_GT(event.num_tokens, 0);
+        EXPECT_GT(event.num_pieces, 0);
+      } else if (event.type == TrainerEvent::MERGE_PROGRESS) {
+        EXPECT_EQ("merge", event.phase);
+        EXPECT_EQ(0, event.num_pieces % 20);
+        EXPECT_GE(event.merges_per_second, 0.0);
+      }
+    }
+    EXPECT_EQ(0, count(events, TrainerEvent::MEMORY_DECISION));
+    if (type == "unigram") {
+      EXPECT_GT(count(events, TrainerEvent::EM_ITERATION), 0);
+      EXPECT_GT(count(events, TrainerEvent::PIECES_PRUNED), 0);
+      EXPECT_EQ(0, count(events, TrainerEvent::MERGE_PROGRESS));
+    } else {
+      EXPECT_EQ(0, count(events, TrainerEvent::EM_ITERATION));
+      EXPECT_GT(count(events, TrainerEvent::MERGE_PROGRESS), 0);
+    }
+  }
+}
+
+TEST(SentencePieceTrainerTest, MaxMemoryTest) {
+  class Recorder : public TrainerObserver {
+   public:
+    void OnEvent(const TrainerEvent &event) override {
+      if (event.type == TrainerEvent::MEMORY_DECISION) {
+        EXPECT_GT(event.memory_bytes, 0);
+        decisions.push_back(event.decision);
+      }
+    }
+    std::vector<std::string> decisions;
+  };
+
+  // The smallest budget takes all the decisions, and the training still
+  // gives a working model.
+  const std::string input = util::JoinPath(::testing::SrcDir(), kTestData);
+  const std::string prefix = util::JoinPath(::testing::TempDir(), "m_budget");
+  for (const std::string type : {"unigram", "bpe"}) {
+    Recorder recorder;
+    SentencePieceTrainer::SetTrainerObserver(&recorder);
+    ASSERT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                                 " --vocab_size=1000 --max_memory_mb=1",
+                                 " --model_type=", type))
+                    .ok());
+    SentencePieceTrainer::SetTrainerObserver(nullptr);
+
+    std::vector<std::string> expected;
+#if !defined(_WIN32) && !defined(SPM_ENABLE_LEVELDB)
+    expected.push_back("spill_sentences");
+#endif
+    expected.push_back(type == "unigram" ? "seed_shards"
+                                         : "compact_positions");
+    EXPECT_EQ(expected, recorder.decisions);
+
+    SentencePieceProcessor sp;
+    ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+    EXPECT_EQ(1000, sp.GetPieceSize());
+    const std::string text = "I saw a girl with a telescope.";
+    EXPECT_EQ(text, sp.DecodePieces(sp.EncodeAsPieces(text)));
+  }
+}
+
+TEST(SentencePieceTrainerTest, TrainModelsTest) {
+  // The models trained from one load of the corpus, in sequence and at the
+  // same time, are the ones trained separately.
+  const std::string input = util::JoinPath(::testing::SrcDir(), kTestData);
+  std::vector<std::string> args;
+  for (const std::string type : {"unigram", "bpe", "char"}) {
+    args.push_back(absl::StrCat("--input=", input, " --model_type=", type,
+                                " --vocab_size=", type == "char" ? 60 : 1000,
+                                " --hard_vocab_limit=false"));
+  }
+  std::vector<std::string> expected(args.size());
+  for (size_t i = 0; i < args.size(); ++i) {
+    ASSERT_TRUE(
+        SentencePieceTrainer::Train(args[i], nullptr, &expected[i]).ok());
+  }
+  for (int num_parallel : {1, 3}) {
+    std::vector<std::string> models;
+    ASSERT_TRUE(
+        SentencePieceTrainer::TrainModels(args, nullptr, num_parallel, &models)
+            .ok());
+    EXPECT_EQ(expected, models);
+  }
+
+  // The specs must only differ in the options used after loading.
+  std::vector<std::string> models;
+  EXPECT_FALSE(SentencePieceTrainer::TrainModels(
+                   {args[0], args[1] + " --character_coverage=0.98"}, nullptr,
+                   1, &models)
+                   .ok());
+  EXPECT_FALSE(SentencePieceTrainer::TrainModels(
+                   {args[0], args[1] + " --normalization_rule_name=identity"},
+                   nullptr, 1, &models)
+                   .ok());
+}
+
 TEST(SentencePieceTrainerTest, SetProtoFieldTest) {
   {
     TrainerSpec spec;
@@ -454,5 +658,27 @@ TEST(SentencePieceTrainerTest, NormalizationTest) {
   }
 }
 
+TEST(SentencePieceTrainerTest, NormalizeBatchTest) {
+  SentencePieceNormalizer sp;
+  std::vector<std::string> normalized;
+  EXPECT_FALSE(sp.NormalizeBatch({"ABC"}, 1, &normalized).ok());
+
+  EXPECT_OK(sp.LoadFromRuleName("nfkc_cf"));
+  const std::vector<std::string> kInputs = {"ＡＢＣＤ", "", "ｶﾞｲﾀﾞﾝｽ",
+                                            "  Hello   World  ", "①②"};
+  std::vector<std::string> inputs;
+  for (int i = 0; i < 1000; ++i) inputs.push_back(kInputs[i % kInputs.size()]);
+  const std::vector<absl::string_view> views(inputs.begin(), inputs.end());
+
+  for (const int num_threads : {1, 4}) {
+    EXPECT_OK(sp.NormalizeBatch(views, num_threads, &normalized));
+    EXPECT_EQ(inputs.size(), normalized.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      EXPECT_EQ(sp.Normalize(inputs[i]), normalized[i]);
+    }
+  }
+  EXPECT_FALSE(sp.NormalizeBatch(views, 0, &normalized).ok());
+}
+
 }  // namespace
 }  // namespace sentencepiece
@@ -0,0 +1,393 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "serve.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+
+#include "third_party/absl/strings/numbers.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_join.h"
+#include "third_party/absl/strings/str_split.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace serve {
+namespace {
+
+// Interval of checking Server::Stop() while waiting for the sockets.
+constexpr int kPollMillis = 100;
+
+// Bytes read from a connection at once.
+constexpr size_t kReadSize = 1 << 16;
+
+// A connection sending a longer line is closed.
+constexpr size_t kMaxLineSize = 1 << 24;
+
+std::string Escape(absl::string_view text) {
+  std::string escaped;
+  escaped.reserve(text.size());
+  for (const char c : text) {
+    switch (c) {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      case '\r':
+        escaped += "\\r";
+        break;
+      default:
+        escaped += c;
+    }
+  }
+  return escaped;
+}
+
+bool WriteAll(int fd, absl::string_view data) {
+#ifdef MSG_NOSIGNAL
+  constexpr int kFlags = MSG_NOSIGNAL;
+#else
+  constexpr int kFlags = 0;
+#endif
+  while (!data.empty()) {
+    const ssize_t size = send(fd, data.data(), data.size(), kFlags);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) return false;
+    data.remove_prefix(size);
+  }
+  return true;
+}
+
+}  // namespace
+
+util::Status ParseRequest(absl::string_view line, Request *request) {
+  if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+  const size_t tab = line.find('\t');
+  const absl::string_view command = line.substr(0, tab);
+  const absl::string_view argument =
+      tab == absl::string_view::npos ? absl::string_view() : line.substr(tab + 1);
+  request->text.clear();
+  request->ids.clear();
+  if (command == "encode") {
+    request->type = Request::kEncode;
+  } else if (command == "encode_pieces") {
+    request->type = Request::kEncodePieces;
+  } else if (command == "count") {
+    request->type = Request::kCount;
+  } else if (command == "decode") {
+    request->type = Request::kDecode;
+    // No ids decode to the empty string, as DecodeIds({}) does.
+    if (argument.empty()) return util::OkStatus();
+    for (const auto piece : absl::StrSplit(argument, ' ')) {
+      if (piece.empty()) continue;
+      int id = 0;
+      if (!absl::SimpleAtoi(piece, &id)) {
+        return util::InvalidArgumentError(absl::StrCat("Invalid id: ", piece));
+      }
+      request->ids.push_back(id);
+    }
+    return util::OkStatus();
+  } else {
+    return util::InvalidArgumentError(
+        absl::StrCat("Unknown command: ", command));
+  }
+  request->text.assign(argument.data(), argument.size());
+  return util::OkStatus();
+}
+
+std::string ErrorResponse(const util::Status &status) {
+  return absl::StrCat("error\t", Escape(status.ToString()));
+}
+
+void RunIsolated(
+    const std::vector<size_t> &indices,
+    const std::function<util::Status(const std::vector<size_t> &)> &batch,
+    const std::function<void(size_t, const util::Status &)> &on_error) {
+  if (indices.empty() || batch(indices).ok()) return;
+  for (const size_t i : indices) {
+    const auto status = batch({i});
+    if (!status.ok()) on_error(i, status);
+  }
+}
+
+Batcher::Batcher(const SentencePieceProcessor *processor,
+                 const Options &options)
+    : processor_(processor), options_(options) {
+  thread_ = std::thread([this]() { Loop(); });
+}
+
+Batcher::~Batcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+std::future<std::string> Batcher::Submit(absl::string_view line) {
+  auto pending = std::make_unique<Pending>();
+  auto response = pending->response.get_future();
+  const auto status = ParseRequest(line, &pending->request);
+  if (!status.ok()) {
+    pending->response.set_value(ErrorResponse(status));
+    return response;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(pending));
+  }
+  cv_.notify_one();
+  return response;
+}
+
+void Batcher::Loop() {
+  const size_t max_batch_size = std::max<size_t>(1, options_.max_batch_size);
+  while (true) {
+    std::vector<std::unique_ptr<Pending>> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !queue_.empty() || stopped_; });
+      if (queue_.empty()) return;
+      // Waits for more requests unless the batch is already full.
+      const auto deadline =
+          std::chrono::steady_clock::now() +
+          std::chrono::microseconds(options_.max_batch_delay_us);
+      cv_.wait_until(lock, deadline, [&]() {
+        return queue_.size() >= max_batch_size || stopped_;
+      });
+      const size_t size = std::min(queue_.size(), max_batch_size);
+      for (size_t i = 0; i < size; ++i) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+    }
+
+    std::vector<const Request *> requests;
+    requests.reserve(batch.size());
+    for (const auto &pending : batch) requests.push_back(&pending->request);
+    auto responses = Run(requests);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i]->response.set_value(std::move(responses[i]));
+    }
+  }
+}
+
+std::vector<std::string> Batcher::Run(
+    const std::vector<const Request *> &requests) const {
+  std::vector<std::string> responses(requests.size());
+  std::vector<size_t> indices[Request::kDecode + 1];
+  for (size_t i = 0; i < requests.size(); ++i) {
+    indices[requests[i]->type].push_back(i);
+  }
+  const int num_threads = options_.num_threads;
+
+  auto run = [&](Request::Type type,
+                 const std::function<util::Status(const std::vector<size_t> &)>
+                     &batch) {
+    RunIsolated(indices[type], batch,
+                [&](size_t i, const util::Status &status) {
+                  responses[i] = ErrorResponse(status);
+                });
+  };
+  auto texts = [&](const std::vector<size_t> &index) {
+    std::vector<absl::string_view> inputs;
+    inputs.reserve(index.size());
+    for (const size_t i : index) inputs.emplace_back(requests[i]->text);
+    return inputs;
+  };
+
+  run(Request::kEncode, [&](const std::vector<size_t> &index) {
+    std::vector<std::vector<int>> ids;
+    RETURN_IF_ERROR(processor_->EncodeBatch(texts(index), num_threads, &ids));
+    for (size_t k = 0; k < index.size(); ++k) {
+      responses[index[k]] = absl::StrJoin(ids[k], " ");
+    }
+    return util::OkStatus();
+  });
+
+  run(Request::kEncodePieces, [&](const std::vector<size_t> &index) {
+    std::vector<std::vector<std::string>> pieces;
+    RETURN_IF_ERROR(
+        processor_->EncodeBatch(texts(index), num_threads, &pieces));
+    for (size_t k = 0; k < index.size(); ++k) {
+      responses[index[k]] = absl::StrJoin(pieces[k], " ");
+    }
+    return util::OkStatus();
+  });
+
+  run(Request::kCount, [&](const std::vector<size_t> &index) {
+    std::vector<size_t> num_tokens;
+    RETURN_IF_ERROR(
+        processor_->CountTokensBatch(texts(index), num_threads, &num_tokens));
+    for (size_t k = 0; k < index.size(); ++k) {
+      responses[index[k]] = std::to_string(num_tokens[k]);
+    }
+    return util::OkStatus();
+  });
+
+  run(Request::kDecode, [&](const std::vector<size_t> &index) {
+    std::vector<std::vector<int>> ids;
+    ids.reserve(index.size());
+    for (const size_t i : index) ids.push_back(requests[i]->ids);
+    std::vector<std::string> detokenized;
+    RETURN_IF_ERROR(processor_->DecodeBatch(ids, num_threads, &detokenized));
+    for (size_t k = 0; k < index.size(); ++k) {
+      responses[index[k]] = Escape(detokenized[k]);
+    }
+    return util::OkStatus();
+  });
+
+  return responses;
+}
+
+Server::Server(Batcher *batcher, int max_connections)
+    : batcher_(batcher), max_connections_(std::max(1, max_connections)) {}
+
+Server::~Server() {
+  if (listen_fd_ >= 0) close(listen_fd_);
+}
+
+util::Status Server::Listen(absl::string_view path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  CHECK_LT_OR_RETURN(path.size(), sizeof(addr.sun_path))
+      << "Socket path is too long: " << path;
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return util::InternalError(absl::StrCat("socket: ", strerror(errno)));
+  }
+  // A socket file nobody accepts on is left by a killed server.
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) ==
+      0) {
+    close(fd);
+    return util::AlreadyExistsError(
+        absl::StrCat("Another server is listening on ", path));
+  }
+  close(fd);
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return util::InternalError(absl::StrCat("socket: ", strerror(errno)));
+  }
+  unlink(addr.sun_path);
+  if (bind(listen_fd, reinterpret_cast<const sockaddr *>(&addr),
+           sizeof(addr)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    const std::string error = strerror(errno);
+    close(listen_fd);
+    return util::InternalError(
+        absl::StrCat("Cannot listen on ", path, ": ", error));
+  }
+  if (listen_fd_ >= 0) close(listen_fd_);
+  listen_fd_ = listen_fd;
+  path_.assign(path.data(), path.size());
+  return util::OkStatus();
+}
+
+void Server::Serve() {
+  while (!stopped_.load()) {
+    pollfd pfd = {listen_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, kPollMillis) <= 0) continue;
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) continue;
+    bool full = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      full = num_connections_ >= max_connections_;
+      if (!full) ++num_connections_;
+    }
+    if (full) {
+      WriteAll(fd, ErrorResponse(util::ResourceExhaustedError(
+                       absl::StrCat("More than ",
+                                    std::to_string(max_connections_),
+                                    " connections"))) +
+                       "\n");
+      close(fd);
+      continue;
+    }
+    std::thread([this, fd]() {
+      ServeConnection(fd);
+      close(fd);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_connections_ == 0) cv_.notify_all();
+    }).detach();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return num_connections_ == 0; });
+  close(listen_fd_);
+  listen_fd_ = -1;
+  unlink(path_.c_str());
+}
+
+void Server::ServeConnection(int fd) {
+  std::string buffer;
+  std::vector<char> chunk(kReadSize);
+  std::vector<std::future<std::string>> responses;
+  std::string output;
+  while (!stopped_.load()) {
+    pollfd pfd = {fd, POLLIN, 0};
+    const int ready = poll(&pfd, 1, kPollMillis);
+    if (ready < 0 && errno != EINTR) return;
+    if (ready <= 0) continue;
+    const ssize_t size = read(fd, chunk.data(), chunk.size());
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) return;
+    buffer.append(chunk.data(), size);
+
+    // Submits all the complete lines before waiting for any, so that the
+    // lines sent together are batched together.
+    responses.clear();
+    size_t begin = 0;
+    for (size_t end = 0; (end = buffer.find('\n', begin)) != std::string::npos;
+         begin = end + 1) {
+      responses.push_back(batcher_->Submit(
+          absl::string_view(buffer).substr(begin, end - begin)));
+    }
+    buffer.erase(0, begin);
+
+    output.clear();
+    for (auto &response : responses) {
+      output += response.get();
+      output += '\n';
+    }
+    if (buffer.size() > kMaxLineSize) {
+      output += ErrorResponse(util::ResourceExhaustedError(
+          absl::StrCat("The line is longer than ",
+                       std::to_string(kMaxLineSize), " bytes")));
+      output += '\n';
+      WriteAll(fd, output);
+      return;
+    }
+    if (!WriteAll(fd, output)) return;
+  }
+}
+
+}  // namespace serve
+}  // namespace sentencepiece
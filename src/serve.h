@@ -0,0 +1,157 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SERVE_H_
+#define SERVE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace serve {
+
+// A request of the line protocol of spm_serve. A connection sends requests
+// of one line "<command>\t<argument>" each, which are answered by one line
+// each in the same order, so that a client may send many requests before
+// reading the responses:
+//   encode\t<text>         The ids of <text>, separated by spaces.
+//   encode_pieces\t<text>  The pieces of <text>, separated by spaces.
+//   count\t<text>          The number of the ids of <text>.
+//   decode\t<ids>          The text of the ids separated by spaces, with
+//                          "\\", "\n" and "\r" escaped as in C.
+// A request which cannot be parsed or run is answered by "error\t<message>".
+struct Request {
+  enum Type { kEncode, kEncodePieces, kCount, kDecode };
+
+  Type type = kEncode;
+  std::string text;      // The text of kEncode, kEncodePieces and kCount.
+  std::vector<int> ids;  // The ids of kDecode.
+};
+
+// Parses the line of a request without its newline.
+util::Status ParseRequest(absl::string_view line, Request *request);
+
+// Returns the error response of `status`.
+std::string ErrorResponse(const util::Status &status);
+
+// Runs `batch` on `indices`. If it fails, runs it on every index alone and
+// calls `on_error` for the failing ones, so that a bad request fails alone.
+void RunIsolated(
+    const std::vector<size_t> &indices,
+    const std::function<util::Status(const std::vector<size_t> &)> &batch,
+    const std::function<void(size_t, const util::Status &)> &on_error);
+
+// Dynamic micro-batching of the requests of all the connections. A thread
+// waits for the first request, collects the others arriving within
+// max_batch_delay_us or until there are max_batch_size of them, and runs
+// every kind of request in the batch with one call of the batch methods of
+// the processor, i.e., on the process-wide pool of their threads.
+class Batcher {
+ public:
+  struct Options {
+    size_t max_batch_size = 256;
+    int64 max_batch_delay_us = 200;
+    int num_threads = 16;  // Passed to the batch methods.
+  };
+
+  // `processor` must outlive this object.
+  Batcher(const SentencePieceProcessor *processor, const Options &options);
+
+  // Runs the queued requests and stops the thread.
+  ~Batcher();
+
+  Batcher(const Batcher &) = delete;
+  Batcher &operator=(const Batcher &) = delete;
+
+  // Returns the response line of the request `line`, without the newline,
+  // once its batch has run.
+  std::future<std::string> Submit(absl::string_view line);
+
+  // Returns the responses of `requests` with the batch methods.
+  std::vector<std::string> Run(const std::vector<const Request *> &requests)
+      const;
+
+ private:
+  struct Pending {
+    Request request;
+    std::promise<std::string> response;
+  };
+
+  void Loop();
+
+  const SentencePieceProcessor *processor_;
+  const Options options_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::unique_ptr<Pending>> queue_;
+  bool stopped_ = false;
+  std::thread thread_;
+};
+
+// Serves the line protocol on a Unix domain socket, with one thread per
+// connection submitting its requests to a Batcher. The connections beyond
+// `max_connections` open at once are answered by one error line and
+// closed.
+class Server {
+ public:
+  // `batcher` must outlive this object.
+  explicit Server(Batcher *batcher, int max_connections = 256);
+  ~Server();
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  // Listens on the socket file `path`, replacing a stale one.
+  util::Status Listen(absl::string_view path);
+
+  // Accepts and serves the connections until Stop() is called, then waits
+  // for the connections to finish their current requests and removes the
+  // socket file.
+  void Serve();
+
+  // Makes Serve() return. Only sets a flag, so it may be called from
+  // a signal handler.
+  void Stop() { stopped_.store(true); }
+
+ private:
+  void ServeConnection(int fd);
+
+  Batcher *batcher_;
+  const int max_connections_;
+  std::string path_;
+  int listen_fd_ = -1;
+  std::atomic<bool> stopped_{false};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int num_connections_ = 0;
+};
+
+}  // namespace serve
+}  // namespace sentencepiece
+
+#endif  // SERVE_H_
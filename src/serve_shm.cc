@@ -0,0 +1,462 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "serve_shm.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace serve {
+namespace {
+
+static_assert(sizeof(std::atomic<uint32>) == sizeof(uint32) &&
+                  std::atomic<uint32>::is_always_lock_free,
+              "futexes need lock-free 32-bit atomics");
+
+// The header and every slot start on their own cache line.
+constexpr uint64 kLineSize = 64;
+static_assert(sizeof(ShmRegion::Header) <= kLineSize, "");
+static_assert(sizeof(ShmRegion::Slot) <= kLineSize, "");
+
+// Interval of checking the stop flags while waiting.
+constexpr int kWaitMillis = 100;
+
+// Interval of freeing the slots of the clients which exited.
+constexpr int kReclaimMillis = 1000;
+
+uint64 RoundUp(uint64 size) {
+  return (size + kLineSize - 1) / kLineSize * kLineSize;
+}
+
+util::Status ErrnoError(absl::string_view what, absl::string_view path) {
+  return util::InternalError(
+      absl::StrCat(what, " ", path, ": ", strerror(errno)));
+}
+
+// Returns false if the process `pid` exited. 0 is no process yet.
+bool IsAlive(uint32 pid) {
+  return pid == 0 || kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+// Returns kUnavailable if the server of `header` stopped or exited.
+util::Status ServerStatus(const ShmRegion::Header &header) {
+  if (header.stopped.load()) {
+    return util::UnavailableError("The server is stopped.");
+  }
+  if (!IsAlive(header.server_pid)) {
+    return util::UnavailableError("The server exited.");
+  }
+  return util::OkStatus();
+}
+
+}  // namespace
+
+ShmRegion::~ShmRegion() {
+  if (header_ != nullptr) munmap(header_, size_);
+}
+
+util::Status ShmRegion::Map(int fd, size_t size) {
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return util::InternalError(absl::StrCat("mmap: ", strerror(errno)));
+  }
+  if (header_ != nullptr) munmap(header_, size_);
+  header_ = static_cast<Header *>(addr);
+  size_ = size;
+  return util::OkStatus();
+}
+
+util::Status ShmRegion::Create(absl::string_view path, uint32 num_slots,
+                               uint64 slot_size) {
+  CHECK_GT_OR_RETURN(num_slots, 0);
+  CHECK_GT_OR_RETURN(slot_size, 0);
+  const std::string filename(path);
+  const uint64 stride = kLineSize + RoundUp(slot_size);
+  const uint64 size = kLineSize + num_slots * stride;
+
+  // A new file, so that the clients of an old server never see it shrink.
+  unlink(filename.c_str());
+  const int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) return ErrnoError("Cannot create", path);
+  if (ftruncate(fd, size) != 0) {
+    const auto status = ErrnoError("Cannot resize", path);
+    close(fd);
+    return status;
+  }
+  RETURN_IF_ERROR(Map(fd, size));
+
+  // The file is zero-filled, i.e., all the slots are kFree. The magic is
+  // written last, so that a client sees it only with the rest.
+  header_->version = kVersion;
+  header_->num_slots = num_slots;
+  header_->slot_size = slot_size;
+  header_->slot_stride = stride;
+  header_->server_pid = static_cast<uint32>(getpid());
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = kMagic;
+  num_slots_ = num_slots;
+  slot_size_ = slot_size;
+  slot_stride_ = stride;
+  return util::OkStatus();
+}
+
+util::Status ShmRegion::Open(absl::string_view path) {
+  const std::string filename(path);
+  const int fd = open(filename.c_str(), O_RDWR);
+  if (fd < 0) {
+    return util::NotFoundError(
+        absl::StrCat("Cannot open ", path, ": ", strerror(errno)));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(kLineSize)) {
+    close(fd);
+    return util::DataLossError(absl::StrCat("Not a region: ", path));
+  }
+  RETURN_IF_ERROR(Map(fd, st.st_size));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  CHECK_OR_RETURN(header_->magic == kMagic) << "Not a region: " << path;
+  CHECK_EQ_OR_RETURN(header_->version, kVersion);
+  num_slots_ = header_->num_slots;
+  slot_size_ = header_->slot_size;
+  slot_stride_ = header_->slot_stride;
+  CHECK_OR_RETURN(slot_stride_ == kLineSize + RoundUp(slot_size_) &&
+                  kLineSize + num_slots_ * slot_stride_ <= size_)
+      << "Broken region: " << path;
+  return util::OkStatus();
+}
+
+ShmRegion::Slot *ShmRegion::slot(uint32 i) const {
+  return reinterpret_cast<Slot *>(reinterpret_cast<char *>(header_) +
+                                  kLineSize + i * slot_stride_);
+}
+
+char *ShmRegion::payload(uint32 i) const {
+  return reinterpret_cast<char *>(slot(i)) + kLineSize;
+}
+
+void ShmRegion::Wait(std::atomic<uint32> *word, uint32 value, int timeout_ms) {
+#if defined(__linux__)
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, reinterpret_cast<uint32 *>(word), FUTEX_WAIT, value,
+          &timeout, nullptr, 0);
+#else
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+  while (word->load() == value && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+#endif
+}
+
+void ShmRegion::Wake(std::atomic<uint32> *word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32 *>(word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+#endif
+}
+
+ShmServer::ShmServer(const SentencePieceProcessor *processor, int num_threads)
+    : processor_(processor), num_threads_(num_threads) {}
+
+util::Status ShmServer::Create(absl::string_view path, uint32 num_slots,
+                               uint64 slot_size) {
+  RETURN_IF_ERROR(region_.Create(path, num_slots, slot_size));
+  path_.assign(path.data(), path.size());
+  return util::OkStatus();
+}
+
+void ShmServer::Serve() {
+  auto *header = region_.header();
+  std::vector<uint32> slots;
+  auto reclaimed = std::chrono::steady_clock::now();
+  while (!stopped_.load()) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - reclaimed >= std::chrono::milliseconds(kReclaimMillis)) {
+      ReclaimSlots();
+      reclaimed = now;
+    }
+    const uint32 doorbell = header->doorbell.load();
+    slots.clear();
+    for (uint32 i = 0; i < region_.num_slots(); ++i) {
+      if (region_.slot(i)->state.load(std::memory_order_acquire) ==
+          ShmRegion::kRequest) {
+        slots.push_back(i);
+      }
+    }
+    if (slots.empty()) {
+      ShmRegion::Wait(&header->doorbell, doorbell, kWaitMillis);
+    } else {
+      Run(slots);
+    }
+  }
+
+  // The clients waiting on a slot give up when they see the flag.
+  header->stopped.store(1);
+  for (uint32 i = 0; i < region_.num_slots(); ++i) {
+    ShmRegion::Wake(&region_.slot(i)->state);
+  }
+  unlink(path_.c_str());
+}
+
+void ShmServer::ReclaimSlots() {
+  for (uint32 i = 0; i < region_.num_slots(); ++i) {
+    auto *s = region_.slot(i);
+    const uint32 state = s->state.load(std::memory_order_acquire);
+    if (state != ShmRegion::kClaimed && state != ShmRegion::kResponse) {
+      continue;
+    }
+    // The owner is cleared before the slot is freed, so that the slot of
+    // a new client, whose owner is 0 until it writes its own, is kept.
+    uint32 owner = s->owner.load();
+    if (IsAlive(owner) || !s->owner.compare_exchange_strong(owner, 0)) {
+      continue;
+    }
+    s->state.store(ShmRegion::kFree, std::memory_order_release);
+  }
+}
+
+void ShmServer::Run(const std::vector<uint32> &slots) {
+  // Writes the response of `slot`, or kResourceExhausted if it does not fit.
+  auto respond = [this](uint32 slot, util::Status status, const void *data,
+                        size_t size) {
+    if (status.ok() && size > region_.slot_size()) {
+      status = util::ResourceExhaustedError(
+          absl::StrCat("The response of ", std::to_string(size),
+                       " bytes does not fit in the slot"));
+    }
+    if (!status.ok()) {
+      data = status.message();
+      size = std::min<size_t>(strlen(status.message()), region_.slot_size());
+    }
+    auto *s = region_.slot(slot);
+    if (size > 0) memcpy(region_.payload(slot), data, size);
+    s->code = static_cast<int32>(status.code());
+    s->size = size;
+    s->state.store(ShmRegion::kResponse, std::memory_order_release);
+    ShmRegion::Wake(&s->state);
+  };
+
+  // The clients may change the slots at any time, so their fields are read
+  // once and checked before use.
+  std::vector<size_t> indices[Request::kDecode + 1];
+  std::vector<uint64> sizes(slots.size());
+  for (size_t k = 0; k < slots.size(); ++k) {
+    const auto *s = region_.slot(slots[k]);
+    const uint32 type = s->type;
+    sizes[k] = s->size;
+    if (type != Request::kEncode && type != Request::kCount &&
+        type != Request::kDecode) {
+      respond(slots[k],
+              util::UnimplementedError(absl::StrCat(
+                  "Unsupported request type: ", std::to_string(type))),
+              nullptr, 0);
+    } else if (sizes[k] > region_.slot_size() ||
+               (type == Request::kDecode && sizes[k] % sizeof(int) != 0)) {
+      respond(slots[k],
+              util::InvalidArgumentError(absl::StrCat(
+                  "Invalid request size: ", std::to_string(sizes[k]))),
+              nullptr, 0);
+    } else {
+      indices[type].push_back(k);
+    }
+  }
+  auto on_error = [&](size_t k, const util::Status &status) {
+    respond(slots[k], status, nullptr, 0);
+  };
+  auto texts = [&](const std::vector<size_t> &index) {
+    std::vector<absl::string_view> inputs;
+    inputs.reserve(index.size());
+    for (const size_t k : index) {
+      inputs.emplace_back(region_.payload(slots[k]), sizes[k]);
+    }
+    return inputs;
+  };
+
+  RunIsolated(
+      indices[Request::kEncode],
+      [&](const std::vector<size_t> &index) {
+        std::vector<std::vector<int>> ids;
+        RETURN_IF_ERROR(processor_->EncodeBatch(texts(index), num_threads_,
+                                                &ids));
+        for (size_t j = 0; j < index.size(); ++j) {
+          respond(slots[index[j]], util::OkStatus(), ids[j].data(),
+                  ids[j].size() * sizeof(int));
+        }
+        return util::OkStatus();
+      },
+      on_error);
+
+  RunIsolated(
+      indices[Request::kCount],
+      [&](const std::vector<size_t> &index) {
+        std::vector<size_t> num_tokens;
+        RETURN_IF_ERROR(processor_->CountTokensBatch(
+            texts(index), num_threads_, &num_tokens));
+        for (size_t j = 0; j < index.size(); ++j) {
+          const uint64 count = num_tokens[j];
+          respond(slots[index[j]], util::OkStatus(), &count, sizeof(count));
+        }
+        return util::OkStatus();
+      },
+      on_error);
+
+  RunIsolated(
+      indices[Request::kDecode],
+      [&](const std::vector<size_t> &index) {
+        std::vector<std::vector<int>> ids(index.size());
+        for (size_t j = 0; j < index.size(); ++j) {
+          ids[j].resize(sizes[index[j]] / sizeof(int));
+          memcpy(ids[j].data(), region_.payload(slots[index[j]]),
+                 ids[j].size() * sizeof(int));
+        }
+        std::vector<std::string> detokenized;
+        RETURN_IF_ERROR(
+            processor_->DecodeBatch(ids, num_threads_, &detokenized));
+        for (size_t j = 0; j < index.size(); ++j) {
+          respond(slots[index[j]], util::OkStatus(), detokenized[j].data(),
+                  detokenized[j].size());
+        }
+        return util::OkStatus();
+      },
+      on_error);
+}
+
+util::Status ShmClient::Open(absl::string_view path) {
+  return region_.Open(path);
+}
+
+util::Status ShmClient::Call(Request::Type type, const void *data, size_t size,
+                             uint32 *slot) const {
+  auto *header = region_.header();
+  CHECK_OR_RETURN(header != nullptr) << "Not opened.";
+  if (size > region_.slot_size()) {
+    return util::ResourceExhaustedError(
+        absl::StrCat("The request of ", std::to_string(size),
+                     " bytes does not fit in the slot"));
+  }
+
+  // Claims a free slot, starting at a different one on every call so that
+  // the threads of the client rarely contend.
+  const uint32 num_slots = region_.num_slots();
+  for (uint32 n = 0;; ++n) {
+    if (header->stopped.load()) {
+      return util::UnavailableError("The server is stopped.");
+    }
+    const uint32 i = next_slot_.fetch_add(1) % num_slots;
+    uint32 expected = ShmRegion::kFree;
+    if (region_.slot(i)->state.compare_exchange_strong(expected,
+                                                       ShmRegion::kClaimed)) {
+      *slot = i;
+      break;
+    }
+    if (n % num_slots == num_slots - 1) {
+      RETURN_IF_ERROR(ServerStatus(*header));
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+
+  auto *s = region_.slot(*slot);
+  s->owner.store(static_cast<uint32>(getpid()));
+  if (size > 0) memcpy(region_.payload(*slot), data, size);
+  s->type = type;
+  s->size = size;
+  s->state.store(ShmRegion::kRequest, std::memory_order_release);
+  header->doorbell.fetch_add(1);
+  ShmRegion::Wake(&header->doorbell);
+
+  uint32 state;
+  while ((state = s->state.load(std::memory_order_acquire)) !=
+         ShmRegion::kResponse) {
+    const auto status = ServerStatus(*header);
+    if (!status.ok()) {
+      Release(*slot);
+      return status;
+    }
+    ShmRegion::Wait(&s->state, state, kWaitMillis);
+  }
+
+  if (s->code != 0) {
+    const util::Status status(
+        static_cast<util::StatusCode>(s->code),
+        absl::string_view(region_.payload(*slot), s->size));
+    Release(*slot);
+    return status;
+  }
+  return util::OkStatus();
+}
+
+void ShmClient::Release(uint32 slot) const {
+  auto *s = region_.slot(slot);
+  s->owner.store(0);
+  s->state.store(ShmRegion::kFree, std::memory_order_release);
+}
+
+util::Status ShmClient::Encode(absl::string_view text,
+                               std::vector<int> *ids) const {
+  CHECK_OR_RETURN(ids) << "output is null";
+  uint32 slot = 0;
+  RETURN_IF_ERROR(Call(Request::kEncode, text.data(), text.size(), &slot));
+  ids->resize(region_.slot(slot)->size / sizeof(int));
+  memcpy(ids->data(), region_.payload(slot), ids->size() * sizeof(int));
+  Release(slot);
+  return util::OkStatus();
+}
+
+util::Status ShmClient::CountTokens(absl::string_view text,
+                                    size_t *num_tokens) const {
+  CHECK_OR_RETURN(num_tokens) << "output is null";
+  uint32 slot = 0;
+  RETURN_IF_ERROR(Call(Request::kCount, text.data(), text.size(), &slot));
+  uint64 count = 0;
+  memcpy(&count, region_.payload(slot), sizeof(count));
+  *num_tokens = count;
+  Release(slot);
+  return util::OkStatus();
+}
+
+util::Status ShmClient::Decode(const std::vector<int> &ids,
+                               std::string *text) const {
+  CHECK_OR_RETURN(text) << "output is null";
+  uint32 slot = 0;
+  RETURN_IF_ERROR(
+      Call(Request::kDecode, ids.data(), ids.size() * sizeof(int), &slot));
+  text->assign(region_.payload(slot), region_.slot(slot)->size);
+  Release(slot);
+  return util::OkStatus();
+}
+
+}  // namespace serve
+}  // namespace sentencepiece
@@ -0,0 +1,178 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SERVE_SHM_H_
+#define SERVE_SHM_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "serve.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace serve {
+
+// The shared memory transport of spm_serve for the processes on the same
+// host. The server maps a file, e.g., on /dev/shm, as a ring of slots, and
+// a client writes the UTF-8 text or the int32 ids of a request into a free
+// slot, where the server writes the int32 ids, the text or the count back.
+// Nothing is serialized, and the waiting sides sleep on futexes of the
+// mapping (polling on systems without futexes).
+//
+// A slot goes kFree -> kClaimed (written by a client) -> kRequest (run by
+// the server) -> kResponse (read by the client) -> kFree. All the slots in
+// kRequest when the server wakes up run as one batch.
+//
+// The region records the process ids of the server and of the client of
+// every slot. A client gives up with kUnavailable when the server exits,
+// e.g., is killed, and the server frees the slots of the clients which
+// exited while holding them.
+class ShmRegion {
+ public:
+  static constexpr uint64 kMagic = 0x6d68732d6d7073;  // "spm-shm"
+  static constexpr uint32 kVersion = 2;
+
+  enum SlotState : uint32 { kFree, kClaimed, kRequest, kResponse };
+
+  struct Header {
+    uint64 magic;
+    uint32 version;
+    uint32 num_slots;
+    uint64 slot_size;  // Bytes of the payload of a slot.
+    uint64 slot_stride;
+    std::atomic<uint32> doorbell;  // Incremented for every request.
+    std::atomic<uint32> stopped;   // Set when the server stops.
+    uint32 server_pid;
+  };
+
+  struct Slot {
+    std::atomic<uint32> state;
+    uint32 type;  // Request::Type.
+    uint64 size;  // Bytes of the payload.
+    int32 code;   // util::StatusCode of the response.
+    // The process id of the client holding the slot, written after the
+    // claim, and cleared before the slot is freed.
+    std::atomic<uint32> owner;
+    // The payload follows the slot, aligned to 8 bytes.
+  };
+
+  ShmRegion() = default;
+  ~ShmRegion();
+
+  ShmRegion(const ShmRegion &) = delete;
+  ShmRegion &operator=(const ShmRegion &) = delete;
+
+  // Creates the file `path` with `num_slots` slots of `slot_size` bytes,
+  // replacing an old one, and maps it. Only the user of the server may open
+  // the file.
+  util::Status Create(absl::string_view path, uint32 num_slots,
+                      uint64 slot_size);
+
+  // Maps the file `path` created by a server.
+  util::Status Open(absl::string_view path);
+
+  // The layout is kept out of the mapping, which the other processes may
+  // write.
+  Header *header() const { return header_; }
+  uint32 num_slots() const { return num_slots_; }
+  uint64 slot_size() const { return slot_size_; }
+  Slot *slot(uint32 i) const;
+  char *payload(uint32 i) const;
+
+  // Sleeps while `*word` is `value`, for `timeout_ms` at most.
+  static void Wait(std::atomic<uint32> *word, uint32 value, int timeout_ms);
+
+  // Wakes the threads sleeping on `word` in all the processes.
+  static void Wake(std::atomic<uint32> *word);
+
+ private:
+  util::Status Map(int fd, size_t size);
+
+  Header *header_ = nullptr;
+  size_t size_ = 0;
+  uint32 num_slots_ = 0;
+  uint64 slot_size_ = 0;
+  uint64 slot_stride_ = 0;
+};
+
+// Runs the requests of the clients of a ShmRegion on a processor.
+class ShmServer {
+ public:
+  // `processor` must outlive this object.
+  ShmServer(const SentencePieceProcessor *processor, int num_threads);
+
+  ShmServer(const ShmServer &) = delete;
+  ShmServer &operator=(const ShmServer &) = delete;
+
+  // Creates the region of the clients. See ShmRegion::Create().
+  util::Status Create(absl::string_view path, uint32 num_slots,
+                      uint64 slot_size);
+
+  // Runs the requests until Stop() is called, then fails the pending
+  // requests with kUnavailable and removes the file.
+  void Serve();
+
+  // Makes Serve() return. Only sets a flag, so it may be called from
+  // a signal handler.
+  void Stop() { stopped_.store(true); }
+
+ private:
+  void Run(const std::vector<uint32> &slots);
+
+  // Frees the slots claimed or answered for the clients which exited.
+  void ReclaimSlots();
+
+  const SentencePieceProcessor *processor_;
+  const int num_threads_;
+  ShmRegion region_;
+  std::string path_;
+  std::atomic<bool> stopped_{false};
+};
+
+// A client of a ShmServer. Thread-safe; every call takes a slot of its own.
+class ShmClient {
+ public:
+  // Maps the region at `path`.
+  util::Status Open(absl::string_view path);
+
+  // Encodes `text` into `ids`.
+  util::Status Encode(absl::string_view text, std::vector<int> *ids) const;
+
+  // Counts the ids of `text`.
+  util::Status CountTokens(absl::string_view text, size_t *num_tokens) const;
+
+  // Decodes `ids` into `text`.
+  util::Status Decode(const std::vector<int> &ids, std::string *text) const;
+
+ private:
+  // Writes the request of `type` with `size` bytes of `data` into a free
+  // slot, and waits for the response. Returns the slot, which the caller
+  // must release after reading the response. Fails with kUnavailable when
+  // the server stops or exits.
+  util::Status Call(Request::Type type, const void *data, size_t size,
+                    uint32 *slot) const;
+  void Release(uint32 slot) const;
+
+  ShmRegion region_;
+  mutable std::atomic<uint32> next_slot_{0};
+};
+
+}  // namespace serve
+}  // namespace sentencepiece
+
+#endif  // SERVE_SHM_H_
@@ -0,0 +1,176 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "serve_shm.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sentencepiece_trainer.h"
+#include "testharness.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace serve {
+namespace {
+
+TEST(ServeShmTest, ClientTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const std::string prefix = util::JoinPath(::testing::TempDir(), "serve_shm");
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                               " --vocab_size=1000"))
+                  .ok());
+  SentencePieceProcessor sp;
+  ASSERT_TRUE(sp.Load(prefix + ".model").ok());
+
+  const std::string path = prefix + ".shm";
+  ShmServer server(&sp, 2);
+  ASSERT_TRUE(server.Create(path, 4, 256).ok());
+  std::thread thread([&server]() { server.Serve(); });
+
+  ShmClient client;
+  EXPECT_FALSE(client.Open(path + ".not_found").ok());
+  ASSERT_TRUE(client.Open(path).ok());
+
+  // More threads than slots.
+  const std::vector<std::string> texts = {"I saw a girl with a telescope.",
+                                          "", "Hello world.", "Botchan"};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int n = 0; n < 20; ++n) {
+        const std::string &text = texts[(t + n) % texts.size()];
+        std::vector<int> ids;
+        size_t num_tokens = 0;
+        std::string detokenized;
+        EXPECT_TRUE(client.Encode(text, &ids).ok());
+        EXPECT_EQ(sp.EncodeAsIds(text), ids);
+        EXPECT_TRUE(client.CountTokens(text, &num_tokens).ok());
+        EXPECT_EQ(ids.size(), num_tokens);
+        EXPECT_TRUE(client.Decode(ids, &detokenized).ok());
+        EXPECT_EQ(sp.DecodeIds(ids), detokenized);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  // The errors of a request, and the requests and the responses not fitting
+  // in a slot.
+  std::string detokenized;
+  EXPECT_FALSE(client.Decode({5, 100000}, &detokenized).ok());
+  std::vector<int> ids;
+  EXPECT_EQ(util::StatusCode::kResourceExhausted,
+            client.Encode(std::string(300, 'a'), &ids).code());
+  std::string words;
+  for (int n = 0; n < 100; ++n) words += "x ";
+  EXPECT_EQ(util::StatusCode::kResourceExhausted,
+            client.Encode(words, &ids).code());
+  EXPECT_TRUE(client.Encode("Hello", &ids).ok());
+
+  // Only the user of the server may open the region.
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  EXPECT_EQ(0600, st.st_mode & 0777);
+
+  // The sizes a client writes into a slot are checked.
+  ShmRegion region;
+  ASSERT_TRUE(region.Open(path).ok());
+  auto request = [&](Request::Type type, uint64 size) {
+    auto *s = region.slot(0);
+    uint32 expected = ShmRegion::kFree;
+    while (!s->state.compare_exchange_strong(expected, ShmRegion::kClaimed)) {
+      expected = ShmRegion::kFree;
+      std::this_thread::yield();
+    }
+    s->type = type;
+    s->size = size;
+    s->state.store(ShmRegion::kRequest, std::memory_order_release);
+    region.header()->doorbell.fetch_add(1);
+    ShmRegion::Wake(&region.header()->doorbell);
+    while (s->state.load(std::memory_order_acquire) != ShmRegion::kResponse) {
+      std::this_thread::yield();
+    }
+    const int32 code = s->code;
+    s->state.store(ShmRegion::kFree, std::memory_order_release);
+    return static_cast<util::StatusCode>(code);
+  };
+  EXPECT_EQ(util::StatusCode::kInvalidArgument,
+            request(Request::kEncode, region.slot_size() + 1));
+  EXPECT_EQ(util::StatusCode::kInvalidArgument,
+            request(Request::kDecode, sizeof(int) + 1));
+  EXPECT_EQ(util::StatusCode::kOk, request(Request::kDecode, 0));
+
+  // The slots held by the clients which exited are freed, and the others
+  // are kept.
+  const pid_t exited = fork();
+  if (exited == 0) _exit(0);
+  ASSERT_EQ(exited, waitpid(exited, nullptr, 0));
+  const uint32 states[] = {ShmRegion::kClaimed, ShmRegion::kResponse,
+                           ShmRegion::kClaimed};
+  const uint32 owners[] = {static_cast<uint32>(exited),
+                           static_cast<uint32>(exited),
+                           static_cast<uint32>(getpid())};
+  for (uint32 i = 0; i < 3; ++i) {
+    auto *s = region.slot(i + 1);
+    s->owner.store(owners[i]);
+    s->state.store(states[i], std::memory_order_release);
+  }
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while ((region.slot(1)->state.load() != ShmRegion::kFree ||
+          region.slot(2)->state.load() != ShmRegion::kFree) &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(ShmRegion::kFree, region.slot(1)->state.load());
+  EXPECT_EQ(ShmRegion::kFree, region.slot(2)->state.load());
+  EXPECT_EQ(ShmRegion::kClaimed, region.slot(3)->state.load());
+  region.slot(3)->owner.store(0);
+  region.slot(3)->state.store(ShmRegion::kFree);
+  EXPECT_TRUE(client.Encode("Hello", &ids).ok());
+
+  server.Stop();
+  thread.join();
+  EXPECT_NE(0, access(path.c_str(), F_OK));
+  EXPECT_EQ(util::StatusCode::kUnavailable,
+            client.Encode("Hello", &ids).code());
+
+  // A client gives up when the server exits without stopping, e.g., when
+  // it is killed.
+  ShmServer killed(&sp, 1);
+  ASSERT_TRUE(killed.Create(path, 4, 256).ok());
+  ShmRegion killed_region;
+  ASSERT_TRUE(killed_region.Open(path).ok());
+  killed_region.header()->server_pid = exited;
+  ShmClient orphan;
+  ASSERT_TRUE(orphan.Open(path).ok());
+  EXPECT_EQ(util::StatusCode::kUnavailable,
+            orphan.Encode("Hello", &ids).code());
+  for (uint32 i = 0; i < killed_region.num_slots(); ++i) {
+    EXPECT_EQ(ShmRegion::kFree, killed_region.slot(i)->state.load());
+  }
+  unlink(path.c_str());
+}
+
+}  // namespace
+}  // namespace serve
+}  // namespace sentencepiece
@@ -0,0 +1,223 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "serve.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sentencepiece_trainer.h"
+#include "testharness.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_join.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace serve {
+namespace {
+
+void LoadModel(SentencePieceProcessor *sp) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const std::string prefix = util::JoinPath(::testing::TempDir(), "serve");
+  ASSERT_TRUE(SentencePieceTrainer::Train(
+                  absl::StrCat("--input=", input, " --model_prefix=", prefix,
+                               " --vocab_size=1000"))
+                  .ok());
+  ASSERT_TRUE(sp->Load(prefix + ".model").ok());
+}
+
+TEST(ServeTest, ParseRequestTest) {
+  Request request;
+  EXPECT_TRUE(ParseRequest("encode\tHello\tworld.", &request).ok());
+  EXPECT_EQ(Request::kEncode, request.type);
+  EXPECT_EQ("Hello\tworld.", request.text);
+
+  EXPECT_TRUE(ParseRequest("encode_pieces\tHello\r", &request).ok());
+  EXPECT_EQ(Request::kEncodePieces, request.type);
+  EXPECT_EQ("Hello", request.text);
+
+  EXPECT_TRUE(ParseRequest("count", &request).ok());
+  EXPECT_EQ(Request::kCount, request.type);
+  EXPECT_TRUE(request.text.empty());
+
+  EXPECT_TRUE(ParseRequest("decode\t10 20  30", &request).ok());
+  EXPECT_EQ(Request::kDecode, request.type);
+  EXPECT_EQ(std::vector<int>({10, 20, 30}), request.ids);
+
+  EXPECT_TRUE(ParseRequest("decode\t", &request).ok());
+  EXPECT_EQ(Request::kDecode, request.type);
+  EXPECT_TRUE(request.ids.empty());
+  EXPECT_TRUE(ParseRequest("decode", &request).ok());
+  EXPECT_TRUE(request.ids.empty());
+
+  EXPECT_FALSE(ParseRequest("decode\t10 x", &request).ok());
+  EXPECT_FALSE(ParseRequest("tokenize\tHello", &request).ok());
+  EXPECT_FALSE(ParseRequest("", &request).ok());
+}
+
+TEST(ServeTest, BatcherTest) {
+  SentencePieceProcessor sp;
+  LoadModel(&sp);
+
+  const std::vector<std::string> texts = {"I saw a girl with a telescope.",
+                                          "", "Hello world."};
+  Batcher::Options options;
+  options.num_threads = 2;
+  options.max_batch_size = 4;
+  Batcher batcher(&sp, options);
+
+  std::vector<std::future<std::string>> responses;
+  std::vector<std::string> expected;
+  for (const auto &text : texts) {
+    std::vector<int> ids;
+    std::vector<std::string> pieces;
+    std::string detokenized;
+    ASSERT_TRUE(sp.Encode(text, &ids).ok());
+    ASSERT_TRUE(sp.Encode(text, &pieces).ok());
+    ASSERT_TRUE(sp.Decode(ids, &detokenized).ok());
+
+    responses.push_back(batcher.Submit(absl::StrCat("encode\t", text)));
+    expected.push_back(absl::StrJoin(ids, " "));
+    responses.push_back(batcher.Submit(absl::StrCat("encode_pieces\t", text)));
+    expected.push_back(absl::StrJoin(pieces, " "));
+    responses.push_back(batcher.Submit(absl::StrCat("count\t", text)));
+    expected.push_back(std::to_string(ids.size()));
+    responses.push_back(
+        batcher.Submit(absl::StrCat("decode\t", absl::StrJoin(ids, " "))));
+    expected.push_back(detokenized);
+  }
+
+  // Only the failing requests of a batch are answered with an error.
+  responses.push_back(batcher.Submit("decode\t5 100000"));
+  responses.push_back(batcher.Submit("decode\t5"));
+  responses.push_back(batcher.Submit("unknown\t5"));
+  responses.push_back(batcher.Submit("decode\t"));
+
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i], responses[i].get());
+  }
+  EXPECT_EQ(0, responses[expected.size()].get().find("error\t"));
+  EXPECT_EQ(sp.DecodeIds({5}), responses[expected.size() + 1].get());
+  EXPECT_EQ(0, responses[expected.size() + 2].get().find("error\t"));
+  EXPECT_EQ("", responses[expected.size() + 3].get());
+}
+
+TEST(ServeTest, ServerTest) {
+  SentencePieceProcessor sp;
+  LoadModel(&sp);
+  Batcher batcher(&sp, Batcher::Options());
+  Server server(&batcher);
+
+  const std::string path = util::JoinPath(::testing::TempDir(), "serve.sock");
+  ASSERT_TRUE(server.Listen(path).ok());
+  std::thread thread([&server]() { server.Serve(); });
+
+  // Another server cannot take over the socket.
+  {
+    Server other(&batcher);
+    EXPECT_FALSE(other.Listen(path).ok());
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.data(), path.size());
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                       sizeof(addr)));
+
+  // Sends the requests at once, the last one split into two writes.
+  const std::string text = "I saw a girl with a telescope.";
+  const std::string request =
+      absl::StrCat("count\t", text, "\nencode\t", text, "\ndecode\t5\nen");
+  ASSERT_EQ(request.size(), write(fd, request.data(), request.size()));
+  ASSERT_EQ(6, write(fd, "code\t\n", 6));
+
+  const std::string expected =
+      absl::StrCat(std::to_string(sp.EncodeAsIds(text).size()), "\n",
+                   absl::StrJoin(sp.EncodeAsIds(text), " "), "\n",
+                   sp.DecodeIds({5}), "\n\n");
+  std::string response;
+  char buf[256];
+  while (response.size() < expected.size()) {
+    const ssize_t size = read(fd, buf, sizeof(buf));
+    if (size <= 0) break;
+    response.append(buf, size);
+  }
+  EXPECT_EQ(expected, response);
+  close(fd);
+
+  server.Stop();
+  thread.join();
+  EXPECT_NE(0, access(path.c_str(), F_OK));
+}
+
+TEST(ServeTest, MaxConnectionsTest) {
+  SentencePieceProcessor sp;
+  LoadModel(&sp);
+  Batcher batcher(&sp, Batcher::Options());
+  Server server(&batcher, 1);
+
+  const std::string path =
+      util::JoinPath(::testing::TempDir(), "serve_max.sock");
+  ASSERT_TRUE(server.Listen(path).ok());
+  std::thread thread([&server]() { server.Serve(); });
+
+  auto connect_server = [&path]() {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    EXPECT_GE(fd, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.data(), path.size());
+    EXPECT_EQ(0, connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                         sizeof(addr)));
+    return fd;
+  };
+  auto read_all = [](int fd, size_t size) {
+    std::string response;
+    char buf[256];
+    while (response.size() < size) {
+      const ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) break;
+      response.append(buf, n);
+    }
+    return response;
+  };
+
+  // The first connection is served once its request is answered.
+  const int fd = connect_server();
+  ASSERT_EQ(8, write(fd, "decode\t\n", 8));
+  EXPECT_EQ("\n", read_all(fd, 1));
+
+  // The second one is refused while the first one is open.
+  const int other = connect_server();
+  EXPECT_EQ(0, read_all(other, 1 << 20).find("error\t"));
+  close(other);
+  close(fd);
+
+  server.Stop();
+  thread.join();
+}
+
+}  // namespace
+}  // namespace serve
+}  // namespace sentencepiece
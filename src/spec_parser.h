@@ -135,10 +135,14 @@ inline std::string PrintProto(const TrainerSpec &message,
   PRINT_PARAM(input_sentence_size);
   PRINT_PARAM(shuffle_input_sentence);
   PRINT_PARAM(seed_sentencepiece_size);
+  PRINT_PARAM(seed_sentencepiece_shard_size);
   PRINT_PARAM(shrinking_factor);
   PRINT_PARAM(max_sentence_length);
   PRINT_PARAM(num_threads);
+  PRINT_PARAM(num_reader_threads);
+  PRINT_PARAM(precompile_trie);
   PRINT_PARAM(num_sub_iterations);
+  PRINT_PARAM(incremental_e_step_tolerance);
   PRINT_PARAM(max_sentencepiece_length);
   PRINT_PARAM(split_by_unicode_script);
   PRINT_PARAM(split_by_number);
@@ -154,6 +158,23 @@ inline std::string PrintProto(const TrainerSpec &message,
   PRINT_PARAM(vocabulary_output_piece_score);
   PRINT_PARAM(train_extremely_large_corpus);
   PRINT_PARAM(seed_sentencepieces_file);
+  PRINT_PARAM(normalized_corpus_cache);
+  PRINT_PARAM(checkpoint_file);
+  PRINT_PARAM(resume_from);
+  PRINT_PARAM(distributed_dir);
+  PRINT_PARAM(num_distributed_processes);
+  PRINT_PARAM(distributed_process_id);
+  PRINT_PARAM(distributed_timeout_sec);
+  PRINT_PARAM(vocab_size_sweep);
+  PRINT_PARAM(dedup_input_sentences);
+  PRINT_PARAM(em_mini_batch_size);
+  PRINT_PARAM(e_step_beam);
+  PRINT_PARAM(e_step_window_size);
+  PRINT_PARAM(sentence_store);
+  PRINT_PARAM(sentence_store_dir);
+  PRINT_PARAM(keep_sentence_store);
+  PRINT_PARAM(max_memory_mb);
+  PRINT_PARAM(approximate_bpe_merges);
   PRINT_PARAM(hard_vocab_limit);
   PRINT_PARAM(use_all_vocab);
   PRINT_PARAM(unk_id);
@@ -215,10 +236,14 @@ util::Status SentencePieceTrainer::SetProtoField(absl::string_view name,
   PARSE_UINT64(input_sentence_size);
   PARSE_BOOL(shuffle_input_sentence);
   PARSE_INT32(seed_sentencepiece_size);
+  PARSE_UINT64(seed_sentencepiece_shard_size);
   PARSE_DOUBLE(shrinking_factor);
   PARSE_INT32(max_sentence_length);
   PARSE_INT32(num_threads);
+  PARSE_INT32(num_reader_threads);
+  PARSE_BOOL(precompile_trie);
   PARSE_INT32(num_sub_iterations);
+  PARSE_DOUBLE(incremental_e_step_tolerance);
   PARSE_INT32(max_sentencepiece_length);
   PARSE_BOOL(split_by_unicode_script);
   PARSE_BOOL(split_by_number);
@@ -235,6 +260,23 @@ util::Status SentencePieceTrainer::SetProtoField(absl::string_view name,
   PARSE_BOOL(vocabulary_output_piece_score);
   PARSE_BOOL(train_extremely_large_corpus);
   PARSE_STRING(seed_sentencepieces_file);
+  PARSE_STRING(normalized_corpus_cache);
+  PARSE_STRING(checkpoint_file);
+  PARSE_STRING(resume_from);
+  PARSE_STRING(distributed_dir);
+  PARSE_INT32(num_distributed_processes);
+  PARSE_INT32(distributed_process_id);
+  PARSE_INT32(distributed_timeout_sec);
+  PARSE_STRING(vocab_size_sweep);
+  PARSE_BOOL(dedup_input_sentences);
+  PARSE_UINT64(em_mini_batch_size);
+  PARSE_DOUBLE(e_step_beam);
+  PARSE_INT32(e_step_window_size);
+  PARSE_STRING(sentence_store);
+  PARSE_STRING(sentence_store_dir);
+  PARSE_BOOL(keep_sentence_store);
+  PARSE_UINT64(max_memory_mb);
+  PARSE_INT32(approximate_bpe_merges);
   PARSE_BOOL(use_all_vocab);
   PARSE_INT32(unk_id);
   PARSE_INT32(bos_id);
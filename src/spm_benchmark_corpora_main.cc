@@ -0,0 +1,428 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// Writes the standard input sets of the benchmarks, sampled from a seed
+// corpus (the samples of data/ by default), e.g.,
+//
+//   spm_benchmark_corpora --output_dir=corpora
+//   spm_benchmark --input=corpora/cjk.txt --input_sets=lines
+//
+// Every set is written to <output_dir>/<set>.txt, one input per line, and
+// its statistics to <output_dir>/stats.tsv. The same flags always write the
+// same files. The sets are:
+//
+//   short          queries of --short_min_size to --short_max_size bytes
+//   long           documents of about --long_size bytes
+//   cjk            lines mostly of Han, Kana and Hangul characters
+//   code           source-code-like lines of identifiers of the corpus
+//   emoji          lines with emoji, ZWJ sequences and astral Han
+//   byte_fallback  lines with the characters of scripts absent from the
+//                  corpus, which byte-fallback models encode as bytes
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "benchmark.h"
+#include "common.h"
+#include "filesystem.h"
+#include "init.h"
+#include "third_party/absl/flags/flag.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_format.h"
+#include "third_party/absl/strings/str_join.h"
+#include "third_party/absl/strings/str_split.h"
+#include "unicode_script.h"
+#include "util.h"
+
+#ifdef OS_WIN
+ABSL_FLAG(std::string, input,
+          "..\\data\\botchan.txt,..\\data\\wagahaiwa_nekodearu.txt",
+          "comma separated seed corpus files, one sentence per line");
+#else
+ABSL_FLAG(std::string, input,
+          "../data/botchan.txt,../data/wagahaiwa_nekodearu.txt",
+          "comma separated seed corpus files, one sentence per line");
+#endif
+ABSL_FLAG(std::string, output_dir, "", "directory of the written sets");
+ABSL_FLAG(std::string, sets, "short,long,cjk,code,emoji,byte_fallback",
+          "comma separated input sets to write");
+ABSL_FLAG(int32, num_inputs, 1000, "inputs of every set but long");
+ABSL_FLAG(int32, num_documents, 20, "inputs of the long set");
+ABSL_FLAG(int32, short_min_size, 10, "minimum bytes of a short query");
+ABSL_FLAG(int32, short_max_size, 100, "maximum bytes of a short query");
+ABSL_FLAG(int32, long_size, 16384, "bytes of a long document");
+ABSL_FLAG(uint32, seed, 1234, "seed of the sampling");
+
+namespace {
+
+using sentencepiece::string_util::DecodeUTF8;
+using sentencepiece::string_util::UnicodeCharToUTF8;
+
+// Ranges of code points [first, last] which the generators draw from.
+struct Range {
+  char32 first;
+  char32 last;
+};
+
+// Emoji of the Miscellaneous Symbols and Pictographs, Emoticons and
+// Supplemental Symbols and Pictographs blocks.
+constexpr Range kEmoji[] = {
+    {0x1F300, 0x1F5FF}, {0x1F600, 0x1F64F}, {0x1F900, 0x1F9FF}};
+// CJK Unified Ideographs Extension B.
+constexpr Range kAstralHan[] = {{0x20000, 0x2A6DF}};
+// Ethiopic, Cherokee, Tifinagh, Linear B, Old Italic and Cuneiform, which
+// the seed corpora do not contain.
+constexpr Range kRareScripts[] = {{0x1200, 0x135A}, {0x13A0, 0x13F4},
+                                  {0x2D30, 0x2D67}, {0x10000, 0x1000B},
+                                  {0x10300, 0x1031E}, {0x12000, 0x12399}};
+
+template <size_t N>
+char32 RandomChar(const Range (&ranges)[N], std::mt19937 *rng) {
+  const auto &range = ranges[(*rng)() % N];
+  return range.first + (*rng)() % (range.last - range.first + 1);
+}
+
+std::vector<char32> DecodeChars(absl::string_view text) {
+  std::vector<char32> chars;
+  while (!text.empty()) {
+    size_t mblen = 0;
+    chars.push_back(DecodeUTF8(text, &mblen));
+    text.remove_prefix(std::max<size_t>(mblen, 1));
+  }
+  return chars;
+}
+
+bool IsCJK(char32 c) {
+  const auto script = sentencepiece::unicode_script::GetScript(c);
+  return script == sentencepiece::unicode_script::U_Han ||
+         script == sentencepiece::unicode_script::U_Hiragana ||
+         script == sentencepiece::unicode_script::U_Katakana ||
+         script == sentencepiece::unicode_script::U_Hangul;
+}
+
+constexpr size_t kMaxWordSize = 24;
+
+// The seed corpus, and what the generators draw from it.
+struct Seed {
+  std::vector<std::string> lines;
+  std::vector<std::string> cjk_lines;  // Half of the characters or more.
+  std::vector<std::string> words;      // Up to kMaxWordSize bytes.
+  std::vector<std::string> identifiers;  // Lowercased ASCII words.
+  std::unordered_set<char32> chars;
+};
+
+Seed ReadSeed(const std::string &filenames) {
+  Seed seed;
+  for (const auto &filename : absl::StrSplit(filenames, ",")) {
+    auto input = sentencepiece::filesystem::NewReadableFile(filename);
+    CHECK_OK(input->status());
+    std::string line;
+    while (input->ReadLine(&line)) {
+      if (!line.empty()) seed.lines.push_back(line);
+    }
+  }
+  CHECK(!seed.lines.empty()) << "no input in " << filenames;
+
+  for (const auto &line : seed.lines) {
+    const auto chars = DecodeChars(line);
+    seed.chars.insert(chars.begin(), chars.end());
+    if (2 * std::count_if(chars.begin(), chars.end(), IsCJK) >=
+        static_cast<int64>(chars.size())) {
+      seed.cjk_lines.push_back(line);
+    }
+    for (const auto word : absl::StrSplit(line, " ")) {
+      // Skips the lines of the languages without spaces.
+      if (word.empty() || word.size() > kMaxWordSize) continue;
+      seed.words.emplace_back(word);
+      std::string identifier;
+      for (const char c : word) {
+        if (c >= 'a' && c <= 'z') identifier += c;
+        if (c >= 'A' && c <= 'Z') identifier += c - 'A' + 'a';
+      }
+      if (identifier.size() >= 2) seed.identifiers.push_back(identifier);
+    }
+  }
+  CHECK(!seed.words.empty()) << "no word in " << filenames;
+  if (seed.identifiers.empty()) seed.identifiers.push_back("x");
+  return seed;
+}
+
+template <typename T>
+const T &Sample(const std::vector<T> &values, std::mt19937 *rng) {
+  return values[(*rng)() % values.size()];
+}
+
+// Cuts queries of a random size from random lines, starting at a word.
+std::vector<std::string> MakeShort(const Seed &seed, std::mt19937 *rng) {
+  const int min_size = absl::GetFlag(FLAGS_short_min_size);
+  const int max_size =
+      std::max(min_size, absl::GetFlag(FLAGS_short_max_size));
+  const size_t num_inputs = absl::GetFlag(FLAGS_num_inputs);
+  std::vector<std::string> inputs;
+  while (inputs.size() < num_inputs) {
+    const size_t size = min_size + (*rng)() % (max_size - min_size + 1);
+    absl::string_view text = Sample(seed.lines, rng);
+    const size_t space = text.find(' ', (*rng)() % text.size());
+    if (space != absl::string_view::npos && text.size() - space > size) {
+      text.remove_prefix(space + 1);
+    }
+    const auto query = sentencepiece::benchmark::TruncateUTF8(text, size);
+    if (!query.empty()) inputs.emplace_back(query);
+  }
+  return inputs;
+}
+
+// Joins consecutive lines from a random one.
+std::vector<std::string> MakeLong(const Seed &seed, std::mt19937 *rng) {
+  const size_t size = absl::GetFlag(FLAGS_long_size);
+  const size_t num_inputs = absl::GetFlag(FLAGS_num_documents);
+  std::vector<std::string> inputs;
+  while (inputs.size() < num_inputs) {
+    std::string document;
+    for (size_t i = (*rng)() % seed.lines.size(); document.size() < size;
+         i = (i + 1) % seed.lines.size()) {
+      if (!document.empty()) document += ' ';
+      document += seed.lines[i];
+    }
+    inputs.push_back(std::move(document));
+  }
+  return inputs;
+}
+
+std::vector<std::string> MakeCJK(const Seed &seed, std::mt19937 *rng) {
+  CHECK(!seed.cjk_lines.empty()) << "no CJK line in --input";
+  const size_t num_inputs = absl::GetFlag(FLAGS_num_inputs);
+  std::vector<std::string> inputs;
+  while (inputs.size() < num_inputs) {
+    inputs.push_back(Sample(seed.cjk_lines, rng));
+  }
+  return inputs;
+}
+
+std::vector<std::string> MakeCode(const Seed &seed, std::mt19937 *rng) {
+  auto name = [&]() {
+    std::string name = Sample(seed.identifiers, rng);
+    switch ((*rng)() % 3) {
+      case 0:
+        name += "_" + Sample(seed.identifiers, rng);
+        break;
+      case 1: {
+        std::string next = Sample(seed.identifiers, rng);
+        next[0] = next[0] - 'a' + 'A';
+        name += next;
+        break;
+      }
+    }
+    return name;
+  };
+  const size_t num_inputs = absl::GetFlag(FLAGS_num_inputs);
+  std::vector<std::string> inputs;
+  while (inputs.size() < num_inputs) {
+    const std::string a = name(), b = name(), c = name();
+    const int value = (*rng)() % 1000;
+    const std::string n = std::to_string(value);
+    switch ((*rng)() % 6) {
+      case 0:
+        inputs.push_back(absl::StrCat("for (int i = 0; i < ", a,
+                                      ".size(); ++i) { ", b, "[i] += ", n,
+                                      "; }"));
+        break;
+      case 1:
+        inputs.push_back(absl::StrCat("if (", a, " != nullptr && ", a, "->",
+                                      b, "() >= ", n, ") return ", c, ";"));
+        break;
+      case 2:
+        inputs.push_back(absl::StrCat("def ", a, "(self, ", b, ", ", c,
+                                      "=None):"));
+        break;
+      case 3:
+        inputs.push_back(absl::StrCat("const auto ", a, " = std::make_unique<",
+                                      b, ">(", c, ", ", n, ");"));
+        break;
+      case 4:
+        inputs.push_back(absl::StrCat("    ", a, " = {\"", b, "\": ", n,
+                                      ", \"", c, "\": [",
+                                      std::to_string(value / 7), ", ",
+                                      std::to_string(value % 7), "]}"));
+        break;
+      default:
+        inputs.push_back(absl::StrCat("// TODO(", a, "): ",
+                                      Sample(seed.words, rng), " ", b, "."));
+        break;
+    }
+  }
+  return inputs;
+}
+
+// Inserts a character from `draw` after every word with probability 1/2.
+template <typename Draw>
+std::vector<std::string> MakeMixed(const Seed &seed, std::mt19937 *rng,
+                                   const Draw &draw) {
+  const size_t num_inputs = absl::GetFlag(FLAGS_num_inputs);
+  std::vector<std::string> inputs;
+  while (inputs.size() < num_inputs) {
+    std::string line;
+    const int num_words = 4 + (*rng)() % 12;
+    for (int i = 0; i < num_words; ++i) {
+      if (!line.empty()) line += ' ';
+      line += Sample(seed.words, rng);
+      if ((*rng)() % 2 == 0) line += draw();
+    }
+    inputs.push_back(std::move(line));
+  }
+  return inputs;
+}
+
+std::vector<std::string> MakeEmoji(const Seed &seed, std::mt19937 *rng) {
+  return MakeMixed(seed, rng, [&]() {
+    switch ((*rng)() % 4) {
+      case 0:
+        return UnicodeCharToUTF8(RandomChar(kAstralHan, rng));
+      case 1:  // A ZWJ sequence.
+        return absl::StrCat(UnicodeCharToUTF8(RandomChar(kEmoji, rng)),
+                            UnicodeCharToUTF8(0x200D),
+                            UnicodeCharToUTF8(RandomChar(kEmoji, rng)));
+      default:
+        return UnicodeCharToUTF8(RandomChar(kEmoji, rng));
+    }
+  });
+}
+
+std::vector<std::string> MakeByteFallback(const Seed &seed,
+                                          std::mt19937 *rng) {
+  return MakeMixed(seed, rng, [&]() {
+    std::string word = " ";
+    const int length = 1 + (*rng)() % 6;
+    for (int i = 0; i < length; ++i) {
+      word += UnicodeCharToUTF8(RandomChar(kRareScripts, rng));
+    }
+    return word;
+  });
+}
+
+// Statistics of a written set.
+struct Stats {
+  std::string name;
+  int64 inputs = 0;
+  int64 bytes = 0;
+  int64 chars = 0;
+  int64 p50_bytes = 0;
+  int64 p99_bytes = 0;
+  // Ratios of the characters.
+  double ascii = 0.0;
+  double cjk = 0.0;
+  double astral = 0.0;  // Outside the BMP, i.e., four UTF-8 bytes.
+  double unseen = 0.0;  // Absent from the seed corpus.
+};
+
+Stats ComputeStats(absl::string_view name,
+                   const std::vector<std::string> &inputs, const Seed &seed) {
+  Stats stats;
+  stats.name = std::string(name);
+  stats.inputs = inputs.size();
+  std::vector<int64> sizes;
+  int64 ascii = 0, cjk = 0, astral = 0, unseen = 0;
+  for (const auto &input : inputs) {
+    sizes.push_back(input.size());
+    stats.bytes += input.size();
+    for (const char32 c : DecodeChars(input)) {
+      ++stats.chars;
+      ascii += c < 0x80;
+      cjk += IsCJK(c);
+      astral += c > 0xFFFF;
+      unseen += seed.chars.count(c) == 0;
+    }
+  }
+  std::sort(sizes.begin(), sizes.end());
+  stats.p50_bytes = sentencepiece::benchmark::Percentile(sizes, 0.5);
+  stats.p99_bytes = sentencepiece::benchmark::Percentile(sizes, 0.99);
+  if (stats.chars > 0) {
+    const double chars = stats.chars;
+    stats.ascii = ascii / chars;
+    stats.cjk = cjk / chars;
+    stats.astral = astral / chars;
+    stats.unseen = unseen / chars;
+  }
+  return stats;
+}
+
+std::string FormatStats(const Stats &stats) {
+  return absl::StrFormat(
+      "%s\t%lld\t%lld\t%lld\t%lld\t%lld\t%.4f\t%.4f\t%.4f\t%.4f",
+      stats.name.c_str(), static_cast<long long>(stats.inputs),
+      static_cast<long long>(stats.bytes), static_cast<long long>(stats.chars),
+      static_cast<long long>(stats.p50_bytes),
+      static_cast<long long>(stats.p99_bytes), stats.ascii, stats.cjk,
+      stats.astral, stats.unseen);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ScopedResourceDestructor cleaner;
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+  const std::string &output_dir = absl::GetFlag(FLAGS_output_dir);
+  CHECK(!output_dir.empty()) << "--output_dir is required";
+
+  const Seed seed = ReadSeed(absl::GetFlag(FLAGS_input));
+  const std::string header =
+      "set\tinputs\tbytes\tchars\tp50_bytes\tp99_bytes\tascii\tcjk\tastral\t"
+      "unseen";
+  std::vector<std::string> rows = {header};
+  for (const auto &name : absl::StrSplit(absl::GetFlag(FLAGS_sets), ",")) {
+    // Every set draws from its own generator, so that a set does not change
+    // with the other --sets.
+    std::vector<uint32> values = {absl::GetFlag(FLAGS_seed)};
+    values.insert(values.end(), name.begin(), name.end());
+    std::seed_seq seq(values.begin(), values.end());
+    std::mt19937 rng(seq);
+
+    std::vector<std::string> inputs;
+    if (name == "short") {
+      inputs = MakeShort(seed, &rng);
+    } else if (name == "long") {
+      inputs = MakeLong(seed, &rng);
+    } else if (name == "cjk") {
+      inputs = MakeCJK(seed, &rng);
+    } else if (name == "code") {
+      inputs = MakeCode(seed, &rng);
+    } else if (name == "emoji") {
+      inputs = MakeEmoji(seed, &rng);
+    } else if (name == "byte_fallback") {
+      inputs = MakeByteFallback(seed, &rng);
+    } else {
+      LOG(FATAL) << "unknown input set: " << name;
+    }
+
+    const std::string filename =
+        sentencepiece::util::JoinPath(output_dir, absl::StrCat(name, ".txt"));
+    auto output = sentencepiece::filesystem::NewWritableFile(filename);
+    CHECK_OK(output->status());
+    for (const auto &input : inputs) CHECK(output->WriteLine(input));
+    rows.push_back(FormatStats(ComputeStats(name, inputs, seed)));
+  }
+
+  auto output = sentencepiece::filesystem::NewWritableFile(
+      sentencepiece::util::JoinPath(output_dir, "stats.tsv"));
+  CHECK_OK(output->status());
+  for (const auto &row : rows) {
+    CHECK(output->WriteLine(row));
+    std::cout << row << "\n";
+  }
+  return 0;
+}
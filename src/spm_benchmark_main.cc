@@ -0,0 +1,762 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// Micro-benchmarks of encoding and decoding, e.g.,
+//
+//   spm_benchmark --benchmarks=encode,decode --output_format=tsv
+//
+// Without --model, a model of every type in --model_types is trained on
+// --input first.
+//
+// With --mode=train, the training of every type in --model_types is timed
+// phase by phase instead, on corpora of --num_sentences sentences and with
+// every --num_threads, e.g.,
+//
+//   spm_benchmark --mode=train --num_sentences=10000,100000 --num_threads=1,8
+//
+// With --mode=scaling, the batch encoders run with every --num_threads on
+// the same inputs, reporting the throughput and the parallel efficiency,
+// i.e., the speedup over the fewest threads divided by the thread ratio.
+// python/scaling_benchmark.py does the same through the Python module.
+//
+// With --mode=latency, every public Encode() overload is called on queries
+// of every --query_sizes bytes one at a time, reporting the percentiles of
+// the latency of a call and the allocations per call, e.g.,
+//
+//   spm_benchmark --mode=latency --query_sizes=16,100 --output_format=tsv
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <thread>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark.h"
+#include "common.h"
+#include "filesystem.h"
+#include "init.h"
+#include "model_factory.h"
+#include "sentencepiece.pb.h"
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_processor.h"
+#include "sentencepiece_trainer.h"
+#include "third_party/absl/flags/flag.h"
+#include "third_party/absl/strings/numbers.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_format.h"
+#include "third_party/absl/strings/str_split.h"
+#include "trainer_factory.h"
+#include "trainer_interface.h"
+#include "unigram_model.h"
+
+#ifdef OS_WIN
+ABSL_FLAG(std::string, input,
+          "..\\data\\botchan.txt,..\\data\\wagahaiwa_nekodearu.txt",
+          "comma separated corpus files, one input per line");
+#else
+ABSL_FLAG(std::string, input,
+          "../data/botchan.txt,../data/wagahaiwa_nekodearu.txt",
+          "comma separated corpus files, one input per line");
+#endif
+ABSL_FLAG(std::string, model, "",
+          "comma separated model files. If empty, the models of "
+          "--model_types are trained on --input");
+ABSL_FLAG(std::string, model_types, "unigram,bpe,char,word",
+          "comma separated model types trained without --model");
+ABSL_FLAG(int32, vocab_size, 8000, "vocabulary size of the trained models");
+ABSL_FLAG(std::string, input_sets, "short,lines,long",
+          "comma separated input length distributions: \"short\" cuts the "
+          "lines to --short_size bytes, \"lines\" takes them as they are, "
+          "and \"long\" joins them into documents of --long_size bytes");
+ABSL_FLAG(int32, short_size, 32, "maximum bytes of a short input");
+ABSL_FLAG(int32, long_size, 16384, "bytes of a long input");
+ABSL_FLAG(std::string, benchmarks,
+          "normalize,encode,encode_proto,segment,nbest,sample,entropy,decode",
+          "comma separated benchmarks to run. \"segment\" runs the model "
+          "without normalization, with both the optimized and the original "
+          "encoder of unigram models");
+ABSL_FLAG(double, min_time, 0.5, "minimum seconds of a benchmark");
+ABSL_FLAG(int32, nbest_size, 8, "NBest size of nbest");
+ABSL_FLAG(double, alpha, 0.1, "smoothing parameter of sample and entropy");
+ABSL_FLAG(std::string, output_format, "text", "choose from text or tsv");
+ABSL_FLAG(std::string, mode, "encode",
+          "choose from encode, which runs --benchmarks, train, which times "
+          "the phases of the training, scaling, which runs the batch "
+          "encoders with every --num_threads, or latency, which reports the "
+          "latency percentiles of the Encode() overloads");
+ABSL_FLAG(std::string, corpora, "synthetic,data",
+          "comma separated training corpora of --mode=train: \"synthetic\" "
+          "samples Zipf-distributed random words, and \"data\" repeats the "
+          "lines of --input");
+ABSL_FLAG(std::string, num_sentences, "10000",
+          "comma separated numbers of sentences of the training corpora");
+ABSL_FLAG(std::string, num_threads, "",
+          "comma separated numbers of threads of --mode=train and "
+          "--mode=scaling. 1 for train, and the powers of two up to the "
+          "number of cores for scaling by default");
+ABSL_FLAG(std::string, query_sizes, "16,32,64,100",
+          "comma separated bytes of the queries of --mode=latency");
+ABSL_FLAG(std::string, tmp_dir, "",
+          "directory of the training corpora. The system temporary "
+          "directory by default");
+
+// Calls to the global operator new and the bytes requested, counted per
+// thread by the replacement operators below for --mode=latency.
+#ifdef SPM_NO_THREADLOCAL
+std::atomic<int64> allocation_count{0};
+std::atomic<int64> allocation_bytes{0};
+#else
+thread_local int64 allocation_count = 0;
+thread_local int64 allocation_bytes = 0;
+#endif
+
+// The aligned variants are not replaced, and not counted.
+void *operator new(size_t size) {
+  ++allocation_count;
+  allocation_bytes += size;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+using sentencepiece::benchmark::PassStats;
+
+// A named set of inputs.
+struct InputSet {
+  std::string name;
+  std::vector<std::string> texts;
+  int64 bytes = 0;
+};
+
+std::vector<std::string> ReadLines(const std::string &filenames) {
+  std::vector<std::string> lines;
+  for (const auto &filename : absl::StrSplit(filenames, ",")) {
+    auto input = sentencepiece::filesystem::NewReadableFile(filename);
+    CHECK_OK(input->status());
+    std::string line;
+    while (input->ReadLine(&line)) {
+      if (!line.empty()) lines.push_back(line);
+    }
+  }
+  CHECK(!lines.empty()) << "no input in " << filenames;
+  return lines;
+}
+
+InputSet MakeInputSet(absl::string_view name,
+                      const std::vector<std::string> &lines) {
+  InputSet set;
+  set.name = std::string(name);
+  if (name == "short") {
+    const size_t size = absl::GetFlag(FLAGS_short_size);
+    for (const auto &line : lines) {
+      set.texts.emplace_back(
+          sentencepiece::benchmark::TruncateUTF8(line, size));
+    }
+  } else if (name == "lines") {
+    set.texts = lines;
+  } else if (name == "long") {
+    const size_t size = absl::GetFlag(FLAGS_long_size);
+    std::string text;
+    for (const auto &line : lines) {
+      if (!text.empty()) text += ' ';
+      text += line;
+      if (text.size() >= size) {
+        set.texts.push_back(std::move(text));
+        text.clear();
+      }
+    }
+    if (!text.empty() || set.texts.empty()) set.texts.push_back(text);
+  } else {
+    LOG(FATAL) << "unknown input set: " << name;
+  }
+  for (const auto &text : set.texts) set.bytes += text.size();
+  return set;
+}
+
+// A model to benchmark.
+struct Model {
+  std::string name;
+  sentencepiece::SentencePieceProcessor sp;
+};
+
+std::vector<std::unique_ptr<Model>> LoadModels() {
+  std::vector<std::unique_ptr<Model>> models;
+  const std::string &filenames = absl::GetFlag(FLAGS_model);
+  if (!filenames.empty()) {
+    for (const auto &filename : absl::StrSplit(filenames, ",")) {
+      auto model = std::make_unique<Model>();
+      const size_t pos = filename.find_last_of("/\\");
+      model->name = std::string(
+          pos == absl::string_view::npos ? filename : filename.substr(pos + 1));
+      CHECK_OK(model->sp.Load(filename));
+      models.push_back(std::move(model));
+    }
+    return models;
+  }
+  for (const auto &type :
+       absl::StrSplit(absl::GetFlag(FLAGS_model_types), ",")) {
+    auto model = std::make_unique<Model>();
+    model->name = std::string(type);
+    std::string serialized;
+    CHECK_OK(sentencepiece::SentencePieceTrainer::Train(
+        absl::StrCat("--input=", absl::GetFlag(FLAGS_input),
+                     " --model_type=", type,
+                     " --vocab_size=",
+                     std::to_string(absl::GetFlag(FLAGS_vocab_size)),
+                     " --hard_vocab_limit=false"),
+        nullptr, &serialized));
+    CHECK_OK(model->sp.LoadFromSerializedProto(serialized));
+    models.push_back(std::move(model));
+  }
+  return models;
+}
+
+// Runs the benchmark `name` of `model` on `set`. Benchmarks which the model
+// does not support are skipped.
+void RunBenchmark(absl::string_view name, const Model &model,
+                  const InputSet &set,
+                  sentencepiece::benchmark::Reporter *reporter) {
+  const auto &sp = model.sp;
+  const auto &texts = set.texts;
+  const double min_time = absl::GetFlag(FLAGS_min_time);
+  auto run = [&](absl::string_view bench_name,
+                 const std::function<PassStats()> &pass) {
+    auto result = sentencepiece::benchmark::Run(pass, min_time);
+    result.name = std::string(bench_name);
+    result.model = model.name;
+    result.inputs = set.name;
+    reporter->Report(result);
+  };
+  // Returns true if `status` of the first input is OK, i.e., the model
+  // supports the benchmark.
+  auto supported = [&](const sentencepiece::util::Status &status) {
+    if (status.ok()) return true;
+    LOG(INFO) << "Skips " << name << " of " << model.name << ": "
+              << status.message();
+    return false;
+  };
+
+  const int nbest_size = absl::GetFlag(FLAGS_nbest_size);
+  const float alpha = absl::GetFlag(FLAGS_alpha);
+
+  if (name == "normalize") {
+    run(name, [&]() {
+      std::string normalized;
+      for (const auto &text : texts) CHECK_OK(sp.Normalize(text, &normalized));
+      return PassStats{static_cast<int64>(texts.size()), set.bytes, 0};
+    });
+  } else if (name == "encode") {
+    run(name, [&]() {
+      PassStats stats{static_cast<int64>(texts.size()), set.bytes, 0};
+      std::vector<int> ids;
+      for (const auto &text : texts) {
+        CHECK_OK(sp.Encode(text, &ids));
+        stats.tokens += ids.size();
+      }
+      return stats;
+    });
+  } else if (name == "encode_proto") {
+    run(name, [&]() {
+      PassStats stats{static_cast<int64>(texts.size()), set.bytes, 0};
+      sentencepiece::SentencePieceText spt;
+      for (const auto &text : texts) {
+        CHECK_OK(sp.Encode(text, &spt));
+        stats.tokens += spt.pieces_size();
+      }
+      return stats;
+    });
+  } else if (name == "segment") {
+    std::vector<std::string> normalized;
+    for (const auto &text : texts) normalized.push_back(sp.Normalize(text));
+    auto segmenter = sentencepiece::ModelFactory::Create(sp.model_proto());
+    CHECK_OK(segmenter->status());
+    auto segment = [&]() {
+      PassStats stats{static_cast<int64>(texts.size()), set.bytes, 0};
+      for (const auto &text : normalized) {
+        stats.tokens += segmenter->Encode(text).size();
+      }
+      return stats;
+    };
+    auto *unigram =
+        dynamic_cast<sentencepiece::unigram::Model *>(segmenter.get());
+    if (unigram == nullptr) {
+      run(name, segment);
+      return;
+    }
+    unigram->SetEncoderVersion(sentencepiece::unigram::Model::kOptimized);
+    run("segment_optimized", segment);
+    unigram->SetEncoderVersion(sentencepiece::unigram::Model::kOriginal);
+    run("segment_original", segment);
+  } else if (name == "nbest") {
+    std::vector<std::vector<int>> nbest;
+    if (!supported(sp.NBestEncode(texts[0], nbest_size, &nbest))) return;
+    run(name, [&]() {
+      PassStats stats{static_cast<int64>(texts.size()), set.bytes, 0};
+      std::vector<std::vector<int>> nbest;
+      for (const auto &text : texts) {
+        CHECK_OK(sp.NBestEncode(text, nbest_size, &nbest));
+        for (const auto &ids : nbest) stats.tokens += ids.size();
+      }
+      return stats;
+    });
+  } else if (name == "sample") {
+    std::vector<int> ids;
+    if (!supported(sp.SampleEncode(texts[0], -1, alpha, &ids))) return;
+    run(name, [&]() {
+      PassStats stats{static_cast<int64>(texts.size()), set.bytes, 0};
+      std::vector<int> ids;
+      for (const auto &text : texts) {
+        CHECK_OK(sp.SampleEncode(text, -1, alpha, &ids));
+        stats.tokens += ids.size();
+      }
+      return stats;
+    });
+  } else if (name == "entropy") {
+    float entropy = 0.0;
+    if (!supported(sp.CalculateEntropy(texts[0], alpha, &entropy))) return;
+    run(name, [&]() {
+      float entropy = 0.0;
+      for (const auto &text : texts) {
+        CHECK_OK(sp.CalculateEntropy(text, alpha, &entropy));
+      }
+      return PassStats{static_cast<int64>(texts.size()), set.bytes, 0};
+    });
+  } else if (name == "decode") {
+    std::vector<std::vector<int>> ids(texts.size());
+    int64 num_tokens = 0;
+    for (size_t i = 0; i < texts.size(); ++i) {
+      CHECK_OK(sp.Encode(texts[i], &ids[i]));
+      num_tokens += ids[i].size();
+    }
+    run(name, [&]() {
+      PassStats stats{static_cast<int64>(ids.size()), 0, num_tokens};
+      std::string text;
+      for (const auto &v : ids) {
+        CHECK_OK(sp.Decode(v, &text));
+        stats.bytes += text.size();
+      }
+      return stats;
+    });
+  } else {
+    LOG(FATAL) << "unknown benchmark: " << name;
+  }
+}
+
+// Returns the comma separated integers of `list`.
+std::vector<int> ParseInts(absl::string_view list) {
+  std::vector<int> values;
+  for (const auto &value : absl::StrSplit(list, ",")) {
+    int v = 0;
+    CHECK(absl::SimpleAtoi(value, &v)) << "not an integer: " << value;
+    values.push_back(v);
+  }
+  return values;
+}
+
+// Returns --num_threads, or the powers of two up to the number of cores
+// and the number of cores itself if `scaling`, or 1.
+std::vector<int> GetNumThreads(bool scaling) {
+  const std::string &flag = absl::GetFlag(FLAGS_num_threads);
+  if (!flag.empty()) return ParseInts(flag);
+  if (!scaling) return {1};
+  const int num_cores =
+      std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency()));
+  std::vector<int> values;
+  for (int n = 1; n < num_cores; n *= 2) values.push_back(n);
+  values.push_back(num_cores);
+  return values;
+}
+
+// Writes the training corpus `name` of `num_sentences` sentences to a file
+// and returns its name.
+std::string WriteCorpus(absl::string_view name, int num_sentences,
+                        const std::vector<std::string> &lines) {
+  std::string dir = absl::GetFlag(FLAGS_tmp_dir);
+  if (dir.empty()) dir = std::filesystem::temp_directory_path().string();
+  const std::string filename =
+      (std::filesystem::path(dir) /
+       absl::StrCat("spm_benchmark_", name, "_", std::to_string(num_sentences),
+                    ".txt"))
+          .string();
+  auto output = sentencepiece::filesystem::NewWritableFile(filename);
+  CHECK_OK(output->status());
+  if (name == "data") {
+    for (int i = 0; i < num_sentences; ++i) {
+      CHECK(output->WriteLine(lines[i % lines.size()]));
+    }
+  } else if (name == "synthetic") {
+    // Words of 1 to 10 lowercase letters, whose frequencies follow Zipf's
+    // law, in sentences of 5 to 30 words. The seed is fixed, so that the
+    // corpus is the same in every run.
+    std::mt19937 generator(0);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<int> word_size(1, 10);
+    std::uniform_int_distribution<int> sentence_size(5, 30);
+    constexpr int kNumWords = 50000;
+    std::vector<std::string> words(kNumWords);
+    std::vector<double> weights(kNumWords);
+    for (int i = 0; i < kNumWords; ++i) {
+      for (int n = word_size(generator); n > 0; --n) {
+        words[i] += static_cast<char>(letter(generator));
+      }
+      weights[i] = 1.0 / (i + 1);
+    }
+    std::discrete_distribution<int> word(weights.begin(), weights.end());
+    std::string sentence;
+    for (int i = 0; i < num_sentences; ++i) {
+      sentence.clear();
+      for (int n = sentence_size(generator); n > 0; --n) {
+        if (!sentence.empty()) sentence += ' ';
+        sentence += words[word(generator)];
+      }
+      CHECK(output->WriteLine(sentence));
+    }
+  } else {
+    LOG(FATAL) << "unknown corpus: " << name;
+  }
+  return filename;
+}
+
+// Trains a model on every corpus and reports the resources used by every
+// phase of the training. The peak resident set size is of the process, so
+// the corpora are trained on in increasing size.
+void RunTrainBenchmarks(const std::vector<std::string> &lines) {
+  const bool tsv = absl::GetFlag(FLAGS_output_format) == "tsv";
+  if (tsv) {
+    std::cout << "model_type\tcorpus\tsentences\tthreads\tphase\tindex\t"
+                 "wall_seconds\tcpu_seconds\tpeak_rss_bytes\n";
+  } else {
+    std::cout << absl::StrFormat("%-8s %-10s %10s %7s %-24s %12s %12s %10s\n",
+                                 "type", "corpus", "sentences", "threads",
+                                 "phase", "wall(s)", "cpu(s)", "rss(MB)");
+  }
+  std::vector<int> sizes = ParseInts(absl::GetFlag(FLAGS_num_sentences));
+  std::sort(sizes.begin(), sizes.end());
+  for (const int size : sizes) {
+    for (const auto &corpus :
+         absl::StrSplit(absl::GetFlag(FLAGS_corpora), ",")) {
+      const std::string filename = WriteCorpus(corpus, size, lines);
+      for (const auto &type :
+           absl::StrSplit(absl::GetFlag(FLAGS_model_types), ",")) {
+        for (const int num_threads : GetNumThreads(false)) {
+          sentencepiece::TrainerSpec trainer_spec;
+          sentencepiece::NormalizerSpec normalizer_spec;
+          sentencepiece::NormalizerSpec denormalizer_spec;
+          CHECK_OK(sentencepiece::SentencePieceTrainer::MergeSpecsFromArgs(
+              absl::StrCat("--input=", filename, " --model_type=", type,
+                           " --vocab_size=",
+                           std::to_string(absl::GetFlag(FLAGS_vocab_size)),
+                           " --num_threads=", std::to_string(num_threads),
+                           " --hard_vocab_limit=false"),
+              &trainer_spec, &normalizer_spec, &denormalizer_spec));
+          CHECK_OK(sentencepiece::SentencePieceTrainer::PopulateNormalizerSpec(
+              &normalizer_spec));
+          auto trainer = sentencepiece::TrainerFactory::Create(
+              trainer_spec, normalizer_spec, denormalizer_spec);
+          sentencepiece::ModelProto model_proto;
+          CHECK_OK(trainer->Train(nullptr, &model_proto));
+
+          // Phases of the same name, e.g., the EM sub-iterations, are
+          // numbered by `index`, and followed by their sum as "total".
+          sentencepiece::TrainerPhase total;
+          total.name = "total";
+          std::map<std::string, int> counts;
+          auto write = [&](const sentencepiece::TrainerPhase &phase,
+                           int index) {
+            if (tsv) {
+              std::cout << absl::StrFormat(
+                  "%s\t%s\t%d\t%d\t%s\t%d\t%.6f\t%.6f\t%lld\n",
+                  std::string(type).c_str(), std::string(corpus).c_str(),
+                  size, num_threads, phase.name.c_str(), index,
+                  phase.wall_time, phase.cpu_time,
+                  static_cast<long long>(phase.peak_rss));
+            } else {
+              std::cout << absl::StrFormat(
+                  "%-8s %-10s %10d %7d %-24s %12.3f %12.3f %10.1f\n",
+                  std::string(type).c_str(), std::string(corpus).c_str(),
+                  size, num_threads,
+                  absl::StrCat(phase.name, "[", std::to_string(index), "]")
+                      .c_str(),
+                  phase.wall_time, phase.cpu_time, phase.peak_rss / 1e6);
+            }
+          };
+          for (const auto &phase : trainer->phases()) {
+            write(phase, counts[phase.name]++);
+            total.wall_time += phase.wall_time;
+            total.cpu_time += phase.cpu_time;
+            total.peak_rss = std::max(total.peak_rss, phase.peak_rss);
+          }
+          write(total, 0);
+          std::cout.flush();
+        }
+      }
+      std::filesystem::remove(filename);
+    }
+  }
+}
+
+// Runs the batch encoders of `model` on `set` with every --num_threads.
+// "encode_batch" returns a vector of ids per input and "encode_batch_result"
+// fills a BatchEncodeResult.
+void RunScalingBenchmarks(const Model &model, const InputSet &set) {
+  const bool tsv = absl::GetFlag(FLAGS_output_format) == "tsv";
+  const auto &sp = model.sp;
+  std::vector<absl::string_view> inputs(set.texts.begin(), set.texts.end());
+  const double min_time = absl::GetFlag(FLAGS_min_time);
+  for (const std::string name : {"encode_batch", "encode_batch_result"}) {
+    double base_throughput = 0.0;
+    int base_threads = 0;
+    for (const int num_threads : GetNumThreads(true)) {
+      std::vector<std::vector<int>> ids;
+      sentencepiece::BatchEncodeResult result;
+      auto r = sentencepiece::benchmark::Run(
+          [&]() {
+            PassStats stats{static_cast<int64>(inputs.size()), set.bytes, 0};
+            if (name == "encode_batch") {
+              CHECK_OK(sp.EncodeBatch(inputs, num_threads, &ids));
+              for (const auto &v : ids) stats.tokens += v.size();
+            } else {
+              CHECK_OK(sp.EncodeBatch(inputs, num_threads, false, false,
+                                      &result));
+              stats.tokens = result.ids().size();
+            }
+            return stats;
+          },
+          min_time);
+      const double throughput = r.bytes_per_second();
+      if (base_threads == 0) {
+        base_threads = num_threads;
+        base_throughput = throughput;
+      }
+      const double efficiency =
+          base_throughput == 0.0
+              ? 0.0
+              : throughput / base_throughput * base_threads / num_threads;
+      if (tsv) {
+        std::cout << absl::StrFormat("%s\t%s\t%s\t%d\t%.0f\t%.0f\t%.3f\n",
+                                     name.c_str(), model.name.c_str(),
+                                     set.name.c_str(), num_threads, throughput,
+                                     r.tokens_per_second(), efficiency);
+      } else {
+        std::cout << absl::StrFormat(
+            "%-20s %-12s %-8s %7d %10.2f %12.3f %10.2f\n", name.c_str(),
+            model.name.c_str(), set.name.c_str(), num_threads,
+            throughput / 1e6, r.tokens_per_second() / 1e6, efficiency);
+      }
+      std::cout.flush();
+    }
+  }
+}
+
+// Returns the queries of --mode=latency of about `size` bytes, cut from the
+// concatenated `lines` at character boundaries.
+std::vector<std::string> MakeQueries(const std::vector<std::string> &lines,
+                                     size_t size) {
+  constexpr size_t kMaxQueries = 10000;
+  std::vector<std::string> queries;
+  std::string rest;
+  for (const auto &line : lines) {
+    if (!rest.empty()) rest += ' ';
+    rest += line;
+    while (rest.size() >= size && queries.size() < kMaxQueries) {
+      const auto query = sentencepiece::benchmark::TruncateUTF8(rest, size);
+      if (query.empty()) break;
+      queries.emplace_back(query);
+      rest.erase(0, query.size());
+    }
+    if (queries.size() == kMaxQueries) break;
+  }
+  if (queries.empty()) queries.push_back(rest);
+  return queries;
+}
+
+// Calls every Encode() overload of `model` on `queries` one at a time and
+// reports the percentiles of the latency of a call, which includes the
+// overhead of reading the clock, and the allocations per call. The outputs
+// are reused across the calls where the overload allows.
+void RunLatencyBenchmarks(const Model &model, size_t size,
+                          const std::vector<std::string> &queries) {
+  const bool tsv = absl::GetFlag(FLAGS_output_format) == "tsv";
+  const auto &sp = model.sp;
+  // Shares the model with the extra options of a typical serving setup.
+  sentencepiece::SentencePieceProcessor bos_eos;
+  CHECK_OK(bos_eos.ShareModel(sp));
+  CHECK_OK(bos_eos.SetEncodeExtraOptions("bos:eos"));
+
+  std::vector<int> ids;
+  std::vector<std::string> pieces;
+  sentencepiece::SentencePieceText spt;
+  sentencepiece::ImmutableSentencePieceText immutable;
+  const std::vector<
+      std::pair<std::string, std::function<void(absl::string_view)>>>
+      overloads = {
+          {"encode_ids", [&](absl::string_view q) { CHECK_OK(sp.Encode(q, &ids)); }},
+          {"encode_pieces",
+           [&](absl::string_view q) { CHECK_OK(sp.Encode(q, &pieces)); }},
+          {"encode_spt", [&](absl::string_view q) { CHECK_OK(sp.Encode(q, &spt)); }},
+          {"encode_immutable",
+           [&](absl::string_view q) {
+             CHECK_OK(sp.Encode(q, immutable.mutable_proto()));
+           }},
+          {"encode_as_ids", [&](absl::string_view q) { sp.EncodeAsIds(q); }},
+          {"encode_as_pieces",
+           [&](absl::string_view q) { sp.EncodeAsPieces(q); }},
+          {"encode_as_serialized",
+           [&](absl::string_view q) { sp.EncodeAsSerializedProto(q); }},
+          {"encode_ids_bos_eos",
+           [&](absl::string_view q) { CHECK_OK(bos_eos.Encode(q, &ids)); }},
+          {"count_tokens",
+           [&](absl::string_view q) {
+             size_t num_tokens = 0;
+             CHECK_OK(sp.CountTokens(q, &num_tokens));
+           }},
+      };
+
+  constexpr size_t kMaxSamples = 1 << 20;
+  const double min_time = absl::GetFlag(FLAGS_min_time);
+  for (const auto &overload : overloads) {
+    const auto &encode = overload.second;
+    for (const auto &query : queries) encode(query);  // Warms up.
+
+    std::vector<int64> nanos;
+    int64 allocations = 0, allocated_bytes = 0;
+    const double start = sentencepiece::benchmark::WallTime();
+    do {
+      for (const auto &query : queries) {
+        const int64 count = allocation_count, bytes = allocation_bytes;
+        const auto begin = std::chrono::steady_clock::now();
+        encode(query);
+        const auto end = std::chrono::steady_clock::now();
+        allocations += allocation_count - count;
+        allocated_bytes += allocation_bytes - bytes;
+        nanos.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+                .count());
+      }
+    } while (sentencepiece::benchmark::WallTime() - start < min_time &&
+             nanos.size() < kMaxSamples);
+
+    std::sort(nanos.begin(), nanos.end());
+    const double calls = nanos.size();
+    const auto percentile = [&](double q) {
+      return static_cast<long long>(
+          sentencepiece::benchmark::Percentile(nanos, q));
+    };
+    if (tsv) {
+      std::cout << absl::StrFormat(
+          "%s\t%s\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\t%.2f\t%.1f\n",
+          overload.first.c_str(), model.name.c_str(), static_cast<int>(size),
+          static_cast<long long>(nanos.size()), percentile(0.5),
+          percentile(0.99), percentile(0.999), percentile(1.0),
+          allocations / calls, allocated_bytes / calls);
+    } else {
+      std::cout << absl::StrFormat(
+          "%-22s %-12s %5d %9lld %9lld %9lld %9lld %9lld %8.2f %9.1f\n",
+          overload.first.c_str(), model.name.c_str(), static_cast<int>(size),
+          static_cast<long long>(nanos.size()), percentile(0.5),
+          percentile(0.99), percentile(0.999), percentile(1.0),
+          allocations / calls, allocated_bytes / calls);
+    }
+    std::cout.flush();
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ScopedResourceDestructor cleaner;
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+
+  const std::vector<std::string> lines = ReadLines(absl::GetFlag(FLAGS_input));
+  if (absl::GetFlag(FLAGS_mode) == "train") {
+    RunTrainBenchmarks(lines);
+    return 0;
+  }
+  if (absl::GetFlag(FLAGS_mode) == "latency") {
+    if (absl::GetFlag(FLAGS_output_format) == "tsv") {
+      std::cout << "benchmark\tmodel\tquery_bytes\tcalls\tp50_ns\tp99_ns\t"
+                   "p999_ns\tmax_ns\tallocs_per_call\tbytes_per_call\n";
+    } else {
+      std::cout << absl::StrFormat(
+          "%-22s %-12s %5s %9s %9s %9s %9s %9s %8s %9s\n", "benchmark",
+          "model", "bytes", "calls", "p50_ns", "p99_ns", "p99.9_ns", "max_ns",
+          "allocs", "alloc_B");
+    }
+    const auto models = LoadModels();
+    for (const auto size : ParseInts(absl::GetFlag(FLAGS_query_sizes))) {
+      const auto queries = MakeQueries(lines, size);
+      for (const auto &model : models) {
+        RunLatencyBenchmarks(*model, size, queries);
+      }
+    }
+    return 0;
+  }
+  const bool scaling = absl::GetFlag(FLAGS_mode) == "scaling";
+  CHECK(scaling || absl::GetFlag(FLAGS_mode) == "encode")
+      << "unknown mode: " << absl::GetFlag(FLAGS_mode);
+
+  std::vector<InputSet> sets;
+  for (const auto &name :
+       absl::StrSplit(absl::GetFlag(FLAGS_input_sets), ",")) {
+    sets.push_back(MakeInputSet(name, lines));
+  }
+
+  const auto models = LoadModels();
+  if (scaling) {
+    if (absl::GetFlag(FLAGS_output_format) == "tsv") {
+      std::cout << "benchmark\tmodel\tinputs\tthreads\tbytes_per_second\t"
+                   "tokens_per_second\tefficiency\n";
+    } else {
+      std::cout << absl::StrFormat("%-20s %-12s %-8s %7s %10s %12s %10s\n",
+                                   "benchmark", "model", "inputs", "threads",
+                                   "MB/s", "Mtokens/s", "efficiency");
+    }
+    for (const auto &model : models) {
+      for (const auto &set : sets) RunScalingBenchmarks(*model, set);
+    }
+    return 0;
+  }
+
+  const std::vector<std::string> benchmarks =
+      absl::StrSplit(absl::GetFlag(FLAGS_benchmarks), ",");
+  sentencepiece::benchmark::Reporter reporter(
+      absl::GetFlag(FLAGS_output_format));
+  for (const auto &model : models) {
+    for (const auto &set : sets) {
+      for (const auto &name : benchmarks) {
+        RunBenchmark(name, *model, set, &reporter);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// Writes a model without its unused pieces, e.g., for a deployment
+// restricted to a vocabulary, with the tries prebuilt, e.g.,
+//
+//   spm_compact --model=m.model --vocabulary=vocab.L1 --output=m.L1.model
+//       --id_map_output=m.L1.ids
+//
+// See SentencePieceProcessor::ExportCompactModel(). --id_map_output lists
+// the old and the new id of every piece, -1 for the removed ones, and
+// --compiled_output also saves the compacted model as a compiled model.
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "filesystem.h"
+#include "init.h"
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/flags/flag.h"
+#include "third_party/absl/strings/str_cat.h"
+
+ABSL_FLAG(std::string, model, "", "input model file name");
+ABSL_FLAG(std::string, output, "", "output model file name");
+ABSL_FLAG(std::string, vocabulary, "",
+          "Restrict the vocabulary to the tokens in \"vocabulary\" file "
+          "before compacting, as spm_encode --vocabulary does");
+ABSL_FLAG(int32, vocabulary_threshold, 0,
+          "Words with frequency < threshold will be treated as OOV");
+ABSL_FLAG(bool, remap_ids, true,
+          "removes the unused pieces and renumbers the others. Otherwise "
+          "they are kept as unused with their ids");
+ABSL_FLAG(std::string, id_map_output, "",
+          "writes the old and the new id of every piece to this file");
+ABSL_FLAG(std::string, compiled_output, "",
+          "also saves the compacted model as a compiled model to this file");
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ScopedResourceDestructor cleaner;
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+
+  CHECK(!absl::GetFlag(FLAGS_model).empty());
+  CHECK(!absl::GetFlag(FLAGS_output).empty());
+
+  sentencepiece::SentencePieceProcessor sp;
+  CHECK_OK(sp.Load(absl::GetFlag(FLAGS_model)));
+  if (!absl::GetFlag(FLAGS_vocabulary).empty()) {
+    CHECK_OK(sp.LoadVocabulary(absl::GetFlag(FLAGS_vocabulary),
+                               absl::GetFlag(FLAGS_vocabulary_threshold)));
+  }
+
+  sentencepiece::ModelProto model_proto;
+  std::vector<int> id_map;
+  CHECK_OK(sp.ExportCompactModel(absl::GetFlag(FLAGS_remap_ids), &model_proto,
+                                 &id_map));
+  LOG(INFO) << "Compacted " << id_map.size() << " pieces into "
+            << model_proto.pieces_size() << " pieces.";
+
+  {
+    auto output = sentencepiece::filesystem::NewWritableFile(
+        absl::GetFlag(FLAGS_output), true);
+    CHECK_OK(output->status());
+    CHECK(output->Write(model_proto.SerializeAsString()));
+  }
+
+  if (!absl::GetFlag(FLAGS_id_map_output).empty()) {
+    auto output = sentencepiece::filesystem::NewWritableFile(
+        absl::GetFlag(FLAGS_id_map_output));
+    CHECK_OK(output->status());
+    for (size_t id = 0; id < id_map.size(); ++id) {
+      output->WriteLine(absl::StrCat(id, "\t", id_map[id]));
+    }
+  }
+
+  if (!absl::GetFlag(FLAGS_compiled_output).empty()) {
+    sentencepiece::SentencePieceProcessor compact;
+    CHECK_OK(compact.Load(model_proto));
+    CHECK_OK(compact.SaveCompiledModel(absl::GetFlag(FLAGS_compiled_output)));
+  }
+
+  return 0;
+}
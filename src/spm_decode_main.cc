@@ -13,11 +13,13 @@
 // limitations under the License.!
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "common.h"
 #include "filesystem.h"
+#include "indexed_ids.h"
 #include "init.h"
 #include "sentencepiece.pb.h"
 #include "sentencepiece_processor.h"
@@ -28,10 +30,98 @@
 ABSL_FLAG(std::string, model, "", "model file name");
 ABSL_FLAG(std::string, input, "", "input filename");
 ABSL_FLAG(std::string, output, "", "output filename");
-ABSL_FLAG(std::string, input_format, "piece", "choose from piece or id");
+ABSL_FLAG(std::string, input_format, "piece",
+          "choose from piece, id, id_uint16, or id_uint32. id_uint16 and "
+          "id_uint32 read the packed ids of spm_encode with the index "
+          "<input>.idx");
+ABSL_FLAG(std::string, input_index, "",
+          "index filename of id_uint16 and id_uint32, <input>.idx by "
+          "default");
 ABSL_FLAG(std::string, output_format, "string", "choose from string or proto");
 ABSL_FLAG(std::string, extra_options, "",
           "':' separated encoder extra options, e.g., \"reverse:bos:eos\"");
+ABSL_FLAG(int32, num_threads, 1,
+          "Number of threads decoding the documents. The output keeps the "
+          "order of the input");
+ABSL_FLAG(int32, batch_size, 1000,
+          "Number of documents decoded by a thread at once with "
+          "--num_threads");
+ABSL_FLAG(int32, max_batches_in_flight, 0,
+          "Number of batches read but not written yet with --num_threads, "
+          "which bounds the memory. 0 means 2 * num_threads");
+
+namespace {
+
+// A line of pieces or ids, or the packed ids of a document.
+struct Document {
+  std::string line;
+  std::vector<int> ids;
+};
+
+// Scratch of decoding the documents, to which their output is appended.
+struct DecodeState {
+  std::vector<absl::string_view> pieces;
+  std::vector<int> ids;
+  std::string detok;
+  sentencepiece::SentencePieceText spt;
+  std::string output;
+};
+
+using ProcessFunc =
+    std::function<void(const Document &document, DecodeState *state)>;
+
+// Reads the documents of the input files in order.
+class DocumentReader {
+ public:
+  DocumentReader(const std::vector<std::string> &filenames, int id_size,
+                 const std::string &index_filename)
+      : filenames_(filenames),
+        id_size_(id_size),
+        index_filename_(index_filename) {}
+
+  // Returns false at the end of the last file.
+  bool Next(Document *document) {
+    while (true) {
+      if (text_ == nullptr && ids_ == nullptr) {
+        if (file_index_ == filenames_.size()) return false;
+        Open(filenames_[file_index_++]);
+      }
+      if (text_ != nullptr) {
+        if (text_->ReadLine(&document->line)) return true;
+        CHECK_OK(text_->status());
+        text_.reset();
+      } else {
+        if (ids_->Next(&document->ids)) return true;
+        CHECK_OK(ids_->status());
+        ids_.reset();
+      }
+    }
+  }
+
+ private:
+  void Open(const std::string &filename) {
+    if (id_size_ == 0) {
+      text_ = sentencepiece::filesystem::NewReadableFile(filename);
+      CHECK_OK(text_->status());
+      return;
+    }
+    ids_ = std::make_unique<sentencepiece::indexed_ids::Reader>();
+    CHECK_OK(ids_->Open(filename, index_filename_.empty()
+                                      ? filename + ".idx"
+                                      : index_filename_));
+    CHECK_EQ(id_size_, ids_->id_size())
+        << filename << " has ids of " << ids_->id_size() << " bytes.";
+  }
+
+  const std::vector<std::string> filenames_;
+  const int id_size_;
+  const std::string index_filename_;
+  size_t file_index_ = 0;
+  std::unique_ptr<sentencepiece::filesystem::ReadableFile> text_;
+  std::unique_ptr<sentencepiece::indexed_ids::Reader> ids_;
+};
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   sentencepiece::ScopedResourceDestructor cleaner;
@@ -55,61 +145,109 @@ int main(int argc, char *argv[]) {
   CHECK_OK(sp.Load(absl::GetFlag(FLAGS_model)));
   CHECK_OK(sp.SetDecodeExtraOptions(absl::GetFlag(FLAGS_extra_options)));
 
-  auto output =
-      sentencepiece::filesystem::NewWritableFile(absl::GetFlag(FLAGS_output));
+  const int num_threads = absl::GetFlag(FLAGS_num_threads);
+  CHECK_GT(num_threads, 0);
+  auto output = sentencepiece::filesystem::NewWritableFile(
+      absl::GetFlag(FLAGS_output), false,
+      /*async_flush=*/num_threads > 1);
   CHECK_OK(output->status());
 
-  std::string detok, line;
-  sentencepiece::SentencePieceText spt;
-  std::function<void(const std::vector<std::string> &pieces)> process;
+  const std::string input_format = absl::GetFlag(FLAGS_input_format);
+  int id_size = 0;
+  if (input_format == "id_uint16" || input_format == "id_uint32") {
+    id_size = input_format == "id_uint16" ? 2 : 4;
+    CHECK(!(rest_args.size() == 1 && rest_args[0].empty()))
+        << input_format << " cannot be read from stdin.";
+    CHECK(absl::GetFlag(FLAGS_input_index).empty() || rest_args.size() == 1)
+        << "--input_index takes one input file.";
+  }
 
-  auto ToIds = [&](const std::vector<std::string> &pieces) {
-    std::vector<int> ids;
-    ids.reserve(pieces.size());
-    for (const auto &s : pieces) {
-      ids.push_back(atoi(s.c_str()));
-    }
-    return ids;
-  };
+  ProcessFunc process;
+  const bool is_string = absl::GetFlag(FLAGS_output_format) == "string";
+  if (!is_string && absl::GetFlag(FLAGS_output_format) != "proto") {
+    LOG(FATAL) << "Unknown output format: "
+               << absl::GetFlag(FLAGS_output_format);
+  }
 
-  if (absl::GetFlag(FLAGS_input_format) == "piece") {
-    if (absl::GetFlag(FLAGS_output_format) == "string") {
-      process = [&](const std::vector<std::string> &pieces) {
-        CHECK_OK(sp.Decode(pieces, &detok));
-        output->WriteLine(detok);
-      };
-    } else if (absl::GetFlag(FLAGS_output_format) == "proto") {
-      process = [&](const std::vector<std::string> &pieces) {
-        CHECK_OK(sp.Decode(pieces, &spt));
-      };
-    } else {
-      LOG(FATAL) << "Unknown output format: "
-                 << absl::GetFlag(FLAGS_output_format);
-    }
-  } else if (absl::GetFlag(FLAGS_input_format) == "id") {
-    if (absl::GetFlag(FLAGS_output_format) == "string") {
-      process = [&](const std::vector<std::string> &pieces) {
-        CHECK_OK(sp.Decode(ToIds(pieces), &detok));
-        output->WriteLine(detok);
-      };
-    } else if (absl::GetFlag(FLAGS_output_format) == "proto") {
-      process = [&](const std::vector<std::string> &pieces) {
-        CHECK_OK(sp.Decode(ToIds(pieces), &spt));
-      };
+  // Decodes `ids` with the proto-free path of the string output.
+  auto decode_ids = [&sp, is_string](const std::vector<int> &ids,
+                                     DecodeState *state) {
+    if (is_string) {
+      CHECK_OK(sp.Decode(ids, &state->detok));
+      state->output.append(state->detok);
+      state->output += '\n';
     } else {
-      LOG(FATAL) << "Unknown output format: "
-                 << absl::GetFlag(FLAGS_output_format);
+      CHECK_OK(sp.Decode(ids, &state->spt));
     }
+  };
+
+  if (input_format == "piece") {
+    process = [&sp, is_string](const Document &document, DecodeState *state) {
+      state->pieces = absl::StrSplit(document.line, " ");
+      if (is_string) {
+        CHECK_OK(sp.Decode(state->pieces, &state->detok));
+        state->output.append(state->detok);
+        state->output += '\n';
+      } else {
+        CHECK_OK(sp.Decode(state->pieces, &state->spt));
+      }
+    };
+  } else if (input_format == "id") {
+    process = [decode_ids](const Document &document, DecodeState *state) {
+      state->ids.clear();
+      for (const auto piece : absl::StrSplit(document.line, " ")) {
+        state->ids.push_back(atoi(std::string(piece).c_str()));
+      }
+      decode_ids(state->ids, state);
+    };
+  } else if (id_size > 0) {
+    process = [decode_ids](const Document &document, DecodeState *state) {
+      decode_ids(document.ids, state);
+    };
   } else {
-    LOG(FATAL) << "Unknown input format: " << absl::GetFlag(FLAGS_input_format);
+    LOG(FATAL) << "Unknown input format: " << input_format;
   }
 
-  for (const auto &filename : rest_args) {
-    auto input = sentencepiece::filesystem::NewReadableFile(filename);
-    CHECK_OK(input->status());
-    while (input->ReadLine(&line)) {
-      const auto pieces = absl::StrSplit(line, " ");
-      process(pieces);
+  DocumentReader reader(rest_args, id_size, absl::GetFlag(FLAGS_input_index));
+  if (num_threads > 1) {
+    const int batch_size = absl::GetFlag(FLAGS_batch_size);
+    const int max_batches = absl::GetFlag(FLAGS_max_batches_in_flight) > 0
+                                ? absl::GetFlag(FLAGS_max_batches_in_flight)
+                                : 2 * num_threads;
+    CHECK_GT(batch_size, 0);
+    struct Batch {
+      std::vector<Document> documents;  // Only the first `size` are used.
+      size_t size = 0;
+      DecodeState state;
+    };
+    sentencepiece::ThreadPool pool(num_threads);
+    sentencepiece::RunOrderedPipeline<Batch>(
+        &pool, max_batches,
+        [&](Batch *batch) {
+          batch->documents.resize(batch_size);
+          batch->size = 0;
+          while (batch->size < batch->documents.size() &&
+                 reader.Next(&batch->documents[batch->size])) {
+            ++batch->size;
+          }
+          return batch->size > 0;
+        },
+        [&](Batch *batch) {
+          for (size_t i = 0; i < batch->size; ++i) {
+            process(batch->documents[i], &batch->state);
+          }
+        },
+        [&](Batch *batch) {
+          CHECK(output->Write(batch->state.output));
+          batch->state.output.clear();
+        });
+  } else {
+    Document document;
+    DecodeState state;
+    while (reader.Next(&document)) {
+      process(document, &state);
+      CHECK(output->Write(state.output));
+      state.output.clear();
     }
   }
 
@@ -0,0 +1,83 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// libFuzzer target comparing every fast path of the encoders with its
+// reference path (see differential.h) on the fuzzed input, which aborts on
+// a mismatch. The models are trained on SPM_FUZZ_CORPUS at startup, or
+// loaded from the comma separated files in $SPM_FUZZ_MODELS.
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "differential.h"
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_processor.h"
+#include "sentencepiece_trainer.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_split.h"
+
+namespace {
+
+std::vector<std::unique_ptr<sentencepiece::differential::Harness>>
+    *harnesses = nullptr;
+
+void AddHarness(const sentencepiece::ModelProto &model_proto) {
+  auto harness =
+      std::make_unique<sentencepiece::differential::Harness>(model_proto);
+  CHECK_OK(harness->status());
+  harnesses->push_back(std::move(harness));
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  harnesses =
+      new std::vector<std::unique_ptr<sentencepiece::differential::Harness>>;
+  const char *models = std::getenv("SPM_FUZZ_MODELS");
+  if (models != nullptr && *models != '\0') {
+    for (const auto &filename : absl::StrSplit(models, ",")) {
+      sentencepiece::SentencePieceProcessor sp;
+      CHECK_OK(sp.Load(filename));
+      AddHarness(sp.model_proto());
+    }
+    return 0;
+  }
+  for (const char *type : {"unigram", "bpe", "char", "word"}) {
+    std::string serialized;
+    CHECK_OK(sentencepiece::SentencePieceTrainer::Train(
+        absl::StrCat("--input=", SPM_FUZZ_CORPUS, " --model_type=", type,
+                     " --vocab_size=1000 --hard_vocab_limit=false"
+                     " --input_sentence_size=2000 --minloglevel=2"),
+        nullptr, &serialized));
+    sentencepiece::ModelProto model_proto;
+    CHECK(model_proto.ParseFromString(serialized));
+    AddHarness(model_proto);
+  }
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  const absl::string_view input(reinterpret_cast<const char *>(data), size);
+  std::vector<sentencepiece::differential::Mismatch> mismatches;
+  for (const auto &harness : *harnesses) {
+    if (harness->Compare(input, &mismatches)) continue;
+    const auto &mismatch = mismatches.front();
+    LOG(FATAL) << mismatch.pair << " mismatch\nfast:      " << mismatch.fast
+               << "\nreference: " << mismatch.reference;
+  }
+  return 0;
+}
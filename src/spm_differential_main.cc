@@ -0,0 +1,161 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// Runs every fast path of the encoders next to its reference path on a
+// corpus (see differential.h), and reports the mismatches and how much
+// faster the fast path is, e.g.,
+//
+//   spm_differential --model=m.model --input=data/botchan.txt
+//
+// Without --model, a model of every type in --model_types is trained on
+// --input first. Exits with 1 if any pair mismatches, so that it can run in
+// the CI. spm_differential_fuzzer compares the same pairs on fuzzed inputs.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "differential.h"
+#include "filesystem.h"
+#include "init.h"
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_processor.h"
+#include "sentencepiece_trainer.h"
+#include "third_party/absl/flags/flag.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_format.h"
+#include "third_party/absl/strings/str_split.h"
+
+ABSL_FLAG(std::string, input, "", "corpus file, one input per line");
+ABSL_FLAG(std::string, model, "",
+          "comma separated model files. If empty, the models of "
+          "--model_types are trained on --input");
+ABSL_FLAG(std::string, model_types, "unigram,bpe,char,word",
+          "comma separated model types trained without --model");
+ABSL_FLAG(int32, vocab_size, 8000, "vocabulary size of the trained models");
+ABSL_FLAG(double, min_time, 0.2,
+          "minimum seconds of timing a path. 0 times a single pass");
+ABSL_FLAG(int32, max_mismatches, 10, "maximum number of mismatches shown");
+ABSL_FLAG(std::string, output_format, "text", "choose from text or tsv");
+
+namespace {
+
+struct Model {
+  std::string name;
+  sentencepiece::ModelProto model_proto;
+};
+
+std::vector<Model> LoadModels() {
+  std::vector<Model> models;
+  const std::string &filenames = absl::GetFlag(FLAGS_model);
+  if (!filenames.empty()) {
+    for (const auto &filename : absl::StrSplit(filenames, ",")) {
+      sentencepiece::SentencePieceProcessor sp;
+      CHECK_OK(sp.Load(filename));
+      const size_t pos = filename.find_last_of("/\\");
+      models.push_back(
+          {std::string(pos == absl::string_view::npos
+                           ? filename
+                           : filename.substr(pos + 1)),
+           sp.model_proto()});
+    }
+    return models;
+  }
+  for (const auto &type :
+       absl::StrSplit(absl::GetFlag(FLAGS_model_types), ",")) {
+    std::string serialized;
+    CHECK_OK(sentencepiece::SentencePieceTrainer::Train(
+        absl::StrCat("--input=", absl::GetFlag(FLAGS_input),
+                     " --model_type=", type, " --vocab_size=",
+                     std::to_string(absl::GetFlag(FLAGS_vocab_size)),
+                     " --hard_vocab_limit=false"),
+        nullptr, &serialized));
+    Model model;
+    model.name = std::string(type);
+    CHECK(model.model_proto.ParseFromString(serialized));
+    models.push_back(std::move(model));
+  }
+  return models;
+}
+
+std::vector<std::string> ReadLines(const std::string &filename) {
+  auto input = sentencepiece::filesystem::NewReadableFile(filename);
+  CHECK_OK(input->status());
+  std::vector<std::string> lines;
+  std::string line;
+  while (input->ReadLine(&line)) lines.push_back(line);
+  return lines;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ScopedResourceDestructor cleaner;
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+  CHECK(!absl::GetFlag(FLAGS_input).empty()) << "--input is required";
+  const bool tsv = absl::GetFlag(FLAGS_output_format) == "tsv";
+  CHECK(tsv || absl::GetFlag(FLAGS_output_format) == "text")
+      << "unknown output format: " << absl::GetFlag(FLAGS_output_format);
+
+  const std::vector<std::string> inputs =
+      ReadLines(absl::GetFlag(FLAGS_input));
+  if (tsv) {
+    std::cout << "model\tpair\tinputs\tmismatches\tfast_seconds\t"
+                 "reference_seconds\tspeedup\n";
+  } else {
+    std::cout << absl::StrFormat("%-12s %-20s %8s %10s %12s %12s %8s\n",
+                                 "model", "pair", "inputs", "mismatches",
+                                 "fast_ms", "reference_ms", "speedup");
+  }
+
+  int64 total_mismatches = 0;
+  std::vector<sentencepiece::differential::Mismatch> mismatches;
+  for (const auto &model : LoadModels()) {
+    sentencepiece::differential::Harness harness(model.model_proto);
+    CHECK_OK(harness.status());
+    const auto results = harness.Run(
+        inputs, absl::GetFlag(FLAGS_min_time), &mismatches);
+    for (const auto &result : results) {
+      total_mismatches += result.mismatches;
+      if (tsv) {
+        std::cout << absl::StrFormat(
+            "%s\t%s\t%lld\t%lld\t%.6f\t%.6f\t%.3f\n", model.name.c_str(),
+            result.name.c_str(), static_cast<long long>(result.inputs),
+            static_cast<long long>(result.mismatches), result.fast_seconds,
+            result.reference_seconds, result.speedup());
+      } else {
+        std::cout << absl::StrFormat(
+            "%-12s %-20s %8lld %10lld %12.3f %12.3f %8.2f\n",
+            model.name.c_str(), result.name.c_str(),
+            static_cast<long long>(result.inputs),
+            static_cast<long long>(result.mismatches),
+            1e3 * result.fast_seconds, 1e3 * result.reference_seconds,
+            result.speedup());
+      }
+    }
+    for (size_t i = 0; i < mismatches.size() &&
+                       i < static_cast<size_t>(
+                               absl::GetFlag(FLAGS_max_mismatches));
+         ++i) {
+      const auto &mismatch = mismatches[i];
+      LOG(ERROR) << model.name << " " << mismatch.pair
+                 << " mismatch\ninput:     " << mismatch.input
+                 << "\nfast:      " << mismatch.fast
+                 << "\nreference: " << mismatch.reference;
+    }
+    mismatches.clear();
+  }
+  return total_mismatches == 0 ? 0 : 1;
+}
@@ -12,28 +12,44 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "common.h"
 #include "filesystem.h"
+#include "indexed_ids.h"
 #include "init.h"
 #include "sentencepiece.pb.h"
 #include "sentencepiece_processor.h"
-#include "third_party/absl/container/flat_hash_map.h"
 #include "third_party/absl/flags/flag.h"
 #include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_format.h"
 #include "third_party/absl/strings/str_join.h"
+#include "third_party/absl/strings/str_replace.h"
 #include "trainer_interface.h"
+#include "util.h"
 
 ABSL_FLAG(std::string, model, "", "model file name");
 ABSL_FLAG(
     std::string, output_format, "piece",
     "choose from piece, id, proto, sample_piece, sample_id, sample_proto, "
-    "nbest_piece, nbest_id, or nbest_proto");
+    "nbest_piece, nbest_id, nbest_proto, id_uint16, or id_uint32. "
+    "id_uint16 and id_uint32 write the ids of all the lines packed in "
+    "little endian, and the offsets of the lines to --output_index");
 ABSL_FLAG(std::string, input, "", "input filename");
 ABSL_FLAG(std::string, output, "", "output filename");
+ABSL_FLAG(std::string, output_index, "",
+          "index filename of id_uint16 and id_uint32, <output>.idx by "
+          "default");
+ABSL_FLAG(std::string, output_template, "",
+          "Writes the output of every input file to its own file, named by "
+          "replacing {name} with the basename of the input file and {index} "
+          "with its position in the inputs, e.g., \"out/{name}.ids\". "
+          "--num_threads files are encoded at once, one per thread");
 ABSL_FLAG(std::string, extra_options, "",
           "':' separated encoder extra options, e.g., \"reverse:bos:eos\"");
 ABSL_FLAG(int32, nbest_size, 10, "NBest size");
@@ -50,6 +66,291 @@ ABSL_FLAG(int32, vocabulary_threshold, 0,
           "Words with frequency < threshold will be treated as OOV");
 ABSL_FLAG(bool, generate_vocabulary, false,
           "Generates vocabulary file instead of segmentation");
+ABSL_FLAG(int32, encode_cache_size, 0,
+          "Caches the segmentation of this many words. 0 disables the cache");
+ABSL_FLAG(std::string, stats, "",
+          "Writes the statistics of the encoded corpus to this file: tokens "
+          "per line, bytes per token, the rates of the unknown and byte "
+          "fallback tokens, and the frequency of every piece. They are of "
+          "the first segmentation of the nbest and sample formats");
+ABSL_FLAG(int32, num_threads, 1,
+          "Number of threads encoding the lines. The output keeps the order "
+          "of the input. With more than one, sampling depends on the thread "
+          "encoding a line");
+ABSL_FLAG(int32, batch_size, 1000,
+          "Number of lines encoded by a thread at once with --num_threads");
+ABSL_FLAG(int32, max_batches_in_flight, 0,
+          "Number of batches read but not written yet with --num_threads, "
+          "which bounds the memory. 0 means 2 * num_threads");
+
+namespace {
+
+// Statistics of the encoded lines.
+struct EncodeStats {
+  int64 num_lines = 0;
+  int64 num_bytes = 0;  // Of the input lines, without the newlines.
+  int64 num_unknown = 0;
+  int64 num_byte_fallback = 0;
+  std::vector<int64> piece_counts;  // Indexed by id.
+  std::vector<int64> line_counts;   // Indexed by the number of tokens.
+
+  void Add(absl::string_view line, const std::vector<int> &ids,
+           const sentencepiece::SentencePieceProcessor &sp) {
+    if (piece_counts.empty()) piece_counts.resize(sp.GetPieceSize(), 0);
+    if (line_counts.size() <= ids.size()) line_counts.resize(ids.size() + 1, 0);
+    ++num_lines;
+    num_bytes += line.size();
+    ++line_counts[ids.size()];
+    for (const int id : ids) {
+      ++piece_counts[id];
+      if (sp.IsUnknown(id)) ++num_unknown;
+      if (sp.IsByte(id)) ++num_byte_fallback;
+    }
+  }
+
+  // Adds `other` and clears it.
+  void Merge(EncodeStats *other) {
+    num_lines += other->num_lines;
+    num_bytes += other->num_bytes;
+    num_unknown += other->num_unknown;
+    num_byte_fallback += other->num_byte_fallback;
+    Accumulate(&other->piece_counts, &piece_counts);
+    Accumulate(&other->line_counts, &line_counts);
+    other->num_lines = other->num_bytes = 0;
+    other->num_unknown = other->num_byte_fallback = 0;
+  }
+
+  // Writes the summary as "key\tvalue" lines, followed by
+  // "piece\t<id>\t<piece>\t<count>" of every piece.
+  void Write(const sentencepiece::SentencePieceProcessor &sp,
+             sentencepiece::filesystem::WritableFile *output) const {
+    int64 num_tokens = 0;
+    for (size_t n = 0; n < line_counts.size(); ++n) {
+      num_tokens += n * line_counts[n];
+    }
+    auto ratio = [](int64 x, int64 y) {
+      return y == 0 ? 0.0 : static_cast<double>(x) / y;
+    };
+    // The number of the tokens of the line at `rank` of the sorted lines.
+    auto percentile = [this](double rank) {
+      int64 seen = 0;
+      for (size_t n = 0; n < line_counts.size(); ++n) {
+        seen += line_counts[n];
+        if (seen > 0 && seen >= rank) return static_cast<int64>(n);
+      }
+      return static_cast<int64>(0);
+    };
+    int64 num_unused = 0;
+    for (size_t id = 0; id < piece_counts.size(); ++id) {
+      if (piece_counts[id] == 0 && !sp.IsControl(id)) ++num_unused;
+    }
+    std::string text;
+    auto write = [&text](absl::string_view key, const std::string &value) {
+      text += absl::StrCat(key, "\t", value) + "\n";
+    };
+    write("lines", std::to_string(num_lines));
+    write("bytes", std::to_string(num_bytes));
+    write("tokens", std::to_string(num_tokens));
+    write("bytes_per_token",
+          absl::StrFormat("%.4f", ratio(num_bytes, num_tokens)));
+    write("tokens_per_line",
+          absl::StrFormat("%.4f", ratio(num_tokens, num_lines)));
+    write("tokens_per_line_p50", std::to_string(percentile(0.5 * num_lines)));
+    write("tokens_per_line_p90", std::to_string(percentile(0.9 * num_lines)));
+    write("tokens_per_line_p99", std::to_string(percentile(0.99 * num_lines)));
+    write("tokens_per_line_max",
+          std::to_string(line_counts.empty() ? 0 : line_counts.size() - 1));
+    write("unknown_tokens", std::to_string(num_unknown));
+    write("unknown_rate",
+          absl::StrFormat("%.6f", ratio(num_unknown, num_tokens)));
+    write("byte_fallback_tokens", std::to_string(num_byte_fallback));
+    write("byte_fallback_rate",
+          absl::StrFormat("%.6f", ratio(num_byte_fallback, num_tokens)));
+    write("unused_pieces", std::to_string(num_unused));
+    for (int id = 0; id < sp.GetPieceSize(); ++id) {
+      const int64 count =
+          id < static_cast<int>(piece_counts.size()) ? piece_counts[id] : 0;
+      text += absl::StrCat("piece\t", std::to_string(id), "\t",
+                           sp.IdToPiece(id), "\t", std::to_string(count)) +
+              "\n";
+    }
+    CHECK(output->Write(text));
+  }
+
+ private:
+  // Adds `from` to `to` and zeros `from`.
+  static void Accumulate(std::vector<int64> *from, std::vector<int64> *to) {
+    if (to->size() < from->size()) to->resize(from->size(), 0);
+    for (size_t i = 0; i < from->size(); ++i) (*to)[i] += (*from)[i];
+    std::fill(from->begin(), from->end(), 0);
+  }
+};
+
+// Scratch of encoding the lines, to which their output is appended.
+struct EncodeState {
+  std::vector<std::string> sps;
+  std::vector<int> ids;
+  std::vector<std::vector<std::string>> nbest_sps;
+  std::vector<std::vector<int>> nbest_ids;
+  sentencepiece::SentencePieceText spt;
+  sentencepiece::NBestSentencePieceText nbest_spt;
+  std::vector<int64> counts;  // Of the piece ids, by --generate_vocabulary.
+  EncodeStats stats;           // By --stats.
+  std::vector<int> stats_ids;
+  std::string output;
+  std::vector<uint32> num_ids;  // Of every line in the binary formats.
+
+  void AppendLine(absl::string_view line) {
+    output.append(line.data(), line.size());
+    output += '\n';
+  }
+};
+
+using ProcessFunc =
+    std::function<void(absl::string_view line, EncodeState *state)>;
+// Writes the output of the lines in `state` and clears it.
+using WriteFunc = std::function<void(EncodeState *state)>;
+
+// Encodes the lines of `filenames` with `process` in a pipeline: this thread
+// reads batches of `batch_size` lines, `num_threads` workers encode them, and
+// a writer thread passes them to `write` in the order of the input. At most
+// `max_batches` batches are in flight.
+void EncodeInParallel(const std::vector<std::string> &filenames,
+                      int num_threads, int batch_size, int max_batches,
+                      const ProcessFunc &process, const WriteFunc &write) {
+  struct Batch {
+    std::vector<std::string> lines;  // Only the first `size` are used.
+    size_t size = 0;
+    EncodeState state;
+  };
+  size_t file_index = 0;
+  std::unique_ptr<sentencepiece::filesystem::ReadableFile> input;
+  sentencepiece::ThreadPool pool(num_threads);
+  sentencepiece::RunOrderedPipeline<Batch>(
+      &pool, max_batches,
+      [&](Batch *batch) {
+        batch->lines.resize(batch_size);
+        batch->size = 0;
+        while (batch->size < batch->lines.size()) {
+          if (input == nullptr) {
+            if (file_index == filenames.size()) break;
+            input = sentencepiece::filesystem::NewReadableFile(
+                filenames[file_index++]);
+            CHECK_OK(input->status());
+          }
+          if (input->ReadLine(&batch->lines[batch->size])) {
+            ++batch->size;
+          } else {
+            CHECK_OK(input->status());
+            input.reset();
+          }
+        }
+        return batch->size > 0;
+      },
+      [&](Batch *batch) {
+        for (size_t i = 0; i < batch->size; ++i) {
+          process(batch->lines[i], &batch->state);
+        }
+      },
+      [&](Batch *batch) { write(&batch->state); });
+}
+
+// An output file, and the index file of the binary formats.
+class EncodeOutput {
+ public:
+  // `id_size` is the bytes of an id in the binary formats, and 0 otherwise.
+  EncodeOutput(const std::string &filename, const std::string &index_filename,
+               int id_size, bool async_flush)
+      : id_size_(id_size) {
+    output_ = sentencepiece::filesystem::NewWritableFile(
+        filename, id_size_ > 0, async_flush);
+    CHECK_OK(output_->status());
+    if (id_size_ == 0) return;
+    index_ = sentencepiece::filesystem::NewWritableFile(index_filename, true);
+    CHECK_OK(index_->status());
+    CHECK(index_->Write(sentencepiece::indexed_ids::IndexHeader(id_size_)));
+  }
+
+  // Writes the output of the lines in `state` and clears it.
+  void Write(EncodeState *state) {
+    CHECK(output_->Write(state->output));
+    state->output.clear();
+    if (!state->counts.empty()) {
+      counts_.resize(state->counts.size(), 0);
+      for (size_t id = 0; id < counts_.size(); ++id) {
+        counts_[id] += state->counts[id];
+      }
+      std::fill(state->counts.begin(), state->counts.end(), 0);
+    }
+    stats_.Merge(&state->stats);
+    if (index_ != nullptr && !state->num_ids.empty()) {
+      std::string offsets;
+      for (const uint32 n : state->num_ids) {
+        num_all_ids_ += n;
+        sentencepiece::indexed_ids::AppendLittleEndian(num_all_ids_, 8,
+                                                       &offsets);
+      }
+      CHECK(index_->Write(offsets));
+      state->num_ids.clear();
+    }
+  }
+
+  EncodeStats *mutable_stats() { return &stats_; }
+
+  // Writes the vocabulary counted by --generate_vocabulary.
+  void WriteVocabulary(const sentencepiece::SentencePieceProcessor &sp) {
+    std::vector<std::pair<std::string, int64>> vocab;
+    for (size_t id = 0; id < counts_.size(); ++id) {
+      if (counts_[id] > 0 && !sp.IsUnknown(id) && !sp.IsControl(id)) {
+        vocab.emplace_back(sp.IdToPiece(id), counts_[id]);
+      }
+    }
+    for (const auto &it : sentencepiece::Sorted(vocab)) {
+      output_->WriteLine(it.first + "\t" +
+                         sentencepiece::string_util::SimpleItoa(it.second));
+    }
+  }
+
+ private:
+  const int id_size_;
+  std::unique_ptr<sentencepiece::filesystem::WritableFile> output_;
+  std::unique_ptr<sentencepiece::filesystem::WritableFile> index_;
+  std::vector<int64> counts_;
+  EncodeStats stats_;
+  uint64 num_all_ids_ = 0;
+};
+
+// Encodes the lines of `filename` in this thread. Returns the number of
+// the lines.
+int64 EncodeFile(const std::string &filename, const ProcessFunc &process,
+                 EncodeOutput *output) {
+  auto input = sentencepiece::filesystem::NewReadableFile(filename);
+  CHECK_OK(input->status());
+  EncodeState state;
+  absl::string_view line;
+  int64 num_lines = 0;
+  while (input->ReadLine(&line)) {
+    process(line, &state);
+    output->Write(&state);
+    ++num_lines;
+  }
+  CHECK_OK(input->status());
+  return num_lines;
+}
+
+// Returns the output filename of the input `filename` at `index` of
+// --output_template.
+std::string ShardFilename(absl::string_view output_template,
+                          absl::string_view filename, size_t index) {
+  const size_t pos = filename.find_last_of("/\\");
+  const absl::string_view name =
+      pos == absl::string_view::npos ? filename : filename.substr(pos + 1);
+  const std::string index_str = absl::StrFormat("%05d", index);
+  return absl::StrReplaceAll(output_template,
+                             {{"{name}", name}, {"{index}", index_str}});
+}
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   sentencepiece::ScopedResourceDestructor cleaner;
@@ -82,94 +383,198 @@ int main(int argc, char *argv[]) {
                                absl::GetFlag(FLAGS_vocabulary_threshold)));
   }
 
-  auto output =
-      sentencepiece::filesystem::NewWritableFile(absl::GetFlag(FLAGS_output));
-  CHECK_OK(output->status());
+  if (absl::GetFlag(FLAGS_encode_cache_size) > 0) {
+    CHECK_OK(sp.SetEncodeCacheCapacity(absl::GetFlag(FLAGS_encode_cache_size)));
+  }
 
-  std::string line;
-  std::vector<std::string> sps;
-  std::vector<int> ids;
-  std::vector<std::vector<std::string>> nbest_sps;
-  std::vector<std::vector<int>> nbest_ids;
-  absl::flat_hash_map<std::string, int> vocab;
-  sentencepiece::SentencePieceText spt;
-  sentencepiece::NBestSentencePieceText nbest_spt;
-  std::function<void(absl::string_view line)> process;
+  const std::string &output_format = absl::GetFlag(FLAGS_output_format);
+  const bool is_binary =
+      output_format == "id_uint16" || output_format == "id_uint32";
+  int id_size = 0;
+  if (is_binary) {
+    CHECK(!absl::GetFlag(FLAGS_generate_vocabulary))
+        << output_format << " does not support --generate_vocabulary.";
+    id_size = output_format == "id_uint16" ? 2 : 4;
+    if (id_size == 2) {
+      CHECK_LE(sp.GetPieceSize(), 1 << 16)
+          << "The vocab does not fit in id_uint16. Use id_uint32.";
+    }
+  }
+
+  ProcessFunc process;
 
   const int nbest_size = absl::GetFlag(FLAGS_nbest_size);
   const float alpha = absl::GetFlag(FLAGS_alpha);
 
   if (absl::GetFlag(FLAGS_generate_vocabulary)) {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.Encode(line, &spt));
-      for (const auto &piece : spt.pieces()) {
-        if (!sp.IsUnknown(piece.id()) && !sp.IsControl(piece.id()))
-          vocab[piece.piece()]++;
-      }
+    process = [&](absl::string_view line, EncodeState *state) {
+      // Counts the ids densely, and skips the unknown and control pieces
+      // when writing them.
+      CHECK_OK(sp.Encode(line, &state->ids));
+      if (state->counts.empty()) state->counts.resize(sp.GetPieceSize(), 0);
+      for (const int id : state->ids) ++state->counts[id];
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "piece") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.Encode(line, &sps));
-      output->WriteLine(absl::StrJoin(sps, " "));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.Encode(line, &state->sps));
+      state->AppendLine(absl::StrJoin(state->sps, " "));
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "id") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.Encode(line, &ids));
-      output->WriteLine(absl::StrJoin(ids, " "));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.Encode(line, &state->ids));
+      state->AppendLine(absl::StrJoin(state->ids, " "));
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "proto") {
-    process = [&](absl::string_view line) { CHECK_OK(sp.Encode(line, &spt)); };
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.Encode(line, &state->spt));
+    };
   } else if (absl::GetFlag(FLAGS_output_format) == "sample_piece") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.SampleEncode(line, nbest_size, alpha, &sps));
-      output->WriteLine(absl::StrJoin(sps, " "));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.SampleEncode(line, nbest_size, alpha, &state->sps));
+      state->AppendLine(absl::StrJoin(state->sps, " "));
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "sample_id") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.SampleEncode(line, nbest_size, alpha, &ids));
-      output->WriteLine(absl::StrJoin(ids, " "));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.SampleEncode(line, nbest_size, alpha, &state->ids));
+      state->AppendLine(absl::StrJoin(state->ids, " "));
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "sample_proto") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.SampleEncode(line, nbest_size, alpha, &spt));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.SampleEncode(line, nbest_size, alpha, &state->spt));
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "nbest_piece") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.NBestEncode(line, nbest_size, &nbest_sps));
-      for (const auto &result : nbest_sps) {
-        output->WriteLine(absl::StrJoin(result, " "));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.NBestEncode(line, nbest_size, &state->nbest_sps));
+      for (const auto &result : state->nbest_sps) {
+        state->AppendLine(absl::StrJoin(result, " "));
       }
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "nbest_id") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.NBestEncode(line, nbest_size, &nbest_ids));
-      for (const auto &result : nbest_ids) {
-        output->WriteLine(absl::StrJoin(result, " "));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.NBestEncode(line, nbest_size, &state->nbest_ids));
+      for (const auto &result : state->nbest_ids) {
+        state->AppendLine(absl::StrJoin(result, " "));
       }
     };
   } else if (absl::GetFlag(FLAGS_output_format) == "nbest_proto") {
-    process = [&](absl::string_view line) {
-      CHECK_OK(sp.NBestEncode(line, nbest_size, &nbest_spt));
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.NBestEncode(line, nbest_size, &state->nbest_spt));
+    };
+  } else if (is_binary) {
+    process = [&](absl::string_view line, EncodeState *state) {
+      CHECK_OK(sp.Encode(line, &state->ids));
+      sentencepiece::indexed_ids::AppendIds(state->ids, id_size,
+                                            &state->output);
+      state->num_ids.push_back(state->ids.size());
     };
   } else {
     LOG(FATAL) << "Unknown output format: "
                << absl::GetFlag(FLAGS_output_format);
   }
 
-  for (const auto &filename : rest_args) {
-    auto input = sentencepiece::filesystem::NewReadableFile(filename);
-    CHECK_OK(input->status());
-    while (input->ReadLine(&line)) {
-      process(line);
-    }
+  const std::string &stats_filename = absl::GetFlag(FLAGS_stats);
+  if (!stats_filename.empty()) {
+    // Counts the first segmentation of the line, in the thread encoding it.
+    process = [&, encode = std::move(process)](absl::string_view line,
+                                               EncodeState *state) {
+      encode(line, state);
+      std::vector<int> &ids = state->stats_ids;
+      ids.clear();
+      auto add_pieces = [&](const sentencepiece::SentencePieceText &spt) {
+        for (const auto &piece : spt.pieces()) ids.push_back(piece.id());
+      };
+      if (output_format == "piece" || output_format == "sample_piece") {
+        for (const auto &piece : state->sps) ids.push_back(sp.PieceToId(piece));
+      } else if (output_format == "proto" || output_format == "sample_proto") {
+        add_pieces(state->spt);
+      } else if (output_format == "nbest_piece") {
+        if (!state->nbest_sps.empty()) {
+          for (const auto &piece : state->nbest_sps[0]) {
+            ids.push_back(sp.PieceToId(piece));
+          }
+        }
+      } else if (output_format == "nbest_id") {
+        if (!state->nbest_ids.empty()) ids = state->nbest_ids[0];
+      } else if (output_format == "nbest_proto") {
+        if (state->nbest_spt.nbests_size() > 0) {
+          add_pieces(state->nbest_spt.nbests(0));
+        }
+      } else {
+        ids = state->ids;
+      }
+      state->stats.Add(line, ids, sp);
+    };
   }
+  auto write_stats = [&](const EncodeStats &stats) {
+    if (stats_filename.empty()) return;
+    auto output = sentencepiece::filesystem::NewWritableFile(stats_filename);
+    CHECK_OK(output->status());
+    stats.Write(sp, output.get());
+  };
 
-  if (absl::GetFlag(FLAGS_generate_vocabulary)) {
-    for (const auto &it : sentencepiece::Sorted(vocab)) {
-      output->WriteLine(it.first + "\t" +
-                        sentencepiece::string_util::SimpleItoa(it.second));
+  const int num_threads = absl::GetFlag(FLAGS_num_threads);
+  CHECK_GT(num_threads, 0);
+  const std::string output_template = absl::GetFlag(FLAGS_output_template);
+  if (!output_template.empty()) {
+    CHECK(output_template.find("{name}") != std::string::npos ||
+          output_template.find("{index}") != std::string::npos)
+        << "--output_template needs {name} or {index}.";
+    CHECK(!(rest_args.size() == 1 && rest_args[0].empty()))
+        << "--output_template needs input files.";
+    // Encodes every file in one thread, and reports it as it is done.
+    std::mutex mutex;
+    size_t num_done = 0;
+    EncodeStats stats;
+    sentencepiece::GetSharedThreadPool()->ParallelFor(
+        rest_args.size(), 1, num_threads,
+        [&](int thread_id, size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i) {
+            const std::string filename =
+                ShardFilename(output_template, rest_args[i], i);
+            EncodeOutput output(filename, filename + ".idx", id_size,
+                                /*async_flush=*/false);
+            const int64 num_lines = EncodeFile(rest_args[i], process, &output);
+            if (absl::GetFlag(FLAGS_generate_vocabulary)) {
+              output.WriteVocabulary(sp);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.Merge(output.mutable_stats());
+            LOG(INFO) << "Encoded " << num_lines << " lines of "
+                      << rest_args[i] << " to " << filename << " ("
+                      << ++num_done << "/" << rest_args.size() << ")";
+          }
+        });
+    write_stats(stats);
+    return 0;
+  }
+
+  std::string index_filename = absl::GetFlag(FLAGS_output_index);
+  if (is_binary && index_filename.empty()) {
+    CHECK(!absl::GetFlag(FLAGS_output).empty())
+        << "--output_index is required to write " << output_format
+        << " to stdout.";
+    index_filename = absl::GetFlag(FLAGS_output) + ".idx";
+  }
+  // The encoding threads do not wait for the disk.
+  EncodeOutput output(absl::GetFlag(FLAGS_output), index_filename, id_size,
+                      /*async_flush=*/num_threads > 1);
+
+  if (num_threads > 1) {
+    const int batch_size = absl::GetFlag(FLAGS_batch_size);
+    const int max_batches = absl::GetFlag(FLAGS_max_batches_in_flight) > 0
+                                ? absl::GetFlag(FLAGS_max_batches_in_flight)
+                                : 2 * num_threads;
+    CHECK_GT(batch_size, 0);
+    EncodeInParallel(rest_args, num_threads, batch_size, max_batches, process,
+                     [&output](EncodeState *state) { output.Write(state); });
+  } else {
+    for (const auto &filename : rest_args) {
+      EncodeFile(filename, process, &output);
     }
   }
 
+  if (absl::GetFlag(FLAGS_generate_vocabulary)) output.WriteVocabulary(sp);
+  write_stats(*output.mutable_stats());
+
   return 0;
 }
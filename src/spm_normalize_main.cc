@@ -12,16 +12,20 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "builder.h"
 #include "common.h"
 #include "filesystem.h"
 #include "init.h"
-#include "normalizer.h"
 #include "sentencepiece.pb.h"
 #include "sentencepiece_model.pb.h"
 #include "sentencepiece_processor.h"
 #include "sentencepiece_trainer.h"
 #include "third_party/absl/flags/flag.h"
+#include "util.h"
 
 ABSL_FLAG(std::string, model, "", "Model file name");
 ABSL_FLAG(bool, use_internal_normalization, false,
@@ -37,13 +41,16 @@ ABSL_FLAG(bool, decompile, false,
           "Decompile compiled charamap and output it as TSV.");
 ABSL_FLAG(std::string, input, "", "Input filename");
 ABSL_FLAG(std::string, output, "", "Output filename");
+ABSL_FLAG(int32, num_threads, 16, "Number of threads for normalization");
+ABSL_FLAG(int32, batch_size, 10000,
+          "Number of lines read, normalized and written at a time");
 
 using sentencepiece::ModelProto;
 using sentencepiece::NormalizerSpec;
+using sentencepiece::SentencePieceNormalizer;
 using sentencepiece::SentencePieceProcessor;
 using sentencepiece::SentencePieceTrainer;
 using sentencepiece::normalizer::Builder;
-using sentencepiece::normalizer::Normalizer;
 
 int main(int argc, char *argv[]) {
   sentencepiece::ScopedResourceDestructor cleaner;
@@ -91,7 +98,11 @@ int main(int argc, char *argv[]) {
         Builder::DecompileCharsMap(spec.precompiled_charsmap(), &chars_map));
     CHECK_OK(Builder::SaveCharsMap(absl::GetFlag(FLAGS_output), chars_map));
   } else {
-    const Normalizer normalizer(spec);
+    SentencePieceNormalizer normalizer;
+    auto model_proto = std::make_unique<ModelProto>();
+    *model_proto->mutable_normalizer_spec() = spec;
+    CHECK_OK(normalizer.Load(std::move(model_proto)));
+
     auto output =
         sentencepiece::filesystem::NewWritableFile(absl::GetFlag(FLAGS_output));
     CHECK_OK(output->status());
@@ -100,14 +111,48 @@ int main(int argc, char *argv[]) {
       rest_args.push_back("");  // empty means that read from stdin.
     }
 
-    std::string line;
-    for (const auto &filename : rest_args) {
-      auto input = sentencepiece::filesystem::NewReadableFile(filename);
-      CHECK_OK(input->status());
-      while (input->ReadLine(&line)) {
-        output->WriteLine(normalizer.Normalize(line));
-      }
-    }
+    const int num_threads = absl::GetFlag(FLAGS_num_threads);
+    const size_t batch_size = absl::GetFlag(FLAGS_batch_size);
+    CHECK_GT(num_threads, 0);
+    CHECK_GT(batch_size, 0);
+
+    // This thread reads the batches of `batch_size` lines, the workers of
+    // the shared pool normalize them, and they are written in the input
+    // order. At most about `num_threads` batches are normalized at once.
+    struct Batch {
+      std::vector<std::string> lines;
+      std::vector<std::string> normalized;
+    };
+    size_t file_index = 0;
+    std::unique_ptr<sentencepiece::filesystem::ReadableFile> input;
+    sentencepiece::RunOrderedPipeline<Batch>(
+        sentencepiece::GetSharedThreadPool(), num_threads + 1,
+        [&](Batch *batch) {
+          batch->lines.clear();
+          std::string line;
+          while (batch->lines.size() < batch_size) {
+            if (input == nullptr) {
+              if (file_index == rest_args.size()) break;
+              input = sentencepiece::filesystem::NewReadableFile(
+                  rest_args[file_index++]);
+              CHECK_OK(input->status());
+            }
+            if (input->ReadLine(&line)) {
+              batch->lines.emplace_back(std::move(line));
+            } else {
+              input.reset();
+            }
+          }
+          return !batch->lines.empty();
+        },
+        [&](Batch *batch) {
+          const std::vector<absl::string_view> views(batch->lines.begin(),
+                                                     batch->lines.end());
+          CHECK_OK(normalizer.NormalizeBatch(views, 1, &batch->normalized));
+        },
+        [&](Batch *batch) {
+          for (const auto &line : batch->normalized) output->WriteLine(line);
+        });
   }
 
   return 0;
@@ -0,0 +1,141 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// Serves encode, decode and count requests on a Unix domain socket with
+// the line protocol of serve.h, batching the requests of all the
+// connections, e.g.,
+//
+//   spm_serve --model=m.model --compiled_model=m.compiled --socket=spm.sock
+//   printf 'encode\tHello world.\n' | nc -U spm.sock
+//
+// With --compiled_model, the model is mapped from the compiled file, which
+// is written from --model first if it does not exist, so that the server
+// starts without building the tries and the servers on a host share the
+// pages of the model. With --shm, the processes on the host may also send
+// the requests through a shared memory region instead (see serve_shm.h),
+// e.g., with --shm=/dev/shm/spm. Stops on SIGINT and SIGTERM.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "common.h"
+#include "init.h"
+#include "sentencepiece_processor.h"
+#include "serve.h"
+#include "serve_shm.h"
+#include "third_party/absl/flags/flag.h"
+
+ABSL_FLAG(std::string, model, "", "model file name");
+ABSL_FLAG(std::string, compiled_model, "",
+          "compiled model file name, written from --model if it does not "
+          "exist");
+ABSL_FLAG(std::string, socket, "", "path of the Unix domain socket");
+ABSL_FLAG(std::string, shm, "",
+          "path of the shared memory region, e.g., on /dev/shm, which only "
+          "the processes of the same user can open");
+ABSL_FLAG(int32, shm_slots, 64,
+          "number of the requests in the shared memory region at once");
+ABSL_FLAG(int64, shm_slot_size, 1 << 20,
+          "maximum bytes of a request or a response in the shared memory "
+          "region");
+ABSL_FLAG(std::string, extra_options, "",
+          "':' separated encoder extra options, e.g., \"reverse:bos:eos\"");
+ABSL_FLAG(int64, result_cache_bytes, 0,
+          "bytes of the cache of the ids of the repeated inputs; 0 disables "
+          "it");
+ABSL_FLAG(int32, num_threads, 16, "number of threads running a batch");
+ABSL_FLAG(int32, max_batch_size, 256, "maximum number of requests in a batch");
+ABSL_FLAG(int64, max_batch_delay_us, 200,
+          "maximum microseconds a request waits for the others of its batch");
+ABSL_FLAG(int32, max_connections, 256,
+          "maximum number of connections of --socket open at once. The "
+          "others are answered by an error and closed");
+
+namespace {
+
+sentencepiece::serve::Server *g_server = nullptr;
+sentencepiece::serve::ShmServer *g_shm_server = nullptr;
+
+void HandleSignal(int) {
+  if (g_server != nullptr) g_server->Stop();
+  if (g_shm_server != nullptr) g_shm_server->Stop();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ScopedResourceDestructor cleaner;
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+
+  const std::string &socket_path = absl::GetFlag(FLAGS_socket);
+  const std::string &shm = absl::GetFlag(FLAGS_shm);
+  CHECK(!socket_path.empty() || !shm.empty());
+  const std::string &compiled_model = absl::GetFlag(FLAGS_compiled_model);
+
+  sentencepiece::SentencePieceProcessor sp;
+  if (compiled_model.empty()) {
+    CHECK(!absl::GetFlag(FLAGS_model).empty());
+    CHECK_OK(sp.Load(absl::GetFlag(FLAGS_model)));
+  } else {
+    if (access(compiled_model.c_str(), F_OK) != 0) {
+      CHECK(!absl::GetFlag(FLAGS_model).empty());
+      sentencepiece::SentencePieceProcessor source;
+      CHECK_OK(source.Load(absl::GetFlag(FLAGS_model)));
+      CHECK_OK(source.SaveCompiledModel(compiled_model));
+    }
+    CHECK_OK(sp.Load(compiled_model));
+  }
+  CHECK_OK(sp.SetEncodeExtraOptions(absl::GetFlag(FLAGS_extra_options)));
+  CHECK_OK(sp.SetResultCacheCapacity(absl::GetFlag(FLAGS_result_cache_bytes)));
+
+  std::unique_ptr<sentencepiece::serve::ShmServer> shm_server;
+  if (!shm.empty()) {
+    shm_server = std::make_unique<sentencepiece::serve::ShmServer>(
+        &sp, absl::GetFlag(FLAGS_num_threads));
+    CHECK_OK(shm_server->Create(shm, absl::GetFlag(FLAGS_shm_slots),
+                                absl::GetFlag(FLAGS_shm_slot_size)));
+  }
+
+  sentencepiece::serve::Batcher::Options options;
+  options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  options.max_batch_size = absl::GetFlag(FLAGS_max_batch_size);
+  options.max_batch_delay_us = absl::GetFlag(FLAGS_max_batch_delay_us);
+  sentencepiece::serve::Batcher batcher(&sp, options);
+  sentencepiece::serve::Server server(&batcher,
+                                     absl::GetFlag(FLAGS_max_connections));
+  if (!socket_path.empty()) CHECK_OK(server.Listen(socket_path));
+
+  g_server = &server;
+  g_shm_server = shm_server.get();
+  signal(SIGINT, HandleSignal);
+  signal(SIGTERM, HandleSignal);
+  signal(SIGPIPE, SIG_IGN);
+  if (socket_path.empty()) {
+    shm_server->Serve();
+  } else if (shm_server) {
+    std::thread shm_thread([&shm_server]() { shm_server->Serve(); });
+    server.Serve();
+    shm_thread.join();
+  } else {
+    server.Serve();
+  }
+  g_server = nullptr;
+  g_shm_server = nullptr;
+
+  return 0;
+}
@@ -57,14 +57,80 @@ ABSL_FLAG(bool, shuffle_input_sentence,
 ABSL_FLAG(int32, seed_sentencepiece_size,
           kDefaultTrainerSpec.seed_sentencepiece_size(),
           "the size of seed sentencepieces");
+ABSL_FLAG(std::uint64_t, seed_sentencepiece_shard_size,
+          kDefaultTrainerSpec.seed_sentencepiece_shard_size(),
+          "maximum number of characters in one suffix array of the seed "
+          "extraction. 0 uses the whole corpus");
 ABSL_FLAG(std::string, seed_sentencepieces_file, "",
           "file to load seed sentencepieces from");
+ABSL_FLAG(std::string, normalized_corpus_cache, "",
+          "directory to cache the normalized corpus for later runs");
+ABSL_FLAG(std::string, checkpoint_file, "",
+          "file to write the state of unigram training to after every round");
+ABSL_FLAG(std::string, resume_from, "",
+          "checkpoint_file of an interrupted unigram training to continue");
+ABSL_FLAG(std::string, distributed_dir, "",
+          "directory shared by the processes of distributed unigram training");
+ABSL_FLAG(int32, num_distributed_processes,
+          kDefaultTrainerSpec.num_distributed_processes(),
+          "number of processes computing the E steps of unigram training");
+ABSL_FLAG(int32, distributed_process_id,
+          kDefaultTrainerSpec.distributed_process_id(),
+          "id of this process in [0, num_distributed_processes). 0 "
+          "coordinates the training and writes the model");
+ABSL_FLAG(int32, distributed_timeout_sec,
+          kDefaultTrainerSpec.distributed_timeout_sec(),
+          "seconds the processes of distributed unigram training wait for "
+          "each other. 0 waits without limit");
+ABSL_FLAG(std::string, vocab_size_sweep, "",
+          "comma-separated vocab sizes larger than vocab_size whose unigram "
+          "models are also saved, to <model_prefix>_<size>");
+ABSL_FLAG(bool, dedup_input_sentences,
+          kDefaultTrainerSpec.dedup_input_sentences(),
+          "merges the exact duplicates of the loaded sentences into one "
+          "sentence of the summed frequency");
+ABSL_FLAG(std::uint64_t, em_mini_batch_size,
+          kDefaultTrainerSpec.em_mini_batch_size(),
+          "number of sentences of the E steps of the unigram sub-iterations "
+          "before the last one of every EM round. 0 runs full E steps");
+ABSL_FLAG(double, e_step_beam, kDefaultTrainerSpec.e_step_beam(),
+          "drops the lattice nodes of the E step below the best path by more "
+          "than this log probability. 0 sums all the paths");
+ABSL_FLAG(int32, e_step_window_size, kDefaultTrainerSpec.e_step_window_size(),
+          "maximum number of characters of the lattices of unigram training. "
+          "Longer sentences are cut into windows. 0 keeps whole sentences");
+ABSL_FLAG(std::string, sentence_store, "",
+          "backend of the loaded sentences: arena, leveldb or log. Empty "
+          "uses the default of the build");
+ABSL_FLAG(std::string, sentence_store_dir, "",
+          "directory of the files of a disk-backed sentence_store");
+ABSL_FLAG(bool, keep_sentence_store,
+          kDefaultTrainerSpec.keep_sentence_store(),
+          "keeps the files of a disk-backed sentence_store after training");
+ABSL_FLAG(std::uint64_t, max_memory_mb, kDefaultTrainerSpec.max_memory_mb(),
+          "memory budget of the training in MiB, kept by spilling the "
+          "sentences to disk and extracting the seed pieces in shards. 0 "
+          "does not limit the memory");
+ABSL_FLAG(int32, approximate_bpe_merges,
+          kDefaultTrainerSpec.approximate_bpe_merges(),
+          "number of the first BPE merges chosen in bulk from estimated pair "
+          "frequencies of a sample. 0 counts all the merges exactly");
 ABSL_FLAG(double, shrinking_factor, kDefaultTrainerSpec.shrinking_factor(),
           "Keeps top shrinking_factor pieces with respect to the loss");
-ABSL_FLAG(int32, num_threads, kDefaultTrainerSpec.num_threads(),
-          "number of threads for training");
+ABSL_FLAG(int32, num_threads, 0,
+          "number of threads for training. 0 leaves it unset, i.e., 16 "
+          "bounded by the CPUs");
+ABSL_FLAG(int32, num_reader_threads, kDefaultTrainerSpec.num_reader_threads(),
+          "number of threads reading the input files");
+ABSL_FLAG(bool, precompile_trie, kDefaultTrainerSpec.precompile_trie(),
+          "stores the tries built from the pieces in the model file, so that "
+          "loading the model skips building them");
 ABSL_FLAG(int32, num_sub_iterations, kDefaultTrainerSpec.num_sub_iterations(),
           "number of EM sub-iterations");
+ABSL_FLAG(double, incremental_e_step_tolerance,
+          kDefaultTrainerSpec.incremental_e_step_tolerance(),
+          "reuses the expected counts of the sentences changing by less than "
+          "this tolerance in the E step. 0 recomputes every sentence");
 ABSL_FLAG(int32, max_sentencepiece_length,
           kDefaultTrainerSpec.max_sentencepiece_length(),
           "maximum length of sentence piece");
@@ -223,10 +289,35 @@ int main(int argc, char *argv[]) {
   SetTrainerSpecFromFlag(input_sentence_size);
   SetTrainerSpecFromFlag(shuffle_input_sentence);
   SetTrainerSpecFromFlag(seed_sentencepiece_size);
+  SetTrainerSpecFromFlag(seed_sentencepiece_shard_size);
   SetTrainerSpecFromFlag(seed_sentencepieces_file);
+  SetTrainerSpecFromFlag(normalized_corpus_cache);
+  SetTrainerSpecFromFlag(checkpoint_file);
+  SetTrainerSpecFromFlag(resume_from);
+  SetTrainerSpecFromFlag(distributed_dir);
+  SetTrainerSpecFromFlag(num_distributed_processes);
+  SetTrainerSpecFromFlag(distributed_process_id);
+  SetTrainerSpecFromFlag(distributed_timeout_sec);
+  SetTrainerSpecFromFlag(vocab_size_sweep);
+  SetTrainerSpecFromFlag(dedup_input_sentences);
+  SetTrainerSpecFromFlag(em_mini_batch_size);
+  SetTrainerSpecFromFlag(e_step_beam);
+  SetTrainerSpecFromFlag(e_step_window_size);
+  SetTrainerSpecFromFlag(sentence_store);
+  SetTrainerSpecFromFlag(sentence_store_dir);
+  SetTrainerSpecFromFlag(keep_sentence_store);
+  SetTrainerSpecFromFlag(max_memory_mb);
+  SetTrainerSpecFromFlag(approximate_bpe_merges);
   SetTrainerSpecFromFlag(shrinking_factor);
-  SetTrainerSpecFromFlag(num_threads);
+  // Only an explicit value is set, so that the default is bounded by the
+  // CPUs but --num_threads=16 is not.
+  if (absl::GetFlag(FLAGS_num_threads) != 0) {
+    SetTrainerSpecFromFlag(num_threads);
+  }
+  SetTrainerSpecFromFlag(num_reader_threads);
+  SetTrainerSpecFromFlag(precompile_trie);
   SetTrainerSpecFromFlag(num_sub_iterations);
+  SetTrainerSpecFromFlag(incremental_e_step_tolerance);
   SetTrainerSpecFromFlag(max_sentencepiece_length);
   SetTrainerSpecFromFlag(max_sentence_length);
   SetTrainerSpecFromFlag(split_by_unicode_script);
@@ -12,6 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <filesystem>
+#include <random>
+#include <string>
+
 #include "init.h"
 #include "testharness.h"
 
@@ -21,11 +25,36 @@ ABSL_FLAG(std::string, test_srcdir, "..\\data", "Data directory.");
 ABSL_FLAG(std::string, test_srcdir, "../data", "Data directory.");
 #endif
 
-ABSL_FLAG(std::string, test_tmpdir, "test_tmp", "Temporary directory.");
+ABSL_FLAG(std::string, test_tmpdir, "",
+          "Temporary directory. Empty creates a new one in the temporary "
+          "directory of the system, which is removed after the tests.");
+
+namespace {
+
+// Returns a new directory in the temporary directory of the system.
+std::string MakeTempDir() {
+  std::random_device random;
+  const auto parent = std::filesystem::temp_directory_path();
+  while (true) {
+    const auto dir =
+        parent / ("sentencepiece_test." + std::to_string(random()));
+    std::error_code ec;
+    if (std::filesystem::create_directory(dir, ec)) return dir.string();
+    CHECK(!ec) << dir.string() << ": " << ec.message();
+  }
+}
+
+}  // namespace
 
 int main(int argc, char **argv) {
   sentencepiece::ScopedResourceDestructor cleaner;
   sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+  const bool make_tmpdir = absl::GetFlag(FLAGS_test_tmpdir).empty();
+  if (make_tmpdir) absl::SetFlag(&FLAGS_test_tmpdir, MakeTempDir());
   sentencepiece::test::RunAllTests();
+  if (make_tmpdir) {
+    std::error_code ec;
+    std::filesystem::remove_all(::testing::TempDir(), ec);
+  }
   return 0;
 }
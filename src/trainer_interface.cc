@@ -15,1072 +15,2045 @@
 #include "trainer_interface.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iterator>
 #include <memory>
+#include <random>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "filesystem.h"
+#include "memory_usage.h"
 #include "model_factory.h"
 #include "model_interface.h"
 #include "normalizer.h"
+#include "pretokenizer_for_training.h"
 #include "sentencepiece_processor.h"
 #include "sentencepiece_trainer.h"
 #include "third_party/absl/container/flat_hash_map.h"
 #include "third_party/absl/strings/numbers.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/absl/strings/str_format.h"
-#include "third_party/absl/strings/str_join.h"
 #include "third_party/absl/strings/str_split.h"
+#include "third_party/absl/strings/strip.h"
 #include "unicode_script.h"
 #include "util.h"
 
-namespace sentencepiece
-{
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
-  const char32_t TrainerInterface::kWSChar = U'\u2581';
-  const char TrainerInterface::kWSStr[] = "\xe2\x96\x81";
+namespace sentencepiece {
 
-  const char32_t TrainerInterface::kUNKChar = U'\u2585';
-  const char TrainerInterface::kUNKStr[] = "\xe2\x96\x85";
+const char32 TrainerInterface::kWSChar = U'▁';
+const char TrainerInterface::kWSStr[] = "\xe2\x96\x81";
 
-  const char32_t TrainerInterface::kUPPBoundaryChar = U'\u0009';
-  const char TrainerInterface::kUPPBoundaryStr[] = "\t";
+const char32 TrainerInterface::kUNKChar = U'▅';
+const char TrainerInterface::kUNKStr[] = "\xe2\x96\x85";
 
-  namespace
-  {
-    util::Status VerifySpec(const TrainerSpec &trainer_spec)
-    {
-      CHECK_GT_OR_RETURN(trainer_spec.vocab_size(), 0);
-
-      if (trainer_spec.model_type() == TrainerSpec::UNIGRAM ||
-          trainer_spec.model_type() == TrainerSpec::BPE)
-      {
-        CHECK_OR_RETURN(!trainer_spec.use_all_vocab())
-            << "--use_all_vocab=true is valid for WORD/CHAR model.";
-      }
+const char32 TrainerInterface::kUPPBoundaryChar = U'\u0009';
+const char TrainerInterface::kUPPBoundaryStr[] = "\t";
 
-      if (!trainer_spec.seed_sentencepieces_file().empty())
-      {
-        CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM)
-            << "seed_sentencepieces_file is only supported for UNIGRAM model.";
-      }
+constexpr size_t TrainerInterface::kSentenceGrainSize;
+constexpr size_t TrainerInterface::kPreTokenizeBatchSize;
+constexpr size_t TrainerInterface::kPreTokenizeWindowSize;
 
-#define CHECK_RANGE(variable, minval, maxval) \
-  CHECK_OR_RETURN(variable >= minval && variable <= maxval)
+namespace {
+util::Status VerifySpec(const TrainerSpec &trainer_spec) {
+  CHECK_GT_OR_RETURN(trainer_spec.vocab_size(), 0);
 
-      CHECK_RANGE(trainer_spec.character_coverage(), 0.98, 1.0);
-      CHECK_RANGE(trainer_spec.max_sentencepiece_length(), 1, 512);
-      CHECK_RANGE(trainer_spec.num_sub_iterations(), 1, 10);
-      CHECK_RANGE(trainer_spec.num_threads(), 1, 1024);
-      CHECK_RANGE(trainer_spec.self_test_sample_size(), 0, 1000);
-      CHECK_RANGE(trainer_spec.shrinking_factor(), 0.5, 0.95);
-      CHECK_RANGE(trainer_spec.max_sentence_length(), 10, 1073741824);
-#undef CHECK_RANGE
+  if (trainer_spec.model_type() == TrainerSpec::UNIGRAM ||
+      trainer_spec.model_type() == TrainerSpec::BPE) {
+    CHECK_OR_RETURN(!trainer_spec.use_all_vocab())
+        << "--use_all_vocab=true is valid for WORD/CHAR model.";
+  }
 
-      CHECK_OR_RETURN(trainer_spec.input_sentence_size() <= 0 ||
-                      trainer_spec.input_sentence_size() > 100);
+  if (!trainer_spec.seed_sentencepieces_file().empty()) {
+    CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM)
+        << "seed_sentencepieces_file is only supported for UNIGRAM model.";
+  }
 
-      CHECK_OR_RETURN(!trainer_spec.unk_piece().empty());
-      CHECK_OR_RETURN(!trainer_spec.bos_piece().empty());
-      CHECK_OR_RETURN(!trainer_spec.eos_piece().empty());
-      CHECK_OR_RETURN(!trainer_spec.pad_piece().empty());
+  if (!trainer_spec.checkpoint_file().empty() ||
+      !trainer_spec.resume_from().empty()) {
+    CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM)
+        << "checkpoint_file and resume_from are only supported for UNIGRAM "
+           "model.";
+  }
 
-      if (SentencePieceTrainer::GetPretokenizerForTraining() ||
-          !trainer_spec.pretokenization_delimiter().empty())
-      {
-        CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM ||
-                        trainer_spec.model_type() == TrainerSpec::BPE)
-            << "PretokenizerForTraining is only supported in UNIGRAM or BPE mode.";
-      }
+  if (trainer_spec.num_distributed_processes() > 1) {
+    CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM)
+        << "num_distributed_processes is only supported for UNIGRAM model.";
+    CHECK_OR_RETURN(!trainer_spec.distributed_dir().empty())
+        << "distributed_dir must be specified.";
+    CHECK_OR_RETURN(trainer_spec.incremental_e_step_tolerance() == 0.0)
+        << "incremental_e_step_tolerance cannot be distributed.";
+    CHECK_OR_RETURN(trainer_spec.em_mini_batch_size() == 0)
+        << "em_mini_batch_size cannot be distributed.";
+  }
 
-      return util::OkStatus();
+  if (!trainer_spec.vocab_size_sweep().empty()) {
+    CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM)
+        << "vocab_size_sweep is only supported for UNIGRAM model.";
+    CHECK_OR_RETURN(!trainer_spec.model_prefix().empty())
+        << "vocab_size_sweep requires model_prefix.";
+    for (const auto size : absl::StrSplit(trainer_spec.vocab_size_sweep(), ',')) {
+      int32 vocab_size = 0;
+      CHECK_OR_RETURN(absl::SimpleAtoi(size, &vocab_size) &&
+                      vocab_size > trainer_spec.vocab_size())
+          << "vocab_size_sweep must be sizes larger than vocab_size: "
+          << trainer_spec.vocab_size_sweep();
     }
+  }
 
-    bool is_unicode_decimal_number(char32 c)
-    {
-      return (c >= 0x30 && c <= 0x39) || (c >= 0xff10 && c <= 0xff19);
-    }
+#define CHECK_RANGE(variable, minval, maxval) \
+  CHECK_OR_RETURN(variable >= minval && variable <= maxval)
 
-    class SentenceSelector
-    {
-    public:
-      using Sampler = random::ReservoirSampler<TrainerInterface::Sentence>;
-
-      static constexpr int64_t kTooBigSentencesSize = 1000000;
-
-      SentenceSelector(TrainerInterface::Sentences sentences,
-                       const TrainerSpec &spec)
-          : sentences_(sentences), spec_(&spec)
-      {
-        if (spec_->input_sentence_size() > 0)
-        {
-          if (spec_->shuffle_input_sentence())
-          {
-            constexpr size_t kSeed = 12345678;
-            sampler_ = std::make_unique<Sampler>(
-                sentences, spec_->input_sentence_size(), kSeed);
-          }
-          else
-          {
-            LOG(INFO) << "First " << spec_->input_sentence_size()
-                      << " sentences are selected. Remaining sentences are discarded.";
-          }
+  CHECK_RANGE(trainer_spec.character_coverage(), 0.98, 1.0);
+  CHECK_RANGE(trainer_spec.max_sentencepiece_length(), 1, 512);
+  CHECK_RANGE(trainer_spec.num_sub_iterations(), 1, 10);
+  CHECK_RANGE(trainer_spec.num_threads(), 1, 1024);
+  CHECK_RANGE(trainer_spec.num_reader_threads(), 1, 1024);
+  CHECK_RANGE(trainer_spec.self_test_sample_size(), 0, 1000);
+  CHECK_RANGE(trainer_spec.shrinking_factor(), 0.5, 0.95);
+  CHECK_RANGE(trainer_spec.incremental_e_step_tolerance(), 0.0, 1.0);
+  CHECK_RANGE(trainer_spec.e_step_beam(), 0.0, 1000.0);
+  CHECK_GE_OR_RETURN(trainer_spec.e_step_window_size(), 0);
+  CHECK_RANGE(trainer_spec.num_distributed_processes(), 1, 4096);
+  CHECK_RANGE(trainer_spec.distributed_process_id(), 0,
+              trainer_spec.num_distributed_processes() - 1);
+  CHECK_GE_OR_RETURN(trainer_spec.distributed_timeout_sec(), 0);
+  CHECK_RANGE(trainer_spec.max_sentence_length(), 10, 1073741824);
+  CHECK_GE_OR_RETURN(trainer_spec.approximate_bpe_merges(), 0);
+#undef CHECK_RANGE
+
+  const auto &store = trainer_spec.sentence_store();
+  CHECK_OR_RETURN(store.empty() || store == "arena" || store == "leveldb" ||
+                  store == "log")
+      << "Unknown sentence_store: " << store;
+#ifndef SPM_ENABLE_LEVELDB
+  CHECK_OR_RETURN(store != "leveldb")
+      << "sentence_store=leveldb requires a build with SPM_ENABLE_LEVELDB.";
+#endif
+#if defined(_WIN32)
+  CHECK_OR_RETURN(store != "log")
+      << "sentence_store=log is not supported on Windows.";
+#endif
+
+  CHECK_OR_RETURN(trainer_spec.input_sentence_size() <= 0 ||
+                  trainer_spec.input_sentence_size() > 100);
+
+  CHECK_OR_RETURN(!trainer_spec.unk_piece().empty());
+  CHECK_OR_RETURN(!trainer_spec.bos_piece().empty());
+  CHECK_OR_RETURN(!trainer_spec.eos_piece().empty());
+  CHECK_OR_RETURN(!trainer_spec.pad_piece().empty());
+
+  if (SentencePieceTrainer::GetPretokenizerForTraining() ||
+      !trainer_spec.pretokenization_delimiter().empty()) {
+    CHECK_OR_RETURN(trainer_spec.model_type() == TrainerSpec::UNIGRAM ||
+                    trainer_spec.model_type() == TrainerSpec::BPE)
+        << "PretokenizerForTraining is only supported in UNIGRAM or BPE mode.";
+  }
+
+  return util::OkStatus();
+}
+
+bool is_unicode_decimal_number(char32 c) {
+  return (c >= 0x30 && c <= 0x39) || (c >= 0xff10 && c <= 0xff19);
+}
+
+// Returns the fingerprint of `text`, which identifies the duplicates of
+// dedup_input_sentences.
+uint64 SentenceFingerprint(absl::string_view text) {
+  uint64 fp = text.size();
+  for (size_t i = 0; i < text.size(); i += sizeof(uint64)) {
+    uint64 chunk = 0;
+    memcpy(&chunk, text.data() + i, std::min(sizeof(uint64), text.size() - i));
+    fp = port::FingerprintCat(fp, chunk);
+  }
+  return fp;
+}
+
+class SentenceSelector {
+ public:
+  using Sampler = random::ReservoirSampler<TrainerInterface::Sentence>;
+
+  static constexpr int64 kTooBigSentencesSize = 1000000;
+
+  // The input is sampled by independent reservoirs, the i-th of which
+  // takes every kNumSamplerShards-th sentence from the i-th one and keeps
+  // its share of input_sentence_size, so that at most input_sentence_size
+  // sampled sentences are held. The number of shards is fixed so that the
+  // sample does not depend on the number of threads.
+  static constexpr int kNumSamplerShards = 16;
+  static constexpr size_t kSampleBatchSize = 1 << 16;
+  static constexpr size_t kSeed = 12345678;
+
+  SentenceSelector(SentenceStore *sentences, const TrainerSpec &spec,
+                   ThreadPool *pool)
+      : sentences_(sentences), spec_(&spec), pool_(pool) {
+    if (spec_->input_sentence_size() > 0) {
+      if (spec_->shuffle_input_sentence()) {
+        const uint64 size = spec_->input_sentence_size();
+        sampled_.resize(kNumSamplerShards);
+        for (int i = 0; i < kNumSamplerShards; ++i) {
+          // The i-th shard gets size / kNumSamplerShards sentences, plus one
+          // of the remainder like the number of the sentences it takes.
+          samplers_.push_back(std::make_unique<Sampler>(
+              &sampled_[i],
+              size / kNumSamplerShards + (i < size % kNumSamplerShards),
+              kSeed + i));
         }
+      } else {
+        LOG(INFO)
+            << "First " << spec_->input_sentence_size()
+            << " sentences are selected. Remaining sentences are discarded.";
       }
+    }
+  }
 
-      void Finish() const
-      {
-        // LevelDB does not provide a direct size method, so custom tracking is needed.
+  // Writes the sampled sentences to the store and flushes it.
+  util::Status Finish() {
+    if (!samplers_.empty()) {
+      SampleBatch();
+      std::vector<TrainerInterface::Sentence> sampled;
+      sampled.reserve(num_sampled_held_);
+      for (auto &shard : sampled_) {
+        std::move(shard.begin(), shard.end(), std::back_inserter(sampled));
+        std::vector<TrainerInterface::Sentence>().swap(shard);
       }
+      // The reservoirs mostly keep the input order, which is shuffled.
+      std::mt19937 engine(kSeed);
+      std::shuffle(sampled.begin(), sampled.end(), engine);
+      for (const auto &sentence : sampled) {
+        RETURN_IF_ERROR(Store(sentence.first, sentence.second));
+      }
+    }
+    RETURN_IF_ERROR(sentences_->Flush());
+
+    if (num_stored_ > sentences_->size()) {
+      // Writes the summed frequencies of the merged sentences.
+      TrainerInterface::Sentence sentence;
+      for (size_t i = 0; i < merged_.size(); ++i) {
+        if (!merged_[i]) continue;
+        RETURN_IF_ERROR(sentences_->Get(i, &sentence));
+        sentence.second = dedup_freqs_[i];
+        RETURN_IF_ERROR(sentences_->Set(i, std::move(sentence)));
+      }
+      LOG(INFO) << "Merged " << num_stored_ - sentences_->size()
+                << " duplicate sentences into " << sentences_->size()
+                << " sentences.";
+      dedup_index_.clear();
+      dedup_freqs_.clear();
+      merged_.clear();
+    }
 
-      bool Add(const std::pair<std::string, int64_t> &sentence)
-      {
-        std::string key = "sentence_" + std::to_string(total_size());
-        if (spec_->input_sentence_size() == 0)
-        {
-          addSentenceToDB(sentence, key);
-        }
-        else
-        {
-          if (spec_->shuffle_input_sentence())
-          {
-            sampler_->Add(sentence);
-          }
-          else
-          {
-            addSentenceToDB(sentence, key);
-            if (total_size() >= spec_->input_sentence_size())
-              return false;
-          }
-        }
+    if (sentences_->size() > kTooBigSentencesSize) {
+      LOG(WARNING) << "Too many sentences are loaded! (" << sentences_->size()
+                   << "), which may slow down training.";
+      LOG(WARNING) << "Consider using "
+                      "--input_sentence_size=<size> and "
+                      "--shuffle_input_sentence=true.";
+      LOG(WARNING) << "They allow to randomly sample <size> sentences from "
+                      "the entire corpus.";
+    }
 
-        if (total_size() > 0 && total_size() % kTooBigSentencesSize == 0)
-        {
-          LOG(INFO) << "Loaded " << total_size() << " lines";
-        }
+    return util::OkStatus();
+  }
 
-        return true;
+  // Sets `more` to false when no more sentences are required. `text` is
+  // only copied into the store or the sample.
+  util::Status Add(absl::string_view text, int64 freq, bool *more) {
+    *more = true;
+    if (spec_->input_sentence_size() == 0) {
+      RETURN_IF_ERROR(Store(text, freq));
+    } else {
+      if (spec_->shuffle_input_sentence()) {
+        batch_.emplace_back(std::string(text), freq);
+        ++num_sampled_input_;
+        if (batch_.size() >= kSampleBatchSize) SampleBatch();
+      } else {
+        RETURN_IF_ERROR(Store(text, freq));
+        if (num_stored_ >= spec_->input_sentence_size()) *more = false;
       }
+    }
 
-      size_t total_size() const
-      {
-        // LevelDB does not provide a direct size method, so custom tracking is needed.
-        // This might involve maintaining a count of added sentences separately.
-        return 0; // Placeholder, implement size tracking
-      }
+    if (total_size() > 0 && total_size() % kTooBigSentencesSize == 0) {
+      LOG(INFO) << "Loaded " << total_size() << " lines";
+    }
 
-    private:
-      void addSentenceToDB(const TrainerInterface::Sentence &sentence, const std::string &key)
-      {
-        std::string serializedSentence = serializeSentence(sentence);
-        leveldb::Status status = sentences_->Put(leveldb::WriteOptions(), key, serializedSentence);
-        if (!status.ok())
-        {
-          throw std::runtime_error("Failed to write to LevelDB: " + status.ToString());
-        }
-      }
+    return util::OkStatus();
+  }
 
-      TrainerInterface::Sentences sentences_ = nullptr;
-      const TrainerSpec *spec_ = nullptr;
-      std::unique_ptr<Sampler> sampler_;
-    };
+  size_t total_size() const {
+    return samplers_.empty() ? num_stored_ : num_sampled_input_;
+  }
 
-    TrainerInterface::TrainerInterface(const TrainerSpec &trainer_spec,
-                                       const NormalizerSpec &normalizer_spec,
-                                       const NormalizerSpec &denormalizer_spec)
-        : trainer_spec_(trainer_spec),
-          normalizer_spec_(normalizer_spec),
-          denormalizer_spec_(denormalizer_spec)
-    {
-      status_ = VerifySpec(trainer_spec_);
-      if (status_.ok())
-        status_ = InitMetaPieces();
+  // Returns the number of the selected sentences, including the duplicates
+  // merged by dedup_input_sentences.
+  size_t num_stored() const { return num_stored_; }
+
+  // Returns the largest number of the sampled sentences held at once,
+  // besides the batch to sample.
+  size_t peak_sampled() const { return peak_sampled_; }
+
+  // Replaces the store, e.g., after MaybeSpillSentences() moved the
+  // sentences stored so far into `sentences`.
+  void set_sentences(SentenceStore *sentences) { sentences_ = sentences; }
+
+ private:
+  // Adds a selected sentence to the store. With dedup_input_sentences, a
+  // sentence of the same fingerprint as a stored one is merged into it by
+  // adding up the frequencies, which the trainer counts the same way as
+  // the repeated lines. The sampling above still sees every line.
+  util::Status Store(absl::string_view text, int64 freq) {
+    ++num_stored_;
+    if (!spec_->dedup_input_sentences()) {
+      return sentences_->AddText(text, freq);
     }
+    const auto it =
+        dedup_index_.emplace(SentenceFingerprint(text), dedup_freqs_.size());
+    if (!it.second) {
+      dedup_freqs_[it.first->second] += freq;
+      merged_[it.first->second] = true;
+      return util::OkStatus();
+    }
+    dedup_freqs_.push_back(freq);
+    merged_.push_back(false);
+    return sentences_->AddText(text, freq);
+  }
 
-    TrainerInterface::~TrainerInterface() {}
+  // Feeds every sentence of `batch_` to the reservoir of its shard, in
+  // parallel over the shards.
+  void SampleBatch() {
+    const size_t size = batch_.size();
+    // Index in `batch_` of the first sentence of the 0-th shard.
+    const size_t offset =
+        (kNumSamplerShards - num_batched_ % kNumSamplerShards) %
+        kNumSamplerShards;
+    pool_->ParallelFor(kNumSamplerShards, 1,
+                       [&](int n, size_t begin, size_t end) {
+                         for (size_t i = begin; i < end; ++i) {
+                           for (size_t j = (offset + i) % kNumSamplerShards;
+                                j < size; j += kNumSamplerShards) {
+                             samplers_[i]->Add(std::move(batch_[j]));
+                           }
+                         }
+                       });
+    num_batched_ += size;
+    batch_.clear();
+
+    num_sampled_held_ = 0;
+    for (const auto &shard : sampled_) num_sampled_held_ += shard.size();
+    peak_sampled_ = std::max(peak_sampled_, num_sampled_held_);
+  }
 
-    bool TrainerInterface::IsValidSentencePiece(const string_util::UnicodeText &sentencepiece) const
-    {
-      // Returns false if the length of piece is invalid.
-      if (sentencepiece.empty() || sentencepiece.size() > static_cast<size_t>(trainer_spec_.max_sentencepiece_length()))
-      {
-        return false;
+  SentenceStore *sentences_ = nullptr;
+  const TrainerSpec *spec_ = nullptr;
+  ThreadPool *pool_ = nullptr;
+  std::vector<TrainerInterface::Sentence> batch_;
+  std::vector<std::vector<TrainerInterface::Sentence>> sampled_;
+  std::vector<std::unique_ptr<Sampler>> samplers_;
+  size_t num_sampled_input_ = 0;
+  size_t num_batched_ = 0;  // Sentences fed to the reservoirs.
+  size_t num_sampled_held_ = 0;
+  size_t peak_sampled_ = 0;
+  size_t num_stored_ = 0;
+
+  // The index of the stored sentence of every fingerprint, and the summed
+  // frequencies of the stored sentences.
+  absl::flat_hash_map<uint64, size_t> dedup_index_;
+  std::vector<int64> dedup_freqs_;
+  std::vector<bool> merged_;
+};
+
+// Runs `fn` over a cursor of every chunk of `sentences` in parallel
+// and returns the first error.
+util::Status ParallelForEachSentence(
+    ThreadPool *pool, const SentenceStore &sentences,
+    const std::function<util::Status(int thread_id,
+                                     SentenceStore::Cursor *cursor)> &fn) {
+  std::vector<util::Status> status(pool->num_threads());
+  pool->ParallelFor(sentences.size(), TrainerInterface::kSentenceGrainSize,
+                    [&](int n, size_t begin, size_t end) {
+                      if (!status[n].ok()) return;
+                      auto cursor = sentences.NewCursor(begin, end);
+                      status[n] = fn(n, cursor.get());
+                      if (status[n].ok()) status[n] = cursor->status();
+                    });
+  for (const auto &s : status) RETURN_IF_ERROR(s);
+  return util::OkStatus();
+}
+
+// Character frequencies counted by one thread. The characters in the BMP,
+// which cover almost all the text, are counted in a dense array and the
+// others in a sparse map.
+class CharCounter {
+ public:
+  static constexpr char32 kDenseSize = 0x10000;
+
+  CharCounter() : dense_(kDenseSize, 0) {}
+
+  // Counts the characters of the normalized `text` `freq` times.
+  void Add(absl::string_view text, int64 freq) {
+    const char *begin = text.data();
+    const char *end = text.data() + text.size();
+    while (begin < end) {
+      // Counts the runs of ASCII bytes without decoding them.
+      const size_t ascii =
+          string_util::ASCIIPrefixLength(absl::string_view(begin, end - begin));
+      for (const char *p = begin; p < begin + ascii; ++p) {
+        if (*p == 0x00) {
+          ++num_nulls_;
+        } else if (*p != 0x20) {
+          dense_[static_cast<unsigned char>(*p)] += freq;
+          total_ += freq;
+        }
+      }
+      begin += ascii;
+      if (begin == end) break;
+
+      size_t mblen = 0;
+      const char32 c = string_util::DecodeUTF8(begin, end, &mblen);
+      begin += mblen;
+      if (!string_util::IsValidCodepoint(c)) continue;
+      if (c == 0x0000) {
+        ++num_nulls_;
+        continue;
       }
+      // The normalized text has no spaces, so a space can only come from an
+      // interchange-invalid character.
+      if (c == 0x0020) continue;
+      if (c < kDenseSize) {
+        dense_[c] += freq;
+      } else {
+        sparse_[c] += freq;
+      }
+      total_ += freq;
+    }
+  }
 
-      constexpr unicode_script::ScriptType kAnyType = static_cast<unicode_script::ScriptType>(-1);
+  void Merge(const CharCounter &other) {
+    for (char32 c = 0; c < kDenseSize; ++c) dense_[c] += other.dense_[c];
+    for (const auto &it : other.sparse_) sparse_[it.first] += it.second;
+    total_ += other.total_;
+    num_nulls_ += other.num_nulls_;
+  }
 
-      unicode_script::ScriptType prev_script = kAnyType;
-      bool all_whitespace_piece = std::all_of(sentencepiece.begin(), sentencepiece.end(),
-                                              [](char32_t c)
-                                              { return c == kWSChar; });
+  // Adds the non-zero counts to `chars_count`.
+  void AppendTo(
+      absl::flat_hash_map<char32, std::pair<bool, int64>> *chars_count) const {
+    for (char32 c = 0; c < kDenseSize; ++c) {
+      if (dense_[c] > 0) (*chars_count)[c].second += dense_[c];
+    }
+    for (const auto &it : sparse_) (*chars_count)[it.first].second += it.second;
+  }
 
-      for (size_t pos = 0; pos < sentencepiece.size(); ++pos)
-      {
-        const char32_t c = sentencepiece[pos];
-        if (c == kUNKChar)
-        { // UNK must not be included
-          return false;
-        }
-        if (c == 0x0000)
-        { // NULL is not allowed for Darts (TRIE).
-          return false;
-        }
-        if (c == kUPPBoundaryChar)
-        {
-          return false;
-        }
-        if (c == 0x0020)
-        {
-          LOG(WARNING) << "space must not be included in normalized string.";
-          return false;
-        }
-        if (!string_util::IsValidCodepoint(c))
-        {
-          return false;
-        }
+  int64 total() const { return total_; }
+  int64 num_nulls() const { return num_nulls_; }
 
-        if (c == kWSChar)
-        {
-          // Only allows whitespace to appear as a prefix of piece unless
-          // allow_whitespace_only_pieces is True.
-          // When split_by_whitespace is false, we allow whitespaces to
-          // appear in the middle, "foo_bar", but do not allow them
-          // to appear as suffix, "foo_bar_".
-          // Regardless of the setting of split_by_whitespace,
-          // whitespace is treated as a prefix/infix of symbol or
-          // independent symbol, unless allow_whitespace_only_pieces() is true,
-          // in which case whitespace only pieces can occur.
-          if (!trainer_spec_.allow_whitespace_only_pieces() || !all_whitespace_piece)
-          {
-            if (trainer_spec_.treat_whitespace_as_suffix())
-            {
-              if ((trainer_spec_.split_by_whitespace() && pos < sentencepiece.size() - 1) ||
-                  (!trainer_spec_.split_by_whitespace() && pos < sentencepiece.size() - 1 && pos == 0))
-              {
-                return false;
-              }
-            }
-            else
-            {
-              if ((trainer_spec_.split_by_whitespace() && pos > 0) ||
-                  (!trainer_spec_.split_by_whitespace() && pos > 0 && pos == sentencepiece.size() - 1))
-              {
-                return false;
-              }
-            }
-          }
-        }
-        else
-        {
-          auto s = unicode_script::GetScript(c);
-
-          // Merge Hiragana/Katakana into Han.
-          if (s == unicode_script::U_Hiragana || s == unicode_script::U_Katakana || c == 0x30FC)
-          { // long vowel sound (Katakana) should be Katakana
-            s = unicode_script::U_Han;
-          }
-          else if (s == unicode_script::U_Inherited)
-          {
-            s = prev_script;
-          }
+ private:
+  std::vector<int64> dense_;
+  absl::flat_hash_map<char32, int64> sparse_;
+  int64 total_ = 0;
+  int64 num_nulls_ = 0;
+};
 
-          if (!trainer_spec_.split_by_number() && is_unicode_decimal_number(c))
-          {
-            s = kAnyType;
-          }
+constexpr char kCorpusCacheMagic[] = "SPMCACHE";
+constexpr uint32 kCorpusCacheVersion = 1;
 
-          if (trainer_spec_.split_digits() && is_unicode_decimal_number(c))
-          {
-            if (sentencepiece.size() > 1)
-              return false;
-          }
+constexpr char kCheckpointMagic[] = "SPMCKPNT";
+constexpr uint32 kCheckpointVersion = 1;
 
-          // Do not allow a piece to include multiple Unicode scripts
-          // when split_by_unicode_script() is true (default = true).
-          if (trainer_spec_.split_by_unicode_script() && s != kAnyType &&
-              prev_script != kAnyType && prev_script != s)
-          {
-            return false;
-          }
+// Size of the buffer flushed to the cache file at once.
+constexpr size_t kCorpusCacheBufferSize = 1 << 20;
 
-          prev_script = s;
-        }
-      }
-      return true;
-    }
-  } // namespace
+void AppendCacheString(absl::string_view str, std::string *output) {
+  sentence_record::AppendVarint(str.size(), output);
+  output->append(str.data(), str.size());
+}
 
-  MultiFileSentenceIterator::MultiFileSentenceIterator(
-      const std::vector<std::string> &files)
-      : files_(files)
-  {
-    Next();
+bool ConsumeCacheString(absl::string_view *input, absl::string_view *str) {
+  uint64 size = 0;
+  if (!sentence_record::ConsumeVarint(input, &size) || input->size() < size) {
+    return false;
   }
-
-  bool MultiFileSentenceIterator::done() const
-  {
-    return (!read_done_ && file_index_ == files_.size());
+  *str = input->substr(0, size);
+  input->remove_prefix(size);
+  return true;
+}
+
+// Returns the key of the normalized corpus cache. The key covers all the
+// inputs of LoadSentences(): the normalizer spec, the options used while
+// loading, and the path, size and modification time of the input files.
+util::Status GetCorpusCacheKey(const TrainerSpec &trainer_spec,
+                               const NormalizerSpec &normalizer_spec,
+                               std::string *key) {
+  // Options only used after loading must not invalidate the cache so that
+  // vocab sizes and model types can be swept over the same cache.
+  TrainerSpec spec = trainer_spec;
+  spec.clear_model_prefix();
+  spec.clear_model_type();
+  spec.clear_vocab_size();
+  spec.clear_seed_sentencepiece_size();
+  spec.clear_seed_sentencepiece_shard_size();
+  spec.clear_seed_sentencepieces_file();
+  spec.clear_shrinking_factor();
+  spec.clear_num_threads();
+  spec.clear_num_reader_threads();
+  spec.clear_precompile_trie();
+  spec.clear_num_sub_iterations();
+  spec.clear_incremental_e_step_tolerance();
+  spec.clear_em_mini_batch_size();
+  spec.clear_e_step_beam();
+  spec.clear_e_step_window_size();
+  spec.clear_max_sentencepiece_length();
+  spec.clear_split_by_unicode_script();
+  spec.clear_split_by_number();
+  spec.clear_split_by_whitespace();
+  spec.clear_split_digits();
+  spec.clear_allow_whitespace_only_pieces();
+  spec.clear_pretokenization_delimiter();
+  spec.clear_vocabulary_output_piece_score();
+  spec.clear_hard_vocab_limit();
+  spec.clear_train_extremely_large_corpus();
+  spec.clear_normalized_corpus_cache();
+  spec.clear_checkpoint_file();
+  spec.clear_resume_from();
+  spec.clear_distributed_dir();
+  spec.clear_num_distributed_processes();
+  spec.clear_distributed_process_id();
+  spec.clear_distributed_timeout_sec();
+  spec.clear_vocab_size_sweep();
+  spec.clear_sentence_store();
+  spec.clear_sentence_store_dir();
+  spec.clear_keep_sentence_store();
+  spec.clear_max_memory_mb();
+  spec.clear_approximate_bpe_merges();
+
+  key->clear();
+  AppendCacheString(spec.SerializeAsString(), key);
+  AppendCacheString(normalizer_spec.SerializeAsString(), key);
+  for (const auto &input : trainer_spec.input()) {
+    std::error_code ec;
+    const uint64 size = std::filesystem::file_size(input, ec);
+    CHECK_OR_RETURN(!ec) << input << ": " << ec.message();
+    const auto mtime = std::filesystem::last_write_time(input, ec);
+    CHECK_OR_RETURN(!ec) << input << ": " << ec.message();
+    AppendCacheString(input, key);
+    sentence_record::AppendVarint(size, key);
+    sentence_record::AppendVarint(mtime.time_since_epoch().count(), key);
   }
-
-  util::Status MultiFileSentenceIterator::status() const
-  {
-    CHECK_OR_RETURN(fp_);
-    return fp_->status();
+  return util::OkStatus();
+}
+
+// Returns the key of a training checkpoint. In addition to the corpus, the
+// key covers all the options which change the result of the training.
+util::Status GetCheckpointKey(const TrainerSpec &trainer_spec,
+                              const NormalizerSpec &normalizer_spec,
+                              std::string *key) {
+  RETURN_IF_ERROR(GetCorpusCacheKey(trainer_spec, normalizer_spec, key));
+  TrainerSpec spec = trainer_spec;
+  spec.clear_model_prefix();
+  spec.clear_normalized_corpus_cache();
+  spec.clear_checkpoint_file();
+  spec.clear_resume_from();
+  spec.clear_distributed_dir();
+  spec.clear_distributed_timeout_sec();
+  spec.clear_sentence_store();
+  spec.clear_sentence_store_dir();
+  spec.clear_keep_sentence_store();
+  AppendCacheString(spec.SerializeAsString(), key);
+  return util::OkStatus();
+}
+
+// Returns the file name of the cache for `key` in `dirname`.
+std::string GetCorpusCacheFile(absl::string_view dirname,
+                               absl::string_view key) {
+  uint64 fp = kCorpusCacheVersion;
+  for (size_t i = 0; i < key.size(); i += sizeof(uint64)) {
+    uint64 chunk = 0;
+    memcpy(&chunk, key.data() + i, std::min(sizeof(uint64), key.size() - i));
+    fp = port::FingerprintCat(fp, chunk);
   }
+  return util::JoinPath(dirname, absl::StrFormat("%016llx.cache",
+                                                 static_cast<uint64>(fp)));
+}
+}  // namespace
+
+MultiFileSentenceIterator::MultiFileSentenceIterator(
+    const std::vector<std::string> &files)
+    : files_(files) {
+  Next();
+}
+
+bool MultiFileSentenceIterator::done() const {
+  return (!read_done_ && file_index_ == files_.size());
+}
+
+util::Status MultiFileSentenceIterator::status() const {
+  CHECK_OR_RETURN(fp_);
+  return fp_->status();
+}
+
+void MultiFileSentenceIterator::Next() {
+  TryRead();
+
+  if (!read_done_ && file_index_ < files_.size()) {
+    const auto &filename = files_[file_index_++];
+    fp_ = filesystem::NewReadableFile(filename);
+    LOG(INFO) << "Loading corpus: " << filename;
+    if (fp_->status() != util::OkStatus()) {
+      file_index_ = files_.size();
+      read_done_ = false;
+      return;
+    }
 
-  void MultiFileSentenceIterator::Next()
-  {
     TryRead();
-
-    if (!read_done_ && file_index_ < files_.size())
+  }
+}
+
+void MultiFileSentenceIterator::TryRead() {
+  read_done_ = fp_ && fp_->ReadLine(&value_);
+}
+
+constexpr int64 ParallelMultiFileSentenceIterator::kDefaultChunkSize;
+
+ParallelMultiFileSentenceIterator::ParallelMultiFileSentenceIterator(
+    const std::vector<std::string> &files, int num_threads, int64 chunk_size)
+    : window_size_(2 * std::max(num_threads, 1)),
+      pool_(std::make_unique<ThreadPool>(std::max(num_threads, 1))) {
+  chunk_size = std::max<int64>(chunk_size, 1);
+  for (const auto &filename : files) {
+    auto fp = filesystem::NewReadableFile(filename);
+    if (!fp->status().ok()) {
+      split_status_ = fp->status();
+      break;
+    }
+    LOG(INFO) << "Loading corpus: " << filename;
+    const int64 size = fp->Size();
+    if (size < 0) {
+      // No random access. Reads the whole file as one chunk.
+      chunks_.push_back({filename, 0, -1});
+      continue;
+    }
+    for (int64 begin = 0; begin < size; begin += chunk_size) {
+      chunks_.push_back({filename, begin, std::min(begin + chunk_size, size)});
+    }
+  }
+  ScheduleChunks();
+  Refill();
+}
+
+ParallelMultiFileSentenceIterator::~ParallelMultiFileSentenceIterator() {
+  pool_.reset();
+}
+
+void ParallelMultiFileSentenceIterator::ScheduleChunks() {
+  while (next_chunk_ < chunks_.size() && window_.size() < window_size_) {
+    window_.push_back(std::make_unique<ChunkResult>());
+    const Chunk *chunk = &chunks_[next_chunk_++];
+    ChunkResult *result = window_.back().get();
+    pool_->Schedule([this, chunk, result]() {
+      ChunkResult local;
+      ReadChunk(*chunk, &local);
+      std::lock_guard<std::mutex> lock(mutex_);
+      result->lines = std::move(local.lines);
+      result->status = std::move(local.status);
+      result->ready = true;
+      chunk_ready_.notify_all();
+    });
+  }
+}
+
+void ParallelMultiFileSentenceIterator::Next() {
+  if (done_) return;
+  if (++line_index_ < lines_.size()) return;
+  Refill();
+}
+
+void ParallelMultiFileSentenceIterator::Refill() {
+  lines_.clear();
+  line_index_ = 0;
+  while (lines_.empty()) {
+    if (window_.empty()) {
+      status_ = split_status_;
+      done_ = true;
+      return;
+    }
+    std::unique_ptr<ChunkResult> result;
     {
-      const auto &filename = files_[file_index_++];
-      fp_ = filesystem::NewReadableFile(filename);
-      LOG(INFO) << "Loading corpus: " << filename;
-      if (fp_->status() != util::OkStatus())
-      {
-        file_index_ = files_.size();
-        read_done_ = false;
-        return;
-      }
-
-      TryRead();
+      std::unique_lock<std::mutex> lock(mutex_);
+      ChunkResult *front = window_.front().get();
+      chunk_ready_.wait(lock, [front]() { return front->ready; });
+      result = std::move(window_.front());
+      window_.pop_front();
+    }
+    if (!result->status.ok()) {
+      status_ = std::move(result->status);
+      done_ = true;
+      return;
     }
+    lines_ = std::move(result->lines);
+    ScheduleChunks();
+  }
+}
+
+// static
+void ParallelMultiFileSentenceIterator::ReadChunk(const Chunk &chunk,
+                                                  ChunkResult *result) {
+  auto fp = filesystem::NewReadableFile(chunk.filename);
+  if (!fp->status().ok()) {
+    result->status = fp->status();
+    return;
   }
 
-  void MultiFileSentenceIterator::TryRead()
-  {
-    read_done_ = fp_ && fp_->ReadLine(&value_);
+  std::string line;
+  if (chunk.begin > 0) {
+    // Skips the line started in the previous chunk. When the byte before
+    // `begin` is a newline, this reads an empty line and stops at `begin`.
+    if (!fp->Seek(chunk.begin - 1)) {
+      result->status = util::InternalError(
+          absl::StrCat(chunk.filename, ": cannot seek to ", chunk.begin));
+      return;
+    }
+    if (!fp->ReadLine(&line)) return;
   }
 
-  TrainerInterface::TrainerInterface(const TrainerSpec &trainer_spec,
-                                     const NormalizerSpec &normalizer_spec,
-                                     const NormalizerSpec &denormalizer_spec)
-      : trainer_spec_(trainer_spec),
-        normalizer_spec_(normalizer_spec),
-        denormalizer_spec_(denormalizer_spec)
-  {
-    status_ = VerifySpec(trainer_spec_);
-    if (status_.ok())
-      status_ = InitMetaPieces();
+  while (true) {
+    if (chunk.end >= 0) {
+      const int64 pos = fp->Tell();
+      if (pos < 0 || pos >= chunk.end) break;
+    }
+    if (!fp->ReadLine(&line)) break;
+    result->lines.push_back(std::move(line));
+  }
+  result->status = fp->status();  // E.g., a broken compressed file.
+}
+
+namespace {
+double WallTime() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// CPU time of all the threads of the process. Wall time on Windows, where
+// std::clock() measures it.
+double ProcessCpuTime() {
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+// Bytes of the peak resident set size of the process, or 0 if unknown.
+int64 PeakResidentSetSize() {
+#if defined(_WIN32)
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss;
+#else
+  return static_cast<int64>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+}  // namespace
+
+TrainerInterface::TrainerInterface(const TrainerSpec &trainer_spec,
+                                   const NormalizerSpec &normalizer_spec,
+                                   const NormalizerSpec &denormalizer_spec)
+    : trainer_spec_(trainer_spec),
+      normalizer_spec_(normalizer_spec),
+      denormalizer_spec_(denormalizer_spec),
+      observer_(SentencePieceTrainer::GetTrainerObserver()),
+      start_time_(WallTime()) {
+  status_ = VerifySpec(trainer_spec_);
+  if (status_.ok()) {
+    sentences_ = NewSentenceStore(trainer_spec_.sentence_store(),
+                                  trainer_spec_.sentence_store_dir(),
+                                  trainer_spec_.keep_sentence_store());
+  }
+  // An invalid spec still gets a store, which is never filled.
+  if (sentences_ == nullptr) sentences_ = std::make_unique<SentenceArena>();
+  if (status_.ok()) status_ = sentences_->status();
+  if (status_.ok()) status_ = InitMetaPieces();
+}
+
+TrainerInterface::~TrainerInterface() {}
+
+ThreadPool *TrainerInterface::GetThreadPool() const {
+  if (pool_ == nullptr) {
+    // The default num_threads runs on the CPUs of the process at most, e.g.,
+    // of a container with a CPU quota, keeping the shards of the threads so
+    // that the model does not depend on the host.
+    pool_ = std::make_unique<ThreadPool>(
+        trainer_spec_.num_threads(), trainer_spec_.has_num_threads()
+                                         ? trainer_spec_.num_threads()
+                                         : GetNumThreads());
+  }
+  return pool_.get();
+}
+
+TrainerInterface::ScopedPhase::ScopedPhase(TrainerInterface *trainer,
+                                           absl::string_view name)
+    : trainer_(trainer) {
+  phase_.name = std::string(name);
+  trainer_->current_phase_ = phase_.name;
+  TrainerEvent event;
+  event.type = TrainerEvent::PHASE_BEGIN;
+  trainer_->Notify(&event);
+  phase_.wall_time = WallTime();
+  phase_.cpu_time = ProcessCpuTime();
+}
+
+void TrainerInterface::ScopedPhase::End() {
+  if (trainer_ == nullptr) return;
+  phase_.wall_time = WallTime() - phase_.wall_time;
+  phase_.cpu_time = ProcessCpuTime() - phase_.cpu_time;
+  phase_.peak_rss = PeakResidentSetSize();
+  const auto usage = trainer_->GetMemoryUsage();
+  trainer_->RecordMemoryUsage(usage);
+  phase_.memory_bytes = usage.total();
+  TrainerEvent event;
+  event.type = TrainerEvent::PHASE_END;
+  event.wall_time = phase_.wall_time;
+  event.cpu_time = phase_.cpu_time;
+  event.memory_bytes = phase_.memory_bytes;
+  trainer_->current_phase_ = phase_.name;
+  trainer_->Notify(&event);
+  trainer_->current_phase_.clear();
+  trainer_->phases_.push_back(std::move(phase_));
+  trainer_ = nullptr;
+}
+
+void TrainerInterface::Notify(TrainerEvent *event) const {
+  if (observer_ == nullptr) return;
+  event->phase = current_phase_;
+  event->elapsed_time = WallTime() - start_time_;
+  event->peak_rss = PeakResidentSetSize();
+  observer_->OnEvent(*event);
+}
+
+MemoryUsage TrainerInterface::GetMemoryUsage() const {
+  MemoryUsage usage;
+  AddMemoryUsage(&usage);
+  return usage;
+}
+
+void TrainerInterface::AddMemoryUsage(MemoryUsage *usage) const {
+  if (sentences_) usage->Add("sentences", sentences_->GetMemoryUsage());
+  usage->Add("required_chars", memory_usage::HashMap(required_chars_));
+  size_t bytes = memory_usage::Vector(final_pieces_);
+  for (const auto &piece : final_pieces_) {
+    bytes += memory_usage::String(piece.first);
+  }
+  usage->Add("final_pieces", bytes);
+  bytes = memory_usage::Vector(self_test_samples_);
+  for (const auto &sample : self_test_samples_) {
+    bytes += memory_usage::String(sample);
+  }
+  usage->Add("self_test_samples", bytes);
+}
+
+void TrainerInterface::RecordMemoryUsage() const {
+  RecordMemoryUsage(GetMemoryUsage());
+}
+
+void TrainerInterface::RecordMemoryUsage(const MemoryUsage &usage) const {
+  for (const auto &component : usage.components) {
+    const size_t peak = peak_memory_usage_.bytes(component.first);
+    if (component.second > peak) {
+      peak_memory_usage_.Add(component.first, component.second - peak);
+    }
+  }
+}
+
+void TrainerInterface::NotifyMemoryDecision(absl::string_view decision,
+                                            absl::string_view detail) const {
+  TrainerEvent event;
+  event.type = TrainerEvent::MEMORY_DECISION;
+  event.decision = std::string(decision);
+  event.memory_bytes = GetMemoryUsage().total();
+  LOG(INFO) << "Memory budget of " << trainer_spec_.max_memory_mb()
+            << " MiB: " << decision << ", " << detail;
+  Notify(&event);
+}
+
+util::Status TrainerInterface::MaybeSpillSentences() {
+#if !defined(_WIN32) && !defined(SPM_ENABLE_LEVELDB)
+  // The LevelDB builds already store the sentences on disk by default.
+  if (memory_budget() == 0 || sentences_spilled_ ||
+      !trainer_spec_.sentence_store().empty()) {
+    return util::OkStatus();
+  }
+  const size_t bytes = sentences_->GetMemoryUsage();
+  if (bytes <= static_cast<size_t>(memory_budget() / 2)) {
+    return util::OkStatus();
+  }
+  auto store = NewLogSentenceStore(trainer_spec_.sentence_store_dir(),
+                                   trainer_spec_.keep_sentence_store());
+  RETURN_IF_ERROR(store->status());
+  RETURN_IF_ERROR(sentences_->Flush());
+  auto cursor = sentences_->NewCursor();
+  for (; !cursor->done(); cursor->Next()) {
+    const auto &w = cursor->value();
+    RETURN_IF_ERROR(store->AddText(w.first, w.second));
+  }
+  RETURN_IF_ERROR(cursor->status());
+  RETURN_IF_ERROR(store->Flush());
+  sentences_ = std::move(store);
+  sentences_spilled_ = true;
+  NotifyMemoryDecision(
+      "spill_sentences",
+      absl::StrCat("moved ", sentences_->size(), " sentences of ", bytes,
+                   " bytes in memory to a log sentence store"));
+#endif
+  return util::OkStatus();
+}
+
+bool TrainerInterface::IsValidSentencePiece(
+    const string_util::UnicodeText &sentencepiece) const {
+  // Returns false if the length of piece is invalid.
+  if (sentencepiece.empty() ||
+      sentencepiece.size() >
+          static_cast<size_t>(trainer_spec_.max_sentencepiece_length())) {
+    return false;
   }
 
-  TrainerInterface::~TrainerInterface() {}
+  constexpr unicode_script::ScriptType kAnyType =
+      static_cast<unicode_script::ScriptType>(-1);
 
-  bool TrainerInterface::IsValidSentencePiece(
-      const string_util::UnicodeText &sentencepiece) const
-  {
-    // Returns false if the length of piece is invalid.
-    if (sentencepiece.empty() ||
-        sentencepiece.size() >
-            static_cast<size_t>(trainer_spec_.max_sentencepiece_length()))
-    {
+  unicode_script::ScriptType prev_script = kAnyType;
+  bool all_whitespace_piece =
+      std::all_of(sentencepiece.begin(), sentencepiece.end(),
+                  [](char32 c) { return c == kWSChar; });
+
+  for (size_t pos = 0; pos < sentencepiece.size(); ++pos) {
+    const char32 c = sentencepiece[pos];
+    if (c == kUNKChar) {  // UNK must not be included
+      return false;
+    }
+    if (c == 0x0000) {  // NULL is not allowed for Darts (TRIE).
+      return false;
+    }
+    if (c == kUPPBoundaryChar) {
+      return false;
+    }
+    if (c == 0x0020) {
+      LOG(WARNING) << "space must not be included in normalized string.";
+      return false;
+    }
+    if (!string_util::IsValidCodepoint(c)) {
       return false;
     }
 
-    constexpr unicode_script::ScriptType kAnyType =
-        static_cast<unicode_script::ScriptType>(-1);
-
-    unicode_script::ScriptType prev_script = kAnyType;
-    bool all_whitespace_piece =
-        std::all_of(sentencepiece.begin(), sentencepiece.end(),
-                    [](char32 c)
-                    { return c == kWSChar; });
+    if (c == kWSChar) {
+      // Only allows whitespace to appear as a prefix of piece unless
+      // allow_whitespace_only_pieces is True.
+      // When split_by_whitespace is false, we allow whitespaces to
+      // appear in the middle, "foo_bar", but do not allow them
+      // to appear as suffix, "foo_bar_".
+      // Regardless of the setting of split_by_whitespace,
+      // whitespace is treated as a prefix/infix of symbol or
+      // independent symbol, unless allow_whitespace_only_pieces() is true,
+      // in which case whitespace only pieces can occur.
+      if (!trainer_spec_.allow_whitespace_only_pieces() ||
+          !all_whitespace_piece) {
+        if (trainer_spec_.treat_whitespace_as_suffix()) {
+          if ((trainer_spec_.split_by_whitespace() &&
+               pos < sentencepiece.size() - 1) ||
+              (!trainer_spec_.split_by_whitespace() &&
+               pos < sentencepiece.size() - 1 && pos == 0)) {
+            return false;
+          }
+        } else {
+          if ((trainer_spec_.split_by_whitespace() && pos > 0) ||
+              (!trainer_spec_.split_by_whitespace() && pos > 0 &&
+               pos == sentencepiece.size() - 1)) {
+            return false;
+          }
+        }
+      }
+    } else {
+      auto s = unicode_script::GetScript(c);
+
+      // Merge Hiragana/Katakana into Han.
+      if (s == unicode_script::U_Hiragana || s == unicode_script::U_Katakana ||
+          c == 0x30FC) {  // long vowel sound (Katakana) should be Katakana
+        s = unicode_script::U_Han;
+      } else if (s == unicode_script::U_Inherited) {
+        s = prev_script;
+      }
 
-    for (size_t pos = 0; pos < sentencepiece.size(); ++pos)
-    {
-      const char32 c = sentencepiece[pos];
-      if (c == kUNKChar)
-      { // UNK must not be included
-        return false;
+      if (!trainer_spec_.split_by_number() && is_unicode_decimal_number(c)) {
+        s = kAnyType;
       }
-      if (c == 0x0000)
-      { // NULL is not allowed for Darts (TRIE).
-        return false;
+
+      if (trainer_spec_.split_digits() && is_unicode_decimal_number(c)) {
+        if (sentencepiece.size() > 1) return false;
       }
-      if (c == kUPPBoundaryChar)
-      {
+
+      // Do not allow a piece to include multiple Unicode scripts
+      // when split_by_unicode_script() is true (default = true).
+      if (trainer_spec_.split_by_unicode_script() && s != kAnyType &&
+          prev_script != kAnyType && prev_script != s) {
         return false;
       }
-      if (c == 0x0020)
-      {
-        LOG(WARNING) << "space must not be included in normalized string.";
+
+      prev_script = s;
+    }
+  }
+  return true;
+}
+
+TrainerInterface::PieceSummary TrainerInterface::GetCharSummary(
+    char32 c) const {
+  PieceSummary summary = {};
+  summary.size = 1;
+  summary.invalid_char = c == kUNKChar || c == 0x0000 ||
+                         c == kUPPBoundaryChar || c == 0x0020 ||
+                         !string_util::IsValidCodepoint(c);
+  summary.valid_scripts = true;
+  summary.first_script = summary.last_script = kNoScript;
+  if (c == kWSChar) {
+    summary.all_whitespace = summary.has_whitespace = true;
+    summary.first_whitespace = summary.last_whitespace = true;
+    return summary;
+  }
+
+  // Follows the scripts of IsValidSentencePiece(). Inherited characters
+  // take the script of the previous one, so they have no script here.
+  int32 script = unicode_script::GetScript(c);
+  if (script == unicode_script::U_Hiragana ||
+      script == unicode_script::U_Katakana || c == 0x30FC) {
+    script = unicode_script::U_Han;
+  } else if (script == unicode_script::U_Inherited) {
+    script = kNoScript;
+  }
+  summary.has_digit = is_unicode_decimal_number(c);
+  if (!trainer_spec_.split_by_number() && summary.has_digit) {
+    script = kAnyScript;
+  }
+  summary.first_script = summary.last_script = script;
+  return summary;
+}
+
+// static
+TrainerInterface::PieceSummary TrainerInterface::MergePieceSummaries(
+    const PieceSummary &left, const PieceSummary &right) {
+  PieceSummary summary;
+  summary.size = left.size + right.size;
+  summary.invalid_char = left.invalid_char || right.invalid_char;
+  // kNoScript and kAnyScript are negative and mix with any script.
+  summary.valid_scripts =
+      left.valid_scripts && right.valid_scripts &&
+      (left.last_script < 0 || right.first_script < 0 ||
+       left.last_script == right.first_script);
+  summary.has_digit = left.has_digit || right.has_digit;
+  summary.all_whitespace = left.all_whitespace && right.all_whitespace;
+  summary.has_whitespace = left.has_whitespace || right.has_whitespace;
+  summary.first_whitespace = left.first_whitespace;
+  summary.last_whitespace = right.last_whitespace;
+  summary.whitespace_after_first =
+      left.whitespace_after_first || right.has_whitespace;
+  summary.whitespace_before_last =
+      left.has_whitespace || right.whitespace_before_last;
+  summary.first_script =
+      left.first_script != kNoScript ? left.first_script : right.first_script;
+  summary.last_script =
+      right.last_script != kNoScript ? right.last_script : left.last_script;
+  return summary;
+}
+
+bool TrainerInterface::IsValidPieceSummary(
+    const PieceSummary &summary) const {
+  if (summary.size == 0 ||
+      summary.size >
+          static_cast<uint32>(trainer_spec_.max_sentencepiece_length()) ||
+      summary.invalid_char) {
+    return false;
+  }
+
+  if (summary.has_whitespace &&
+      (!trainer_spec_.allow_whitespace_only_pieces() ||
+       !summary.all_whitespace)) {
+    const bool multi = summary.size > 1;
+    if (trainer_spec_.treat_whitespace_as_suffix()) {
+      if (trainer_spec_.split_by_whitespace()
+              ? summary.whitespace_before_last
+              : summary.first_whitespace && multi) {
         return false;
       }
-      if (!string_util::IsValidCodepoint(c))
-      {
+    } else {
+      if (trainer_spec_.split_by_whitespace()
+              ? summary.whitespace_after_first
+              : summary.last_whitespace && multi) {
         return false;
       }
+    }
+  }
 
-      if (c == kWSChar)
-      {
-        // Only allows whitespace to appear as a prefix of piece unless
-        // allow_whitespace_only_pieces is True.
-        // When split_by_whitespace is false, we allow whitespaces to
-        // appear in the middle, "foo_bar", but do not allow them
-        // to appear as suffix, "foo_bar_".
-        // Regardless of the setting of split_by_whitespace,
-        // whitespace is treated as a prefix/infix of symbol or
-        // independent symbol, unless allow_whitespace_only_pieces() is true,
-        // in which case whitespace only pieces can occur.
-        if (!trainer_spec_.allow_whitespace_only_pieces() ||
-            !all_whitespace_piece)
-        {
-          if (trainer_spec_.treat_whitespace_as_suffix())
-          {
-            if ((trainer_spec_.split_by_whitespace() &&
-                 pos < sentencepiece.size() - 1) ||
-                (!trainer_spec_.split_by_whitespace() &&
-                 pos < sentencepiece.size() - 1 && pos == 0))
-            {
-              return false;
-            }
-          }
-          else
-          {
-            if ((trainer_spec_.split_by_whitespace() && pos > 0) ||
-                (!trainer_spec_.split_by_whitespace() && pos > 0 &&
-                 pos == sentencepiece.size() - 1))
-            {
-              return false;
-            }
-          }
-        }
-      }
-      else
-      {
-        auto s = unicode_script::GetScript(c);
-
-        // Merge Hiragana/Katakana into Han.
-        if (s == unicode_script::U_Hiragana || s == unicode_script::U_Katakana ||
-            c == 0x30FC)
-        { // long vowel sound (Katakana) should be Katakana
-          s = unicode_script::U_Han;
-        }
-        else if (s == unicode_script::U_Inherited)
-        {
-          s = prev_script;
-        }
-
-        if (!trainer_spec_.split_by_number() && is_unicode_decimal_number(c))
-        {
-          s = kAnyType;
-        }
-
-        if (trainer_spec_.split_digits() && is_unicode_decimal_number(c))
-        {
-          if (sentencepiece.size() > 1)
-            return false;
-        }
+  if (trainer_spec_.split_digits() && summary.has_digit && summary.size > 1) {
+    return false;
+  }
 
-        // Do not allow a piece to include multiple Unicode scripts
-        // when split_by_unicode_script() is true (default = true).
-        if (trainer_spec_.split_by_unicode_script() && s != kAnyType &&
-            prev_script != kAnyType && prev_script != s)
-        {
-          return false;
+  return !trainer_spec_.split_by_unicode_script() || summary.valid_scripts;
+}
+
+template <typename T>
+void AddDPNoise(const TrainerSpec &trainer_spec, std::mt19937 *generator,
+                T *to_update) {
+  if (trainer_spec.differential_privacy_noise_level() > 0) {
+    std::normal_distribution<float> dist(
+        0.0f, trainer_spec.differential_privacy_noise_level());
+    const float random_num = dist(*generator);
+    *to_update =
+        std::round(std::max(0.f, random_num + static_cast<float>(*to_update)));
+  }
+  // Clip anything below the clipping threshold to 0.
+  if (*to_update < trainer_spec.differential_privacy_clipping_threshold()) {
+    *to_update = 0;
+  }
+}
+
+util::Status TrainerInterface::LoadCorpus(
+    SentenceIterator *sentence_iterator,
+    std::shared_ptr<const LoadedCorpus> *corpus) {
+  CHECK_OR_RETURN(corpus != nullptr);
+  CHECK_OR_RETURN(loaded_corpus_ == nullptr);
+  sentence_iterator_ = sentence_iterator;
+  loading_corpus_ = true;
+  const auto status = LoadSentences();
+  loading_corpus_ = false;
+  sentence_iterator_ = nullptr;
+  RETURN_IF_ERROR(status);
+
+  auto loaded = std::make_shared<LoadedCorpus>();
+  RETURN_IF_ERROR(
+      GetCorpusCacheKey(trainer_spec_, normalizer_spec_, &loaded->key));
+  RETURN_IF_ERROR(sentences_->Flush());
+  loaded->sentences = std::move(sentences_);
+  loaded->required_chars = std::move(required_chars_);
+  loaded->self_test_samples = std::move(self_test_samples_);
+  // Empty until the training takes `loaded`.
+  sentences_ = std::make_unique<SentenceArena>();
+  required_chars_.clear();
+  self_test_samples_.clear();
+  loaded_corpus_ = loaded;
+  *corpus = std::move(loaded);
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::TakeLoadedCorpus() {
+  std::string key;
+  RETURN_IF_ERROR(GetCorpusCacheKey(trainer_spec_, normalizer_spec_, &key));
+  CHECK_OR_RETURN(key == loaded_corpus_->key)
+      << "The corpus was loaded with other options. The specs of the models "
+         "of a corpus may only differ in the options used after loading, "
+         "e.g., model_type and vocab_size.";
+
+  ScopedPhase load_phase(this, "load_sentences");
+  // The trainers of a corpus share sentence_store_dir, so a copy on disk
+  // goes to a temporary directory of its own.
+  const std::string type = trainer_spec_.sentence_store();
+  const bool keep = trainer_spec_.keep_sentence_store();
+  sentences_ = NewCopyOnWriteSentenceStore(
+      loaded_corpus_->sentences,
+      [type, keep]() -> std::unique_ptr<SentenceStore> {
+#if !defined(_WIN32)
+        if (!type.empty() && type != "arena") {
+          return NewLogSentenceStore("", keep);
         }
-
-        prev_script = s;
+#endif
+        return std::make_unique<SentenceArena>();
+      });
+  required_chars_ = loaded_corpus_->required_chars;
+  self_test_samples_ = loaded_corpus_->self_test_samples;
+  RETURN_IF_ERROR(VerifyRequiredChars());
+
+  LOG(INFO) << "Taking " << sentences_->size()
+            << " sentences loaded for another model.";
+  TrainerEvent loaded;
+  loaded.type = TrainerEvent::SENTENCES_LOADED;
+  loaded.num_sentences = sentences_->size();
+  Notify(&loaded);
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::LoadSentences() {
+  RETURN_IF_ERROR(status());
+  RETURN_IF_ERROR(sentences_->status());
+  CHECK_OR_RETURN(sentences_->empty());
+  CHECK_OR_RETURN(required_chars_.empty());
+  CHECK_OR_RETURN(trainer_spec_.input_format().empty() ||
+                  trainer_spec_.input_format() == "text" ||
+                  trainer_spec_.input_format() == "tsv")
+      << "Supported formats are 'text' and 'tsv'.";
+
+  CHECK_OR_RETURN(
+      loaded_corpus_ != nullptr ||
+      (sentence_iterator_ != nullptr && trainer_spec_.input().empty()) ||
+      (sentence_iterator_ == nullptr && !trainer_spec_.input().empty()))
+      << "SentenceIterator and trainer_spec.input() must be exclusive.";
+
+  CHECK_OR_RETURN(
+      loading_corpus_ ||
+      (output_model_proto_ != nullptr &&
+       trainer_spec_.model_prefix().empty()) ||
+      (output_model_proto_ == nullptr && !trainer_spec_.model_prefix().empty()))
+      << "ModelProto and trainer_spec.model_prefix() must be exclusive.";
+
+  if (loaded_corpus_ != nullptr) return TakeLoadedCorpus();
+
+  ScopedPhase load_phase(this, "load_sentences");
+  std::string cache_key, cache_file;
+  if (!trainer_spec_.normalized_corpus_cache().empty()) {
+    if (sentence_iterator_ != nullptr) {
+      LOG(WARNING) << "normalized_corpus_cache is ignored when "
+                      "SentenceIterator is specified.";
+    } else {
+      RETURN_IF_ERROR(
+          GetCorpusCacheKey(trainer_spec_, normalizer_spec_, &cache_key));
+      cache_file = GetCorpusCacheFile(
+          trainer_spec_.normalized_corpus_cache(), cache_key);
+      bool found = false;
+      RETURN_IF_ERROR(LoadCorpusCache(cache_file, cache_key, &found));
+      if (found) {
+        LOG(INFO) << "Loaded " << sentences_->size()
+                  << " normalized sentences from " << cache_file;
+        RETURN_IF_ERROR(MaybeSpillSentences());
+        return VerifyRequiredChars();
       }
     }
-    return true;
   }
 
-  template <typename T>
-  void AddDPNoise(const TrainerSpec &trainer_spec, std::mt19937 *generator,
-                  T *to_update)
-  {
-    if (trainer_spec.differential_privacy_noise_level() > 0)
-    {
-      std::normal_distribution<float> dist(
-          0.0f, trainer_spec.differential_privacy_noise_level());
-      const float random_num = dist(*generator);
-      *to_update =
-          std::round(std::max(0.f, random_num + static_cast<float>(*to_update)));
-    }
-    // Clip anything below the clipping threshold to 0.
-    if (*to_update < trainer_spec.differential_privacy_clipping_threshold())
-    {
-      *to_update = 0;
-    }
-  }
+  const bool is_tsv = trainer_spec_.input_format() == "tsv";
 
-  util::Status TrainerInterface::LoadSentences()
-  {
-    RETURN_IF_ERROR(status());
-    CHECK_OR_RETURN(sentences_.empty());
-    CHECK_OR_RETURN(required_chars_.empty());
-    CHECK_OR_RETURN(trainer_spec_.input_format().empty() ||
-                    trainer_spec_.input_format() == "text" ||
-                    trainer_spec_.input_format() == "tsv")
-        << "Supported formats are 'text' and 'tsv'.";
-
-    CHECK_OR_RETURN(
-        (sentence_iterator_ != nullptr && trainer_spec_.input().empty()) ||
-        (sentence_iterator_ == nullptr && !trainer_spec_.input().empty()))
-        << "SentenceIterator and trainer_spec.input() must be exclusive.";
-
-    CHECK_OR_RETURN(
-        (output_model_proto_ != nullptr &&
-         trainer_spec_.model_prefix().empty()) ||
-        (output_model_proto_ == nullptr && !trainer_spec_.model_prefix().empty()))
-        << "ModelProto and trainer_spec.model_prefix() must be exclusive.";
-
-    const bool is_tsv = trainer_spec_.input_format() == "tsv";
-
-    SentenceSelector selector(&sentences_, trainer_spec_);
-    random::ReservoirSampler<std::string> test_sentence_sampler(
-        &self_test_samples_, trainer_spec_.self_test_sample_size());
-
-    int too_long_lines = 0;
-
-    std::unique_ptr<SentenceIterator> sentence_iterator_impl;
-    if (sentence_iterator_ == nullptr)
-    {
+  SentenceSelector selector(sentences_.get(), trainer_spec_, GetThreadPool());
+  random::ReservoirSampler<std::string> test_sentence_sampler(
+      &self_test_samples_, trainer_spec_.self_test_sample_size());
+
+  int too_long_lines = 0;
+  // Lines read, counted to measure the stored sentences every
+  // kMemoryCheckInterval lines.
+  int64 num_lines = 0;
+
+  std::unique_ptr<SentenceIterator> sentence_iterator_impl;
+  if (sentence_iterator_ == nullptr) {
+    const std::vector<std::string> files(trainer_spec_.input().begin(),
+                                         trainer_spec_.input().end());
+    if (trainer_spec_.num_reader_threads() > 1) {
+      LOG(INFO) << "SentenceIterator is not specified. Using "
+                   "ParallelMultiFileSentenceIterator with "
+                << trainer_spec_.num_reader_threads() << " threads.";
+      sentence_iterator_impl =
+          std::make_unique<ParallelMultiFileSentenceIterator>(
+              files, trainer_spec_.num_reader_threads());
+    } else {
       LOG(INFO) << "SentenceIterator is not specified. Using "
                    "MultiFileSentenceIterator.";
       sentence_iterator_impl =
-          std::make_unique<MultiFileSentenceIterator>(std::vector<std::string>(
-              trainer_spec_.input().begin(), trainer_spec_.input().end()));
-      sentence_iterator_ = sentence_iterator_impl.get();
+          std::make_unique<MultiFileSentenceIterator>(files);
     }
+    sentence_iterator_ = sentence_iterator_impl.get();
+  }
 
-    for (; !sentence_iterator_->done(); sentence_iterator_->Next())
-    {
-      int64 freq = 1;
-      std::string sentence = sentence_iterator_->value();
-
-      if (is_tsv)
-      {
-        const std::vector<std::string> v = absl::StrSplit(sentence, '\t');
-        CHECK_EQ_OR_RETURN(v.size(), 2)
-            << "Input format must be: word <tab> freq. " << sentence;
-        sentence = v[0];
-        CHECK_OR_RETURN(absl::SimpleAtoi(v[1], &freq))
-            << "Could not parse the frequency";
-        CHECK_GE_OR_RETURN(freq, 1);
-      }
+  for (; !sentence_iterator_->done(); sentence_iterator_->Next()) {
+    int64 freq = 1;
+    // The sentence is only copied when it is stored or sampled.
+    absl::string_view sentence = sentence_iterator_->view();
+
+    if (is_tsv) {
+      const std::vector<absl::string_view> v = absl::StrSplit(sentence, '\t');
+      CHECK_EQ_OR_RETURN(v.size(), 2)
+          << "Input format must be: word <tab> freq. " << sentence;
+      sentence = v[0];
+      CHECK_OR_RETURN(absl::SimpleAtoi(v[1], &freq))
+          << "Could not parse the frequency";
+      CHECK_GE_OR_RETURN(freq, 1);
+    }
 
-      if (sentence.empty())
-        continue;
+    if (sentence.empty()) continue;
 
-      if (static_cast<int>(sentence.size()) >
-          trainer_spec_.max_sentence_length())
-      {
-        if (too_long_lines == 0)
-        {
-          LOG(WARNING) << "Found too long line (" << sentence.size() << " > "
-                       << trainer_spec_.max_sentence_length() << ").";
-          LOG(WARNING) << "Too long lines are skipped in the training.";
-          LOG(WARNING) << "The maximum length can be changed with "
-                          "--max_sentence_length=<size> flag.";
-        }
-        ++too_long_lines;
-        continue;
+    if (static_cast<int>(sentence.size()) >
+        trainer_spec_.max_sentence_length()) {
+      if (too_long_lines == 0) {
+        LOG(WARNING) << "Found too long line (" << sentence.size() << " > "
+                     << trainer_spec_.max_sentence_length() << ").";
+        LOG(WARNING) << "Too long lines are skipped in the training.";
+        LOG(WARNING) << "The maximum length can be changed with "
+                        "--max_sentence_length=<size> flag.";
       }
+      ++too_long_lines;
+      continue;
+    }
 
-      if (sentence.find(kUNKStr) != std::string::npos)
-      {
-        LOG(INFO) << "Reserved chars are found. Skipped: " << sentence;
-        continue;
-      }
-
-      test_sentence_sampler.Add(sentence);
-
-      if (!selector.Add(std::make_pair(sentence, freq)))
-      {
-        goto END;
-      }
+    if (sentence.find(kUNKStr) != std::string::npos) {
+      LOG(INFO) << "Reserved chars are found. Skipped: " << sentence;
+      continue;
     }
 
-    RETURN_IF_ERROR(sentence_iterator_->status());
+    test_sentence_sampler.Add(sentence);
 
-  END:
-    // Emits error message if any.
-    selector.Finish();
+    bool more = true;
+    RETURN_IF_ERROR(selector.Add(sentence, freq, &more));
+    if (!more) goto END;
 
-    if (sentences_.size() == selector.total_size())
-    {
-      LOG(INFO) << "Loaded all " << sentences_.size() << " sentences";
-    }
-    else
-    {
-      LOG(INFO) << "Sampled " << sentences_.size() << " sentences from "
-                << selector.total_size() << " sentences.";
+    if (memory_budget() > 0 && ++num_lines % kMemoryCheckInterval == 0) {
+      RETURN_IF_ERROR(MaybeSpillSentences());
+      selector.set_sentences(sentences_.get());
     }
+  }
 
-    if (too_long_lines > 0)
-      LOG(INFO) << "Skipped " << too_long_lines << " too long sentences.";
-    if (self_test_samples_.size() > 0)
-      LOG(INFO) << "Loaded " << self_test_samples_.size() << " test sentences";
+  RETURN_IF_ERROR(sentence_iterator_->status());
 
-    // Normalize and removes empty string.
-    {
-      const normalizer::Normalizer normalizer(normalizer_spec_, trainer_spec_);
-      std::set<absl::string_view> meta_pieces_set;
-      for (const auto &it : meta_pieces_)
-      {
-        LOG(INFO) << "Adding meta_piece: " << it.second.first;
-        meta_pieces_set.insert(it.second.first);
-      }
-      const normalizer::PrefixMatcher meta_pieces_matcher(meta_pieces_set);
-
-      LOG(INFO) << "Normalizing sentences...";
-      CHECK_OR_RETURN(!sentences_.empty());
-      {
-        auto pool = std::make_unique<ThreadPool>(trainer_spec_.num_threads());
-        pool->StartWorkers();
-        for (int n = 0; n < trainer_spec_.num_threads(); ++n)
-        {
-          pool->Schedule([&, n]()
-                         {
-          for (size_t i = n; i < sentences_.size();
-               i += trainer_spec_.num_threads()) {
-            auto *s = &sentences_[i].first;
-            *s = meta_pieces_matcher.GlobalReplace(normalizer.Normalize(*s),
-                                                   kUPPBoundaryStr);
-          } });
-        }
-      }
+END:
+  // Emits error message if any.
+  RETURN_IF_ERROR(selector.Finish());
+  peak_sampled_sentences_ = selector.peak_sampled();
+  // The sampled sentences are only stored by Finish().
+  RETURN_IF_ERROR(MaybeSpillSentences());
 
-      for (size_t i = 0; i < sentences_.size(); ++i)
-      {
-        auto *s = &sentences_[i].first;
-        CHECK_OR_RETURN(s->find(" ") == std::string::npos)
-            << "Normalized string must not include spaces";
-        if (s->empty())
-        {
-          std::swap(sentences_[i], sentences_[sentences_.size() - 1]);
-          sentences_.resize(sentences_.size() - 1);
-        }
-      }
-    }
-
-    // If DP is required, add the noise/clip the input.
-    if (trainer_spec_.enable_differential_privacy())
-    {
-      if (trainer_spec_.input_format() != "tsv")
-      {
-        LOG(ERROR)
-            << "Dp version will not work correctly with text input format.";
-      }
-      if (trainer_spec_.differential_privacy_noise_level() <= 0)
-      {
-        LOG(WARNING) << "Private version with <=0 noise level will give "
-                        "infinity epsilon guarantees.";
-      }
-      if (trainer_spec_.differential_privacy_clipping_threshold() <= 0)
-      {
-        LOG(WARNING) << "Private version with <=0 clipping threshold will give "
-                        "infinity epsilon guarantees.";
-      }
+  if (selector.num_stored() == selector.total_size()) {
+    LOG(INFO) << "Loaded all " << selector.num_stored() << " sentences";
+  } else {
+    LOG(INFO) << "Sampled " << selector.num_stored() << " sentences from "
+              << selector.total_size() << " sentences.";
+  }
 
-      // Add noise to all the sentences via threadpool.
+  if (too_long_lines > 0)
+    LOG(INFO) << "Skipped " << too_long_lines << " too long sentences.";
+  if (self_test_samples_.size() > 0)
+    LOG(INFO) << "Loaded " << self_test_samples_.size() << " test sentences";
+  load_phase.End();
 
-      // This line is mainly for tests with small num of sentences.
-      const auto num_workers =
-          std::min<uint64>(trainer_spec_.num_threads(), sentences_.size() - 1);
+  ScopedPhase normalize_phase(this, "normalize");
 
-      {
-        auto pool = std::make_unique<ThreadPool>(num_workers);
-        pool->StartWorkers();
-        for (int n = 0; n < num_workers; ++n)
-        {
-          pool->Schedule([&, n]()
-                         {
-          // One per thread generator.
-          auto *generator = random::GetRandomGenerator();
-          for (size_t i = n; i < sentences_.size(); i += num_workers) {
-            AddDPNoise<int64>(trainer_spec_, generator,
-                              &(sentences_[i].second));
-          } });
-        }
-      }
+  // Characters are counted while normalizing, so that the corpus is not
+  // scanned again.
+  std::vector<CharCounter> char_counters(GetThreadPool()->num_threads());
 
-      // Remove zero freq elements.
-      const auto before_size = sentences_.size();
-      auto it = std::remove_if(sentences_.begin(), sentences_.end(),
-                               [](const Sentence &s)
-                               { return s.second <= 0; });
-      const auto new_size = std::distance(sentences_.begin(), it);
-      const int num_erased = before_size - new_size;
-      sentences_.erase(it, sentences_.end());
-
-      LOG(INFO) << "DP noise resulted in " << 1.0 * num_erased / before_size
-                << " fraction of sentences removed.";
+  // Normalize and removes empty string.
+  {
+    const normalizer::Normalizer normalizer(normalizer_spec_, trainer_spec_);
+    std::set<absl::string_view> meta_pieces_set;
+    for (const auto &it : meta_pieces_) {
+      LOG(INFO) << "Adding meta_piece: " << it.second.first;
+      meta_pieces_set.insert(it.second.first);
     }
+    const normalizer::PrefixMatcher meta_pieces_matcher(meta_pieces_set);
+
+    // Per-thread buffers reused across the sentences. The stored sentence is
+    // copied out of them, so it does not keep the spare capacity reserved by
+    // the normalizer.
+    struct NormalizeBuffer {
+      std::string normalized;
+      std::string replaced;
+      std::vector<size_t> norm_to_orig;
+    };
+    std::vector<NormalizeBuffer> buffers(GetThreadPool()->num_threads());
+
+    LOG(INFO) << "Normalizing sentences...";
+    CHECK_OR_RETURN(!sentences_->empty());
+    RETURN_IF_ERROR(ParallelForEachSentence(
+        GetThreadPool(), *sentences_,
+        [&](int n, SentenceStore::Cursor *cursor) -> util::Status {
+          NormalizeBuffer *buffer = &buffers[n];
+          for (; !cursor->done(); cursor->Next()) {
+            const auto &w = cursor->value();
+            RETURN_IF_ERROR(normalizer.Normalize(w.first, &buffer->normalized,
+                                                 &buffer->norm_to_orig));
+            const std::string *s = &buffer->normalized;
+            if (meta_pieces_matcher.GlobalReplace(*s, kUPPBoundaryStr,
+                                                  &buffer->replaced)) {
+              s = &buffer->replaced;
+            }
+            CHECK_OR_RETURN(s->find(" ") == std::string::npos)
+                << "Normalized string must not include spaces";
+            // The frequencies are final unless DP noise is added below.
+            if (!trainer_spec_.enable_differential_privacy()) {
+              char_counters[n].Add(*s, w.second);
+            }
+            if (*s == w.first) continue;
+            RETURN_IF_ERROR(
+                sentences_->Set(cursor->index(), std::make_pair(*s, w.second)));
+          }
+          return util::OkStatus();
+        }));
 
-    // Count character frequencies.
-    int64 all_chars_count = 0;
-    // A map from a character to {is_required_char, character count}.
-    absl::flat_hash_map<char32, std::pair<bool, int64>> chars_count;
-    for (const char32 c :
-         string_util::UTF8ToUnicodeText(trainer_spec_.required_chars()))
-    {
-      CHECK_OR_RETURN(string_util::IsValidCodepoint(c));
-      if (c == 0x0000)
-      {
-        LOG(INFO) << "Found null character. The required_chars field must be "
-                     "encoded in utf-8.";
-        continue;
-      }
-      chars_count[c].first = true; // is_required_character.
+    RETURN_IF_ERROR(sentences_->RemoveIf(
+        [](const Sentence &s) { return s.first.empty(); }));
+  }
+
+  // If DP is required, add the noise/clip the input.
+  if (trainer_spec_.enable_differential_privacy()) {
+    if (trainer_spec_.input_format() != "tsv") {
+      LOG(ERROR)
+          << "Dp version will not work correctly with text input format.";
     }
-    for (const auto &w : sentences_)
-    {
-      for (const char32 c : string_util::UTF8ToUnicodeText(w.first))
-      {
-        if (!string_util::IsValidCodepoint(c))
-          continue;
-        if (c == 0x0000)
-        {
-          LOG(INFO)
-              << "Found null character. The corpus must be encoded in utf-8.";
-          continue;
-        }
-        if (c == 0x0020)
-        {
-          // UTF8ToUnicodeText returns a white space if the text
-          // contains an interchange-invalid character.
-          CHECK_OR_RETURN(w.first.find(" ") == std::string::npos)
-              << "space must not be included in normalized string.";
-          continue;
-        }
-        chars_count[c].second += w.second;
-        all_chars_count += w.second;
-      }
+    if (trainer_spec_.differential_privacy_noise_level() <= 0) {
+      LOG(WARNING) << "Private version with <=0 noise level will give "
+                      "infinity epsilon guarantees.";
     }
-    LOG(INFO) << "all chars count=" << all_chars_count;
-
-    // Determines required_chars which must be included in the vocabulary.
-    int64 accumulated_chars_count = 0;
-    // Sorted() sorts the chars_count values in the decsending order of pair<>.
-    // I.e. characters are sorted in the order of required characters and then
-    // frequent characters.
-    for (const auto &w : Sorted(chars_count))
-    {
-      const float coverage = 1.0 * accumulated_chars_count / all_chars_count;
-      if (!trainer_spec_.use_all_vocab() &&
-          coverage >= trainer_spec_.character_coverage())
-      {
-        LOG(INFO) << "Done: " << 100.0 * coverage << "% characters are covered.";
-        break;
-      }
-      accumulated_chars_count += w.second.second;
-      CHECK_NE_OR_RETURN(w.first, 0x0020)
-          << "space must not be included in normalized string.";
-      if (w.first == kUPPBoundaryChar)
-        continue; // Tab is not included.
-      required_chars_.emplace(w.first, w.second.second);
+    if (trainer_spec_.differential_privacy_clipping_threshold() <= 0) {
+      LOG(WARNING) << "Private version with <=0 clipping threshold will give "
+                      "infinity epsilon guarantees.";
     }
 
-    LOG(INFO) << "Alphabet size=" << required_chars_.size();
-    LOG(INFO) << "Final character coverage="
-              << 1.0 * accumulated_chars_count / all_chars_count;
-
-    CHECK_OR_RETURN(!port::ContainsKey(required_chars_, kUNKChar));
+    // Add noise to all the sentences via threadpool.
+    RETURN_IF_ERROR(ParallelForEachSentence(
+        GetThreadPool(), *sentences_,
+        [&](int n, SentenceStore::Cursor *cursor) -> util::Status {
+          // One per thread generator.
+          auto *generator = random::GetRandomGenerator();
+          for (; !cursor->done(); cursor->Next()) {
+            Sentence w = cursor->value();
+            AddDPNoise<int64>(trainer_spec_, generator, &w.second);
+            RETURN_IF_ERROR(sentences_->Set(cursor->index(), std::move(w)));
+          }
+          return util::OkStatus();
+        }));
+
+    // Remove zero freq elements.
+    const auto before_size = sentences_->size();
+    RETURN_IF_ERROR(sentences_->RemoveIf(
+        [](const Sentence &s) { return s.second <= 0; }));
+    const int num_erased = before_size - sentences_->size();
+
+    LOG(INFO) << "DP noise resulted in " << 1.0 * num_erased / before_size
+              << " fraction of sentences removed.";
+
+    RETURN_IF_ERROR(ParallelForEachSentence(
+        GetThreadPool(), *sentences_,
+        [&](int n, SentenceStore::Cursor *cursor) -> util::Status {
+          for (; !cursor->done(); cursor->Next()) {
+            char_counters[n].Add(cursor->value().first, cursor->value().second);
+          }
+          return util::OkStatus();
+        }));
+  }
 
-    // Replaces rare characters (characters not included in required_chars_)
-    // with kUNKChar.
-    for (auto &w : sentences_)
-    {
-      string_util::UnicodeText uw2;
-      for (const char32 c : string_util::UTF8ToUnicodeText(w.first))
-      {
-        if (port::ContainsKey(required_chars_, c))
-        {
-          uw2.push_back(c);
-        }
-        else
-        {
-          uw2.push_back(kUNKChar);
-        }
-      }
-      w.first = string_util::UnicodeTextToUTF8(uw2);
+  // Merges the character frequencies.
+  for (size_t i = 1; i < char_counters.size(); ++i) {
+    char_counters[0].Merge(char_counters[i]);
+  }
+  const CharCounter &char_counter = char_counters[0];
+  if (char_counter.num_nulls() > 0) {
+    LOG(INFO) << "Found " << char_counter.num_nulls()
+              << " null characters. The corpus must be encoded in utf-8.";
+  }
+  const int64 all_chars_count = char_counter.total();
+  // A map from a character to {is_required_char, character count}.
+  absl::flat_hash_map<char32, std::pair<bool, int64>> chars_count;
+  for (const char32 c :
+       string_util::UTF8ToUnicodeText(trainer_spec_.required_chars())) {
+    CHECK_OR_RETURN(string_util::IsValidCodepoint(c));
+    if (c == 0x0000) {
+      LOG(INFO) << "Found null character. The required_chars field must be "
+                   "encoded in utf-8.";
+      continue;
     }
-
-    if (trainer_spec_.model_type() != TrainerSpec::WORD &&
-        trainer_spec_.model_type() != TrainerSpec::CHAR)
-    {
-      CHECK_LE_OR_RETURN(
-          static_cast<int>(required_chars_.size() + meta_pieces_.size()),
-          trainer_spec_.vocab_size())
-          << "Vocabulary size is smaller than required_chars. "
-          << trainer_spec_.vocab_size() << " vs "
-          << required_chars_.size() + meta_pieces_.size() << ". "
-          << "Increase vocab_size or decrease character_coverage with "
-          << "--character_coverage option.";
+    chars_count[c].first = true;  // is_required_character.
+  }
+  char_counter.AppendTo(&chars_count);
+  LOG(INFO) << "all chars count=" << all_chars_count;
+
+  // Determines required_chars which must be included in the vocabulary.
+  int64 accumulated_chars_count = 0;
+  // Sorted() sorts the chars_count values in the decsending order of pair<>.
+  // I.e. characters are sorted in the order of required characters and then
+  // frequent characters.
+  for (const auto &w : Sorted(chars_count)) {
+    const float coverage = 1.0 * accumulated_chars_count / all_chars_count;
+    if (!trainer_spec_.use_all_vocab() &&
+        coverage >= trainer_spec_.character_coverage()) {
+      LOG(INFO) << "Done: " << 100.0 * coverage << "% characters are covered.";
+      break;
     }
+    accumulated_chars_count += w.second.second;
+    CHECK_NE_OR_RETURN(w.first, 0x0020)
+        << "space must not be included in normalized string.";
+    if (w.first == kUPPBoundaryChar) continue;  // Tab is not included.
+    required_chars_.emplace(w.first, w.second.second);
+  }
 
-    LOG(INFO) << "Done! preprocessed " << sentences_.size() << " sentences.";
+  LOG(INFO) << "Alphabet size=" << required_chars_.size();
+  LOG(INFO) << "Final character coverage="
+            << 1.0 * accumulated_chars_count / all_chars_count;
+
+  CHECK_OR_RETURN(!port::ContainsKey(required_chars_, kUNKChar));
+
+  // Replaces rare characters (characters not included in required_chars_)
+  // with kUNKChar.
+  RETURN_IF_ERROR(ParallelForEachSentence(
+      GetThreadPool(), *sentences_,
+      [&](int n, SentenceStore::Cursor *cursor) -> util::Status {
+        for (; !cursor->done(); cursor->Next()) {
+          const auto &w = cursor->value();
+          string_util::UnicodeText uw2;
+          bool replaced = false;
+          for (const char32 c : string_util::UTF8ToUnicodeText(w.first)) {
+            if (port::ContainsKey(required_chars_, c)) {
+              uw2.push_back(c);
+            } else {
+              uw2.push_back(kUNKChar);
+              replaced = true;
+            }
+          }
+          if (!replaced) continue;
+          RETURN_IF_ERROR(sentences_->Set(
+              cursor->index(),
+              std::make_pair(string_util::UnicodeTextToUTF8(uw2), w.second)));
+        }
+        return util::OkStatus();
+      }));
+
+  RETURN_IF_ERROR(VerifyRequiredChars());
+  // The rewritten sentences may have grown the store.
+  RETURN_IF_ERROR(MaybeSpillSentences());
+
+  LOG(INFO) << "Done! preprocessed " << sentences_->size() << " sentences.";
+  TrainerEvent loaded;
+  loaded.type = TrainerEvent::SENTENCES_LOADED;
+  loaded.num_sentences = sentences_->size();
+  Notify(&loaded);
+
+  if (!cache_file.empty()) {
+    // The cache is only an optimization, so training goes on without it.
+    const auto status = SaveCorpusCache(cache_file, cache_key);
+    if (!status.ok()) {
+      LOG(WARNING) << "Failed to save the normalized corpus cache: "
+                   << status.ToString();
+    }
+  }
 
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::VerifyRequiredChars() const {
+  if (trainer_spec_.model_type() != TrainerSpec::WORD &&
+      trainer_spec_.model_type() != TrainerSpec::CHAR) {
+    CHECK_LE_OR_RETURN(
+        static_cast<int>(required_chars_.size() + meta_pieces_.size()),
+        trainer_spec_.vocab_size())
+        << "Vocabulary size is smaller than required_chars. "
+        << trainer_spec_.vocab_size() << " vs "
+        << required_chars_.size() + meta_pieces_.size() << ". "
+        << "Increase vocab_size or decrease character_coverage with "
+        << "--character_coverage option.";
+  }
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::LoadCorpusCache(absl::string_view filename,
+                                               absl::string_view key,
+                                               bool *found) {
+  *found = false;
+  std::error_code ec;
+  if (!std::filesystem::exists(std::string(filename), ec)) {
     return util::OkStatus();
   }
 
-  void TrainerInterface::SplitSentencesByWhitespace()
+  std::string data;
   {
-    LOG(INFO) << "Tokenizing input sentences with whitespace: "
-              << sentences_.size();
-    absl::flat_hash_map<std::string, int64> tokens;
-    for (const auto &s : sentences_)
-    {
-      for (const auto &w :
-           SplitIntoWords(s.first, trainer_spec_.treat_whitespace_as_suffix(),
-                          trainer_spec_.allow_whitespace_only_pieces()))
-      {
-        tokens[std::string(w)] += s.second;
-      }
-    }
-    sentences_ = Sorted(tokens);
-    LOG(INFO) << "Done! " << sentences_.size();
+    auto input = filesystem::NewReadableFile(filename, true);
+    RETURN_IF_ERROR(input->status());
+    CHECK_OR_RETURN(input->ReadAll(&data));
   }
 
-  util::Status TrainerInterface::Serialize(ModelProto *model_proto) const
-  {
-    RETURN_IF_ERROR(status());
+  absl::string_view in(data), str;
+  uint64 version = 0, size = 0;
+  if (!absl::ConsumePrefix(&in, kCorpusCacheMagic) ||
+      !sentence_record::ConsumeVarint(&in, &version) ||
+      version != kCorpusCacheVersion || !ConsumeCacheString(&in, &str) ||
+      str != key) {
+    LOG(WARNING) << filename << " is not a cache of this corpus. Ignored.";
+    return util::OkStatus();
+  }
 
-    // Duplicated sentencepiece is not allowed.
-    std::set<std::string> dup;
+  std::vector<std::pair<char32, int64>> required_chars;
+  std::vector<std::string> self_test_samples;
 
-    model_proto->Clear();
+#define CHECK_CACHE(condition) \
+  CHECK_OR_RETURN(condition) << "Broken corpus cache: " << filename
 
-#define CHECK_PIECE(piece)                                  \
-  CHECK_OR_RETURN(string_util::IsStructurallyValid(piece)); \
-  CHECK_OR_RETURN(!piece.empty());                          \
-  CHECK_OR_RETURN(dup.insert(piece).second) << piece << " is already defined";
+  CHECK_CACHE(sentence_record::ConsumeVarint(&in, &size));
+  for (uint64 i = 0; i < size; ++i) {
+    uint64 c = 0, freq = 0;
+    CHECK_CACHE(sentence_record::ConsumeVarint(&in, &c) &&
+                sentence_record::ConsumeVarint(&in, &freq));
+    required_chars.emplace_back(static_cast<char32>(c),
+                                static_cast<int64>(freq));
+  }
 
-    size_t fid = 0;
-    for (int id = 0; id < trainer_spec_.vocab_size(); ++id)
-    {
-      const auto it = meta_pieces_.find(id);
-      if (it != meta_pieces_.end())
-      {
-        auto *sp = model_proto->add_pieces();
-        sp->set_piece(it->second.first);
-        sp->set_type(it->second.second);
-        sp->set_score(0.0);
-        CHECK_EQ_OR_RETURN(model_proto->pieces_size() - 1, it->first);
-        CHECK_NE_OR_RETURN(ModelProto::SentencePiece::NORMAL, sp->type());
-        CHECK_PIECE(sp->piece());
-      }
-      else if (fid < final_pieces_.size())
-      {
-        const auto &w = final_pieces_[fid++];
-        auto *sp = model_proto->add_pieces();
-        sp->set_piece(w.first);
-        sp->set_score(w.second);
-        CHECK_PIECE(sp->piece());
-      }
-    }
+  CHECK_CACHE(sentence_record::ConsumeVarint(&in, &size));
+  for (uint64 i = 0; i < size; ++i) {
+    CHECK_CACHE(ConsumeCacheString(&in, &str));
+    self_test_samples.emplace_back(str);
+  }
 
-    CHECK_EQ_OR_RETURN(fid, final_pieces_.size());
+  CHECK_CACHE(sentence_record::ConsumeVarint(&in, &size));
+  for (uint64 i = 0; i < size; ++i) {
+    absl::string_view text;
+    int64 freq = 0;
+    CHECK_CACHE(ConsumeCacheString(&in, &str) &&
+                sentence_record::Decode(str, &text, &freq));
+    RETURN_IF_ERROR(sentences_->Add(std::make_pair(std::string(text), freq)));
+  }
+  CHECK_CACHE(in.empty());
+#undef CHECK_CACHE
+
+  RETURN_IF_ERROR(sentences_->Flush());
+  required_chars_.insert(required_chars.begin(), required_chars.end());
+  self_test_samples_ = std::move(self_test_samples);
+  *found = true;
+
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::SaveCorpusCache(absl::string_view filename,
+                                               absl::string_view key) const {
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(std::string(filename)).parent_path(), ec);
+  CHECK_OR_RETURN(!ec) << ec.message();
+
+  // Writes to a temporary file first so that an interrupted run does not
+  // leave a truncated cache behind.
+  const std::string tmp_filename = absl::StrCat(filename, ".tmp");
+  {
+    auto output = filesystem::NewWritableFile(tmp_filename, true);
+    RETURN_IF_ERROR(output->status());
 
-    *(model_proto->mutable_trainer_spec()) = trainer_spec_;
-    *(model_proto->mutable_normalizer_spec()) = normalizer_spec_;
+    std::string buffer = kCorpusCacheMagic;
+    sentence_record::AppendVarint(kCorpusCacheVersion, &buffer);
+    AppendCacheString(key, &buffer);
 
-    if (!denormalizer_spec_.normalization_rule_tsv().empty())
-    {
-      *(model_proto->mutable_denormalizer_spec()) = denormalizer_spec_;
+    // Sorted() makes the cache deterministic.
+    sentence_record::AppendVarint(required_chars_.size(), &buffer);
+    for (const auto &it : Sorted(required_chars_)) {
+      sentence_record::AppendVarint(it.first, &buffer);
+      sentence_record::AppendVarint(it.second, &buffer);
     }
 
-    if (!trainer_spec_.hard_vocab_limit() ||
-        trainer_spec_.model_type() == TrainerSpec::CHAR)
-    {
-      CHECK_GE_OR_RETURN(trainer_spec_.vocab_size(), model_proto->pieces_size());
-      CHECK_GE_OR_RETURN(trainer_spec_.vocab_size(),
-                         static_cast<int32>(dup.size()));
-      model_proto->mutable_trainer_spec()->set_vocab_size(
-          model_proto->pieces_size());
-    }
-    else
-    {
-      CHECK_EQ_OR_RETURN(trainer_spec_.vocab_size(), model_proto->pieces_size())
-          << absl::StrFormat(
-                 "Vocabulary size too high (%d). Please set it to a value <= %d.",
-                 trainer_spec_.vocab_size(), model_proto->pieces_size());
-      CHECK_EQ_OR_RETURN(trainer_spec_.vocab_size(),
-                         static_cast<int32>(dup.size()));
+    sentence_record::AppendVarint(self_test_samples_.size(), &buffer);
+    for (const auto &sample : self_test_samples_) {
+      AppendCacheString(sample, &buffer);
     }
 
-    // Saves self-testing data.
-    if (!self_test_samples_.empty())
-    {
-      SentencePieceProcessor sp;
-      RETURN_IF_ERROR(sp.Load(*model_proto));
-      for (const auto &input : self_test_samples_)
-      {
-        std::vector<std::string> sps;
-        RETURN_IF_ERROR(sp.Encode(input, &sps));
-        auto *sample = model_proto->mutable_self_test_data()->add_samples();
-        sample->set_input(input);
-        sample->set_expected(absl::StrJoin(sps, " "));
+    sentence_record::AppendVarint(sentences_->size(), &buffer);
+    std::string record;
+    auto cursor = sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      const auto &w = cursor->value();
+      sentence_record::Encode(w.first, w.second, &record);
+      AppendCacheString(record, &buffer);
+      if (buffer.size() >= kCorpusCacheBufferSize) {
+        CHECK_OR_RETURN(output->Write(buffer));
+        buffer.clear();
       }
     }
+    RETURN_IF_ERROR(cursor->status());
+    CHECK_OR_RETURN(output->Write(buffer));
+  }
 
-    return util::OkStatus();
+  std::filesystem::rename(tmp_filename, std::string(filename), ec);
+  CHECK_OR_RETURN(!ec) << ec.message();
+  LOG(INFO) << "Saved the normalized corpus cache: " << filename;
+
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::SaveCheckpoint(
+    int64 round,
+    const std::vector<std::pair<std::string, float>> &pieces) const {
+  const std::string &filename = trainer_spec_.checkpoint_file();
+  if (filename.empty()) return util::OkStatus();
+
+  std::string key;
+  RETURN_IF_ERROR(GetCheckpointKey(trainer_spec_, normalizer_spec_, &key));
+
+  std::string buffer = kCheckpointMagic;
+  sentence_record::AppendVarint(kCheckpointVersion, &buffer);
+  AppendCacheString(key, &buffer);
+  sentence_record::AppendVarint(round, &buffer);
+  sentence_record::AppendVarint(pieces.size(), &buffer);
+  for (const auto &w : pieces) {
+    AppendCacheString(w.first, &buffer);
+    // The bits of the score, so that it is restored exactly.
+    uint32 score = 0;
+    memcpy(&score, &w.second, sizeof(score));
+    sentence_record::AppendVarint(score, &buffer);
   }
 
-  util::Status TrainerInterface::SaveModel(absl::string_view filename) const
+  // Replaces the previous checkpoint only once the new one is complete.
+  const std::string tmp_filename = absl::StrCat(filename, ".tmp");
   {
-    LOG(INFO) << "Saving model: " << filename;
-    ModelProto model_proto;
-
-    RETURN_IF_ERROR(Serialize(&model_proto));
-
-    auto output = filesystem::NewWritableFile(filename.data(), true);
+    auto output = filesystem::NewWritableFile(tmp_filename, true);
     RETURN_IF_ERROR(output->status());
-    output->Write(model_proto.SerializeAsString());
-    return util::OkStatus();
+    CHECK_OR_RETURN(output->Write(buffer));
   }
-
-  util::Status TrainerInterface::SaveVocab(absl::string_view filename) const
+  std::error_code ec;
+  std::filesystem::rename(tmp_filename, filename, ec);
+  CHECK_OR_RETURN(!ec) << ec.message();
+  LOG(INFO) << "Saved the checkpoint of round " << round << ": " << filename;
+
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::LoadCheckpoint(
+    int64 *round, std::vector<std::pair<std::string, float>> *pieces) const {
+  const std::string &filename = trainer_spec_.resume_from();
+  std::string data;
   {
-    LOG(INFO) << "Saving vocabs: " << filename;
-    ModelProto model_proto;
-    RETURN_IF_ERROR(Serialize(&model_proto));
-    auto output = filesystem::NewWritableFile(filename);
-    RETURN_IF_ERROR(output->status());
+    auto input = filesystem::NewReadableFile(filename, true);
+    RETURN_IF_ERROR(input->status());
+    CHECK_OR_RETURN(input->ReadAll(&data));
+  }
 
-    for (const auto &piece : model_proto.pieces())
-    {
-      if (piece.piece().find_first_of(" \t\r\n") != std::string::npos)
-      {
-        LOG(WARNING) << "The piece [" << piece.piece()
-                     << "] contains escaped characters that break the format of "
-                     << filename;
+  std::string key;
+  RETURN_IF_ERROR(GetCheckpointKey(trainer_spec_, normalizer_spec_, &key));
+
+  absl::string_view in(data), str;
+  uint64 version = 0, value = 0, size = 0;
+  CHECK_OR_RETURN(absl::ConsumePrefix(&in, kCheckpointMagic) &&
+                  sentence_record::ConsumeVarint(&in, &version) &&
+                  version == kCheckpointVersion)
+      << filename << " is not a checkpoint.";
+  CHECK_OR_RETURN(ConsumeCacheString(&in, &str) && str == key)
+      << filename << " is a checkpoint of another corpus or other options.";
+
+#define CHECK_CHECKPOINT(condition) \
+  CHECK_OR_RETURN(condition) << "Broken checkpoint: " << filename
+
+  CHECK_CHECKPOINT(sentence_record::ConsumeVarint(&in, &value) &&
+                   sentence_record::ConsumeVarint(&in, &size));
+  *round = value;
+  pieces->clear();
+  for (uint64 i = 0; i < size; ++i) {
+    uint64 bits = 0;
+    CHECK_CHECKPOINT(ConsumeCacheString(&in, &str) &&
+                     sentence_record::ConsumeVarint(&in, &bits));
+    const uint32 score_bits = bits;
+    float score = 0.0;
+    memcpy(&score, &score_bits, sizeof(score));
+    pieces->emplace_back(std::string(str), score);
+  }
+  CHECK_CHECKPOINT(in.empty());
+#undef CHECK_CHECKPOINT
+
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::CountWords(
+    bool treat_ws_as_suffix, bool allow_ws_only_pieces,
+    std::vector<Sentence> *words) const {
+  // Counts the words per thread into maps partitioned by the hash of the
+  // word, so that the partitions are merged in parallel.
+  auto *pool = GetThreadPool();
+  const int num_threads = pool->num_threads();
+  using WordCounts = absl::flat_hash_map<std::string, int64>;
+  std::vector<std::vector<WordCounts>> counts(
+      num_threads, std::vector<WordCounts>(num_threads));
+  RETURN_IF_ERROR(ParallelForEachSentence(
+      pool, *sentences_,
+      [&](int n, SentenceStore::Cursor *cursor) -> util::Status {
+        auto &parts = counts[n];
+        std::vector<absl::string_view> words;
+        for (; !cursor->done(); cursor->Next()) {
+          const auto &s = cursor->value();
+          SplitIntoWords(s.first, treat_ws_as_suffix, allow_ws_only_pieces,
+                         &words);
+          for (const auto &w : words) {
+            auto &part = parts[std::hash<absl::string_view>()(w) % num_threads];
+            part[std::string(w)] += s.second;
+          }
+        }
+        return util::OkStatus();
+      }));
+
+  std::vector<std::vector<Sentence>> parts(num_threads);
+  pool->ParallelForShards(num_threads, [&](int, size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p) {
+      WordCounts &merged = counts[0][p];
+      for (int n = 1; n < num_threads; ++n) {
+        for (const auto &w : counts[n][p]) merged[w.first] += w.second;
+        WordCounts().swap(counts[n][p]);
       }
+      parts[p].assign(merged.begin(), merged.end());
+      WordCounts().swap(merged);
     }
+  });
 
-    if (trainer_spec_.vocabulary_output_piece_score())
-    {
-      for (const auto &piece : model_proto.pieces())
-      {
-        std::ostringstream os;
-        os << piece.piece() << "\t" << piece.score();
-        CHECK_OR_RETURN(output->WriteLine(os.str()));
-      }
+  words->clear();
+  for (auto &part : parts) {
+    words->insert(words->end(), std::make_move_iterator(part.begin()),
+                  std::make_move_iterator(part.end()));
+    std::vector<Sentence>().swap(part);
+  }
+  return util::OkStatus();
+}
+
+void TrainerInterface::PreTokenizeSentences(
+    const pretokenizer::PretokenizerForTrainingInterface &pretokenizer,
+    const std::vector<absl::string_view> &texts,
+    std::vector<std::vector<std::string>> *tokens) const {
+  tokens->resize(texts.size());
+  GetThreadPool()->ParallelFor(
+      texts.size(), kPreTokenizeBatchSize, [&](int, size_t begin, size_t end) {
+        auto results = pretokenizer.PreTokenizeBatch(
+            std::vector<absl::string_view>(texts.begin() + begin,
+                                           texts.begin() + end));
+        CHECK_EQ(results.size(), end - begin);
+        std::move(results.begin(), results.end(), tokens->begin() + begin);
+      });
+}
+
+util::Status TrainerInterface::SplitSentencesByWhitespace() {
+  ScopedPhase phase(this, "split_by_whitespace");
+  LOG(INFO) << "Tokenizing input sentences with whitespace: "
+            << sentences_->size();
+
+  std::vector<Sentence> tokens;
+  RETURN_IF_ERROR(CountWords(trainer_spec_.treat_whitespace_as_suffix(),
+                             trainer_spec_.allow_whitespace_only_pieces(),
+                             &tokens));
+
+  RETURN_IF_ERROR(sentences_->Clear());
+  for (auto &w : Sorted(tokens)) {
+    RETURN_IF_ERROR(sentences_->Add(std::move(w)));
+  }
+  RETURN_IF_ERROR(sentences_->Flush());
+  LOG(INFO) << "Done! " << sentences_->size();
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::Serialize(ModelProto *model_proto) const {
+  RETURN_IF_ERROR(status());
+
+  // Duplicated sentencepiece is not allowed.
+  std::set<std::string> dup;
+
+  model_proto->Clear();
+
+#define CHECK_PIECE(piece)                                  \
+  CHECK_OR_RETURN(string_util::IsStructurallyValid(piece)); \
+  CHECK_OR_RETURN(!piece.empty());                          \
+  CHECK_OR_RETURN(dup.insert(piece).second) << piece << " is already defined";
+
+  size_t fid = 0;
+  for (int id = 0; id < trainer_spec_.vocab_size(); ++id) {
+    const auto it = meta_pieces_.find(id);
+    if (it != meta_pieces_.end()) {
+      auto *sp = model_proto->add_pieces();
+      sp->set_piece(it->second.first);
+      sp->set_type(it->second.second);
+      sp->set_score(0.0);
+      CHECK_EQ_OR_RETURN(model_proto->pieces_size() - 1, it->first);
+      CHECK_NE_OR_RETURN(ModelProto::SentencePiece::NORMAL, sp->type());
+      CHECK_PIECE(sp->piece());
+    } else if (fid < final_pieces_.size()) {
+      const auto &w = final_pieces_[fid++];
+      auto *sp = model_proto->add_pieces();
+      sp->set_piece(w.first);
+      sp->set_score(w.second);
+      CHECK_PIECE(sp->piece());
     }
-    else
-    {
-      for (const auto &piece : model_proto.pieces())
-      {
-        CHECK_OR_RETURN(output->WriteLine(piece.piece()));
+  }
+
+  CHECK_EQ_OR_RETURN(fid, final_pieces_.size());
+
+  *(model_proto->mutable_trainer_spec()) = trainer_spec_;
+  *(model_proto->mutable_normalizer_spec()) = normalizer_spec_;
+
+  if (!denormalizer_spec_.normalization_rule_tsv().empty()) {
+    *(model_proto->mutable_denormalizer_spec()) = denormalizer_spec_;
+  }
+
+  if (!trainer_spec_.hard_vocab_limit() ||
+      trainer_spec_.model_type() == TrainerSpec::CHAR) {
+    CHECK_GE_OR_RETURN(trainer_spec_.vocab_size(), model_proto->pieces_size());
+    CHECK_GE_OR_RETURN(trainer_spec_.vocab_size(),
+                       static_cast<int32>(dup.size()));
+    model_proto->mutable_trainer_spec()->set_vocab_size(
+        model_proto->pieces_size());
+  } else {
+    CHECK_EQ_OR_RETURN(trainer_spec_.vocab_size(), model_proto->pieces_size())
+        << absl::StrFormat(
+               "Vocabulary size too high (%d). Please set it to a value <= %d.",
+               trainer_spec_.vocab_size(), model_proto->pieces_size());
+    CHECK_EQ_OR_RETURN(trainer_spec_.vocab_size(),
+                       static_cast<int32>(dup.size()));
+  }
+
+  // Saves self-testing data.
+  if (!self_test_samples_.empty()) {
+    SentencePieceProcessor sp;
+    RETURN_IF_ERROR(sp.Load(*model_proto));
+    const std::vector<absl::string_view> inputs(self_test_samples_.begin(),
+                                                self_test_samples_.end());
+    BatchEncodeResult result;
+    RETURN_IF_ERROR(sp.EncodeBatch(inputs, trainer_spec_.num_threads(),
+                                   /*with_pieces=*/true,
+                                   /*with_alignment=*/false, &result));
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      auto *sample = model_proto->mutable_self_test_data()->add_samples();
+      sample->set_input(self_test_samples_[i]);
+      std::string *expected = sample->mutable_expected();
+      for (size_t j = result.offsets()[i]; j < result.offsets()[i + 1]; ++j) {
+        if (j > result.offsets()[i]) expected->push_back(' ');
+        const absl::string_view piece = result.piece(j);
+        expected->append(piece.data(), piece.size());
       }
     }
+  }
 
-    return util::OkStatus();
+  if (trainer_spec_.precompile_trie()) {
+    const auto model = ModelFactory::Create(*model_proto);
+    CHECK_OR_RETURN(model);
+    RETURN_IF_ERROR(model->status());
+    model_proto->set_precompiled_trie(model->SerializePrecompiledTrie());
   }
 
-  util::Status TrainerInterface::Save() const
-  {
-    if (output_model_proto_)
-    {
-      RETURN_IF_ERROR(Serialize(output_model_proto_));
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::SaveModel(absl::string_view filename,
+                                         const ModelProto &model_proto) const {
+  LOG(INFO) << "Saving model: " << filename;
+  auto output = filesystem::NewWritableFile(filename.data(), true);
+  RETURN_IF_ERROR(output->status());
+  output->Write(model_proto.SerializeAsString());
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::SaveVocab(absl::string_view filename,
+                                         const ModelProto &model_proto) const {
+  LOG(INFO) << "Saving vocabs: " << filename;
+  auto output = filesystem::NewWritableFile(filename);
+  RETURN_IF_ERROR(output->status());
+
+  // Formats all the lines into one buffer written at once.
+  std::string buffer;
+  const bool with_score = trainer_spec_.vocabulary_output_piece_score();
+  for (const auto &piece : model_proto.pieces()) {
+    if (piece.piece().find_first_of(" \t\r\n") != std::string::npos) {
+      LOG(WARNING) << "The piece [" << piece.piece()
+                   << "] contains escaped characters that break the format of "
+                   << filename;
     }
-    else
-    {
-      RETURN_IF_ERROR(SaveModel(trainer_spec_.model_prefix() + ".model"));
-      RETURN_IF_ERROR(SaveVocab(trainer_spec_.model_prefix() + ".vocab"));
+    buffer.append(piece.piece());
+    if (with_score) {
+      // The same as std::ostream << float.
+      char score[32];
+      const int size =
+          std::snprintf(score, sizeof(score), "%g", piece.score());
+      buffer.push_back('\t');
+      buffer.append(score, size);
     }
-    return util::OkStatus();
+    buffer.push_back('\n');
   }
+  CHECK_OR_RETURN(output->Write(buffer));
+  CHECK_OR_RETURN(output->Flush());
 
-  util::Status TrainerInterface::InitMetaPieces()
-  {
-    CHECK_OR_RETURN(meta_pieces_.empty());
-    bool has_unk = false;
+  return util::OkStatus();
+}
 
-    auto insert_id = [&has_unk, this](int id, const std::string &w) -> bool
-    {
-      if (id < 0)
-        return true;
-      if (id >= trainer_spec_.vocab_size() ||
-          meta_pieces_.find(id) != meta_pieces_.end() ||
-          (has_unk && w == trainer_spec_.unk_piece()))
-        return false;
-      if (w == trainer_spec_.unk_piece())
-        has_unk = true;
-      meta_pieces_[id] = std::make_pair(
-          w, w == trainer_spec_.unk_piece() ? ModelProto::SentencePiece::UNKNOWN
-                                            : ModelProto::SentencePiece::CONTROL);
-      return true;
-    };
-
-    CHECK_OR_RETURN(insert_id(trainer_spec_.unk_id(), trainer_spec_.unk_piece()));
-    CHECK_OR_RETURN(insert_id(trainer_spec_.bos_id(), trainer_spec_.bos_piece()));
-    CHECK_OR_RETURN(insert_id(trainer_spec_.eos_id(), trainer_spec_.eos_piece()));
-    CHECK_OR_RETURN(insert_id(trainer_spec_.pad_id(), trainer_spec_.pad_piece()));
-
-    CHECK_OR_RETURN(has_unk) << trainer_spec_.unk_piece() << " must be defined.";
-
-    std::set<std::string> dup;
-
-    int id = 0;
-    auto insert_meta_symbol =
-        [&id, &dup, this](const std::string &w,
-                          ModelProto::SentencePiece::Type type) -> util::Status
-    {
-      if (!dup.insert(w).second)
-      {
-        return util::InternalError(absl::StrCat(
-            w, " is already defined. duplicated symbols are not allowed."));
-      }
+util::Status TrainerInterface::Save() const {
+  if (output_model_proto_) {
+    RETURN_IF_ERROR(Serialize(output_model_proto_));
+  } else {
+    // Serializes once for both files, since it runs the self-test.
+    ModelProto model_proto;
+    RETURN_IF_ERROR(Serialize(&model_proto));
+    RETURN_IF_ERROR(
+        SaveModel(trainer_spec_.model_prefix() + ".model", model_proto));
+    RETURN_IF_ERROR(
+        SaveVocab(trainer_spec_.model_prefix() + ".vocab", model_proto));
+  }
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::InitMetaPieces() {
+  CHECK_OR_RETURN(meta_pieces_.empty());
+  bool has_unk = false;
+
+  auto insert_id = [&has_unk, this](int id, const std::string &w) -> bool {
+    if (id < 0) return true;
+    if (id >= trainer_spec_.vocab_size() ||
+        meta_pieces_.find(id) != meta_pieces_.end() ||
+        (has_unk && w == trainer_spec_.unk_piece()))
+      return false;
+    if (w == trainer_spec_.unk_piece()) has_unk = true;
+    meta_pieces_[id] = std::make_pair(
+        w, w == trainer_spec_.unk_piece() ? ModelProto::SentencePiece::UNKNOWN
+                                          : ModelProto::SentencePiece::CONTROL);
+    return true;
+  };
 
-      if (w == trainer_spec_.unk_piece())
-      {
-        return util::InternalError(
-            absl::StrCat(trainer_spec_.unk_piece(),
-                         " must not be defined with --control_symbols and "
-                         "--user_defined_symbols."));
-      }
+  CHECK_OR_RETURN(insert_id(trainer_spec_.unk_id(), trainer_spec_.unk_piece()));
+  CHECK_OR_RETURN(insert_id(trainer_spec_.bos_id(), trainer_spec_.bos_piece()));
+  CHECK_OR_RETURN(insert_id(trainer_spec_.eos_id(), trainer_spec_.eos_piece()));
+  CHECK_OR_RETURN(insert_id(trainer_spec_.pad_id(), trainer_spec_.pad_piece()));
 
-      if (w == trainer_spec_.bos_piece() && trainer_spec_.bos_id() >= 0)
-      {
-        meta_pieces_[trainer_spec_.bos_id()].second = type;
-      }
-      else if (w == trainer_spec_.eos_piece() && trainer_spec_.eos_id() >= 0)
-      {
-        meta_pieces_[trainer_spec_.eos_id()].second = type;
-      }
-      else if (w == trainer_spec_.pad_piece() && trainer_spec_.pad_id() >= 0)
-      {
-        meta_pieces_[trainer_spec_.pad_id()].second = type;
-      }
-      else
-      {
-        while (meta_pieces_.find(id) != meta_pieces_.end())
-          ++id;
-        meta_pieces_[id] = std::make_pair(w, type);
-      }
+  CHECK_OR_RETURN(has_unk) << trainer_spec_.unk_piece() << " must be defined.";
 
-      return util::OkStatus();
-    };
+  std::set<std::string> dup;
 
-    for (const auto &w : trainer_spec_.control_symbols())
-    {
-      RETURN_IF_ERROR(insert_meta_symbol(w, ModelProto::SentencePiece::CONTROL));
+  int id = 0;
+  auto insert_meta_symbol =
+      [&id, &dup, this](const std::string &w,
+                        ModelProto::SentencePiece::Type type) -> util::Status {
+    if (!dup.insert(w).second) {
+      return util::InternalError(absl::StrCat(
+          w, " is already defined. duplicated symbols are not allowed."));
     }
 
-    for (const auto &w : trainer_spec_.user_defined_symbols())
-    {
-      RETURN_IF_ERROR(
-          insert_meta_symbol(w, ModelProto::SentencePiece::USER_DEFINED));
+    if (w == trainer_spec_.unk_piece()) {
+      return util::InternalError(
+          absl::StrCat(trainer_spec_.unk_piece(),
+                       " must not be defined with --control_symbols and "
+                       "--user_defined_symbols."));
     }
 
-    if (trainer_spec_.byte_fallback())
-    {
-      for (int i = 0; i < 256; ++i)
-      {
-        RETURN_IF_ERROR(
-            insert_meta_symbol(ByteToPiece(i), ModelProto::SentencePiece::BYTE));
-      }
+    if (w == trainer_spec_.bos_piece() && trainer_spec_.bos_id() >= 0) {
+      meta_pieces_[trainer_spec_.bos_id()].second = type;
+    } else if (w == trainer_spec_.eos_piece() && trainer_spec_.eos_id() >= 0) {
+      meta_pieces_[trainer_spec_.eos_id()].second = type;
+    } else if (w == trainer_spec_.pad_piece() && trainer_spec_.pad_id() >= 0) {
+      meta_pieces_[trainer_spec_.pad_id()].second = type;
+    } else {
+      while (meta_pieces_.find(id) != meta_pieces_.end()) ++id;
+      meta_pieces_[id] = std::make_pair(w, type);
     }
 
     return util::OkStatus();
+  };
+
+  for (const auto &w : trainer_spec_.control_symbols()) {
+    RETURN_IF_ERROR(insert_meta_symbol(w, ModelProto::SentencePiece::CONTROL));
+  }
+
+  for (const auto &w : trainer_spec_.user_defined_symbols()) {
+    RETURN_IF_ERROR(
+        insert_meta_symbol(w, ModelProto::SentencePiece::USER_DEFINED));
   }
 
-} // namespace sentencepiece
+  if (trainer_spec_.byte_fallback()) {
+    for (int i = 0; i < 256; ++i) {
+      RETURN_IF_ERROR(
+          insert_meta_symbol(ByteToPiece(i), ModelProto::SentencePiece::BYTE));
+    }
+  }
+
+  return util::OkStatus();
+}
+
+}  // namespace sentencepiece
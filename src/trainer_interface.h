@@ -12,301 +12,439 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
-// /*
-// spm_train-- input = sample.txt-- model_prefix = wm-- vocab_size = 32000 --character_coverage = 1.0 --model_type = unigram-- max_sentence_length = 4096 --train_extremely_large_corpus = true
-// */
-
 #ifndef TRAINER_INTERFACE_H_
 #define TRAINER_INTERFACE_H_
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
+
 #include "common.h"
 #include "filesystem.h"
+#include "sentence_store.h"
 #include "sentencepiece_model.pb.h"
 #include "sentencepiece_processor.h"
 #include "sentencepiece_trainer.h"
 #include "third_party/absl/container/flat_hash_map.h"
 #include "util.h"
-#include "leveldb/db.h"
-#include "leveldb/write_batch.h"
-#include <sstream>
-#include <iostream>
-#include <stdexcept>
-#include <unicode/uscript.h> // Assuming you have this header for script handling
-#include "trainer_spec.h"   // Assuming you have this header for TrainerSpec
-#include "normalizer_spec.h"
-
-namespace sentencepiece
-{
-
-  template <typename K, typename V>
-  std::vector<std::pair<K, V>> Sorted(const std::vector<std::pair<K V>> &m)
-  {
-    std::vector<std::pair<K, V>> v = m;
-    std::sort(v.begin(), v.end(),
-              [](const std::pair<K, V> &p1, const std::pair<K, V> &p2)
-              {
-                return (p1.second > p2.second ||
-                        (p1.second == p2.second && p1.first < p2.first));
-              });
-    return v;
+
+namespace sentencepiece {
+
+template <typename K, typename V>
+std::vector<std::pair<K, V>> Sorted(const std::vector<std::pair<K, V>> &m) {
+  std::vector<std::pair<K, V>> v = m;
+  std::sort(v.begin(), v.end(),
+            [](const std::pair<K, V> &p1, const std::pair<K, V> &p2) {
+              return (p1.second > p2.second ||
+                      (p1.second == p2.second && p1.first < p2.first));
+            });
+  return v;
+}
+
+template <typename K, typename V>
+std::vector<std::pair<K, V>> Sorted(const absl::flat_hash_map<K, V> &m) {
+  std::vector<std::pair<K, V>> v(m.begin(), m.end());
+  return Sorted(v);
+}
+
+class MultiFileSentenceIterator : public SentenceIterator {
+ public:
+  explicit MultiFileSentenceIterator(const std::vector<std::string> &files);
+  ~MultiFileSentenceIterator() {}
+
+  bool done() const override;
+  void Next() override;
+  const std::string &value() const override { return value_; }
+  util::Status status() const override;
+
+ private:
+  void TryRead();
+
+  bool read_done_ = false;
+  size_t file_index_ = 0;
+  std::vector<std::string> files_;
+  std::string value_;
+  std::unique_ptr<filesystem::ReadableFile> fp_;
+};
+
+// Reads the same lines as MultiFileSentenceIterator with multiple threads.
+// Every file is split into byte ranges of about `chunk_size` which are read
+// concurrently. A line belongs to the range containing its first byte, so
+// the ranges do not need to be aligned to newlines in advance. At most
+// 2 * `num_threads` ranges are buffered, and they are returned strictly in
+// the file order, so the output does not depend on the scheduling.
+class ParallelMultiFileSentenceIterator : public SentenceIterator {
+ public:
+  static constexpr int64 kDefaultChunkSize = 16 << 20;
+
+  ParallelMultiFileSentenceIterator(const std::vector<std::string> &files,
+                                    int num_threads,
+                                    int64 chunk_size = kDefaultChunkSize);
+  ~ParallelMultiFileSentenceIterator();
+
+  bool done() const override { return done_; }
+  void Next() override;
+  const std::string &value() const override { return lines_[line_index_]; }
+  util::Status status() const override { return status_; }
+
+ private:
+  // Byte range [begin, end) of `filename`. `end` < 0 reads until EOF.
+  struct Chunk {
+    std::string filename;
+    int64 begin = 0;
+    int64 end = -1;
+  };
+
+  struct ChunkResult {
+    std::vector<std::string> lines;
+    util::Status status;
+    bool ready = false;
+  };
+
+  // Schedules the chunks until the window is full.
+  void ScheduleChunks();
+
+  // Moves to the first line of the next non-empty chunk.
+  void Refill();
+
+  static void ReadChunk(const Chunk &chunk, ChunkResult *result);
+
+  std::vector<Chunk> chunks_;
+  size_t next_chunk_ = 0;
+  size_t window_size_ = 0;
+  std::deque<std::unique_ptr<ChunkResult>> window_;
+  std::vector<std::string> lines_;
+  size_t line_index_ = 0;
+  bool done_ = false;
+  util::Status status_;
+  // Error found while splitting the files. Reported after the lines of the
+  // files before it, like MultiFileSentenceIterator.
+  util::Status split_status_;
+  std::mutex mutex_;
+  std::condition_variable chunk_ready_;
+  // Declared last, so the pending reads finish before the buffers go away.
+  std::unique_ptr<ThreadPool> pool_;
+};
+
+// Resources used by a phase of the training, e.g., an EM sub-iteration.
+struct TrainerPhase {
+  std::string name;
+  double wall_time = 0.0;  // Seconds.
+  double cpu_time = 0.0;   // Seconds of all the threads of the process.
+  int64 peak_rss = 0;      // Peak resident set size of the process in bytes
+                           // at the end of the phase, or 0 if unknown.
+  int64 memory_bytes = 0;  // GetMemoryUsage().total() at the end of the phase.
+};
+
+// The sentences and the statistics loaded by a trainer, which the
+// trainers of the other models of the same corpus take instead of loading
+// it again. See SentencePieceTrainer::TrainModels().
+struct LoadedCorpus {
+  std::string key;  // GetCorpusCacheKey() of the loading trainer.
+  std::shared_ptr<const SentenceStore> sentences;
+  absl::flat_hash_map<char32, int64> required_chars;
+  std::vector<std::string> self_test_samples;
+};
+
+// Base trainer class
+class TrainerInterface {
+ public:
+  using Sentence = SentenceStore::Sentence;
+
+  static const char32 kWSChar;
+  static const char32 kUNKChar;
+  static const char32 kUPPBoundaryChar;
+  static const char kWSStr[];
+  static const char kUNKStr[];
+  static const char kUPPBoundaryStr[];
+
+  // Number of sentences claimed at once by a worker in the parallel
+  // loops over `sentences_`.
+  static constexpr size_t kSentenceGrainSize = 64;
+
+  // Number of sentences passed to one PreTokenizeBatch() call of the
+  // pre-tokenizer, and number of sentences read at once to be
+  // pre-tokenized in parallel.
+  static constexpr size_t kPreTokenizeBatchSize = 64;
+  static constexpr size_t kPreTokenizeWindowSize = 1 << 14;
+
+  // Number of the lines loaded between two measures of the sentences
+  // against max_memory_mb.
+  static constexpr int64 kMemoryCheckInterval = 1 << 16;
+
+  TrainerInterface(const TrainerSpec &trainer_spec,
+                   const NormalizerSpec &normalizer_spec,
+                   const NormalizerSpec &denormalizer_spec);
+
+  virtual ~TrainerInterface();
+
+  // Loads sentence from `sentence_iterator` and stores the model
+  // to `output_model_proto`.
+  virtual util::Status Train(SentenceIterator *sentence_iterator,
+                             ModelProto *output_model_proto) {
+    sentence_iterator_ = sentence_iterator;
+    output_model_proto_ = output_model_proto;
+    return Train();
   }
 
-  template <typename K, typename V>
-  std::vector<std::pair<K, V>> Sorted(const absl::flat_hash_map<K, V> &m)
-  {
-    std::vector<std::pair<K, V>> v(m.begin(), m.end());
-    return Sorted(v);
+  virtual util::Status Train() { return status(); }
+
+  virtual util::Status status() const { return status_; }
+
+  FRIEND_TEST(TrainerInterfaceTest, IsValidSentencePieceTest);
+  FRIEND_TEST(TrainerInterfaceTest, PieceSummaryTest);
+  FRIEND_TEST(TrainerInterfaceTest, OverrideSpecialPiecesTest);
+  FRIEND_TEST(TrainerInterfaceTest, BytePiecesTest);
+  FRIEND_TEST(TrainerInterfaceTest, SerializeTest);
+  FRIEND_TEST(TrainerInterfaceTest, CharactersTest);
+  FRIEND_TEST(TrainerInterfaceTest, NormalizedCorpusCacheTest);
+  FRIEND_TEST(TrainerInterfaceTest, DedupInputSentencesTest);
+  FRIEND_TEST(TrainerInterfaceTest, SampleInputSentenceTest);
+
+  // Loads all sentences from spec.input() or SentenceIterator.
+  // It loads at most input_sentence_size sentences.
+  util::Status LoadSentences();
+
+  // Loads the sentences from `sentence_iterator` or spec.input() into
+  // `corpus` to be shared with the trainers of the other models of the
+  // corpus. The training of this trainer then takes `corpus` too.
+  util::Status LoadCorpus(SentenceIterator *sentence_iterator,
+                          std::shared_ptr<const LoadedCorpus> *corpus);
+
+  // Makes LoadSentences() take the sentences of `corpus` instead of
+  // loading them. They are read from `corpus`, and only copied when the
+  // trainer rewrites them. LoadSentences() fails when `corpus` was loaded
+  // with other options.
+  void SetLoadedCorpus(std::shared_ptr<const LoadedCorpus> corpus) {
+    loaded_corpus_ = std::move(corpus);
   }
 
-  class MultiFileSentenceIterator : public SentenceIterator
-  {
-  public:
-    explicit MultiFileSentenceIterator(const std::vector<std::string> &files);
-    ~MultiFileSentenceIterator() {}
-
-    bool done() const override;
-    void Next() override;
-    const std::string &value() const override { return value_; }
-    util::Status status() const override;
-
-  private:
-    void TryRead();
-
-    bool read_done_ = false;
-    size_t file_index_ = 0;
-    std::vector<std::string> files_;
-    std::string value_;
-    std::unique_ptr<filesystem::ReadableFile> fp_;
+  // Phases of the training so far, in the order they ended.
+  const std::vector<TrainerPhase> &phases() const { return phases_; }
+
+  // Returns the memory held by the trainer now, e.g., the sentences and the
+  // structures of the running phase.
+  MemoryUsage GetMemoryUsage() const;
+
+  // Returns the largest bytes of every component measured so far. The
+  // components are measured at the end of every phase and where the
+  // trainers hold their largest structures, e.g., the suffix array.
+  const MemoryUsage &peak_memory_usage() const { return peak_memory_usage_; }
+
+ protected:
+  // Records the resources used from its construction until End() or its
+  // destruction as the phase `name` of `trainer`, and notifies the
+  // observer of its beginning and end.
+  class ScopedPhase {
+   public:
+    ScopedPhase(TrainerInterface *trainer, absl::string_view name);
+    ~ScopedPhase() { End(); }
+
+    void End();
+
+   private:
+    TrainerInterface *trainer_;
+    TrainerPhase phase_;  // Holds the start times until End().
   };
 
-  // Base trainer class
-  class TrainerInterface
-  {
-  public:
-    using Sentence = std::pair<std::string, int64_t>;
-    using Sentences = leveldb::DB *;
-
-    static const char32_t kWSChar;
-    static const char32_t kUNKChar;
-    static const char32_t kUPPBoundaryChar;
-    static const char kWSStr[];
-    static const char kUNKStr[];
-    static const char kUPPBoundaryStr[];
-
-    TrainerInterface(const TrainerSpec &trainer_spec,
-                     const NormalizerSpec &normalizer_spec,
-                     const NormalizerSpec &denormalizer_spec)
-        : trainer_spec_(trainer_spec),
-          normalizer_spec_(normalizer_spec),
-          denormalizer_spec_(denormalizer_spec)
-    {
-      status_ = VerifySpec(trainer_spec_);
-      if (status_.ok())
-        status_ = InitMetaPieces();
-
-      leveldb::Options options;
-      options.create_if_missing = true;
-      leveldb::Status status = leveldb::DB::Open(options, "sentences_db", &sentences_db_);
-      if (!status.ok())
-      {
-        throw std::runtime_error("Failed to open LevelDB: " + status.ToString());
-      }
-    }
-
-    virtual ~TrainerInterface()
-    {
-      delete sentences_db_;
-    }
-
-    bool IsValidSentencePiece(const string_util::UnicodeText &sentencepiece) const
-    {
-      // Returns false if the length of piece is invalid.
-      if (sentencepiece.empty() ||
-          sentencepiece.size() > static_cast<size_t>(trainer_spec_.max_sentencepiece_length()))
-      {
-        return false;
-      }
-
-      constexpr unicode_script::ScriptType kAnyType = static_cast<unicode_script::ScriptType>(-1);
-      unicode_script::ScriptType prev_script = kAnyType;
-      bool all_whitespace_piece = std::all_of(sentencepiece.begin(), sentencepiece.end(),
-                                              [](char32_t c)
-                                              { return c == kWSChar; });
-
-      for (size_t pos = 0; pos < sentencepiece.size(); ++pos)
-      {
-        const char32_t c = sentencepiece[pos];
-        if (c == kUNKChar)
-        { // UNK must not be included
-          return false;
-        }
-        if (c == 0x0000)
-        { // NULL is not allowed for Darts (TRIE).
-          return false;
-        }
-        if (c == kUPPBoundaryChar)
-        {
-          return false;
-        }
-        if (c == 0x0020)
-        {
-          std::cerr << "space must not be included in normalized string." << std::endl;
-          return false;
-        }
-        if (!string_util::IsValidCodepoint(c))
-        {
-          return false;
-        }
-
-        if (c == kWSChar)
-        {
-          // Only allows whitespace to appear as a prefix of piece unless
-          // allow_whitespace_only_pieces is True.
-          // When split_by_whitespace is false, we allow whitespaces to
-          // appear in the middle, "foo_bar", but do not allow them
-          // to appear as suffix, "foo_bar_".
-          // Regardless of the setting of split_by_whitespace,
-          // whitespace is treated as a prefix/infix of symbol or
-          // independent symbol, unless allow_whitespace_only_pieces() is true,
-          // in which case whitespace only pieces can occur.
-          if (!trainer_spec_.allow_whitespace_only_pieces() || !all_whitespace_piece)
-          {
-            if (trainer_spec_.treat_whitespace_as_suffix())
-            {
-              if ((trainer_spec_.split_by_whitespace() && pos < sentencepiece.size() - 1) ||
-                  (!trainer_spec_.split_by_whitespace() && pos < sentencepiece.size() - 1 && pos == 0))
-              {
-                return false;
-              }
-            }
-            else
-            {
-              if ((trainer_spec_.split_by_whitespace() && pos > 0) ||
-                  (!trainer_spec_.split_by_whitespace() && pos > 0 && pos == sentencepiece.size() - 1))
-              {
-                return false;
-              }
-            }
-          }
-        }
-        else
-        {
-          auto s = unicode_script::GetScript(c);
-
-          // Merge Hiragana/Katakana into Han.
-          if (s == unicode_script::U_Hiragana || s == unicode_script::U_Katakana || c == 0x30FC)
-          { // long vowel sound (Katakana) should be Katakana
-            s = unicode_script::U_Han;
-          }
-          else if (s == unicode_script::U_Inherited)
-          {
-            s = prev_script;
-          }
-
-          if (!trainer_spec_.split_by_number() && is_unicode_decimal_number(c))
-          {
-            s = kAnyType;
-          }
-
-          if (trainer_spec_.split_digits() && is_unicode_decimal_number(c))
-          {
-            if (sentencepiece.size() > 1)
-              return false;
-          }
-
-          // Do not allow a piece to include multiple Unicode scripts
-          // when split_by_unicode_script() is true (default = true).
-          if (trainer_spec_.split_by_unicode_script() && s != kAnyType &&
-              prev_script != kAnyType && prev_script != s)
-          {
-            return false;
-          }
-
-          prev_script = s;
-        }
-      }
-      return true;
-    }
-
-    // Serializes a Sentence into a string
-    std::string serializeSentence(const Sentence &sentence) const
-    {
-      std::ostringstream oss;
-      size_t strSize = sentence.first.size();
-      oss.write(reinterpret_cast<const char *>(&strSize), sizeof(strSize));
-      oss.write(sentence.first.data(), strSize);
-      oss.write(reinterpret_cast<const char *>(&sentence.second), sizeof(sentence.second));
-      return oss.str();
-    }
-
-    // Deserializes a string into a Sentence
-    Sentence deserializeSentence(const std::string &data) const
-    {
-      std::istringstream iss(data);
-      size_t strSize;
-      iss.read(reinterpret_cast<char *>(&strSize), sizeof(strSize));
-      std::string str(strSize, '\0');
-      iss.read(&str[0], strSize);
-      int64_t number;
-      iss.read(reinterpret_cast<char *>(&number), sizeof(number));
-      return {str, number};
-    }
-
-    // Add a sentence to the LevelDB
-    void addSentenceToDB(const Sentence &sentence, const std::string &key)
-    {
-      std::string serializedSentence = serializeSentence(sentence);
-      leveldb::Status status = sentences_db_->Put(leveldb::WriteOptions(), key, serializedSentence);
-      if (!status.ok())
-      {
-        throw std::runtime_error("Failed to write to LevelDB: " + status.ToString());
-      }
-    }
-
-    // Retrieve a sentence from the LevelDB
-    Sentence getSentenceFromDB(const std::string &key)
-    {
-      std::string value;
-      leveldb::Status status = sentences_db_->Get(leveldb::ReadOptions(), key, &value);
-      if (!status.ok())
-      {
-        throw std::runtime_error("Failed to read from LevelDB: " + status.ToString());
-      }
-      return deserializeSentence(value);
-    }
-
-    // Update a sentence in the LevelDB
-    void updateSentenceInDB(const std::string &key, const Sentence &newSentence)
-    {
-      addSentenceToDB(newSentence, key); // Since LevelDB Put will overwrite existing entry
-    }
-
-    // Delete a sentence from the LevelDB
-    void deleteSentenceFromDB(const std::string &key)
-    {
-      leveldb::Status status = sentences_db_->Delete(leveldb::WriteOptions(), key);
-      if (!status.ok())
-      {
-        throw std::runtime_error("Failed to delete from LevelDB: " + status.ToString());
-      }
-    }
-
-  protected:
-    // Other existing methods...
-
-  private:
-    leveldb::DB *sentences_db_; // LevelDB database for storing sentences
-    TrainerSpec trainer_spec_;
-    NormalizerSpec normalizer_spec_;
-    NormalizerSpec denormalizer_spec_;
-    util::Status status_;
+  // Completes the common fields of `event` and passes it to the observer
+  // set when the trainer was created, if any.
+  void Notify(TrainerEvent *event) const;
+
+  // Adds the memory held by the trainer to `usage`. Trainers add their own
+  // structures to the ones of the base class.
+  virtual void AddMemoryUsage(MemoryUsage *usage) const;
+
+  // Raises `peak_memory_usage_` to GetMemoryUsage(), or to `usage`.
+  void RecordMemoryUsage() const;
+  void RecordMemoryUsage(const MemoryUsage &usage) const;
+
+  // Returns trainer_spec.max_memory_mb() in bytes, or 0 if unlimited.
+  int64 memory_budget() const {
+    return static_cast<int64>(trainer_spec_.max_memory_mb()) << 20;
+  }
+
+  // Logs `decision`, taken to stay within max_memory_mb and explained by
+  // `detail`, and reports it to the observer.
+  void NotifyMemoryDecision(absl::string_view decision,
+                            absl::string_view detail) const;
+
+  // Moves the sentences to a "log" store when they are in the default
+  // in-memory store and take more than half of max_memory_mb. Does nothing
+  // if sentence_store is set.
+  util::Status MaybeSpillSentences();
+
+  // Returns true if |sentence| is valid sentence.
+  virtual bool IsValidSentencePiece(
+      const string_util::UnicodeText &sentence) const;
+
+  // The properties of a piece which IsValidSentencePiece() depends on.
+  // The summary of a concatenation is merged from the summaries of its
+  // parts, so that the trainers building pieces from smaller ones, e.g.,
+  // BPE, check a new piece without scanning its characters.
+  struct PieceSummary {
+    uint32 size;                  // number of characters.
+    bool invalid_char;            // has a character never allowed in pieces.
+    bool valid_scripts;           // the scripts respect split_by_*.
+    bool has_digit;               // has a decimal number.
+    bool all_whitespace;          // consists of kWSChar only.
+    bool has_whitespace;          // has kWSChar.
+    bool first_whitespace;        // starts with kWSChar.
+    bool last_whitespace;         // ends with kWSChar.
+    bool whitespace_after_first;  // has kWSChar after the first character.
+    bool whitespace_before_last;  // has kWSChar before the last character.
+    int32 first_script;           // script of the first and the last
+    int32 last_script;            // characters having one, or kNoScript.
   };
 
-} // namespace sentencepiece
-#endif // TRAINER_INTERFACE_H_
+  // Script of a summary without scripted characters, and the script of
+  // the characters mixable with any script, i.e., the numbers unless
+  // split_by_number.
+  static constexpr int32 kNoScript = -2;
+  static constexpr int32 kAnyScript = -1;
+
+  // Returns the summary of the piece consisting of `c`.
+  PieceSummary GetCharSummary(char32 c) const;
+
+  // Returns the summary of the concatenation of `left` and `right`.
+  static PieceSummary MergePieceSummaries(const PieceSummary &left,
+                                          const PieceSummary &right);
+
+  // Returns IsValidSentencePiece() of the piece summarized by `summary`.
+  bool IsValidPieceSummary(const PieceSummary &summary) const;
+
+  // Splits all sentencecs by whitespaces and
+  // replace the |sentences_| with tokenized string.
+  // e.g.,
+  //  [ ["hello world ", 1], ["hi world]" ] =>
+  //  [ ["hello", 1], ["hi", 1], ["world", 2] ]
+  util::Status SplitSentencesByWhitespace();
+
+  // Sets `tokens` to PreTokenize() of every text in `texts`, calling
+  // PreTokenizeBatch() over batches of kPreTokenizeBatchSize in parallel.
+  void PreTokenizeSentences(
+      const pretokenizer::PretokenizerForTrainingInterface &pretokenizer,
+      const std::vector<absl::string_view> &texts,
+      std::vector<std::vector<std::string>> *tokens) const;
+
+  // Sets `words` to the words of all the sentences split by
+  // SplitIntoWords() with their total frequencies, in no particular order.
+  // The sentences are counted in parallel.
+  util::Status CountWords(bool treat_ws_as_suffix, bool allow_ws_only_pieces,
+                          std::vector<Sentence> *words) const;
+
+  // Save model files into spec.model_prefix().
+  util::Status Save() const;
+
+  // Writes the state of the training after `round` rounds with the current
+  // `pieces` to trainer_spec.checkpoint_file(), if specified.
+  util::Status SaveCheckpoint(
+      int64 round,
+      const std::vector<std::pair<std::string, float>> &pieces) const;
+
+  // Reads the state of trainer_spec.resume_from(). Fails if it was written
+  // for another corpus or with other options.
+  util::Status LoadCheckpoint(
+      int64 *round, std::vector<std::pair<std::string, float>> *pieces) const;
+
+  // Returns the thread pool shared by all the parallel phases of
+  // training, e.g., normalization and EM sub-iterations. The workers
+  // are created on the first call and reused afterwards.
+  ThreadPool *GetThreadPool() const;
+
+  // Set of characters which must be included in the final vocab.
+  // The value of this map stores the frequency.
+  absl::flat_hash_map<char32, int64> required_chars_;
+
+  // Final output pieces
+  std::vector<std::pair<std::string, float>> final_pieces_;
+
+  // All sentences.
+  std::unique_ptr<SentenceStore> sentences_;
+
+  // True once MaybeSpillSentences() moved `sentences_` to a log store.
+  bool sentences_spilled_ = false;
+
+  // Trainer spec.
+  TrainerSpec trainer_spec_;
+
+  // Normalizer spec
+  NormalizerSpec normalizer_spec_;
+
+  // Denormalizer spec
+  NormalizerSpec denormalizer_spec_;
+
+  // Reserved control pieces. e.g., <unk>, <s>, </s>.
+  // key is vocab id.
+  std::map<int, std::pair<std::string, ModelProto::SentencePiece::Type>>
+      meta_pieces_;
+
+  // Detect errors on initialization.
+  util::Status status_;
+
+  // Loads sentences from SentenceIterator if not null.
+  SentenceIterator *sentence_iterator_ = nullptr;
+
+  // Emits model to this proto instead of file.
+  ModelProto *output_model_proto_ = nullptr;
+
+ private:
+  // Serialize final_pieces_ to |model_proto|.
+  util::Status Serialize(ModelProto *model_proto) const;
+
+  // Saves `model_proto` to the model file.
+  util::Status SaveModel(absl::string_view filename,
+                         const ModelProto &model_proto) const;
+
+  // Saves the vocabulary of `model_proto` to the vocabulary file for NMT.
+  util::Status SaveVocab(absl::string_view filename,
+                         const ModelProto &model_proto) const;
+
+  // Initializes `meta_pieces_` from TrainerSpec.
+  util::Status InitMetaPieces();
+
+  // Restores the sentences, `required_chars_` and `self_test_samples_`
+  // from the normalized corpus cache at `filename`. Sets `found` to false
+  // when there is no cache for `key`.
+  util::Status LoadCorpusCache(absl::string_view filename,
+                               absl::string_view key, bool *found);
+
+  // Stores the loaded sentences to the normalized corpus cache.
+  util::Status SaveCorpusCache(absl::string_view filename,
+                               absl::string_view key) const;
+
+  // Takes the sentences of `loaded_corpus_`.
+  util::Status TakeLoadedCorpus();
+
+  // Returns an error if the vocabulary cannot hold `required_chars_`.
+  util::Status VerifyRequiredChars() const;
+
+  // Randomly sampled raw sentences for self-testing.
+  std::vector<std::string> self_test_samples_;
+
+  // The corpus taken by LoadSentences(), and true while LoadCorpus()
+  // loads it without a model to output.
+  std::shared_ptr<const LoadedCorpus> loaded_corpus_;
+  bool loading_corpus_ = false;
+
+  // The largest number of the sentences held at once by the sampling of
+  // shuffle_input_sentence in LoadSentences().
+  size_t peak_sampled_sentences_ = 0;
+
+  std::vector<TrainerPhase> phases_;
+  mutable MemoryUsage peak_memory_usage_;
+
+  TrainerObserver *observer_ = nullptr;
+  std::string current_phase_;
+  double start_time_ = 0.0;  // Wall time when the trainer was created.
+
+  mutable std::unique_ptr<ThreadPool> pool_;
+};
+}  // namespace sentencepiece
+#endif  // TRAINER_INTERFACE_H_
@@ -14,6 +14,8 @@
 
 #include "trainer_interface.h"
 
+#include <filesystem>
+#include <set>
 #include <utility>
 
 #include "filesystem.h"
@@ -199,6 +201,55 @@ TEST(TrainerInterfaceTest, IsValidSentencePieceTest) {
   EXPECT_FALSE(IsValid("２＊"));
 }
 
+TEST(TrainerInterfaceTest, PieceSummaryTest) {
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  const std::vector<char32> chars = {'a',    0x3B1,  '1',    '$',
+                                     0x2581, 0x30A2, 0x6F22, 0x30FC,
+                                     0x0308, '\t',   0x0000};
+
+  // All the pieces of up to 3 characters.
+  std::vector<string_util::UnicodeText> pieces;
+  for (const char32 c1 : chars) {
+    pieces.push_back({c1});
+    for (const char32 c2 : chars) {
+      pieces.push_back({c1, c2});
+      for (const char32 c3 : chars) pieces.push_back({c1, c2, c3});
+    }
+  }
+
+  for (int flags = 0; flags < 128; ++flags) {
+    TrainerSpec trainer_spec;
+    trainer_spec.set_split_by_whitespace(flags & 1);
+    trainer_spec.set_treat_whitespace_as_suffix(flags & 2);
+    trainer_spec.set_allow_whitespace_only_pieces(flags & 4);
+    trainer_spec.set_split_by_unicode_script(flags & 8);
+    trainer_spec.set_split_by_number(flags & 16);
+    trainer_spec.set_split_digits(flags & 32);
+    trainer_spec.set_max_sentencepiece_length(flags & 64 ? 2 : 16);
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+
+    for (const auto &piece : pieces) {
+      const bool expected = trainer.IsValidSentencePiece(piece);
+
+      // Merges from the left and from the right.
+      auto left = trainer.GetCharSummary(piece[0]);
+      for (size_t i = 1; i < piece.size(); ++i) {
+        left = TrainerInterface::MergePieceSummaries(
+            left, trainer.GetCharSummary(piece[i]));
+      }
+      auto right = trainer.GetCharSummary(piece.back());
+      for (int i = static_cast<int>(piece.size()) - 2; i >= 0; --i) {
+        right = TrainerInterface::MergePieceSummaries(
+            trainer.GetCharSummary(piece[i]), right);
+      }
+      EXPECT_EQ(expected, trainer.IsValidPieceSummary(left));
+      EXPECT_EQ(expected, trainer.IsValidPieceSummary(right));
+      EXPECT_EQ(piece.size(), left.size);
+    }
+  }
+}
+
 TEST(TrainerInterfaceTest, OverrideSpecialPiecesTest) {
   TrainerSpec base_trainer_spec;
   NormalizerSpec normalizer_spec;
@@ -489,6 +540,24 @@ TEST(TrainerInterfaceTest, SerializeTest) {
       EXPECT_EQ(final_pieces[i - 3].second, model_proto.pieces(i).score());
     }
   }
+
+  {
+    // The vocab file with the scores formatted as std::ostream does.
+    trainer_spec.set_model_prefix(
+        util::JoinPath(::testing::TempDir(), "serialize_vocab"));
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    trainer.final_pieces_ = final_pieces;
+    ASSERT_TRUE(trainer.Save().ok());
+    auto input = filesystem::NewReadableFile(trainer_spec.model_prefix() +
+                                             ".vocab");
+    ASSERT_TRUE(input->status().ok());
+    std::vector<std::string> lines;
+    std::string line;
+    while (input->ReadLine(&line)) lines.push_back(line);
+    EXPECT_EQ(std::vector<std::string>({"<unk>\t0", "<s>\t0", "</s>\t0",
+                                        "a\t0.1", "b\t0.2", "c\t0.3"}),
+              lines);
+  }
 }
 
 TEST(TrainerInterfaceTest, CharactersTest) {
@@ -553,6 +622,187 @@ TEST(TrainerInterfaceTest, CharactersTest) {
         trainer.required_chars_,
         E({{ToChar32("a"), 50}, {ToChar32("あ"), 49}, {ToChar32("b"), 1}}));
   }
+  {
+    // Characters out of the BMP are counted as well.
+    {
+      auto output = filesystem::NewWritableFile(input_file);
+      std::string line(50, 'a');
+      for (int i = 0; i < 49; ++i) line += "🍣";
+      output->WriteLine(line + "b");
+    }
+    trainer_spec.clear_required_chars();
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    EXPECT_EQ(trainer.required_chars_,
+              E({{ToChar32("a"), 50}, {ToChar32("🍣"), 49}}));
+  }
+}
+
+TEST(TrainerInterfaceTest, NormalizedCorpusCacheTest) {
+  const std::string input_file =
+      util::JoinPath(::testing::TempDir(), "cache_input");
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    output->WriteLine("Hello World");
+    output->WriteLine("abc");
+    output->WriteLine("Hello World");
+  }
+  const std::string cache_dir =
+      util::JoinPath(::testing::TempDir(), "corpus_cache");
+  std::filesystem::remove_all(cache_dir);
+
+  TrainerSpec trainer_spec;
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  trainer_spec.add_input(input_file);
+  trainer_spec.set_model_prefix("model");
+  trainer_spec.set_self_test_sample_size(2);
+  trainer_spec.set_normalized_corpus_cache(cache_dir);
+
+  using Sentences = std::vector<TrainerInterface::Sentence>;
+  auto load = [&](Sentences *sentences,
+                  absl::flat_hash_map<char32, int64> *required_chars,
+                  std::vector<std::string> *samples) {
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    sentences->clear();
+    auto cursor = trainer.sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      sentences->push_back(cursor->value());
+    }
+    *required_chars = trainer.required_chars_;
+    *samples = trainer.self_test_samples_;
+  };
+  auto num_files = [&]() {
+    return std::distance(std::filesystem::directory_iterator(cache_dir),
+                         std::filesystem::directory_iterator());
+  };
+
+  Sentences sentences1, sentences2;
+  absl::flat_hash_map<char32, int64> chars1, chars2;
+  std::vector<std::string> samples1, samples2;
+
+  load(&sentences1, &chars1, &samples1);
+  EXPECT_EQ(3, sentences1.size());
+  EXPECT_EQ(1, num_files());
+
+  // Options used after loading reuse the same cache.
+  trainer_spec.set_vocab_size(100);
+  trainer_spec.set_model_type(TrainerSpec::BPE);
+  load(&sentences2, &chars2, &samples2);
+  EXPECT_EQ(1, num_files());
+  EXPECT_EQ(sentences1, sentences2);
+  EXPECT_EQ(chars1, chars2);
+  EXPECT_EQ(samples1, samples2);
+
+  // Another normalizer makes another cache.
+  normalizer_spec.set_add_dummy_prefix(false);
+  load(&sentences2, &chars2, &samples2);
+  EXPECT_EQ(2, num_files());
+  EXPECT_NE(sentences1, sentences2);
+  load(&sentences1, &chars1, &samples1);
+  EXPECT_EQ(2, num_files());
+  EXPECT_EQ(sentences1, sentences2);
+  EXPECT_EQ(chars1, chars2);
+}
+
+TEST(TrainerInterfaceTest, DedupInputSentencesTest) {
+  const std::string input_file =
+      util::JoinPath(::testing::TempDir(), "dedup_input");
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    for (const char *line :
+         {"Hello World", "abc", "Hello World", "abc", "xyz", "Hello World"}) {
+      output->WriteLine(line);
+    }
+  }
+
+  TrainerSpec trainer_spec;
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  trainer_spec.add_input(input_file);
+  trainer_spec.set_model_prefix("model");
+
+  auto load = [&](std::vector<TrainerInterface::Sentence> *sentences,
+                  absl::flat_hash_map<char32, int64> *required_chars) {
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    sentences->clear();
+    auto cursor = trainer.sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      sentences->push_back(cursor->value());
+    }
+    *required_chars = trainer.required_chars_;
+  };
+
+  std::vector<TrainerInterface::Sentence> sentences, deduped;
+  absl::flat_hash_map<char32, int64> chars, deduped_chars;
+  load(&sentences, &chars);
+  EXPECT_EQ(6, sentences.size());
+
+  trainer_spec.set_dedup_input_sentences(true);
+  load(&deduped, &deduped_chars);
+  EXPECT_EQ(std::vector<TrainerInterface::Sentence>(
+                {{WS "Hello" WS "World", 3}, {WS "abc", 2}, {WS "xyz", 1}}),
+            deduped);
+  EXPECT_EQ(chars, deduped_chars);
+
+  // The first sentences are selected before the duplicates are merged.
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    for (int i = 0; i < 200; ++i) output->WriteLine(absl::StrCat("s", i % 10));
+  }
+  trainer_spec.set_input_sentence_size(101);
+  trainer_spec.set_shuffle_input_sentence(false);
+  load(&deduped, &deduped_chars);
+  ASSERT_EQ(10, deduped.size());
+  int64 total = 0;
+  for (const auto &s : deduped) total += s.second;
+  EXPECT_EQ(101, total);
+  EXPECT_EQ(11, deduped[0].second);
+}
+
+TEST(TrainerInterfaceTest, SampleInputSentenceTest) {
+  const std::string input_file =
+      util::JoinPath(::testing::TempDir(), "sample_input");
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    for (int i = 0; i < 2000; ++i) output->WriteLine(absl::StrCat("s", i));
+  }
+
+  TrainerSpec trainer_spec;
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  trainer_spec.add_input(input_file);
+  trainer_spec.set_model_prefix("model");
+  trainer_spec.set_input_sentence_size(200);
+  trainer_spec.set_shuffle_input_sentence(true);
+
+  auto load = [&]() {
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    std::set<std::string> sentences;
+    auto cursor = trainer.sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      sentences.insert(cursor->value().first);
+    }
+    EXPECT_EQ(200, trainer.sentences_->size());
+    // The reservoirs never hold more than the sample.
+    EXPECT_EQ(200, trainer.peak_sampled_sentences_);
+    return sentences;
+  };
+
+  const auto sentences = load();
+  EXPECT_EQ(200, sentences.size());
+  // The sample is the same regardless of the number of threads.
+  trainer_spec.set_num_threads(3);
+  EXPECT_EQ(sentences, load());
+
+  // Every sentence is kept when the input is smaller than the sample.
+  trainer_spec.set_input_sentence_size(2003);
+  TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+  EXPECT_OK(trainer.LoadSentences());
+  EXPECT_EQ(2000, trainer.sentences_->size());
 }
 
 TEST(TrainerInterfaceTest, MultiFileSentenceIteratorTest) {
@@ -591,4 +841,65 @@ TEST(TrainerInterfaceTest, MultiFileSentenceIteratorErrorTest) {
   EXPECT_FALSE(it.status().ok());
 }
 
+TEST(TrainerInterfaceTest, ParallelMultiFileSentenceIteratorTest) {
+  std::vector<std::string> files;
+  for (int i = 0; i < 5; ++i) {
+    const std::string file = util::JoinPath(::testing::TempDir(),
+                                            absl::StrCat("parallel_input", i));
+    auto output = filesystem::NewWritableFile(file);
+    const int num_line = (rand() % 100) + 1;
+    for (int n = 0; n < num_line; ++n) {
+      // Includes empty lines and lines longer than a chunk.
+      output->WriteLine(std::string(rand() % 30, 'a' + n % 26));
+    }
+    // The last line of the last file has no newline.
+    if (i == 4) output->Write("last");
+    files.push_back(file);
+  }
+
+  // Empty file. MultiFileSentenceIterator returns an empty line for the
+  // empty files followed by another file, so it is placed at the end.
+  const std::string empty_file =
+      util::JoinPath(::testing::TempDir(), "parallel_input_empty");
+  filesystem::NewWritableFile(empty_file);
+  files.push_back(empty_file);
+
+  std::vector<std::string> expected;
+  MultiFileSentenceIterator expected_it(files);
+  for (; !expected_it.done(); expected_it.Next()) {
+    expected.emplace_back(expected_it.value());
+  }
+  EXPECT_OK(expected_it.status());
+  EXPECT_EQ("last", expected.back());
+
+  for (const int num_threads : {1, 4}) {
+    for (const int64 chunk_size : {1, 3, 16, 100, 1 << 20}) {
+      std::vector<std::string> results;
+      ParallelMultiFileSentenceIterator it(files, num_threads, chunk_size);
+      for (; !it.done(); it.Next()) results.emplace_back(it.value());
+      EXPECT_OK(it.status());
+      EXPECT_EQ(expected, results);
+    }
+  }
+}
+
+TEST(TrainerInterfaceTest, ParallelMultiFileSentenceIteratorErrorTest) {
+  const std::string file =
+      util::JoinPath(::testing::TempDir(), "parallel_input_ok");
+  {
+    auto output = filesystem::NewWritableFile(file);
+    output->WriteLine("foo");
+    output->WriteLine("bar");
+  }
+
+  const std::vector<std::string> files = {
+      file, util::JoinPath(::testing::TempDir(), "parallel_input_not_exist")};
+  std::vector<std::string> results;
+  ParallelMultiFileSentenceIterator it(files, 2, 2);
+  for (; !it.done(); it.Next()) results.emplace_back(it.value());
+  EXPECT_FALSE(it.status().ok());
+  // The lines before the missing file are still returned.
+  EXPECT_EQ(std::vector<std::string>({"foo", "bar"}), results);
+}
+
 }  // namespace sentencepiece
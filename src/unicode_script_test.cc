@@ -39,5 +39,22 @@ TEST(UnicodeScript, GetScriptTypeTest) {
   EXPECT_EQ(U_Common, GetScriptType("@"));
   EXPECT_EQ(U_Common, GetScriptType("-"));
 }
+
+TEST(UnicodeScript, GetScriptBoundaryTest) {
+  EXPECT_EQ(U_Common, GetScript(0x0000));
+  EXPECT_EQ(U_Inherited, GetScript(0x0300));  // Combining grave accent.
+  EXPECT_EQ(U_Common, GetScript(0x0378));  // Unassigned.
+  EXPECT_EQ(U_Hangul, GetScript(0xAC00));
+  EXPECT_EQ(U_Linear_B, GetScript(0x10000));
+  EXPECT_EQ(U_Tangut, GetScript(0x17000));
+  EXPECT_EQ(U_Tangut, GetScript(0x187EC));
+  EXPECT_EQ(U_Han, GetScript(0x20000));
+  EXPECT_EQ(U_Han, GetScript(0x2A6D6));
+  EXPECT_EQ(U_Common, GetScript(0xE0001));  // Language tag.
+  EXPECT_EQ(U_Inherited, GetScript(0xE0100));  // Variation selector.
+  EXPECT_EQ(U_Common, GetScript(0x10FFFF));
+  EXPECT_EQ(U_Common, GetScript(0x110000));
+  EXPECT_EQ(U_Common, GetScript(0xFFFFFFFF));
+}
 }  // namespace unicode_script
 }  // namespace sentencepiece
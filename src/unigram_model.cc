@@ -18,12 +18,17 @@
 #include <cfloat>
 #include <cmath>
 #include <complex>
+#include <cstring>
+#include <limits>
 #include <map>
 #include <queue>
+#include <random>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "encode_stats.h"
+#include "memory_usage.h"
 #include "third_party/absl/container/flat_hash_map.h"
 #include "third_party/absl/strings/str_split.h"
 #include "third_party/absl/strings/string_view.h"
@@ -39,6 +44,66 @@ constexpr size_t kPreallocateLatticeNodeSize = 1024;
 constexpr float kUnkPenalty = 10.0;
 constexpr float kEpsilon = 1e-7;
 
+// Returns the number of unicode characters in `text`, split as
+// Lattice::SetSentence() does.
+int CharLength(absl::string_view text) {
+  return string_util::CountChars(text);
+}
+
+// Walks the trie one byte at a time with Darts::DoubleArray::traverse().
+class TraverseWalker {
+ public:
+  explicit TraverseWalker(const Darts::DoubleArray &trie) : trie_(&trie) {}
+
+  void Reset() { node_pos_ = 0; }
+
+  // Follows the transition labeled key[pos]. Returns -2 if it does not exist,
+  // the value of the new state if it is an accept state, or -1 otherwise.
+  int Next(const char *key, size_t pos) {
+    size_t key_pos = pos;
+    return trie_->traverse(key, node_pos_, key_pos, pos + 1);
+  }
+
+ private:
+  const Darts::DoubleArray *trie_ = nullptr;
+  size_t node_pos_ = 0;
+};
+
+// The same as TraverseWalker, but reads the double-array units directly and
+// keeps the current unit in a register. traverse() reloads the unit of
+// `node_pos` on every call, which is one more dependent load per byte.
+class UnitWalker {
+ public:
+  explicit UnitWalker(const Darts::DoubleArray &trie)
+      : units_(static_cast<const Unit *>(trie.array())), root_(units_[0]) {
+    Reset();
+  }
+
+  void Reset() {
+    id_ = 0;
+    unit_ = root_;
+  }
+
+  int Next(const char *key, size_t pos) {
+    const auto c = static_cast<unsigned char>(key[pos]);
+    const Darts::Details::id_type id = id_ ^ unit_.offset() ^ c;
+    const Unit unit = units_[id];
+    if (unit.label() != c) return -2;
+    id_ = id;
+    unit_ = unit;
+    if (!unit.has_leaf()) return -1;
+    return static_cast<int>(units_[id ^ unit.offset()].value());
+  }
+
+ private:
+  using Unit = Darts::Details::DoubleArrayUnit;
+
+  const Unit *units_ = nullptr;
+  Unit root_;
+  Unit unit_;
+  Darts::Details::id_type id_ = 0;
+};
+
 // Returns log(exp(x) + exp(y)).
 // if init_mode is true, returns log(exp(y)) == y.
 // log(\sum_i exp(a[i])) can be computed as
@@ -68,17 +133,48 @@ inline float Gumbel() {
 
   return noise;
 }
+
+constexpr size_t kMaxCachedLatticeNodeSize = 1 << 16;
+
+// Lends the lattice shared by the encoders running in the calling thread
+// for the scope. Reusing it keeps the node chunks and the indexes across
+// sentences, but not the memory of an exceptionally long sentence, which is
+// released at the end of the scope.
+class ThreadLocalLattice {
+ public:
+  ThreadLocalLattice() {
+    if (lattice() == nullptr) lattice().reset(new Lattice);
+  }
+
+  ~ThreadLocalLattice() {
+    if (lattice()->node_capacity() > kMaxCachedLatticeNodeSize) {
+      lattice().reset();
+    }
+  }
+
+  Lattice &operator*() const { return *lattice(); }
+
+ private:
+  static std::unique_ptr<Lattice> &lattice() {
+    thread_local std::unique_ptr<Lattice> lattice;
+    return lattice;
+  }
+};
 }  // namespace
 
 Lattice::Lattice() : node_allocator_(kPreallocateLatticeNodeSize) {}
 Lattice::~Lattice() {}
 
-const std::vector<Lattice::Node *> &Lattice::begin_nodes(int pos) const {
-  return begin_nodes_[pos];
+Lattice::NodeRange Lattice::begin_nodes(int pos) const {
+  BuildIndex();
+  return NodeRange(begin_index_.data() + begin_offsets_[pos],
+                   begin_index_.data() + begin_offsets_[pos + 1]);
 }
 
-const std::vector<Lattice::Node *> &Lattice::end_nodes(int pos) const {
-  return end_nodes_[pos];
+Lattice::NodeRange Lattice::end_nodes(int pos) const {
+  BuildIndex();
+  return NodeRange(end_index_.data() + end_offsets_[pos],
+                   end_index_.data() + end_offsets_[pos + 1]);
 }
 
 int Lattice::size() const {
@@ -92,22 +188,22 @@ const char *Lattice::sentence() const { return sentence_.data(); }
 
 const char *Lattice::surface(int pos) const { return surface_[pos]; }
 
-Lattice::Node *Lattice::bos_node() const { return end_nodes_[0][0]; }
+Lattice::Node *Lattice::bos_node() const { return node_allocator_[kBosNodeId]; }
 
-Lattice::Node *Lattice::eos_node() const { return begin_nodes_[size()][0]; }
+Lattice::Node *Lattice::eos_node() const { return node_allocator_[kEosNodeId]; }
 
 Lattice::Node *Lattice::NewNode() {
   Node *node = node_allocator_.Allocate();
   node->node_id = node_allocator_.size() - 1;
+  index_is_valid_ = false;
   return node;
 }
 
 void Lattice::Clear() {
-  begin_nodes_.clear();
-  end_nodes_.clear();
   sentence_ = absl::string_view("");
   surface_.clear();
   node_allocator_.Free();
+  index_is_valid_ = false;
 }
 
 void Lattice::SetSentence(absl::string_view sentence) {
@@ -125,24 +221,14 @@ void Lattice::SetSentence(absl::string_view sentence) {
   surface_.push_back(sentence.data());
 
   const int len = size();
-  begin_nodes_.resize(len + 1);
-  end_nodes_.resize(len + 1);
-
-  constexpr size_t kReservedNodeSize = 16;
-  for (int i = 0; i <= len; ++i) {
-    begin_nodes_[i].reserve(kReservedNodeSize);
-    end_nodes_[i].reserve(kReservedNodeSize);
-  }
 
   Node *bos = NewNode();
   bos->id = -1;
   bos->pos = 0;
-  end_nodes_[0].push_back(bos);
 
   Node *eos = NewNode();
   eos->id = -1;
   eos->pos = len;
-  begin_nodes_[len].push_back(eos);
 }
 
 Lattice::Node *Lattice::Insert(int pos, int length) {
@@ -152,21 +238,59 @@ Lattice::Node *Lattice::Insert(int pos, int length) {
   const int utf8_length =
       static_cast<int>(surface(pos + length) - surface(pos));
   node->piece = absl::string_view(surface(pos), utf8_length);
-  begin_nodes_[pos].push_back(node);
-  end_nodes_[pos + node->length].push_back(node);
 
   return node;
 }
 
+void Lattice::BuildIndex() const {
+  if (index_is_valid_) return;
+
+  // Counting sort of the nodes by their begin and end positions. It is
+  // stable, so the nodes at every position keep the insertion order. BOS only
+  // ends at 0 and EOS only begins at size().
+  const int len = size();
+  const size_t num_nodes = node_allocator_.size();
+  begin_offsets_.assign(len + 3, 0);
+  end_offsets_.assign(len + 3, 0);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    const Node *node = node_allocator_[i];
+    if (i != kBosNodeId) ++begin_offsets_[node->pos + 2];
+    if (i != kEosNodeId) ++end_offsets_[node->pos + node->length + 2];
+  }
+  for (int pos = 2; pos <= len + 2; ++pos) {
+    begin_offsets_[pos] += begin_offsets_[pos - 1];
+    end_offsets_[pos] += end_offsets_[pos - 1];
+  }
+
+  // Moves the offsets at pos + 1 from the beginning to the end of `pos`,
+  // which is the beginning of pos + 1.
+  begin_index_.resize(std::max<size_t>(num_nodes, 1) - 1);
+  end_index_.resize(std::max<size_t>(num_nodes, 1) - 1);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    Node *node = node_allocator_[i];
+    if (i != kBosNodeId) {
+      begin_index_[begin_offsets_[node->pos + 1]++] = node;
+    }
+    if (i != kEosNodeId) {
+      end_index_[end_offsets_[node->pos + node->length + 1]++] = node;
+    }
+  }
+
+  index_is_valid_ = true;
+}
+
 Lattice::LatticePathWithScore Lattice::Viterbi() {
   const int len = size();
 
+  CancellationCheck cancellation;
   for (int pos = 0; pos <= len; ++pos) {
-    for (Node *rnode : begin_nodes_[pos]) {
+    if (cancellation.Cancelled()) return {};
+    const NodeRange lnodes = end_nodes(pos);
+    for (Node *rnode : begin_nodes(pos)) {
       rnode->prev = nullptr;
       float best_score = 0.0;
       Node *best_node = nullptr;
-      for (Node *lnode : end_nodes_[pos]) {
+      for (Node *lnode : lnodes) {
         const float score = lnode->backtrace_score + rnode->score;
         if (best_node == nullptr || score > best_score) {
           best_node = lnode;
@@ -184,8 +308,8 @@ Lattice::LatticePathWithScore Lattice::Viterbi() {
 
   // backtrace
   std::vector<Node *> results;
-  float score = begin_nodes(len)[0]->backtrace_score;
-  for (Node *node = begin_nodes_[len][0]->prev; node->prev != nullptr;
+  float score = eos_node()->backtrace_score;
+  for (Node *node = eos_node()->prev; node->prev != nullptr;
        node = node->prev) {
     results.push_back(node);
   }
@@ -201,15 +325,19 @@ std::vector<float> Lattice::ForwardAlgorithm(float inv_theta) const {
   const int len = size();
   std::vector<float> alpha(node_allocator_.size(), 0.0);
 
+  // alpha of a node only depends on the nodes ending at its begin position,
+  // so it is computed once for all the nodes beginning at `pos`.
   for (int pos = 0; pos <= len; ++pos) {
-    for (Node *rnode : begin_nodes_[pos]) {
-      for (Node *lnode : end_nodes_[pos]) {
-        alpha[rnode->node_id] =
-            LogSumExp(alpha[rnode->node_id],
-                      inv_theta * lnode->score + alpha[lnode->node_id],
-                      lnode == end_nodes_[pos][0]);
-      }
+    const NodeRange rnodes = begin_nodes(pos);
+    if (rnodes.empty()) continue;
+    const NodeRange lnodes = end_nodes(pos);
+    float value = 0.0;
+    for (size_t i = 0; i < lnodes.size(); ++i) {
+      const Node *lnode = lnodes[i];
+      value = LogSumExp(value, inv_theta * lnode->score + alpha[lnode->node_id],
+                        i == 0);
     }
+    for (const Node *rnode : rnodes) alpha[rnode->node_id] = value;
   }
 
   return alpha;
@@ -219,22 +347,26 @@ std::vector<float> Lattice::BackwardAlgorithm(float inv_theta) const {
   const int len = size();
   std::vector<float> beta(node_allocator_.size(), 0.0);
 
+  // Likewise, beta is shared by all the nodes ending at `pos`.
   for (int pos = len; pos >= 0; --pos) {
-    for (Node *lnode : end_nodes_[pos]) {
-      for (Node *rnode : begin_nodes_[pos]) {
-        beta[lnode->node_id] =
-            LogSumExp(beta[lnode->node_id], rnode->score + beta[rnode->node_id],
-                      rnode == begin_nodes_[pos][0]);
-      }
+    const NodeRange lnodes = end_nodes(pos);
+    if (lnodes.empty()) continue;
+    const NodeRange rnodes = begin_nodes(pos);
+    float value = 0.0;
+    for (size_t i = 0; i < rnodes.size(); ++i) {
+      const Node *rnode = rnodes[i];
+      value = LogSumExp(value, rnode->score + beta[rnode->node_id], i == 0);
     }
+    for (const Node *lnode : lnodes) beta[lnode->node_id] = value;
   }
 
   return beta;
 }
 
-float Lattice::PopulateMarginal(float freq,
-                                std::vector<float> *expected) const {
+float Lattice::PopulateMarginal(float freq, std::vector<float> *expected,
+                                float beam) const {
   if (expected == nullptr) return 0.0;
+  if (beam > 0.0) return PopulateBeamMarginal(freq, beam, expected);
 
   const int len = size();
 
@@ -244,9 +376,9 @@ float Lattice::PopulateMarginal(float freq,
   const auto alpha = ForwardAlgorithm(1.0);
   const auto beta = BackwardAlgorithm(1.0);
 
-  const float Z = alpha[begin_nodes_[len][0]->node_id];
+  const float Z = alpha[eos_node()->node_id];
   for (int pos = 0; pos < len; ++pos) {
-    for (Node *node : begin_nodes_[pos]) {
+    for (Node *node : begin_nodes(pos)) {
       if (node->id >= 0) {
         // the index of |expected| is a Node::id, which is a vocabulary id.
         (*expected)[node->id] +=
@@ -260,6 +392,77 @@ float Lattice::PopulateMarginal(float freq,
   return freq * Z;
 }
 
+float Lattice::PopulateBeamMarginal(float freq, float beam,
+                                    std::vector<float> *expected) const {
+  const int len = size();
+  constexpr float kUnreached = -std::numeric_limits<float>::infinity();
+
+  // The scores of the best paths from BOS to every position and from every
+  // position to EOS. The nodes are indexed by their positions since the
+  // paths only join at the positions.
+  std::vector<float> best_alpha(len + 1, kUnreached);
+  std::vector<float> best_beta(len + 1, kUnreached);
+  best_alpha[0] = 0.0;
+  for (int pos = 0; pos < len; ++pos) {
+    if (best_alpha[pos] == kUnreached) continue;
+    for (const Node *node : begin_nodes(pos)) {
+      float &value = best_alpha[pos + node->length];
+      value = std::max(value, best_alpha[pos] + node->score);
+    }
+  }
+  best_beta[len] = 0.0;
+  for (int pos = len - 1; pos >= 0; --pos) {
+    for (const Node *node : begin_nodes(pos)) {
+      best_beta[pos] = std::max(best_beta[pos],
+                                node->score + best_beta[pos + node->length]);
+    }
+  }
+
+  // The best path through a kept node only has kept nodes, so the kept
+  // nodes begin and end at the positions reached below.
+  const float threshold = best_beta[0] - beam;
+  auto is_kept = [&](const Node *node) {
+    return best_alpha[node->pos] + node->score +
+               best_beta[node->pos + node->length] >=
+           threshold;
+  };
+
+  std::vector<float> alpha(len + 1, kUnreached);
+  std::vector<float> beta(len + 1, kUnreached);
+  alpha[0] = 0.0;
+  for (int pos = 0; pos < len; ++pos) {
+    if (alpha[pos] == kUnreached) continue;
+    for (const Node *node : begin_nodes(pos)) {
+      if (!is_kept(node)) continue;
+      float &value = alpha[pos + node->length];
+      value = LogSumExp(value, alpha[pos] + node->score, value == kUnreached);
+    }
+  }
+  beta[len] = 0.0;
+  for (int pos = len - 1; pos >= 0; --pos) {
+    for (const Node *node : begin_nodes(pos)) {
+      if (!is_kept(node)) continue;
+      float &value = beta[pos];
+      value = LogSumExp(value, node->score + beta[pos + node->length],
+                        value == kUnreached);
+    }
+  }
+
+  const float Z = alpha[len];
+  for (int pos = 0; pos < len; ++pos) {
+    for (const Node *node : begin_nodes(pos)) {
+      if (node->id >= 0 && is_kept(node)) {
+        (*expected)[node->id] +=
+            freq * std::exp(static_cast<double>(
+                       alpha[pos] + node->score +
+                       beta[pos + node->length] - Z));
+      }
+    }
+  }
+
+  return freq * Z;
+}
+
 float Lattice::CalculateEntropy(float inv_theta) const {
   const int len = size();
 
@@ -271,23 +474,26 @@ float Lattice::CalculateEntropy(float inv_theta) const {
   // Populate the forward marginals to get the normalising constant
   const auto alpha = ForwardAlgorithm(inv_theta);
 
-  // Now populate the forward entropies
+  // Now populate the forward entropies. As alpha, they are shared by all the
+  // nodes beginning at `pos`.
   for (int pos = 0; pos <= len; ++pos) {
-    for (Node *rnode : begin_nodes_[pos]) {
-      for (Node *lnode : end_nodes_[pos]) {
-        // Contribution each lnode makes = p(lnode) * (H(lnode) + log p(lnode))
-
-        // We have to normalise p(lnode) by the marginal contribution it makes
-        const float lnode_transition_prob =
-            ((inv_theta * lnode->score) + alpha[lnode->node_id] -
-             alpha[rnode->node_id]);
-        H[rnode->node_id] += std::exp(lnode_transition_prob) *
-                             (H[lnode->node_id] + lnode_transition_prob);
-      }
+    const NodeRange rnodes = begin_nodes(pos);
+    if (rnodes.empty()) continue;
+    const float rnode_alpha = alpha[rnodes.front()->node_id];
+    float entropy = 0.0;
+    for (const Node *lnode : end_nodes(pos)) {
+      // Contribution each lnode makes = p(lnode) * (H(lnode) + log p(lnode))
+
+      // We have to normalise p(lnode) by the marginal contribution it makes
+      const float lnode_transition_prob =
+          ((inv_theta * lnode->score) + alpha[lnode->node_id] - rnode_alpha);
+      entropy += std::exp(lnode_transition_prob) *
+                 (H[lnode->node_id] + lnode_transition_prob);
     }
+    for (const Node *rnode : rnodes) H[rnode->node_id] = entropy;
   }
 
-  return -H[begin_nodes_[len][0]->node_id];
+  return -H[eos_node()->node_id];
 }
 
 namespace {
@@ -340,8 +546,102 @@ Hypothesis *CloneHypAndDependents(
   return cloned;
 }
 
+constexpr size_t kPreallocatedHypothesisSize = 512;
+constexpr size_t kMaxCachedHypothesisSize = 1 << 16;
+
+// Does not keep the memory of an exceptionally large search.
+void ReleaseLargeHypothesisAllocator(model::FreeList<Hypothesis> *allocator) {
+  if (allocator->capacity() > kMaxCachedHypothesisSize) {
+    model::FreeList<Hypothesis> empty(kPreallocatedHypothesisSize);
+    allocator->swap(empty);
+  }
+}
+
+// Returns the hypothesis allocator of Lattice::NBest() in the calling thread.
+// It is created on the first A* search, so that the callers which only run
+// Viterbi never allocate it, and reused by the following searches.
+model::FreeList<Hypothesis> &GetThreadLocalHypothesisAllocator() {
+  thread_local model::FreeList<Hypothesis> allocator(
+      kPreallocatedHypothesisSize);
+  // A search which returned early did not release the memory below.
+  ReleaseLargeHypothesisAllocator(&allocator);
+  return allocator;
+}
+
 }  // namespace
 
+template <size_t K>
+std::vector<Lattice::LatticePathWithScore> Lattice::NBestViterbi(
+    size_t nbest_size) {
+  // The best paths from BOS to every node, sorted by the score. A path is
+  // its score and the `rank`-th best path to the previous node.
+  struct PartialPath {
+    float score;
+    int prev_node_id;
+    int rank;
+  };
+  struct BestPaths {
+    std::array<PartialPath, K> paths;
+    size_t size = 0;
+  };
+
+  const size_t beam_size = std::min(nbest_size, K);
+  std::vector<BestPaths> best_paths(node_allocator_.size());
+  best_paths[kBosNodeId].paths[0] = {0.0, -1, 0};
+  best_paths[kBosNodeId].size = 1;
+
+  const int len = size();
+  CancellationCheck cancellation;
+  for (int pos = 0; pos <= len; ++pos) {
+    if (cancellation.Cancelled()) return {};
+    const NodeRange lnodes = end_nodes(pos);
+    for (const Node *rnode : begin_nodes(pos)) {
+      auto &rpaths = best_paths[rnode->node_id];
+      for (const Node *lnode : lnodes) {
+        const auto &lpaths = best_paths[lnode->node_id];
+        for (size_t rank = 0; rank < lpaths.size; ++rank) {
+          const float score = lpaths.paths[rank].score + rnode->score;
+          // `lpaths` is sorted, so the rest of them are not better either.
+          if (rpaths.size == beam_size &&
+              !(score > rpaths.paths[beam_size - 1].score)) {
+            break;
+          }
+          // Inserts after the paths with the same score, like the stable
+          // order of the A* search.
+          size_t i = std::min(rpaths.size, beam_size - 1);
+          for (; i > 0 && score > rpaths.paths[i - 1].score; --i) {
+            rpaths.paths[i] = rpaths.paths[i - 1];
+          }
+          rpaths.paths[i] = {score, static_cast<int>(lnode->node_id),
+                             static_cast<int>(rank)};
+          rpaths.size = std::min(rpaths.size + 1, beam_size);
+        }
+      }
+    }
+  }
+
+  std::vector<LatticePathWithScore> results;
+  const auto &eos_paths = best_paths[kEosNodeId];
+  for (size_t i = 0; i < eos_paths.size; ++i) {
+    results.emplace_back();
+    auto &nodes = results.back().first;
+    const PartialPath *path = &eos_paths.paths[i];
+    while (path->prev_node_id != static_cast<int>(kBosNodeId)) {
+      nodes.push_back(node_allocator_[path->prev_node_id]);
+      path = &best_paths[path->prev_node_id].paths[path->rank];
+    }
+    std::reverse(nodes.begin(), nodes.end());
+    // Sums up from EOS, as NBest() does.
+    float score = 0.0;
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      score = (*it)->score + score;
+    }
+    results.back().second = score;
+  }
+
+  return results;
+}
+
 std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
                                                           bool sample,
                                                           float inv_theta) {
@@ -350,10 +650,21 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
     return {};
   }
 
-  if (nbest_size == 1 && !sample) {
+  if (sample) {
+    return SampleWithoutReplacement(nbest_size, inv_theta);
+  }
+
+  if (nbest_size == 1) {
     return {Viterbi()};
   }
 
+  if (nbest_size <= kMaxNBestViterbiSize) {
+    if (nbest_size <= 2) return NBestViterbi<2>(nbest_size);
+    if (nbest_size <= 4) return NBestViterbi<4>(nbest_size);
+    if (nbest_size <= 8) return NBestViterbi<8>(nbest_size);
+    return NBestViterbi<kMaxNBestViterbiSize>(nbest_size);
+  }
+
   // Uses A* search to enumerate N-bests.
   // Given a lattice, enumerates hypotheses (paths) from EOS.
   // At each partial path x, compute f(x) as follows
@@ -375,8 +686,9 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
 
   using Agenda = std::priority_queue<Hypothesis *, std::vector<Hypothesis *>,
                                      HypothesisComparator>;
-  constexpr size_t kPreallocatedHypothesisSize = 512;
-  model::FreeList<Hypothesis> hypothesis_allocator(kPreallocatedHypothesisSize);
+  model::FreeList<Hypothesis> &hypothesis_allocator =
+      GetThreadLocalHypothesisAllocator();
+  hypothesis_allocator.Free();
 
   Agenda agenda;
   std::vector<Lattice::LatticePathWithScore> results;
@@ -386,23 +698,17 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
   eos->next = nullptr;
   eos->gx = 0.0;
 
-  std::vector<float> alpha(node_allocator_.size(), 0.0);
-
-  if (sample) {
-    // Run forwards algorithm to get normalising constants
-    alpha = ForwardAlgorithm(inv_theta);
-    // f(eos) = Gumbel(0), as it is the perturbed score of the entire lattice.
-    eos->fx = Gumbel();
-  } else {
-    // Run Viterbi first to fill backtrace score.
-    Viterbi();
-    eos->fx = eos->node->backtrace_score;
-  }
+  // Run Viterbi first to fill backtrace score.
+  Viterbi();
+  const auto *token = ScopedCancellation::current();
+  if (token != nullptr && token->IsCancelled()) return {};
+  eos->fx = eos->node->backtrace_score;
   agenda.push(eos);
 
   int shrink_count = 0;  // Number of times agenda has shrunk. For logging only.
   bool printed_memory_warning = false;  // For logging only.
-  while (!agenda.empty()) {
+  CancellationCheck cancellation;
+  while (!agenda.empty() && !cancellation.Cancelled()) {
     auto *top = agenda.top();
     agenda.pop();
     auto *node = top->node;
@@ -420,48 +726,13 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
       continue;
     }
 
-    const int end_nodes_size = end_nodes(node->pos).size();
-    std::vector<float> probs(end_nodes_size, 0.0);
-    std::vector<float> perturbed_probs(end_nodes_size, 0.0);
-    std::vector<double> adjusted_probs(end_nodes_size, 0.0);
-    const float Z = alpha[node->node_id];
-    if (sample) {
-      float max_score = -1e8;
-      // Calculate the marginal and perturbed scores for stochastic search
-      for (int i = 0; i < end_nodes(node->pos).size(); i++) {
-        Node *lnode = end_nodes(node->pos)[i];
-        // Calculate backwards transition score
-        probs[i] =
-            top->gx + alpha[lnode->node_id] + (inv_theta * lnode->score) - Z;
-        perturbed_probs[i] = probs[i] + Gumbel();
-        if (perturbed_probs[i] > max_score) {
-          max_score = perturbed_probs[i];
-        }
-      }
-      // Now constrain the sampled continuations to match the score of parent
-      for (int i = 0; i < adjusted_probs.size(); i++) {
-        // Use numerically stable version of truncated Gumbel:
-        // https://arxiv.org/pdf/1903.06059.pdf appendix B.3
-        const float v = top->fx - perturbed_probs[i] +
-                        std::log1p(-std::exp(perturbed_probs[i] - max_score));
-        adjusted_probs[i] = top->fx - std::max(static_cast<float>(0.0), v) -
-                            std::log1p(std::exp(-std::abs(v)));
-      }
-    }
-
     // Expands new node ending at node->pos
-    for (int i = 0; i < end_nodes(node->pos).size(); i++) {
-      Node *lnode = end_nodes(node->pos)[i];
+    for (Node *lnode : end_nodes(node->pos)) {
       auto *hyp = hypothesis_allocator.Allocate();
       hyp->node = lnode;
-      if (sample) {
-        hyp->gx = probs[i];
-        hyp->fx = adjusted_probs[i];
-      } else {
-        hyp->gx = lnode->score + top->gx;  // just adds node->score
-        hyp->fx =
-            lnode->backtrace_score + top->gx;  // backtrace_score is h(node).
-      }
+      hyp->gx = lnode->score + top->gx;  // just adds node->score
+      hyp->fx =
+          lnode->backtrace_score + top->gx;  // backtrace_score is h(node).
       hyp->next = top;
       agenda.push(hyp);
     }
@@ -505,10 +776,13 @@ std::vector<Lattice::LatticePathWithScore> Lattice::NBest(size_t nbest_size,
     }
   }
 
+  ReleaseLargeHypothesisAllocator(&hypothesis_allocator);
+
   return results;
 }
 
-std::vector<Lattice::Node *> Lattice::Sample(float inv_theta) {
+std::vector<Lattice::Node *> Lattice::Sample(float inv_theta,
+                                             SampleGenerator *generator) {
   const int len = size();
   if (len == 0) return {};
 
@@ -516,7 +790,7 @@ std::vector<Lattice::Node *> Lattice::Sample(float inv_theta) {
 
   alpha = ForwardAlgorithm(inv_theta);
 
-  auto *mt = random::GetRandomGenerator();
+  auto *mt = generator == nullptr ? random::GetRandomGenerator() : nullptr;
 
   std::vector<Node *> results;
   std::vector<float> probs;
@@ -525,12 +799,12 @@ std::vector<Lattice::Node *> Lattice::Sample(float inv_theta) {
   Node *node = eos_node();
   while (true) {
     probs.clear();
-    for (const Node *lnode : end_nodes_[node->pos]) {
+    for (const Node *lnode : end_nodes(node->pos)) {
       probs.push_back(std::exp(static_cast<double>(
           alpha[lnode->node_id] + inv_theta * lnode->score - Z)));
     }
     std::discrete_distribution<int> dist(probs.begin(), probs.end());
-    node = end_nodes_[node->pos][dist(*mt)];
+    node = end_nodes(node->pos)[mt ? dist(*mt) : dist(*generator)];
     if (node == bos_node()) break;
 
     Z = alpha[node->node_id];
@@ -552,6 +826,8 @@ void Model::PopulateNodes(Lattice *lattice) const {
   };
 
   const float unk_score = min_score() - kUnkPenalty;
+  const auto *mask = ScopedVocabularyMask::current();
+  const int *id_map = trie_id_map_.empty() ? nullptr : trie_id_map_.data();
 
   const int len = lattice->size();
   const char *end = lattice->sentence() + lattice->utf8_size();
@@ -575,8 +851,9 @@ void Model::PopulateNodes(Lattice *lattice) const {
     for (size_t k = 0; k < num_nodes; ++k) {
       const int length =
           get_chars_length(begin_pos, begin + trie_results[k].length);
-      const int id = trie_results[k].value;
-      if (IsUnusedInlined(id)) continue;
+      int id = trie_results[k].value;
+      if (id_map != nullptr && (id = id_map[id]) < 0) continue;
+      if (IsUnusedInlined(id, mask)) continue;
       Lattice::Node *node = lattice->Insert(begin_pos, length);
       node->id = id;  // the value of Trie stores vocab_id.
       // User defined symbol receives extra bonus to always be selected.
@@ -596,15 +873,37 @@ void Model::PopulateNodes(Lattice *lattice) const {
 }
 
 int Model::PieceToId(absl::string_view piece) const {
+  if (piece_ids_) return ModelInterface::PieceToId(piece);
+
+  // The trainer model only has `trie_`.
   auto it = reserved_id_map_.find(piece);
   if (it != reserved_id_map_.end()) {
     return it->second;
   }
   int id = 0;
   trie_->exactMatchSearch(piece.data(), id, piece.size());
+  if (id != -1 && !trie_id_map_.empty()) id = trie_id_map_[id];
   return id == -1 ? unk_id_ : id;
 }
 
+void Model::AppendCompiledSections(CompiledModel::Sections *sections) const {
+  ModelInterface::AppendCompiledSections(sections);
+  if (!trie_) return;
+  (*sections)[CompiledModel::kUnigramTrie].assign(
+      static_cast<const char *>(trie_->array()), trie_->total_size());
+  (*sections)[CompiledModel::kUnigramTrieResults].assign(
+      reinterpret_cast<const char *>(&trie_results_size_),
+      sizeof(trie_results_size_));
+}
+
+void Model::AddMemoryUsage(MemoryUsage *usage) const {
+  ModelInterface::AddMemoryUsage(usage);
+  usage->Add("unigram_trie",
+             memory_usage::Trie(trie_.get(),
+                                GetPrebuiltSection(CompiledModel::kUnigramTrie)) +
+                 memory_usage::Vector(trie_id_map_));
+}
+
 void Model::BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces) {
   if (!status().ok()) return;
 
@@ -613,34 +912,62 @@ void Model::BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces) {
     return;
   }
 
-  // sort by sentencepiece since DoubleArray::build()
-  // only accepts sorted strings.
-  sort(pieces->begin(), pieces->end());
+  trie_ = std::make_unique<Darts::DoubleArray>();
+  const auto trie_results =
+      GetPrebuiltSection(CompiledModel::kUnigramTrieResults);
+  const bool is_mapped =
+      trie_results.size() == sizeof(trie_results_size_) &&
+      MapCompiledArray(CompiledModel::kUnigramTrie, trie_.get());
+  if (!is_mapped) {
+    // sort by sentencepiece since DoubleArray::build()
+    // only accepts sorted strings.
+    sort(pieces->begin(), pieces->end());
+
+    // Makes key/value set for DoubleArrayTrie.
+    std::vector<const char *> key(pieces->size());
+    std::vector<int> value(pieces->size());
+    for (size_t i = 0; i < pieces->size(); ++i) {
+      key[i] = (*pieces)[i].first.data();  // sorted piece.
+      value[i] = (*pieces)[i].second;      // vocab_id
+    }
 
-  // Makes key/value set for DoubleArrayTrie.
-  std::vector<const char *> key(pieces->size());
-  std::vector<int> value(pieces->size());
-  for (size_t i = 0; i < pieces->size(); ++i) {
-    key[i] = (*pieces)[i].first.data();  // sorted piece.
-    value[i] = (*pieces)[i].second;      // vocab_id
+    if (trie_->build(key.size(), const_cast<char **>(&key[0]), nullptr,
+                     &value[0]) != 0) {
+      status_ = util::InternalError("cannot build double-array.");
+      return;
+    }
   }
 
-  trie_ = std::make_unique<Darts::DoubleArray>();
-  if (trie_->build(key.size(), const_cast<char **>(&key[0]), nullptr,
-                   &value[0]) != 0) {
-    status_ = util::InternalError("cannot build double-array.");
-    return;
+  // Computes the longest piece per first byte, which bounds the trie walk
+  // and the positions the optimized Viterbi has to keep scores for.
+  max_piece_length_by_first_byte_.fill(0);
+  int max_piece_length = 0;
+  for (const auto &p : *pieces) {
+    if (p.first.empty()) continue;
+    auto &length =
+        max_piece_length_by_first_byte_[static_cast<uint8>(p.first[0])];
+    length = std::max<int>(length, p.first.size());
+    max_piece_length = std::max(max_piece_length, length);
+  }
+  // An unknown character advances by one UTF-8 character, at most 4 bytes.
+  best_path_scores_size_ = 1;
+  while (best_path_scores_size_ <= std::max(max_piece_length, 4)) {
+    best_path_scores_size_ <<= 1;
   }
 
   // Computes the maximum number of shared prefixes in the trie.
-  const int kMaxTrieResultsSize = 1024;
-  std::vector<Darts::DoubleArray::result_pair_type> results(
-      kMaxTrieResultsSize);
   trie_results_size_ = 0;
-  for (const auto &p : *pieces) {
-    const int num_nodes = trie_->commonPrefixSearch(
-        p.first.data(), results.data(), results.size(), p.first.size());
-    trie_results_size_ = std::max(trie_results_size_, num_nodes);
+  if (is_mapped) {
+    memcpy(&trie_results_size_, trie_results.data(), trie_results.size());
+  } else {
+    const int kMaxTrieResultsSize = 1024;
+    std::vector<Darts::DoubleArray::result_pair_type> results(
+        kMaxTrieResultsSize);
+    for (const auto &p : *pieces) {
+      const int num_nodes = trie_->commonPrefixSearch(
+          p.first.data(), results.data(), results.size(), p.first.size());
+      trie_results_size_ = std::max(trie_results_size_, num_nodes);
+    }
   }
 
   pieces_.clear();
@@ -649,8 +976,10 @@ void Model::BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces) {
     status_ = util::InternalError("no entry is found in the trie.");
 }
 
-Model::Model(const ModelProto &model_proto) {
+Model::Model(const ModelProto &model_proto,
+             std::shared_ptr<const CompiledModel> compiled_model) {
   model_proto_ = &model_proto;
+  compiled_model_ = std::move(compiled_model);
 
   InitializePieces();
 
@@ -662,16 +991,29 @@ Model::Model(const ModelProto &model_proto) {
       max_score_ = std::max(max_score_, sp.score());
     }
   }
+  const auto &spec = model_proto_->trainer_spec();
+  if (spec.has_min_piece_score()) min_score_ = spec.min_piece_score();
+  if (spec.has_max_piece_score()) max_score_ = spec.max_piece_score();
 
   std::vector<std::pair<absl::string_view, int>> pieces;
   for (const auto &it : pieces_) pieces.emplace_back(it.first, it.second);
 
   BuildTrie(&pieces);
+  ReleasePieceMaps();
 }
 
 Model::~Model() {}
 
 EncodeResult Model::Encode(absl::string_view normalized) const {
+  if (IsEncodeCacheAvailable()) {
+    return EncodeWithCache(normalized, [this](absl::string_view word) {
+      return EncodeUncached(word);
+    });
+  }
+  return EncodeUncached(normalized);
+}
+
+EncodeResult Model::EncodeUncached(absl::string_view normalized) const {
   if (encoder_version_ == EncoderVersion::kOptimized) {
     return EncodeOptimized(normalized);
   }
@@ -680,9 +1022,11 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
     return {};
   }
 
-  Lattice lattice;
+  const ThreadLocalLattice scoped_lattice;
+  Lattice &lattice = *scoped_lattice;
   lattice.SetSentence(normalized);
   PopulateNodes(&lattice);
+  encode_stats::Add(encode_stats::kLatticeNodes, lattice.num_nodes() - 2);
 
   EncodeResult results;
   for (const auto *node : lattice.Viterbi().first) {
@@ -692,6 +1036,105 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
   return results;
 }
 
+std::vector<Lattice::LatticePathWithScore> Lattice::SampleWithoutReplacement(
+    size_t nbest_size, float inv_theta) {
+  // Stochastic beam search (https://arxiv.org/pdf/1903.06059.pdf) from EOS to
+  // BOS. A partial path x is the suffix of a path from its left-most node to
+  // EOS, and f(x) is the maximum of the Gumbel-perturbed scores of the paths
+  // completing it, drawn top-down as a truncated Gumbel.
+  //
+  // The partial paths whose left-most node begins at the same position have
+  // disjoint completions, so every path among the `nbest_size` best by its
+  // perturbed score only passes through partial paths among the `nbest_size`
+  // best of their position. Keeping that many per position draws the same
+  // samples as an exhaustive search in O(nbest_size * |nodes|) expansions.
+  auto compare = [](const Hypothesis *h1, const Hypothesis *h2) {
+    return h1->fx > h2->fx;
+  };
+
+  model::FreeList<Hypothesis> &hypothesis_allocator =
+      GetThreadLocalHypothesisAllocator();
+  hypothesis_allocator.Free();
+
+  // beams[pos] is the min-heap of the partial paths beginning at `pos`, and
+  // beams[len + 1] the one of the complete paths reaching BOS.
+  const int len = size();
+  std::vector<std::vector<Hypothesis *>> beams(len + 2);
+  auto push = [&](Node *node, Hypothesis *next, float fx, float gx) {
+    auto &beam = beams[node == bos_node() ? len + 1 : node->pos];
+    Hypothesis *hyp = nullptr;
+    if (beam.size() < nbest_size) {
+      hyp = hypothesis_allocator.Allocate();
+      beam.push_back(hyp);
+    } else if (fx > beam.front()->fx) {
+      // The evicted one is not expanded yet, so nothing points to it.
+      std::pop_heap(beam.begin(), beam.end(), compare);
+      hyp = beam.back();
+    } else {
+      return;
+    }
+    hyp->node = node;
+    hyp->next = next;
+    hyp->fx = fx;
+    hyp->gx = gx;
+    std::push_heap(beam.begin(), beam.end(), compare);
+  };
+
+  const std::vector<float> alpha = ForwardAlgorithm(inv_theta);
+  // f(eos) = Gumbel(0), as it is the perturbed score of the entire lattice.
+  push(eos_node(), nullptr, Gumbel(), 0.0);
+
+  // Reused by every expansion.
+  std::vector<float> probs, perturbed_probs;
+  for (int pos = len; pos >= 0; --pos) {
+    // A partial path only expands to the nodes ending at its position, which
+    // begin before it, so beams[pos] is complete here.
+    const NodeRange lnodes = end_nodes(pos);
+    const int end_nodes_size = lnodes.size();
+    auto &beam = beams[pos];
+    std::sort_heap(beam.begin(), beam.end(), compare);
+    for (Hypothesis *top : beam) {
+      const float Z = alpha[top->node->node_id];
+      probs.resize(end_nodes_size);
+      perturbed_probs.resize(end_nodes_size);
+      float max_score = -1e8;
+      // Calculate the marginal and perturbed scores for stochastic search
+      for (int i = 0; i < end_nodes_size; i++) {
+        const Node *lnode = lnodes[i];
+        // Calculate backwards transition score
+        probs[i] =
+            top->gx + alpha[lnode->node_id] + (inv_theta * lnode->score) - Z;
+        perturbed_probs[i] = probs[i] + Gumbel();
+        max_score = std::max(max_score, perturbed_probs[i]);
+      }
+      // Now constrain the sampled continuations to match the score of parent
+      for (int i = 0; i < end_nodes_size; i++) {
+        // Use numerically stable version of truncated Gumbel:
+        // https://arxiv.org/pdf/1903.06059.pdf appendix B.3
+        const float v = top->fx - perturbed_probs[i] +
+                        std::log1p(-std::exp(perturbed_probs[i] - max_score));
+        const float fx = top->fx - std::max(static_cast<float>(0.0), v) -
+                         std::log1p(std::exp(-std::abs(v)));
+        push(lnodes[i], top, fx, probs[i]);
+      }
+    }
+  }
+
+  auto &complete = beams[len + 1];
+  std::sort_heap(complete.begin(), complete.end(), compare);
+  std::vector<LatticePathWithScore> results(complete.size());
+  for (size_t i = 0; i < complete.size(); ++i) {
+    for (auto *n = complete[i]->next; n->next != nullptr; n = n->next) {
+      results[i].first.push_back(n->node);
+    }
+    results[i].second = complete[i]->fx;
+  }
+
+  ReleaseLargeHypothesisAllocator(&hypothesis_allocator);
+
+  return results;
+}
+
 NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
                                      int nbest_size) const {
   if (!status().ok() || normalized.empty()) {
@@ -704,7 +1147,8 @@ NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
     return {std::pair<EncodeResult, float>(Encode(normalized), 0.0)};
   }
 
-  Lattice lattice;
+  const ThreadLocalLattice scoped_lattice;
+  Lattice &lattice = *scoped_lattice;
   lattice.SetSentence(normalized);
   PopulateNodes(&lattice);
 
@@ -722,16 +1166,30 @@ NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
 
 EncodeResult Model::SampleEncode(absl::string_view normalized,
                                  float inv_theta) const {
+  return SampleEncodeWithGenerator(normalized, inv_theta, nullptr);
+}
+
+EncodeResult Model::SampleEncodeWithGenerator(
+    absl::string_view normalized, float inv_theta,
+    SampleGenerator *generator) const {
   if (!status().ok() || normalized.empty()) {
     return {};
   }
 
-  Lattice lattice;
+  EncodeResult results;
+  if (encoder_version_ == EncoderVersion::kOptimized) {
+    EncodeScratch scratch;
+    SampleEncodeOptimized(normalized, inv_theta, generator, &scratch,
+                          &results);
+    return results;
+  }
+
+  const ThreadLocalLattice scoped_lattice;
+  Lattice &lattice = *scoped_lattice;
   lattice.SetSentence(normalized);
   PopulateNodes(&lattice);
 
-  EncodeResult results;
-  for (const auto *node : lattice.Sample(inv_theta)) {
+  for (const auto *node : lattice.Sample(inv_theta, generator)) {
     results.emplace_back(node->piece, node->id);
   }
 
@@ -746,7 +1204,8 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
     return {};
   }
   NBestEncodeResult results;
-  Lattice lattice;
+  const ThreadLocalLattice scoped_lattice;
+  Lattice &lattice = *scoped_lattice;
   lattice.SetSentence(normalized);
   PopulateNodes(&lattice);
 
@@ -827,10 +1286,6 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
     }
   } else {
     while (results.size() < samples) {
-      Lattice lattice;
-      lattice.SetSentence(normalized);
-      PopulateNodes(&lattice);
-
       float score = 0.0;
       EncodeResult result;
       const std::vector<Lattice::Node *> sample = lattice.Sample(inv_theta);
@@ -847,7 +1302,8 @@ NBestEncodeResult Model::SampleEncodeAndScore(absl::string_view normalized,
 
 float Model::CalculateEntropy(absl::string_view normalized,
                               float inv_theta) const {
-  Lattice lattice;
+  const ThreadLocalLattice scoped_lattice;
+  Lattice &lattice = *scoped_lattice;
   lattice.SetSentence(normalized);
   PopulateNodes(&lattice);
 
@@ -937,86 +1393,307 @@ EncodeResult Model::EncodeOptimized(absl::string_view normalized) const {
   // Secondly, it reduces the number of fields we need to maintain in the
   // node/path structure. Specifically, there are 8 fields defined in
   // `Lattice::Node` used by the original encoder, but here in the optimized
-  // encoder we only need to define 3 fields in `BestPathNode`.
+  // encoder we only need to define 2 fields in `BestPathNode` and its score.
+  //
+  // 4. The best path score at position M is only read when the next token
+  // starts at M, and it is only written by tokens starting less than the
+  // longest piece before M. The scores therefore live in a ring buffer of
+  // `best_path_scores_size_` entries, which stays in the L1 cache however long
+  // the input is. Only the last token of the best path is kept for every
+  // position, which is needed for the backtracking.
+  //
+  // 5. No piece starting with a byte is longer than
+  // `max_piece_length_by_first_byte_` for that byte, which bounds the trie
+  // walk, and positions that no piece starts with skip the trie entirely.
+
+  EncodeResult results;
+  EncodeScratch scratch;
+  EncodeOptimized(normalized, &scratch, &results);
+  return results;
+}
 
+void Model::EncodeOptimized(absl::string_view normalized,
+                            EncodeScratch *scratch,
+                            EncodeResult *results) const {
   if (!status().ok() || normalized.empty()) {
-    return {};
+    return;
   }
-  // Represents the last node of the best path.
-  struct BestPathNode {
-    int id = -1;  // The vocab id. (maybe -1 for UNK)
-    float best_path_score =
-        0;  // The total score of the best path ending at this node.
-    int starts_at =
-        -1;  // The starting position (in utf-8) of this node. The entire best
-             // path can be constructed by backtracking along this link.
-  };
+  // Without user defined and unused pieces nor a vocabulary restriction,
+  // the pieces found need no type lookup.
+  const auto *mask = ScopedVocabularyMask::current();
+  const bool check_types = has_user_defined_or_unused_ || mask != nullptr;
+  if (trie_engine_ == kDartsTraverse) {
+    if (check_types) {
+      EncodeOptimizedWithWalker<TraverseWalker, true>(normalized, mask,
+                                                      scratch, results);
+    } else {
+      EncodeOptimizedWithWalker<TraverseWalker, false>(normalized, mask,
+                                                       scratch, results);
+    }
+  } else {
+    if (check_types) {
+      EncodeOptimizedWithWalker<UnitWalker, true>(normalized, mask, scratch,
+                                                  results);
+    } else {
+      EncodeOptimizedWithWalker<UnitWalker, false>(normalized, mask, scratch,
+                                                   results);
+    }
+  }
+}
+
+template <typename Walker, bool kCheckTypes>
+void Model::EncodeOptimizedWithWalker(absl::string_view normalized,
+                                      const VocabularyMask *mask,
+                                      EncodeScratch *scratch,
+                                      EncodeResult *results) const {
+  Walker walker(*trie_);
+  // Each node represents the last node of the best path ending there.
+  using BestPathNode = EncodeScratch::PathNode;
   const int size = normalized.size();
   const float unk_score = min_score() - kUnkPenalty;
   // The ends are exclusive.
-  std::vector<BestPathNode> best_path_ends_at(size + 1);
+  auto *best_path_ends_at = &scratch->best_path;
+  best_path_ends_at->assign(size + 1, BestPathNode());
+  // The score of position `pos` is stored at `pos & score_mask`.
+  auto &scores = scratch->best_path_scores;
+  scores.assign(best_path_scores_size_, 0.0);
+  const int score_mask = best_path_scores_size_ - 1;
   // Generate lattice on-the-fly (not stored) and update best_path_ends_at.
+  int64 num_lookups = 0, num_nodes = 0;
+  CancellationCheck cancellation;
   int starts_at = 0;
   while (starts_at < size) {
-    std::size_t node_pos = 0;
-    std::size_t key_pos = starts_at;
-    const auto best_path_score_till_here =
-        best_path_ends_at[starts_at].best_path_score;
+    // Nothing is output; the processor fails the encode.
+    if (cancellation.Cancelled()) return;
+    const auto best_path_score_till_here = scores[starts_at & score_mask];
     bool has_single_node = false;
     const int mblen =
         std::min<int>(string_util::OneCharLen(normalized.data() + starts_at),
                       size - starts_at);
-    while (key_pos < size) {
-      const int ret =
-          trie_->traverse(normalized.data(), node_pos, key_pos, key_pos + 1);
-      if (ret == -2) break;
-      if (ret >= 0) {
-        if (IsUnusedInlined(ret)) continue;
-        // Update the best path node.
-        auto &target_node = best_path_ends_at[key_pos];
-        const auto length = (key_pos - starts_at);
-        // User defined symbol receives extra bonus to always be selected.
-        const auto score = IsUserDefinedInlined(ret)
-                               ? (length * max_score_ - 0.1)
-                               : GetScoreInlined(ret);
-        const auto candidate_best_path_score =
-            score + best_path_score_till_here;
-        if (target_node.starts_at == -1 ||
-            candidate_best_path_score > target_node.best_path_score) {
-          target_node.best_path_score = candidate_best_path_score;
-          target_node.starts_at = starts_at;
-          target_node.id = ret;
-        }
-        if (!has_single_node && length == mblen) {
-          has_single_node = true;
+    const int max_length = max_piece_length_by_first_byte_[static_cast<uint8>(
+        normalized[starts_at])];
+    if (max_length > 0) {
+      walker.Reset();
+      std::size_t key_pos = starts_at;
+      const std::size_t key_end = std::min(size, starts_at + max_length);
+      while (key_pos < key_end) {
+        const int ret = walker.Next(normalized.data(), key_pos++);
+        if constexpr (encode_stats::kEnabled) ++num_lookups;
+        if (ret == -2) break;
+        if (ret >= 0) {
+          if (kCheckTypes && IsUnusedInlined(ret, mask)) continue;
+          if constexpr (encode_stats::kEnabled) ++num_nodes;
+          // Update the best path node.
+          auto &target_node = (*best_path_ends_at)[key_pos];
+          auto &target_score = scores[key_pos & score_mask];
+          const auto length = (key_pos - starts_at);
+          // User defined symbol receives extra bonus to always be selected.
+          const auto score = kCheckTypes && IsUserDefinedInlined(ret)
+                                 ? (length * max_score_ - 0.1)
+                                 : GetScoreInlined(ret);
+          const auto candidate_best_path_score =
+              score + best_path_score_till_here;
+          if (target_node.starts_at == -1 ||
+              candidate_best_path_score > target_score) {
+            target_score = candidate_best_path_score;
+            target_node.starts_at = starts_at;
+            target_node.id = ret;
+          }
+          if (!has_single_node && length == mblen) {
+            has_single_node = true;
+          }
         }
       }
     }
     if (!has_single_node) {
-      auto &target_node = best_path_ends_at[starts_at + mblen];
+      const int ends_at = starts_at + mblen;
+      auto &target_node = (*best_path_ends_at)[ends_at];
+      auto &target_score = scores[ends_at & score_mask];
       const auto candidate_best_path_score =
           unk_score + best_path_score_till_here;
       if (target_node.starts_at == -1 ||
-          candidate_best_path_score > target_node.best_path_score) {
-        target_node.best_path_score = candidate_best_path_score;
+          candidate_best_path_score > target_score) {
+        target_score = candidate_best_path_score;
         target_node.starts_at = starts_at;
         target_node.id = unk_id_;
       }
+      if constexpr (encode_stats::kEnabled) ++num_nodes;
     }
     // Move by one unicode character.
     starts_at += mblen;
   }
+  encode_stats::Add(encode_stats::kTrieLookups, num_lookups);
+  encode_stats::Add(encode_stats::kLatticeNodes, num_nodes);
   // Backtrack to identify the best path.
-  EncodeResult results;
+  const size_t results_begin = results->size();
   int ends_at = size;
   while (ends_at > 0) {
-    const auto &node = best_path_ends_at[ends_at];
-    results.emplace_back(
+    const auto &node = (*best_path_ends_at)[ends_at];
+    results->emplace_back(
         normalized.substr(node.starts_at, ends_at - node.starts_at), node.id);
     ends_at = node.starts_at;
   }
-  std::reverse(results.begin(), results.end());
-  return results;
+  std::reverse(results->begin() + results_begin, results->end());
+}
+
+void Model::SampleEncodeOptimized(absl::string_view normalized,
+                                  float inv_theta, SampleGenerator *generator,
+                                  EncodeScratch *scratch,
+                                  EncodeResult *results) const {
+  if (!status().ok() || normalized.empty()) {
+    return;
+  }
+  // Picks the specialization as EncodeOptimized() does.
+  const auto *mask = ScopedVocabularyMask::current();
+  const bool check_types = has_user_defined_or_unused_ || mask != nullptr;
+  if (trie_engine_ == kDartsTraverse) {
+    if (check_types) {
+      SampleEncodeOptimizedWithWalker<TraverseWalker, true>(
+          normalized, inv_theta, generator, mask, scratch, results);
+    } else {
+      SampleEncodeOptimizedWithWalker<TraverseWalker, false>(
+          normalized, inv_theta, generator, mask, scratch, results);
+    }
+  } else {
+    if (check_types) {
+      SampleEncodeOptimizedWithWalker<UnitWalker, true>(
+          normalized, inv_theta, generator, mask, scratch, results);
+    } else {
+      SampleEncodeOptimizedWithWalker<UnitWalker, false>(
+          normalized, inv_theta, generator, mask, scratch, results);
+    }
+  }
+}
+
+template <typename Walker, bool kCheckTypes>
+void Model::SampleEncodeOptimizedWithWalker(absl::string_view normalized,
+                                            float inv_theta,
+                                            SampleGenerator *generator,
+                                            const VocabularyMask *mask,
+                                            EncodeScratch *scratch,
+                                            EncodeResult *results) const {
+  Walker walker(*trie_);
+  const int size = normalized.size();
+  const float unk_score = min_score() - kUnkPenalty;
+  auto &arcs = scratch->sample_arcs;
+  arcs.clear();
+  auto &arcs_ending_at = scratch->sample_arcs_ending_at;
+  arcs_ending_at.assign(size + 1, std::make_pair(-1, -1));
+  auto &alpha = scratch->forward_scores;
+  alpha.assign(size + 1, 0.0);
+
+  // Every piece starting at `starts_at` is found after all the pieces ending
+  // there, so alpha[starts_at] is final when its pieces are added. The sums
+  // are accumulated in the same order as Lattice::ForwardAlgorithm().
+  auto add_arc = [&](int starts_at, int ends_at, int id, float score) {
+    auto &ending_at = arcs_ending_at[ends_at];
+    const int index = arcs.size();
+    arcs.push_back({id, starts_at, score, -1});
+    alpha[ends_at] = LogSumExp(alpha[ends_at],
+                               inv_theta * score + alpha[starts_at],
+                               ending_at.first == -1);
+    if (ending_at.first == -1) {
+      ending_at.first = index;
+    } else {
+      arcs[ending_at.second].next = index;
+    }
+    ending_at.second = index;
+  };
+
+  // Forward filtering.
+  int starts_at = 0;
+  while (starts_at < size) {
+    bool has_single_node = false;
+    const int mblen =
+        std::min<int>(string_util::OneCharLen(normalized.data() + starts_at),
+                      size - starts_at);
+    const int max_length = max_piece_length_by_first_byte_[static_cast<uint8>(
+        normalized[starts_at])];
+    if (max_length > 0) {
+      walker.Reset();
+      std::size_t key_pos = starts_at;
+      const std::size_t key_end = std::min(size, starts_at + max_length);
+      while (key_pos < key_end) {
+        const int ret = walker.Next(normalized.data(), key_pos++);
+        if (ret == -2) break;
+        if (ret >= 0) {
+          if (kCheckTypes && IsUnusedInlined(ret, mask)) continue;
+          const int length = key_pos - starts_at;
+          // User defined symbol receives extra bonus to always be selected.
+          // The bonus counts unicode characters as PopulateNodes() does.
+          const float score =
+              kCheckTypes && IsUserDefinedInlined(ret)
+                  ? (CharLength(normalized.substr(starts_at, length)) *
+                         max_score_ -
+                     0.1)
+                  : GetScoreInlined(ret);
+          add_arc(starts_at, key_pos, ret, score);
+          if (!has_single_node && length == mblen) {
+            has_single_node = true;
+          }
+        }
+      }
+    }
+    if (!has_single_node) {
+      add_arc(starts_at, starts_at + mblen, unk_id_, unk_score);
+    }
+    // Move by one unicode character.
+    starts_at += mblen;
+  }
+
+  // Backward sampling.
+  auto *mt = generator == nullptr ? random::GetRandomGenerator() : nullptr;
+  std::vector<float> probs;
+  std::vector<int> candidates;
+  const size_t results_begin = results->size();
+  int ends_at = size;
+  float Z = alpha[size];
+  while (ends_at > 0) {
+    probs.clear();
+    candidates.clear();
+    for (int a = arcs_ending_at[ends_at].first; a != -1; a = arcs[a].next) {
+      probs.push_back(std::exp(static_cast<double>(
+          alpha[arcs[a].starts_at] + inv_theta * arcs[a].score - Z)));
+      candidates.push_back(a);
+    }
+    std::discrete_distribution<int> dist(probs.begin(), probs.end());
+    const auto &arc = arcs[candidates[mt ? dist(*mt) : dist(*generator)]];
+    results->emplace_back(
+        normalized.substr(arc.starts_at, ends_at - arc.starts_at), arc.id);
+    Z = alpha[arc.starts_at];
+    ends_at = arc.starts_at;
+  }
+  // Lattice::Sample() also draws the BOS node, which keeps the generator in
+  // step with it.
+  std::discrete_distribution<int> bos_dist({1.0});
+  mt ? bos_dist(*mt) : bos_dist(*generator);
+  std::reverse(results->begin() + results_begin, results->end());
+}
+
+// Encodes the inputs one after another. Running the Viterbi of 8 inputs in
+// turns, one byte or one trie walk at a time as the threads of a GPU warp
+// would, gives the same results but was 1.4-2.5x slower on botchan.txt: the
+// trie stays in the cache, so there is little memory latency to overlap,
+// while the suspended walks lose their registers and branch history. On
+// queries of 5-20 characters, 8 or 16 lanes prefetching the next unit of
+// their walks were still 1.3-1.5x slower with 8k-500k pieces, and only
+// broke even with 2M pieces. The walks from the successive positions of
+// one input are independent already, so the out-of-order core overlaps
+// their loads without the interleaving.
+void Model::EncodeBatch(const std::vector<absl::string_view> &inputs,
+                        EncodeScratch *scratch,
+                        EncodeBatchResult *output) const {
+  if (encoder_version_ != EncoderVersion::kOptimized) {
+    ModelInterface::EncodeBatch(inputs, scratch, output);
+    return;
+  }
+
+  output->pieces.clear();
+  output->offsets.assign(1, 0);
+  for (const auto normalized : inputs) {
+    EncodeOptimized(normalized, scratch, &output->pieces);
+    output->offsets.push_back(output->pieces.size());
+  }
 }
 }  // namespace unigram
 }  // namespace sentencepiece
@@ -15,6 +15,7 @@
 #ifndef UNIGRAM_MODEL_H_
 #define UNIGRAM_MODEL_H_
 
+#include <array>
 #include <memory>
 #include <string>
 #include <utility>
@@ -48,6 +49,25 @@ class Lattice {
     std::string DebugString() const;
   };
 
+  // Nodes starting or ending at the same position, in the insertion order.
+  class NodeRange {
+   public:
+    NodeRange(Node *const *begin, Node *const *end)
+        : begin_(begin), end_(end) {}
+
+    Node *const *begin() const { return begin_; }
+    Node *const *end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    Node *operator[](size_t i) const { return begin_[i]; }
+    Node *front() const { return *begin_; }
+    Node *back() const { return *(end_ - 1); }
+
+   private:
+    Node *const *begin_;
+    Node *const *end_;
+  };
+
   // Returns bos node.
   Node *bos_node() const;
 
@@ -55,10 +75,12 @@ class Lattice {
   Node *eos_node() const;
 
   // Returns nodes starting at |pos|.
-  const std::vector<Node *> &begin_nodes(int pos) const;
+  // The range is invalidated by Insert(), SetSentence() and Clear().
+  NodeRange begin_nodes(int pos) const;
 
   // Returns nodes ending at |pos|.
-  const std::vector<Node *> &end_nodes(int pos) const;
+  // The range is invalidated by Insert(), SetSentence() and Clear().
+  NodeRange end_nodes(int pos) const;
 
   // Returns Unicode character length.
   int size() const;
@@ -66,6 +88,12 @@ class Lattice {
   // Returns multi-byte (utf8) length.
   int utf8_size() const;
 
+  // Returns the number of nodes, including BOS and EOS.
+  size_t num_nodes() const { return node_allocator_.size(); }
+
+  // Returns the number of nodes the allocated chunks can hold.
+  size_t node_capacity() const { return node_allocator_.capacity(); }
+
   // Returns the substring of sentence. sentence[pos:]
   const char *surface(int pos) const;
 
@@ -98,8 +126,10 @@ class Lattice {
 
   // Samples one path from the lattice according to the
   // generation probability (Product of piece probabilities).
-  // `theta` is a smoothing parameter.
-  std::vector<Node *> Sample(float theta);
+  // `theta` is a smoothing parameter. The numbers are drawn from
+  // `generator`, or from the thread-local generator when it is null.
+  std::vector<Node *> Sample(float theta,
+                             SampleGenerator *generator = nullptr);
 
   // Calculates the entropy of the lattice.
   float CalculateEntropy(float theta) const;
@@ -110,34 +140,79 @@ class Lattice {
   //    (*expected)[node->id] += marginal_prob_of_node * freq;
   //  }
   // Returns the log-likelihood of this sentence.
-  float PopulateMarginal(float freq, std::vector<float> *expected) const;
+  // With |beam| > 0, the nodes on no path within |beam| of the log
+  // probability of the Viterbi path are skipped, and only the remaining
+  // paths are summed.
+  float PopulateMarginal(float freq, std::vector<float> *expected,
+                         float beam = 0.0) const;
 
  private:
   // Returns new node.
   // Lattice class has the ownership of the returned value.
   Node *NewNode();
 
+  // Rebuilds the begin/end indexes if nodes were added since the last call.
+  void BuildIndex() const;
+
+  // PopulateMarginal() with |beam| > 0.
+  float PopulateBeamMarginal(float freq, float beam,
+                             std::vector<float> *expected) const;
+
+  // NBest(nbest_size, false, 0.0) for nbest_size <= K. Keeps the K best
+  // paths from BOS to every node, which avoids the agenda of the A* search.
+  template <size_t K>
+  std::vector<LatticePathWithScore> NBestViterbi(size_t nbest_size);
+
+  // NBest(nbest_size, true, theta): draws `nbest_size` paths without
+  // replacement by their Gumbel-perturbed scores, which are returned, with a
+  // stochastic beam of `nbest_size` partial paths per position.
+  std::vector<LatticePathWithScore> SampleWithoutReplacement(size_t nbest_size,
+                                                             float theta);
+
+  // NBest() uses NBestViterbi() up to this size.
+  static constexpr size_t kMaxNBestViterbiSize = 16;
+
+  static constexpr size_t kBosNodeId = 0;
+  static constexpr size_t kEosNodeId = 1;
+
   absl::string_view sentence_;
   std::vector<const char *> surface_;
-  std::vector<std::vector<Node *>> begin_nodes_;
-  std::vector<std::vector<Node *>> end_nodes_;
   model::FreeList<Node> node_allocator_;
+
+  // Nodes sorted by the begin (end) position. The nodes beginning (ending) at
+  // `pos` are [begin_offsets_[pos], begin_offsets_[pos + 1]) of begin_index_.
+  // They are built on demand, so the buffers are reused across sentences.
+  mutable bool index_is_valid_ = false;
+  mutable std::vector<int> begin_offsets_;
+  mutable std::vector<int> end_offsets_;
+  mutable std::vector<Node *> begin_index_;
+  mutable std::vector<Node *> end_index_;
 };
 
 class Model : public ModelInterface {
  public:
-  explicit Model(const ModelProto &model_proto);
+  // Maps the trie from `compiled_model` if it is given.
+  explicit Model(const ModelProto &model_proto,
+                 std::shared_ptr<const CompiledModel> compiled_model = nullptr);
   Model() {}
   ~Model() override;
 
   EncodeResult Encode(absl::string_view normalized) const override;
 
+  void EncodeBatch(const std::vector<absl::string_view> &inputs,
+                   EncodeScratch *scratch,
+                   EncodeBatchResult *output) const override;
+
   NBestEncodeResult NBestEncode(absl::string_view normalized,
                                 int nbest_size) const override;
 
   EncodeResult SampleEncode(absl::string_view normalized,
                             float theta) const override;
 
+  EncodeResult SampleEncodeWithGenerator(
+      absl::string_view normalized, float theta,
+      SampleGenerator *generator) const override;
+
   NBestEncodeResult SampleEncodeAndScore(absl::string_view normalized,
                                          float theta, int samples, bool wor,
                                          bool include_best) const override;
@@ -169,6 +244,11 @@ class Model : public ModelInterface {
   // Returns a vocab id of |piece|.
   int PieceToId(absl::string_view piece) const override;
 
+  void AppendCompiledSections(
+      CompiledModel::Sections *sections) const override;
+
+  void AddMemoryUsage(MemoryUsage *usage) const override;
+
   // Verifies if two outputs are equivalent by comparing their scores.
   bool VerifyOutputsEquivalent(absl::string_view expected,
                                absl::string_view actual) const override;
@@ -185,8 +265,21 @@ class Model : public ModelInterface {
   // Returns the current encoder version in use.
   EncoderVersion GetEncoderVersion() const { return encoder_version_; }
 
+  // How the optimized encoder walks the trie. Both give identical results.
+  enum TrieEngine {
+    kUnitWalker,     // Reads the double-array units directly (default).
+    kDartsTraverse,  // Calls Darts::DoubleArray::traverse() per byte.
+  };
+
+  void SetTrieEngine(TrieEngine trie_engine) { trie_engine_ = trie_engine; }
+
+  TrieEngine GetTrieEngine() const { return trie_engine_; }
+
  protected:
-  // Builds a Trie index.
+  // Encode() without the word cache.
+  EncodeResult EncodeUncached(absl::string_view normalized) const;
+
+  // Builds a Trie index, or maps a prebuilt one.
   void BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces);
 
   // The optimized Viterbi encode.
@@ -200,6 +293,42 @@ class Model : public ModelInterface {
   // For detailed explanations please see the comments inside the function body.
   EncodeResult EncodeOptimized(absl::string_view normalized) const;
 
+  // Appends the result of EncodeOptimized() to `results`, using the buffers
+  // of `scratch`.
+  void EncodeOptimized(absl::string_view normalized, EncodeScratch *scratch,
+                       EncodeResult *results) const;
+
+  // EncodeOptimized() with the trie walker of `trie_engine_`, looking up the
+  // types of the pieces found only if `kCheckTypes`, i.e., if the model has
+  // user defined or unused pieces or the vocabulary is restricted by `mask`.
+  template <typename Walker, bool kCheckTypes>
+  void EncodeOptimizedWithWalker(absl::string_view normalized,
+                                 const VocabularyMask *mask,
+                                 EncodeScratch *scratch,
+                                 EncodeResult *results) const;
+
+  // The optimized forward-filtering backward-sampling. Like EncodeOptimized()
+  // it walks the utf-8 input once without building a Lattice, keeping only
+  // the forward score of every position and the pieces found, and appends a
+  // sample to `results`. The pieces are visited and the random generator is
+  // drawn in the same order as Lattice::Sample(), so both return the same
+  // segmentation for the same generator state. The numbers are drawn from
+  // `generator`, or from the thread-local generator when it is null.
+  void SampleEncodeOptimized(absl::string_view normalized, float inv_theta,
+                             SampleGenerator *generator,
+                             EncodeScratch *scratch,
+                             EncodeResult *results) const;
+
+  // SampleEncodeOptimized() with the trie walker of `trie_engine_`, as
+  // EncodeOptimizedWithWalker().
+  template <typename Walker, bool kCheckTypes>
+  void SampleEncodeOptimizedWithWalker(absl::string_view normalized,
+                                       float inv_theta,
+                                       SampleGenerator *generator,
+                                       const VocabularyMask *mask,
+                                       EncodeScratch *scratch,
+                                       EncodeResult *results) const;
+
   float min_score_ = 0.0;
   float max_score_ = 0.0;
   std::unique_ptr<Darts::DoubleArray> trie_;
@@ -208,8 +337,23 @@ class Model : public ModelInterface {
   // to the maximum size of shared common prefix in the sentence pieces.
   int trie_results_size_;
 
+  // Maps the values of `trie_` to the vocab ids, or to -1 for the pieces
+  // removed since the trie was built. Empty if the values are the ids.
+  // Lets TrainerModel drop pieces without rebuilding the trie.
+  std::vector<int> trie_id_map_;
+
+  // Maximum byte length of the pieces in the trie, indexed by their first
+  // byte. 0 means no piece starts with the byte.
+  std::array<int, 256> max_piece_length_by_first_byte_{};
+
+  // Size of EncodeScratch::best_path_scores. A power of two larger than any
+  // step of the optimized Viterbi, i.e., the longest piece or one character.
+  int best_path_scores_size_ = 0;
+
   // encoder version.
   EncoderVersion encoder_version_ = kOptimized;
+
+  TrieEngine trie_engine_ = kUnitWalker;
 };
 
 }  // namespace unigram
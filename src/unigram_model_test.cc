@@ -16,6 +16,7 @@
 
 #include <cmath>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -192,6 +193,45 @@ void InsertWithScoreAndId(Lattice *lattice, int pos, int length, float score,
   node->id = id;
 }
 
+TEST(LatticeTest, ReuseTest) {
+  Lattice lattice;
+  lattice.SetSentence("ABCDEFGH");
+  for (int pos = 0; pos < 8; ++pos) lattice.Insert(pos, 1);
+  lattice.Insert(0, 8);
+  EXPECT_EQ(2, lattice.begin_nodes(0).size());
+  EXPECT_EQ(2, lattice.end_nodes(8).size());
+
+  lattice.SetSentence("あい");
+  EXPECT_EQ(0, lattice.begin_nodes(0).size());
+  EXPECT_EQ(lattice.bos_node(), lattice.end_nodes(0).front());
+  EXPECT_EQ(lattice.eos_node(), lattice.begin_nodes(2).front());
+
+  // Nodes inserted after a lookup are found by the next one.
+  Lattice::Node *node[3];
+  node[0] = lattice.Insert(0, 1);
+  EXPECT_EQ(1, lattice.begin_nodes(0).size());
+  node[1] = lattice.Insert(1, 1);
+  node[2] = lattice.Insert(0, 2);
+  EXPECT_EQ(2, node[2]->node_id - node[0]->node_id);
+  EXPECT_EQ("あい", node[2]->piece);
+  EXPECT_EQ(0.0, node[2]->score);
+  EXPECT_EQ(nullptr, node[2]->prev);
+
+  EXPECT_EQ(2, lattice.begin_nodes(0).size());
+  EXPECT_EQ(node[0], lattice.begin_nodes(0)[0]);
+  EXPECT_EQ(node[2], lattice.begin_nodes(0)[1]);
+  EXPECT_EQ(1, lattice.begin_nodes(1).size());
+  EXPECT_EQ(node[1], lattice.begin_nodes(1)[0]);
+  EXPECT_EQ(1, lattice.end_nodes(1).size());
+  EXPECT_EQ(node[0], lattice.end_nodes(1)[0]);
+  EXPECT_EQ(2, lattice.end_nodes(2).size());
+  EXPECT_EQ(node[1], lattice.end_nodes(2)[0]);
+  EXPECT_EQ(node[2], lattice.end_nodes(2)[1]);
+
+  node[1]->score = 1.0;
+  EXPECT_EQ("あ い", GetTokenized(lattice.Viterbi().first));
+}
+
 TEST(LatticeTest, ViterbiTest) {
   Lattice lattice;
   lattice.SetSentence("ABC");
@@ -237,6 +277,34 @@ TEST(LatticeTest, NBestTest) {
   EXPECT_EQ(nbests1.size(), 1);
 }
 
+TEST(LatticeTest, NBestViterbiTest) {
+  // Compares the k-best Viterbi used for small sizes with the A* search.
+  const int kMaxSize = 20;
+  for (int trial = 0; trial < 100; ++trial) {
+    Lattice lattice;
+    const int length = 1 + rand() % 12;
+    lattice.SetSentence(std::string(length, 'a'));
+    for (int pos = 0; pos < length; ++pos) {
+      for (int len = 1; pos + len <= length && len <= 4; ++len) {
+        if (len > 1 && rand() % 3 == 0) continue;
+        InsertWithScore(&lattice, pos, len, -10.0 * rand() / RAND_MAX);
+      }
+    }
+
+    const auto expected = lattice.NBest(kMaxSize, false, 0.0);
+    for (const int nbest_size : {2, 3, 4, 7, 8, 16}) {
+      const auto actual = lattice.NBest(nbest_size, false, 0.0);
+      EXPECT_EQ(std::min<size_t>(nbest_size, expected.size()), actual.size());
+      for (size_t i = 0; i < actual.size(); ++i) {
+        EXPECT_EQ(GetTokenized(expected[i].first),
+                  GetTokenized(actual[i].first));
+        EXPECT_EQ(expected[i].first, actual[i].first);
+        EXPECT_EQ(expected[i].second, actual[i].second);
+      }
+    }
+  }
+}
+
 TEST(LatticeTest, NBestSampleTest) {
   Lattice lattice;
   lattice.SetSentence("ABC");
@@ -318,6 +386,55 @@ TEST(LatticeTest, NBestSampleTest) {
   }
 }
 
+TEST(LatticeTest, NBestSampleManyTest) {
+  Lattice lattice;
+  lattice.SetSentence("ABC");
+
+  InsertWithScore(&lattice, 0, 1, 0.0);  // A
+  InsertWithScore(&lattice, 1, 1, 0.0);  // B
+  InsertWithScore(&lattice, 2, 1, 0.1);  // C
+  InsertWithScore(&lattice, 0, 2, 0.2);  // AB
+  InsertWithScore(&lattice, 1, 2, 0.5);  // BC
+  InsertWithScore(&lattice, 0, 3, 1.0);  // ABC
+
+  // Asking for more samples than paths returns all of them.
+  for (int trial = 0; trial < 100; ++trial) {
+    std::set<std::string> paths;
+    for (const auto &nbest : lattice.NBest(10, true, 0.5)) {
+      paths.insert(GetTokenized(nbest.first));
+    }
+    EXPECT_EQ(4, paths.size());
+  }
+
+  // Every node of length 1 to 3 over a long sentence, whose paths are many
+  // more than the samples.
+  const std::string sentence(60, 'a');
+  lattice.SetSentence(sentence);
+  for (int pos = 0; pos < sentence.size(); ++pos) {
+    for (int length = 1; length <= 3 && pos + length <= sentence.size();
+         ++length) {
+      InsertWithScoreAndId(&lattice, pos, length, -0.5 * length, pos);
+    }
+  }
+
+  for (const size_t num_samples : {1, 16, 129}) {
+    const auto nbests = lattice.NBest(num_samples, true, 1.0);
+    EXPECT_EQ(num_samples, nbests.size());
+    std::set<std::vector<Lattice::Node *>> paths;
+    for (size_t i = 0; i < nbests.size(); ++i) {
+      paths.insert(nbests[i].first);
+      std::string surface;
+      for (const auto *node : nbests[i].first) {
+        surface.append(node->piece.data(), node->piece.size());
+      }
+      EXPECT_EQ(sentence, surface);
+      // Sorted by the perturbed score.
+      if (i > 0) EXPECT_GE(nbests[i - 1].second, nbests[i].second);
+    }
+    EXPECT_EQ(num_samples, paths.size());
+  }
+}
+
 TEST(LatticeTest, CalculateEntropyTest) {
   Lattice lattice;
   lattice.SetSentence("ABC");
@@ -426,6 +543,39 @@ TEST(LatticeTest, PopulateMarginalTest) {
   EXPECT_NEAR(std::log(static_cast<double>(Z)), logZ, 0.001);
 }
 
+TEST(LatticeTest, PopulateBeamMarginalTest) {
+  Lattice lattice;
+  lattice.SetSentence("ABC");
+
+  InsertWithScoreAndId(&lattice, 0, 1, 1.0, 0);  // A
+  InsertWithScoreAndId(&lattice, 1, 1, 1.2, 1);  // B
+  InsertWithScoreAndId(&lattice, 2, 1, 2.5, 2);  // C
+  InsertWithScoreAndId(&lattice, 0, 2, 3.0, 3);  // AB
+  InsertWithScoreAndId(&lattice, 1, 2, 4.0, 4);  // BC
+  InsertWithScoreAndId(&lattice, 0, 3, 2.0, 5);  // ABC
+
+  // A wide beam keeps all the paths.
+  std::vector<float> exact(6, 0.0), wide(6, 0.0);
+  const float logZ = lattice.PopulateMarginal(1.0, &exact);
+  EXPECT_NEAR(logZ, lattice.PopulateMarginal(1.0, &wide, 100.0), 0.001);
+  for (int i = 0; i < 6; ++i) EXPECT_NEAR(exact[i], wide[i], 0.001);
+
+  // The best paths through B (A B C) and ABC are more than 0.6 below the
+  // best path AB C, which leaves AB C and A BC.
+  std::vector<float> probs(6, 0.0);
+  const float p2 = exp(3.0 + 2.5);
+  const float p3 = exp(1.0 + 4.0);
+  const float Z = p2 + p3;
+  const float beam_logZ = lattice.PopulateMarginal(1.0, &probs, 0.6);
+  EXPECT_NEAR(p3 / Z, probs[0], 0.001);  // A
+  EXPECT_NEAR(0.0, probs[1], 0.001);     // B
+  EXPECT_NEAR(p2 / Z, probs[2], 0.001);  // C
+  EXPECT_NEAR(p2 / Z, probs[3], 0.001);  // AB
+  EXPECT_NEAR(p3 / Z, probs[4], 0.001);  // BC
+  EXPECT_NEAR(0.0, probs[5], 0.001);     // ABC
+  EXPECT_NEAR(std::log(static_cast<double>(Z)), beam_logZ, 0.001);
+}
+
 TEST(LatticeTest, SampleTest) {
   Lattice lattice;
   lattice.SetSentence("ABC");
@@ -950,6 +1100,177 @@ TEST_P(UnigramModelTest, VerifyOutputsEquivalent) {
   EXPECT_FALSE(model.VerifyOutputsEquivalent("ab", "a b"));
 }
 
+TEST(UnigramModelTest, TrieEngineTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+  const std::vector<std::string> kPieces = {
+      "a", "b", "c", "ab", "bc", "abc", "ca", "あ", "あい", "い", "cab", "bb"};
+  for (size_t i = 0; i < kPieces.size(); ++i) {
+    AddPiece(&model_proto, kPieces[i], 0.1 * (i % 5));
+  }
+  // "bc" is unused and "bb" is user defined.
+  model_proto.mutable_pieces(7)->set_type(ModelProto::SentencePiece::UNUSED);
+  model_proto.mutable_pieces(14)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+
+  Model model(model_proto);
+  EXPECT_EQ(Model::kUnitWalker, model.GetTrieEngine());
+
+  const std::vector<std::string> kChars = {"a", "b", "c", "x", "あ", "い"};
+  for (int trial = 0; trial < 1000; ++trial) {
+    std::string input;
+    const int length = rand() % 20;
+    for (int i = 0; i < length; ++i) input += kChars[rand() % kChars.size()];
+    model.SetTrieEngine(Model::kUnitWalker);
+    const auto expected = model.Encode(input);
+    model.SetTrieEngine(Model::kDartsTraverse);
+    EXPECT_EQ(expected, model.Encode(input));
+  }
+}
+
+TEST(UnigramModelTest, PrecompiledTrieTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+  const std::vector<std::string> kPieces = {
+      "a", "b", "c", "ab", "bc", "abc", "ca", "あ", "あい", "い", "cab", "bb"};
+  for (size_t i = 0; i < kPieces.size(); ++i) {
+    AddPiece(&model_proto, kPieces[i], 0.1 * (i % 5));
+  }
+  model_proto.mutable_pieces(7)->set_type(ModelProto::SentencePiece::UNUSED);
+  model_proto.mutable_pieces(14)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+
+  const Model model(model_proto);
+  const std::string trie = model.SerializePrecompiledTrie();
+  EXPECT_FALSE(trie.empty());
+
+  ModelProto precompiled_proto = model_proto;
+  precompiled_proto.set_precompiled_trie(trie);
+  const Model precompiled(precompiled_proto);
+  EXPECT_TRUE(precompiled.status().ok());
+  EXPECT_EQ(trie, precompiled.SerializePrecompiledTrie());
+
+  // The user defined symbols are matched in place.
+  const auto matcher = precompiled.prefix_matcher()->trie_array();
+  const auto &blob = precompiled_proto.precompiled_trie();
+  EXPECT_TRUE(matcher.data() >= blob.data() &&
+              matcher.data() + matcher.size() <= blob.data() + blob.size());
+  EXPECT_EQ(2, precompiled.prefix_matcher()->PrefixMatch("bbc"));
+
+  for (int id = 0; id < model_proto.pieces_size(); ++id) {
+    EXPECT_EQ(id, precompiled.PieceToId(model_proto.pieces(id).piece()));
+  }
+  const std::vector<std::string> kChars = {"a", "b", "c", "x", "あ", "い"};
+  for (int trial = 0; trial < 1000; ++trial) {
+    std::string input;
+    const int length = rand() % 20;
+    for (int i = 0; i < length; ++i) input += kChars[rand() % kChars.size()];
+    EXPECT_EQ(model.Encode(input), precompiled.Encode(input));
+  }
+
+  // The tries are rebuilt when the pieces are changed after they are built.
+  ModelProto stale_proto = precompiled_proto;
+  stale_proto.mutable_pieces(4)->set_piece("z");
+  const Model stale(stale_proto);
+  EXPECT_TRUE(stale.status().ok());
+  EXPECT_EQ(4, stale.PieceToId("z"));
+  EXPECT_EQ(0, stale.PieceToId("b"));
+  EXPECT_EQ(EncodeResult({{"z", 4}, {"z", 4}}), stale.Encode("zz"));
+
+  // So are broken ones.
+  ModelProto broken_proto = model_proto;
+  broken_proto.set_precompiled_trie(trie.substr(0, trie.size() - 5));
+  const Model broken(broken_proto);
+  EXPECT_TRUE(broken.status().ok());
+  EXPECT_EQ(model.Encode("abcab"), broken.Encode("abcab"));
+
+  // And corrupted ones of the right size.
+  std::string corrupted = trie;
+  corrupted[corrupted.size() / 2] ^= 0x55;
+  ModelProto corrupted_proto = model_proto;
+  corrupted_proto.set_precompiled_trie(corrupted);
+  const Model rebuilt(corrupted_proto);
+  EXPECT_TRUE(rebuilt.status().ok());
+  EXPECT_EQ(trie, rebuilt.SerializePrecompiledTrie());
+  for (int id = 0; id < model_proto.pieces_size(); ++id) {
+    EXPECT_EQ(id, rebuilt.PieceToId(model_proto.pieces(id).piece()));
+  }
+  EXPECT_EQ(model.Encode("abcab"), rebuilt.Encode("abcab"));
+}
+
+TEST(UnigramModelTest, LongPieceAndLongInputTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+  // Dyadic scores keep the path scores exact, so ties compare equal.
+  AddPiece(&model_proto, "a", -1.0);
+  AddPiece(&model_proto, "b", -2.0);
+  AddPiece(&model_proto, "ab", -2.5);
+  AddPiece(&model_proto, std::string(33, 'a'), -4.0);
+  AddPiece(&model_proto, "あ", -1.5);
+  AddPiece(&model_proto, "ああああああ", -3.0);
+  AddPiece(&model_proto, std::string(17, 'b') + "あ", -0.5);
+
+  Model model(model_proto);
+  const std::vector<std::string> kChars = {"a", "a", "a", "b", "x", "あ"};
+  for (int trial = 0; trial < 20; ++trial) {
+    std::string input;
+    const int length = 1000 + rand() % 1000;
+    for (int i = 0; i < length; ++i) {
+      // Long runs of the same character match the long pieces.
+      const std::string &c = kChars[rand() % kChars.size()];
+      for (int n = rand() % 40; n >= 0; --n) input += c;
+    }
+    model.SetEncoderVersion(Model::kOriginal);
+    const auto expected = model.Encode(input);
+    model.SetEncoderVersion(Model::kOptimized);
+    const auto actual = model.Encode(input);
+    std::string joined;
+    for (const auto &p : actual) joined.append(p.first.data(), p.first.size());
+    EXPECT_EQ(input, joined);
+    std::vector<std::string> expected_pieces, actual_pieces;
+    for (const auto &p : expected) expected_pieces.emplace_back(p.first);
+    for (const auto &p : actual) actual_pieces.emplace_back(p.first);
+    EXPECT_TRUE(model.VerifyOutputsEquivalent(
+        absl::StrJoin(expected_pieces, " "), absl::StrJoin(actual_pieces, " ")));
+  }
+}
+
+TEST(UnigramModelTest, SampleEncodeOptimizedTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+  const std::vector<std::string> kPieces = {
+      "a", "b", "c", "ab", "bc", "abc", "ca", "あ", "あい", "い", "cab", "bb"};
+  for (size_t i = 0; i < kPieces.size(); ++i) {
+    AddPiece(&model_proto, kPieces[i], -0.3 * (i % 5) - 0.5);
+  }
+  // "bc" is unused, and "bb" and "あい" are user defined.
+  model_proto.mutable_pieces(7)->set_type(ModelProto::SentencePiece::UNUSED);
+  model_proto.mutable_pieces(11)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+  model_proto.mutable_pieces(14)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+
+  Model model(model_proto);
+  auto *mt = random::GetRandomGenerator();
+  const std::vector<std::string> kChars = {"a", "b", "c", "x", "あ", "い"};
+  for (int trial = 0; trial < 300; ++trial) {
+    std::string input;
+    const int length = rand() % 30 + 1;
+    for (int i = 0; i < length; ++i) input += kChars[rand() % kChars.size()];
+    for (const float alpha : {0.0, 0.3, 1.0}) {
+      // Two samples in a row check that the generator is left in the same
+      // state.
+      model.SetEncoderVersion(Model::kOriginal);
+      mt->seed(trial);
+      const auto expected1 = model.SampleEncode(input, alpha);
+      const auto expected2 = model.SampleEncode(input, alpha);
+      for (const auto engine : {Model::kUnitWalker, Model::kDartsTraverse}) {
+        model.SetEncoderVersion(Model::kOptimized);
+        model.SetTrieEngine(engine);
+        mt->seed(trial);
+        EXPECT_EQ(expected1, model.SampleEncode(input, alpha));
+        EXPECT_EQ(expected2, model.SampleEncode(input, alpha));
+      }
+    }
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(ParametrizedUnigramModelTests, UnigramModelTest,
                          test::ValuesIn(GetEncoderVersions()));
 
@@ -16,22 +16,33 @@
 
 #include <algorithm>
 #include <cfloat>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <functional>
 #include <memory>
 #include <numeric>
+#include <set>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "filesystem.h"
+#include "memory_usage.h"
 #include "normalizer.h"
 #include "pretokenizer_for_training.h"
 #include "sentencepiece_trainer.h"
 #include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/match.h"
 #include "third_party/absl/strings/numbers.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_format.h"
 #include "third_party/absl/strings/str_replace.h"
 #include "third_party/absl/strings/str_split.h"
+#include "third_party/absl/strings/strip.h"
+#include "third_party/darts_clone/darts.h"
 #include "third_party/esaxx/esa.hxx"  // Suffix array library.
 #include "trainer_interface.h"
 #include "unicode_script.h"
@@ -43,6 +54,178 @@ namespace {
 
 constexpr char32 kSentenceBoundary = 0x0000;
 
+// Calls `fn` with the windows of `sentence` of at most `window` characters
+// in order, or with the whole sentence if `window` is 0. A window ends
+// before the last whitespace in it, if any, or after it with `ws_suffix`
+// (see TrainerSpec::treat_whitespace_as_suffix), so that the pieces
+// beginning or ending with a whitespace are kept whole. See
+// TrainerSpec::e_step_window_size.
+template <typename Fn>
+void ForEachWindow(absl::string_view sentence, int window, bool ws_suffix,
+                   const Fn &fn) {
+  // Windows count characters, which are never more than the bytes.
+  if (window <= 0 || sentence.size() <= static_cast<size_t>(window)) {
+    fn(sentence);
+    return;
+  }
+  const absl::string_view ws = TrainerInterface::kWSStr;
+  while (!sentence.empty()) {
+    size_t end = 0, cut = 0;
+    for (int n = 0; n < window && end < sentence.size(); ++n) {
+      if (absl::StartsWith(sentence.substr(end), ws)) {
+        if (ws_suffix) {
+          cut = end + ws.size();
+        } else if (end > 0) {
+          cut = end;
+        }
+      }
+      end += std::min<size_t>(string_util::OneCharLen(sentence.data() + end),
+                              sentence.size() - end);
+    }
+    if (end == sentence.size() || cut == 0) cut = end;
+    fn(sentence.substr(0, cut));
+    sentence.remove_prefix(cut);
+  }
+}
+
+// Splits `text` at kSentenceBoundary, skipping empty segments.
+std::vector<UnicodeText> SplitIntoSegments(const UnicodeText &text) {
+  std::vector<UnicodeText> segments;
+  auto begin = text.begin();
+  while (begin != text.end()) {
+    const auto end = std::find(begin, text.end(), kSentenceBoundary);
+    if (begin != end) segments.emplace_back(begin, end);
+    if (end == text.end()) break;
+    begin = end + 1;
+  }
+  return segments;
+}
+
+// Number of vocabulary entries reduced at once when merging
+// the per-thread accumulators.
+constexpr size_t kReduceGrainSize = 4096;
+
+// Number of pieces resegmented at once when pruning.
+constexpr size_t kPruneGrainSize = 256;
+
+// Number of the lines of seed_sentencepieces_file validated at once.
+constexpr size_t kSeedBatchSize = 1 << 16;
+
+// Orders the pieces by their scores, and then by the pieces, as Sorted().
+bool IsHigherScored(const std::pair<std::string, float> &p1,
+                    const std::pair<std::string, float> &p2) {
+  return p1.second > p2.second ||
+         (p1.second == p2.second && p1.first < p2.first);
+}
+
+// Keeps the `size` highest scored pieces of `pieces`, unordered.
+void KeepHighestScored(size_t size, TrainerModel::SentencePieces *pieces) {
+  if (pieces->size() <= size) return;
+  std::nth_element(pieces->begin(), pieces->begin() + size, pieces->end(),
+                   IsHigherScored);
+  pieces->resize(size);
+}
+
+// Number of consecutive sentences read at once by a mini-batch of
+// em_mini_batch_size, which takes every chunk of its residue, so that it
+// samples the whole corpus however its sentences are ordered.
+constexpr size_t kMiniBatchChunkSize = 64;
+
+// The k-th (0-based) mini-batch of an EM round of em_mini_batch_size is
+// interpolated with the step size (k + 1)^-kStepwiseEMDecay, so that the
+// first one is taken as is. A decay in (0.5, 1] makes the running counts
+// converge. See Liang and Klein, "Online EM for Unsupervised Models", 2009.
+constexpr double kStepwiseEMDecay = 0.7;
+
+// The files of distributed training. A step file holds the step number,
+// the DistributedStep, the number of sentences and the pieces with their
+// scores. A result file holds the step number, the process id, the
+// objective, the number of tokens and the counts as a float array in the
+// native byte order.
+constexpr char kDistributedStepMagic[] = "SPMDSTEP";
+constexpr char kDistributedResultMagic[] = "SPMDRSLT";
+
+// Interval of polling the files of the other processes.
+constexpr int kDistributedPollMillis = 50;
+
+std::string GetDistributedStepFile(absl::string_view dirname, int64 step) {
+  return util::JoinPath(dirname, absl::StrFormat("step-%08lld",
+                                                 static_cast<long long>(step)));
+}
+
+std::string GetDistributedResultFile(absl::string_view dirname, int64 step,
+                                     int process_id) {
+  return util::JoinPath(
+      dirname, absl::StrFormat("result-%08lld-%04d",
+                               static_cast<long long>(step), process_id));
+}
+
+void AppendString(absl::string_view str, std::string *output) {
+  sentence_record::AppendVarint(str.size(), output);
+  output->append(str.data(), str.size());
+}
+
+bool ConsumeString(absl::string_view *input, absl::string_view *str) {
+  uint64 size = 0;
+  if (!sentence_record::ConsumeVarint(input, &size) || input->size() < size) {
+    return false;
+  }
+  *str = input->substr(0, size);
+  input->remove_prefix(size);
+  return true;
+}
+
+void AppendFloat(float value, std::string *output) {
+  uint32 bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  sentence_record::AppendVarint(bits, output);
+}
+
+bool ConsumeFloat(absl::string_view *input, float *value) {
+  uint64 bits = 0;
+  if (!sentence_record::ConsumeVarint(input, &bits)) return false;
+  const uint32 bits32 = bits;
+  memcpy(value, &bits32, sizeof(bits32));
+  return true;
+}
+
+// Writes `data` through a temporary file, so that the processes polling
+// for `filename` never read a partial file.
+util::Status WriteFileAtomically(const std::string &filename,
+                                 absl::string_view data) {
+  const std::string tmp_filename = absl::StrCat(filename, ".tmp");
+  {
+    auto output = filesystem::NewWritableFile(tmp_filename, true);
+    RETURN_IF_ERROR(output->status());
+    CHECK_OR_RETURN(output->Write(data));
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_filename, filename, ec);
+  CHECK_OR_RETURN(!ec) << ec.message();
+  return util::OkStatus();
+}
+
+// Waits until `filename` exists and reads it. Fails after `timeout_sec`
+// seconds unless `timeout_sec` is 0.
+util::Status WaitAndReadFile(const std::string &filename, int timeout_sec,
+                             std::string *data) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+  std::error_code ec;
+  while (!std::filesystem::exists(filename, ec)) {
+    if (timeout_sec > 0 && std::chrono::steady_clock::now() >= deadline) {
+      return util::StatusBuilder(util::StatusCode::kDeadlineExceeded, GTL_LOC)
+             << "No " << filename << " after " << timeout_sec << " seconds.";
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kDistributedPollMillis));
+  }
+  auto input = filesystem::NewReadableFile(filename, true);
+  RETURN_IF_ERROR(input->status());
+  CHECK_OR_RETURN(input->ReadAll(data));
+  return util::OkStatus();
+}
+
 double Digamma(double x) {
   double result = 0.0;
   for (; x < 7; ++x) result -= 1 / x;
@@ -113,6 +296,41 @@ const TrainerModel::SentencePieces &TrainerModel::GetSentencePieces() const {
 }
 
 void TrainerModel::SetSentencePieces(SentencePieces &&sentencepieces) {
+  auto pieces = SetPiecesAndScores(std::move(sentencepieces));
+  trie_id_map_.clear();
+  trie_size_ = pieces.size();
+  BuildTrie(&pieces);
+  CHECK(status().ok());
+}
+
+void TrainerModel::UpdateSentencePieces(SentencePieces &&sentencepieces) {
+  auto pieces = SetPiecesAndScores(std::move(sentencepieces));
+  if (RemapTrie()) return;
+  trie_id_map_.clear();
+  trie_size_ = pieces.size();
+  BuildTrie(&pieces);
+  CHECK(status().ok());
+}
+
+bool TrainerModel::RemapTrie() {
+  if (!trie_ || sentencepieces_.size() <
+                    trie_size_ * (1.0 - kMaxRemovedTrieFraction)) {
+    return false;
+  }
+  std::vector<int> id_map(trie_size_, -1);
+  for (size_t i = 0; i < sentencepieces_.size(); ++i) {
+    const auto &piece = sentencepieces_[i].first;
+    int value = -1;
+    trie_->exactMatchSearch(piece.data(), value, piece.size());
+    if (value < 0) return false;
+    id_map[value] = i;
+  }
+  trie_id_map_ = std::move(id_map);
+  return true;
+}
+
+std::vector<std::pair<absl::string_view, int>>
+TrainerModel::SetPiecesAndScores(SentencePieces &&sentencepieces) {
   sentencepieces_ = std::move(sentencepieces);
   CHECK(!sentencepieces_.empty());
 
@@ -131,9 +349,25 @@ void TrainerModel::SetSentencePieces(SentencePieces &&sentencepieces) {
     piece->set_piece(w.data(), w.size());
     piece->set_score(score);
   }
+  InitializePieceAttributes();
+  return pieces;
+}
 
-  BuildTrie(&pieces);
-  CHECK(status().ok());
+util::Status Trainer::RemovePretokenizationDelimiter() {
+  const absl::string_view delimiter = trainer_spec_.pretokenization_delimiter();
+  if (SentencePieceTrainer::GetPretokenizerForTraining() != nullptr ||
+      delimiter.empty()) {
+    return util::OkStatus();
+  }
+  auto cursor = sentences_->NewCursor();
+  for (; !cursor->done(); cursor->Next()) {
+    auto w = cursor->value();
+    w.first = absl::StrReplaceAll(w.first, {{delimiter, ""}});
+    if (w.first != cursor->value().first) {
+      RETURN_IF_ERROR(sentences_->Set(cursor->index(), std::move(w)));
+    }
+  }
+  return cursor->status();
 }
 
 TrainerModel::SentencePieces Trainer::MakeSeedSentencePieces() {
@@ -145,24 +379,28 @@ TrainerModel::SentencePieces Trainer::MakeSeedSentencePieces() {
 // Returns seed sentencepieces for EM training.
 template <typename node_int_type>
 TrainerModel::SentencePieces Trainer::MakeSeedSentencePiecesInternal() {
-  CHECK(!sentences_.empty());
+  CHECK(!sentences_->empty());
   CHECK(!required_chars_.empty());
 
   // Pretokenizer applied only in training time.
   // Pretokenizer is used as a constraint of piece extractions.
   const auto *pretokenizer = SentencePieceTrainer::GetPretokenizerForTraining();
 
-  auto pretokenize_or_rewrite = [&](std::pair<std::string, int64> *w) {
-    if (pretokenizer) {
-      std::vector<char32> chars;
-      for (const auto &w : pretokenizer->PreTokenize(w->first)) {
-        for (const auto &c : string_util::UTF8ToUnicodeText(w)) {
-          chars.push_back(c);
-        }
-        chars.push_back(kSentenceBoundary);
+  // Returns the characters of the pre-tokenized `tokens`, each followed by
+  // kSentenceBoundary.
+  auto tokens_to_chars = [](const std::vector<std::string> &tokens) {
+    std::vector<char32> chars;
+    for (const auto &w : tokens) {
+      for (const auto &c : string_util::UTF8ToUnicodeText(w)) {
+        chars.push_back(c);
       }
-      return chars;
-    } else if (!trainer_spec_.pretokenization_delimiter().empty()) {
+      chars.push_back(kSentenceBoundary);
+    }
+    return chars;
+  };
+
+  auto rewrite = [&](std::pair<std::string, int64> *w) {
+    if (!trainer_spec_.pretokenization_delimiter().empty()) {
       // When delimiter is specified, tokenize the input with the delimiter.
       // For EM training, we assume that the delimiter doesn't exist and
       // rewrite the original sentence.
@@ -181,14 +419,90 @@ TrainerModel::SentencePieces Trainer::MakeSeedSentencePiecesInternal() {
     return string_util::UTF8ToUnicodeText(w->first);
   };
 
+  // Calls `fn` with every sentence and its characters delimited by the
+  // pre-tokenization. Without a pretokenizer, the sentences rewritten by
+  // rewrite() are stored if `store` is true. The pretokenizer runs over
+  // windows of the sentences in parallel.
+  auto for_each_sentence =
+      [&](bool store,
+          const std::function<void(const Sentence &w, const UnicodeText &ut)>
+              &fn) {
+        std::vector<Sentence> window;
+        std::vector<std::vector<std::string>> tokens;
+        auto flush = [&]() {
+          std::vector<absl::string_view> texts;
+          for (const auto &w : window) texts.push_back(w.first);
+          PreTokenizeSentences(*pretokenizer, texts, &tokens);
+          for (size_t i = 0; i < window.size(); ++i) {
+            fn(window[i], tokens_to_chars(tokens[i]));
+          }
+          window.clear();
+        };
+        auto cursor = sentences_->NewCursor();
+        for (; !cursor->done(); cursor->Next()) {
+          if (pretokenizer) {
+            window.push_back(cursor->value());
+            if (window.size() >= kPreTokenizeWindowSize) flush();
+            continue;
+          }
+          auto w = cursor->value();
+          const auto ut = rewrite(&w);
+          if (store && w.first != cursor->value().first) {
+            CHECK_OK(sentences_->Set(cursor->index(), w));
+          }
+          fn(w, ut);
+        }
+        CHECK_OK(cursor->status());
+        if (!window.empty()) flush();
+      };
+
   // Merges all sentences into one array with 0x0000 delimiter.
+  // The substrings are counted by the frequencies of the sentences, which
+  // are only kept if some of them are not 1, e.g., in TSV input.
   std::vector<char32> array;
+  std::vector<int64> freqs;
+  bool weighted = false;
   absl::flat_hash_map<std::string, int64> all_chars;
 
-  const bool is_tsv = trainer_spec_.input_format() == "tsv";
+  // With a shard size, the array only holds a shard of the sentences at once.
+  // The candidates of the shards are counted over all the sentences in
+  // a second pass, which also rewrites them.
+  uint64 shard_size = trainer_spec_.seed_sentencepieces_file().empty()
+                          ? trainer_spec_.seed_sentencepiece_shard_size()
+                          : 0;
+  // Under max_memory_mb, the shards are sized so that a suffix array fits in
+  // what the structures held so far leave of the budget. A corpus fitting
+  // in one shard gets the same seeds as without shards.
+  const bool budgeted_shards =
+      shard_size == 0 && trainer_spec_.seed_sentencepieces_file().empty() &&
+      memory_budget() > 0;
+  if (budgeted_shards) {
+    // The characters and their ranks, SA, L, R and D, and the accumulated
+    // frequencies.
+    constexpr int64 kBytesPerChar =
+        2 * sizeof(char32) + 4 * sizeof(node_int_type) + sizeof(int64);
+    constexpr int64 kMinShardSize = 1 << 16;
+    const int64 available =
+        memory_budget() - static_cast<int64>(GetMemoryUsage().total());
+    shard_size = std::max(available / kBytesPerChar, kMinShardSize);
+  }
+  const size_t seed_size =
+      static_cast<size_t>(trainer_spec_.seed_sentencepiece_size());
+  int num_shards = 0;
+  std::vector<std::pair<std::string, int64>> frequent_substrings;
+  std::set<std::string> candidates;
+  auto flush_shard = [&]() {
+    frequent_substrings = ExtractFrequentSubstrings<node_int_type>(
+        &array, weighted ? &freqs : nullptr, seed_size);
+    for (const auto &it : frequent_substrings) candidates.insert(it.first);
+    array.clear();
+    freqs.clear();
+    weighted = false;
+    ++num_shards;
+  };
 
-  for (auto &w : sentences_) {
-    const auto ut = pretokenize_or_rewrite(&w);
+  for_each_sentence(shard_size == 0, [&](const Sentence &w,
+                                         const UnicodeText &ut) {
     for (const auto &c : ut) {
       array.push_back(c);
       if (c != kUNKChar && c != kSentenceBoundary) {
@@ -196,14 +510,76 @@ TrainerModel::SentencePieces Trainer::MakeSeedSentencePiecesInternal() {
       }
     }
     array.push_back(kSentenceBoundary);  // sentence boundary marker.
+    freqs.push_back(w.second);
+    weighted |= w.second != 1;
+
+    if (shard_size > 0 && array.size() >= shard_size) flush_shard();
+  });
+  if (shard_size > 0 && (!array.empty() || num_shards == 0)) flush_shard();
+
+  if (budgeted_shards && num_shards > 1) {
+    NotifyMemoryDecision(
+        "seed_shards", absl::StrCat("extracting the seed pieces from ",
+                                    num_shards, " shards of ", shard_size,
+                                    " characters"));
+  }
+
+  if (shard_size > 0) {
+    LOG(INFO) << "Extracted " << candidates.size() << " candidates from "
+              << num_shards << " shards";
+    // Counts the occurrences of the candidates in the sentences, as the
+    // suffix array of all of them would.
+    std::vector<std::string> keys(candidates.begin(), candidates.end());
+    candidates.clear();
+    std::vector<int64> counts(keys.size(), 0);
+    Darts::DoubleArray trie;
+    std::vector<Darts::DoubleArray::result_pair_type> results;
+    if (num_shards > 1 && !keys.empty()) {
+      std::vector<const char *> key_ptrs(keys.size());
+      std::vector<size_t> lengths(keys.size());
+      std::vector<int> values(keys.size());
+      size_t max_length = 0;
+      for (size_t i = 0; i < keys.size(); ++i) {
+        key_ptrs[i] = keys[i].data();
+        lengths[i] = keys[i].size();
+        values[i] = i;
+        max_length = std::max(max_length, keys[i].size());
+      }
+      CHECK_EQ(0, trie.build(keys.size(), const_cast<char **>(key_ptrs.data()),
+                             lengths.data(), values.data()));
+      // Every candidate found at a position has a different byte length.
+      results.resize(max_length + 1);
+    }
+
+    for_each_sentence(true, [&](const Sentence &w, const UnicodeText &ut) {
+      if (results.empty()) return;
+      // The candidates do not contain a sentence boundary.
+      for (const auto &segment : SplitIntoSegments(ut)) {
+        const std::string text = string_util::UnicodeTextToUTF8(segment);
+        for (size_t pos = 0; pos < text.size();
+             pos += string_util::OneCharLen(text.data() + pos)) {
+          const size_t num_results = trie.commonPrefixSearch(
+              text.data() + pos, results.data(), results.size(),
+              text.size() - pos);
+          for (size_t k = 0; k < num_results; ++k) {
+            counts[results[k].value] += w.second;
+          }
+        }
+      }
+    });
 
-    // Naive workaround to over-sample the input.
-    // In TSV mode, the frequency field is not used to extract the seed piece.
-    // we can at least extract all pieces by copying the input because
-    // the occurrence gets at least larger than or equals to 2.
-    if (is_tsv) {
-      for (const auto &c : ut) array.push_back(c);
-      array.push_back(kSentenceBoundary);
+    if (num_shards > 1) {
+      // character-wise coverage is the default score.
+      BoundedPriorityQueue<size_t> queue(seed_size);
+      for (size_t i = 0; i < keys.size(); ++i) {
+        if (counts[i] < 2) continue;
+        const int64 len = string_util::UTF8ToUnicodeText(keys[i]).size();
+        queue.push(i, counts[i] * len);
+      }
+      frequent_substrings.clear();
+      for (const auto &p : queue.get()) {
+        frequent_substrings.emplace_back(keys[p.first], p.second);
+      }
     }
   }
 
@@ -214,172 +590,775 @@ TrainerModel::SentencePieces Trainer::MakeSeedSentencePiecesInternal() {
   }
 
   if (!trainer_spec_.seed_sentencepieces_file().empty()) {
-    auto seed_sentencepieces_file = sentencepiece::filesystem::NewReadableFile(
-        trainer_spec_.seed_sentencepieces_file());
-    std::string line;
-    int64_t freq = 1;
-    int skipped_sentencepieces = 0;
-    while (seed_sentencepieces_file->ReadLine(&line)) {
-      const std::vector<std::string> fields = absl::StrSplit(line, '\t');
-      CHECK_GE(fields.size(), 2);
-      const auto &seed_sentencepiece = fields[0];
-      CHECK(absl::SimpleAtoi(fields[1], &freq))
-          << "Could not parse the frequency; line: " << line;
-      const UnicodeText uw = string_util::UTF8ToUnicodeText(seed_sentencepiece);
-      if (!IsValidSentencePiece(uw)) {
-        ++skipped_sentencepieces;
-        continue;
-      }
-      // Initialise score of a piece by character coverage.
-      seed_sentencepieces.emplace_back(seed_sentencepiece, freq * uw.size());
-      if (seed_sentencepieces.size() % 1000000 == 0) {
-        LOG(INFO) << "loaded " << seed_sentencepieces.size()
-                  << " seed sentencepieces";
-      }
+    const size_t size = trainer_spec_.seed_sentencepiece_size();
+    for (auto &it : ReadSeedSentencePieces(size)) {
+      seed_sentencepieces.push_back(std::move(it));
     }
 
-    LOG(INFO) << "skipped " << skipped_sentencepieces << " seed sentencepieces";
-
     // Take highest scoring pieces as initial vocab.
-    seed_sentencepieces = Sorted(seed_sentencepieces);
-    seed_sentencepieces.resize(std::min<size_t>(
-        trainer_spec_.seed_sentencepiece_size(), seed_sentencepieces.size()));
+    KeepHighestScored(size, &seed_sentencepieces);
+    std::sort(seed_sentencepieces.begin(), seed_sentencepieces.end(),
+              IsHigherScored);
 
     LOG(INFO) << "Initialized " << seed_sentencepieces.size()
               << " seed sentencepieces from file.";
   } else {
-    CHECK_LE(array.size(),
-             static_cast<size_t>(std::numeric_limits<node_int_type>::max()))
-        << "Input corpus too large, try with train_extremely_large_corpus=true";
-    const node_int_type n = array.size();
-
-    std::vector<node_int_type> SA(n);  // suffix array
-    std::vector<node_int_type> L(n);   // left boundaries of internal node
-    std::vector<node_int_type> R(n);   // right boundaries of internal node
-    std::vector<node_int_type> D(n);   // depths of internal node
-
-    // Makes a suffix array to extract all sub strings occurring
-    // more than 2 times in the sentence.
-    constexpr node_int_type kAlphabetSize = 0x110000;  // All UCS4 range.
-    node_int_type node_num = 0;
-    LOG(INFO) << "Making suffix array...";
-    CHECK_EQ(0, esaxx(array.begin(), SA.begin(), L.begin(), R.begin(),
-                      D.begin(), n, kAlphabetSize, node_num));
-
-    LOG(INFO) << "Extracting frequent sub strings... node_num=" << node_num;
-    BoundedPriorityQueue<node_int_type> queue(
-        static_cast<size_t>(trainer_spec_.seed_sentencepiece_size()));
-
-    for (node_int_type i = 0; i < node_num; ++i) {
+    if (shard_size == 0) {
+      frequent_substrings = ExtractFrequentSubstrings<node_int_type>(
+          &array, weighted ? &freqs : nullptr, seed_size);
+    }
+    for (const auto &it : frequent_substrings) {
+      CHECK(!port::ContainsKey(all_chars, it.first));
+      seed_sentencepieces.emplace_back(it);
+    }
+  }
+
+  ToLogProb(seed_sentencepieces.begin(), seed_sentencepieces.end());
+
+  LOG(INFO) << "Initialized " << seed_sentencepieces.size()
+            << " seed sentencepieces";
+
+  return seed_sentencepieces;
+}
+
+TrainerModel::SentencePieces Trainer::ReadSeedSentencePieces(
+    size_t size) const {
+  auto *pool = GetThreadPool();
+  const int num_shards = pool->num_threads();
+  ParallelMultiFileSentenceIterator lines(
+      {trainer_spec_.seed_sentencepieces_file()}, num_shards);
+
+  // Every shard keeps its pieces, pruned to the `size` highest scored ones
+  // when they double, and the first line it could not parse.
+  std::vector<TrainerModel::SentencePieces> shards(num_shards);
+  std::vector<int64> skipped(num_shards, 0);
+  std::vector<std::string> errors(num_shards);
+  std::vector<std::string> batch;
+  int64 num_lines = 0;
+  auto flush = [&]() {
+    pool->ParallelForShards(
+        batch.size(), [&](int shard, size_t begin, size_t end) {
+          auto *pieces = &shards[shard];
+          for (size_t i = begin; i < end && errors[shard].empty(); ++i) {
+            const std::vector<absl::string_view> fields =
+                absl::StrSplit(batch[i], '\t');
+            int64 freq = 1;
+            if (fields.size() < 2 || !absl::SimpleAtoi(fields[1], &freq)) {
+              errors[shard] = batch[i];
+              break;
+            }
+            const UnicodeText uw = string_util::UTF8ToUnicodeText(fields[0]);
+            if (!IsValidSentencePiece(uw)) {
+              ++skipped[shard];
+              continue;
+            }
+            // Initialise score of a piece by character coverage.
+            pieces->emplace_back(std::string(fields[0]), freq * uw.size());
+            if (pieces->size() >= 2 * std::max<size_t>(size, kSeedBatchSize)) {
+              KeepHighestScored(size, pieces);
+            }
+          }
+        });
+    for (const auto &error : errors) {
+      CHECK(error.empty()) << "Could not parse the frequency; line: " << error;
+    }
+    num_lines += batch.size();
+    batch.clear();
+    LOG(INFO) << "loaded " << num_lines << " lines of seed sentencepieces";
+  };
+  for (; !lines.done(); lines.Next()) {
+    batch.push_back(lines.value());
+    if (batch.size() >= kSeedBatchSize) flush();
+  }
+  CHECK_OK(lines.status());
+  flush();
+
+  TrainerModel::SentencePieces result;
+  for (auto &pieces : shards) {
+    KeepHighestScored(size, &pieces);
+    for (auto &it : pieces) result.push_back(std::move(it));
+  }
+  LOG(INFO) << "skipped "
+            << std::accumulate(skipped.begin(), skipped.end(), int64{0})
+            << " seed sentencepieces";
+  return result;
+}
+
+template <typename node_int_type>
+std::vector<std::pair<std::string, int64>> Trainer::ExtractFrequentSubstrings(
+    std::vector<char32> *corpus, const std::vector<int64> *freqs,
+    size_t size) const {
+  CHECK_LE(corpus->size(),
+           static_cast<size_t>(std::numeric_limits<node_int_type>::max()))
+      << "Input corpus too large, try with train_extremely_large_corpus=true";
+  auto *pool = GetThreadPool();
+
+  // Compacts the alphabet to the characters in the corpus. The ranks keep
+  // the order of the characters, so the suffix array is the same as the
+  // one of the characters, while the suffix sorting only scans buckets of
+  // the characters present instead of the whole UCS4 range.
+  constexpr char32 kMaxChar = 0x110000;
+  std::vector<char32> chars;  // rank -> character.
+  std::vector<char32> ranks(kMaxChar, 0);  // character -> rank + 1.
+  for (const char32 c : *corpus) {
+    CHECK_LT(c, kMaxChar);
+    ranks[c] = 1;
+  }
+  for (char32 c = 0; c < kMaxChar; ++c) {
+    if (ranks[c] == 0) continue;
+    chars.push_back(c);
+    ranks[c] = chars.size();
+  }
+  // Every sentence ends with kSentenceBoundary, the smallest character.
+  CHECK_EQ(chars[0], kSentenceBoundary);
+
+  // Most corpora have fewer than 65536 characters after character_coverage,
+  // whose ranks are stored in 16 bits, halving the array next to the suffix
+  // array.
+  if (chars.size() <= std::numeric_limits<uint16>::max() + 1) {
+    std::vector<uint16> array(corpus->size());
+    pool->ParallelForShards(array.size(), [&](int, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        array[i] = ranks[(*corpus)[i]] - 1;
+      }
+    });
+    std::vector<char32>().swap(*corpus);
+    std::vector<char32>().swap(ranks);
+    return ExtractFrequentRankSubstrings<node_int_type>(array, chars, freqs,
+                                                        size);
+  }
+
+  pool->ParallelForShards(corpus->size(), [&](int, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      (*corpus)[i] = ranks[(*corpus)[i]] - 1;
+    }
+  });
+  std::vector<char32>().swap(ranks);
+  return ExtractFrequentRankSubstrings<node_int_type>(*corpus, chars, freqs,
+                                                      size);
+}
+
+template <typename node_int_type, typename rank_type>
+std::vector<std::pair<std::string, int64>>
+Trainer::ExtractFrequentRankSubstrings(const std::vector<rank_type> &array,
+                                       const std::vector<char32> &chars,
+                                       const std::vector<int64> *freqs,
+                                       size_t size) const {
+  const node_int_type n = array.size();
+  auto *pool = GetThreadPool();
+  constexpr rank_type kSentenceBoundaryRank = 0;
+
+  // Sets `uw` to the characters of array[offset, offset + len).
+  auto get_text = [&](node_int_type offset, node_int_type len,
+                      UnicodeText *uw) {
+    uw->resize(len);
+    for (node_int_type k = 0; k < len; ++k) {
+      (*uw)[k] = chars[array[offset + k]];
+    }
+  };
+
+  std::vector<node_int_type> SA(n);  // suffix array
+  std::vector<node_int_type> L(n);   // left boundaries of internal node
+  std::vector<node_int_type> R(n);   // right boundaries of internal node
+  std::vector<node_int_type> D(n);   // depths of internal node
+
+  // Makes a suffix array to extract all sub strings occurring
+  // more than 2 times in the sentence.
+  const node_int_type alphabet_size = chars.size();
+  node_int_type node_num = 0;
+  LOG(INFO) << "Making suffix array... alphabet_size=" << alphabet_size;
+  CHECK_EQ(0, esaxx(array.begin(), SA.begin(), L.begin(), R.begin(),
+                    D.begin(), n, alphabet_size, node_num));
+
+  LOG(INFO) << "Extracting frequent sub strings... node_num=" << node_num;
+
+  // With the frequencies, the occurrences SA[L[i], R[i]) of the node i are
+  // counted by the prefix sums of the frequencies in the suffix order.
+  std::vector<int64> accumulated_freqs;
+  if (freqs != nullptr) {
+    std::vector<node_int_type> ends;  // sentence -> position of its boundary.
+    for (node_int_type pos = 0; pos < n; ++pos) {
+      if (array[pos] == kSentenceBoundaryRank) ends.push_back(pos);
+    }
+    CHECK_EQ(ends.size(), freqs->size());
+    accumulated_freqs.resize(n + 1, 0);
+    pool->ParallelForShards(n, [&](int, size_t begin, size_t end) {
+      for (size_t k = begin; k < end; ++k) {
+        const size_t sid =
+            std::lower_bound(ends.begin(), ends.end(), SA[k]) - ends.begin();
+        accumulated_freqs[k + 1] = (*freqs)[sid];
+      }
+    });
+    std::partial_sum(accumulated_freqs.begin(), accumulated_freqs.end(),
+                     accumulated_freqs.begin());
+  }
+
+  // The suffix array is the largest structure of the training.
+  auto usage = GetMemoryUsage();
+  usage.Add("suffix_array",
+            memory_usage::Vector(array) + memory_usage::Vector(SA) +
+                memory_usage::Vector(L) + memory_usage::Vector(R) +
+                memory_usage::Vector(D) +
+                memory_usage::Vector(accumulated_freqs));
+  RecordMemoryUsage(usage);
+
+  // Every shard keeps its own best nodes. Merging them gives the same
+  // nodes as one queue, since the queue orders the nodes totally by the
+  // score and then the index.
+  std::vector<BoundedPriorityQueue<node_int_type>> shard_queues(
+      pool->num_threads(), BoundedPriorityQueue<node_int_type>(size));
+  pool->ParallelForShards(node_num, [&](int shard, size_t begin_node,
+                                        size_t end_node) {
+    auto &shard_queue = shard_queues[shard];
+    UnicodeText uw;  // Reused by the nodes.
+    for (node_int_type i = begin_node; i < end_node; ++i) {
       const node_int_type offset = SA[L[i]];
       const node_int_type len = D[i];
       if (len <= 1) {
         continue;
       }
-      const char32 *begin = &array[offset];
-      const char32 *end = &array[offset + len];
+      const rank_type *begin = &array[offset];
+      const rank_type *end = &array[offset + len];
       // Skips if a substring contains a sentence boundary.
-      if (std::find(begin, end, kSentenceBoundary) != end) {
+      if (std::find(begin, end, kSentenceBoundaryRank) != end) {
         continue;
       }
-      const UnicodeText uw(begin, end);
+      get_text(offset, len, &uw);
       if (!IsValidSentencePiece(uw)) {
         continue;
       }
 
       // character-wise coverage is the default score.
-      const node_int_type freq = R[i] - L[i];
-      const node_int_type score = freq * len;
-      queue.push(i, score);
+      const int64 freq =
+          freqs == nullptr ? R[i] - L[i]
+                           : accumulated_freqs[R[i]] - accumulated_freqs[L[i]];
+      const int64 score = freq * len;
+      shard_queue.push(i, score);
     }
+  });
+
+  BoundedPriorityQueue<node_int_type> queue(size);
+  for (auto &shard_queue : shard_queues) {
+    for (const auto &p : shard_queue.get()) queue.push(p.first, p.second);
+  }
 
-    for (const auto &p : queue.get()) {
-      const node_int_type offset = SA[L[p.first]];
-      const node_int_type len = D[p.first];
-      CHECK_GT(len, 0);
-      const char32 *begin = &array[offset];
-      const char32 *end = &array[offset + len];
-      const UnicodeText uw(begin, end);
-      const std::string w = string_util::UnicodeTextToUTF8(uw);
-      CHECK(IsValidSentencePiece(uw));  // just in case.
-      CHECK(!port::ContainsKey(all_chars, w));
-      seed_sentencepieces.emplace_back(w, p.second);
+  std::vector<std::pair<std::string, int64>> substrings;
+  for (const auto &p : queue.get()) {
+    const node_int_type offset = SA[L[p.first]];
+    const node_int_type len = D[p.first];
+    CHECK_GT(len, 0);
+    UnicodeText uw;
+    get_text(offset, len, &uw);
+    CHECK(IsValidSentencePiece(uw));  // just in case.
+    substrings.emplace_back(string_util::UnicodeTextToUTF8(uw), p.second);
+  }
+  return substrings;
+
+
+}
+
+void Trainer::EStepCache::Shard::Clear() {
+  offsets.assign(1, 0);
+  ids.clear();
+  counts.clear();
+  z.clear();
+  num_tokens.clear();
+  flags.clear();
+}
+
+// static
+float Trainer::AddExpected(const Lattice &lattice, int64 freq, float beam,
+                           std::vector<float> *scratch,
+                           std::vector<int> *ids) {
+  const float Z = lattice.PopulateMarginal(freq, scratch, beam);
+  CHECK(!std::isnan(Z)) << "likelihood is NAN. Input sentence may be too long";
+  for (int pos = 0; pos < lattice.size(); ++pos) {
+    for (const auto *node : lattice.begin_nodes(pos)) {
+      if (node->id >= 0) ids->push_back(node->id);
     }
   }
+  return Z;
+}
 
-  ToLogProb(seed_sentencepieces.begin(), seed_sentencepieces.end());
+// static
+void Trainer::AppendExpected(float Z, int num_tokens, uint8 flags,
+                             std::vector<float> *scratch,
+                             std::vector<int> *ids,
+                             EStepCache::Shard *shard) {
+  std::sort(ids->begin(), ids->end());
+  ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+  for (const int id : *ids) {
+    shard->ids.push_back(id);
+    shard->counts.push_back((*scratch)[id]);
+    (*scratch)[id] = 0.0;
+  }
+  ids->clear();
+  shard->offsets.push_back(shard->ids.size());
+  shard->z.push_back(Z);
+  shard->num_tokens.push_back(num_tokens);
+  shard->flags.push_back(flags);
+}
 
-  LOG(INFO) << "Initialized " << seed_sentencepieces.size()
-            << " seed sentencepieces";
+// static
+std::vector<int> Trainer::GetCacheIdMap(const TrainerModel &model,
+                                        const EStepCache &cache) {
+  const auto &sentencepieces = model.GetSentencePieces();
+  absl::flat_hash_map<absl::string_view, int> ids;
+  for (size_t i = 0; i < sentencepieces.size(); ++i) {
+    ids[sentencepieces[i].first] = i;
+  }
+  std::vector<int> id_map(cache.pieces.size());
+  for (size_t i = 0; i < cache.pieces.size(); ++i) {
+    id_map[i] = port::FindWithDefault(ids, cache.pieces[i], -1);
+  }
+  return id_map;
+}
 
-  return seed_sentencepieces;
+// static
+void Trainer::SetCachePieces(const TrainerModel &model, EStepCache *cache) {
+  const auto &sentencepieces = model.GetSentencePieces();
+  cache->pieces.resize(sentencepieces.size());
+  for (size_t i = 0; i < sentencepieces.size(); ++i) {
+    cache->pieces[i] = sentencepieces[i].first;
+  }
 }
 
 std::vector<float> Trainer::RunEStep(const TrainerModel &model, float *obj,
-                                     int64 *num_tokens) const {
-  std::vector<std::vector<float>> expected(trainer_spec_.num_threads());
-  std::vector<float> objs(trainer_spec_.num_threads(), 0.0);
-  std::vector<int64> ntokens(trainer_spec_.num_threads(), 0.0);
-
-  auto pool = std::make_unique<ThreadPool>(trainer_spec_.num_threads());
-  pool->StartWorkers();
+                                     int64 *num_tokens,
+                                     EStepCache *cache) const {
+  auto *pool = GetThreadPool();
+  const int num_threads = pool->num_threads();
+  if (is_coordinator()) CHECK_OK(SendDistributedStep(kEStep, &model));
+
+  std::vector<std::vector<float>> expected(num_threads);
+  std::vector<float> objs(num_threads, 0.0);
+  std::vector<int64> ntokens(num_threads, 0.0);
+  std::vector<Lattice> lattices(num_threads);
+  for (auto &e : expected) e.resize(model.GetPieceSize(), 0.0);
 
   int64 all_sentence_freq = 0;
-  for (const auto &w : sentences_) {
-    all_sentence_freq += w.second;
-  }
-
-  // Executes E step in parallel
-  for (int n = 0; n < trainer_spec_.num_threads(); ++n) {
-    pool->Schedule([&, n]() {
-      Lattice lattice;
-      expected[n].resize(model.GetPieceSize(), 0.0);
-      for (size_t i = n; i < sentences_.size();
-           i += trainer_spec_.num_threads()) {
-        const std::string &w = sentences_[i].first;
-        const int64 freq = sentences_[i].second;
-        lattice.SetSentence(w);
-        model.PopulateNodes(&lattice);
-        const float Z = lattice.PopulateMarginal(freq, &expected[n]);
-        ntokens[n] += lattice.Viterbi().first.size();
-        CHECK(!std::isnan(Z))
-            << "likelihood is NAN. Input sentence may be too long";
-        objs[n] -= Z / all_sentence_freq;
-      }
-    });
+  {
+    auto cursor = sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      all_sentence_freq += cursor->value().second;
+    }
+    CHECK_OK(cursor->status());
+  }
+
+  // Maps the ids of the cache to the ids of `model`.
+  std::vector<int> id_map;
+  std::vector<EStepCache::Shard> next_shards;
+  // The counts of one sentence and the ids in its lattice, per thread.
+  std::vector<std::vector<float>> scratches;
+  std::vector<std::vector<int>> scratch_ids;
+  std::vector<std::vector<std::pair<int, float>>> previous;
+  if (cache != nullptr) {
+    id_map = GetCacheIdMap(model, *cache);
+    cache->shards.resize(num_threads);
+    next_shards.resize(num_threads);
+    scratches.resize(num_threads);
+    scratch_ids.resize(num_threads);
+    previous.resize(num_threads);
+    for (auto &s : scratches) s.resize(model.GetPieceSize(), 0.0);
   }
-  pool.reset(nullptr);
+  const float tolerance = trainer_spec_.incremental_e_step_tolerance();
+  const float beam = trainer_spec_.e_step_beam();
+  const int window = trainer_spec_.e_step_window_size();
+  const bool ws_suffix = trainer_spec_.treat_whitespace_as_suffix();
+
+  // Executes E step in parallel. The shards are fixed so that the float
+  // accumulators do not depend on the scheduling, and balanced by bytes.
+  const auto local = GetLocalSentences();
+  pool->ParallelForShards(
+      GetLocalShards(), [&](int n, size_t begin, size_t end) {
+        Lattice *lattice = &lattices[n];
+        const EStepCache::Shard *prev = nullptr;
+        EStepCache::Shard *next = nullptr;
+        if (cache != nullptr) {
+          prev = &cache->shards[n];
+          if (prev->offsets.size() != end - begin + 1) prev = nullptr;
+          next = &next_shards[n];
+          next->Clear();
+        }
+        auto cursor =
+            sentences_->NewCursor(local.first + begin, local.first + end);
+        for (size_t k = 0; !cursor->done(); cursor->Next(), ++k) {
+          const std::string &w = cursor->value().first;
+          const int64 freq = cursor->value().second;
+          if (cache == nullptr) {
+            ForEachWindow(w, window, ws_suffix, [&](absl::string_view chunk) {
+              lattice->SetSentence(chunk);
+              model.PopulateNodes(lattice);
+              const float Z =
+                  lattice->PopulateMarginal(freq, &expected[n], beam);
+              ntokens[n] += lattice->Viterbi().first.size();
+              CHECK(!std::isnan(Z))
+                  << "likelihood is NAN. Input sentence may be too long";
+              objs[n] -= Z / all_sentence_freq;
+            });
+            continue;
+          }
+
+          // The previous counts in the ids of `model`.
+          auto &old = previous[n];
+          bool reusable = false;
+          old.clear();
+          if (prev != nullptr) {
+            reusable = prev->flags[k] & (EStepCache::kConverged |
+                                         EStepCache::kExact);
+            for (uint64 j = prev->offsets[k]; j < prev->offsets[k + 1]; ++j) {
+              const int id = id_map[prev->ids[j]];
+              if (id < 0) {
+                reusable = false;
+                old.clear();
+                break;
+              }
+              old.emplace_back(id, prev->counts[j]);
+            }
+          }
+
+          const uint64 offset = next->ids.size();
+          if (reusable) {
+            for (const auto &e : old) {
+              next->ids.push_back(e.first);
+              next->counts.push_back(e.second);
+            }
+            next->offsets.push_back(next->ids.size());
+            next->z.push_back(prev->z[k]);
+            next->num_tokens.push_back(prev->num_tokens[k]);
+            next->flags.push_back(prev->flags[k] & EStepCache::kConverged);
+          } else {
+            float Z = 0.0;
+            int num_tokens = 0;
+            ForEachWindow(w, window, ws_suffix, [&](absl::string_view chunk) {
+              lattice->SetSentence(chunk);
+              model.PopulateNodes(lattice);
+              num_tokens += lattice->Viterbi().first.size();
+              Z += AddExpected(*lattice, freq, beam, &scratches[n],
+                               &scratch_ids[n]);
+            });
+            AppendExpected(Z, num_tokens, 0, &scratches[n], &scratch_ids[n],
+                           next);
+
+            // Converged if the lattice has the same pieces and their counts
+            // have moved by at most the tolerance.
+            if (!old.empty() && old.size() == next->ids.size() - offset) {
+              std::sort(old.begin(), old.end());
+              float diff = 0.0;
+              for (size_t j = 0; j < old.size(); ++j) {
+                if (old[j].first != next->ids[offset + j]) {
+                  diff = FLT_MAX;
+                  break;
+                }
+                diff += std::fabs(next->counts[offset + j] - old[j].second);
+              }
+              if (diff <= tolerance * freq) {
+                next->flags.back() = EStepCache::kConverged;
+              }
+            }
+          }
 
-  // Merges expectations
-  for (int n = 1; n < trainer_spec_.num_threads(); ++n) {
+          for (size_t j = offset; j < next->ids.size(); ++j) {
+            expected[n][next->ids[j]] += next->counts[j];
+          }
+          ntokens[n] += next->num_tokens.back();
+          objs[n] -= next->z.back() / all_sentence_freq;
+        }
+        CHECK_OK(cursor->status());
+      });
+
+  // Merges expectations. The vocabulary is split into disjoint ranges
+  // which are reduced in parallel, so the reduction does not become
+  // a serial bottleneck with many threads.
+  for (int n = 1; n < num_threads; ++n) {
     objs[0] += objs[n];
     ntokens[0] += ntokens[n];
-    for (size_t k = 0; k < expected[0].size(); ++k) {
-      expected[0][k] += expected[n][k];
-    }
   }
+  pool->ParallelFor(expected[0].size(), kReduceGrainSize,
+                    [&](int, size_t begin, size_t end) {
+                      float *dst = expected[0].data();
+                      for (int n = 1; n < num_threads; ++n) {
+                        const float *src = expected[n].data();
+                        for (size_t k = begin; k < end; ++k) dst[k] += src[k];
+                      }
+                    });
 
   *obj = objs[0];
   *num_tokens = ntokens[0];
+  if (is_coordinator()) {
+    CHECK_OK(ReceiveDistributedResults(&expected[0], obj, num_tokens));
+  }
   CHECK(!std::isnan(*obj));
 
-  return expected[0];
+  if (cache != nullptr) {
+    cache->shards.swap(next_shards);
+    SetCachePieces(model, cache);
+  }
+
+  return std::move(expected[0]);
+}
+
+std::vector<float> Trainer::RunMiniBatchEStep(const TrainerModel &model,
+                                              size_t batch, size_t num_batches,
+                                              int64 all_sentence_freq,
+                                              float *obj,
+                                              int64 *num_tokens) const {
+  auto *pool = GetThreadPool();
+  const int num_threads = pool->num_threads();
+
+  // The chunks of the mini-batch are `batch`, `batch` + `num_batches`, ...
+  const size_t size = sentences_->size();
+  const size_t chunk_size = std::min<size_t>(
+      kMiniBatchChunkSize, trainer_spec_.em_mini_batch_size());
+  const size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+  const size_t num_batch_chunks =
+      batch < num_chunks ? (num_chunks - batch - 1) / num_batches + 1 : 0;
+  const float beam = trainer_spec_.e_step_beam();
+  const int window = trainer_spec_.e_step_window_size();
+  const bool ws_suffix = trainer_spec_.treat_whitespace_as_suffix();
+
+  std::vector<std::vector<float>> expected(num_threads);
+  std::vector<float> objs(num_threads, 0.0);
+  std::vector<int64> ntokens(num_threads, 0);
+  std::vector<int64> freqs(num_threads, 0);
+  std::vector<Lattice> lattices(num_threads);
+  for (auto &e : expected) e.resize(model.GetPieceSize(), 0.0);
+
+  pool->ParallelForShards(num_batch_chunks, [&](int n, size_t b, size_t e) {
+    Lattice *lattice = &lattices[n];
+    for (size_t c = b; c < e; ++c) {
+      const size_t begin = (batch + c * num_batches) * chunk_size;
+      auto cursor = sentences_->NewCursor(
+          begin, std::min<size_t>(begin + chunk_size, size));
+      for (; !cursor->done(); cursor->Next()) {
+        const int64 freq = cursor->value().second;
+        ForEachWindow(cursor->value().first, window, ws_suffix,
+                      [&](absl::string_view chunk) {
+                        lattice->SetSentence(chunk);
+                        model.PopulateNodes(lattice);
+                        const float Z =
+                            lattice->PopulateMarginal(freq, &expected[n], beam);
+                        ntokens[n] += lattice->Viterbi().first.size();
+                        CHECK(!std::isnan(Z)) << "likelihood is NAN. Input "
+                                                 "sentence may be too long";
+                        objs[n] -= Z;
+                      });
+        freqs[n] += freq;
+      }
+      CHECK_OK(cursor->status());
+    }
+  });
+
+  for (int n = 1; n < num_threads; ++n) {
+    objs[0] += objs[n];
+    ntokens[0] += ntokens[n];
+    freqs[0] += freqs[n];
+  }
+
+  // Scales the counts of the mini-batch to the whole corpus.
+  const float scale =
+      freqs[0] > 0 ? static_cast<float>(all_sentence_freq) / freqs[0] : 0.0;
+  pool->ParallelFor(expected[0].size(), kReduceGrainSize,
+                    [&](int, size_t b, size_t e) {
+                      float *dst = expected[0].data();
+                      for (int n = 1; n < num_threads; ++n) {
+                        const float *src = expected[n].data();
+                        for (size_t k = b; k < e; ++k) dst[k] += src[k];
+                      }
+                      for (size_t k = b; k < e; ++k) dst[k] *= scale;
+                    });
+
+  *obj = freqs[0] > 0 ? objs[0] / freqs[0] : 0.0;
+  *num_tokens = static_cast<int64>(ntokens[0] * scale);
+  CHECK(!std::isnan(*obj));
+  return std::move(expected[0]);
+}
+
+std::pair<size_t, size_t> Trainer::GetLocalSentences() const {
+  const uint64 size = sentences_->size();
+  const int num_processes = trainer_spec_.num_distributed_processes();
+  const int process_id = trainer_spec_.distributed_process_id();
+  return std::make_pair(size * process_id / num_processes,
+                        size * (process_id + 1) / num_processes);
+}
+
+const std::vector<size_t> &Trainer::GetLocalShards() const {
+  const auto local = GetLocalSentences();
+  const size_t size = local.second - local.first;
+  const size_t num_shards = GetThreadPool()->num_threads();
+  if (local_shards_.size() == num_shards + 1 &&
+      local_shards_.back() == size) {
+    return local_shards_;
+  }
+
+  // Empty sentences still cost something.
+  uint64 total = 0;
+  auto cursor = sentences_->NewCursor(local.first, local.second);
+  for (; !cursor->done(); cursor->Next()) {
+    total += cursor->value().first.size() + 1;
+  }
+  CHECK_OK(cursor->status());
+
+  local_shards_.assign(1, 0);
+  uint64 bytes = 0;
+  cursor = sentences_->NewCursor(local.first, local.second);
+  for (size_t k = 0; !cursor->done(); cursor->Next(), ++k) {
+    bytes += cursor->value().first.size() + 1;
+    while (local_shards_.size() < num_shards &&
+           bytes >= total * local_shards_.size() / num_shards) {
+      local_shards_.push_back(k + 1);
+    }
+  }
+  CHECK_OK(cursor->status());
+  local_shards_.resize(num_shards + 1, size);
+  return local_shards_;
+}
+
+util::Status Trainer::SendDistributedStep(DistributedStep step,
+                                          const TrainerModel *model) const {
+  std::string data = kDistributedStepMagic;
+  sentence_record::AppendVarint(distributed_step_, &data);
+  sentence_record::AppendVarint(step, &data);
+  sentence_record::AppendVarint(sentences_->size(), &data);
+  if (model == nullptr) {
+    sentence_record::AppendVarint(0, &data);
+  } else {
+    const auto &sentencepieces = model->GetSentencePieces();
+    sentence_record::AppendVarint(sentencepieces.size(), &data);
+    for (const auto &w : sentencepieces) {
+      AppendString(w.first, &data);
+      AppendFloat(w.second, &data);
+    }
+  }
+  RETURN_IF_ERROR(WriteFileAtomically(
+      GetDistributedStepFile(trainer_spec_.distributed_dir(),
+                             distributed_step_++),
+      data));
+  return util::OkStatus();
+}
+
+util::Status Trainer::ReceiveDistributedResults(std::vector<float> *counts,
+                                                float *objective,
+                                                int64 *num_tokens) const {
+  const int64 step = distributed_step_ - 1;
+  const std::string &dirname = trainer_spec_.distributed_dir();
+  for (int id = 1; id < trainer_spec_.num_distributed_processes(); ++id) {
+    const std::string filename = GetDistributedResultFile(dirname, step, id);
+    std::string data;
+    RETURN_IF_ERROR(WaitAndReadFile(
+        filename, trainer_spec_.distributed_timeout_sec(), &data));
+
+    absl::string_view in(data), array;
+    uint64 result_step = 0, result_id = 0, result_num_tokens = 0;
+    float result_objective = 0.0;
+    CHECK_OR_RETURN(absl::ConsumePrefix(&in, kDistributedResultMagic) &&
+                    sentence_record::ConsumeVarint(&in, &result_step) &&
+                    sentence_record::ConsumeVarint(&in, &result_id) &&
+                    ConsumeFloat(&in, &result_objective) &&
+                    sentence_record::ConsumeVarint(&in, &result_num_tokens) &&
+                    ConsumeString(&in, &array) && in.empty() &&
+                    result_step == static_cast<uint64>(step) &&
+                    result_id == static_cast<uint64>(id) &&
+                    array.size() == counts->size() * sizeof(float))
+        << "Broken result: " << filename;
+
+    for (size_t i = 0; i < counts->size(); ++i) {
+      float count = 0.0;
+      memcpy(&count, array.data() + i * sizeof(float), sizeof(float));
+      (*counts)[i] += count;
+    }
+    *objective += result_objective;
+    if (num_tokens != nullptr) *num_tokens += result_num_tokens;
+
+    std::error_code ec;
+    std::filesystem::remove(filename, ec);
+  }
+
+  // Every process has read the step.
+  std::error_code ec;
+  std::filesystem::remove(GetDistributedStepFile(dirname, step), ec);
+  return util::OkStatus();
+}
+
+util::Status Trainer::ServeDistributedSteps() {
+  const std::string &dirname = trainer_spec_.distributed_dir();
+  const int process_id = trainer_spec_.distributed_process_id();
+  while (true) {
+    const std::string filename =
+        GetDistributedStepFile(dirname, distributed_step_);
+    std::string data;
+    RETURN_IF_ERROR(WaitAndReadFile(
+        filename, trainer_spec_.distributed_timeout_sec(), &data));
+
+    absl::string_view in(data), piece;
+    uint64 step = 0, kind = 0, num_sentences = 0, size = 0;
+    TrainerModel::SentencePieces sentencepieces;
+    CHECK_OR_RETURN(absl::ConsumePrefix(&in, kDistributedStepMagic) &&
+                    sentence_record::ConsumeVarint(&in, &step) &&
+                    sentence_record::ConsumeVarint(&in, &kind) &&
+                    sentence_record::ConsumeVarint(&in, &num_sentences) &&
+                    sentence_record::ConsumeVarint(&in, &size) &&
+                    step == static_cast<uint64>(distributed_step_))
+        << "Broken step: " << filename;
+    for (uint64 i = 0; i < size; ++i) {
+      float score = 0.0;
+      CHECK_OR_RETURN(ConsumeString(&in, &piece) && ConsumeFloat(&in, &score))
+          << "Broken step: " << filename;
+      sentencepieces.emplace_back(std::string(piece), score);
+    }
+    CHECK_OR_RETURN(in.empty()) << "Broken step: " << filename;
+    CHECK_EQ_OR_RETURN(num_sentences, sentences_->size())
+        << "Process 0 has loaded other sentences.";
+
+    std::vector<float> counts;
+    float objective = 0.0;
+    int64 num_tokens = 0;
+    if (kind == kEStep || kind == kViterbiStep) {
+      TrainerModel model(trainer_spec_, normalizer_spec_);
+      model.SetSentencePieces(std::move(sentencepieces));
+      if (kind == kEStep) {
+        counts = RunEStep(model, &objective, &num_tokens);
+      } else {
+        counts = RunViterbiStep(model, nullptr, &objective);
+      }
+    } else if (kind != kDoneStep) {
+      return util::InternalError(absl::StrCat("Unknown step: ", filename));
+    }
+
+    std::string result = kDistributedResultMagic;
+    sentence_record::AppendVarint(distributed_step_, &result);
+    sentence_record::AppendVarint(process_id, &result);
+    AppendFloat(objective, &result);
+    sentence_record::AppendVarint(num_tokens, &result);
+    AppendString(absl::string_view(reinterpret_cast<const char *>(counts.data()),
+                                   counts.size() * sizeof(float)),
+                 &result);
+    RETURN_IF_ERROR(WriteFileAtomically(
+        GetDistributedResultFile(dirname, distributed_step_, process_id),
+        result));
+    // The empty result of kDoneStep tells process 0 that the step file has
+    // been read and can be removed.
+    if (kind == kDoneStep) return util::OkStatus();
+    ++distributed_step_;
+  }
 }
 
 TrainerModel::SentencePieces Trainer::RunMStep(
-    const TrainerModel &model, const std::vector<float> &expected) const {
+    const TrainerModel &model, const std::vector<float> &expected,
+    bool keep_pieces) const {
   const auto &sentencepieces = model.GetSentencePieces();
   CHECK_EQ(sentencepieces.size(), expected.size());
   TrainerModel::SentencePieces new_sentencepieces;
 
   float sum = 0.0;
   for (size_t i = 0; i < expected.size(); ++i) {
-    const float freq = expected[i];
+    float freq = expected[i];
 
     // Filter infrequent sentencepieces here.
     constexpr float kExpectedFrequencyThreshold = 0.5;
     if (freq < kExpectedFrequencyThreshold) {
-      continue;
+      if (!keep_pieces) continue;
+      freq = kExpectedFrequencyThreshold;
     }
 
     new_sentencepieces.emplace_back(sentencepieces[i].first, freq);
@@ -398,12 +1377,115 @@ TrainerModel::SentencePieces Trainer::RunMStep(
   return new_sentencepieces;
 }
 
+std::vector<float> Trainer::RunViterbiStep(const TrainerModel &model,
+                                           EStepCache *cache,
+                                           float *vsum) const {
+  const auto &sentencepieces = model.GetSentencePieces();
+  auto *pool = GetThreadPool();
+  const int num_threads = pool->num_threads();
+  if (is_coordinator()) CHECK_OK(SendDistributedStep(kViterbiStep, &model));
+  const float beam = trainer_spec_.e_step_beam();
+  const int window = trainer_spec_.e_step_window_size();
+  const bool ws_suffix = trainer_spec_.treat_whitespace_as_suffix();
+
+  std::vector<float> freq(sentencepieces.size(), 0.0);
+  std::vector<float> vsums(num_threads, 0.0);
+  std::vector<std::vector<float>> freqs(num_threads);
+  std::vector<Lattice> lattices(num_threads);
+  for (int n = 0; n < num_threads; ++n) {
+    freqs[n].resize(sentencepieces.size(), 0.0);
+  }
+
+  // With the cache, the same lattices also give the expected counts of the
+  // next E step for the sentences keeping all their pieces.
+  std::vector<EStepCache::Shard> next_shards;
+  std::vector<std::vector<float>> scratches;
+  std::vector<std::vector<int>> scratch_ids;
+  if (cache != nullptr) {
+    cache->shards.resize(num_threads);
+    next_shards.resize(num_threads);
+    scratches.resize(num_threads);
+    scratch_ids.resize(num_threads);
+    for (auto &s : scratches) s.resize(model.GetPieceSize(), 0.0);
+  }
+
+  const auto local = GetLocalSentences();
+  pool->ParallelForShards(
+      GetLocalShards(), [&](int n, size_t begin, size_t end) {
+        Lattice *lattice = &lattices[n];
+        const EStepCache::Shard *prev = nullptr;
+        EStepCache::Shard *next = nullptr;
+        if (cache != nullptr) {
+          prev = &cache->shards[n];
+          if (prev->offsets.size() != end - begin + 1) prev = nullptr;
+          next = &next_shards[n];
+          next->Clear();
+        }
+        auto cursor =
+            sentences_->NewCursor(local.first + begin, local.first + end);
+        for (size_t k = 0; !cursor->done(); cursor->Next(), ++k) {
+          const auto &w = cursor->value();
+          vsums[n] += w.second;
+          float Z = 0.0;
+          int num_tokens = 0;
+          ForEachWindow(
+              w.first, window, ws_suffix, [&](absl::string_view chunk) {
+                lattice->SetSentence(chunk);
+                model.PopulateNodes(lattice);
+                const auto viterbi = lattice->Viterbi().first;
+                for (const auto *node : viterbi) {
+                  if (node->id >= 0) {
+                    freqs[n][node->id] += w.second;
+                  }
+                }
+                num_tokens += viterbi.size();
+                if (next != nullptr) {
+                  Z += AddExpected(*lattice, w.second, beam, &scratches[n],
+                                   &scratch_ids[n]);
+                }
+              });
+          if (next != nullptr) {
+            // Keeps whether the sentence has converged.
+            const uint8 flags =
+                EStepCache::kExact |
+                (prev != nullptr ? prev->flags[k] & EStepCache::kConverged
+                                 : 0);
+            AppendExpected(Z, num_tokens, flags, &scratches[n],
+                           &scratch_ids[n], next);
+          }
+        }
+        CHECK_OK(cursor->status());
+      });
+  if (cache != nullptr) {
+    cache->shards.swap(next_shards);
+    SetCachePieces(model, cache);
+  }
+
+  *vsum = 0.0;
+  for (int n = 0; n < num_threads; ++n) {
+    *vsum += vsums[n];
+  }
+  pool->ParallelFor(sentencepieces.size(), kReduceGrainSize,
+                    [&](int, size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; ++i) {
+                        for (int n = 0; n < num_threads; ++n) {
+                          freq[i] += freqs[n][i];
+                        }
+                      }
+                    });
+  if (is_coordinator()) {
+    CHECK_OK(ReceiveDistributedResults(&freq, vsum, nullptr));
+  }
+  return freq;
+}
+
 TrainerModel::SentencePieces Trainer::PruneSentencePieces(
-    const TrainerModel &model) const {
+    const TrainerModel &model, EStepCache *cache) const {
   const auto &sentencepieces = model.GetSentencePieces();
+  auto *pool = GetThreadPool();
 
-  Lattice lattice;
-  std::vector<bool> always_keep(sentencepieces.size(), true);
+  // Not std::vector<bool>, whose elements cannot be set in parallel.
+  std::vector<uint8> always_keep(sentencepieces.size(), true);
   std::vector<std::vector<int>> alternatives(sentencepieces.size());
 
   // First, segments the current sentencepieces to know
@@ -411,73 +1493,44 @@ TrainerModel::SentencePieces Trainer::PruneSentencePieces(
   // from the vocabulary.
   // To do so, we take the second best segmentation of sentencepiece[i].
   // alternatives[i] stores the sequence of second best sentencepieces.
-  for (size_t i = 0; i < sentencepieces.size(); ++i) {
-    const auto &w = sentencepieces[i];
-    lattice.SetSentence(w.first);
-    model.PopulateNodes(&lattice);
-    const auto nbests = lattice.NBest(2, false, 0.0);
-    if (nbests.size() == 1) {
-      // No second-best result is found. always keep this sentencepiece.
-      always_keep[i] = true;
-      continue;
-    } else if (nbests[0].first.size() >= 2) {
-      // Can safely remove this sentencepiece if its Viterbi path is split.
-      always_keep[i] = false;
-    } else if (nbests[0].first.size() == 1) {
-      always_keep[i] = true;
-      for (const auto *node : nbests[1].first) {
-        alternatives[i].push_back(node->id);
-      }
-    }
-  }
-
-  // Second, segments all sentences to compute likelihood
-  // with a unigram language model. inverted[i] stores
-  // the set of sentence index where the sentencepieces[i] appears.
-  float vsum = 0.0;
-  std::vector<float> freq(sentencepieces.size(), 0.0);
-  std::vector<std::vector<int>> inverted(sentencepieces.size());
+  // The pieces are independent, so they are segmented in parallel. NBest()
+  // of two paths runs the k-best Viterbi rather than the A* search.
   {
-    std::vector<float> vsums(trainer_spec_.num_threads(), 0.0);
-    std::vector<std::vector<float>> freqs(trainer_spec_.num_threads());
-    std::vector<std::vector<std::vector<int>>> inverteds(
-        trainer_spec_.num_threads());
-
-    auto pool = std::make_unique<ThreadPool>(trainer_spec_.num_threads());
-    pool->StartWorkers();
-    for (int n = 0; n < trainer_spec_.num_threads(); ++n) {
-      freqs[n].resize(sentencepieces.size(), 0.0);
-      inverteds[n].resize(sentencepieces.size());
-
-      pool->Schedule([&, n]() {
-        Lattice lattice;
-        for (size_t i = n; i < sentences_.size();
-             i += trainer_spec_.num_threads()) {
-          const auto &w = sentences_[i];
-          lattice.SetSentence(w.first);
-          model.PopulateNodes(&lattice);
-          vsums[n] += w.second;
-          for (const auto *node : lattice.Viterbi().first) {
-            if (node->id >= 0) {
-              freqs[n][node->id] += w.second;
-              inverteds[n][node->id].push_back(i);
+    std::vector<Lattice> lattices(pool->num_threads());
+    pool->ParallelFor(
+        sentencepieces.size(), kPruneGrainSize,
+        [&](int n, size_t begin, size_t end) {
+          Lattice *lattice = &lattices[n];
+          for (size_t i = begin; i < end; ++i) {
+            const auto &w = sentencepieces[i];
+            lattice->SetSentence(w.first);
+            model.PopulateNodes(lattice);
+            const auto nbests = lattice->NBest(2, false, 0.0);
+            if (nbests.size() == 1) {
+              // No second-best result is found. always keep this
+              // sentencepiece.
+              always_keep[i] = true;
+              continue;
+            } else if (nbests[0].first.size() >= 2) {
+              // Can safely remove this sentencepiece if its Viterbi path is
+              // split.
+              always_keep[i] = false;
+            } else if (nbests[0].first.size() == 1) {
+              always_keep[i] = true;
+              for (const auto *node : nbests[1].first) {
+                alternatives[i].push_back(node->id);
+              }
             }
           }
-        }
-      });
-    }
-    pool.reset(nullptr);
-
-    for (int n = 0; n < trainer_spec_.num_threads(); ++n) {
-      vsum += vsums[n];
-      for (size_t i = 0; i < sentencepieces.size(); ++i) {
-        freq[i] += freqs[n][i];
-        std::copy(inverteds[n][i].begin(), inverteds[n][i].end(),
-                  std::back_inserter(inverted[i]));
-      }
-    }
+        });
   }
 
+  // Second, segments all sentences to compute likelihood
+  // with a unigram language model. freq[i] stores the frequency of
+  // sentencepieces[i] in the Viterbi paths.
+  float vsum = 0.0;
+  const auto freq = RunViterbiStep(model, cache, &vsum);
+
   const float sum = std::accumulate(freq.begin(), freq.end(), 0.0);
   const float logsum = std::log(static_cast<double>(sum));
   std::vector<std::pair<int, float>> candidates;
@@ -496,11 +1549,10 @@ TrainerModel::SentencePieces Trainer::PruneSentencePieces(
       // no alternatives. Keeps this entry.
       new_sentencepieces.push_back(sentencepieces[i]);
     } else {
-      float F = 0.0;  // the frequency of sentencepieces[i].
-      for (const int n : inverted[i]) {
-        F += sentences_[n].second;
-      }
-      F /= vsum;  // normalizes by all sentence frequency.
+      // The frequency of sentencepieces[i], normalized by all sentence
+      // frequency. Every occurrence in a Viterbi path adds the frequency of
+      // its sentence, so this equals freq[i] and needs no sentence lookup.
+      const float F = freq[i] / vsum;
 
       // The logprob with the sentencepiece[i].
       const float logprob_sp = std::log(static_cast<double>(freq[i])) - logsum;
@@ -581,6 +1633,23 @@ TrainerModel::SentencePieces Trainer::FinalizeSentencePieces(
   return Sorted(final_sentencepieces);
 }
 
+util::Status Trainer::SaveSweepModel(const TrainerModel &model,
+                                     int vocab_size) {
+  const TrainerSpec trainer_spec = trainer_spec_;
+  trainer_spec_.set_vocab_size(vocab_size);
+  trainer_spec_.set_model_prefix(
+      absl::StrCat(trainer_spec.model_prefix(), "_") +
+      absl::StrCat(vocab_size));
+  trainer_spec_.clear_vocab_size_sweep();
+  LOG(INFO) << "Saving the model of vocab_size=" << vocab_size << " to "
+            << trainer_spec_.model_prefix();
+  final_pieces_ = FinalizeSentencePieces(model);
+  const util::Status status = Save();
+  trainer_spec_ = trainer_spec;
+  final_pieces_.clear();
+  return status;
+}
+
 util::Status Trainer::Train() {
   RETURN_IF_ERROR(status());
 
@@ -592,49 +1661,192 @@ util::Status Trainer::Train() {
   RETURN_IF_ERROR(model.status());
   RETURN_IF_ERROR(LoadSentences());
 
-  auto seed_sentencepieces = MakeSeedSentencePieces();
-  model.SetSentencePieces(std::move(seed_sentencepieces));
+  if (trainer_spec_.num_distributed_processes() > 1) {
+    if (!is_coordinator()) {
+      // Prepares the sentences as process 0 does before the EM training.
+      RETURN_IF_ERROR(RemovePretokenizationDelimiter());
+      if (trainer_spec_.split_by_whitespace()) {
+        RETURN_IF_ERROR(SplitSentencesByWhitespace());
+      }
+      LOG(INFO) << "Serving the steps of process 0 with "
+                << sentences_->size() << " sentences";
+      return ServeDistributedSteps();
+    }
+    // Removes the files of the previous runs, e.g., the last kDoneStep,
+    // which the other processes would read as the steps of this run.
+    std::error_code ec;
+    std::filesystem::create_directories(trainer_spec_.distributed_dir(), ec);
+    CHECK_OR_RETURN(!ec) << ec.message();
+    for (const auto &entry : std::filesystem::directory_iterator(
+             trainer_spec_.distributed_dir(), ec)) {
+      const std::string name = entry.path().filename().string();
+      if (absl::StartsWith(name, "step-") ||
+          absl::StartsWith(name, "result-")) {
+        std::filesystem::remove(entry.path(), ec);
+      }
+    }
+  }
+
+  int64 round = 0;
+  if (trainer_spec_.resume_from().empty()) {
+    ScopedPhase phase(this, "seed");
+    auto seed_sentencepieces = MakeSeedSentencePieces();
+    RETURN_IF_ERROR(SaveCheckpoint(round, seed_sentencepieces));
+    model.SetSentencePieces(std::move(seed_sentencepieces));
+  } else {
+    TrainerModel::SentencePieces sentencepieces;
+    RETURN_IF_ERROR(LoadCheckpoint(&round, &sentencepieces));
+    CHECK_OR_RETURN(!sentencepieces.empty());
+    LOG(INFO) << "Resuming from round " << round << " with "
+              << sentencepieces.size() << " pieces";
+    RETURN_IF_ERROR(RemovePretokenizationDelimiter());
+    model.SetSentencePieces(std::move(sentencepieces));
+  }
 
   if (trainer_spec_.split_by_whitespace()) {
-    SplitSentencesByWhitespace();
+    RETURN_IF_ERROR(SplitSentencesByWhitespace());
   }
 
-  LOG(INFO) << "Using " << sentences_.size() << " sentences for EM training";
+  LOG(INFO) << "Using " << sentences_->size() << " sentences for EM training";
+  local_shards_.clear();
+
+  // The sizes of vocab_size_sweep in the descending order. The pruning stops
+  // at every one of them before vocab_size. The sizes which a resumed model
+  // is already smaller than were saved before the checkpoint.
+  std::vector<int> sweep_sizes;
+  for (const auto size :
+       absl::StrSplit(trainer_spec_.vocab_size_sweep(), ',')) {
+    int32 vocab_size = 0;
+    CHECK_OR_RETURN(absl::SimpleAtoi(size, &vocab_size));
+    if (trainer_spec_.resume_from().empty() ||
+        static_cast<int>(vocab_size * 1.1) <= model.GetPieceSize()) {
+      sweep_sizes.push_back(vocab_size);
+    }
+  }
+  std::sort(sweep_sizes.begin(), sweep_sizes.end(), std::greater<int>());
+  auto set_desired_vocab_size = [&]() {
+    desired_vocab_size_ = static_cast<size_t>(
+        (sweep_sizes.empty() ? trainer_spec_.vocab_size()
+                             : sweep_sizes.front()) *
+        1.1);
+  };
+  set_desired_vocab_size();
 
-  desired_vocab_size_ = static_cast<size_t>(trainer_spec_.vocab_size() * 1.1);
+  std::unique_ptr<EStepCache> cache;
+  if (trainer_spec_.incremental_e_step_tolerance() > 0.0) {
+    cache = std::make_unique<EStepCache>();
+  }
+
+  // Stepwise EM runs the sub-iterations but the last on mini-batches, which
+  // only depend on the round so that resume_from reproduces them.
+  const int num_sub_iterations = trainer_spec_.num_sub_iterations();
+  const uint64 mini_batch_size = trainer_spec_.em_mini_batch_size();
+  const bool stepwise =
+      mini_batch_size > 0 && mini_batch_size < sentences_->size();
+  const uint64 num_batches =
+      stepwise ? (sentences_->size() + mini_batch_size - 1) / mini_batch_size
+               : 1;
+  int64 all_sentence_freq = 0;
+  if (stepwise) {
+    auto cursor = sentences_->NewCursor();
+    for (; !cursor->done(); cursor->Next()) {
+      all_sentence_freq += cursor->value().second;
+    }
+    RETURN_IF_ERROR(cursor->status());
+  }
 
   while (true) {
+    // The running counts of stepwise EM in the ids of `model`.
+    std::vector<float> running;
+
     // Sub-EM iteration.
-    for (int iter = 0; iter < trainer_spec_.num_sub_iterations(); ++iter) {
+    for (int iter = 0; iter < num_sub_iterations; ++iter) {
       // Executes E step
       float objective = 0.0;
       int64 num_tokens = 0;
-      const auto expected = RunEStep(model, &objective, &num_tokens);
-
-      // Executes M step.
-      auto new_sentencepieces = RunMStep(model, expected);
-      model.SetSentencePieces(std::move(new_sentencepieces));
-
-      LOG(INFO) << "EM sub_iter=" << iter << " size=" << model.GetPieceSize()
-                << " obj=" << objective << " num_tokens=" << num_tokens
+      const bool mini_batch = stepwise && iter + 1 < num_sub_iterations;
+      ScopedPhase e_step_phase(this, "e_step");
+      std::vector<float> expected;
+      if (mini_batch) {
+        const uint64 batch =
+            (round * (num_sub_iterations - 1) + iter) % num_batches;
+        const auto counts =
+            RunMiniBatchEStep(model, batch, num_batches, all_sentence_freq,
+                              &objective, &num_tokens);
+        const float step = std::pow(iter + 1.0, -kStepwiseEMDecay);
+        running.resize(counts.size(), 0.0);
+        for (size_t i = 0; i < counts.size(); ++i) {
+          running[i] += step * (counts[i] - running[i]);
+        }
+      } else {
+        expected = RunEStep(model, &objective, &num_tokens, cache.get());
+      }
+      e_step_phase.End();
+
+      // Executes M step. It only drops pieces, so the trie is kept. A
+      // mini-batch does not see every piece, so only the full E step drops
+      // them and the running counts keep the ids of `model`.
+      ScopedPhase m_step_phase(this, "m_step");
+      auto new_sentencepieces = mini_batch
+                                    ? RunMStep(model, running, true)
+                                    : RunMStep(model, expected);
+      model.UpdateSentencePieces(std::move(new_sentencepieces));
+      TrainerEvent event;
+      event.type = TrainerEvent::EM_ITERATION;
+      event.iteration = iter;
+      event.objective = objective;
+      event.num_tokens = num_tokens;
+      event.num_pieces = model.GetPieceSize();
+      Notify(&event);
+      m_step_phase.End();
+
+      LOG(INFO) << "EM sub_iter=" << iter << (mini_batch ? " mini_batch" : "")
+                << " size=" << model.GetPieceSize() << " obj=" << objective
+                << " num_tokens=" << num_tokens
                 << " num_tokens/piece="
                 << 1.0 * num_tokens / model.GetPieceSize();
     }  // end of Sub EM iteration
 
-    // Stops the iteration when the size of sentences reaches to the
-    // desired symbol size.
+    // Saves the models of the sweep sizes reached, and then stops the
+    // iteration when the size of sentences reaches to the desired symbol
+    // size.
+    while (!sweep_sizes.empty() &&
+           model.GetPieceSize() <= desired_vocab_size_) {
+      RETURN_IF_ERROR(SaveSweepModel(model, sweep_sizes.front()));
+      sweep_sizes.erase(sweep_sizes.begin());
+      set_desired_vocab_size();
+    }
     if (model.GetPieceSize() <= desired_vocab_size_) {
       break;
     }
 
     // Prunes pieces.
-    auto new_sentencepieces = PruneSentencePieces(model);
+    ScopedPhase prune_phase(this, "prune");
+    auto new_sentencepieces = PruneSentencePieces(model, cache.get());
     model.SetSentencePieces(std::move(new_sentencepieces));
+    TrainerEvent event;
+    event.type = TrainerEvent::PIECES_PRUNED;
+    event.num_pieces = model.GetPieceSize();
+    Notify(&event);
+    prune_phase.End();
+    RETURN_IF_ERROR(SaveCheckpoint(++round, model.GetSentencePieces()));
   }  // end of EM iteration
 
+  if (is_coordinator()) {
+    RETURN_IF_ERROR(SendDistributedStep(kDoneStep, nullptr));
+    // Waits for the other processes to read kDoneStep, so that no step file
+    // is left in distributed_dir.
+    std::vector<float> counts;
+    float objective = 0.0;
+    RETURN_IF_ERROR(ReceiveDistributedResults(&counts, &objective, nullptr));
+  }
+
   // Finally, adjusts the size of sentencepices to be |vocab_size|.
+  ScopedPhase finalize_phase(this, "finalize");
   final_pieces_ = FinalizeSentencePieces(model);
+  finalize_phase.End();
 
+  ScopedPhase save_phase(this, "save");
   return Save();
 }
 }  // namespace unigram
@@ -49,12 +49,29 @@ class TrainerModel : public Model {
   // The meta symbols, e.g., </s> are NOT included.
   void SetSentencePieces(SentencePieces &&sentencepieces);
 
+  // Same as SetSentencePieces(), but keeps the trie when `sentencepieces`
+  // are a subset of its pieces, e.g., after the M step, and only masks the
+  // removed ones. The trie is rebuilt once more than
+  // kMaxRemovedTrieFraction of its pieces are removed.
+  void UpdateSentencePieces(SentencePieces &&sentencepieces);
+
+  static constexpr float kMaxRemovedTrieFraction = 0.5;
+
   EncodeResult Encode(absl::string_view normalized) const override {
     return {};
   }
 
  private:
+  // Sets the pieces but the trie. Returns the pieces with their ids.
+  std::vector<std::pair<absl::string_view, int>> SetPiecesAndScores(
+      SentencePieces &&sentencepieces);
+
+  // Maps the current trie to the current pieces. Returns false if a piece
+  // is not in it or too many of its pieces are removed.
+  bool RemapTrie();
+
   SentencePieces sentencepieces_;
+  size_t trie_size_ = 0;  // The number of pieces in the trie.
   TrainerSpec trainer_spec_;
   NormalizerSpec normalizer_spec_;
   ModelProto model_proto_data_;
@@ -74,6 +91,11 @@ class Trainer : public TrainerInterface {
 
  private:
   FRIEND_TEST(TrainerTest, IsValidSentencePieceTest);
+  FRIEND_TEST(UnigramTrainerTest, CheckpointTest);
+
+  // Removes the pretokenization delimiter from the sentences as
+  // MakeSeedSentencePieces() does, when it is skipped by resume_from.
+  util::Status RemovePretokenizationDelimiter();
 
   // Makes seed pieces from the training corpus.
   // The size of seed pieces is determined by seed_sentencepiece_size.
@@ -82,29 +104,177 @@ class Trainer : public TrainerInterface {
   template <typename node_int_type>
   TrainerModel::SentencePieces MakeSeedSentencePiecesInternal();
 
+  // Returns the valid pieces of seed_sentencepieces_file scored by their
+  // frequency times their length, unordered, including the `size` highest
+  // scored ones at least. The file is read in parallel chunks, and its
+  // lines are parsed and validated on the thread pool.
+  TrainerModel::SentencePieces ReadSeedSentencePieces(size_t size) const;
+
+  // Returns the `size` substrings of `corpus` scored highest by their
+  // frequency times their length, with the scores. `corpus` is sentences
+  // each followed by kSentenceBoundary, and is overwritten. An occurrence
+  // counts as the frequency of its sentence in `freqs`, or as 1 if `freqs`
+  // is nullptr.
+  template <typename node_int_type>
+  std::vector<std::pair<std::string, int64>> ExtractFrequentSubstrings(
+      std::vector<char32> *corpus, const std::vector<int64> *freqs,
+      size_t size) const;
+
+  // ExtractFrequentSubstrings() of the corpus `array` of the ranks of the
+  // characters, `chars` mapping the ranks back to the characters.
+  template <typename node_int_type, typename rank_type>
+  std::vector<std::pair<std::string, int64>> ExtractFrequentRankSubstrings(
+      const std::vector<rank_type> &array, const std::vector<char32> &chars,
+      const std::vector<int64> *freqs, size_t size) const;
+
+  // The results of the E step of every sentence, which are reused by the
+  // following E steps once the sentence has converged. See
+  // TrainerSpec::incremental_e_step_tolerance. PruneSentencePieces() also
+  // fills it in its Viterbi pass, so that the next E step only rebuilds the
+  // lattices containing a pruned piece.
+  struct EStepCache {
+    enum Flag : uint8 {
+      kConverged = 1,  // Reused until a piece in the lattice is removed.
+      kExact = 2,      // Computed with the current scores.
+    };
+
+    // The sentences of one shard of ParallelForShards() as a CSR array:
+    // the k-th sentence has the expected counts `counts` of the pieces
+    // `ids` in [offsets[k], offsets[k + 1]).
+    struct Shard {
+      void Clear();
+
+      std::vector<uint64> offsets;
+      std::vector<int> ids;
+      std::vector<float> counts;  // Including the frequency of the sentence.
+      std::vector<float> z;       // The frequency times the log likelihood.
+      std::vector<int> num_tokens;
+      std::vector<uint8> flags;
+    };
+
+    // The pieces indexed by the ids of `shards`.
+    std::vector<std::string> pieces;
+    std::vector<Shard> shards;
+  };
+
+  // Adds the expected counts of `lattice` of a sentence of `freq` to
+  // `scratch`, which has the size of the vocabulary, and the ids of its
+  // nodes to `ids`, with the `beam` of Lattice::PopulateMarginal(). Returns
+  // the log likelihood times `freq`.
+  static float AddExpected(const Lattice &lattice, int64 freq, float beam,
+                           std::vector<float> *scratch, std::vector<int> *ids);
+
+  // Appends the counts of `scratch` added by AddExpected() for the windows
+  // of a sentence to `shard`, with their summed log likelihood `Z`. Leaves
+  // `scratch` zero and `ids` empty.
+  static void AppendExpected(float Z, int num_tokens, uint8 flags,
+                             std::vector<float> *scratch,
+                             std::vector<int> *ids, EStepCache::Shard *shard);
+
+  // Returns the ids of `model` of the pieces of `cache`, or -1 for the
+  // removed ones.
+  static std::vector<int> GetCacheIdMap(const TrainerModel &model,
+                                        const EStepCache &cache);
+
+  // Sets the pieces of `cache` to the ones of `model`.
+  static void SetCachePieces(const TrainerModel &model, EStepCache *cache);
+
   // Executes the E step of EM and returns expected count.
   // The index of return array is the vocab id.
   // |objective| is a negative likelihood of the current model.
   // |num_token| is the number of total tokens to tokenize
   // training corpus.
+  // With |cache|, the converged sentences in it are not recomputed and the
+  // cache is updated with the other sentences.
   std::vector<float> RunEStep(const TrainerModel &model, float *objective,
-                              int64 *num_tokens) const;
+                              int64 *num_tokens,
+                              EStepCache *cache = nullptr) const;
+
+  // Executes the E step on the |batch|-th of |num_batches| mini-batches,
+  // which interleave over the sentences, and returns their expected counts
+  // scaled to the whole corpus of |all_sentence_freq|, i.e., multiplied by
+  // |all_sentence_freq| over the frequency of the sentences. |objective| is
+  // the negative likelihood per sentence and |num_tokens| is scaled
+  // likewise. See TrainerSpec::em_mini_batch_size.
+  std::vector<float> RunMiniBatchEStep(const TrainerModel &model,
+                                       size_t batch, size_t num_batches,
+                                       int64 all_sentence_freq,
+                                       float *objective,
+                                       int64 *num_tokens) const;
+
+  // Segments the sentences with the Viterbi algorithm and returns the
+  // frequencies of the pieces in the best paths. |vsum| is the sum of the
+  // frequencies of the sentences. See PruneSentencePieces() for |cache|.
+  std::vector<float> RunViterbiStep(const TrainerModel &model,
+                                    EStepCache *cache, float *vsum) const;
+
+  // The steps which process 0 of distributed training asks the other
+  // processes to run on their sentences. See
+  // TrainerSpec::num_distributed_processes.
+  enum DistributedStep : uint32 {
+    kEStep = 1,        // RunEStep().
+    kViterbiStep = 2,  // RunViterbiStep().
+    kDoneStep = 3,     // Finishes the other processes.
+  };
+
+  // Returns true if this process coordinates distributed training.
+  bool is_coordinator() const {
+    return trainer_spec_.num_distributed_processes() > 1 &&
+           trainer_spec_.distributed_process_id() == 0;
+  }
+
+  // Returns the range of the sentences of this process.
+  std::pair<size_t, size_t> GetLocalSentences() const;
+
+  // Returns the bounds of the ParallelForShards() shards of the sentences of
+  // this process, relative to GetLocalSentences().first. The shards have
+  // about the same bytes rather than the same number of sentences, so that
+  // a shard of long sentences does not leave one thread as a straggler.
+  // Computed on first use, as the sentences are fixed during EM.
+  const std::vector<size_t> &GetLocalShards() const;
+
+  // Asks the other processes to run `step` with `model`.
+  util::Status SendDistributedStep(DistributedStep step,
+                                   const TrainerModel *model) const;
+
+  // Waits for the results of the other processes for the last step, and
+  // adds them to `counts`, `objective` and `num_tokens` if not null.
+  util::Status ReceiveDistributedResults(std::vector<float> *counts,
+                                         float *objective,
+                                         int64 *num_tokens) const;
+
+  // Runs the steps asked by process 0 until it finishes.
+  util::Status ServeDistributedSteps();
 
   // Executes the M step of EM with the expected frequency and
-  // returns new pieces.
-  TrainerModel::SentencePieces RunMStep(
-      const TrainerModel &model, const std::vector<float> &expected) const;
+  // returns new pieces. With |keep_pieces|, the infrequent pieces are kept
+  // with the score of the frequency threshold instead of being dropped.
+  TrainerModel::SentencePieces RunMStep(const TrainerModel &model,
+                                        const std::vector<float> &expected,
+                                        bool keep_pieces = false) const;
 
   // Heuristically prunes the current pieces.
   // This is called after each EM sub-iteration.
+  // With |cache|, the results of the sentences with the current model are
+  // stored in it for the next E step.
   TrainerModel::SentencePieces PruneSentencePieces(
-      const TrainerModel &model) const;
+      const TrainerModel &model, EStepCache *cache = nullptr) const;
 
   // Makes the final sentence pieces by incorporating the required characters
   // and control/user defined symbols.
   TrainerModel::SentencePieces FinalizeSentencePieces(
       const TrainerModel &model) const;
 
+  // Saves the model of `vocab_size` of vocab_size_sweep finalized from
+  // `model` to <model_prefix>_<vocab_size>.
+  util::Status SaveSweepModel(const TrainerModel &model, int vocab_size);
+
+  // The number of the distributed steps sent or served so far.
+  mutable int64 distributed_step_ = 0;
+
+  // The shards of GetLocalShards().
+  mutable std::vector<size_t> local_shards_;
+
   // When the size of SentencePieces becomes less than desired_vocab_size_,
   // break the main training loop. desired_vocab_size_ = 1.1 * vocab_size_
   // for now.
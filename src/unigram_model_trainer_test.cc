@@ -14,7 +14,12 @@
 
 #include "unigram_model_trainer.h"
 
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "filesystem.h"
@@ -39,6 +44,61 @@ TEST(UnigramTrainerTest, TrainerModelTest) {
   EXPECT_EQ(EncodeResult(), model.Encode("test"));
 }
 
+TEST(UnigramTrainerTest, UpdateSentencePiecesTest) {
+  TrainerSpec trainer_spec;
+  NormalizerSpec normalizer_spec;
+  auto set_pieces = [&](TrainerModel *model,
+                        TrainerModel::SentencePieces pieces, bool update) {
+    if (update) {
+      model->UpdateSentencePieces(std::move(pieces));
+    } else {
+      model->SetSentencePieces(std::move(pieces));
+    }
+  };
+  // Returns the pieces, ids and scores in the lattice of `text`.
+  auto populate = [](const TrainerModel &model, absl::string_view text) {
+    Lattice lattice;
+    lattice.SetSentence(text);
+    model.PopulateNodes(&lattice);
+    std::vector<std::string> nodes;
+    for (int pos = 0; pos < lattice.size(); ++pos) {
+      for (const auto *node : lattice.begin_nodes(pos)) {
+        nodes.push_back(absl::StrCat(node->piece, ":") +
+                        absl::StrCat(node->id, ":") +
+                        absl::StrCat(node->score));
+      }
+    }
+    return nodes;
+  };
+
+  TrainerModel model(trainer_spec, normalizer_spec);
+  set_pieces(&model,
+             {{"a", -1.0}, {"b", -2.0}, {"ab", -3.0}, {"abc", -4.0},
+              {"c", -5.0}, {"bc", -6.0}},
+             false);
+
+  // Drops and reorders the pieces without rebuilding the trie.
+  const TrainerModel::SentencePieces updated = {
+      {"c", -1.5}, {"ab", -2.5}, {"a", -3.5}, {"bc", -4.5}};
+  set_pieces(&model, updated, true);
+  TrainerModel expected(trainer_spec, normalizer_spec);
+  set_pieces(&expected, updated, false);
+  EXPECT_EQ(populate(expected, "abcab"), populate(model, "abcab"));
+  EXPECT_EQ(4, model.GetPieceSize());
+  EXPECT_EQ(3, model.PieceToId("bc"));
+  EXPECT_EQ(2, model.PieceToId("a"));
+
+  // Too many removed pieces or a new piece rebuild the trie.
+  for (const TrainerModel::SentencePieces &pieces :
+       {TrainerModel::SentencePieces{{"ab", -1.0}},
+        TrainerModel::SentencePieces{{"a", -1.0}, {"d", -2.0}, {"c", -3.0}},
+        updated}) {
+    set_pieces(&model, pieces, true);
+    set_pieces(&expected, pieces, false);
+    EXPECT_EQ(populate(expected, "abcabd"), populate(model, "abcabd"));
+  }
+}
+
 struct TrainerResult {
   std::string sentence_pieces;
   std::vector<std::pair<std::string, float>> seed_pieces_and_probs;
@@ -148,10 +208,517 @@ TEST(UnigramTrainerTest, BasicDPTest) {
   }
 }
 
+TEST(UnigramTrainerTest, CheckpointTest) {
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::UNIGRAM);
+  trainer_spec.add_input(util::JoinPath(::testing::SrcDir(), "botchan.txt"));
+  trainer_spec.set_vocab_size(1000);
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("nmt_nfkc");
+  NormalizerSpec denormalizer_spec;
+  const std::string checkpoint =
+      util::JoinPath(::testing::TempDir(), "checkpoint");
+
+  // Returns the vocab trained with `spec`.
+  auto train = [&](const TrainerSpec &spec, absl::string_view name) {
+    TrainerSpec s = spec;
+    s.set_model_prefix(util::JoinPath(::testing::TempDir(), name));
+    Trainer trainer(s, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.Train());
+    std::string vocab;
+    auto input = filesystem::NewReadableFile(s.model_prefix() + ".vocab");
+    EXPECT_TRUE(input->ReadAll(&vocab));
+    return vocab;
+  };
+
+  // Writes a checkpoint of the seeds as an interrupted run does.
+  trainer_spec.set_checkpoint_file(checkpoint);
+  trainer_spec.set_model_prefix(
+      util::JoinPath(::testing::TempDir(), "interrupted"));
+  {
+    Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    EXPECT_OK(trainer.SaveCheckpoint(0, trainer.MakeSeedSentencePieces()));
+  }
+  trainer_spec.clear_checkpoint_file();
+  TrainerSpec resume_spec = trainer_spec;
+  resume_spec.set_resume_from(checkpoint);
+  EXPECT_EQ(train(trainer_spec, "uninterrupted"),
+            train(resume_spec, "resumed"));
+
+  // The last checkpoint resumes the final round.
+  trainer_spec.set_checkpoint_file(checkpoint);
+  const std::string vocab = train(trainer_spec, "checkpointed");
+  EXPECT_EQ(vocab, train(resume_spec, "resumed"));
+
+  // Other options do not resume the checkpoint.
+  resume_spec.set_vocab_size(2000);
+  Trainer trainer(resume_spec, normalizer_spec, denormalizer_spec);
+  EXPECT_FALSE(trainer.Train().ok());
+
+  trainer_spec.set_model_type(TrainerSpec::BPE);
+  EXPECT_FALSE(
+      TrainerInterface(trainer_spec, normalizer_spec, denormalizer_spec)
+          .status()
+          .ok());
+}
+
+TEST(UnigramTrainerTest, PhasesTest) {
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::UNIGRAM);
+  trainer_spec.add_input(util::JoinPath(::testing::SrcDir(), "botchan.txt"));
+  trainer_spec.set_vocab_size(1000);
+  trainer_spec.set_model_prefix(util::JoinPath(::testing::TempDir(), "phases"));
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("nmt_nfkc");
+  NormalizerSpec denormalizer_spec;
+
+  Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+  EXPECT_TRUE(trainer.phases().empty());
+  EXPECT_OK(trainer.Train());
+
+  std::vector<std::string> names;
+  for (const auto &phase : trainer.phases()) {
+    EXPECT_GE(phase.wall_time, 0.0);
+    EXPECT_GE(phase.cpu_time, 0.0);
+    if (names.empty() || names.back() != phase.name) {
+      names.push_back(phase.name);
+    }
+  }
+  EXPECT_EQ("load_sentences", names.front());
+  EXPECT_EQ("save", names.back());
+  for (const char *name : {"normalize", "seed", "e_step", "m_step", "prune",
+                           "finalize"}) {
+    EXPECT_NE(names.end(), std::find(names.begin(), names.end(), name));
+  }
+}
+
+TEST(UnigramTrainerTest, MemoryUsageTest) {
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::UNIGRAM);
+  trainer_spec.add_input(util::JoinPath(::testing::SrcDir(), "botchan.txt"));
+  trainer_spec.set_vocab_size(1000);
+  trainer_spec.set_model_prefix(util::JoinPath(::testing::TempDir(), "memory"));
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("nmt_nfkc");
+  NormalizerSpec denormalizer_spec;
+
+  Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+  EXPECT_EQ(0, trainer.GetMemoryUsage().bytes("sentences"));
+  EXPECT_OK(trainer.Train());
+
+  const auto usage = trainer.GetMemoryUsage();
+  EXPECT_GT(usage.bytes("sentences"), 0);
+  EXPECT_GT(usage.bytes("final_pieces"), 0);
+  EXPECT_EQ(0, usage.bytes("suffix_array"));
+
+  // The suffix array is measured while it exists, and holds a few words per
+  // character of the corpus.
+  const auto &peak = trainer.peak_memory_usage();
+  EXPECT_GT(peak.bytes("suffix_array"), 4 * peak.bytes("sentences") / 10);
+  EXPECT_GE(peak.total(), usage.total());
+}
+
 namespace {
 
 static constexpr char kTestInputData[] = "wagahaiwa_nekodearu.txt";
 
+TEST(UnigramTrainerTest, ShardedSeedSentencePiecesTest) {
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::UNIGRAM);
+  trainer_spec.add_input(util::JoinPath(::testing::SrcDir(), kTestInputData));
+  trainer_spec.set_vocab_size(4000);
+  trainer_spec.set_seed_sentencepiece_size(10000);
+  trainer_spec.set_model_prefix(
+      util::JoinPath(::testing::TempDir(), "sharded_seed_model"));
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("identity");
+  NormalizerSpec denormalizer_spec;
+
+  auto make_seeds = [&](uint64 shard_size) {
+    trainer_spec.set_seed_sentencepiece_shard_size(shard_size);
+    Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    return trainer.MakeSeedSentencePieces();
+  };
+
+  const auto seeds = make_seeds(0);
+  // One shard is the whole corpus.
+  EXPECT_EQ(seeds, make_seeds(1ULL << 40));
+
+  // The most frequent substrings are the best ones of some shard, and are
+  // counted exactly.
+  const auto sharded = make_seeds(50000);
+  EXPECT_EQ(seeds.size(), sharded.size());
+  const int kTop = 200;
+  std::map<std::string, float> top, sharded_top;
+  for (int i = 0; i < kTop; ++i) {
+    top.emplace(seeds[i]);
+    sharded_top.emplace(sharded[i]);
+  }
+  // The scores are normalized by the sum of all the seeds.
+  std::vector<std::string> missed;
+  float offset = 0.0;
+  for (const auto &it : top) {
+    const auto found = sharded_top.find(it.first);
+    if (found == sharded_top.end()) {
+      missed.push_back(it.first);
+      continue;
+    }
+    if (offset == 0.0) offset = found->second - it.second;
+    EXPECT_NEAR(offset, found->second - it.second, 1e-3);
+  }
+  EXPECT_LE(missed.size(), kTop / 20);
+}
+
+TEST(UnigramTrainerTest, WeightedSeedSentencePiecesTest) {
+  const std::string input_file =
+      util::JoinPath(::testing::TempDir(), "weighted_input");
+  {
+    auto output = filesystem::NewWritableFile(input_file);
+    output->WriteLine("abcd\t1000");
+    output->WriteLine("abxy\t1");
+    output->WriteLine("xyzw\t1");
+    output->WriteLine("xyq\t1");
+  }
+
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::UNIGRAM);
+  trainer_spec.set_input_format("tsv");
+  trainer_spec.add_input(input_file);
+  trainer_spec.set_character_coverage(1.0);
+  trainer_spec.set_model_prefix(
+      util::JoinPath(::testing::TempDir(), "weighted_model"));
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("identity");
+  normalizer_spec.set_add_dummy_prefix(false);
+  NormalizerSpec denormalizer_spec;
+
+  // The shards of 6 characters are "abcd abxy" and "xyzw xyq".
+  for (const uint64 shard_size : {0, 6}) {
+    trainer_spec.set_seed_sentencepiece_shard_size(shard_size);
+    Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    std::map<std::string, float> seeds;
+    for (const auto &it : trainer.MakeSeedSentencePieces()) {
+      seeds.emplace(it);
+    }
+    // "ab" occurs 1001 times and "xy" 3 times.
+    ASSERT_TRUE(seeds.count("ab"));
+    ASSERT_TRUE(seeds.count("xy"));
+    EXPECT_NEAR(std::log(1001.0 / 3.0), seeds["ab"] - seeds["xy"], 1e-3);
+  }
+}
+
+TEST(UnigramTrainerTest, SeedSentencePiecesFileTest) {
+  // The i-th piece is i in base 26 with the letters, and occurs i times.
+  constexpr int kNumPieces = 20000;
+  auto piece = [](int i) {
+    std::string result(4, 'a');
+    for (int k = 3; k >= 0; --k, i /= 26) result[k] += i % 26;
+    return result;
+  };
+  const std::string seed_file =
+      util::JoinPath(::testing::TempDir(), "seed_sentencepieces");
+  {
+    auto output = filesystem::NewWritableFile(seed_file);
+    for (int i = 1; i <= kNumPieces; ++i) {
+      output->WriteLine(absl::StrCat(piece(i), "\t", i));
+    }
+    // Not a valid piece.
+    output->WriteLine("x" WS "y\t1000000");
+  }
+
+  TrainerSpec trainer_spec;
+  trainer_spec.set_model_type(TrainerSpec::UNIGRAM);
+  trainer_spec.add_input(util::JoinPath(::testing::SrcDir(), kTestInputData));
+  trainer_spec.set_seed_sentencepieces_file(seed_file);
+  trainer_spec.set_seed_sentencepiece_size(5000);
+  trainer_spec.set_model_prefix(
+      util::JoinPath(::testing::TempDir(), "seed_file_model"));
+  NormalizerSpec normalizer_spec;
+  normalizer_spec.set_name("identity");
+  NormalizerSpec denormalizer_spec;
+
+  auto make_seeds = [&](int num_threads) {
+    trainer_spec.set_num_threads(num_threads);
+    Trainer trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    EXPECT_OK(trainer.LoadSentences());
+    return trainer.MakeSeedSentencePieces();
+  };
+
+  const auto seeds = make_seeds(1);
+  EXPECT_EQ(seeds, make_seeds(4));
+  EXPECT_EQ(5000, seeds.size());
+
+  // The seeds are ordered by their scores, and the pieces of the file are
+  // the most frequent ones.
+  int expected = kNumPieces;
+  for (size_t i = 0; i < seeds.size(); ++i) {
+    EXPECT_NE("x" WS "y", seeds[i].first);
+    if (i > 0) EXPECT_GE(seeds[i - 1].second, seeds[i].second);
+    if (seeds[i].first.size() == 4) {
+      EXPECT_EQ(piece(expected), seeds[i].first);
+      --expected;
+    }
+  }
+  EXPECT_LT(expected, kNumPieces);
+}
+
+TEST(UnigramTrainerTest, IncrementalEStepTest) {
+  auto train = [](float tolerance) {
+    const std::string prefix = util::JoinPath(
+        ::testing::TempDir(), absl::StrCat("incremental_model", tolerance));
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=",
+                                 util::JoinPath(::testing::SrcDir(),
+                                                "botchan.txt"),
+                                 " --vocab_size=1000 --model_type=unigram",
+                                 " --incremental_e_step_tolerance=",
+                                 tolerance))
+                    .ok());
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(prefix + ".model").ok());
+    std::set<std::string> pieces;
+    for (int i = 0; i < sp.GetPieceSize(); ++i) {
+      pieces.insert(sp.IdToPiece(i));
+    }
+    return pieces;
+  };
+
+  // The converged sentences only change slightly in the following E steps.
+  const auto pieces = train(0.0);
+  const auto incremental = train(0.01);
+  EXPECT_EQ(pieces.size(), incremental.size());
+  int common = 0;
+  for (const auto &piece : incremental) common += pieces.count(piece);
+  EXPECT_GE(common, pieces.size() * 0.98);
+}
+
+TEST(UnigramTrainerTest, EStepBeamTest) {
+  auto train = [](float beam) {
+    const std::string prefix = util::JoinPath(
+        ::testing::TempDir(), absl::StrCat("beam_model", beam));
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=",
+                                 util::JoinPath(::testing::SrcDir(),
+                                                "botchan.txt"),
+                                 " --vocab_size=1000 --model_type=unigram",
+                                 " --e_step_beam=", beam))
+                    .ok());
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(prefix + ".model").ok());
+    std::set<std::string> pieces;
+    for (int i = 0; i < sp.GetPieceSize(); ++i) {
+      pieces.insert(sp.IdToPiece(i));
+    }
+    return pieces;
+  };
+
+  // The paths far below the best one hardly change the expected counts.
+  const auto pieces = train(0.0);
+  const auto beam = train(10.0);
+  EXPECT_EQ(pieces.size(), beam.size());
+  int common = 0;
+  for (const auto &piece : beam) common += pieces.count(piece);
+  EXPECT_GE(common, pieces.size() * 0.98);
+}
+
+TEST(UnigramTrainerTest, EStepWindowTest) {
+  auto train = [](const std::string &input, const std::string &name,
+                  const std::string &flags) {
+    const std::string prefix = util::JoinPath(::testing::TempDir(), name);
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=", input,
+                                 " --vocab_size=1000 --model_type=unigram",
+                                 flags))
+                    .ok());
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(prefix + ".model").ok());
+    std::set<std::string> pieces;
+    for (int i = 0; i < sp.GetPieceSize(); ++i) {
+      pieces.insert(sp.IdToPiece(i));
+    }
+    return pieces;
+  };
+
+  // Cutting the sentences into short windows loses few pieces.
+  const std::string botchan =
+      util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  const auto pieces = train(botchan, "window_model0", " --e_step_window_size=0");
+  const auto windows =
+      train(botchan, "window_model32", " --e_step_window_size=32");
+  EXPECT_EQ(pieces.size(), windows.size());
+  int common = 0;
+  for (const auto &piece : windows) common += pieces.count(piece);
+  EXPECT_GE(common, pieces.size() * 0.9);
+
+  // With the whitespaces as suffixes, the windows end after them.
+  const auto suffix_pieces =
+      train(botchan, "window_suffix_model0",
+            " --e_step_window_size=0 --treat_whitespace_as_suffix=true");
+  const auto suffix_windows =
+      train(botchan, "window_suffix_model32",
+            " --e_step_window_size=32 --treat_whitespace_as_suffix=true");
+  EXPECT_EQ(suffix_pieces.size(), suffix_windows.size());
+  common = 0;
+  for (const auto &piece : suffix_windows) {
+    common += suffix_pieces.count(piece);
+  }
+  EXPECT_GE(common, suffix_pieces.size() * 0.9);
+
+  // Sentences of 64KB are trained on windows rather than whole lattices.
+  const std::string input_file =
+      util::JoinPath(::testing::TempDir(), "long_sentences");
+  {
+    auto input = filesystem::NewReadableFile(botchan);
+    auto output = filesystem::NewWritableFile(input_file);
+    std::string line, sentence;
+    while (input->ReadLine(&line)) {
+      sentence.append(line).append(" ");
+      if (sentence.size() >= 65536) {
+        output->WriteLine(sentence);
+        sentence.clear();
+      }
+    }
+  }
+  const auto long_pieces =
+      train(input_file, "long_window_model",
+            " --split_by_whitespace=false --max_sentence_length=131072"
+            " --e_step_window_size=1024");
+  EXPECT_EQ(1000, long_pieces.size());
+}
+
+TEST(UnigramTrainerTest, StepwiseEMTest) {
+  auto train = [](uint64 mini_batch_size) {
+    const std::string prefix = util::JoinPath(
+        ::testing::TempDir(), absl::StrCat("stepwise_model", mini_batch_size));
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=",
+                                 util::JoinPath(::testing::SrcDir(),
+                                                "botchan.txt"),
+                                 " --vocab_size=1000 --model_type=unigram",
+                                 " --num_sub_iterations=3",
+                                 " --em_mini_batch_size=", mini_batch_size))
+                    .ok());
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(prefix + ".model").ok());
+    std::set<std::string> pieces;
+    for (int i = 0; i < sp.GetPieceSize(); ++i) {
+      pieces.insert(sp.IdToPiece(i));
+    }
+    return pieces;
+  };
+
+  // The 9165 words are split into mini-batches of about a third of them,
+  // which estimate the counts well enough for the full E step before the
+  // pruning.
+  const auto pieces = train(0);
+  const auto stepwise = train(3000);
+  EXPECT_EQ(pieces.size(), stepwise.size());
+  int common = 0;
+  for (const auto &piece : stepwise) common += pieces.count(piece);
+  EXPECT_GE(common, pieces.size() * 0.85);
+
+  // A mini-batch not smaller than the corpus is full EM.
+  EXPECT_EQ(pieces, train(1000000));
+}
+
+TEST(UnigramTrainerTest, VocabSizeSweepTest) {
+  const std::string input = util::JoinPath(::testing::SrcDir(), "botchan.txt");
+  auto train = [&](const std::string &name, const std::string &flags) {
+    const std::string prefix = util::JoinPath(::testing::TempDir(), name);
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=", input,
+                                 " --model_type=unigram ", flags))
+                    .ok());
+    return prefix;
+  };
+  auto read_vocab = [](const std::string &prefix) {
+    std::string vocab;
+    auto file = filesystem::NewReadableFile(prefix + ".vocab");
+    EXPECT_TRUE(file->ReadAll(&vocab));
+    return vocab;
+  };
+
+  const std::string sweep =
+      train("sweep_model", "--vocab_size=1000 --vocab_size_sweep=2000,1500");
+  const std::string sweep_vocab = read_vocab(sweep + "_2000");
+  // The largest size is trained exactly as alone.
+  EXPECT_EQ(read_vocab(train("standalone_2000", "--vocab_size=2000")),
+            sweep_vocab);
+  for (const int size : {1000, 1500}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(
+        sp.Load((size == 1000 ? sweep : absl::StrCat(sweep, "_", size)) +
+                ".model")
+            .ok());
+    EXPECT_EQ(size, sp.GetPieceSize());
+  }
+
+  EXPECT_FALSE(SentencePieceTrainer::Train(
+                   absl::StrCat("--model_prefix=", sweep, " --input=", input,
+                                " --vocab_size=1000 --vocab_size_sweep=500"))
+                   .ok());
+}
+
+TEST(UnigramTrainerTest, DistributedTest) {
+  const std::string dirname =
+      util::JoinPath(::testing::TempDir(), "distributed");
+  std::error_code ec;
+  std::filesystem::remove_all(dirname, ec);
+
+  auto train = [&](int num_processes, int process_id) {
+    const std::string prefix = util::JoinPath(
+        ::testing::TempDir(), absl::StrCat("distributed_model", process_id));
+    EXPECT_TRUE(SentencePieceTrainer::Train(
+                    absl::StrCat("--model_prefix=", prefix, " --input=",
+                                 util::JoinPath(::testing::SrcDir(),
+                                                "botchan.txt"),
+                                 " --vocab_size=1000 --model_type=unigram",
+                                 " --distributed_dir=", dirname,
+                                 " --num_distributed_processes=",
+                                 num_processes) +
+                    absl::StrCat(" --distributed_process_id=", process_id))
+                    .ok());
+    return prefix;
+  };
+  auto get_pieces = [](const std::string &prefix) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(prefix + ".model").ok());
+    std::set<std::string> pieces;
+    for (int i = 0; i < sp.GetPieceSize(); ++i) {
+      pieces.insert(sp.IdToPiece(i));
+    }
+    return pieces;
+  };
+
+  const auto pieces = get_pieces(train(1, 0));
+
+  std::thread worker([&]() { train(2, 1); });
+  const auto distributed = get_pieces(train(2, 0));
+  worker.join();
+
+  // Only the order of adding the expected frequencies differs.
+  EXPECT_EQ(pieces.size(), distributed.size());
+  int common = 0;
+  for (const auto &piece : distributed) common += pieces.count(piece);
+  EXPECT_GE(common, pieces.size() * 0.98);
+
+  // No step or result file is left.
+  EXPECT_TRUE(std::filesystem::is_empty(dirname, ec));
+
+  // Without process 0, process 1 gives up waiting for the first step.
+  const auto status = SentencePieceTrainer::Train(absl::StrCat(
+      "--model_prefix=",
+      util::JoinPath(::testing::TempDir(), "distributed_timeout"),
+      " --input=", util::JoinPath(::testing::SrcDir(), "botchan.txt"),
+      " --vocab_size=1000 --model_type=unigram --distributed_dir=", dirname,
+      " --num_distributed_processes=2 --distributed_process_id=1",
+      " --distributed_timeout_sec=1"));
+  EXPECT_EQ(status.code(), util::StatusCode::kDeadlineExceeded);
+}
+
 TEST(UnigramTrainerTest, EndToEndTest) {
   const std::string input =
       util::JoinPath(::testing::SrcDir(), kTestInputData);
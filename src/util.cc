@@ -15,9 +15,36 @@
 #include "util.h"
 
 #include <atomic>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <memory>
 
+#include "third_party/absl/strings/numbers.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/strings/str_split.h"
+#include "third_party/absl/strings/strip.h"
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The AVX2 kernels are compiled for the CPUs supporting them at runtime.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__AVX2__)
+#define SPM_AVX2_DISPATCH 1
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 namespace sentencepiece {
 
 namespace {
@@ -83,11 +110,115 @@ char32 DecodeUTF8(const char *begin, const char *end, size_t *mblen) {
   return kUnicodeError;
 }
 
+namespace {
+
+using ASCIIPrefixLengthFunc = size_t (*)(const char *data, size_t size);
+
+size_t ASCIIPrefixLengthScalar(const char *data, size_t size) {
+  size_t i = 0;
+  for (; i + sizeof(uint64) <= size; i += sizeof(uint64)) {
+    uint64 chunk;
+    memcpy(&chunk, data + i, sizeof(chunk));
+    if (chunk & 0x8080808080808080ULL) break;
+  }
+  while (i < size && static_cast<unsigned char>(data[i]) < 0x80) ++i;
+  return i;
+}
+
+#if defined(__SSE2__)
+size_t ASCIIPrefixLengthSSE2(const char *data, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const int mask = _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + ASCIIPrefixLengthScalar(data + i, size - i);
+}
+#endif
+
+#if defined(SPM_AVX2_DISPATCH) || defined(__AVX2__)
+#if defined(SPM_AVX2_DISPATCH)
+__attribute__((target("avx2")))
+#endif
+size_t ASCIIPrefixLengthAVX2(const char *data, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const uint32 mask = static_cast<uint32>(_mm256_movemask_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i))));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + ASCIIPrefixLengthScalar(data + i, size - i);
+}
+#endif
+
+ASCIIPrefixLengthFunc SelectASCIIPrefixLength() {
+#if defined(__AVX2__)
+  return ASCIIPrefixLengthAVX2;
+#else
+#if defined(SPM_AVX2_DISPATCH)
+  if (__builtin_cpu_supports("avx2")) return ASCIIPrefixLengthAVX2;
+#endif
+#if defined(__SSE2__)
+  return ASCIIPrefixLengthSSE2;
+#else
+  return ASCIIPrefixLengthScalar;
+#endif
+#endif
+}
+
+}  // namespace
+
+size_t ASCIIPrefixLength(absl::string_view str) {
+  static const ASCIIPrefixLengthFunc func = SelectASCIIPrefixLength();
+  return func(str.data(), str.size());
+}
+
+size_t CountChars(absl::string_view str) {
+  size_t num_chars = 0;
+  size_t pos = 0;
+  while (pos < str.size()) {
+    const size_t ascii = ASCIIPrefixLength(str.substr(pos));
+    num_chars += ascii;
+    pos += ascii;
+    // Steps over the characters up to the next ASCII byte.
+    while (pos < str.size() && static_cast<unsigned char>(str[pos]) >= 0x80) {
+      pos += OneCharLen(str.data() + pos);
+      ++num_chars;
+    }
+  }
+  return num_chars;
+}
+
+void ByteToCharOffsets(absl::string_view str, std::vector<int> *offsets) {
+  offsets->resize(str.size() + 1);
+  int *output = offsets->data();
+  int num_chars = 0;
+  size_t pos = 0;
+  while (pos < str.size()) {
+    const size_t ascii = ASCIIPrefixLength(str.substr(pos));
+    for (size_t i = 0; i < ascii; ++i) output[pos + i] = num_chars + i;
+    num_chars += ascii;
+    pos += ascii;
+    while (pos < str.size() && static_cast<unsigned char>(str[pos]) >= 0x80) {
+      const size_t end =
+          std::min<size_t>(pos + OneCharLen(str.data() + pos), str.size());
+      for (; pos < end; ++pos) output[pos] = num_chars;
+      ++num_chars;
+    }
+  }
+  output[str.size()] = num_chars;
+}
+
 bool IsStructurallyValid(absl::string_view str) {
   const char *begin = str.data();
   const char *end = str.data() + str.size();
   size_t mblen = 0;
   while (begin < end) {
+    if (static_cast<unsigned char>(*begin) < 0x80) {
+      begin += ASCIIPrefixLength(absl::string_view(begin, end - begin));
+      continue;
+    }
     const char32 c = DecodeUTF8(begin, end, &mblen);
     if (c == kUnicodeError && mblen != 3) return false;
     if (!IsValidCodepoint(c)) return false;
@@ -137,15 +268,32 @@ std::string UnicodeCharToUTF8(const char32 c) { return UnicodeTextToUTF8({c}); }
 
 UnicodeText UTF8ToUnicodeText(absl::string_view utf8) {
   UnicodeText uc;
+  UTF8ToUnicodeText(utf8, &uc);
+  return uc;
+}
+
+void UTF8ToUnicodeText(absl::string_view utf8, UnicodeText *output) {
+  output->clear();
   const char *begin = utf8.data();
   const char *end = utf8.data() + utf8.size();
   while (begin < end) {
-    size_t mblen;
-    const char32 c = DecodeUTF8(begin, end, &mblen);
-    uc.push_back(c);
-    begin += mblen;
+    // Widens the runs of ASCII bytes in bulk.
+    const size_t ascii =
+        ASCIIPrefixLength(absl::string_view(begin, end - begin));
+    if (ascii > 0) {
+      const size_t size = output->size();
+      output->resize(size + ascii);
+      const unsigned char *bytes =
+          reinterpret_cast<const unsigned char *>(begin);
+      std::copy(bytes, bytes + ascii, output->begin() + size);
+      begin += ascii;
+    }
+    while (begin < end && static_cast<unsigned char>(*begin) >= 0x80) {
+      size_t mblen;
+      output->push_back(DecodeUTF8(begin, end, &mblen));
+      begin += mblen;
+    }
   }
-  return uc;
 }
 
 std::string UnicodeTextToUTF8(const UnicodeText &utext) {
@@ -157,9 +305,79 @@ std::string UnicodeTextToUTF8(const UnicodeText &utext) {
   }
   return result;
 }
+
+void UTF16ToUTF8(std::u16string_view input, std::string *output,
+                 std::vector<uint32> *units) {
+  output->clear();
+  output->reserve(input.size());
+  if (units != nullptr) {
+    units->clear();
+    units->reserve(input.size() + 1);
+  }
+  char buf[4];
+  size_t pos = 0;
+  while (pos < input.size()) {
+    const size_t begin = pos;
+    char32 c = input[pos++];
+    if (c < 0x80) {
+      output->push_back(static_cast<char>(c));
+      if (units != nullptr) units->push_back(begin);
+      continue;
+    }
+    if (c >= 0xD800 && c <= 0xDBFF && pos < input.size() &&
+        input[pos] >= 0xDC00 && input[pos] <= 0xDFFF) {
+      c = 0x10000 + ((c - 0xD800) << 10) + (input[pos++] - 0xDC00);
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+      c = kUnicodeError;
+    }
+    const size_t mblen = EncodeUTF8(c, buf);
+    output->append(buf, mblen);
+    if (units != nullptr) units->insert(units->end(), mblen, begin);
+  }
+  if (units != nullptr) units->push_back(input.size());
+}
+
+void UTF8ToUTF16(absl::string_view input, std::u16string *output) {
+  output->clear();
+  output->reserve(input.size());
+  const char *begin = input.data();
+  const char *end = input.data() + input.size();
+  while (begin < end) {
+    size_t mblen;
+    const char32 c = DecodeUTF8(begin, end, &mblen);
+    begin += mblen;
+    if (c < 0x10000) {
+      output->push_back(static_cast<char16_t>(c));
+    } else {
+      output->push_back(static_cast<char16_t>(0xD800 + ((c - 0x10000) >> 10)));
+      output->push_back(static_cast<char16_t>(0xDC00 + (c & 0x3FF)));
+    }
+  }
+}
 }  // namespace string_util
 
 namespace random {
+uint64 SplitMix64(uint64 seed, uint64 index) {
+  uint64 z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+uint32 GetStreamSeed(uint64 seed, uint64 index) {
+  const uint64 z = SplitMix64(seed, index);
+  return static_cast<uint32>(z ^ (z >> 32));
+}
+
+void CounterGenerator::Fill(float *values, size_t size) {
+  // The top 24 bits fill the mantissa, so 1.0 is never returned.
+  constexpr float kScale = 1.0 / (1 << 24);
+  for (size_t i = 0; i < size; ++i) {
+    values[i] = (SplitMix64(key_, counter_ + i) >> 40) * kScale;
+  }
+  counter_ += size;
+}
+
 #ifdef SPM_NO_THREADLOCAL
 namespace {
 class RandomGeneratorStorage {
@@ -274,6 +492,347 @@ std::wstring Utf8ToWide(absl::string_view input) {
 #endif
 }  // namespace util
 
+namespace {
+// Options of SetThreadOptions(). Leaked, as the workers may read them at
+// exit.
+struct ThreadOptions {
+  std::mutex mutex;
+  int32 num_threads = 0;
+  std::vector<int> cpus;
+};
+
+ThreadOptions *GetThreadOptions() {
+  static auto *options = new ThreadOptions;
+  return options;
+}
+
+std::atomic<ThreadPool *> g_shared_thread_pool = nullptr;
+
+// Returns the contents of the small file `filename`, e.g., of sysfs, or an
+// empty string.
+std::string ReadSmallFile(const std::string &filename) {
+  std::ifstream input(filename);
+  std::string contents;
+  std::getline(input, contents, '\0');
+  return contents;
+}
+
+#if defined(__linux__)
+// Returns the CPUs of the quota "<quota> <period>" of cgroup v2, or of the
+// files of cgroup v1, or 0 if unlimited.
+double ParseCpuQuota(const std::string &quota, const std::string &period) {
+  double value = 0.0, period_value = 0.0;
+  if (!absl::SimpleAtoi(quota, &value) ||
+      !absl::SimpleAtoi(period, &period_value) || value <= 0.0 ||
+      period_value <= 0.0) {
+    return 0.0;
+  }
+  return value / period_value;
+}
+
+// Returns the CPU quota of the cgroup of the process, and of its ancestors,
+// in CPUs, or 0 if unlimited.
+double GetCgroupCpuQuota() {
+  double quota = 0.0;
+  auto bound = [&quota](double cpus) {
+    if (cpus > 0.0 && (quota == 0.0 || cpus < quota)) quota = cpus;
+  };
+  const std::string cgroups = ReadSmallFile("/proc/self/cgroup");
+  for (const auto line : absl::StrSplit(cgroups, '\n')) {
+    const std::vector<std::string> fields =
+        absl::StrSplit(line, ':', absl::AllowEmpty());
+    if (fields.size() != 3) continue;
+    std::string path = fields[2];
+    if (fields[0] == "0" && fields[1].empty()) {
+      // cgroup v2: "<quota> <period>", or "max <period>", in cpu.max.
+      while (true) {
+        const std::string max =
+            ReadSmallFile(absl::StrCat("/sys/fs/cgroup", path, "/cpu.max"));
+        const std::vector<std::string> values = absl::StrSplit(max, " \n");
+        if (values.size() == 2) bound(ParseCpuQuota(values[0], values[1]));
+        if (path.empty() || path == "/") break;
+        path.resize(path.rfind('/'));
+      }
+    } else if (fields[1].find("cpu") != std::string::npos) {
+      // cgroup v1: cpu.cfs_quota_us is -1 if unlimited.
+      for (const std::string &dir :
+           {absl::StrCat("/sys/fs/cgroup/cpu", path),
+            std::string("/sys/fs/cgroup/cpu")}) {
+        bound(ParseCpuQuota(ReadSmallFile(dir + "/cpu.cfs_quota_us"),
+                            ReadSmallFile(dir + "/cpu.cfs_period_us")));
+      }
+    }
+  }
+  return quota;
+}
+#endif  // __linux__
+
+// Pins the calling thread to `cpus`, if any. The CPUs the process may not
+// run on are left to the kernel, which fails if there is none of `cpus`.
+void SetThreadAffinity(const std::vector<int> &cpus) {
+#if defined(__linux__)
+  if (cpus.empty()) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+}  // namespace
+
+bool ParseCpuList(absl::string_view list, std::vector<int> *cpus) {
+  cpus->clear();
+  const std::vector<std::string> ranges = absl::StrSplit(list, ", \n");
+  for (const auto &range : ranges) {
+    const std::vector<std::string> ends =
+        absl::StrSplit(range, '-', absl::AllowEmpty());
+    int begin = 0, end = 0;
+    if (ends.empty() || ends.size() > 2 ||
+        !absl::SimpleAtoi(ends[0], &begin) ||
+        !absl::SimpleAtoi(ends.back(), &end) || begin < 0 || end < begin) {
+      return false;
+    }
+    for (int cpu = begin; cpu <= end; ++cpu) cpus->push_back(cpu);
+  }
+  return true;
+}
+
+int32 GetAvailableCpus() {
+  static const int32 available = []() {
+    int32 cpus = std::max<int32>(1, std::thread::hardware_concurrency());
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      cpus = std::max(1, CPU_COUNT(&set));
+    }
+    const double quota = GetCgroupCpuQuota();
+    if (quota > 0.0) {
+      cpus = std::min<int32>(cpus, std::max(1.0, std::ceil(quota)));
+    }
+#endif
+    return cpus;
+  }();
+  return available;
+}
+
+util::Status SetThreadOptions(int num_threads, absl::string_view cpus) {
+  if (num_threads < 0 || num_threads > 1024) {
+    return util::StatusBuilder(util::StatusCode::kInvalidArgument, GTL_LOC)
+           << "num_threads must be in [0, 1024]: " << num_threads;
+  }
+  std::vector<int> cpu_list;
+  if (!cpus.empty()) {
+#if defined(__linux__)
+    std::string list(cpus);
+    if (absl::ConsumePrefix(&cpus, "node:")) {
+      int node = 0;
+      if (!absl::SimpleAtoi(std::string(cpus), &node) || node < 0) {
+        return util::StatusBuilder(util::StatusCode::kInvalidArgument,
+                                   GTL_LOC)
+               << "invalid NUMA node: " << cpus;
+      }
+      list = ReadSmallFile(absl::StrCat("/sys/devices/system/node/node", node,
+                                        "/cpulist"));
+    }
+    if (!ParseCpuList(list, &cpu_list) || cpu_list.empty()) {
+      return util::StatusBuilder(util::StatusCode::kInvalidArgument, GTL_LOC)
+             << "invalid or empty CPU list: " << cpus;
+    }
+#else
+    return util::StatusBuilder(util::StatusCode::kUnimplemented, GTL_LOC)
+           << "CPU affinity is not supported on this platform.";
+#endif
+  }
+
+  auto *options = GetThreadOptions();
+  std::lock_guard<std::mutex> lock(options->mutex);
+  if (g_shared_thread_pool.load(std::memory_order_acquire) != nullptr &&
+      (num_threads != options->num_threads || cpu_list != options->cpus)) {
+    return util::StatusBuilder(util::StatusCode::kFailedPrecondition, GTL_LOC)
+           << "SetThreadOptions() must be called before the shared thread "
+              "pool is used.";
+  }
+  options->num_threads = num_threads;
+  options->cpus = std::move(cpu_list);
+  return util::OkStatus();
+}
+
+int GetNumThreads() {
+  auto *options = GetThreadOptions();
+  std::lock_guard<std::mutex> lock(options->mutex);
+  return options->num_threads > 0 ? options->num_threads
+                                  : std::min<int32>(GetAvailableCpus(), 256);
+}
+
+void ScheduleOnSharedThreadPool(std::function<void()> closure) {
+  GetSharedThreadPool()->Schedule(std::move(closure));
+}
+
+ThreadPool::ThreadPool(int32 n) : ThreadPool(n, n) {}
+
+ThreadPool::ThreadPool(int32 n, int32 max_workers)
+    : num_threads_(std::max<int32>(1, n)) {
+  const int32 num_workers =
+      std::max<int32>(1, std::min(num_threads_, max_workers));
+  // Keeps a few tasks per worker in flight so that the producer
+  // is not blocked on every Schedule() call.
+  max_queue_size_ = 4 * num_workers;
+  std::vector<int> cpus;
+  {
+    auto *options = GetThreadOptions();
+    std::lock_guard<std::mutex> lock(options->mutex);
+    cpus = options->cpus;
+  }
+  workers_.reserve(num_workers);
+  for (int32 i = 0; i < num_workers; ++i) {
+    workers_.emplace_back([this, cpus]() {
+      SetThreadAffinity(cpus);
+      WorkerLoop();
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_available_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> closure) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_not_full_.wait(lock,
+                         [this]() { return queue_.size() < max_queue_size_; });
+    queue_.emplace_back(std::move(closure));
+    ++num_pending_;
+  }
+  task_available_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  task_done_.wait(lock, [this]() { return num_pending_ == 0; });
+}
+
+void ThreadPool::ParallelFor(
+    size_t size, size_t grain,
+    const std::function<void(int thread_id, size_t begin, size_t end)> &fn) {
+  ParallelFor(size, grain, num_threads(), fn);
+}
+
+void ThreadPool::ParallelFor(
+    size_t size, size_t grain, int max_tasks,
+    const std::function<void(int thread_id, size_t begin, size_t end)> &fn) {
+  if (size == 0) return;
+  grain = std::max<size_t>(1, grain);
+  const size_t num_chunks = (size + grain - 1) / grain;
+  const int num_tasks = static_cast<int>(std::min<size_t>(
+      {static_cast<size_t>(num_threads()),
+       static_cast<size_t>(std::max(1, max_tasks)), num_chunks}));
+  if (num_tasks == 1) {
+    fn(0, 0, size);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::mutex mutex;
+  std::condition_variable done;
+  int num_running = num_tasks;
+  for (int n = 0; n < num_tasks; ++n) {
+    Schedule([&, n]() {
+      size_t begin = 0;
+      while ((begin = next.fetch_add(grain)) < size) {
+        fn(n, begin, std::min(begin + grain, size));
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--num_running == 0) done.notify_all();
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&num_running]() { return num_running == 0; });
+}
+
+void ThreadPool::ParallelForShards(
+    size_t size,
+    const std::function<void(int shard, size_t begin, size_t end)> &fn) {
+  const size_t num_shards = num_threads();
+  std::vector<size_t> bounds(num_shards + 1);
+  for (size_t shard = 0; shard <= num_shards; ++shard) {
+    bounds[shard] = size * shard / num_shards;
+  }
+  ParallelForShards(bounds, fn);
+}
+
+void ThreadPool::ParallelForShards(
+    const std::vector<size_t> &bounds,
+    const std::function<void(int shard, size_t begin, size_t end)> &fn) {
+  if (bounds.size() < 2) return;
+  ParallelFor(bounds.size() - 1, 1, [&](int, size_t begin, size_t end) {
+    for (size_t shard = begin; shard < end; ++shard) {
+      fn(static_cast<int>(shard), bounds[shard], bounds[shard + 1]);
+    }
+  });
+}
+
+namespace {
+// The pool of the running worker thread, or null.
+thread_local const ThreadPool *g_current_thread_pool = nullptr;
+}  // namespace
+
+bool ThreadPool::IsWorkerThread() const {
+  return g_current_thread_pool == this;
+}
+
+void ThreadPool::WorkerLoop() {
+  g_current_thread_pool = this;
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_available_.wait(lock,
+                           [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;  // stop_ is set.
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    queue_not_full_.notify_one();
+    task();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_pending_ == 0) task_done_.notify_all();
+    }
+  }
+}
+
+ThreadPool *GetSharedThreadPool() {
+  ThreadPool *pool = g_shared_thread_pool.load(std::memory_order_acquire);
+  if (pool != nullptr) return pool;
+  auto *created = new ThreadPool(GetNumThreads());
+  if (!g_shared_thread_pool.compare_exchange_strong(
+          pool, created, std::memory_order_acq_rel)) {
+    delete created;  // Another thread created the pool first.
+    return pool;
+  }
+#if !defined(_WIN32)
+  // The child of fork() has none of the workers of the parent. It leaks the
+  // pool of the parent, whose workers cannot be joined, and creates its own
+  // on first use.
+  static const int registered = pthread_atfork(nullptr, nullptr, []() {
+    g_shared_thread_pool.store(nullptr, std::memory_order_release);
+  });
+  (void)registered;
+#endif
+  return created;
+}
+
 namespace log_domain {
 double LogSum(const std::vector<double> &xs) {
   if (xs.empty()) {
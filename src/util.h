@@ -19,11 +19,15 @@
 #include <string.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -162,6 +166,19 @@ inline bool IsValidCodepoint(char32 c) {
 
 bool IsStructurallyValid(absl::string_view str);
 
+// Returns the length of the leading run of ASCII bytes of `str`. The bytes
+// are tested 16 or 32 at a time, with the widest vectors the CPU supports.
+size_t ASCIIPrefixLength(absl::string_view str);
+
+// Returns the number of characters of `str` split with OneCharLen(), where
+// the last one is cut at the end of `str`.
+size_t CountChars(absl::string_view str);
+
+// Resizes `offsets` to `str.size() + 1` and sets (*offsets)[i] to the index
+// of the character, split as CountChars() does, covering the i-th byte.
+// (*offsets)[str.size()] is the number of characters.
+void ByteToCharOffsets(absl::string_view str, std::vector<int> *offsets);
+
 using UnicodeText = std::vector<char32>;
 
 char32 DecodeUTF8(const char *begin, const char *end, size_t *mblen);
@@ -181,8 +198,25 @@ std::string UnicodeCharToUTF8(const char32 c);
 
 UnicodeText UTF8ToUnicodeText(absl::string_view utf8);
 
+// Same as above, but stores the characters into `output`, reusing its
+// capacity.
+void UTF8ToUnicodeText(absl::string_view utf8, UnicodeText *output);
+
 std::string UnicodeTextToUTF8(const UnicodeText &utext);
 
+// Transcodes the UTF-16 `input` into the UTF-8 `output`, where an unpaired
+// surrogate becomes U+FFFD. With `units`, also resizes it to
+// `output->size() + 1` and sets (*units)[i] to the offset in `input` of the
+// character covering the i-th byte, so that a byte offset of `output` maps
+// to a code unit offset without another pass. (*units)[output->size()] is
+// `input.size()`.
+void UTF16ToUTF8(std::u16string_view input, std::string *output,
+                 std::vector<uint32> *units);
+
+// Transcodes the UTF-8 `input` into the UTF-16 `output`, where the invalid
+// bytes become U+FFFD as DecodeUTF8() makes them.
+void UTF8ToUTF16(absl::string_view input, std::u16string *output);
+
 }  // namespace string_util
 
 // other map/ptr utilties
@@ -282,12 +316,47 @@ inline uint64 FingerprintCat(uint64 x, uint64 y) {
   return y;
 }
 
+// Returns a fingerprint of `data`, e.g., to detect a corrupted file. It is
+// not a cryptographic hash.
+inline uint64 Fingerprint(absl::string_view data) {
+  uint64 fp = data.size();
+  for (size_t i = 0; i < data.size(); i += sizeof(uint64)) {
+    uint64 chunk = 0;
+    memcpy(&chunk, data.data() + i, std::min(sizeof(uint64), data.size() - i));
+    fp = FingerprintCat(fp, chunk);
+  }
+  return fp;
+}
+
 }  // namespace port
 
 namespace random {
 
 std::mt19937 *GetRandomGenerator();
 
+// Returns the `index`-th output of SplitMix64 started from `seed`.
+uint64 SplitMix64(uint64 seed, uint64 index);
+
+// Returns the seed of the `index`-th random stream derived from `seed`.
+// It is a SplitMix64 hash of both, so consecutive indices give unrelated
+// streams, and an item can be sampled on any thread in any order.
+uint32 GetStreamSeed(uint64 seed, uint64 index);
+
+// Counter-based random generator. The i-th number is a SplitMix64 hash of
+// the key and i, so the numbers do not depend on each other, and a block of
+// them is computed by a loop the compiler can vectorize.
+class CounterGenerator {
+ public:
+  explicit CounterGenerator(uint64 key) : key_(key) {}
+
+  // Fills `values` with the next `size` uniform numbers in [0, 1).
+  void Fill(float *values, size_t size);
+
+ private:
+  uint64 key_ = 0;
+  uint64 counter_ = 0;
+};
+
 template <typename T>
 class ReservoirSampler {
  public:
@@ -297,22 +366,71 @@ class ReservoirSampler {
       : sampled_(sampled), size_(size), engine_(seed) {}
   virtual ~ReservoirSampler() {}
 
-  void Add(const T &item) {
+  void Add(const T &item) { AddItem(item); }
+  void Add(T &&item) { AddItem(std::move(item)); }
+
+  // Adds an item of another type which T is constructible from, e.g., a
+  // string_view to a sampler of std::string. It is only converted to T
+  // when it is sampled.
+  template <typename U>
+  void Add(const U &item) {
+    AddItem(item);
+  }
+
+  // Merges the sample of `other`, drawn from another part of the stream,
+  // into this sample. The result is a uniform sample of both parts as if
+  // all the items were added to this sampler. `other` is emptied.
+  void Merge(ReservoirSampler *other) {
+    uint64 this_total = total_;
+    uint64 other_total = other->total_;
+    const uint64 size = std::min(size_, this_total + other_total);
+
+    // Drawing from the back of a shuffled sample is a uniform draw without
+    // replacement from that part of the stream.
+    std::shuffle(sampled_->begin(), sampled_->end(), engine_);
+    std::shuffle(other->sampled_->begin(), other->sampled_->end(), engine_);
+
+    std::vector<T> merged;
+    merged.reserve(size);
+    while (merged.size() < size) {
+      // Takes the next item from a part with the probability proportional
+      // to the number of its items not drawn yet.
+      std::uniform_int_distribution<uint64> dist(
+          0, this_total + other_total - 1);
+      std::vector<T> *from = sampled_;
+      if (dist(engine_) < this_total) {
+        --this_total;
+      } else {
+        from = other->sampled_;
+        --other_total;
+      }
+      merged.push_back(std::move(from->back()));
+      from->pop_back();
+    }
+
+    sampled_->swap(merged);
+    total_ += other->total_;
+    other->sampled_->clear();
+    other->total_ = 0;
+  }
+
+  uint64 total_size() const { return total_; }
+
+ private:
+  template <typename U>
+  void AddItem(U &&item) {
     if (size_ == 0) return;
 
     ++total_;
     if (sampled_->size() < size_) {
-      sampled_->push_back(item);
+      sampled_->emplace_back(std::forward<U>(item));
     } else {
       std::uniform_int_distribution<uint64> dist(0, total_ - 1);
       const uint64 n = dist(engine_);
-      if (n < sampled_->size()) (*sampled_)[n] = item;
+      if (n < sampled_->size()) (*sampled_)[n] = T(std::forward<U>(item));
     }
   }
 
-  uint64 total_size() const { return total_; }
-
- private:
   std::vector<T> *sampled_ = nullptr;
   uint64 size_ = 0;
   uint64 total_ = 0;
@@ -417,22 +535,170 @@ void STLDeleteElements(std::vector<T *> *vec) {
 }
 }  // namespace port
 
+// A fixed-size pool of long-lived worker threads fed from a bounded task
+// queue. Schedule() blocks while the queue is full. Wait() blocks until all
+// the tasks scheduled so far are finished, so one pool can be reused across
+// several parallel phases (e.g., EM iterations) without re-spawning threads.
+// The destructor waits for the pending tasks and joins the workers.
 class ThreadPool {
  public:
-  ThreadPool(int32 n) {}
-  virtual ~ThreadPool() {
-    for (auto &task : tasks_) {
-      task.join();
-    }
-  }
-
-  void Schedule(std::function<void()> closure) { tasks_.emplace_back(closure); }
+  explicit ThreadPool(int32 n);
+
+  // Same as above, but runs the tasks of the `n` threads on `max_workers`
+  // workers at most, e.g., so that the shards of `n` threads, and hence the
+  // results, are the same on fewer CPUs. The tasks must not wait for each
+  // other.
+  ThreadPool(int32 n, int32 max_workers);
+
+  virtual ~ThreadPool();
+
+  // Returns the number of the threads, which are the shards of
+  // ParallelForShards() and the thread ids of ParallelFor().
+  int32 num_threads() const { return num_threads_; }
+
+  // Enqueues `closure`. Blocks when the queue is full.
+  void Schedule(std::function<void()> closure);
+
+  // Blocks until all the scheduled tasks are finished.
+  void Wait();
+
+  // Runs `fn(thread_id, begin, end)` over the range [0, size) and blocks
+  // until it is done. The range is split into chunks of `grain` items which
+  // the workers claim dynamically, so a few expensive items do not leave one
+  // thread as a straggler. `thread_id` is in [0, num_threads()) and is unique
+  // among the concurrently running calls, which lets the caller keep
+  // per-thread scratch state (e.g., Lattice, accumulators) across chunks.
+  // Must not be called from a task running on this pool.
+  // Only waits for the chunks of this call, so several threads can share one
+  // pool.
+  void ParallelFor(size_t size, size_t grain,
+                   const std::function<void(int thread_id, size_t begin,
+                                            size_t end)> &fn);
+
+  // Same as above, but runs at most `max_tasks` chunks at a time, e.g., to
+  // honor the number of threads a caller of a shared pool asks for.
+  void ParallelFor(size_t size, size_t grain, int max_tasks,
+                   const std::function<void(int thread_id, size_t begin,
+                                            size_t end)> &fn);
+
+  // Splits the range [0, size) into num_threads() contiguous shards and runs
+  // `fn(shard, begin, end)` on each of them in parallel. Unlike ParallelFor(),
+  // the range of a shard only depends on `size` and num_threads(), so
+  // floating point sums accumulated per shard are the same in every run.
+  // `shard` is in [0, num_threads()) and can also index per-thread state.
+  void ParallelForShards(
+      size_t size,
+      const std::function<void(int shard, size_t begin, size_t end)> &fn);
+
+  // Same as above, but the k-th shard is [bounds[k], bounds[k + 1]), e.g.,
+  // to balance the shards by the bytes of their items rather than by their
+  // number. `bounds` has num_threads() + 1 entries at most.
+  void ParallelForShards(
+      const std::vector<size_t> &bounds,
+      const std::function<void(int shard, size_t begin, size_t end)> &fn);
+
+  // Returns true if the calling thread is a worker of this pool, which must
+  // not call ParallelFor() of the pool.
+  bool IsWorkerThread() const;
+
+  // Workers are started in the constructor. Kept for compatibility.
   void StartWorkers() {}
 
  private:
-  std::vector<std::thread> tasks_;
+  void WorkerLoop();
+
+  int32 num_threads_ = 0;
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> queue_;
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::condition_variable task_done_;
+  std::condition_variable queue_not_full_;
+  size_t max_queue_size_ = 0;
+  int64 num_pending_ = 0;  // queued + running tasks.
+  bool stop_ = false;
 };
 
+// Returns a process-wide pool with GetNumThreads() workers, created on
+// first use, so that short batch requests do not pay the thread creation
+// cost. Intentionally leaked to avoid joining the workers at exit. A child
+// process of fork() creates its own pool on first use.
+ThreadPool *GetSharedThreadPool();
+
+// Returns the number of the CPUs the process may run on: the CPUs of its
+// affinity mask, bounded by the CPU quota of its cgroup, and at least 1.
+int32 GetAvailableCpus();
+
+// Parses a CPU list as in sysfs, e.g., "0-3,8-11", into `cpus`. Returns
+// false if it is malformed.
+bool ParseCpuList(absl::string_view list, std::vector<int> *cpus);
+
+// Runs a pipeline over the batches of an input, e.g., of the lines of a
+// file: this thread fills the batches with `read`, the workers of `pool`
+// run `process` on them, and a writer thread passes them to `write` in the
+// order of `read`. At most `max_batches` batches are in flight, and they
+// are reused. `read` returns false when there is no more input, and the
+// batch it was given is dropped.
+template <typename Batch>
+void RunOrderedPipeline(ThreadPool *pool, int max_batches,
+                        const std::function<bool(Batch *batch)> &read,
+                        const std::function<void(Batch *batch)> &process,
+                        const std::function<void(Batch *batch)> &write) {
+  struct Slot {
+    Batch batch;
+    bool in_flight = false;
+    bool processed = false;
+  };
+  std::vector<Slot> slots(std::max(max_batches, 1));
+  std::mutex mutex;
+  std::condition_variable cv;
+  int64 num_batches = -1;  // Set when all the input is read.
+
+  std::thread writer([&]() {
+    for (int64 next = 0;; ++next) {
+      Slot &slot = slots[next % slots.size()];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return slot.processed || next == num_batches; });
+        if (!slot.processed) return;
+      }
+      write(&slot.batch);
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.processed = false;
+      slot.in_flight = false;
+      cv.notify_all();
+    }
+  });
+
+  int64 seq = 0;
+  while (true) {
+    Slot *slot = &slots[seq % slots.size()];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return !slot->in_flight; });
+    }
+    if (!read(&slot->batch)) break;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot->in_flight = true;
+    }
+    pool->Schedule([&, slot]() {
+      process(&slot->batch);
+      std::lock_guard<std::mutex> lock(mutex);
+      slot->processed = true;
+      cv.notify_all();
+    });
+    ++seq;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    num_batches = seq;
+    cv.notify_all();
+  }
+  writer.join();
+}
+
 namespace log_domain {
 
 double LogSum(const std::vector<double> &xs);
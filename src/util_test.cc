@@ -12,7 +12,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "filesystem.h"
 #include "testharness.h"
@@ -297,6 +312,105 @@ TEST(UtilTest, UnicodeTextToUTF8Test) {
   EXPECT_EQ("これはtest", string_util::UnicodeTextToUTF8(ut));
 }
 
+TEST(UtilTest, UTF16Test) {
+  std::string utf8;
+  std::vector<uint32> units;
+  std::u16string utf16;
+
+  // "aテ😀" has 1, 1 and 2 code units, and 1, 3 and 4 bytes.
+  string_util::UTF16ToUTF8(u"a\u30C6\U0001F600", &utf8, &units);
+  EXPECT_EQ("aテ😀", utf8);
+  EXPECT_EQ(std::vector<uint32>({0, 1, 1, 1, 2, 2, 2, 2, 4}), units);
+  string_util::UTF8ToUTF16(utf8, &utf16);
+  EXPECT_EQ(u"a\u30C6\U0001F600", utf16);
+
+  // Unpaired surrogates.
+  string_util::UTF16ToUTF8(std::u16string({u'a', 0xD800, u'b', 0xDC00}),
+                           &utf8, nullptr);
+  EXPECT_EQ("a\xEF\xBF\xBD" "b\xEF\xBF\xBD", utf8);
+
+  string_util::UTF16ToUTF8(u"", &utf8, &units);
+  EXPECT_TRUE(utf8.empty());
+  EXPECT_EQ(std::vector<uint32>({0}), units);
+}
+
+TEST(UtilTest, ASCIIPrefixLengthTest) {
+  EXPECT_EQ(0, string_util::ASCIIPrefixLength(""));
+  EXPECT_EQ(4, string_util::ASCIIPrefixLength("abcd"));
+  EXPECT_EQ(2, string_util::ASCIIPrefixLength("ab\xc3\x81"));
+  EXPECT_EQ(0, string_util::ASCIIPrefixLength("\x80"));
+  EXPECT_EQ(3, string_util::ASCIIPrefixLength(absl::string_view("a\0c", 3)));
+  // Across the 8, 16 and 32 bytes wide chunks.
+  for (int size = 1; size <= 80; ++size) {
+    for (int pos = 0; pos <= size; ++pos) {
+      std::string str(size, 'a');
+      if (pos < size) str[pos] = '\xff';
+      EXPECT_EQ(pos, string_util::ASCIIPrefixLength(str));
+    }
+  }
+}
+
+TEST(UtilTest, UTF8KernelsTest) {
+  // The character walks the kernels replace.
+  auto count_chars = [](absl::string_view str) {
+    size_t num_chars = 0;
+    while (!str.empty()) {
+      str.remove_prefix(
+          std::min<size_t>(string_util::OneCharLen(str.data()), str.size()));
+      ++num_chars;
+    }
+    return num_chars;
+  };
+  auto decode = [](absl::string_view str) {
+    string_util::UnicodeText uc;
+    while (!str.empty()) {
+      size_t mblen = 0;
+      uc.push_back(string_util::DecodeUTF8(str, &mblen));
+      str.remove_prefix(mblen);
+    }
+    return uc;
+  };
+  auto is_valid = [](absl::string_view str) {
+    while (!str.empty()) {
+      size_t mblen = 0;
+      const char32 c = string_util::DecodeUTF8(str, &mblen);
+      if (c == kUnicodeError && mblen != 3) return false;
+      str.remove_prefix(mblen);
+    }
+    return true;
+  };
+
+  const std::vector<std::string> kFragments = {
+      "a", "bcdefghijklmnopqrstu", std::string(1, '\0'), "\x80", "\xc3",
+      "\xc3\xa9", "\xe3\x81", "\xe3\x81\x82", "\xf0\x9f\x98\x80", "\xf0",
+      "\xed\xa0\x80"};
+  std::vector<int> offsets;
+  string_util::UnicodeText uc;
+  for (int i = 0; i < 2000; ++i) {
+    std::string str;
+    const int size = rand() % 30;
+    for (int j = 0; j < size; ++j) {
+      str += kFragments[rand() % kFragments.size()];
+    }
+
+    EXPECT_EQ(count_chars(str), string_util::CountChars(str));
+    EXPECT_EQ(is_valid(str), string_util::IsStructurallyValid(str));
+    string_util::UTF8ToUnicodeText(str, &uc);
+    EXPECT_EQ(decode(str), uc);
+
+    string_util::ByteToCharOffsets(str, &offsets);
+    std::vector<int> expected;
+    for (size_t pos = 0; pos < str.size();) {
+      const size_t mblen = std::min<size_t>(
+          string_util::OneCharLen(str.data() + pos), str.size() - pos);
+      expected.insert(expected.end(), mblen, count_chars(str.substr(0, pos)));
+      pos += mblen;
+    }
+    expected.push_back(count_chars(str));
+    EXPECT_EQ(expected, offsets);
+  }
+}
+
 TEST(UtilTest, MapUtilTest) {
   const std::map<std::string, std::string> kMap = {
       {"a", "A"}, {"b", "B"}, {"c", "C"}};
@@ -424,6 +538,255 @@ TEST(UtilTest, ReservoirSamplerTest) {
   EXPECT_EQ(10000, sampler.total_size());
 }
 
+TEST(UtilTest, CounterGeneratorTest) {
+  std::vector<float> expected(1000), actual(1000);
+  random::CounterGenerator gen(1234);
+  gen.Fill(expected.data(), expected.size());
+  double sum = 0.0;
+  for (const float v : expected) {
+    EXPECT_GE(v, 0.0);
+    EXPECT_LT(v, 1.0);
+    sum += v;
+  }
+  EXPECT_NEAR(0.5, sum / expected.size(), 0.05);
+
+  // The numbers only depend on the key and the counter.
+  random::CounterGenerator gen2(1234);
+  gen2.Fill(actual.data(), 10);
+  gen2.Fill(actual.data() + 10, actual.size() - 10);
+  EXPECT_EQ(expected, actual);
+
+  random::CounterGenerator gen3(5678);
+  gen3.Fill(actual.data(), actual.size());
+  EXPECT_NE(expected, actual);
+}
+
+TEST(UtilTest, ReservoirSamplerMergeTest) {
+  // Samples [0, 1000) and [1000, 4000) separately. The merged sample must
+  // draw about 1/4 of the items from the first part.
+  constexpr int kSize = 100;
+  int64 num_first = 0;
+  for (int trial = 0; trial < 100; ++trial) {
+    std::vector<int> sampled1, sampled2;
+    random::ReservoirSampler<int> sampler1(&sampled1, kSize, trial);
+    random::ReservoirSampler<int> sampler2(&sampled2, kSize, trial + 1000);
+    for (int i = 0; i < 1000; ++i) sampler1.Add(i);
+    for (int i = 1000; i < 4000; ++i) sampler2.Add(i);
+    sampler1.Merge(&sampler2);
+    EXPECT_EQ(kSize, sampled1.size());
+    EXPECT_EQ(4000, sampler1.total_size());
+    EXPECT_TRUE(sampled2.empty());
+    EXPECT_EQ(0, sampler2.total_size());
+    std::set<int> unique(sampled1.begin(), sampled1.end());
+    EXPECT_EQ(kSize, unique.size());
+    for (const int v : sampled1) num_first += v < 1000;
+  }
+  EXPECT_NEAR(0.25, num_first / (100.0 * kSize), 0.02);
+
+  // Merging parts smaller than the sample keeps all the items.
+  std::vector<int> sampled1, sampled2;
+  random::ReservoirSampler<int> sampler1(&sampled1, 10);
+  random::ReservoirSampler<int> sampler2(&sampled2, 10);
+  for (int i = 0; i < 3; ++i) sampler1.Add(i);
+  for (int i = 3; i < 7; ++i) sampler2.Add(i);
+  sampler1.Merge(&sampler2);
+  std::sort(sampled1.begin(), sampled1.end());
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 5, 6}), sampled1);
+  EXPECT_EQ(7, sampler1.total_size());
+}
+
+TEST(UtilTest, ThreadPoolTest) {
+  ThreadPool pool(4);
+  EXPECT_EQ(4, pool.num_threads());
+  std::atomic<int> sum(0);
+  // The pool is reusable after Wait().
+  for (int iter = 1; iter <= 3; ++iter) {
+    for (int i = 0; i < 100; ++i) {
+      pool.Schedule([&sum]() { ++sum; });
+    }
+    pool.Wait();
+    EXPECT_EQ(100 * iter, sum.load());
+  }
+
+  // The destructor finishes all the pending tasks.
+  {
+    ThreadPool pool2(0);
+    EXPECT_EQ(1, pool2.num_threads());
+    for (int i = 0; i < 10; ++i) {
+      pool2.Schedule([&sum]() { ++sum; });
+    }
+  }
+  EXPECT_EQ(310, sum.load());
+}
+
+TEST(UtilTest, ParallelForTest) {
+  ThreadPool pool(4);
+  for (const size_t grain : {1, 7, 1000}) {
+    std::vector<int> visited(1000, 0);
+    std::vector<int64> sums(pool.num_threads(), 0);
+    pool.ParallelFor(visited.size(), grain,
+                     [&](int n, size_t begin, size_t end) {
+                       EXPECT_LE(end - begin, grain);
+                       for (size_t i = begin; i < end; ++i) {
+                         ++visited[i];
+                         sums[n] += i;
+                       }
+                     });
+    for (const int v : visited) EXPECT_EQ(1, v);
+    EXPECT_EQ(999 * 1000 / 2, std::accumulate(sums.begin(), sums.end(), 0));
+  }
+
+  // Empty range.
+  pool.ParallelFor(0, 10, [](int n, size_t begin, size_t end) {
+    LOG(FATAL) << "must not be called";
+  });
+}
+
+TEST(UtilTest, ParallelForMaxTasksTest) {
+  ThreadPool pool(4);
+  std::atomic<int> running(0), max_running(0);
+  std::vector<int> visited(100, 0);
+  pool.ParallelFor(visited.size(), 1, 2, [&](int n, size_t begin, size_t end) {
+    EXPECT_LT(n, 2);
+    const int r = ++running;
+    int m = max_running.load();
+    while (r > m && !max_running.compare_exchange_weak(m, r)) {
+    }
+    for (size_t i = begin; i < end; ++i) ++visited[i];
+    --running;
+  });
+  for (const int v : visited) EXPECT_EQ(1, v);
+  EXPECT_LE(max_running.load(), 2);
+
+  // Concurrent callers of a shared pool only wait for their own chunks.
+  auto *shared = GetSharedThreadPool();
+  EXPECT_EQ(shared, GetSharedThreadPool());
+  std::vector<std::thread> threads;
+  std::vector<int64> sums(4, 0);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      std::atomic<int64> sum(0);
+      shared->ParallelFor(1000, 10, 4, [&](int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) sum += i;
+      });
+      sums[t] = sum.load();
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  for (const int64 sum : sums) EXPECT_EQ(999 * 1000 / 2, sum);
+
+#if !defined(_WIN32)
+  // The child of fork() runs on its own pool, as the workers of the shared
+  // pool are not in the child.
+  const pid_t pid = fork();
+  if (pid == 0) {
+    std::atomic<int64> sum(0);
+    GetSharedThreadPool()->ParallelFor(
+        1000, 10, [&](int, size_t begin, size_t end) {
+          for (size_t i = begin; i < end; ++i) sum += i;
+        });
+    _exit(sum.load() == 999 * 1000 / 2 && GetSharedThreadPool() != shared
+              ? 0
+              : 1);
+  }
+  EXPECT_LT(0, pid);
+  int status = 0;
+  EXPECT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+#endif
+}
+
+TEST(UtilTest, ThreadOptionsTest) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-3,8", &cpus));
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8}), cpus);
+  EXPECT_TRUE(ParseCpuList("5\n", &cpus));
+  EXPECT_EQ(std::vector<int>({5}), cpus);
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+
+  EXPECT_LE(1, GetAvailableCpus());
+  EXPECT_LE(1, GetNumThreads());
+  EXPECT_FALSE(SetThreadOptions(-1).ok());
+  EXPECT_FALSE(SetThreadOptions(0, "a").ok());
+  EXPECT_FALSE(SetThreadOptions(0, "node:a").ok());
+
+#if defined(__linux__)
+  // The child of fork() has no shared pool yet, so that it may set the
+  // options.
+  const pid_t pid = fork();
+  if (pid == 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) _exit(1);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &set)) ++cpu;
+    bool ok = SetThreadOptions(3, absl::StrCat(cpu)).ok() &&
+              GetNumThreads() == 3 &&
+              GetSharedThreadPool()->num_threads() == 3;
+    // The workers only run on `cpu`.
+    std::atomic<bool> pinned(true);
+    GetSharedThreadPool()->ParallelFor(3, 1, [&](int, size_t, size_t) {
+      cpu_set_t worker_set;
+      CPU_ZERO(&worker_set);
+      if (sched_getaffinity(0, sizeof(worker_set), &worker_set) != 0 ||
+          CPU_COUNT(&worker_set) != 1 || !CPU_ISSET(cpu, &worker_set)) {
+        pinned = false;
+      }
+    });
+    // The options of the shared pool cannot change anymore.
+    ok = ok && pinned.load() && SetThreadOptions(3, absl::StrCat(cpu)).ok() &&
+         !SetThreadOptions(2).ok();
+    _exit(ok ? 0 : 1);
+  }
+  EXPECT_LT(0, pid);
+  int status = 0;
+  EXPECT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+#endif
+}
+
+TEST(UtilTest, ParallelForShardsTest) {
+  ThreadPool pool(4);
+  for (const size_t size : {0, 3, 1001}) {
+    std::vector<int> visited(size, 0);
+    std::vector<std::pair<size_t, size_t>> ranges(pool.num_threads());
+    pool.ParallelForShards(size, [&](int shard, size_t begin, size_t end) {
+      ranges[shard] = std::make_pair(begin, end);
+      for (size_t i = begin; i < end; ++i) ++visited[i];
+    });
+    for (const int v : visited) EXPECT_EQ(1, v);
+    // The shards are contiguous and fixed by the size.
+    for (int n = 0; n < pool.num_threads(); ++n) {
+      EXPECT_EQ(size * n / 4, ranges[n].first);
+      EXPECT_EQ(size * (n + 1) / 4, ranges[n].second);
+    }
+  }
+}
+
+TEST(UtilTest, ParallelForShardsWithBoundsTest) {
+  ThreadPool pool(4);
+  const std::vector<size_t> bounds = {0, 1, 1, 10, 12};
+  std::vector<int> visited(12, 0);
+  std::vector<std::pair<size_t, size_t>> ranges(pool.num_threads());
+  pool.ParallelForShards(bounds, [&](int shard, size_t begin, size_t end) {
+    ranges[shard] = std::make_pair(begin, end);
+    for (size_t i = begin; i < end; ++i) ++visited[i];
+  });
+  for (const int v : visited) EXPECT_EQ(1, v);
+  for (int n = 0; n < pool.num_threads(); ++n) {
+    EXPECT_EQ(bounds[n], ranges[n].first);
+    EXPECT_EQ(bounds[n + 1], ranges[n].second);
+  }
+  bool called = false;
+  pool.ParallelForShards(std::vector<size_t>(),
+                         [&](int, size_t, size_t) { called = true; });
+  EXPECT_FALSE(called);
+}
+
 TEST(UtilTest, StrSplitAsCSVTest) {
   {
     const auto v = util::StrSplitAsCSV("foo,bar,buz");
@@ -18,9 +18,12 @@
 namespace sentencepiece {
 namespace word {
 
-Model::Model(const ModelProto &model_proto) {
+Model::Model(const ModelProto &model_proto,
+             std::shared_ptr<const CompiledModel> compiled_model) {
   model_proto_ = &model_proto;
+  compiled_model_ = std::move(compiled_model);
   InitializePieces();
+  ReleasePieceMaps();
 }
 
 Model::~Model() {}
@@ -30,8 +33,12 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
     return {};
   }
 
+  thread_local std::vector<absl::string_view> words;
+  SplitIntoWords(normalized, false, false, &words);
+
   EncodeResult output;
-  for (const auto &w : SplitIntoWords(normalized)) {
+  output.reserve(words.size());
+  for (const auto &w : words) {
     output.emplace_back(w, PieceToId(w));
   }
 
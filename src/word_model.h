@@ -24,7 +24,9 @@ namespace word {
 // Tokenize text with whitespaces.
 class Model : public ModelInterface {
  public:
-  explicit Model(const ModelProto &model_proto);
+  // Maps the piece ids from `compiled_model` if it is given.
+  explicit Model(const ModelProto &model_proto,
+                 std::shared_ptr<const CompiledModel> compiled_model = nullptr);
   ~Model() override;
 
   EncodeResult Encode(absl::string_view normalized) const override;
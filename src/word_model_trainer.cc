@@ -14,8 +14,8 @@
 
 #include <cmath>
 #include <string>
+#include <vector>
 
-#include "third_party/absl/container/flat_hash_map.h"
 #include "third_party/absl/strings/string_view.h"
 #include "util.h"
 #include "word_model.h"
@@ -32,12 +32,8 @@ util::Status Trainer::Train() {
 
   RETURN_IF_ERROR(LoadSentences());
 
-  absl::flat_hash_map<std::string, uint64> freq;
-  for (const auto &it : sentences_) {
-    for (const auto &s : SplitIntoWords(it.first)) {
-      freq[std::string(s)] += it.second;
-    }
-  }
+  std::vector<Sentence> freq;
+  RETURN_IF_ERROR(CountWords(false, false, &freq));
 
   const int vocab_size = trainer_spec_.vocab_size() - meta_pieces_.size();
   CHECK_GE_OR_RETURN(vocab_size, 0);
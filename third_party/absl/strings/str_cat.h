@@ -16,6 +16,7 @@
 #ifndef ABSL_STRINGS_STR_CAT_H_
 #define ABSL_STRINGS_STR_CAT_H_
 
+#include <cstdint>
 #include <sstream>
 #include <string>
 
@@ -24,7 +25,7 @@
 
 namespace absl {
 
-inline std::string StrCat(int v) {
+inline std::string StrCat(int64_t v) {
   std::ostringstream os;
   os << v;
   return os.str();
@@ -34,13 +35,16 @@ inline std::string StrCat(absl::string_view str) {
   return std::string(str.data(), str.size());
 }
 
+template <typename... T>
+inline std::string StrCat(int64_t first, const T &...rest);
+
 template <typename... T>
 inline std::string StrCat(absl::string_view first, const T &...rest) {
   return StrCat(first) + StrCat(rest...);
 }
 
 template <typename... T>
-inline std::string StrCat(int first, const T &...rest) {
+inline std::string StrCat(int64_t first, const T &...rest) {
   return StrCat(first) + StrCat(rest...);
 }
 